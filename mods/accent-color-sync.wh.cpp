@@ -5,7 +5,7 @@
 // @description:fr-FR   Restaurer la fonctionnalité d'opacité des couleurs du Panneau de configuration
 // @description:es-ES   Recuperar la funcionalidad de opacidad de colores del Panel de control
 // @description:ja-JP   コントロールパネルの色の不透明度機能を復元する
-// @version             1.6
+// @version             1.6.1
 // @author              CatmanFan / Mr._Lechkar
 // @github              https://github.com/CatmanFan
 // @include             explorer.exe
@@ -129,6 +129,7 @@ Brings back the functionality of the Control Panel's "Color intensity" slider to
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -293,6 +294,116 @@ BOOL set_DWORD(std::wstring sk, std::wstring v, unsigned long data, bool del = F
         return FALSE;
     }
 }
+
+/**
+ * Holds the DWM registry key open so that several DWORD values can be read
+ * and written in one pass. Values which already hold the requested data are
+ * not rewritten.
+ */
+struct DwmKeyBatch {
+    HKEY hKey = nullptr;
+    bool changed = FALSE;
+
+    DwmKeyBatch()
+    {
+        LONG openRes = RegOpenKeyEx(HKEY_CURRENT_USER, dwmKey.c_str(), 0, KEY_QUERY_VALUE | KEY_SET_VALUE, &hKey);
+        if (openRes != ERROR_SUCCESS) {
+            Wh_Log(L"Failed to open registry key");
+            hKey = nullptr;
+        }
+    }
+
+    ~DwmKeyBatch()
+    {
+        if (hKey)
+            RegCloseKey(hKey);
+    }
+
+    DwmKeyBatch(const DwmKeyBatch&) = delete;
+    DwmKeyBatch& operator=(const DwmKeyBatch&) = delete;
+
+    /**
+     * @param v The name of the value.
+     * @param data Receives the DWORD value if it is found.
+     * @return `TRUE` if found, otherwise `FALSE`.
+     */
+    BOOL get(const std::wstring& v, DWORD& data)
+    {
+        DWORD size(sizeof(DWORD));
+        DWORD type;
+        if (!hKey)
+            return FALSE;
+
+        LONG getRes = RegQueryValueEx(hKey, v.c_str(), 0, &type, reinterpret_cast<LPBYTE>(&data), &size);
+        return getRes == ERROR_SUCCESS && type == REG_DWORD;
+    }
+
+    /**
+     * @param v The name of the value.
+     * @param data The DWORD value to write.
+     * @return `TRUE` if the value holds `data` afterwards, otherwise `FALSE`.
+     */
+    BOOL set(const std::wstring& v, DWORD data)
+    {
+        DWORD current;
+        if (!hKey)
+            return FALSE;
+        if (get(v, current) && current == data)
+            return TRUE;
+
+        LONG setRes = RegSetValueEx(hKey, v.c_str(), 0, REG_DWORD, (const BYTE*)&data, sizeof(data));
+        if (setRes != ERROR_SUCCESS) {
+            Wh_Log(L"Failed writing to registry");
+            return FALSE;
+        }
+
+        changed = TRUE;
+        return TRUE;
+    }
+};
+#pragma endregion
+
+#pragma region ----- DWM notification -----
+// Slider drags can call setColorizationBalance many times per frame, so the
+// colorization message is throttled to one per frame through this timer.
+PTP_TIMER dwmNotifyTimer = nullptr;
+std::atomic<bool> dwmNotifyPending = FALSE;
+const DWORD dwmNotifyDelayMs = 16;
+
+void postDwmColorizationChanged()
+{
+    PostMessage(FindWindow(TEXT("dwm"), nullptr), WM_DWMCOLORIZATIONCOLORCHANGED, 0, 0);
+}
+
+void CALLBACK DwmNotifyTimerCallback(PTP_CALLBACK_INSTANCE, PVOID, PTP_TIMER)
+{
+    // Cleared before posting, so that writes made after this point schedule
+    // a new message instead of being lost.
+    dwmNotifyPending = FALSE;
+    postDwmColorizationChanged();
+}
+
+/**
+ * Tells DWM to reload the colorization parameters from the registry.
+ * @param debounce Determines whether to coalesce the message with other requests made within the same frame.
+ */
+void notifyDwmColorizationChanged(bool debounce = FALSE)
+{
+    if (!debounce || !dwmNotifyTimer) {
+        postDwmColorizationChanged();
+        return;
+    }
+
+    if (dwmNotifyPending.exchange(TRUE))
+        return;
+
+    ULARGE_INTEGER dueTime;
+    dueTime.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(dwmNotifyDelayMs) * 10000);
+    FILETIME ft;
+    ft.dwLowDateTime = dueTime.LowPart;
+    ft.dwHighDateTime = dueTime.HighPart;
+    SetThreadpoolTimer(dwmNotifyTimer, &ft, 0, 0);
+}
 #pragma endregion
 
 #pragma region ----- DWM colorization calculator -----
@@ -551,14 +662,19 @@ int valueTo100(int x) { return x - intensitySliderMin / (intensitySliderMax - in
 int valueFrom100(int x) { return (x / 100) * (intensitySliderMax - intensitySliderMin) + intensitySliderMin; }
 #pragma endregion
 
-DWORD readColor()
+DWORD readColor(DwmKeyBatch& batch)
 {
-    const std::wstring value = L"ColorizationColor";
-
-    if (!exists_DWORD(dwmKey, value))
+    DWORD color;
+    if (!batch.get(L"ColorizationColor", color))
         return 0xFF000000;
     else
-        return read_DWORD(dwmKey, value);
+        return color;
+}
+
+DWORD readColor()
+{
+    DwmKeyBatch batch;
+    return readColor(batch);
 }
 
 void loadColorValues(DWORD input)
@@ -574,15 +690,15 @@ void loadColorValues(DWORD input)
  * @param a Afterglow
  * @param a Blur
  */
-void writeColorizationBalance(int c, int a, int b)
+void writeColorizationBalance(DwmKeyBatch& batch, int c, int a, int b)
 {
     if (settings.glassApp == GlassSoftware::Glass8) {
-        set_DWORD(dwmKey, balanceColor, c);
-        set_DWORD(dwmKey, balanceBlur, b);
+        batch.set(balanceColor, c);
+        batch.set(balanceBlur, b);
     } else {
-        set_DWORD(dwmKey, balanceColor, c);
-        set_DWORD(dwmKey, balanceAfterglow, a);
-        set_DWORD(dwmKey, balanceBlur, b);
+        batch.set(balanceColor, c);
+        batch.set(balanceAfterglow, a);
+        batch.set(balanceBlur, b);
     }
 }
 
@@ -639,12 +755,12 @@ int opacity = -1;
 /**
  * Writes the OpenGlass opacity value to DWM's color and afterglow values in registry.
  */
-void bruteforceOpacity()
+void bruteforceOpacity(DwmKeyBatch& batch)
 {
     if (!settings.boolSyncDWM)
         return;
 
-    argb dwm(readColor());
+    argb dwm(readColor(batch));
     argb og(dwmSettings.to_colorization_color().value);
     if (dwm.value == 0x52fadc0e) dwm.value = 0x54fadc0e; // Sun
     if (dwm.value == og.value) return;
@@ -663,18 +779,27 @@ void bruteforceOpacity()
         opacity = 0x54;
 
     DWORD New = (dwm.value & 0x00ffffff) | (opacity << 24);
-    set_DWORD(dwmKey, L"ColorizationColor", New);
-    set_DWORD(dwmKey, L"ColorizationAfterglow", New);
+    batch.set(L"ColorizationColor", New);
+    batch.set(L"ColorizationAfterglow", New);
 
     dwmSettings.color = dwmSettings.afterglow = New;
 }
 
+void bruteforceOpacity()
+{
+    DwmKeyBatch batch;
+    bruteforceOpacity(batch);
+}
+
 /**
  * Calculates the color, afterglow and blur intensity values from an integer out of 100, then writes them to the registry for use with OpenGlass.
  * @param bruteforce Determines whether to also simultaneously bruteforce the opacity value to DWM.
+ * @param debounce Determines whether to coalesce the DWM notification with other calls made within the same frame.
  */
-void setColorizationBalance(bool bruteforce = FALSE)
+void setColorizationBalance(bool bruteforce = FALSE, bool debounce = FALSE)
 {
+    DwmKeyBatch batch;
+
     // *********************************************
     // Set "og_Opacity" value.
 
@@ -682,7 +807,7 @@ void setColorizationBalance(bool bruteforce = FALSE)
         settings.opacity = 42; // 40.7853080838;
     if (opacity < 0 || opacity > 100)
         opacity = settings.opacity;
-    set_DWORD(dwmKey, opacityValue, opacity);
+    batch.set(opacityValue, opacity);
     
     // Return if the function has already been run once under a fixed opacity.
     // This is to prevent useless DWM refreshing afterward.
@@ -704,15 +829,17 @@ void setColorizationBalance(bool bruteforce = FALSE)
     // *********************************************
     // Actually do the registry editing
     // *********************************************
-    writeColorizationBalance(dwmSettings.color_balance, dwmSettings.afterglow_balance, dwmSettings.blur_balance);
+    writeColorizationBalance(batch, dwmSettings.color_balance, dwmSettings.afterglow_balance, dwmSettings.blur_balance);
     
     // Other registry values
-    set_DWORD(dwmKey, L"GlassType", 1);    // settings.boolTransparency ? 1 : 0);
+    batch.set(L"GlassType", 1);    // settings.boolTransparency ? 1 : 0);
 
     if (bruteforce)
-		bruteforceOpacity();
+		bruteforceOpacity(batch);
 
-    PostMessage(FindWindow(TEXT("dwm"), nullptr), WM_DWMCOLORIZATIONCOLORCHANGED, 0, 0);
+    // Nothing to reload if every value already matched the registry
+    if (batch.changed)
+        notifyDwmColorizationChanged(debounce);
 }
 
 #pragma region ----- DirectUI hooks -----
@@ -760,8 +887,7 @@ long THISCALL CCTrackBar_SetThumbPosition_hook(class CCTrackBar* This, int value
     // Track bar value
     if (intensitySlider > 0 && intensitySlider == ptr) {
         opacity = value;
-        set_DWORD(dwmKey, opacityValue, opacity);
-        setColorizationBalance();
+        setColorizationBalance(FALSE, TRUE);
     }
 
     return CCTrackBar_SetThumbPosition(This, value);
@@ -1041,7 +1167,8 @@ BOOL LoadSettings()
             return FALSE;
 
         opacity = settings.opacity = def;
-        writeColorizationBalance(0x08, 0x2b, 0x31);
+        DwmKeyBatch batch;
+        writeColorizationBalance(batch, 0x08, 0x2b, 0x31);
     }
 	
     loadColorValues(readColor());
@@ -1107,6 +1234,24 @@ BOOL Wh_ModInit()
         return FALSE;
     }
 
+    dwmNotifyTimer = CreateThreadpoolTimer(DwmNotifyTimerCallback, nullptr, nullptr);
+    if (!dwmNotifyTimer)
+        Wh_Log(L"Failed to create DWM notification timer");
+
     setColorizationBalance();
     return TRUE;
 }
+
+void Wh_ModUninit()
+{
+    if (dwmNotifyTimer) {
+        SetThreadpoolTimer(dwmNotifyTimer, nullptr, 0, 0);
+        WaitForThreadpoolTimerCallbacks(dwmNotifyTimer, TRUE);
+        CloseThreadpoolTimer(dwmNotifyTimer);
+        dwmNotifyTimer = nullptr;
+
+        // Deliver a message that was cancelled above
+        if (dwmNotifyPending.exchange(FALSE))
+            postDwmColorizationChanged();
+    }
+}
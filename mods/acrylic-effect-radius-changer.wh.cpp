@@ -2,7 +2,7 @@
 // @id              acrylic-effect-radius-changer
 // @name            Acrylic Effect Radius Changer
 // @description     Allows the user to change the Acrylic effect blur radius
-// @version         1.1.0
+// @version         1.2.0
 // @author          Dulappy
 // @github          https://github.com/Dulappy
 // @include         dwm.exe
@@ -54,6 +54,12 @@ You can scroll down to see some examples of different custom blur radii in actio
 - optimization: true
   $name: Optimizization
   $description: Optimizes the blur, especially for higher radii, in exchange for graphical fidelity (virtually unnoticeable)
+- adaptive: false
+  $name: Adaptive optimization
+  $description: >-
+    Blurs large surfaces at a lower resolution, and lowers it further while
+    building the blur effects takes too long. Requires optimization to be
+    enabled
 */
 // ==/WindhawkModSettings==
 
@@ -62,16 +68,72 @@ You can scroll down to see some examples of different custom blur radii in actio
 #include <dcommon.h>
 #include <windhawk_utils.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
 struct {
     int width;
     int height;
     bool optimize;
+    bool adaptive;
 } settings;
 
 void LoadSettings() {
     settings.width = Wh_GetIntSetting(L"radius.width");
     settings.height = Wh_GetIntSetting(L"radius.height");
     settings.optimize = Wh_GetIntSetting(L"optimization");
+    settings.adaptive = Wh_GetIntSetting(L"adaptive");
+}
+
+// Adaptive optimization: the blur radius passed to DetermineOutputScale is
+// scaled up with the surface area, so that large surfaces are blurred at a
+// lower resolution, and by a pressure factor which grows while the time spent
+// building blur effects is over budget.
+constexpr float kAdaptiveReferenceArea = 1920.0f * 1080.0f;
+constexpr float kAdaptiveMaxAreaFactor = 4.0f;
+constexpr float kAdaptiveMaxPressure = 4.0f;
+constexpr LONGLONG kAdaptiveBudgetUsPerSecond = 100 * 1000;
+
+// The area of the surface being built, for the DetermineOutputScale call made
+// from within BuildEffect.
+thread_local float g_blurSurfaceArea;
+
+std::atomic<float> g_adaptivePressure{1.0f};
+
+// Only updated from BuildEffect, which runs on the DWM composition thread.
+struct {
+    LARGE_INTEGER frequency;
+    LONGLONG windowStart;
+    LONGLONG elapsed;
+    int count;
+} g_blurStats;
+
+void UpdateBlurStats(LONGLONG start, LONGLONG end) {
+    g_blurStats.elapsed += end - start;
+    g_blurStats.count++;
+
+    if (end - g_blurStats.windowStart < g_blurStats.frequency.QuadPart) {
+        return;
+    }
+
+    LONGLONG elapsedUs =
+        g_blurStats.elapsed * 1000000 / g_blurStats.frequency.QuadPart;
+
+    float pressure = g_adaptivePressure;
+    if (elapsedUs > kAdaptiveBudgetUsPerSecond) {
+        pressure = std::min(pressure * 2.0f, kAdaptiveMaxPressure);
+    } else if (elapsedUs < kAdaptiveBudgetUsPerSecond / 2) {
+        pressure = std::max(pressure / 2.0f, 1.0f);
+    }
+    g_adaptivePressure = pressure;
+
+    Wh_Log(L"Built %d blur effects in %lld us over the last second, pressure %g",
+           g_blurStats.count, elapsedUs, pressure);
+
+    g_blurStats.windowStart = end;
+    g_blurStats.elapsed = 0;
+    g_blurStats.count = 0;
 }
 
 long (*CCustomBlur_BuildEffect_orig)(void* pThis, ID2D1Image* image, D2D_RECT_F*, D2D_SIZE_F*, DWORD, D2D_VECTOR_2F*, D2D_VECTOR_2F*);
@@ -79,7 +141,21 @@ long (*CCustomBlur_BuildEffect_orig)(void* pThis, ID2D1Image* image, D2D_RECT_F*
 long CCustomBlur_BuildEffect_Hook(void* pThis, ID2D1Image* image, D2D_RECT_F* blurrect, D2D_SIZE_F* blurradius, DWORD optimization, D2D_VECTOR_2F* scale, D2D_VECTOR_2F* vector2) {
     blurradius->width = (float)settings.width;
     blurradius->height = (float)settings.height;
-    return CCustomBlur_BuildEffect_orig(pThis, image, blurrect, blurradius, optimization, scale, vector2);
+
+    if (!settings.adaptive || !settings.optimize) {
+        return CCustomBlur_BuildEffect_orig(pThis, image, blurrect, blurradius, optimization, scale, vector2);
+    }
+
+    g_blurSurfaceArea = (blurrect->right - blurrect->left) * (blurrect->bottom - blurrect->top);
+
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    long result = CCustomBlur_BuildEffect_orig(pThis, image, blurrect, blurradius, optimization, scale, vector2);
+    QueryPerformanceCounter(&end);
+
+    g_blurSurfaceArea = 0;
+    UpdateBlurStats(start.QuadPart, end.QuadPart);
+    return result;
 }
 
 float (*CCustomBlur_DetermineOutputScale_orig)(float, float, DWORD);
@@ -88,6 +164,13 @@ float CCustomBlur_DetermineOutputScale_Hook(float f1, float f2, DWORD optimizati
     f1 = (float)(settings.optimize * settings.width);
     f2 = (float)(settings.optimize * settings.width);
 
+    if (settings.adaptive && settings.optimize) {
+        float radius = (float)std::max(settings.width, settings.height);
+        float areaFactor = std::clamp(std::sqrt(g_blurSurfaceArea / kAdaptiveReferenceArea),
+                                      1.0f, kAdaptiveMaxAreaFactor);
+        f1 = f2 = radius * areaFactor * g_adaptivePressure;
+    }
+
     return CCustomBlur_DetermineOutputScale_orig(f1, f2, optimization);
 }
 
@@ -99,6 +182,8 @@ BOOL Wh_ModInit() {
 
     LoadSettings();
 
+    QueryPerformanceFrequency(&g_blurStats.frequency);
+
     WindhawkUtils::SYMBOL_HOOK symbolHooks[] = {
         {
             {L"public: static float __cdecl CCustomBlur::DetermineOutputScale(float,float,enum D2D1_GAUSSIANBLUR_OPTIMIZATION)"},
@@ -127,4 +212,5 @@ void Wh_ModSettingsChanged() {
     Wh_Log(L"SettingsChanged");
 
     LoadSettings();
+    g_adaptivePressure = 1.0f;
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 // @id              aero-tray
 // @name            Aero Tray 
 // @description     Restores Windows 7/8 tray overflow
-// @version         1.0.2
+// @version         1.0.3
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         explorer.exe
@@ -399,7 +399,12 @@ void CTrayOverflow_UpdateButtonMetrics_hook(
     HWND hToolbar = CTrayOverflow_Toolbar(pThis);
     if (hToolbar)
     {
-        SendMessageW(hToolbar, TB_SETPADDING, NULL, MAKELPARAM(ICON_PADDING, ICON_PADDING));
+        /* Setting the padding relayouts the toolbar, skip it if unchanged */
+        LPARAM lPadding = MAKELPARAM(ICON_PADDING, ICON_PADDING);
+        if ((LPARAM)SendMessageW(hToolbar, TB_GETPADDING, NULL, NULL) != lPadding)
+        {
+            SendMessageW(hToolbar, TB_SETPADDING, NULL, lPadding);
+        }
     }
 }
 
@@ -417,9 +422,9 @@ LRESULT CTrayOverflow__OnPaint_hook(
     if (hdcOut)
     {
         hDC = hdcOut;
-        if (!GetClipBox(hDC, &ps.rcPaint))
+        if (GetClipBox(hDC, &ps.rcPaint) == ERROR)
         {
-            SetRectEmpty(&ps.rcPaint);
+            GetClientRect(hWnd, &ps.rcPaint);
         }
         ps.fRestore = FALSE;
     }
@@ -434,48 +439,60 @@ LRESULT CTrayOverflow__OnPaint_hook(
 
     int nAreaHeight = MulDiv(LINK_AREA_HEIGHT, GetDeviceCaps(hDC, LOGPIXELSY), 96);
 
+    /**
+      * Only draw the parts of the areas which need repainting, the flyout gets
+      * repainted often when tray icons animate.
+      */
+    RECT rcDirty;
+
     rc.top = rc.bottom - nAreaHeight;
-    if (g_hTheme)
-    {
-        DrawThemeBackground(
-            g_hTheme,
-            hDC,
-            FLYOUT_LINKAREA,
-            0,
-            &rc,
-            NULL
-        );
-    }
-    else
+    if (IntersectRect(&rcDirty, &rc, &ps.rcPaint))
     {
-        FillRect(
-            hDC,
-            &rc,
-            GetSysColorBrush(COLOR_3DFACE)
-        );
+        if (g_hTheme)
+        {
+            DrawThemeBackground(
+                g_hTheme,
+                hDC,
+                FLYOUT_LINKAREA,
+                0,
+                &rc,
+                &rcDirty
+            );
+        }
+        else
+        {
+            FillRect(
+                hDC,
+                &rcDirty,
+                GetSysColorBrush(COLOR_3DFACE)
+            );
+        }
     }
 
     rc.bottom = rc.top;
     rc.top = 0;
 
-    if (g_hTheme)
-    {
-        DrawThemeBackground(
-            g_hTheme,
-            hDC,
-            6,
-            0,
-            &rc,
-            NULL
-        );
-    }
-    else
+    if (IntersectRect(&rcDirty, &rc, &ps.rcPaint))
     {
-        FillRect(
-            hDC,
-            &rc,
-            GetSysColorBrush(COLOR_WINDOW)
-        );
+        if (g_hTheme)
+        {
+            DrawThemeBackground(
+                g_hTheme,
+                hDC,
+                6,
+                0,
+                &rc,
+                &rcDirty
+            );
+        }
+        else
+        {
+            FillRect(
+                hDC,
+                &rcDirty,
+                GetSysColorBrush(COLOR_WINDOW)
+            );
+        }
     }
 
     if (ps.fRestore)
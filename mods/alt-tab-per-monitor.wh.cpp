@@ -2,7 +2,7 @@
 // @id              alt-tab-per-monitor
 // @name            Alt+Tab per monitor
 // @description     Pressing Alt+Tab shows all open windows on the primary display. This mod shows only the windows on the monitor where the cursor is.
-// @version         1.1.0
+// @version         1.1.1
 // @author          L3r0y
 // @github          https://github.com/L3r0yThingz
 // @include         explorer.exe
@@ -41,6 +41,11 @@ std::atomic<DWORD> g_threadIdForXamlAltTabViewHost_CreateInstance;
 ULONGLONG g_CreateInstance_TickCount;
 constexpr ULONGLONG kDeltaThreshold = 200;
 
+// The monitor under the cursor when the alt tab window was created. Windows
+// are filtered against it while the window list is built, instead of querying
+// the cursor position for each window.
+std::atomic<HMONITOR> g_altTabCursorMonitor;
+
 VS_FIXEDFILEINFO* GetModuleVersionInfo(HMODULE hModule, UINT* puPtrLen) {
     void* pFixedFileInfo = nullptr;
     UINT uPtrLen = 0;
@@ -142,13 +147,24 @@ HRESULT GetWindowHandleFromApplicationView(void* applicationView,
     return hr;
 }
 
-bool IsWindowOnCursorMonitor(HWND windowHandle) {
+HMONITOR GetCursorMonitor() {
     POINT pt;
     if (!GetCursorPos(&pt)) {
-        return false;
+        return nullptr;
+    }
+
+    return MonitorFromPoint(pt, MONITOR_DEFAULTTONEAREST);
+}
+
+bool IsWindowOnCursorMonitor(HWND windowHandle) {
+    HMONITOR hMon = g_altTabCursorMonitor;
+    if (!hMon) {
+        hMon = GetCursorMonitor();
+        if (!hMon) {
+            return false;
+        }
     }
 
-    auto hMon = MonitorFromPoint(pt, MONITOR_DEFAULTTONEAREST);
     auto hMonFromWindow =
         MonitorFromWindow(windowHandle, MONITOR_DEFAULTTONEAREST);
 
@@ -287,6 +303,13 @@ HRESULT WINAPI CMultitaskingViewFrame_CreateFrame_Hook(void* pThis,
     return ret;
 }
 
+void BeginAltTabCreateInstance() {
+    g_altTabCursorMonitor = GetCursorMonitor();
+    g_threadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
+    g_lastThreadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
+    g_CreateInstance_TickCount = GetTickCount64();
+}
+
 using XamlAltTabViewHost_CreateInstance_t = HRESULT(WINAPI*)(void* pThis,
                                                              void* param1,
                                                              void* param2,
@@ -296,9 +319,7 @@ HRESULT WINAPI XamlAltTabViewHost_CreateInstance_Hook(void* pThis,
                                                       void* param1,
                                                       void* param2,
                                                       void* param3) {
-    g_threadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
-    g_lastThreadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
-    g_CreateInstance_TickCount = GetTickCount64();
+    BeginAltTabCreateInstance();
     HRESULT ret = XamlAltTabViewHost_CreateInstance_Original(pThis, param1,
                                                              param2, param3);
     g_threadIdForXamlAltTabViewHost_CreateInstance = 0;
@@ -330,9 +351,7 @@ HRESULT WINAPI CAltTabViewHost_CreateInstance_Hook(void* pThis,
                                                    void* param9,
                                                    void* param10,
                                                    void* param11) {
-    g_threadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
-    g_lastThreadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
-    g_CreateInstance_TickCount = GetTickCount64();
+    BeginAltTabCreateInstance();
     HRESULT ret = CAltTabViewHost_CreateInstance_Original(
         pThis, param1, param2, param3, param4, param5, param6, param7, param8,
         param9, param10, param11);
@@ -364,9 +383,7 @@ HRESULT WINAPI CAltTabViewHost_CreateInstance_Win11_Hook(void* pThis,
                                                          void* param8,
                                                          void* param9,
                                                          void* param10) {
-    g_threadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
-    g_lastThreadIdForXamlAltTabViewHost_CreateInstance = GetCurrentThreadId();
-    g_CreateInstance_TickCount = GetTickCount64();
+    BeginAltTabCreateInstance();
     HRESULT ret = CAltTabViewHost_CreateInstance_Win11_Original(
         pThis, param1, param2, param3, param4, param5, param6, param7, param8,
         param9, param10);
@@ -2,7 +2,7 @@
 // @id              auto-theme-switcher
 // @name            Auto Theme Switcher
 // @description     Automatically switch between light and dark appearance/wallpapers/themes based on a custom hours/sunset to sunrise with custom script support
-// @version         1.1.1
+// @version         1.1.3
 // @author          tinodin
 // @github          https://github.com/tinodin
 // @include         explorer.exe
@@ -98,7 +98,10 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+#include <algorithm>
 #include <fstream>
+#include <thread>
+#include <vector>
 #include <comdef.h>
 #include <winrt/base.h>
 #include <winrt/Windows.Devices.Geolocation.h>
@@ -109,6 +112,15 @@ using namespace winrt;
 using namespace Windows::Devices::Geolocation;
 using namespace winrt::Windows::System;
 
+// Number of days of upcoming switch times which are computed in advance.
+#define SCHEDULE_DAYS 7
+
+// How long before a switch the upcoming wallpaper is read into the file cache.
+#define PREFETCH_LEAD_TIME 60
+
+// How often the time is checked if the timer can't be armed, in milliseconds.
+#define TIMER_FALLBACK_POLL_INTERVAL 60000
+
 HANDLE g_timer = nullptr;
 HANDLE g_timerThread = nullptr;
 HANDLE g_wakeEvent = nullptr;
@@ -118,6 +130,16 @@ std::wstring g_scheduleMode;
 SYSTEMTIME g_lightTime, g_darkTime;
 double g_latitude, g_longitude;
 
+// Set for the sunrise/sunset modes, in which case the switch times are
+// computed per day from these coordinates.
+bool g_useSunTimes = false;
+double g_sunLatitude, g_sunLongitude;
+
+struct SwitchEvent {
+    time_t time;
+    bool light;
+};
+
 std::wstring g_switchMode;
 
 std::wstring g_lightWallpaperPath, g_darkWallpaperPath;
@@ -175,6 +197,14 @@ void ApplyLockScreen() {
         return;
     }
 
+    wchar_t currentLockScreen[MAX_PATH] = {0};
+    size = sizeof(currentLockScreen);
+    if (RegGetValueW(HKEY_LOCAL_MACHINE, L"SOFTWARE\\Policies\\Microsoft\\Windows\\Personalization", L"LockScreenImage", RRF_RT_REG_SZ, nullptr, currentLockScreen, &size) == ERROR_SUCCESS &&
+        _wcsicmp(currentLockScreen, currentWallpaper) == 0) {
+        Wh_Log(L"Lock screen already applied");
+        return;
+    }
+
     std::wstring wallpaperPath = currentWallpaper;
     HKEY hKey;
 
@@ -342,8 +372,66 @@ void ApplyTheme(PCWSTR themePath) {
     SendMessageTimeoutW(HWND_BROADCAST, WM_SETTINGCHANGE, 0, (LPARAM)L"ImmersiveColorSet", SMTO_ABORTIFHUNG, 100, nullptr);
 }
 
+std::wstring GetThemeWallpaper(PCWSTR themePath) {
+    std::wifstream file(themePath);
+    if (!file)
+        return L"";
+
+    std::wstring line, wallpaperInTheme;
+    bool inDesktop = false;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == L';') continue;
+        if (line[0] == L'[') {
+            inDesktop = (line == L"[Control Panel\\Desktop]");
+            continue;
+        }
+        if (inDesktop && line.find(L"Wallpaper=") == 0) {
+            wallpaperInTheme = line.substr(10);
+            break;
+        }
+    }
+
+    if (wallpaperInTheme.empty())
+        return L"";
+
+    wchar_t expanded[MAX_PATH] = {};
+    ExpandEnvironmentStringsW(wallpaperInTheme.c_str(), expanded, MAX_PATH);
+    return expanded;
+}
+
+// Reads the upcoming wallpaper ahead of the switch, so that decoding it on
+// the switch doesn't wait for a cold (possibly network) drive.
+void PrefetchWallpaper(bool useLightTheme) {
+    std::wstring wallpaperPath;
+    if (g_switchMode == L"Theme") {
+        const std::wstring& themePath = useLightTheme ? g_lightThemePath : g_darkThemePath;
+        if (!themePath.empty())
+            wallpaperPath = GetThemeWallpaper(themePath.c_str());
+    } else if (g_switchMode == L"Wallpaper") {
+        wallpaperPath = useLightTheme ? g_lightWallpaperPath : g_darkWallpaperPath;
+    }
+
+    if (wallpaperPath.empty() || IsWallpaperApplied(wallpaperPath.c_str()))
+        return;
+
+    HANDLE hFile = CreateFileW(wallpaperPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Wh_Log(L"Failed to open wallpaper for prefetching: %u", GetLastError());
+        return;
+    }
+
+    BYTE buffer[64 * 1024];
+    DWORD read;
+    while (ReadFile(hFile, buffer, sizeof(buffer), &read, nullptr) && read > 0) {
+        if (g_exitFlag) break;
+    }
+
+    CloseHandle(hFile);
+    Wh_Log(L"Prefetched wallpaper: %s", wallpaperPath.c_str());
+}
+
 void Apply(bool useLightTheme) {
-    PCWSTR wallpaperPath = useLightTheme ? g_lightWallpaperPath.c_str() : g_darkWallpaperPath.c_str();
+    const std::wstring& wallpaperPath = useLightTheme ? g_lightWallpaperPath : g_darkWallpaperPath;
     PCWSTR themePath = useLightTheme ? g_lightThemePath.c_str() : g_darkThemePath.c_str();
     bool changed = false;
 
@@ -363,51 +451,26 @@ void Apply(bool useLightTheme) {
                 CoUninitialize();
                 changed = true;
             } else {
-                wchar_t currentWallpaper[MAX_PATH] = {};
-                DWORD size = sizeof(currentWallpaper);
-                bool wallpaperMismatch = false;
-
-                if (RegGetValueW(HKEY_CURRENT_USER, L"Control Panel\\Desktop", L"WallPaper", RRF_RT_REG_SZ, nullptr, currentWallpaper, &size) == ERROR_SUCCESS) {
-                    std::wifstream file(themePath);
-                    if (file) {
-                        std::wstring line, wallpaperInTheme;
-                        bool inDesktop = false;
-                        while (std::getline(file, line)) {
-                            if (line.empty() || line[0] == L';') continue;
-                            if (line[0] == L'[') {
-                                inDesktop = (line == L"[Control Panel\\Desktop]");
-                                continue;
-                            }
-                            if (inDesktop && line.find(L"Wallpaper=") == 0) {
-                                wallpaperInTheme = line.substr(10);
-                                break;
-                            }
-                        }
-                        if (!wallpaperInTheme.empty()) {
-                            wchar_t expanded[MAX_PATH] = {};
-                            ExpandEnvironmentStringsW(wallpaperInTheme.c_str(), expanded, MAX_PATH);
-                            if (_wcsicmp(currentWallpaper, expanded) != 0) {
-                                ApplyWallpaper(expanded);
-                                changed = true;
-                                wallpaperMismatch = true;
-                            }
-                        }
-                    }
-                }
-
-                if (wallpaperMismatch)
-                {
+                std::wstring wallpaperInTheme = GetThemeWallpaper(themePath);
+                if (!wallpaperInTheme.empty() && !IsWallpaperApplied(wallpaperInTheme.c_str())) {
+                    ApplyWallpaper(wallpaperInTheme.c_str());
+                    changed = true;
                     Wh_Log(L"Successfully applied theme");
-                }
-                else {
+                } else {
                     Wh_Log(L"Theme already applied");
-                }   
+                }
             }
         }
     } else {
-        if (g_switchMode == L"Wallpaper" && *wallpaperPath) {
-            if (!IsWallpaperApplied(wallpaperPath)) {
-                ApplyWallpaper(wallpaperPath);
+        // Setting the wallpaper decodes and transcodes the image
+        // synchronously, which can take a while. It doesn't depend on the
+        // appearance, so run both concurrently.
+        std::thread wallpaperThread;
+        if (g_switchMode == L"Wallpaper" && !wallpaperPath.empty()) {
+            if (!IsWallpaperApplied(wallpaperPath.c_str())) {
+                wallpaperThread = std::thread([path = wallpaperPath]() {
+                    ApplyWallpaper(path.c_str());
+                });
                 changed = true;
             } else {
                 Wh_Log(L"Wallpaper already applied");
@@ -420,9 +483,13 @@ void Apply(bool useLightTheme) {
         } else {
             Wh_Log(L"Appearance already applied");
         }
+
+        if (wallpaperThread.joinable()) {
+            wallpaperThread.join();
+        }
     }
 
-    if (changed && Wh_GetIntSetting(L"LockScreen")) {
+    if (changed && g_lockScreen) {
         ApplyLockScreen();
     }
 
@@ -433,19 +500,75 @@ void Apply(bool useLightTheme) {
     ResetWorkingSet();
 }
 
-void ApplyCurrent() {
+SYSTEMTIME ParseScheduleTime(PCWSTR timeStr) {
+    SYSTEMTIME st = {};
+    swscanf_s(timeStr, L"%hu:%hu", &st.wHour, &st.wMinute);
+    return st;
+}
+
+void GetSunriseSunsetUtc(double latitude, double longitude, time_t day, time_t& sunrise, time_t& sunset);
+
+time_t MakeLocalTime(time_t day, const SYSTEMTIME& st) {
+    struct tm t;
+    localtime_s(&t, &day);
+    t.tm_hour = st.wHour; t.tm_min = st.wMinute; t.tm_sec = 0;
+    t.tm_isdst = -1;
+    return mktime(&t);
+}
+
+// Computes the upcoming switches for the next SCHEDULE_DAYS days, sorted by
+// time. The time zone and DST rules are taken into account per day, so the
+// result stays valid across DST transitions.
+std::vector<SwitchEvent> BuildSchedule() {
+    std::vector<SwitchEvent> schedule;
     time_t now = time(nullptr);
-    struct tm local;
-    localtime_s(&local, &now);
 
-    auto makeTime = [&](const SYSTEMTIME& st) {
-        struct tm t = local;
-        t.tm_hour = st.wHour; t.tm_min = st.wMinute; t.tm_sec = 0;
-        return mktime(&t);
-    };
+    // Start a day earlier, a local day doesn't necessarily match a UTC day.
+    for (int i = -1; i <= SCHEDULE_DAYS; i++) {
+        time_t day = now + (time_t)i * 86400;
+        time_t lightT, darkT;
+        if (g_useSunTimes) {
+            GetSunriseSunsetUtc(g_sunLatitude, g_sunLongitude, day, lightT, darkT);
+        } else {
+            lightT = MakeLocalTime(day, g_lightTime);
+            darkT = MakeLocalTime(day, g_darkTime);
+        }
+
+        if (lightT > now) schedule.push_back({ lightT, true });
+        if (darkT > now) schedule.push_back({ darkT, false });
+    }
+
+    std::sort(schedule.begin(), schedule.end(), [](const SwitchEvent& a, const SwitchEvent& b) {
+        return a.time < b.time;
+    });
+
+    // Duplicates can appear for custom hours around DST transitions.
+    schedule.erase(std::unique(schedule.begin(), schedule.end(), [](const SwitchEvent& a, const SwitchEvent& b) {
+        return a.time == b.time;
+    }), schedule.end());
+
+    return schedule;
+}
+
+// The current state is the opposite of the next switch. The switch times are
+// taken from the schedule, which is computed per day, since g_lightTime and
+// g_darkTime are only this day's times when the settings were loaded.
+void ApplyCurrent() {
+    std::vector<SwitchEvent> schedule = BuildSchedule();
+    if (!schedule.empty()) {
+        Apply(!schedule.front().light);
+        return;
+    }
 
-    time_t lightT = makeTime(g_lightTime);
-    time_t darkT = makeTime(g_darkTime);
+    // Polar day/night with no switch in the upcoming days.
+    time_t now = time(nullptr);
+    time_t lightT, darkT;
+    if (g_useSunTimes) {
+        GetSunriseSunsetUtc(g_sunLatitude, g_sunLongitude, now, lightT, darkT);
+    } else {
+        lightT = MakeLocalTime(now, g_lightTime);
+        darkT = MakeLocalTime(now, g_darkTime);
+    }
 
     bool isLightNow;
     if (lightT < darkT)
@@ -456,67 +579,167 @@ void ApplyCurrent() {
     Apply(isLightNow);
 }
 
-SYSTEMTIME ParseScheduleTime(PCWSTR timeStr) {
-    SYSTEMTIME st = {};
-    swscanf_s(timeStr, L"%hu:%hu", &st.wHour, &st.wMinute);
-    return st;
+bool ArmTimer(time_t switchTime) {
+    // Absolute due time in UTC file time units, which isn't affected by sleep
+    // or time zone changes, unlike a relative one.
+    LARGE_INTEGER dueTime;
+    dueTime.QuadPart = ((LONGLONG)switchTime * 10000000LL) + 116444736000000000LL;
+
+    if (!SetWaitableTimer(g_timer, &dueTime, 0, nullptr, nullptr, TRUE)) {
+        Wh_Log(L"SetWaitableTimer failed: %u", GetLastError());
+        return false;
+    }
+
+    return true;
 }
 
-time_t GetNextSwitch(const SYSTEMTIME& light, const SYSTEMTIME& dark, bool& nextLight) {
-    time_t now = time(nullptr);
-    struct tm local;
-    localtime_s(&local, &now);
+// Arms the timer, recreating it if needed. Returns false if the timer can't be
+// used, the due time is then polled for instead.
+bool ArmOrRecreateTimer(time_t switchTime) {
+    if (g_timer && ArmTimer(switchTime)) {
+        return true;
+    }
 
-    auto makeTime = [&](const SYSTEMTIME& st) {
-        struct tm t = local;
-        t.tm_hour = st.wHour; t.tm_min = st.wMinute; t.tm_sec = 0;
-        return mktime(&t);
-    };
+    if (g_timer) CloseHandle(g_timer);
+    g_timer = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+    if (!g_timer) {
+        Wh_Log(L"CreateWaitableTimer failed: %u", GetLastError());
+        return false;
+    }
 
-    time_t lightT = makeTime(light);
-    time_t darkT = makeTime(dark);
+    return ArmTimer(switchTime);
+}
 
-    bool isLightNow;
-    if (lightT < darkT)
-        isLightNow = now >= lightT && now < darkT;
-    else
-        isLightNow = now >= lightT || now < darkT;
+bool g_scheduleOutdated = false;
 
-    if (isLightNow) {
-        nextLight = false;
-        if (darkT <= now) darkT += 86400;
-        return darkT;
-    } else {
-        nextLight = true;
-        if (lightT <= now) lightT += 86400;
-        return lightT;
+LRESULT CALLBACK SchedulerWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+    switch (uMsg) {
+        case WM_TIMECHANGE:
+            Wh_Log(L"Time changed");
+            g_scheduleOutdated = true;
+            break;
+
+        case WM_POWERBROADCAST:
+            if (wParam == PBT_APMRESUMEAUTOMATIC) {
+                Wh_Log(L"Resumed from sleep");
+                g_scheduleOutdated = true;
+            }
+            break;
     }
+
+    return DefWindowProcW(hWnd, uMsg, wParam, lParam);
 }
 
 DWORD WINAPI ThemeScheduler(LPVOID) {
-    LARGE_INTEGER dueTime;
-    HANDLE handles[] = { g_wakeEvent, g_timer };
+    // A hidden top-level window, message-only windows don't receive the
+    // WM_TIMECHANGE and WM_POWERBROADCAST broadcasts.
+    WNDCLASSW wc = {};
+    wc.lpfnWndProc = SchedulerWndProc;
+    wc.hInstance = GetModuleHandleW(nullptr);
+    wc.lpszClassName = L"AutoThemeSwitcherScheduler_" WH_MOD_ID;
+    RegisterClassW(&wc);
+
+    HWND hWnd = CreateWindowExW(0, wc.lpszClassName, nullptr, 0, 0, 0, 0, 0, nullptr, nullptr, wc.hInstance, nullptr);
+    if (!hWnd) {
+        Wh_Log(L"CreateWindow failed: %u", GetLastError());
+    }
+
+    std::vector<SwitchEvent> schedule;
+    bool rebuild = true;
+    bool prefetched = false;
 
     while (!g_exitFlag) {
-        bool nextLight;
-        time_t nextSwitch = GetNextSwitch(g_lightTime, g_darkTime, nextLight);
-        time_t now = time(nullptr);
-        int secondsToWait = (int)(nextSwitch - now);
-        if (secondsToWait < 0) secondsToWait = 0;
+        if (rebuild || schedule.empty()) {
+            _tzset();
+            schedule = BuildSchedule();
+            rebuild = false;
+            prefetched = false;
+
+            if (!schedule.empty()) {
+                time_t next = schedule.front().time;
+                struct tm local;
+                localtime_s(&local, &next);
+                Wh_Log(L"Next switch to %s at %04d-%02d-%02d %02d:%02d:%02d",
+                    schedule.front().light ? L"light" : L"dark",
+                    local.tm_year + 1900, local.tm_mon + 1, local.tm_mday,
+                    local.tm_hour, local.tm_min, local.tm_sec);
+            }
+        }
+
+        time_t dueTime;
+        if (schedule.empty()) {
+            // Polar day/night with no switch in the upcoming days, check again
+            // in a day.
+            dueTime = time(nullptr) + 86400;
+        } else if (!prefetched && schedule.front().time - PREFETCH_LEAD_TIME > time(nullptr)) {
+            dueTime = schedule.front().time - PREFETCH_LEAD_TIME;
+        } else {
+            dueTime = schedule.front().time;
+        }
 
-        dueTime.QuadPart = -((LONGLONG)secondsToWait * 10000000LL);
+        bool timerArmed = ArmOrRecreateTimer(dueTime);
 
-        SetWaitableTimer(g_timer, &dueTime, 0, nullptr, nullptr, TRUE);
+        HANDLE handles[] = { g_wakeEvent, g_timer };
+        DWORD res = MsgWaitForMultipleObjects(timerArmed ? 2 : 1, handles, FALSE,
+            timerArmed ? INFINITE : TIMER_FALLBACK_POLL_INTERVAL, QS_ALLINPUT);
+        if (res == WAIT_TIMEOUT) {
+            if (time(nullptr) < dueTime) continue;
+            res = WAIT_OBJECT_0 + 1;
+        }
 
-        DWORD res = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
         if (res == WAIT_OBJECT_0) {
             if (g_exitFlag) break;
+            rebuild = true;
+            continue;
+        }
+
+        if (res == WAIT_OBJECT_0 + 1) {
+            if (schedule.empty()) {
+                rebuild = true;
+                continue;
+            }
+
+            if (!prefetched) {
+                prefetched = true;
+                if (schedule.front().time > time(nullptr)) {
+                    PrefetchWallpaper(schedule.front().light);
+                    continue;
+                }
+            }
+
+            SwitchEvent event = schedule.front();
+            schedule.erase(schedule.begin());
+            if (schedule.size() < 2) rebuild = true;
+            prefetched = false;
+
+            Apply(event.light);
             continue;
         }
 
-        Apply(nextLight);
+        MSG msg;
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
+        }
+
+        if (g_scheduleOutdated) {
+            g_scheduleOutdated = false;
+
+            // A switch may have been skipped while asleep or by the clock
+            // jumping forward, make sure the current state is applied.
+            _tzset();
+            schedule = BuildSchedule();
+            rebuild = false;
+            prefetched = false;
+            if (!schedule.empty()) {
+                Apply(!schedule.front().light);
+            }
+        }
     }
 
+    if (hWnd) DestroyWindow(hWnd);
+    UnregisterClassW(wc.lpszClassName, wc.hInstance);
+
     return 0;
 }
 
@@ -529,6 +752,8 @@ void StartScheduler() {
     }
 
     g_wakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    // Switches are scheduled to the minute, a high resolution timer isn't
+    // needed.
     g_timer = CreateWaitableTimerW(nullptr, TRUE, nullptr);
 
     g_timerThread = CreateThread(nullptr, 0, ThemeScheduler, nullptr, 0, nullptr);
@@ -686,6 +911,19 @@ void GetSunriseSunsetTimes(double latitude, double longitude, SYSTEMTIME& sunris
     convertToLocalSystemTime(tsunset, sunset);
 }
 
+void GetSunriseSunsetUtc(double latitude, double longitude, time_t day, time_t& sunrise, time_t& sunset)
+{
+    struct tm day_tm;
+    gmtime_s(&day_tm, &day);
+
+    double tsunrise, tsunset;
+    Sunriset::SunriseSunset(day_tm.tm_year + 1900, day_tm.tm_mon + 1, day_tm.tm_mday, latitude, longitude, tsunrise, tsunset);
+
+    time_t midnight = day - (day % 86400);
+    sunrise = midnight + (time_t)(tsunrise * 3600.0);
+    sunset = midnight + (time_t)(tsunset * 3600.0);
+}
+
 std::wstring TrimQuotes(const std::wstring& str) {
     size_t start = 0;
     size_t end = str.length();
@@ -710,6 +948,8 @@ void LoadSettings() {
     g_longitude = rawLongitude ? _wtof(rawLongitude) : 0.0;
     if (rawLongitude) Wh_FreeStringSetting(rawLongitude);
 
+    g_useSunTimes = false;
+
     if (g_scheduleMode == L"CustomHours") {
         g_lightTime = ParseScheduleTime(rawLight);
         g_darkTime = ParseScheduleTime(rawDark);
@@ -719,6 +959,10 @@ void LoadSettings() {
         SYSTEMTIME sunriseTime, sunsetTime;
         GetSunriseSunsetTimes(pos.Latitude, pos.Longitude, sunriseTime, sunsetTime);
 
+        g_useSunTimes = true;
+        g_sunLatitude = pos.Latitude;
+        g_sunLongitude = pos.Longitude;
+
         g_lightTime = sunriseTime;
         g_darkTime = sunsetTime;
 
@@ -726,6 +970,10 @@ void LoadSettings() {
         SYSTEMTIME sunriseTime, sunsetTime;
         GetSunriseSunsetTimes(g_latitude, g_longitude, sunriseTime, sunsetTime);
 
+        g_useSunTimes = true;
+        g_sunLatitude = g_latitude;
+        g_sunLongitude = g_longitude;
+
         g_lightTime = sunriseTime;
         g_darkTime = sunsetTime;
     }
@@ -2,7 +2,7 @@
 // @id              basic-themer
 // @name            Basic Themer
 // @description     Applies the Windows Basic theme to desktop windows
-// @version         1.1.1
+// @version         1.1.2
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         dwm.exe
@@ -73,6 +73,7 @@ basic frames. To circumvent this, use the "DWM Unextend Frames" mod.
 #include <windhawk_utils.h>
 #include <dwmapi.h>
 #include <wtsapi32.h>
+#include <unordered_map>
 #include <vector>
 
 struct
@@ -99,6 +100,178 @@ void ApplyAnimsInternal(HWND hWnd, BOOL bDisable)
     DwmSetWindowAttribute(hWnd, DWMWA_TRANSITIONS_FORCEDISABLED, &bNoAnims, sizeof(BOOL));
 }
 
+/* Image names and list decisions of processes seen so far, so that window
+   syncs don't have to enumerate every process on the machine. Each entry
+   holds a handle to the process, which keeps its PID from being reused, and
+   is evicted by a thread pool wait when the process exits. */
+struct ProcessCacheEntry
+{
+    std::wstring name;
+    HANDLE hProcess;
+    HANDLE hWait;
+    /* -1 if not decided yet for the current settings */
+    int decision;
+};
+
+std::unordered_map<DWORD, ProcessCacheEntry> g_processCache;
+SRWLOCK g_processCacheLock = SRWLOCK_INIT;
+
+VOID CALLBACK ProcessExitCallback(PVOID lpParameter, BOOLEAN bTimedOut)
+{
+    DWORD pid = (DWORD)(ULONG_PTR)lpParameter;
+
+    AcquireSRWLockExclusive(&g_processCacheLock);
+    auto it = g_processCache.find(pid);
+    if (it != g_processCache.end())
+    {
+        UnregisterWait(it->second.hWait);
+        CloseHandle(it->second.hProcess);
+        g_processCache.erase(it);
+    }
+    ReleaseSRWLockExclusive(&g_processCacheLock);
+}
+
+void FreeProcessCache(void)
+{
+    std::unordered_map<DWORD, ProcessCacheEntry> processCache;
+
+    AcquireSRWLockExclusive(&g_processCacheLock);
+    processCache.swap(g_processCache);
+    ReleaseSRWLockExclusive(&g_processCacheLock);
+
+    /* Waits for running callbacks, which must not hold the lock here */
+    for (auto &it : processCache)
+    {
+        UnregisterWaitEx(it.second.hWait, INVALID_HANDLE_VALUE);
+        CloseHandle(it.second.hProcess);
+    }
+}
+
+/* Fallback for processes which can't be opened. Returns false if the
+   snapshot can't be taken, and leaves the name empty if the process isn't
+   in it. */
+bool GetProcessNameFromSnapshot(DWORD pid, std::wstring &name)
+{
+    WTS_PROCESS_INFOW *processes = nullptr;
+    DWORD processCount = 0;
+    if (!WTSEnumerateProcessesW(WTS_CURRENT_SERVER_HANDLE, 0, 1, &processes, &processCount))
+    {
+        return false;
+    }
+
+    for (DWORD i = 0; i < processCount; i++)
+    {
+        if (processes[i].ProcessId == pid)
+        {
+            name = processes[i].pProcessName;
+            break;
+        }
+    }
+
+    WTSFreeMemory(processes);
+    return true;
+}
+
+/* Must be called with g_processCacheLock held */
+int GetListDecision(const std::wstring &name)
+{
+    for (auto &path: settings.blacklist)
+    {
+        if (!path.find(name))
+        {
+            return 0;
+        }
+    }
+
+    for (auto &path: settings.whitelist)
+    {
+        if (!path.find(name))
+        {
+            return 1;
+        }
+    }
+
+    return (!settings.whitelistmode);
+}
+
+bool ShouldUseBasicThemeForProcess(DWORD pid)
+{
+    AcquireSRWLockExclusive(&g_processCacheLock);
+    auto it = g_processCache.find(pid);
+    if (it != g_processCache.end())
+    {
+        ProcessCacheEntry &entry = it->second;
+        if (entry.decision == -1)
+        {
+            entry.decision = GetListDecision(entry.name);
+        }
+        bool result = entry.decision;
+        ReleaseSRWLockExclusive(&g_processCacheLock);
+        return result;
+    }
+    ReleaseSRWLockExclusive(&g_processCacheLock);
+
+    std::wstring name;
+    HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, pid);
+    if (hProcess)
+    {
+        WCHAR szPath[MAX_PATH];
+        DWORD cchPath = ARRAYSIZE(szPath);
+        if (QueryFullProcessImageNameW(hProcess, 0, szPath, &cchPath))
+        {
+            PCWSTR pszName = wcsrchr(szPath, L'\\');
+            name = pszName ? pszName + 1 : szPath;
+        }
+    }
+
+    if (name.empty())
+    {
+        if (hProcess)
+            CloseHandle(hProcess);
+
+        if (!GetProcessNameFromSnapshot(pid, name))
+            return false;
+
+        AcquireSRWLockShared(&g_processCacheLock);
+        /* Processes missing from the snapshot match neither list */
+        bool result = name.empty() ? !settings.whitelistmode : GetListDecision(name);
+        ReleaseSRWLockShared(&g_processCacheLock);
+        return result;
+    }
+
+    AcquireSRWLockExclusive(&g_processCacheLock);
+    bool result = GetListDecision(name);
+
+    auto inserted = g_processCache.try_emplace(pid);
+    if (inserted.second)
+    {
+        ProcessCacheEntry &entry = inserted.first->second;
+        entry.name = std::move(name);
+        entry.hProcess = hProcess;
+        entry.decision = result;
+        if (!RegisterWaitForSingleObject(
+            &entry.hWait,
+            hProcess,
+            ProcessExitCallback,
+            (PVOID)(ULONG_PTR)pid,
+            INFINITE,
+            WT_EXECUTEONLYONCE
+        ))
+        {
+            CloseHandle(hProcess);
+            g_processCache.erase(inserted.first);
+        }
+    }
+    else
+    {
+        /* Another thread cached it in the meantime */
+        CloseHandle(hProcess);
+    }
+    ReleaseSRWLockExclusive(&g_processCacheLock);
+
+    return result;
+}
+
 bool ShouldUseBasicTheme(HWND hWnd)
 {
     DWORD pid = 0;
@@ -131,39 +304,7 @@ bool ShouldUseBasicTheme(HWND hWnd)
         return true;
     }
 
-    WTS_PROCESS_INFOW *processes = nullptr;
-    DWORD processCount = 0;
-    if (!WTSEnumerateProcessesW(WTS_CURRENT_SERVER_HANDLE, 0, 1, &processes, &processCount))
-    {
-        return false;
-    }
-
-    for (DWORD i = 0; i < processCount; i++)
-    {
-        if (processes[i].ProcessId == pid)
-        {
-            for (auto path: settings.blacklist)
-            {
-                if (!path.find(processes[i].pProcessName))
-                {
-                    WTSFreeMemory(processes);
-                    return false;
-                }
-            }
-
-            for (auto path: settings.whitelist)
-            {
-                if (!path.find(processes[i].pProcessName))
-                {
-                    WTSFreeMemory(processes);
-                    return true;
-                }
-            }
-        }
-    }
-
-    WTSFreeMemory(processes);
-    return (!settings.whitelistmode);
+    return ShouldUseBasicThemeForProcess(pid);
 }
 
 void ApplyBasicTheme(HWND hWnd)
@@ -261,6 +402,14 @@ HRESULT CWindowList_SyncWindowData_hook(
 
 void LoadSettings(void)
 {
+    /* The lists are read by GetListDecision under this lock */
+    AcquireSRWLockExclusive(&g_processCacheLock);
+
+    for (auto &it : g_processCache)
+    {
+        it.second.decision = -1;
+    }
+
     settings.blacklist.clear();
     settings.whitelist.clear();
 
@@ -285,6 +434,8 @@ void LoadSettings(void)
         settings.whitelist.push_back(lpszPath);
         Wh_FreeStringSetting(lpszPath);
     }
+
+    ReleaseSRWLockExclusive(&g_processCacheLock);
 }
 
 const WindhawkUtils::SYMBOL_HOOK uDWMDllHooks[] = {
@@ -343,4 +494,5 @@ void Wh_ModSettingsChanged(void)
 void Wh_ModUninit()
 {
     EnumDesktopWindows(NULL, UninitEnumProc, NULL);
+    FreeProcessCache();
 }
\ No newline at end of file
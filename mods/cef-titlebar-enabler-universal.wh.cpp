@@ -2,7 +2,7 @@
 // @id              cef-titlebar-enabler-universal
 // @name            CEF/Spotify Tweaks
 // @description     Various tweaks for Spotify, including native frames, transparent windows, and more
-// @version         1.3
+// @version         1.3.3
 // @author          Ingan121
 // @github          https://github.com/Ingan121
 // @twitter         https://twitter.com/Ingan121
@@ -180,9 +180,12 @@ See https://www.spotify.com/opensource/ for more
 #include <libloaderapi.h>
 #include <windhawk_api.h>
 #include <windhawk_utils.h>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <condition_variable>
 #include <cstdint>
+#include <cstring>
 #include <thread>
 #include <mutex>
 #include <regex>
@@ -193,6 +196,9 @@ See https://www.spotify.com/opensource/ for more
 #include <sddl.h>
 #include <uxtheme.h>
 #include <windows.h>
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 using namespace std::string_view_literals;
 
@@ -203,6 +209,9 @@ using namespace std::string_view_literals;
 #define cef_window_handle_t HWND
 #define ANY_MINOR -1
 #define PIPE_NAME L"\\\\.\\pipe\\CTEWH-IPC"
+#define PIPE_INSTANCES 4 // Pending pipe instances, one per concurrently connected renderer
+#define PIPE_BUFFER_SIZE 1024
+#define PIPE_MAX_MESSAGE_SIZE 65536
 #define LAST_TESTED_CEF_VERSION 139
 #define CR_RT_1ST_VERSION 119 // First Spotify version to support Chrome runtime
 
@@ -298,11 +307,24 @@ BOOL g_titleLocked = FALSE;
 double g_playbackSpeed = 1.0;
 int64_t g_currentTrackPlayer = NULL;
 
-DWORD g_lastRendererPid = NULL;
+std::vector<DWORD> g_rendererPids; // Renderers allowed to connect to the pipe server
+std::mutex g_rendererPidsMutex;
 HANDLE g_hPipe = INVALID_HANDLE_VALUE;
+HANDLE g_hPipeIocp = NULL;
+std::mutex g_pipeIocpMutex; // Guards g_hPipeIocp, which Wh_ModUninit posts to while the pipe thread closes it
 BOOL g_shouldClosePipe = FALSE;
 std::thread g_pipeThread;
 
+// Commands received by the pipe server, run on the main window thread
+// Multi-producer single-consumer lock-free stack, drained and reversed by DispatchIpcCommands
+struct ipc_command_t {
+    ipc_command_t* next;
+    std::wstring text;
+};
+std::atomic<ipc_command_t*> g_ipcCommandQueue{nullptr};
+std::atomic<bool> g_ipcDispatchPending{false};
+UINT g_ipcDispatchMsg = RegisterWindowMessageW(L"CTEWH-IPC-Dispatch");
+
 std::condition_variable g_queryResponseCv;
 std::mutex g_ipcMutex;
 bool g_queryResponseReceived = false;
@@ -544,6 +566,9 @@ int AddValueToObj(cef_v8value_t* obj, std::u16string name, std::u16string value)
 #pragma endregion
 
 void CreateNamedPipeServer();
+void DispatchIpcCommands();
+void FreeIpcCommands();
+void AddRendererPid(DWORD pid);
 
 // Whether DwmExtendFrameIntoClientArea should be called
 // False if DWM is disabled, visual styles are disabled, or some kind of basic themer is used
@@ -597,6 +622,12 @@ LRESULT CALLBACK SubclassProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam
     // dwRefData is 1 if the window is created by cef_window_create_top_level
     // Assumed 1 if this mod is loaded after the window is created
     // dwRefData is 2 if the window is created by cef_window_create_top_level and is_frameless is hooked
+    if (uMsg == g_ipcDispatchMsg && g_ipcDispatchMsg != 0) {
+        if (hWnd == g_mainHwnd) {
+            DispatchIpcCommands();
+        }
+        return 0;
+    }
     switch (uMsg) {
         case WM_NCACTIVATE:
             if (hWnd == g_mainHwnd && cte_settings.transparentrendering && !cte_settings.showframe && IsDwmEnabled()) {
@@ -715,6 +746,30 @@ inline void Wh_DeleteValue(const wchar_t* key) {
 }
 #endif
 
+// Identifies the build of a loaded module. Cached offsets are only used for the
+// build they were found in, otherwise bytes which happen to match at a stale
+// offset after an update could be patched or hooked.
+std::wstring GetModuleCacheId(char* pbExecutable) {
+    IMAGE_DOS_HEADER* pDosHeader = (IMAGE_DOS_HEADER*)pbExecutable;
+    IMAGE_NT_HEADERS* pNtHeader = (IMAGE_NT_HEADERS*)((char*)pDosHeader + pDosHeader->e_lfanew);
+    WCHAR path[MAX_PATH];
+    if (!GetModuleFileNameW((HMODULE)pbExecutable, path, ARRAYSIZE(path))) {
+        path[0] = L'\0';
+    }
+    WCHAR id[MAX_PATH + 32];
+    swprintf_s(id, L"%s|%08X|%08X|%08X", path, pNtHeader->FileHeader.TimeDateStamp,
+        pNtHeader->OptionalHeader.CheckSum, pNtHeader->OptionalHeader.SizeOfImage);
+    return id;
+}
+
+BOOL IsCacheForModule(const std::wstring& key, const std::wstring& moduleId) {
+    WCHAR cachedId[MAX_PATH + 32];
+    if (!Wh_GetStringValue(key.c_str(), cachedId, ARRAYSIZE(cachedId))) {
+        return FALSE;
+    }
+    return moduleId == cachedId;
+}
+
 // From https://windhawk.net/mods/visual-studio-anti-rich-header
 std::string ReplaceAll(std::string str, const std::string& from, const std::string& to)
 {
@@ -742,6 +797,7 @@ int64_t PatchMemory(std::wstring identifier, char* pbExecutable, const std::stri
     std::regex regex(targetRegex, std::regex::optimize);
     std::match_results<std::string_view::const_iterator> match;
     bool foundAnyMatch = false;
+    std::wstring moduleId = GetModuleCacheId(pbExecutable);
 
     for (int i = 0; i < pNtHeader->FileHeader.NumberOfSections; ++i) {
         if (expectedSection != -1 && i != expectedSection) {
@@ -756,7 +812,10 @@ int64_t PatchMemory(std::wstring identifier, char* pbExecutable, const std::stri
         size_t moduleSize = pSectionHeader[i].VirtualAddress + pSectionHeader[i].SizeOfRawData;
 
         std::wstring keyPrefix = identifier + L"_offset_";
-        if (targetPatch.size() == 0) {
+        std::wstring moduleKey = keyPrefix + L"module";
+        if (!IsCacheForModule(moduleKey, moduleId)) {
+            Wh_Log(L"No cached offsets for memory %s in this build", identifier.c_str());
+        } else if (targetPatch.size() == 0) {
             std::wstring key = keyPrefix + L"0";
             int64_t cachedOffset = Wh_GetIntValue(key.c_str(), -1);
             if (cachedOffset != -1) {
@@ -844,6 +903,7 @@ int64_t PatchMemory(std::wstring identifier, char* pbExecutable, const std::stri
             Wh_Log(L"Match #%d found in section %d at position: %p", matchCount, i, pos);
             std::wstring key = keyPrefix + std::to_wstring(matchCount);
             Wh_SetIntValue(key.c_str(), static_cast<int>(pos - pbExecutable));
+            Wh_SetStringValue(moduleKey.c_str(), moduleId.c_str());
 
             if (targetPatch.size() == 0) {
                 // Just return the address of the first match
@@ -953,23 +1013,192 @@ typedef struct {
     const size_t instr_offset; // estimated location of the searched instructions relative to the entry point
 } function_search;
 
-// Wrapper for string_view::find, that checks the needle is unique within the haystack.
-const char* unique_search(std::string_view haystack, std::string_view needle, LPCWSTR symbol_name) {
-    size_t index1 = haystack.find(needle);
-    if (index1 == std::string_view::npos) {
-        Wh_Log(L"Error: Couldn't find instructions for symbol %s", symbol_name);
+// Multi-signature scanner: all signatures are searched in a single pass over
+// the code section. Each signature is anchored on its two rarest bytes
+// (according to a sampled byte histogram of the section), which are compared
+// 32 positions at a time with AVX2, and only positions where both anchors
+// match are verified against the full signature.
+typedef struct {
+    LPCWSTR name;
+    std::string_view pattern;
+    std::string_view mask; // '?' marks wildcard bytes, empty if all bytes must match
+    // results, filled by scan_signatures
+    const char* match;
+    const char* second_match; // set if the signature isn't unique
+    size_t candidates;
+    double verify_ms;
+} code_signature;
+
+typedef struct {
+    size_t offset1, offset2;
+    unsigned char byte1, byte2;
+    bool done; // found twice, no need to look any further
+} signature_anchors;
+
+#define MAX_SCAN_SIGNATURES 16
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+bool signature_matches_at(const code_signature& sig, const char* p) {
+    for (size_t i = 0; i < sig.pattern.size(); i++) {
+        if ((sig.mask.empty() || sig.mask[i] != '?') && p[i] != sig.pattern[i]) return false;
+    }
+    return true;
+}
+
+void verify_signature_candidate(code_signature& sig, signature_anchors& anchors, const char* p, LARGE_INTEGER freq) {
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    sig.candidates++;
+    if (signature_matches_at(sig, p)) {
+        if (!sig.match) {
+            sig.match = p;
+        } else {
+            sig.second_match = p;
+            anchors.done = true;
+        }
+    }
+    QueryPerformanceCounter(&end);
+    sig.verify_ms += (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+// sample the section instead of counting every byte, the distribution of a
+// large code section is uniform enough
+void sample_byte_histogram(std::string_view code, size_t histogram[256]) {
+    for (size_t offset = 0; offset < code.size(); offset += 0x100000) {
+        size_t end = std::min(code.size(), offset + 0x10000);
+        for (size_t i = offset; i < end; i++) histogram[(unsigned char)code[i]]++;
+    }
+}
+
+void choose_signature_anchors(const size_t histogram[256], const code_signature& sig, signature_anchors& anchors) {
+    size_t best1 = SIZE_MAX, best2 = SIZE_MAX;
+    for (size_t i = 0; i < sig.pattern.size(); i++) {
+        if (!sig.mask.empty() && sig.mask[i] == '?') continue;
+        size_t count = histogram[(unsigned char)sig.pattern[i]];
+        if (best1 == SIZE_MAX || count < histogram[(unsigned char)sig.pattern[best1]]) {
+            best2 = best1;
+            best1 = i;
+        } else if (best2 == SIZE_MAX || count < histogram[(unsigned char)sig.pattern[best2]]) {
+            best2 = i;
+        }
+    }
+    if (best1 == SIZE_MAX) best1 = 0; // all wildcards, every position is a candidate
+    if (best2 == SIZE_MAX) best2 = best1;
+
+    anchors.offset1 = best1;
+    anchors.offset2 = best2;
+    anchors.byte1 = (unsigned char)sig.pattern[best1];
+    anchors.byte2 = (unsigned char)sig.pattern[best2];
+    anchors.done = false;
+}
+
+// scans [0, end) for candidate positions in 32-byte blocks, returns where the
+// scalar tail scan should continue. The caller guarantees that
+// end + max pattern size <= code size.
+#if defined(_M_X64) || defined(__x86_64__)
+__attribute__((target("avx2")))
+size_t scan_signatures_avx2(const char* base, size_t end, code_signature* sigs, signature_anchors* anchors, size_t count, LARGE_INTEGER freq) {
+    __m256i needle1[MAX_SCAN_SIGNATURES], needle2[MAX_SCAN_SIGNATURES];
+    for (size_t s = 0; s < count; s++) {
+        needle1[s] = _mm256_set1_epi8((char)anchors[s].byte1);
+        needle2[s] = _mm256_set1_epi8((char)anchors[s].byte2);
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= end; i += 32) {
+        for (size_t s = 0; s < count; s++) {
+            if (anchors[s].done) continue;
+            __m256i block1 = _mm256_loadu_si256((const __m256i*)(base + i + anchors[s].offset1));
+            __m256i block2 = _mm256_loadu_si256((const __m256i*)(base + i + anchors[s].offset2));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(block1, needle1[s]), _mm256_cmpeq_epi8(block2, needle2[s])));
+            while (mask && !anchors[s].done) {
+                unsigned bit = __builtin_ctz(mask);
+                mask &= mask - 1;
+                verify_signature_candidate(sigs[s], anchors[s], base + i + bit, freq);
+            }
+        }
+    }
+    return i;
+}
+#endif
+
+void scan_signatures(std::string_view code, code_signature* sigs, size_t count) {
+    if (count > MAX_SCAN_SIGNATURES) {
+        Wh_Log(L"Error: too many signatures (%zu)", count);
+        return;
+    }
+
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    size_t histogram[256] = {};
+    sample_byte_histogram(code, histogram);
+
+    signature_anchors anchors[MAX_SCAN_SIGNATURES];
+    size_t max_size = 0;
+    for (size_t s = 0; s < count; s++) {
+        if (sigs[s].pattern.empty()) {
+            Wh_Log(L"Error: empty signature %s", sigs[s].name);
+            return;
+        }
+        sigs[s].match = NULL;
+        sigs[s].second_match = NULL;
+        sigs[s].candidates = 0;
+        sigs[s].verify_ms = 0;
+        choose_signature_anchors(histogram, sigs[s], anchors[s]);
+        max_size = std::max(max_size, sigs[s].pattern.size());
+    }
+
+    const char* base = code.data();
+    size_t i = 0;
+    bool used_avx2 = false;
+#if defined(_M_X64) || defined(__x86_64__)
+    if (code.size() > max_size + 32 && IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE)) {
+        i = scan_signatures_avx2(base, code.size() - max_size, sigs, anchors, count, freq);
+        used_avx2 = true;
+    }
+#endif
+
+    // the tail (or everything, without AVX2), one signature at a time with
+    // memchr on the rarest byte
+    for (size_t s = 0; s < count; s++) {
+        if (code.size() < sigs[s].pattern.size()) continue;
+        const char* p = base + i + anchors[s].offset1;
+        const char* last = base + code.size() - sigs[s].pattern.size() + anchors[s].offset1;
+        while (!anchors[s].done && p <= last &&
+               (p = (const char*)memchr(p, anchors[s].byte1, last - p + 1)) != NULL) {
+            const char* candidate = p - anchors[s].offset1;
+            if ((unsigned char)candidate[anchors[s].offset2] == anchors[s].byte2) {
+                verify_signature_candidate(sigs[s], anchors[s], candidate, freq);
+            }
+            p++;
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+    Wh_Log(L"Scanned %zu MB for %zu signature(s) in %.1f ms%s", code.size() >> 20, count,
+        (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart, used_avx2 ? L" (AVX2)" : L"");
+    for (size_t s = 0; s < count; s++) {
+        Wh_Log(L"  %s: %zu candidate(s), %.2f ms verifying", sigs[s].name, sigs[s].candidates, sigs[s].verify_ms);
+    }
+}
+
+// Checks that a scanned signature was found exactly once.
+const char* unique_match(const code_signature& sig) {
+    if (sig.match == NULL) {
+        Wh_Log(L"Error: Couldn't find instructions for symbol %s", sig.name);
         return NULL;
     }
-    // Can we find the same sequence again in the rest of the haystack?
-    size_t index2 = haystack.find(needle, index1 + 1);
-    if (index2 != std::string_view::npos) {
-        Wh_Log(L"Error: Found multiple matches for %s: at %p and at %p", symbol_name, haystack.begin()+index1, haystack.begin()+index2);
-        // log_hexdump((unsigned char*)haystack.begin() + index1 - 0x50, 6);
-        // Wh_Log(L"----------------");
-        // log_hexdump((unsigned char*)haystack.begin() + index2 - 0x50, 6);
+    if (sig.second_match != NULL) {
+        Wh_Log(L"Error: Found multiple matches for %s: at %p and at %p", sig.name, sig.match, sig.second_match);
         return NULL;
     }
-    return haystack.begin() + index1;
+    return sig.match;
 }
 
 // get address and size of code section via PE header info  (expect around 200 MB)
@@ -992,60 +1221,83 @@ std::string_view getCodeSection(HMODULE chromeModule) {
 }
 
 // Find a function address by scanning for specific instruction patterns.
-// We search the entire code section once per function,
-// to ensure we aren't hooking the wrong location.
-// Better safe than sorry, and it shouldn't cause noticeable delay on startup.
-const char* search_function_instructions(std::wstring identifier, std::string_view code_section, function_search fsearch) {
-    if (code_section.size()==0) return 0;
+// Alternative patterns (e.g. for different versions) are searched in a single pass
+// over the entire code section, to ensure we aren't hooking the wrong location.
+// The first alternative which is found exactly once is used.
+const char* search_function_instructions(std::wstring identifier, std::string_view code_section, const function_search* fsearches, size_t count) {
+    if (code_section.size()==0 || count == 0) return 0;
 
     std::wstring key = identifier + L"_offset";
+    std::wstring module_key = identifier + L"_module";
+    HMODULE module = NULL;
+    GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+        (LPCWSTR)code_section.data(), &module);
+    std::wstring module_id = module ? GetModuleCacheId((char*)module) : L"";
     int cached_offset = Wh_GetIntValue(key.c_str(), -1);
-    auto prologue = fsearch.prologue;
-    if (cached_offset >= 0 && static_cast<size_t>(cached_offset + prologue.size()) < code_section.size()) {
-        std::string_view match_view = code_section.substr(cached_offset, prologue.size());
-        if (match_view == prologue) {
-            Wh_Log(L"Returning cached offset for function %s", identifier.c_str());
-            return code_section.data() + cached_offset;
-        } else {
-            Wh_Log(L"Match not found at the cached offset; invalidating the cache...");
-            Wh_DeleteValue(key.c_str());
+    if (cached_offset >= 0 && !IsCacheForModule(module_key, module_id)) {
+        Wh_Log(L"Cached offset for function %s is from another build; ignoring it", identifier.c_str());
+        cached_offset = -1;
+    }
+    if (cached_offset >= 0) {
+        for (size_t i = 0; i < count; i++) {
+            auto prologue = fsearches[i].prologue;
+            if (static_cast<size_t>(cached_offset + prologue.size()) < code_section.size() &&
+                code_section.substr(cached_offset, prologue.size()) == prologue) {
+                Wh_Log(L"Returning cached offset for function %s", identifier.c_str());
+                return code_section.data() + cached_offset;
+            }
         }
+        Wh_Log(L"Match not found at the cached offset; invalidating the cache...");
+        Wh_DeleteValue(key.c_str());
     }
 
     Wh_Log(L"Searching for function %s", identifier.c_str());
-    const char* addr = unique_search(code_section, fsearch.search, identifier.c_str());
-    if (addr == NULL) {
-        Wh_Log(L"Could not find function %s; is the mod up to date?", identifier.c_str());
-        return NULL;
+    std::vector<std::wstring> names(count);
+    std::vector<code_signature> signatures(count);
+    for (size_t i = 0; i < count; i++) {
+        names[i] = count > 1 ? identifier + L" #" + std::to_wstring(i + 1) : identifier;
+        signatures[i] = { .name = names[i].c_str(), .pattern = fsearches[i].search };
     }
-    Wh_Log(L"Instructions were found at address: %p", addr);
-    int offset = fsearch.instr_offset;
-    const char* entry = addr - offset;
-    // verify the prologue is what we expect; otherwise search for it
-    // and verify it is preceded by 0xcc INT3 or 0xc3 RET (or ?? JMP)
-    if (prologue != std::string_view{entry, prologue.size()}) {
-        Wh_Log(L"Prologue not found where expected, searching...");
-        // maybe function length changed due to different compilation
-        auto search_space = std::string_view{entry - 0x40, addr};
-        size_t new_offset = search_space.rfind(prologue);
-        if (new_offset != std::string_view::npos) {
-            entry = (char*)search_space.begin() + new_offset;
-        } else {
-            entry = NULL;
+    scan_signatures(code_section, signatures.data(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        const char* addr = unique_match(signatures[i]);
+        if (addr == NULL) {
+            continue;
         }
-    }
-    if (entry) {
-        Wh_Log(L"Found entrypoint for function %s at addr %p", identifier.c_str(), entry);
-        if (entry[-1]!=(char)0xcc && entry[-1]!=(char)0xc3) {
-            Wh_Log(L"Warn: prologue not preceded by INT3 or RET");
+        Wh_Log(L"Instructions were found at address: %p", addr);
+        int offset = fsearches[i].instr_offset;
+        const char* entry = addr - offset;
+        // verify the prologue is what we expect; otherwise search for it
+        // and verify it is preceded by 0xcc INT3 or 0xc3 RET (or ?? JMP)
+        auto prologue = fsearches[i].prologue;
+        if (prologue != std::string_view{entry, prologue.size()}) {
+            Wh_Log(L"Prologue not found where expected, searching...");
+            // maybe function length changed due to different compilation
+            auto search_space = std::string_view{entry - 0x40, addr};
+            size_t new_offset = search_space.rfind(prologue);
+            if (new_offset != std::string_view::npos) {
+                entry = (char*)search_space.begin() + new_offset;
+            } else {
+                entry = NULL;
+            }
+        }
+        if (entry) {
+            Wh_Log(L"Found entrypoint for function %s at addr %p", names[i].c_str(), entry);
+            if (entry[-1]!=(char)0xcc && entry[-1]!=(char)0xc3) {
+                Wh_Log(L"Warn: prologue not preceded by INT3 or RET");
+            }
+            Wh_SetIntValue(key.c_str(), static_cast<int>(entry - code_section.data()));
+            Wh_SetStringValue(module_key.c_str(), module_id.c_str());
+            return entry;
+        } else {
+            Wh_Log(L"Err: Couldn't locate function entry point for symbol %s", names[i].c_str());
+            // log_hexdump(addr - 0x40, 0x5);
         }
-        Wh_SetIntValue(key.c_str(), static_cast<int>(entry - code_section.data()));
-        return entry;
-    } else {
-        Wh_Log(L"Err: Couldn't locate function entry point for symbol %s", identifier.c_str());
-        // log_hexdump(addr - 0x40, 0x5);
-        return NULL;
     }
+
+    Wh_Log(L"Could not find function %s; is the mod up to date?", identifier.c_str());
+    return NULL;
 }
 
 typedef uint64_t* __fastcall (*CreateTrackPlayer_t)(
@@ -1114,26 +1366,24 @@ const std::string SetPlaybackSpeed_instructions =
 BOOL HookCreateTrackPlayer(char* pbExecutable, BOOL shouldFindSetPlaybackSpeed) {
     std::string_view code_section = getCodeSection((HMODULE)pbExecutable);
     if (code_section.size() == 0) return FALSE;
-    const char* addr = search_function_instructions(
-        L"CreateTrackPlayer",
-        code_section,
+    const function_search CreateTrackPlayer_searches[] = {
         {
             .search = CreateTrackPlayer_instructions,
             .prologue = CreateTrackPlayer_prologue,
             .instr_offset = 0xBA0
-        }
+        },
+        {
+            .search = CreateTrackPlayer_instructions_2,
+            .prologue = CreateTrackPlayer_prologue,
+            .instr_offset = 0xBA0
+        },
+    };
+    const char* addr = search_function_instructions(
+        L"CreateTrackPlayer",
+        code_section,
+        CreateTrackPlayer_searches,
+        ARRAYSIZE(CreateTrackPlayer_searches)
     );
-    if (addr == NULL) {
-        addr = search_function_instructions(
-            L"CreateTrackPlayer",
-            code_section,
-            {
-                .search = CreateTrackPlayer_instructions_2,
-                .prologue = CreateTrackPlayer_prologue,
-                .instr_offset = 0xBA0
-            }
-        );
-    }
     if (addr == NULL) return FALSE;
     Wh_Log(L"Hooking CreateTrackPlayer at %p", addr);
     Wh_SetFunctionHook((void*)addr, (void*)CreateTrackPlayer_hook, (void**)&CreateTrackPlayer_original);
@@ -1211,7 +1461,6 @@ _cef_window_t* CEF_EXPORT cef_window_create_top_level_hook(cef_window_delegate_t
                     g_pipeThread = std::thread([=]() {
                         CreateNamedPipeServer();
                     });
-                    g_pipeThread.detach();
                 }
             }
         }
@@ -1428,7 +1677,7 @@ BOOL WINAPI CreateProcessW_hook(
 
     if (result && lpCommandLine) {
         if (wcsstr(lpCommandLine, L"--type=renderer")) {
-            g_lastRendererPid = lpProcessInformation->dwProcessId;
+            AddRendererPid(lpProcessInformation->dwProcessId);
             Wh_Log(L"Renderer process detected");
         }
     }
@@ -1513,7 +1762,7 @@ BOOL WINAPI CreateProcessAsUserW_hook(
 
     if (result && lpCommandLine) {
         if (wcsstr(lpCommandLine, L"--type=renderer")) {
-            g_lastRendererPid = lpProcessInformation->dwProcessId;
+            AddRendererPid(lpProcessInformation->dwProcessId);
             Wh_Log(L"Renderer process detected");
         }
     }
@@ -1660,43 +1909,40 @@ void HandleWindhawkComm(LPCWSTR command) {
             }
         }
     #endif
-    // /WH:Query
-    } else if (wcscmp(command, L"/WH:Query") == 0) {
-        if (g_hPipe == INVALID_HANDLE_VALUE) {
-            return;
-        }
-        wchar_t queryResponse[256];
-        // <showframe:showframeonothers:showmenu:showcontrols:transparentcontrols:transparentrendering:ignoreminsize:noforceddarkmode:forceextensions:allowuntested:isMaximized:isTopMost:isLayered:isThemingEnabled:isDwmEnabled:hwAccelerated:minWidth:minHeight:titleLocked:dpi:speedModSupported:playbackSpeed:immediateSpeedChange>
-        swprintf(queryResponse, 256, L"/WH:QueryResponse:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%lf:%d",
-            cte_settings.showframe,
-            cte_settings.showframeonothers,
-            cte_settings.showmenu,
-            cte_settings.showcontrols,
-            cte_settings.transparentcontrols,
-            cte_settings.transparentrendering,
-            cte_settings.ignoreminsize,
-            cte_settings.noforceddarkmode,
-            cte_settings.forceextensions,
-            cte_settings.allowuntested,
-            IsZoomed(g_mainHwnd),
-            GetWindowLong(g_mainHwnd, GWL_EXSTYLE) & WS_EX_TOPMOST,
-            GetWindowLong(g_mainHwnd, GWL_EXSTYLE) & WS_EX_LAYERED,
-            IsAppThemed() && IsThemeActive(),
-            IsDwmEnabled(),
-            FindWindowExW(g_mainHwnd, NULL, L"Intermediate D3D Window", NULL) != NULL,
-            g_minWidth,
-            g_minHeight,
-            g_titleLocked,
-            GetDpiForWindowWithFallback(g_mainHwnd),
-            CreateTrackPlayer_original != NULL,
-            g_playbackSpeed,
-            SetPlaybackSpeed != NULL
-        );
-        DWORD bytesWritten;
-        WriteFile(g_hPipe, queryResponse, wcslen(queryResponse) * sizeof(wchar_t), &bytesWritten, NULL);
     }
 }
 
+// /WH:Query is answered directly on the pipe thread, as the renderer waits for the response
+// Everything read here is safe to query from any thread
+void FormatQueryResponse(wchar_t* buffer, size_t size) {
+    // <showframe:showframeonothers:showmenu:showcontrols:transparentcontrols:transparentrendering:ignoreminsize:noforceddarkmode:forceextensions:allowuntested:isMaximized:isTopMost:isLayered:isThemingEnabled:isDwmEnabled:hwAccelerated:minWidth:minHeight:titleLocked:dpi:speedModSupported:playbackSpeed:immediateSpeedChange>
+    swprintf(buffer, size, L"/WH:QueryResponse:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%d:%lf:%d",
+        cte_settings.showframe,
+        cte_settings.showframeonothers,
+        cte_settings.showmenu,
+        cte_settings.showcontrols,
+        cte_settings.transparentcontrols,
+        cte_settings.transparentrendering,
+        cte_settings.ignoreminsize,
+        cte_settings.noforceddarkmode,
+        cte_settings.forceextensions,
+        cte_settings.allowuntested,
+        IsZoomed(g_mainHwnd),
+        GetWindowLong(g_mainHwnd, GWL_EXSTYLE) & WS_EX_TOPMOST,
+        GetWindowLong(g_mainHwnd, GWL_EXSTYLE) & WS_EX_LAYERED,
+        IsAppThemed() && IsThemeActive(),
+        IsDwmEnabled(),
+        FindWindowExW(g_mainHwnd, NULL, L"Intermediate D3D Window", NULL) != NULL,
+        g_minWidth,
+        g_minHeight,
+        g_titleLocked,
+        GetDpiForWindowWithFallback(g_mainHwnd),
+        CreateTrackPlayer_original != NULL,
+        g_playbackSpeed,
+        SetPlaybackSpeed != NULL
+    );
+}
+
 // Copy-pasted from https://source.chromium.org/chromium/chromium/src/+/main:third_party/crashpad/crashpad/util/win/registration_protocol_win.cc;drc=f39c57f31413abcb41d3068cfb2c7a1718003cc5;l=253
 // Same logic as in crashpad to allow processes with untrusted integrity level to connect to the named pipe
 void* GetSecurityDescriptorWithUser(const wchar_t* sddl_string, size_t* size) {
@@ -1748,6 +1994,22 @@ bool SupportsWin10SIDs() {
     return false;
 }
 
+// Allow a renderer to connect to the pipe server
+// Renderers which exited without connecting are dropped, so the list doesn't keep growing
+void AddRendererPid(DWORD pid) {
+    std::lock_guard<std::mutex> lock(g_rendererPidsMutex);
+    std::erase_if(g_rendererPids, [](DWORD rendererPid) {
+        HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, rendererPid);
+        if (!hProcess) {
+            return true;
+        }
+        bool exited = WaitForSingleObject(hProcess, 0) == WAIT_OBJECT_0;
+        CloseHandle(hProcess);
+        return exited;
+    });
+    g_rendererPids.push_back(pid);
+}
+
 const void* GetSecurityDescriptorForNamedPipeInstance(size_t* size) {
     // Get a security descriptor which grants the current user and SYSTEM full
     // access to the named pipe. Also grant AppContainer RW access through the ALL
@@ -1764,6 +2026,200 @@ const void* GetSecurityDescriptorForNamedPipeInstance(size_t* size) {
     return sec_desc;
 }
 
+// Queue a command for the main window thread
+// The window is only woken if no dispatch is pending, as a pending dispatch picks up the rest
+// If waking it fails, the next command tries again, and the queue is dropped if the window is gone
+void QueueIpcCommand(std::wstring_view text) {
+    ipc_command_t* cmd = new ipc_command_t{nullptr, std::wstring(text)};
+    ipc_command_t* head = g_ipcCommandQueue.load(std::memory_order_relaxed);
+    do {
+        cmd->next = head;
+    } while (!g_ipcCommandQueue.compare_exchange_weak(head, cmd, std::memory_order_release, std::memory_order_relaxed));
+    if (!g_ipcDispatchPending.exchange(true)) {
+        if (!PostMessage(g_mainHwnd, g_ipcDispatchMsg, 0, 0)) {
+            Wh_Log(L"Failed to wake the main window for IPC commands, GLE=%d", GetLastError());
+            g_ipcDispatchPending = false;
+            if (!IsWindow(g_mainHwnd)) {
+                FreeIpcCommands();
+            }
+        }
+    }
+}
+
+// Commands where only the latest one in a batch matters
+// Frequent updates from the renderer (e.g. playback speed or colour changes) are coalesced this way
+bool IsCoalescableIpcCommand(std::wstring_view name) {
+    return name == L"/WH:SetPlaybackSpeed" ||
+        name == L"/WH:SetLayered" ||
+        name == L"/WH:SetBackdrop" ||
+        name == L"/WH:ResizeTo" ||
+        name == L"/WH:SetMinSize" ||
+        name == L"/WH:SetTitle" ||
+        name == L"/WH:ExtendFrame";
+}
+
+std::wstring_view GetIpcCommandName(std::wstring_view command) {
+    size_t pos = command.find(L':', 4); // Skip the /WH: prefix
+    return pos == std::wstring_view::npos ? command : command.substr(0, pos);
+}
+
+// Runs on the main window thread
+void DispatchIpcCommands() {
+    // Cleared before taking the queue, so that a command queued after this wakes the window again
+    g_ipcDispatchPending = false;
+    ipc_command_t* cmd = g_ipcCommandQueue.exchange(nullptr, std::memory_order_acquire);
+
+    // Restore the order commands were received in
+    ipc_command_t* ordered = nullptr;
+    while (cmd) {
+        ipc_command_t* next = cmd->next;
+        cmd->next = ordered;
+        ordered = cmd;
+        cmd = next;
+    }
+
+    while (ordered) {
+        ipc_command_t* next = ordered->next;
+        std::wstring_view name = GetIpcCommandName(ordered->text);
+        bool superseded = false;
+        if (IsCoalescableIpcCommand(name)) {
+            for (ipc_command_t* later = next; later; later = later->next) {
+                if (GetIpcCommandName(later->text) == name) {
+                    superseded = true;
+                    break;
+                }
+            }
+        }
+        if (!superseded && !g_shouldClosePipe) {
+            HandleWindhawkComm(ordered->text.c_str());
+        }
+        delete ordered;
+        ordered = next;
+    }
+}
+
+void FreeIpcCommands() {
+    ipc_command_t* cmd = g_ipcCommandQueue.exchange(nullptr, std::memory_order_acquire);
+    while (cmd) {
+        ipc_command_t* next = cmd->next;
+        delete cmd;
+        cmd = next;
+    }
+}
+
+struct pipe_instance_t {
+    HANDLE hPipe;
+    OVERLAPPED readOverlapped; // Used for both connecting and reading
+    OVERLAPPED writeOverlapped;
+    BOOL connected;
+    BOOL writePending;
+    int pendingOps;
+    char readBuffer[PIPE_BUFFER_SIZE];
+    std::string message; // Accumulates a message larger than the read buffer
+    wchar_t writeBuffer[256];
+};
+
+void ConnectPipeInstance(pipe_instance_t* instance);
+
+void ReadPipeInstance(pipe_instance_t* instance) {
+    ZeroMemory(&instance->readOverlapped, sizeof(OVERLAPPED));
+    if (ReadFile(instance->hPipe, instance->readBuffer, sizeof(instance->readBuffer), NULL, &instance->readOverlapped)) {
+        instance->pendingOps++;
+        return;
+    }
+
+    DWORD error = GetLastError();
+    if (error == ERROR_IO_PENDING || error == ERROR_MORE_DATA) {
+        // The completion is queued to the port either way
+        instance->pendingOps++;
+        return;
+    }
+
+    Wh_Log(L"Client disconnected, GLE=%d", error);
+    DisconnectNamedPipe(instance->hPipe);
+    ConnectPipeInstance(instance);
+}
+
+void OnPipeInstanceConnected(pipe_instance_t* instance) {
+    DWORD clientPid = 0;
+    if (GetNamedPipeClientProcessId(instance->hPipe, &clientPid)) {
+        std::lock_guard<std::mutex> lock(g_rendererPidsMutex);
+        auto it = std::find(g_rendererPids.begin(), g_rendererPids.end(), clientPid);
+        if (it == g_rendererPids.end()) {
+            Wh_Log(L"Rejected pipe connection from unexpected PID: %lu", clientPid);
+            DisconnectNamedPipe(instance->hPipe);
+            ConnectPipeInstance(instance);
+            return;
+        }
+        // Each renderer connects only once
+        g_rendererPids.erase(it);
+    }
+
+    Wh_Log(L"Client %lu connected", clientPid);
+    instance->connected = TRUE;
+    instance->message.clear();
+    ReadPipeInstance(instance);
+}
+
+void ConnectPipeInstance(pipe_instance_t* instance) {
+    instance->connected = FALSE;
+    ZeroMemory(&instance->readOverlapped, sizeof(OVERLAPPED));
+    if (ConnectNamedPipe(instance->hPipe, &instance->readOverlapped)) {
+        instance->pendingOps++;
+        return;
+    }
+
+    DWORD error = GetLastError();
+    if (error == ERROR_IO_PENDING) {
+        instance->pendingOps++;
+    } else if (error == ERROR_PIPE_CONNECTED) {
+        // The client connected between CreateNamedPipe and ConnectNamedPipe, no completion is queued
+        OnPipeInstanceConnected(instance);
+    } else {
+        Wh_Log(L"ConnectNamedPipe failed, GLE=%d", error);
+    }
+}
+
+void WritePipeInstance(pipe_instance_t* instance, LPCWSTR response) {
+    if (instance->writePending) {
+        Wh_Log(L"Previous response is still being written, dropping the response");
+        return;
+    }
+
+    wcsncpy_s(instance->writeBuffer, ARRAYSIZE(instance->writeBuffer), response, _TRUNCATE);
+    ZeroMemory(&instance->writeOverlapped, sizeof(OVERLAPPED));
+    DWORD size = wcslen(instance->writeBuffer) * sizeof(wchar_t);
+    if (WriteFile(instance->hPipe, instance->writeBuffer, size, NULL, &instance->writeOverlapped) || GetLastError() == ERROR_IO_PENDING) {
+        instance->writePending = TRUE;
+        instance->pendingOps++;
+    } else {
+        Wh_Log(L"WriteFile failed, GLE=%d", GetLastError());
+    }
+}
+
+// A message may contain multiple newline-separated commands
+void HandlePipeMessage(pipe_instance_t* instance) {
+    std::wstring_view message((const wchar_t*)instance->message.data(), instance->message.size() / sizeof(wchar_t));
+    Wh_Log(L"Received message: %.*s", (int)message.size(), message.data());
+
+    while (!message.empty()) {
+        size_t end = message.find(L'\n');
+        std::wstring_view command = message.substr(0, end);
+        message = end == std::wstring_view::npos ? std::wstring_view() : message.substr(end + 1);
+        if (command.empty()) {
+            continue;
+        }
+
+        if (command == L"/WH:Query") {
+            wchar_t queryResponse[256];
+            FormatQueryResponse(queryResponse, ARRAYSIZE(queryResponse));
+            WritePipeInstance(instance, queryResponse);
+        } else {
+            QueueIpcCommand(command);
+        }
+    }
+}
+
 void CreateNamedPipeServer() {
     void* pSecurityDescriptor = const_cast<void*>(GetSecurityDescriptorForNamedPipeInstance(NULL));
     if (!pSecurityDescriptor) {
@@ -1775,69 +2231,140 @@ void CreateNamedPipeServer() {
     securityAttributes.lpSecurityDescriptor = pSecurityDescriptor;
     securityAttributes.bInheritHandle = TRUE;
 
-    while (!g_shouldClosePipe) {
-        g_hPipe = CreateNamedPipe(
+    HANDLE hIocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (!hIocp) {
+        Wh_Log(L"CreateIoCompletionPort failed, GLE=%d", GetLastError());
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_pipeIocpMutex);
+        g_hPipeIocp = hIocp;
+    }
+
+    // Keep several instances listening, so multiple renderers can stay connected at once
+    pipe_instance_t instances[PIPE_INSTANCES] = {};
+    for (int i = 0; i < PIPE_INSTANCES; i++) {
+        instances[i].hPipe = CreateNamedPipe(
             PIPE_NAME,                                       // Pipe name
             PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,       // Read/Write access with overlapped I/O
             PIPE_TYPE_MESSAGE |                              // Message type pipe
             PIPE_READMODE_MESSAGE |                          // Message-read mode
             PIPE_WAIT,                                       // Blocking mode
             PIPE_UNLIMITED_INSTANCES,                        // Max instances
-            512,                                             // Output buffer size
-            512,                                             // Input buffer size
+            PIPE_BUFFER_SIZE,                                // Output buffer size
+            PIPE_BUFFER_SIZE,                                // Input buffer size
             0,                                               // Client time-out
             pSecurityDescriptor ? &securityAttributes : NULL // Security attributes
         );
 
-        if (g_hPipe == INVALID_HANDLE_VALUE) {
+        if (instances[i].hPipe == INVALID_HANDLE_VALUE) {
             Wh_Log(L"CreateNamedPipe failed, GLE=%d", GetLastError());
-            return;
+            continue;
+        }
+
+        if (!CreateIoCompletionPort(instances[i].hPipe, hIocp, (ULONG_PTR)&instances[i], 0)) {
+            Wh_Log(L"CreateIoCompletionPort failed, GLE=%d", GetLastError());
+            CloseHandle(instances[i].hPipe);
+            instances[i].hPipe = INVALID_HANDLE_VALUE;
+            continue;
         }
 
-        Wh_Log(L"Waiting for client to connect...");
-        BOOL connected = ConnectNamedPipe(g_hPipe, NULL) ? TRUE : (GetLastError() == ERROR_PIPE_CONNECTED);
+        ConnectPipeInstance(&instances[i]);
+    }
 
-        if (connected) {
-            DWORD clientPid = 0;
-            if (GetNamedPipeClientProcessId(g_hPipe, &clientPid)) {
-                if (clientPid != g_lastRendererPid) {
-                    Wh_Log(L"Rejected pipe connection from unexpected PID: %lu (expected %lu)", clientPid, g_lastRendererPid);
-                    CloseHandle(g_hPipe);
-                    continue;
-                }
+    Wh_Log(L"Waiting for clients to connect...");
+    while (!g_shouldClosePipe) {
+        DWORD bytesTransferred;
+        ULONG_PTR key;
+        OVERLAPPED* overlapped;
+        BOOL result = GetQueuedCompletionStatus(hIocp, &bytesTransferred, &key, &overlapped, INFINITE);
+        if (!overlapped) {
+            // Woken up by Wh_ModUninit
+            break;
+        }
+
+        pipe_instance_t* instance = (pipe_instance_t*)key;
+        instance->pendingOps--;
+        DWORD error = result ? ERROR_SUCCESS : GetLastError();
+
+        if (overlapped == &instance->writeOverlapped) {
+            instance->writePending = FALSE;
+            if (error != ERROR_SUCCESS) {
+                Wh_Log(L"Writing the response failed, GLE=%d", error);
             }
+            continue;
+        }
 
-            Wh_Log(L"Client connected, waiting for message...");
-            wchar_t buffer[512];
-            DWORD bytesRead;
-            while (!g_shouldClosePipe) {
-                BOOL result = ReadFile(g_hPipe, buffer, sizeof(buffer) - sizeof(wchar_t), &bytesRead, NULL);
-                if (result) {
-                    if (bytesRead >= sizeof(buffer) - sizeof(wchar_t)) {
-                        Wh_Log(L"Buffer overflow detected");
-                        continue;
-                    }
-                    buffer[bytesRead / sizeof(wchar_t)] = L'\0';
-                    Wh_Log(L"Received message: %s", buffer);
-                    HandleWindhawkComm(buffer);
-                } else {
-                    DWORD error = GetLastError();
-                    if (error == ERROR_BROKEN_PIPE || error == ERROR_PIPE_NOT_CONNECTED) {
-                        Wh_Log(L"Client disconnected, GLE=%d", error);
-                        break;
-                    }
-                }
+        if (g_shouldClosePipe) {
+            break;
+        }
+
+        if (!instance->connected) {
+            if (error == ERROR_SUCCESS) {
+                OnPipeInstanceConnected(instance);
+            } else {
+                Wh_Log(L"ConnectNamedPipe failed, GLE=%d", error);
+                DisconnectNamedPipe(instance->hPipe);
+                ConnectPipeInstance(instance);
             }
-        } else {
-            Wh_Log(L"ConnectNamedPipe failed, GLE=%d", GetLastError());
+            continue;
         }
 
-        Wh_Log(L"Closing pipe...");
-        CloseHandle(g_hPipe);
-        g_hPipe = INVALID_HANDLE_VALUE;
-        g_lastRendererPid = NULL;
+        if (error != ERROR_SUCCESS && error != ERROR_MORE_DATA) {
+            Wh_Log(L"Client disconnected, GLE=%d", error);
+            DisconnectNamedPipe(instance->hPipe);
+            ConnectPipeInstance(instance);
+            continue;
+        }
+
+        instance->message.append(instance->readBuffer, bytesTransferred);
+        if (instance->message.size() > PIPE_MAX_MESSAGE_SIZE) {
+            Wh_Log(L"Message too large, dropping");
+            instance->message.clear();
+        } else if (error == ERROR_SUCCESS) {
+            HandlePipeMessage(instance);
+            instance->message.clear();
+        }
+        ReadPipeInstance(instance);
+    }
+
+    Wh_Log(L"Closing pipes...");
+    for (int i = 0; i < PIPE_INSTANCES; i++) {
+        if (instances[i].hPipe != INVALID_HANDLE_VALUE) {
+            CancelIoEx(instances[i].hPipe, NULL);
+            CloseHandle(instances[i].hPipe);
+        }
     }
 
+    // Wait for the cancelled operations before the OVERLAPPED structures go out of scope
+    for (;;) {
+        int pendingOps = 0;
+        for (int i = 0; i < PIPE_INSTANCES; i++) {
+            pendingOps += instances[i].pendingOps;
+        }
+        if (pendingOps <= 0) {
+            break;
+        }
+
+        DWORD bytesTransferred;
+        ULONG_PTR key;
+        OVERLAPPED* overlapped;
+        GetQueuedCompletionStatus(hIocp, &bytesTransferred, &key, &overlapped, 1000);
+        if (!overlapped) {
+            if (GetLastError() == WAIT_TIMEOUT) {
+                Wh_Log(L"Timed out waiting for pipe operations to be cancelled");
+                break;
+            }
+            continue;
+        }
+        ((pipe_instance_t*)key)->pendingOps--;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(g_pipeIocpMutex);
+        g_hPipeIocp = NULL;
+    }
+    CloseHandle(hIocp);
     LocalFree(pSecurityDescriptor);
 }
 
@@ -2670,6 +3197,13 @@ void Wh_ModUninit() {
     Wh_Log(L"Uninit");
 
     g_shouldClosePipe = TRUE;
+    {
+        std::lock_guard<std::mutex> lock(g_pipeIocpMutex);
+        if (g_hPipeIocp) {
+            // Wake up the pipe server thread
+            PostQueuedCompletionStatus(g_hPipeIocp, 0, 0, NULL);
+        }
+    }
 
     if (g_isSpotifyRenderer) {
         // Note: sandboxed renderers won't even respond to the uninit request and keep loaded until the renderer exits
@@ -2691,6 +3225,7 @@ void Wh_ModUninit() {
     if (g_pipeThread.joinable()) {
         g_pipeThread.join();
     }
+    FreeIpcCommands();
 
     EnumWindows(UninitEnumWindowsProc, 1);
 
@@ -2,7 +2,7 @@
 // @id              chrome-ui-tweaks
 // @name            Chrome UI Tweaks
 // @description     Small UI tweaks to Google Chrome
-// @version         1.0.0
+// @version         1.0.2
 // @author          Vasher
 // @github          https://github.com/VasherMC
 // @architecture    x86-64
@@ -152,7 +152,16 @@ Latest tested Chrome version: 124.0.6367.119 (stable), 126.0.6457.0 (canary)
 #include <libloaderapi.h>
 #include <windhawk_api.h>
 #include <winnt.h>
+#include <cwchar>
+#include <cwctype>
+#include <string>
 #include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 using namespace std::string_view_literals;
 
@@ -529,23 +538,192 @@ typedef struct {
     const size_t instr_offset; // estimated location of the searched instructions relative to the entry point
 } function_search;
 
-// Wrapper for string_view::find, that checks the needle is unique within the haystack.
-const char* unique_search(std::string_view haystack, std::string_view needle, LPCWSTR symbol_name) {
-    size_t index1 = haystack.find(needle);
-    if (index1 == std::string_view::npos) {
-        Wh_Log(L"Error: Couldn't find instructions for symbol %s", symbol_name);
+// Multi-signature scanner: all signatures are searched in a single pass over
+// the code section. Each signature is anchored on its two rarest bytes
+// (according to a sampled byte histogram of the section), which are compared
+// 32 positions at a time with AVX2, and only positions where both anchors
+// match are verified against the full signature.
+typedef struct {
+    LPCWSTR name;
+    std::string_view pattern;
+    std::string_view mask; // '?' marks wildcard bytes, empty if all bytes must match
+    // results, filled by scan_signatures
+    const char* match;
+    const char* second_match; // set if the signature isn't unique
+    size_t candidates;
+    double verify_ms;
+} code_signature;
+
+typedef struct {
+    size_t offset1, offset2;
+    unsigned char byte1, byte2;
+    bool done; // found twice, no need to look any further
+} signature_anchors;
+
+#define MAX_SCAN_SIGNATURES 16
+
+#ifndef PF_AVX2_INSTRUCTIONS_AVAILABLE
+#define PF_AVX2_INSTRUCTIONS_AVAILABLE 40
+#endif
+
+bool signature_matches_at(const code_signature& sig, const char* p) {
+    for (size_t i = 0; i < sig.pattern.size(); i++) {
+        if ((sig.mask.empty() || sig.mask[i] != '?') && p[i] != sig.pattern[i]) return false;
+    }
+    return true;
+}
+
+void verify_signature_candidate(code_signature& sig, signature_anchors& anchors, const char* p, LARGE_INTEGER freq) {
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    sig.candidates++;
+    if (signature_matches_at(sig, p)) {
+        if (!sig.match) {
+            sig.match = p;
+        } else {
+            sig.second_match = p;
+            anchors.done = true;
+        }
+    }
+    QueryPerformanceCounter(&end);
+    sig.verify_ms += (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+// sample the section instead of counting every byte, the distribution of a
+// large code section is uniform enough
+void sample_byte_histogram(std::string_view code, size_t histogram[256]) {
+    for (size_t offset = 0; offset < code.size(); offset += 0x100000) {
+        size_t end = std::min(code.size(), offset + 0x10000);
+        for (size_t i = offset; i < end; i++) histogram[(unsigned char)code[i]]++;
+    }
+}
+
+void choose_signature_anchors(const size_t histogram[256], const code_signature& sig, signature_anchors& anchors) {
+    size_t best1 = SIZE_MAX, best2 = SIZE_MAX;
+    for (size_t i = 0; i < sig.pattern.size(); i++) {
+        if (!sig.mask.empty() && sig.mask[i] == '?') continue;
+        size_t count = histogram[(unsigned char)sig.pattern[i]];
+        if (best1 == SIZE_MAX || count < histogram[(unsigned char)sig.pattern[best1]]) {
+            best2 = best1;
+            best1 = i;
+        } else if (best2 == SIZE_MAX || count < histogram[(unsigned char)sig.pattern[best2]]) {
+            best2 = i;
+        }
+    }
+    if (best1 == SIZE_MAX) best1 = 0; // all wildcards, every position is a candidate
+    if (best2 == SIZE_MAX) best2 = best1;
+
+    anchors.offset1 = best1;
+    anchors.offset2 = best2;
+    anchors.byte1 = (unsigned char)sig.pattern[best1];
+    anchors.byte2 = (unsigned char)sig.pattern[best2];
+    anchors.done = false;
+}
+
+// scans [0, end) for candidate positions in 32-byte blocks, returns where the
+// scalar tail scan should continue. The caller guarantees that
+// end + max pattern size <= code size.
+#if defined(_M_X64) || defined(__x86_64__)
+__attribute__((target("avx2")))
+size_t scan_signatures_avx2(const char* base, size_t end, code_signature* sigs, signature_anchors* anchors, size_t count, LARGE_INTEGER freq) {
+    __m256i needle1[MAX_SCAN_SIGNATURES], needle2[MAX_SCAN_SIGNATURES];
+    for (size_t s = 0; s < count; s++) {
+        needle1[s] = _mm256_set1_epi8((char)anchors[s].byte1);
+        needle2[s] = _mm256_set1_epi8((char)anchors[s].byte2);
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= end; i += 32) {
+        for (size_t s = 0; s < count; s++) {
+            if (anchors[s].done) continue;
+            __m256i block1 = _mm256_loadu_si256((const __m256i*)(base + i + anchors[s].offset1));
+            __m256i block2 = _mm256_loadu_si256((const __m256i*)(base + i + anchors[s].offset2));
+            uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_cmpeq_epi8(block1, needle1[s]), _mm256_cmpeq_epi8(block2, needle2[s])));
+            while (mask && !anchors[s].done) {
+                unsigned bit = __builtin_ctz(mask);
+                mask &= mask - 1;
+                verify_signature_candidate(sigs[s], anchors[s], base + i + bit, freq);
+            }
+        }
+    }
+    return i;
+}
+#endif
+
+void scan_signatures(std::string_view code, code_signature* sigs, size_t count) {
+    if (count > MAX_SCAN_SIGNATURES) {
+        Wh_Log(L"Error: too many signatures (%zu)", count);
+        return;
+    }
+
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    size_t histogram[256] = {};
+    sample_byte_histogram(code, histogram);
+
+    signature_anchors anchors[MAX_SCAN_SIGNATURES];
+    size_t max_size = 0;
+    for (size_t s = 0; s < count; s++) {
+        if (sigs[s].pattern.empty()) {
+            Wh_Log(L"Error: empty signature %s", sigs[s].name);
+            return;
+        }
+        sigs[s].match = NULL;
+        sigs[s].second_match = NULL;
+        sigs[s].candidates = 0;
+        sigs[s].verify_ms = 0;
+        choose_signature_anchors(histogram, sigs[s], anchors[s]);
+        max_size = std::max(max_size, sigs[s].pattern.size());
+    }
+
+    const char* base = code.data();
+    size_t i = 0;
+    bool used_avx2 = false;
+#if defined(_M_X64) || defined(__x86_64__)
+    if (code.size() > max_size + 32 && IsProcessorFeaturePresent(PF_AVX2_INSTRUCTIONS_AVAILABLE)) {
+        i = scan_signatures_avx2(base, code.size() - max_size, sigs, anchors, count, freq);
+        used_avx2 = true;
+    }
+#endif
+
+    // the tail (or everything, without AVX2), one signature at a time with
+    // memchr on the rarest byte
+    for (size_t s = 0; s < count; s++) {
+        if (code.size() < sigs[s].pattern.size()) continue;
+        const char* p = base + i + anchors[s].offset1;
+        const char* last = base + code.size() - sigs[s].pattern.size() + anchors[s].offset1;
+        while (!anchors[s].done && p <= last &&
+               (p = (const char*)memchr(p, anchors[s].byte1, last - p + 1)) != NULL) {
+            const char* candidate = p - anchors[s].offset1;
+            if ((unsigned char)candidate[anchors[s].offset2] == anchors[s].byte2) {
+                verify_signature_candidate(sigs[s], anchors[s], candidate, freq);
+            }
+            p++;
+        }
+    }
+
+    QueryPerformanceCounter(&end);
+    Wh_Log(L"Scanned %zu MB for %zu signature(s) in %.1f ms%s", code.size() >> 20, count,
+        (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart, used_avx2 ? L" (AVX2)" : L"");
+    for (size_t s = 0; s < count; s++) {
+        Wh_Log(L"  %s: %zu candidate(s), %.2f ms verifying", sigs[s].name, sigs[s].candidates, sigs[s].verify_ms);
+    }
+}
+
+// Checks that a scanned signature was found exactly once.
+const char* unique_match(const code_signature& sig) {
+    if (sig.match == NULL) {
+        Wh_Log(L"Error: Couldn't find instructions for symbol %s", sig.name);
         return NULL;
     }
-    // Can we find the same sequence again in the rest of the haystack?
-    size_t index2 = haystack.find(needle, index1 + 1);
-    if (index2 != std::string_view::npos) {
-        Wh_Log(L"Error: Found multiple matches for %s: at %p and at %p", symbol_name, haystack.begin()+index1, haystack.begin()+index2);
-        // log_hexdump((unsigned char*)haystack.begin() + index1 - 0x50, 6);
-        // Wh_Log(L"----------------");
-        // log_hexdump((unsigned char*)haystack.begin() + index2 - 0x50, 6);
+    if (sig.second_match != NULL) {
+        Wh_Log(L"Error: Found multiple matches for %s: at %p and at %p", sig.name, sig.match, sig.second_match);
         return NULL;
     }
-    return haystack.begin() + index1;
+    return sig.match;
 }
 
 // get address and size of code section via PE header info  (expect around 200 MB)
@@ -567,14 +745,116 @@ std::string_view getCodeSection(HMODULE chromeModule) {
     };
 }
 
-// Find a function address by scanning for specific instruction patterns.
-// We search the entire code section once per function,
-// to ensure we aren't hooking the wrong location.
-// Better safe than sorry, and it shouldn't cause noticeable delay on startup.
-const char* search_function_instructions(std::string_view code_section, function_search fsearch, LPCWSTR symbol_name) {
-    if (code_section.size()==0) return 0;
-    Wh_Log(L"Searching for function %s", symbol_name);
-    const char* addr = unique_search(code_section, fsearch.search, symbol_name);
+// Windhawk 1.4 fallback (it targets Windows 7 by default)
+#if _WIN32_WINNT < 0x0A00
+inline void Wh_DeleteValue(const wchar_t* key) {
+    Wh_SetIntValue(key, -1);
+}
+#endif
+
+// Identifies the chrome.dll build. The path contains the Chrome version, and
+// the PE header fields change with every build.
+std::wstring get_module_cache_id(HMODULE module) {
+    IMAGE_DOS_HEADER* dos_header = (IMAGE_DOS_HEADER*) module;
+    IMAGE_NT_HEADERS* pe_header = (IMAGE_NT_HEADERS*)(((char*)dos_header) + dos_header->e_lfanew);
+    WCHAR path[MAX_PATH];
+    if (!GetModuleFileNameW(module, path, ARRAYSIZE(path))) {
+        path[0] = L'\0';
+    }
+    WCHAR id[MAX_PATH + 32];
+    swprintf_s(id, L"%s|%08X|%08X|%08X", path, pe_header->FileHeader.TimeDateStamp,
+        pe_header->OptionalHeader.CheckSum, pe_header->OptionalHeader.SizeOfImage);
+    return id;
+}
+
+// Chrome channels (e.g. stable and canary) can run side by side, each with its
+// own chrome.dll, so the cache is kept per install folder. The version folder
+// is left out, so that an update replaces the install's cache instead of adding
+// another one. Returns a prefix for the storage keys of the install's cache.
+std::wstring get_module_cache_prefix(HMODULE module) {
+    WCHAR path[MAX_PATH];
+    DWORD len = GetModuleFileNameW(module, path, ARRAYSIZE(path));
+    if (len == 0 || len == ARRAYSIZE(path)) {
+        return L"cache_";
+    }
+    // strip "\<version>\chrome.dll"
+    for (int i = 0; i < 2; i++) {
+        WCHAR* separator = wcsrchr(path, L'\\');
+        if (separator) {
+            *separator = L'\0';
+        }
+    }
+    // FNV-1a of the case-insensitive path, the keys must stay the same across launches
+    uint32_t hash = 2166136261u;
+    for (const WCHAR* p = path; *p; p++) {
+        hash = (hash ^ (uint32_t)towlower(*p)) * 16777619u;
+    }
+    WCHAR prefix[32];
+    swprintf_s(prefix, L"cache_%08X_", hash);
+    return prefix;
+}
+
+// Locate the signatures, scanning only once per chrome.dll build.
+// The locations (RVAs) of unique matches are stored in the mod storage along with the build id.
+// On later launches of the same build, they're only verified by comparing the signature bytes.
+void resolve_signatures(HMODULE module, std::string_view code_section, code_signature* sigs, const LPCWSTR* cache_keys, size_t count) {
+    if (count > MAX_SCAN_SIGNATURES) {
+        Wh_Log(L"Error: too many signatures (%zu)", count);
+        return;
+    }
+
+    std::wstring module_id = get_module_cache_id(module);
+    std::wstring key_prefix = get_module_cache_prefix(module);
+    std::wstring module_id_key = key_prefix + L"module_id";
+    WCHAR cached_id[MAX_PATH + 32];
+    bool cache_valid = Wh_GetStringValue(module_id_key.c_str(), cached_id, ARRAYSIZE(cached_id)) && module_id == cached_id;
+    if (!cache_valid) {
+        Wh_Log(L"No cached locations for this chrome.dll build");
+    }
+
+    code_signature to_scan[MAX_SCAN_SIGNATURES];
+    size_t to_scan_index[MAX_SCAN_SIGNATURES];
+    size_t scan_count = 0;
+    for (size_t s = 0; s < count; s++) {
+        if (cache_valid) {
+            int rva = Wh_GetIntValue((key_prefix + cache_keys[s]).c_str(), -1);
+            const char* p = (const char*)module + rva;
+            if (rva >= 0 && p >= code_section.data() &&
+                p + sigs[s].pattern.size() <= code_section.data() + code_section.size() &&
+                signature_matches_at(sigs[s], p)) {
+                Wh_Log(L"Using cached location of %s", sigs[s].name);
+                sigs[s].match = p;
+                sigs[s].second_match = NULL;
+                sigs[s].candidates = 0;
+                sigs[s].verify_ms = 0;
+                continue;
+            }
+            Wh_Log(L"Cached location of %s is invalid", sigs[s].name);
+        }
+        to_scan_index[scan_count] = s;
+        to_scan[scan_count++] = sigs[s];
+    }
+
+    if (scan_count == 0) return;
+
+    scan_signatures(code_section, to_scan, scan_count);
+
+    for (size_t i = 0; i < scan_count; i++) {
+        size_t s = to_scan_index[i];
+        sigs[s] = to_scan[i];
+        if (sigs[s].match && !sigs[s].second_match) {
+            Wh_SetIntValue((key_prefix + cache_keys[s]).c_str(), (int)(sigs[s].match - (const char*)module));
+        } else {
+            Wh_DeleteValue((key_prefix + cache_keys[s]).c_str());
+        }
+    }
+    Wh_SetStringValue(module_id_key.c_str(), module_id.c_str());
+}
+
+// Find a function address from the instruction pattern located by scan_signatures.
+// The entire code section is searched, to ensure we aren't hooking the wrong location.
+const char* search_function_instructions(const code_signature& signature, function_search fsearch, LPCWSTR symbol_name) {
+    const char* addr = unique_match(signature);
     if (addr == NULL) {
         Wh_Log(L"Could not find function %s; is the mod up to date?", symbol_name);
         return NULL;
@@ -633,15 +913,17 @@ const std::string_view BookmarkBubble_instructions =
     "\xe8"sv;                   // call
 const std::string_view BookmarkBubble_prologue = "AWAVAUATVWUS"sv;
 
-bool hook_BookmarkBubble(std::string_view code_section) {
+const LPCWSTR BookmarkBubble_symbol = L"?ShowBookmarkBubble@ToolbarView@@QEAAXAEBVGURL@@_N@Z";
+
+bool hook_BookmarkBubble(const code_signature& signature) {
     const char* hook_loc = search_function_instructions(
-        code_section,
+        signature,
         {
             .search = BookmarkBubble_instructions,
             .prologue = BookmarkBubble_prologue,
             .instr_offset = 0xb5,
         },
-        L"?ShowBookmarkBubble@ToolbarView@@QEAAXAEBVGURL@@_N@Z");
+        BookmarkBubble_symbol);
     if (hook_loc == NULL) return false;
     Wh_SetFunctionHook((void*)hook_loc, (void*)ShowBookmarkBubble_Hook, (void **)&ShowBookmarkBubble_Original);
     return true;
@@ -703,8 +985,8 @@ const std::string_view MenuConfig_Instance_postcall = // not unique in chrome 12
 // We hook it and wait for it to be called, to guarantee the MenuConfig has been initialized
 // the function itself is hard to search for, so instead we search for
 // instructions that use specific parts of the returned menuconfig.
-bool hook_Menuconfig_Instance(std::string_view code_section) {
-    const char* callsite = unique_search(code_section, MenuConfig_Instance_postcall, L"MenuConfig::Instance()");
+bool hook_Menuconfig_Instance(const code_signature& signature) {
+    const char* callsite = unique_match(signature);
     if (callsite == NULL) return false;
     if (callsite[-5] != (char)0xe8) {
         Wh_Log(L"Unexpected instruction at %p", callsite);
@@ -728,9 +1010,24 @@ std::atomic<bool> g_unloading = false;
 
 void set_hooks(HMODULE module) {
     std::string_view code_section = getCodeSection(module);
+    if (code_section.size() == 0) {
+        Wh_Log(L"Finished hooking: found %d/%d functions", 0, 2);
+        return;
+    }
+    // search for all signatures in a single pass over the code section,
+    // unless their locations are cached for this build
+    code_signature signatures[] = {
+        { .name = L"MenuConfig::Instance()", .pattern = MenuConfig_Instance_postcall },
+        { .name = BookmarkBubble_symbol, .pattern = BookmarkBubble_instructions },
+    };
+    const LPCWSTR cache_keys[] = {
+        L"MenuConfig_Instance_rva",
+        L"BookmarkBubble_rva",
+    };
+    resolve_signatures(module, code_section, signatures, cache_keys, ARRAYSIZE(signatures));
     int hooks_placed = 0;
-    hooks_placed += hook_Menuconfig_Instance(code_section);
-    hooks_placed += hook_BookmarkBubble(code_section);
+    hooks_placed += hook_Menuconfig_Instance(signatures[0]);
+    hooks_placed += hook_BookmarkBubble(signatures[1]);
     Wh_Log(L"Finished hooking: found %d/%d functions", hooks_placed, 2);
 }
 
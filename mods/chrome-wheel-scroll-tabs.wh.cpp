@@ -2,7 +2,7 @@
 // @id              chrome-wheel-scroll-tabs
 // @name            Chrome/Edge scroll tabs with mouse wheel
 // @description     Use the mouse wheel while hovering over the tab bar to switch between tabs
-// @version         1.2.1
+// @version         1.2.2
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -62,6 +62,8 @@ Yandex Browser.
 #include <commctrl.h>
 #include <windowsx.h>
 
+#include <algorithm>
+
 struct {
     bool reverseScrollingDirection;
     bool horizontalScrolling;
@@ -74,6 +76,22 @@ DWORD g_uiThreadId;
 DWORD g_lastScrollTime;
 HWND g_lastScrollWnd;
 short g_lastScrollDeltaRemainder;
+DWORD g_lastTabSwitchTime;
+
+// Window rect and DPI of the last scrolled window, so that a stream of wheel
+// messages doesn't query them for each message. Only accessed from the UI
+// thread, and invalidated by the subclass proc when the window moves or its
+// DPI changes.
+struct {
+    HWND hWnd;
+    RECT rect;
+    UINT dpi;
+} g_windowGeometryCache;
+
+// High-resolution touchpads send many small deltas, and a fling can add up to
+// many notches in a short time. Tab switches closer than this to the previous
+// one are held back, and at most one notch is kept for when it passes.
+constexpr DWORD kMinTabSwitchIntervalMs = 50;
 
 // wParam - TRUE to subclass, FALSE to unsubclass
 // lParam - subclass data
@@ -166,10 +184,14 @@ bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
         return false;
     }
 
-    RECT rect{};
-    GetWindowRect(hWnd, &rect);
+    if (g_windowGeometryCache.hWnd != hWnd) {
+        g_windowGeometryCache.hWnd = hWnd;
+        GetWindowRect(hWnd, &g_windowGeometryCache.rect);
+        g_windowGeometryCache.dpi = GetDpiForWindowWithFallback(hWnd);
+    }
 
-    UINT dpi = GetDpiForWindowWithFallback(hWnd);
+    const RECT& rect = g_windowGeometryCache.rect;
+    UINT dpi = g_windowGeometryCache.dpi;
 
     if (int scrollAreaLimitPixelsFromTop =
             g_settings.scrollAreaLimitPixelsFromTop) {
@@ -226,13 +248,33 @@ bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
         }
     }
 
-    if (hWnd == g_lastScrollWnd &&
-        GetTickCount() - g_lastScrollTime < 1000 * 5) {
-        delta += g_lastScrollDeltaRemainder;
+    DWORD tickCount = GetTickCount();
+    bool continuesLastScroll =
+        hWnd == g_lastScrollWnd && tickCount - g_lastScrollTime < 1000 * 5;
+
+    int accumulatedDelta = delta;
+    if (continuesLastScroll) {
+        accumulatedDelta += g_lastScrollDeltaRemainder;
+    }
+
+    int clicks = accumulatedDelta / WHEEL_DELTA;
+    if (clicks != 0 && continuesLastScroll &&
+        tickCount - g_lastTabSwitchTime < kMinTabSwitchIntervalMs) {
+        clicks = 0;
     }
 
-    int clicks = delta / WHEEL_DELTA;
-    Wh_Log(L"%d clicks (delta=%d)", clicks, delta);
+    g_lastScrollTime = tickCount;
+    g_lastScrollWnd = hWnd;
+
+    // Not enough for a notch yet, or held back. Nothing is sent, to avoid
+    // flooding the browser with Ctrl presses for each small delta.
+    if (clicks == 0) {
+        g_lastScrollDeltaRemainder =
+            (short)std::clamp(accumulatedDelta, -WHEEL_DELTA, WHEEL_DELTA);
+        return true;
+    }
+
+    Wh_Log(L"%d clicks (delta=%d)", clicks, accumulatedDelta);
 
     WORD key = VK_NEXT;
     if (clicks < 0) {
@@ -265,9 +307,8 @@ bool OnMouseWheel(HWND hWnd, WORD keys, short delta, int xPos, int yPos) {
 
     delete[] input;
 
-    g_lastScrollTime = GetTickCount();
-    g_lastScrollWnd = hWnd;
-    g_lastScrollDeltaRemainder = delta % WHEEL_DELTA;
+    g_lastTabSwitchTime = tickCount;
+    g_lastScrollDeltaRemainder = accumulatedDelta % WHEEL_DELTA;
 
     return true;
 }
@@ -283,6 +324,14 @@ LRESULT CALLBACK BrowserWindowSubclassProc(_In_ HWND hWnd,
     }
 
     switch (uMsg) {
+        case WM_WINDOWPOSCHANGED:
+        case WM_DPICHANGED:
+        case WM_NCDESTROY:
+            if (g_windowGeometryCache.hWnd == hWnd) {
+                g_windowGeometryCache.hWnd = nullptr;
+            }
+            break;
+
         case WM_MOUSEWHEEL:
         case WM_MOUSEHWHEEL: {
             WORD fwKeys = GET_KEYSTATE_WPARAM(wParam);
@@ -2,7 +2,7 @@
 // @id              classic-desktop-icons
 // @name            Classic Desktop Icons
 // @description     Enables the classic selection style on desktop icons.
-// @version         1.4.4
+// @version         1.4.5
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         explorer.exe
@@ -92,6 +92,15 @@ const RECT g_rcOriginalMargins { 4, 5, 0, 0 };
 HWND g_hWndDesktop = NULL;
 BOOL g_bSubclassed = FALSE;
 
+// UpdateDesktop runs on many list view messages, so it only re-applies what has
+// actually been reset. These track what's already applied.
+BOOL g_bUnthemed = FALSE;
+BOOL g_bApplyingTheme = FALSE;
+
+// The primary monitor's work area, cached until the display or the work areas change.
+RECT g_rcPrimaryWorkArea;
+BOOL g_bPrimaryWorkAreaValid = FALSE;
+
 bool ShouldLimitWorkingArea()
 {
     return settings.fLimitToWorkingSpace && GetSystemMetrics(SM_CMONITORS) <= 1;
@@ -149,6 +158,21 @@ void CLVDrawManager___PaintWorkArea_hook(void *pThis, HDC hdcTarget, RECT *pRect
 
     HWND hWnd = WindowFromDC(hdcTarget);
 
+    if (hWnd == g_hWndDesktop && g_hWndDesktop)
+    {
+        // Only paint the work areas that intersect the damaged region. With multiple
+        // monitors, a marquee selection on one of them would otherwise repaint all
+        // of them.
+        RECT rcClip;
+        RECT rcIntersect;
+        int clipRegion = GetClipBox(hdcTarget, &rcClip);
+        if (clipRegion == NULLREGION ||
+            (clipRegion != ERROR && pRect && !IntersectRect(&rcIntersect, pRect, &rcClip)))
+        {
+            return;
+        }
+    }
+
     if (hWnd == g_hWndDesktop && settings.noselect)
     {
         disableMarquee = true;
@@ -208,9 +232,31 @@ bool GetMonitorRects(HMONITOR hMonitor, LPRECT prc, bool fGetWorkingArea)
     return true;
 }
 
+bool GetPrimaryWorkArea(LPRECT prc)
+{
+    if (!g_bPrimaryWorkAreaValid)
+    {
+        if (!GetMonitorRects(GetPrimaryMonitor(), &g_rcPrimaryWorkArea, true))
+            return false;
+
+        g_bPrimaryWorkAreaValid = TRUE;
+    }
+
+    *prc = g_rcPrimaryWorkArea;
+    return true;
+}
+
+void InvalidateMonitorRects()
+{
+    g_bPrimaryWorkAreaValid = FALSE;
+}
+
 HRESULT (*CDesktopBrowser__SetDesktopWorkAreas_orig)(void *pThis, HWND hWnd, RECT *pRect);
 HRESULT CDesktopBrowser__SetDesktopWorkAreas_hook(void *pThis, HWND hWnd, RECT *pRect)
 {
+    // The work areas changed, e.g. the taskbar was moved or resized.
+    InvalidateMonitorRects();
+
     // If we're limiting the size of the desktop window to the working space, then we
     // don't want to set the work area, since that will duplicate the padding.
     if (ShouldLimitWorkingArea())
@@ -240,6 +286,17 @@ LRESULT CALLBACK DesktopSubclassProc(
     DWORD_PTR dwRefData
 )
 {
+    if (uMsg == WM_SIZE || uMsg == WM_DISPLAYCHANGE || uMsg == WM_SETTINGCHANGE)
+    {
+        InvalidateMonitorRects();
+    }
+
+    if (uMsg == WM_THEMECHANGED && !g_bApplyingTheme)
+    {
+        // Someone else changed the theme of the desktop, it has to be removed again.
+        g_bUnthemed = FALSE;
+    }
+
     if (uMsg == WM_SETREDRAW || uMsg == LVM_GETITEMCOUNT || uMsg == WM_SIZE)
     {
         UpdateDesktop();
@@ -263,31 +320,52 @@ void UpdateDesktop(void)
     if (g_hWndDesktop != NULL)
     {
         /* Untheme the desktop */
-        if (settings.fOldSelection)
+        // Re-theming repaints the whole desktop, so only do it if it's not unthemed yet.
+        if (settings.fOldSelection && !g_bUnthemed)
         {
+            g_bApplyingTheme = TRUE;
             SetWindowTheme(g_hWndDesktop, NULL, NULL);
             SendMessageW(g_hWndDesktop, WM_THEMECHANGED, 0, 0);
+            g_bApplyingTheme = FALSE;
+            g_bUnthemed = TRUE;
         }
 
         // Set the margin of the desktop view:
-        SendMessageW(g_hWndDesktop, LVM_SETVIEWMARGINS, 0, (LPARAM)&settings.rcMargins);
+        RECT rcMargins = { 0 };
+        SendMessageW(g_hWndDesktop, LVM_GETVIEWMARGINS, 0, (LPARAM)&rcMargins);
+        if (!EqualRect(&rcMargins, &settings.rcMargins))
+        {
+            SendMessageW(g_hWndDesktop, LVM_SETVIEWMARGINS, 0, (LPARAM)&settings.rcMargins);
+        }
 
         /* Apply the desktop background color */
         if (settings.background)
         {
-            SendMessageW(
-                g_hWndDesktop,
-                LVM_SETTEXTBKCOLOR,
-                NULL,
-                GetSysColor(COLOR_BACKGROUND)
-            );
+            COLORREF crBackground = GetSysColor(COLOR_BACKGROUND);
+            if ((COLORREF)SendMessageW(g_hWndDesktop, LVM_GETTEXTBKCOLOR, 0, 0) != crBackground)
+            {
+                SendMessageW(
+                    g_hWndDesktop,
+                    LVM_SETTEXTBKCOLOR,
+                    NULL,
+                    crBackground
+                );
+            }
         }
 
         // Update the size if we're limiting to the working space:
         if (ShouldLimitWorkingArea())
         {
             RECT rcWorkArea;
-            if (GetMonitorRects(GetPrimaryMonitor(), &rcWorkArea, true))
+            RECT rcDefView = { 0 };
+            HWND hWndDefView = GetParent(g_hWndDesktop);
+            if (GetWindowRect(hWndDefView, &rcDefView))
+            {
+                MapWindowPoints(NULL, GetParent(hWndDefView), (LPPOINT)&rcDefView, 2);
+            }
+
+            // Skip if the DefView window already fills the work area.
+            if (GetPrimaryWorkArea(&rcWorkArea) && !EqualRect(&rcDefView, &rcWorkArea))
             {
                 SetWindowPos(
                     // We want to change the position of the DefView window and not the
@@ -585,6 +663,7 @@ void Wh_ModUninit(void)
 
     /* Retheme desktop */
     SetWindowTheme(g_hWndDesktop, L"Desktop", NULL);
+    g_bUnthemed = FALSE;
     Wh_Log(L"Unloaded Classic Desktop Icons");
 }
 
@@ -2,7 +2,7 @@
 // @id              classic-explorer-treeview
 // @name            Classic Explorer Treeview
 // @description     Modifies Folder Treeview in file explorer so as to make it look more classic.
-// @version         1.1.3
+// @version         1.1.4
 // @author          Waldemar
 // @github          https://github.com/CyprinusCarpio
 // @include         explorer.exe
@@ -165,6 +165,7 @@ are enabled.
 
 #include <wingdi.h>
 #include <wrl.h>
+#include <atomic>
 #include <vector>
 #include <shlwapi.h>
 #include <shdeprecated.h>
@@ -291,8 +292,8 @@ public:
 //Used to keep track of the extra data assigned to each file explorer window
 std::vector<FEWExtra> g_FEWExtras;
 
-// Euclidean color distance
-double ColorDistance(DWORD color1, DWORD color2)
+// Squared euclidean color distance, which is enough for comparing distances
+int ColorDistanceSquared(DWORD color1, DWORD color2)
 {
     int b1 = (color1 & 0xFF);
     int g1 = ((color1 >> 8) & 0xFF);
@@ -302,38 +303,64 @@ double ColorDistance(DWORD color1, DWORD color2)
     int g2 = ((color2 >> 8) & 0xFF);
     int r2 = ((color2 >> 16) & 0xFF);
 
-    return std::sqrt(std::pow(r2 - r1, 2) + std::pow(g2 - g1, 2) + std::pow(b2 - b1, 2));
+    return (r2 - r1) * (r2 - r1) + (g2 - g1) * (g2 - g1) + (b2 - b1) * (b2 - b1);
 }
 
-void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
+// Colors used for the expando buttons and lines. These are resolved once per
+// color scheme instead of for every painted node, and invalidated on
+// WM_SYSCOLORCHANGE and when the settings change.
+struct ExpandoColors
 {
-    RECT rect;
-    TreeView_GetItemRect(hTree, hItem, &rect, TRUE);
+    DWORD windowColor;
+    DWORD lineColor;
+    DWORD textColor;
+};
+
+ExpandoColors g_expandoColors;
+std::atomic<bool> g_expandoColorsValid = false;
+
+ExpandoColors GetExpandoColors()
+{
+    if (g_expandoColorsValid)
+    {
+        return g_expandoColors;
+    }
+
+    ExpandoColors colors;
+    colors.windowColor = GetSysColor(COLOR_WINDOW);
+    colors.textColor = GetSysColor(COLOR_BTNTEXT);
 
-    // Get system colors
-    bool useHighlight = false;
-    DWORD windowColor = GetSysColor(COLOR_WINDOW);
     DWORD shadowColor = GetSysColor(COLOR_3DSHADOW);
     DWORD highlightColor = GetSysColor(COLOR_3DHIGHLIGHT);
 
-    // Check the line color option and set the useHighlight flag accordingly
-    if (g_lineColorOptionInt == 1)
+    // Shadow color is default
+    colors.lineColor = shadowColor;
+    if (g_lineColorOptionInt == 1) // highlight color
     {
-        useHighlight = true;
+        colors.lineColor = highlightColor;
     }
-    else if (g_lineColorOptionInt == 2)
+    else if (g_lineColorOptionInt == 2) // automatic color
     {
-        // Calculate the color distances
-        double distanceShadow = ColorDistance(windowColor, shadowColor);
-        double distanceHighlight = ColorDistance(windowColor, highlightColor);
-
-        // Determine whether to use highlight based on color distances
-        if (distanceHighlight > distanceShadow)
+        // Use whichever stands out more against the window color
+        if (ColorDistanceSquared(colors.windowColor, highlightColor) >
+            ColorDistanceSquared(colors.windowColor, shadowColor))
         {
-            useHighlight = true;
+            colors.lineColor = highlightColor;
         }
     }
 
+    g_expandoColors = colors;
+    g_expandoColorsValid = true;
+    return colors;
+}
+
+void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
+{
+    RECT rect;
+    TreeView_GetItemRect(hTree, hItem, &rect, TRUE);
+
+    ExpandoColors colors = GetExpandoColors();
+
     // Even though the item height should be 16, I'm accomodating some more heights
     UINT itemHeight = TreeView_GetItemHeight(hTree);
     switch(itemHeight)
@@ -365,9 +392,10 @@ void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
         // Get the state of the item
         UINT state = TreeView_GetItemState(hTree, hItem, TVIS_EXPANDED);
 
-        // Create a solid brush with the window color and select it into the device context
-        HBRUSH brush = CreateSolidBrush(windowColor);
-        HBRUSH original = (HBRUSH)SelectObject(hdc, brush);
+        // The DC brush and pen are used so that no GDI objects have to be
+        // created for every painted node
+        HBRUSH brush = (HBRUSH)GetStockObject(DC_BRUSH);
+        COLORREF originalBrushColor = SetDCBrushColor(hdc, colors.windowColor);
 
         // Define the rectangle for the button
         RECT buttonRect;
@@ -376,23 +404,18 @@ void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
         buttonRect.right = rect.left + 9;
         buttonRect.bottom = rect.top + 9;
 
-        // Fill the rectangle with the brush color and delete the brush
+        // Fill the rectangle with the window color
         FillRect(hdc, &buttonRect, brush);
-        DeleteObject(brush);
 
-        // Create a new brush with the highlight color if useHighlight is true, otherwise shadowColor
-        brush = CreateSolidBrush(useHighlight ? highlightColor : shadowColor);
-
-        // Draw a frame around the button rectangle with the new brush and delete the brush
+        // Draw a frame around the button rectangle with the line color
+        SetDCBrushColor(hdc, colors.lineColor);
         FrameRect(hdc, &buttonRect, brush);
-        DeleteObject(brush);
 
-        // Restore the original brush to the device context
-        SelectObject(hdc, original);
+        SetDCBrushColor(hdc, originalBrushColor);
 
-        // Create a pen with a solid style and the button text color, and select it into the device context
-        HPEN hPen = CreatePen(PS_SOLID, 1, GetSysColor(COLOR_BTNTEXT));
-        HPEN hOldPen = (HPEN)SelectObject(hdc, hPen);
+        // Select a solid pen with the button text color into the device context
+        HPEN hOldPen = (HPEN)SelectObject(hdc, GetStockObject(DC_PEN));
+        COLORREF originalPenColor = SetDCPenColor(hdc, colors.textColor);
 
         // Draw a +/- symbol in the item's button based on its expanded state
         if (state & TVIS_EXPANDED)
@@ -408,9 +431,9 @@ void DrawExpandoButton(HWND hTree, HDC hdc, HTREEITEM hItem)
             LineTo(hdc, rect.left + 4, rect.top + 7);
         }
 
-        // Restore the original pen to the device context and delete the pen
+        // Restore the original pen to the device context
+        SetDCPenColor(hdc, originalPenColor);
         SelectObject(hdc, hOldPen);
-        DeleteObject(hPen);
     }
 }
 
@@ -1024,18 +1047,15 @@ LRESULT CALLBACK TVSubclassProc(_In_ HWND hWnd,
             lptvi->iIntegral = 1;
         }
     }
-    else if(uMsg == WM_SYSCOLORCHANGE && g_lineColorOptionInt == 2)
+    else if(uMsg == WM_SYSCOLORCHANGE)
     {
-        //If the automatic line color setting is enabled, new best color needs to be set
-        DWORD windowColor = GetSysColor(COLOR_WINDOW);
-        DWORD shadowColor = GetSysColor(COLOR_3DSHADOW);
-        DWORD highlightColor = GetSysColor(COLOR_3DHIGHLIGHT);
+        g_expandoColorsValid = false;
 
-        // Calculate the color distances
-        double distanceShadow = ColorDistance(windowColor, shadowColor);
-        double distanceHighlight = ColorDistance(windowColor, highlightColor);
-
-        TreeView_SetLineColor(hWnd, distanceHighlight > distanceShadow ? highlightColor : shadowColor);
+        //If the automatic line color setting is enabled, new best color needs to be set
+        if (g_lineColorOptionInt == 2)
+        {
+            TreeView_SetLineColor(hWnd, GetExpandoColors().lineColor);
+        }
     }
     return DefSubclassProc(hWnd, uMsg, wParam, lParam);
 }
@@ -1086,21 +1106,9 @@ HWND __cdecl NSCCreateTreeviewHook(void* pThis, HWND hWnd)
             TreeView_SetItemHeight(treeview, 16);
 
             // Set dotted line color. Shadow color is default
-            DWORD highlightColor = GetSysColor(COLOR_3DHIGHLIGHT);
-            if(g_lineColorOptionInt == 1) //highlight color
-            {
-                TreeView_SetLineColor(treeview, highlightColor);
-            }
-            else if(g_lineColorOptionInt == 2) //automatic color
+            if(g_lineColorOptionInt != 0)
             {
-                DWORD windowColor = GetSysColor(COLOR_WINDOW);
-                DWORD shadowColor = GetSysColor(COLOR_3DSHADOW);
-
-                // Calculate the color distances
-                double distanceShadow = ColorDistance(windowColor, shadowColor);
-                double distanceHighlight = ColorDistance(windowColor, highlightColor);
-
-                TreeView_SetLineColor(treeview, distanceHighlight > distanceShadow ? highlightColor : shadowColor);
+                TreeView_SetLineColor(treeview, GetExpandoColors().lineColor);
             }
             // Set the extended style to bring back the classic tooltip
             DWORD exStyle = TreeView_GetExtendedStyle(treeview);
@@ -1349,4 +1357,6 @@ void Wh_ModSettingsChanged()
     {
         g_lineColorOptionInt = 2;
     }
-}
\ No newline at end of file
+
+    g_expandoColorsValid = false;
+}
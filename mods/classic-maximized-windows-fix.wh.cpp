@@ -2,7 +2,7 @@
 // @id              classic-maximized-windows-fix
 // @name            Fix Classic Theme Maximized Windows
 // @description     Fix maximized windows having borders that spill out onto additional displays when using the classic theme.
-// @version         2.2
+// @version         2.2.1
 // @author          ephemeralViolette
 // @github          https://github.com/ephemeralViolette
 // @include         *
@@ -45,14 +45,34 @@ so rarely they may be affected. For consistency, I manually excluded `conhost.ex
 */
 // ==/WindhawkModReadme==
 
-#include <vector>
-#include <algorithm>
-#include <synchapi.h>
 #include <windhawk_utils.h>
 
-CRITICAL_SECTION g_criticalSection;
-std::vector<HWND> g_affectedWindows;
-std::vector<HWND> g_fakeUndoWindows;
+/*
+ * The masking state of each window is stored in a window property, which is only
+ * ever touched from the window's own thread. This avoids a process wide lock and
+ * list search for every WM_WINDOWPOSCHANGED of every window.
+ */
+enum MASKSTATE
+{
+    MS_NONE = 0,
+    MS_MASKED,
+    MS_FAKEUNDO,
+};
+
+ATOM g_maskStateProp = 0;
+
+MASKSTATE GetMaskState(HWND hWnd)
+{
+    return (MASKSTATE)(ULONG_PTR)GetPropW(hWnd, MAKEINTATOM(g_maskStateProp));
+}
+
+void SetMaskState(HWND hWnd, MASKSTATE state)
+{
+    if (state == MS_NONE)
+        RemovePropW(hWnd, MAKEINTATOM(g_maskStateProp));
+    else
+        SetPropW(hWnd, MAKEINTATOM(g_maskStateProp), (HANDLE)(ULONG_PTR)state);
+}
 
 // === DPI HELPERS === //
 // These are only available in Windows 10, version 1607 and newer.
@@ -60,20 +80,21 @@ unsigned int (WINAPI *g_pGetDpiForWindow)(HWND);
 int (WINAPI *g_pGetSystemMetricsForDpi)(int, unsigned int);
 
 /*
- * GetSystemMetricsForWindow: Get the system metrics for a given window.
+ * GetSizeBordersForWindow: Get the size of the resizing borders for a given window.
  *
  * This function is per-monitor DPI aware when available.
  */
-int GetSystemMetricsForWindow(HWND hWnd, int nIndex)
+int GetSizeBordersForWindow(HWND hWnd)
 {
     if (g_pGetDpiForWindow && g_pGetSystemMetricsForDpi)
     {
         unsigned int dpi = g_pGetDpiForWindow(hWnd);
-        return g_pGetSystemMetricsForDpi(nIndex, dpi);
+        return g_pGetSystemMetricsForDpi(SM_CXSIZEFRAME, dpi)
+            + g_pGetSystemMetricsForDpi(SM_CXPADDEDBORDER, dpi);
     }
     else
     {
-        return GetSystemMetrics(nIndex);
+        return GetSystemMetrics(SM_CXSIZEFRAME) + GetSystemMetrics(SM_CXPADDEDBORDER);
     }
 }
 
@@ -81,41 +102,23 @@ int GetSystemMetricsForWindow(HWND hWnd, int nIndex)
  * ApplyWindowMasking: Applies a mask to the window to clip the borders drawn
  *                     by the window manager.
  */
-LRESULT ApplyWindowMasking(HWND hWnd)
+LRESULT ApplyWindowMasking(HWND hWnd, int sizeBorders)
 {
-    BOOL canLock = TryEnterCriticalSection(&g_criticalSection);
-    int sizeBorders =
-        GetSystemMetricsForWindow(hWnd, SM_CXSIZEFRAME) +
-        GetSystemMetricsForWindow(hWnd, SM_CXPADDEDBORDER);
     RECT rcWindow;
-    HRGN hRgn = NULL;
-
-    if (canLock)
-    {
-        GetWindowRect(hWnd, &rcWindow);
+    GetWindowRect(hWnd, &rcWindow);
 
-        int cxWindow = rcWindow.right - rcWindow.left;
-        int cyWindow = rcWindow.bottom - rcWindow.top;
+    int cxWindow = rcWindow.right - rcWindow.left;
+    int cyWindow = rcWindow.bottom - rcWindow.top;
 
-        // SetWindowRgn transfers ownership of the HRGN to the operating system, so it's not
-        // our responsibility to clean.
-        hRgn = CreateRectRgn(
-            0 + sizeBorders, 0 + sizeBorders,
-            cxWindow - sizeBorders, cyWindow - sizeBorders
-        );
+    // SetWindowRgn transfers ownership of the HRGN to the operating system, so it's not
+    // our responsibility to clean.
+    HRGN hRgn = CreateRectRgn(
+        0 + sizeBorders, 0 + sizeBorders,
+        cxWindow - sizeBorders, cyWindow - sizeBorders
+    );
 
-        g_affectedWindows.push_back(hWnd);
-    
-        // If the window is marked as "fake undo", then remove that flag.
-        std::vector<HWND>::iterator i;
-        if ((i = std::find(g_fakeUndoWindows.begin(), g_fakeUndoWindows.end(), hWnd)) != g_fakeUndoWindows.end())
-        {
-            std::vector<HWND>::iterator newEnd = std::remove(g_fakeUndoWindows.begin(), g_fakeUndoWindows.end(), hWnd);
-            g_fakeUndoWindows.erase(newEnd, g_fakeUndoWindows.end());
-        }
-            
-        LeaveCriticalSection(&g_criticalSection);
-    }
+    // This also removes the "fake undo" state, if the window had it.
+    SetMaskState(hWnd, MS_MASKED);
 
     if (hRgn != NULL && SetWindowRgn(hWnd, hRgn, TRUE))
     {
@@ -138,32 +141,19 @@ LRESULT ApplyWindowMasking(HWND hWnd)
  */
 LRESULT FakeUndoWindowMasking(HWND hWnd)
 {
-    std::vector<HWND>::iterator i;
-
-    BOOL canLock = TryEnterCriticalSection(&g_criticalSection);
-
-    if (canLock)
+    if (GetMaskState(hWnd) == MS_MASKED)
     {
-        if ((i = std::find(g_affectedWindows.begin(), g_affectedWindows.end(), hWnd)) != g_affectedWindows.end())
-        {
-            std::vector<HWND>::iterator newEnd = std::remove(g_affectedWindows.begin(), g_affectedWindows.end(), hWnd);
-            g_affectedWindows.erase(newEnd, g_affectedWindows.end());
-            g_fakeUndoWindows.push_back(hWnd);
-
-            HRGN hRgn = CreateRectRgn(
-                0, 0,
-                99999, 99999
-            );
-
-            SetWindowRgn(hWnd, hRgn, TRUE);
-        }
+        SetMaskState(hWnd, MS_FAKEUNDO);
 
-        LeaveCriticalSection(&g_criticalSection);
+        HRGN hRgn = CreateRectRgn(
+            0, 0,
+            99999, 99999
+        );
 
-        return S_OK;
+        SetWindowRgn(hWnd, hRgn, TRUE);
     }
 
-    return E_FAIL;
+    return S_OK;
 }
 
 /*
@@ -171,26 +161,14 @@ LRESULT FakeUndoWindowMasking(HWND hWnd)
  */
 LRESULT UndoWindowMasking(HWND hWnd)
 {
-    std::vector<HWND>::iterator i;
-
-    BOOL canLock = TryEnterCriticalSection(&g_criticalSection);
-
-    if (canLock)
+    if (GetMaskState(hWnd) == MS_MASKED)
     {
-        if ((i = std::find(g_affectedWindows.begin(), g_affectedWindows.end(), hWnd)) != g_affectedWindows.end())
-        {
-            std::vector<HWND>::iterator newEnd = std::remove(g_affectedWindows.begin(), g_affectedWindows.end(), hWnd);
-            g_affectedWindows.erase(newEnd, g_affectedWindows.end());
+        SetMaskState(hWnd, MS_NONE);
 
-            SetWindowRgn(hWnd, NULL, TRUE);
-        }
-
-        LeaveCriticalSection(&g_criticalSection);
-
-        return S_OK;
+        SetWindowRgn(hWnd, NULL, TRUE);
     }
 
-    return E_FAIL;
+    return S_OK;
 }
 
 /*
@@ -205,9 +183,7 @@ void HandleMaxForWindow(HWND hWnd, UINT uMsg)
         if (dwStyle & WS_MAXIMIZE && dwStyle & WS_CAPTION && !(dwStyle & WS_CHILD))
         {
             /* Check if window is truly maximized to the full size of the screen */
-            int sizeBorders =
-                GetSystemMetricsForWindow(hWnd, SM_CXSIZEFRAME) +
-                GetSystemMetricsForWindow(hWnd, SM_CXPADDEDBORDER);
+            int sizeBorders = GetSizeBordersForWindow(hWnd);
 
             /**
              * Get the info for the monitor the window is on.
@@ -231,9 +207,9 @@ void HandleMaxForWindow(HWND hWnd, UINT uMsg)
                 return;
             }
 
-            if (std::find(g_affectedWindows.begin(), g_affectedWindows.end(), hWnd) == g_affectedWindows.end())
+            if (GetMaskState(hWnd) != MS_MASKED)
             {
-                ApplyWindowMasking(hWnd);
+                ApplyWindowMasking(hWnd, sizeBorders);
             }
         }
         else
@@ -241,6 +217,10 @@ void HandleMaxForWindow(HWND hWnd, UINT uMsg)
             FakeUndoWindowMasking(hWnd);
         }
     }
+    else if (hWnd && (uMsg == WM_NCDESTROY))
+    {
+        SetMaskState(hWnd, MS_NONE);
+    }
 }
 
 typedef LRESULT (WINAPI *DefWindowProcA_t)(HWND, UINT, WPARAM, LPARAM);
@@ -287,22 +267,22 @@ BOOL CALLBACK ThemePostWndProc_hook(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
 }
 
 /*
- * InitCriticalSections: Setup data-access locks.
+ * RemoveMaskStates: Remove the masking state property from the windows of this process.
  */
-bool InitCriticalSections()
+void RemoveMaskStates()
 {
-    if (!InitializeCriticalSectionAndSpinCount(&g_criticalSection, 0x400))
-        return false;
-
-    return true;
-}
-
-/*
- * CleanCriticalSections: Clean up data-access locks.
- */
-void CleanCriticalSections()
-{
-    DeleteCriticalSection(&g_criticalSection);
+    EnumWindows(
+        [](HWND hWnd, LPARAM lParam) WINAPI -> BOOL
+        {
+            DWORD dwProcessId = 0;
+            if (GetWindowThreadProcessId(hWnd, &dwProcessId) && dwProcessId == GetCurrentProcessId())
+            {
+                RemovePropW(hWnd, MAKEINTATOM(g_maskStateProp));
+            }
+            return TRUE;
+        },
+        0
+    );
 }
 
 // The mod is being initialized, load settings, hook functions, and do other
@@ -311,7 +291,12 @@ BOOL Wh_ModInit()
 {
     Wh_Log(L"Init " WH_MOD_ID L" version " WH_MOD_VERSION);
 
-    InitCriticalSections();
+    g_maskStateProp = GlobalAddAtomW(L"Windhawk_" WH_MOD_ID L"_MaskState");
+    if (!g_maskStateProp)
+    {
+        Wh_Log(L"GlobalAddAtomW failed");
+        return FALSE;
+    }
 
     HMODULE user32 = LoadLibraryW(L"user32.dll");
     HMODULE uxtheme = LoadLibraryExW(L"uxtheme.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
@@ -362,5 +347,6 @@ void Wh_ModUninit()
 {
     Wh_Log(L"Uninit");
 
-    CleanCriticalSections();
+    RemoveMaskStates();
+    GlobalDeleteAtom(g_maskStateProp);
 }
@@ -2,7 +2,7 @@
 // @id              classic-progress-bars
 // @name            Classic Progress Bars
 // @description     Reverts progress bars to how they looked in Windows XP and before
-// @version         1.0.0
+// @version         1.0.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -227,16 +227,28 @@ void ProEraseBkgnd(PRO_DATA *ppd, HDC hdc, RECT* prcClient)
 #define BLOCKSINMARQUEE 5
 BOOL MarqueeShowBlock(int iBlock, int iMarqueeBlock, int nBlocks)
 {
-    int i;
-    for (i = 0; i < BLOCKSINMARQUEE; i++)
+    // The marquee covers the whole bar
+    if (nBlocks <= BLOCKSINMARQUEE)
     {
-        if ((iMarqueeBlock + i - (BLOCKSINMARQUEE / 2)) % nBlocks == iBlock)
+        int i;
+        for (i = 0; i < BLOCKSINMARQUEE; i++)
         {
-            return TRUE;
+            if ((iMarqueeBlock + i - (BLOCKSINMARQUEE / 2)) % nBlocks == iBlock)
+            {
+                return TRUE;
+            }
         }
+
+        return FALSE;
     }
 
-    return FALSE;
+    // Offset of the block from the trailing end of the marquee, which only
+    // wraps around past the end of the bar
+    int iOffset = iBlock - (iMarqueeBlock - (BLOCKSINMARQUEE / 2));
+    if (iOffset < 0)
+        iOffset += nBlocks;
+
+    return iOffset < BLOCKSINMARQUEE;
 }
 
 /* Re-allocate the PRO_DATA struct to include our extra field if
@@ -368,6 +380,10 @@ void __fastcall Progress_Paint_hook(PRO_DATA_EX *ppd, HDC hdcIn)
             nBlocks = (x + (dxBlock + dxSpace) - 1) / (dxBlock + dxSpace); // round up
         }
 
+        // Only the invalidated blocks need to be drawn
+        RECT rcBounds, rcBlock;
+        GetClipBox(hdc, &rcBounds);
+
         for (i = 0; i < nBlocks; i++) 
         {
             if (ppd->dwStyle & PBS_VERTICAL) 
@@ -402,6 +418,11 @@ void __fastcall Progress_Paint_hook(PRO_DATA_EX *ppd, HDC hdcIn)
                 fShowBlock = TRUE;
             }
 
+            if (fShowBlock && !IntersectRect(&rcBlock, &rc, &rcBounds))
+            {
+                fShowBlock = FALSE;
+            }
+
             if (fShowBlock)
             {
                 if (ppd->hTheme)
@@ -482,16 +503,81 @@ BOOL ProNeedsRepaint(PRO_DATA *ppd, int iOldPos)
     return fRet;
 }
 
+/* Gets the part of the bar covering the blocks [iFirstBlock, iLastBlock].
+   Progress_Paint_hook shrinks the bar by the theme content margins, which
+   ProGetPaintMetrics doesn't account for, so the rect is padded by a couple
+   of blocks on each side. */
+void ProGetBlocksRect(PRO_DATA *ppd, int iFirstBlock, int iLastBlock, RECT *prcDirty)
+{
+    RECT rc, rcClient;
+    int dxSpace, dxBlock;
+    ProGetPaintMetrics(ppd, &rcClient, &rc, &dxSpace, &dxBlock);
+
+    int dxStep = dxBlock + dxSpace;
+    *prcDirty = rcClient;
+    if (ppd->dwStyle & PBS_VERTICAL)
+    {
+        // Blocks are laid out from the bottom up
+        prcDirty->top = rc.bottom - (iLastBlock + 3) * dxStep;
+        prcDirty->bottom = rc.bottom - (iFirstBlock - 2) * dxStep;
+    }
+    else
+    {
+        prcDirty->left = rc.left + (iFirstBlock - 2) * dxStep;
+        prcDirty->right = rc.left + (iLastBlock + 3) * dxStep;
+    }
+
+    IntersectRect(prcDirty, prcDirty, &rcClient);
+}
+
+/* Gets the blocks which change with the next marquee step. Returns FALSE if
+   the whole bar should be repainted. */
+BOOL ProGetMarqueeDirtyRect(PRO_DATA_EX *ppd, RECT *prcDirty)
+{
+    RECT rc, rcClient;
+    int dxSpace, dxBlock;
+    ProGetPaintMetrics(ppd, &rcClient, &rc, &dxSpace, &dxBlock);
+
+    if (dxBlock == 1 && dxSpace == 0)
+        return FALSE;
+
+    int nBlocks;
+    if (ppd->dwStyle & PBS_VERTICAL)
+        nBlocks = ((rc.bottom - rc.top) + (dxBlock + dxSpace) - 1) / (dxBlock + dxSpace); // round up
+    else
+        nBlocks = ((rc.right - rc.left) + (dxBlock + dxSpace) - 1) / (dxBlock + dxSpace); // round up
+
+    // The next paint moves the marquee by one block, hiding its trailing block
+    // and showing a new leading one. Near the ends of the bar the block count
+    // used by the paint might differ from ours due to the theme margins, and
+    // the marquee wraps around, so repaint everything there.
+    int iHideBlock = ppd->iMarqueePos - (BLOCKSINMARQUEE / 2);
+    int iShowBlock = ppd->iMarqueePos + (BLOCKSINMARQUEE / 2) + 1;
+    if (iHideBlock < 2 || iShowBlock > nBlocks - 3)
+        return FALSE;
+
+    ProGetBlocksRect(ppd, iHideBlock, iShowBlock, prcDirty);
+    return TRUE;
+}
+
 int UpdatePosition(PRO_DATA *ppd, int iNewPos, BOOL bAllowWrap)
 {
     int iOldPos = ppd->iPos;
     UINT uRedraw = RDW_INVALIDATE | RDW_UPDATENOW;
     BOOL fNeedsRepaint = TRUE;
+    RECT rcDirty;
+    BOOL fPartialRepaint = FALSE;
 
     if (ppd->dwStyle & PBS_MARQUEE)
     {
         // Do an immediate repaint
         uRedraw |= RDW_ERASE;
+
+        // Only the blocks entering and leaving the marquee change. The data
+        // may be moved, so the old pointer can't be used after this.
+        PRO_DATA_EX *ppdEx = ReAllocProDataIfNecessary((PRO_DATA_EX *)ppd);
+        ppd = ppdEx;
+        fPartialRepaint = ProGetMarqueeDirtyRect(ppdEx, &rcDirty);
     }
     else
     {
@@ -519,11 +605,33 @@ int UpdatePosition(PRO_DATA *ppd, int iNewPos, BOOL bAllowWrap)
 
         ppd->iPos = iNewPos;
         fNeedsRepaint = ProNeedsRepaint(ppd, iOldPos);
+
+        // Only the blocks between the old and the new position change. The
+        // smooth themed bar is a single stretched chunk, so it has to be
+        // repainted in full.
+        if (fNeedsRepaint)
+        {
+            RECT rc, rcClient;
+            int dxSpace, dxBlock;
+            ProGetPaintMetrics(ppd, &rcClient, &rc, &dxSpace, &dxBlock);
+
+            if (!(dxBlock == 1 && dxSpace == 0 && ppd->hTheme))
+            {
+                int dxStep = dxBlock + dxSpace;
+                int x = GetProgressScreenPos(ppd, ppd->iPos, &rc);
+                int xOld = GetProgressScreenPos(ppd, iOldPos, &rc);
+                int nBlocks = (x + dxStep - 1) / dxStep; // round up
+                int nOldBlocks = (xOld + dxStep - 1) / dxStep; // round up
+
+                ProGetBlocksRect(ppd, min(nBlocks, nOldBlocks), max(nBlocks, nOldBlocks), &rcDirty);
+                fPartialRepaint = TRUE;
+            }
+        }
     }
 
     if (fNeedsRepaint)
     {
-        RedrawWindow(ppd->hwnd, NULL, NULL, uRedraw);
+        RedrawWindow(ppd->hwnd, fPartialRepaint ? &rcDirty : NULL, NULL, uRedraw);
         NotifyWinEvent(EVENT_OBJECT_VALUECHANGE, ppd->hwnd, OBJID_CLIENT, 0);
     }
 
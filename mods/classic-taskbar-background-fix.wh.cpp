@@ -2,7 +2,7 @@
 // @id              classic-taskbar-background-fix
 // @name            Classic Taskbar background fix
 // @description     Fixes Taskbar background in classic theme by replacing black background with a classic button face colour
-// @version         1.0.3
+// @version         1.0.5
 // @author          Roland Pihlakas
 // @github          https://github.com/levitation
 // @homepage        https://www.simplify.ee/
@@ -75,10 +75,14 @@ I would like to thank @Anixx and @OrthodoxWindows for testing the mod during its
 #include <winnt.h>      //defines HRESULT, needed for Visual Studio intellisense only, in clang the HRESULT seems to be defined already elsewhere, but the include does not harm either
 //#include <uxtheme.h>    //currently not needed since we use our own declaration of DrawThemeParentBackground and DrawThemeParentBackgroundEx
 #include <intrin.h>
+#include <winternl.h>     //PCUNICODE_STRING, NT_SUCCESS
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <mutex>
 #include <new>          //std::nothrow
+#include <vector>
 
 
 
@@ -125,8 +129,17 @@ HANDLE g_initThread = NULL;
 HANDLE g_initThreadStopSignal = NULL;
 HWND g_hwndTaskbar = NULL;
 
+typedef struct tagCallerModuleRange {
+    ULONG_PTR start;
+    ULONG_PTR end;          //exclusive
+    bool isClassicTaskbarButtonsLiteMod;
+} CallerModuleRange;
+
 std::mutex g_classicTaskbarButtonsLiteModDetectionMutex;
-std::map<void*, bool> g_classicTaskbarButtonsLiteModDetectionMap;
+std::vector<CallerModuleRange> g_classicTaskbarButtonsLiteModDetectionRanges;  //sorted by start address, so that a caller lookup is a binary search without any system calls
+unsigned int g_classicTaskbarButtonsLiteModDetectionRangesUnloadCounter = 0;  //value of g_dllUnloadCounter when the ranges were last known to be valid
+std::atomic<unsigned int> g_dllUnloadCounter = 0;
+PVOID g_dllNotificationCookie = NULL;
 HMODULE hUxtheme = NULL;
 
 
@@ -134,6 +147,7 @@ typedef struct tagMemDCInfo {
     HDC originalHdc;
     HBITMAP memBitmap;
     HGDIOBJ oldBitmap;
+    bool isBackBuffer;      //memDC is g_backBuffer.memDC which is reused instead of deleted
     int colorIndex;
 } MemDCInfo;
 
@@ -141,6 +155,30 @@ typedef struct tagMemDCInfo {
 std::mutex g_hdcMapMutex;
 std::map<HDC, MemDCInfo> g_hdcMap;      //using map not unordered_map since the latter becomes slow when doing many insertions and removals. Also it is expected that the current map will contain only a few elements at a time
 
+//A back buffer that is reused by consecutive BeginPaint/EndPaint pairs so that every taskbar repaint does not need to create and delete a DC and a full size bitmap. It grows to the largest painted window. Nested paints that happen while it is in use fall back to a temporary DC.
+struct {
+    HDC memDC;
+    HBITMAP memBitmap;
+    HGDIOBJ oldBitmap;
+    int width;
+    int height;
+    int bitsPixel;
+    int savedDCState;   //used to reset any DC state that the painting code left behind
+    bool inUse;
+} g_backBuffer = {};
+
+
+//Window classes that need their background repainted. The classification depends only on the window class, so it is cached by class atom, which avoids GetClassNameW and string comparisons on every paint and needs no cleanup when windows are destroyed.
+enum class WindowClassKind {
+    other,
+    taskbar,                //repainted on BeginPaint and DrawThemeParentBackground
+    tray,                   //repainted on DrawThemeParentBackground only
+    showDesktopButton       //depends on g_repaintDesktopButtonConfig
+};
+
+std::mutex g_windowClassKindMutex;
+std::map<ATOM, WindowClassKind> g_windowClassKindMap;   //expected to contain only a few dozen elements
+
 RepaintDesktopButtonConfig g_repaintDesktopButtonConfig;
 CompatWithTaskbarButtonsModsConfig g_compatWithTaskbarButtonsModsConfig;
 
@@ -241,6 +279,32 @@ PCWSTR GetModuleName(
     }
 }
 
+ULONG_PTR GetModuleEnd(HMODULE hModule) {
+
+    //the image headers of a loaded module stay mapped for as long as the module is loaded
+    const IMAGE_DOS_HEADER* dosHeader = (const IMAGE_DOS_HEADER*)hModule;
+    const IMAGE_NT_HEADERS* ntHeaders = (const IMAGE_NT_HEADERS*)((const BYTE*)hModule + dosHeader->e_lfanew);
+    return (ULONG_PTR)hModule + ntHeaders->OptionalHeader.SizeOfImage;
+}
+
+//Inserts the range at its sorted position. Any cached ranges which overlap the new one are replaced by it, since the new one comes from a fresh module lookup. Keeping the ranges non-overlapping keeps them sorted by their end address too, which the lookup relies on.
+void InsertCallerModuleRange(std::vector<CallerModuleRange>& ranges, const CallerModuleRange& range) {
+    auto first = std::lower_bound(
+        ranges.begin(),
+        ranges.end(),
+        range.start,
+        [](const CallerModuleRange& existing, ULONG_PTR start) { return existing.end <= start; }
+    );
+    auto last = std::lower_bound(
+        first,
+        ranges.end(),
+        range.end,
+        [](const CallerModuleRange& existing, ULONG_PTR end) { return existing.start < end; }
+    );
+    auto it = ranges.erase(first, last);
+    ranges.insert(it, range);
+}
+
 bool IsCallerClassicTaskbarButtonsLiteMod(void* returnAddress) {
 
     bool callerIsClassicTaskbarButtonsLiteMod = false;
@@ -254,10 +318,26 @@ bool IsCallerClassicTaskbarButtonsLiteMod(void* returnAddress) {
         g_compatWithTaskbarButtonsModsConfig 
         == CompatWithTaskbarButtonsModsConfig::autoDetect
     ) {
+        ULONG_PTR address = (ULONG_PTR)returnAddress;
+
         std::lock_guard<std::mutex> guard(g_classicTaskbarButtonsLiteModDetectionMutex);
-        auto it = g_classicTaskbarButtonsLiteModDetectionMap.find(returnAddress);
-        if (it != g_classicTaskbarButtonsLiteModDetectionMap.end()) {
-            callerIsClassicTaskbarButtonsLiteMod = it->second;
+
+        //An unloaded mod's address range might be reused by another dll, so forget all ranges after any dll unload. This also handles cases where the user changes the active buttons mod.
+        unsigned int dllUnloadCounter = g_dllUnloadCounter;
+        if (dllUnloadCounter != g_classicTaskbarButtonsLiteModDetectionRangesUnloadCounter) {
+            g_classicTaskbarButtonsLiteModDetectionRanges.clear();
+            g_classicTaskbarButtonsLiteModDetectionRangesUnloadCounter = dllUnloadCounter;
+        }
+
+        //find the last range starting at or before the address
+        auto it = std::upper_bound(
+            g_classicTaskbarButtonsLiteModDetectionRanges.begin(),
+            g_classicTaskbarButtonsLiteModDetectionRanges.end(),
+            address,
+            [](ULONG_PTR address, const CallerModuleRange& range) { return address < range.start; }
+        );
+        if (it != g_classicTaskbarButtonsLiteModDetectionRanges.begin() && address < (it - 1)->end) {
+            callerIsClassicTaskbarButtonsLiteMod = (it - 1)->isClassicTaskbarButtonsLiteMod;
         }
         else {
             HMODULE callerModule = GetCallerModule(returnAddress);
@@ -284,12 +364,14 @@ bool IsCallerClassicTaskbarButtonsLiteMod(void* returnAddress) {
                 Wh_Log(L"A non classic-taskbar-buttons-lite mod detected");
             }
 
-            //Saving to a map enables handling cases where the user changes the active buttons mod. Also there may be different callers to this hooked function. We need to have special handling only if the caller is classic-taskbar-buttons-lite mod, otherwise no special handling is needed.
-            //We could use DllMain() to remove obsolete entries from g_classicTaskbarButtonsLiteModDetectionMap, but it is expected to happen rarely that a dll (or mod) using the DrawFrameControl() function is unloaded, so lets not bother with that.
-            g_classicTaskbarButtonsLiteModDetectionMap.insert({ 
-                returnAddress, 
-                callerIsClassicTaskbarButtonsLiteMod 
-            });
+            //Saving the whole module range means that other call sites in the same dll do not need to resolve the module again. There may be different callers to this hooked function. We need to have special handling only if the caller is classic-taskbar-buttons-lite mod, otherwise no special handling is needed.
+            //If the module was not found (for example, .NET code) then remember only the return address itself.
+            CallerModuleRange range;
+            range.start = callerModule ? (ULONG_PTR)callerModule : address;
+            range.end = callerModule ? GetModuleEnd(callerModule) : address + 1;
+            range.isClassicTaskbarButtonsLiteMod = callerIsClassicTaskbarButtonsLiteMod;
+
+            InsertCallerModuleRange(g_classicTaskbarButtonsLiteModDetectionRanges, range);
         }
     }
 
@@ -297,12 +379,129 @@ bool IsCallerClassicTaskbarButtonsLiteMod(void* returnAddress) {
 }
 
 
-bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* paintRect, bool isDrawThemeParentBackgroundCall) {
+//https://learn.microsoft.com/en-us/windows/win32/devnotes/ldrdllnotification
+#define LDR_DLL_NOTIFICATION_REASON_UNLOADED    2
+
+typedef struct tagLdrDllNotificationData {
+    ULONG Flags;
+    PCUNICODE_STRING FullDllName;
+    PCUNICODE_STRING BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+} LdrDllNotificationData;
+
+typedef VOID(CALLBACK* LdrDllNotificationFunction_t)(ULONG, const LdrDllNotificationData*, PVOID);
+typedef NTSTATUS(NTAPI* LdrRegisterDllNotification_t)(ULONG, LdrDllNotificationFunction_t, PVOID, PVOID*);
+typedef NTSTATUS(NTAPI* LdrUnregisterDllNotification_t)(PVOID);
+
+VOID CALLBACK DllNotificationCallback(
+    ULONG NotificationReason,
+    const LdrDllNotificationData* NotificationData,
+    PVOID Context
+) {
+    //NB! This is called under the loader lock, so it must not take g_classicTaskbarButtonsLiteModDetectionMutex. GetCallerModule() is called while holding that mutex and takes the loader lock.
+    if (NotificationReason == LDR_DLL_NOTIFICATION_REASON_UNLOADED)
+        g_dllUnloadCounter++;
+}
+
+void RegisterDllNotification() {
+
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    LdrRegisterDllNotification_t pLdrRegisterDllNotification = 
+        hNtdll ? (LdrRegisterDllNotification_t)GetProcAddress(hNtdll, "LdrRegisterDllNotification") : NULL;
+
+    if (
+        !pLdrRegisterDllNotification
+        || !NT_SUCCESS(pLdrRegisterDllNotification(
+            /*Flags = */0,
+            DllNotificationCallback,
+            /*Context = */NULL,
+            &g_dllNotificationCookie
+        ))
+    ) {
+        //without the notification the caller module ranges are never forgotten, which matches the behaviour of the earlier per return address cache
+        Wh_Log(L"LdrRegisterDllNotification failed");
+        g_dllNotificationCookie = NULL;
+    }
+}
+
+void UnregisterDllNotification() {
+
+    if (!g_dllNotificationCookie)
+        return;
+
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    LdrUnregisterDllNotification_t pLdrUnregisterDllNotification = 
+        hNtdll ? (LdrUnregisterDllNotification_t)GetProcAddress(hNtdll, "LdrUnregisterDllNotification") : NULL;
+
+    if (pLdrUnregisterDllNotification)
+        pLdrUnregisterDllNotification(g_dllNotificationCookie);
+
+    g_dllNotificationCookie = NULL;
+}
+
+
+WindowClassKind WindowClassKindFromClassName(PCWSTR szClassName) {
+
+    if (
+        _wcsicmp(szClassName, L"Shell_TrayWnd") == 0        //around of start button in case OpenShell is active
+        || _wcsicmp(szClassName, L"Start") == 0             //around of start button in case OpenShell is NOT active
+        || _wcsicmp(szClassName, L"Shell_SecondaryTrayWnd") == 0        //secondary taskbar
+        || _wcsicmp(szClassName, L"MSTaskListWClass") == 0      //around of taskbar buttons
+    ) {
+        return WindowClassKind::taskbar;
+    }
+    else if (
+        _wcsicmp(szClassName, L"CiceroUIWndFrame") == 0     //language bar
+        || _wcsicmp(szClassName, L"TrayNotifyWnd") == 0     //around of tray, sometimes may be a very thin line, but could be also a wider area
+        || _wcsicmp(szClassName, L"Button") == 0        //three dots of the "show hidden icons" button
+        || _wcsicmp(szClassName, L"SysPager") == 0      //visible tray icons
+        //|| _wcsicmp(szClassName, L"ToolbarWindow32") == 0      //Background of both visible and hidden tray icons. Commenting out in order to not repaint hidden tray icons popup background. Not needed anyway, since painting SysPager class has already the desired effect.
+        || _wcsicmp(szClassName, L"TrayClockWClass") == 0       //clock
+        || _wcsicmp(szClassName, L"TrayButton") == 0        //action center button
+    ) {
+        return WindowClassKind::tray;
+    }
+    else if (_wcsicmp(szClassName, L"TrayShowDesktopButtonWClass") == 0) {     //show desktop button
+        return WindowClassKind::showDesktopButton;
+    }
+    else {
+        return WindowClassKind::other;
+    }
+}
+
+bool GetWindowClassKind(OUT WindowClassKind* kind, HWND hWnd) {
+
+    ATOM classAtom = (ATOM)GetClassLongPtrW(hWnd, GCW_ATOM);
+    if (classAtom) {
+        std::lock_guard<std::mutex> guard(g_windowClassKindMutex);
+        auto it = g_windowClassKindMap.find(classAtom);
+        if (it != g_windowClassKindMap.end()) {
+            *kind = it->second;
+            return true;
+        }
+    }
 
     WCHAR szClassName[32];
+    if (!GetClassNameW(hWnd, szClassName, ARRAYSIZE(szClassName)))
+        return false;
+
+    *kind = WindowClassKindFromClassName(szClassName);
+
+    if (classAtom) {
+        std::lock_guard<std::mutex> guard(g_windowClassKindMutex);
+        g_windowClassKindMap.insert({ classAtom, *kind });
+    }
+
+    return true;
+}
+
+bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* paintRect, bool isDrawThemeParentBackgroundCall) {
+
+    WindowClassKind kind;
     if (
         hWnd 
-        && GetClassNameW(hWnd, szClassName, ARRAYSIZE(szClassName))
+        && GetWindowClassKind(&kind, hWnd)
     ) {
         if (
             isDrawThemeParentBackgroundCall
@@ -310,7 +509,7 @@ bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* pa
                 g_repaintDesktopButtonConfig == RepaintDesktopButtonConfig::highlightOnHover
                 || g_repaintDesktopButtonConfig == RepaintDesktopButtonConfig::blackOnHover
             )
-            && _wcsicmp(szClassName, L"TrayShowDesktopButtonWClass") == 0
+            && kind == WindowClassKind::showDesktopButton
         ) {
             POINT cursorPos;
             if (GetCursorPos(&cursorPos)) {
@@ -340,7 +539,7 @@ bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* pa
         else if (
             isDrawThemeParentBackgroundCall        //painting the "show desktop" button black again since without it earlier calls to DrawThemeParentBackground would remove the black color from "show desktop" button as a side effect of painting other tray areas
             && g_repaintDesktopButtonConfig == RepaintDesktopButtonConfig::no
-            && _wcsicmp(szClassName, L"TrayShowDesktopButtonWClass") == 0   //show desktop button
+            && kind == WindowClassKind::showDesktopButton
         ) {
             *colorIndex = blackColorIndex;     
             return true;
@@ -348,23 +547,14 @@ bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* pa
         else {
 
             bool result =
-                _wcsicmp(szClassName, L"Shell_TrayWnd") == 0        //around of start button in case OpenShell is active
-                || _wcsicmp(szClassName, L"Start") == 0             //around of start button in case OpenShell is NOT active
-                || _wcsicmp(szClassName, L"Shell_SecondaryTrayWnd") == 0        //secondary taskbar
-                || _wcsicmp(szClassName, L"MSTaskListWClass") == 0      //around of taskbar buttons
+                kind == WindowClassKind::taskbar
                 || (
                     isDrawThemeParentBackgroundCall
                     && (
-                        _wcsicmp(szClassName, L"CiceroUIWndFrame") == 0     //language bar
-                        || _wcsicmp(szClassName, L"TrayNotifyWnd") == 0     //around of tray, sometimes may be a very thin line, but could be also a wider area
-                        || _wcsicmp(szClassName, L"Button") == 0        //three dots of the "show hidden icons" button
-                        || _wcsicmp(szClassName, L"SysPager") == 0      //visible tray icons
-                        //|| _wcsicmp(szClassName, L"ToolbarWindow32") == 0      //Background of both visible and hidden tray icons. Commenting out in order to not repaint hidden tray icons popup background. Not needed anyway, since painting SysPager class has already the desired effect.
-                        || _wcsicmp(szClassName, L"TrayClockWClass") == 0       //clock
-                        || _wcsicmp(szClassName, L"TrayButton") == 0        //action center button
+                        kind == WindowClassKind::tray
                         || (
                             g_repaintDesktopButtonConfig == RepaintDesktopButtonConfig::yes
-                            && _wcsicmp(szClassName, L"TrayShowDesktopButtonWClass") == 0   //show desktop button
+                            && kind == WindowClassKind::showDesktopButton
                         )
                     )
                 );
@@ -377,6 +567,96 @@ bool WindowNeedsBackgroundRepaint(OUT int* colorIndex, HWND hWnd, const RECT* pa
     return false;
 }
 
+//Returns a DC with g_backBuffer selected, growing the buffer when needed, or NULL if the back buffer is already in use or cannot be allocated
+//The paint rectangle is cleared to black, since EndPaintHook only replaces black pixels and the previous paint must not show through
+HDC AcquireBackBuffer(HDC hdc, int width, int height, int bitsPixel, const RECT& rcPaint) {
+
+    if (g_backBuffer.inUse)
+        return NULL;
+
+    if (
+        !g_backBuffer.memDC
+        || g_backBuffer.width < width
+        || g_backBuffer.height < height
+        || g_backBuffer.bitsPixel != bitsPixel
+    ) {
+        if (g_backBuffer.bitsPixel == bitsPixel) {  //avoid reallocating repeatedly when different sized windows paint alternately
+            width = max(width, g_backBuffer.width);
+            height = max(height, g_backBuffer.height);
+        }
+
+        if (g_backBuffer.memDC) {
+            RestoreDC(g_backBuffer.memDC, g_backBuffer.savedDCState);
+            SelectObject(g_backBuffer.memDC, g_backBuffer.oldBitmap);
+            DeleteObject(g_backBuffer.memBitmap);
+            DeleteDC(g_backBuffer.memDC);
+            g_backBuffer = {};
+        }
+
+        HDC memDC = CreateCompatibleDC(hdc);
+        if (!memDC) {
+            Wh_Log(L"CreateCompatibleDC failed");
+            return NULL;
+        }
+
+        //need full bitmap here - could not create a smaller compatible bitmap with only the width and height of lpPaint->rcPaint since that would mess up ClientToScreen coordinates conversion in the program.
+        HBITMAP memBitmap = CreateCompatibleBitmap(hdc, width, height);
+        if (!memBitmap) {
+            Wh_Log(L"CreateCompatibleBitmap failed");
+            DeleteDC(memDC);
+            return NULL;
+        }
+
+        HGDIOBJ oldBitmap = SelectObject(memDC, memBitmap);
+        int savedDCState = oldBitmap ? SaveDC(memDC) : 0;
+        if (!savedDCState) {
+            Wh_Log(L"SelectObject or SaveDC failed");
+            if (oldBitmap)
+                SelectObject(memDC, oldBitmap);
+            DeleteObject(memBitmap);
+            DeleteDC(memDC);
+            return NULL;
+        }
+
+        g_backBuffer.memDC = memDC;
+        g_backBuffer.memBitmap = memBitmap;
+        g_backBuffer.oldBitmap = oldBitmap;
+        g_backBuffer.width = width;
+        g_backBuffer.height = height;
+        g_backBuffer.bitsPixel = bitsPixel;
+        g_backBuffer.savedDCState = savedDCState;
+    }
+
+    PatBlt(g_backBuffer.memDC, rcPaint.left, rcPaint.top, rcPaint.right - rcPaint.left, rcPaint.bottom - rcPaint.top, BLACKNESS);
+
+    g_backBuffer.inUse = true;
+    return g_backBuffer.memDC;
+}
+
+void ReleaseBackBuffer() {
+
+    //reset selected objects, clipping, coordinate transforms etc. that the painting code may have changed
+    RestoreDC(g_backBuffer.memDC, g_backBuffer.savedDCState);
+    g_backBuffer.savedDCState = SaveDC(g_backBuffer.memDC);
+    g_backBuffer.inUse = false;
+}
+
+void FreeBackBuffer() {
+
+    std::lock_guard<std::mutex> guard(g_hdcMapMutex);
+
+    if (
+        g_backBuffer.memDC
+        && !g_backBuffer.inUse      //if a paint is still in progress then leaking the buffer is safer than deleting a DC the program is drawing into
+    ) {
+        RestoreDC(g_backBuffer.memDC, g_backBuffer.savedDCState);
+        SelectObject(g_backBuffer.memDC, g_backBuffer.oldBitmap);
+        DeleteObject(g_backBuffer.memBitmap);
+        DeleteDC(g_backBuffer.memDC);
+        g_backBuffer = {};
+    }
+}
+
 void ConditionalFillRect(HDC hdc, const RECT& rect, COLORREF oldColor, COLORREF newColor, int newColorIndex, bool useFloodFill) {
 
     int pixelCount = (rect.right - rect.left) * (rect.bottom - rect.top);
@@ -516,56 +796,68 @@ HDC WINAPI BeginPaintHook(
         && WindowNeedsBackgroundRepaint(&colorIndex, hWnd, &lpPaint->rcPaint, /*isDrawThemeParentBackgroundCall*/false)
     ) {
         //Send memDC to the caller to prevent occasional flickering. With memDC we can repaint the pixels before they are updated on screen.
-        HDC memDC = CreateCompatibleDC(hdc);
-        if (!memDC) {
-            Wh_Log(L"CreateCompatibleDC failed");
+        //GetClipBox does not work well here for some reason, causing taskbar buttons to be partially updated
+        BITMAP bitmapHeader = {};
+        HGDIOBJ hBitmap = GetCurrentObject(lpPaint->hdc, OBJ_BITMAP);
+        if (!hBitmap) {
+            Wh_Log(L"GetCurrentObject failed");
+        }
+        else if (!GetObjectW(hBitmap, sizeof(BITMAP), &bitmapHeader)) {
+            Wh_Log(L"GetObjectW failed");
         }
         else {
-            //GetClipBox does not work well here for some reason, causing taskbar buttons to be partially updated
-            BITMAP bitmapHeader = {};
-            HGDIOBJ hBitmap = GetCurrentObject(lpPaint->hdc, OBJ_BITMAP);
-            if (!hBitmap) {
-                Wh_Log(L"GetCurrentObject failed");
+            int width = bitmapHeader.bmWidth;
+            int height = bitmapHeader.bmHeight;
+
+            MemDCInfo memDCInfo;
+            memDCInfo.originalHdc = lpPaint->hdc;
+            memDCInfo.colorIndex = colorIndex;
+
+            std::lock_guard<std::mutex> guard(g_hdcMapMutex);
+
+            HDC memDC = AcquireBackBuffer(lpPaint->hdc, width, height, bitmapHeader.bmBitsPixel, lpPaint->rcPaint);
+            if (memDC) {
+                memDCInfo.memBitmap = NULL;
+                memDCInfo.oldBitmap = NULL;
+                memDCInfo.isBackBuffer = true;
+
+                g_hdcMap.insert({ memDC, memDCInfo });
+
+                lpPaint->hdc = memDC;
+                return memDC;
+            }
+
+            //the back buffer is in use by another paint, so use a temporary memDC
+            memDC = CreateCompatibleDC(hdc);
+            if (!memDC) {
+                Wh_Log(L"CreateCompatibleDC failed");
             }
             else {
-                if (!GetObjectW(hBitmap, sizeof(BITMAP), &bitmapHeader)) {
-                    Wh_Log(L"GetObjectW failed");
+                //need full bitmap copy here - could not create a smaller compatible bitmap with only the width and height of lpPaint->rcPaint since that would mess up ClientToScreen coordinates conversion in the program.
+                HBITMAP memBitmap = CreateCompatibleBitmap(lpPaint->hdc, width, height);
+                if (!memBitmap) {
+                    Wh_Log(L"CreateCompatibleBitmap failed");
                 }
                 else {
-                    int width = bitmapHeader.bmWidth;
-                    int height = bitmapHeader.bmHeight;
-
-                    //need full bitmap copy here - could not create a smaller compatible bitmap with only the width and height of lpPaint->rcPaint since that would mess up ClientToScreen coordinates conversion in the program.
-                    HBITMAP memBitmap = CreateCompatibleBitmap(lpPaint->hdc, width, height);
-                    if (!memBitmap) {
-                        Wh_Log(L"CreateCompatibleBitmap failed");
+                    HGDIOBJ oldBitmap = SelectObject(memDC, memBitmap);
+                    if (!oldBitmap) {
+                        Wh_Log(L"SelectObject failed");
                     }
                     else {
-                        HGDIOBJ oldBitmap = SelectObject(memDC, memBitmap);
-                        if (!oldBitmap) {
-                            Wh_Log(L"SelectObject failed");
-                        }
-                        else {
-                            MemDCInfo memDCInfo;
-                            memDCInfo.originalHdc = lpPaint->hdc;
-                            memDCInfo.memBitmap = memBitmap;
-                            memDCInfo.oldBitmap = oldBitmap;
-                            memDCInfo.colorIndex = colorIndex;
-
-                            {
-                                std::lock_guard<std::mutex> guard(g_hdcMapMutex);
-                                g_hdcMap.insert({ memDC, memDCInfo });
-                            }
+                        memDCInfo.memBitmap = memBitmap;
+                        memDCInfo.oldBitmap = oldBitmap;
+                        memDCInfo.isBackBuffer = false;
 
-                            lpPaint->hdc = memDC;
-                            return memDC;
-                        }
+                        g_hdcMap.insert({ memDC, memDCInfo });
 
-                        DeleteObject(memBitmap);
+                        lpPaint->hdc = memDC;
+                        return memDC;
                     }
 
-                    DeleteDC(memDC);
+                    DeleteObject(memBitmap);
                 }
+
+                DeleteDC(memDC);
             }
         }
     }
@@ -623,10 +915,16 @@ BOOL WINAPI EndPaintHook(
                 Wh_Log(L"BitBlt failed");
 
             //clean up
-            SelectObject(memDC, memDCInfo.oldBitmap);
-            DeleteObject(memDCInfo.memBitmap);
+            if (memDCInfo.isBackBuffer) {
+                std::lock_guard<std::mutex> guard(g_hdcMapMutex);
+                ReleaseBackBuffer();
+            }
+            else {
+                SelectObject(memDC, memDCInfo.oldBitmap);
+                DeleteObject(memDCInfo.memBitmap);
 
-            DeleteDC(memDC);
+                DeleteDC(memDC);
+            }
 
 
             SetLastError(originalError);    //Reset the error code so that the hooked API does not appear to have errored in case any helper code above caused an error code to be set. Some Windows API-s do not reset error code in case of success, so lets ensure that we enter the hooked API with original error code.
@@ -1019,6 +1317,8 @@ BOOL Wh_ModInit() {
 
     Wh_Log(L"Initialising hooks...");
 
+    RegisterDllNotification();
+
     Wh_SetFunctionHookT(pBeginPaint, BeginPaintHook, &pOriginalBeginPaint);
     Wh_SetFunctionHookT(pEndPaint, EndPaintHook, &pOriginalEndPaint);
     Wh_SetFunctionHookT(pDrawFrameControl, DrawFrameControlHook, &pOriginalDrawFrameControl);
@@ -1069,6 +1369,11 @@ void Wh_ModUninit() {
     }
 
 
+    UnregisterDllNotification();
+
+    FreeBackBuffer();
+
+
     if (hUxtheme) {
         FreeLibrary(hUxtheme);
         hUxtheme = NULL;
@@ -2,7 +2,7 @@
 // @id              classic-taskbar-context-menu
 // @name            Non Immersive Taskbar Context Menu
 // @description     Restores the non-immersive taskbar context menu
-// @version         1.0.3
+// @version         1.0.5
 // @author          ItsProfessional
 // @github          https://github.com/ItsProfessional
 // @include         explorer.exe
@@ -44,6 +44,7 @@ struct {
 #include <commctrl.h>
 #include <string.h>
 #include <unordered_set>
+#include <mutex>
 
 //msvcrt.lib;msvcrtd.lib
 #ifdef _DEBUG
@@ -61,6 +62,7 @@ struct {
 
 #define STANDARD_DPI 96
 #define DPI_SCALE(in) in * GetDPI() / STANDARD_DPI
+#define DPI_SCALE_FOR(in, dpi) in * (dpi) / STANDARD_DPI
 
 
 std::unordered_set<HWND> handles;
@@ -123,7 +125,41 @@ int GetDPI() {
 #define ICON_SETTING_INDEX 21
 #define ICON_SHOWDESKTOP_INDEX 34
 
-static HBITMAP MyIcons[MyIcons_Count];
+// Menus can open on monitors with different DPIs, so the icons are kept per
+// DPI, loaded the first time a menu needs them. The DPIs of the monitors
+// present at init are loaded in the background. Past MyIcons_MaxDpis, the
+// least recently used DPI is evicted. Its icons may still be set on an open
+// menu, so they're only deleted on the next eviction.
+#define MyIcons_MaxDpis 8
+
+struct MyIconsForDpi {
+	UINT dpi;
+	UINT size;
+	UINT lastUse;
+	HBITMAP icons[MyIcons_Count];
+};
+
+static MyIconsForDpi MyIcons[MyIcons_MaxDpis];
+static int MyIcons_DpiCount = 0;
+static HBITMAP MyIcons_Evicted[MyIcons_Count];
+static UINT MyIcons_UseCount = 0;
+static UINT MyIcons_Hits = 0;
+static UINT MyIcons_Misses = 0;
+static std::mutex MyIcons_Mutex;
+static HANDLE MyIcons_PrewarmThread = NULL;
+static HMODULE MyIcons_hShcore = NULL;
+
+using GetDpiForWindow_t = UINT(WINAPI*)(HWND hwnd);
+static GetDpiForWindow_t pGetDpiForWindow;
+
+using GetDpiForMonitor_t = HRESULT(WINAPI*)(HMONITOR hmonitor, int dpiType, UINT* dpiX, UINT* dpiY);
+static GetDpiForMonitor_t pGetDpiForMonitor;
+
+
+UINT GetWindowDPI(HWND hWnd) {
+	UINT dpi = pGetDpiForWindow && hWnd ? pGetDpiForWindow(hWnd) : 0;
+	return dpi ? dpi : GetDPI();
+}
 
 
 
@@ -250,31 +286,139 @@ HBITMAP IconToBitmap(HICON hIcon, INT size = 0) {
 
 
 
-HBITMAP MyIcons_Get(unsigned char index) {
-	return MyIcons[index];
-}
-
-
-void MyIcons_Load() {
+void MyIcons_Load(HBITMAP icons[MyIcons_Count], UINT dpi) {
 	HICON hIcon = NULL;
 	ExtractIconEx(L"shell32.dll", ICON_SETTING_INDEX, NULL, &hIcon, 1);
-	MyIcons[MYICON_SETTING] = IconToBitmap(hIcon, DPI_SCALE(16));
+	icons[MYICON_SETTING] = IconToBitmap(hIcon, DPI_SCALE_FOR(16, dpi));
 	DestroyIcon(hIcon);
 
 	ExtractIconEx(L"taskmgr.exe", 0, NULL, &hIcon, 1);
-	MyIcons[MYICON_TASKMGR] = IconToBitmap(hIcon, DPI_SCALE(16));
+	icons[MYICON_TASKMGR] = IconToBitmap(hIcon, DPI_SCALE_FOR(16, dpi));
 	DestroyIcon(hIcon);
 
 	ExtractIconEx(L"shell32.dll", ICON_SHOWDESKTOP_INDEX, NULL, &hIcon, 1);
-	MyIcons[MYICON_SHOWDESKTOP] = IconToBitmap(hIcon, DPI_SCALE(16));
+	icons[MYICON_SHOWDESKTOP] = IconToBitmap(hIcon, DPI_SCALE_FOR(16, dpi));
 	DestroyIcon(hIcon);
 }
 
 
-void MyIcons_Free() {
+void MyIcons_DeleteAll(HBITMAP icons[MyIcons_Count]) {
 	for (int i = 0; i < MyIcons_Count; i++) {
-		if (MyIcons[i] != NULL) DeleteObject(MyIcons[i]);
-    }
+		if (icons[i] != NULL) DeleteObject(icons[i]);
+		icons[i] = NULL;
+	}
+}
+
+
+HBITMAP MyIcons_GetForDpi(UINT dpi, unsigned char index) {
+	std::lock_guard<std::mutex> guard(MyIcons_Mutex);
+
+	for (int i = 0; i < MyIcons_DpiCount; i++) {
+		if (MyIcons[i].dpi == dpi) {
+			MyIcons_Hits++;
+			MyIcons[i].lastUse = ++MyIcons_UseCount;
+			return MyIcons[i].icons[index];
+		}
+	}
+
+	MyIcons_Misses++;
+
+	MyIconsForDpi* entry;
+	if (MyIcons_DpiCount < MyIcons_MaxDpis) {
+		entry = &MyIcons[MyIcons_DpiCount];
+		MyIcons_DpiCount++;
+	} else {
+		entry = &MyIcons[0];
+		for (int i = 1; i < MyIcons_DpiCount; i++) {
+			if (MyIcons[i].lastUse < entry->lastUse) entry = &MyIcons[i];
+		}
+
+		MyIcons_DeleteAll(MyIcons_Evicted);
+		memcpy(MyIcons_Evicted, entry->icons, sizeof(MyIcons_Evicted));
+	}
+
+	entry->dpi = dpi;
+	entry->size = DPI_SCALE_FOR(16, dpi);
+	entry->lastUse = ++MyIcons_UseCount;
+	MyIcons_Load(entry->icons, dpi);
+
+	return entry->icons[index];
+}
+
+
+HBITMAP MyIcons_Get(HWND hWnd, unsigned char index) {
+	return MyIcons_GetForDpi(GetWindowDPI(hWnd), index);
+}
+
+
+BOOL CALLBACK MyIcons_PrewarmMonitorProc(HMONITOR hMonitor, HDC hdc, LPRECT lprcMonitor, LPARAM lParam) {
+	UINT dpiX, dpiY;
+	if (SUCCEEDED(pGetDpiForMonitor(hMonitor, 0 /* MDT_EFFECTIVE_DPI */, &dpiX, &dpiY))) MyIcons_GetForDpi(dpiX, 0);
+
+	return TRUE;
+}
+
+
+DWORD WINAPI MyIcons_PrewarmThreadProc(LPVOID lpParameter) {
+	MyIcons_GetForDpi(GetDPI(), 0);
+
+	if (pGetDpiForMonitor) EnumDisplayMonitors(NULL, NULL, MyIcons_PrewarmMonitorProc, 0);
+
+	return 0;
+}
+
+
+void MyIcons_Init() {
+	pGetDpiForWindow = (GetDpiForWindow_t)GetProcAddress(GetModuleHandle(L"user32.dll"), "GetDpiForWindow");
+
+	MyIcons_hShcore = LoadLibrary(L"shcore.dll");
+	if (MyIcons_hShcore) pGetDpiForMonitor = (GetDpiForMonitor_t)GetProcAddress(MyIcons_hShcore, "GetDpiForMonitor");
+
+	MyIcons_PrewarmThread = CreateThread(NULL, 0, MyIcons_PrewarmThreadProc, NULL, 0, NULL);
+}
+
+
+// Written to the log when the settings change and on unload, to check what the
+// icons cost in a long running explorer process.
+void MyIcons_LogUsage() {
+	std::lock_guard<std::mutex> guard(MyIcons_Mutex);
+
+	UINT bitmaps = 0;
+	UINT bytes = 0;
+	for (int i = 0; i < MyIcons_DpiCount; i++) {
+		for (int j = 0; j < MyIcons_Count; j++) {
+			if (MyIcons[i].icons[j] != NULL) {
+				bitmaps++;
+				bytes += MyIcons[i].size * MyIcons[i].size * 4;
+			}
+		}
+	}
+
+	HANDLE hProcess = GetCurrentProcess();
+	Wh_Log(L"Icons: %d DPIs, %u bitmaps (%u bytes, %u GDI handles), %u hits, %u misses, %u GDI and %u USER objects in process",
+		MyIcons_DpiCount, bitmaps, bytes, bitmaps, MyIcons_Hits, MyIcons_Misses,
+		GetGuiResources(hProcess, GR_GDIOBJECTS), GetGuiResources(hProcess, GR_USEROBJECTS));
+}
+
+
+void MyIcons_Free() {
+	if (MyIcons_PrewarmThread) {
+		WaitForSingleObject(MyIcons_PrewarmThread, INFINITE);
+		CloseHandle(MyIcons_PrewarmThread);
+		MyIcons_PrewarmThread = NULL;
+	}
+
+	if (MyIcons_hShcore) {
+		pGetDpiForMonitor = NULL;
+		FreeLibrary(MyIcons_hShcore);
+		MyIcons_hShcore = NULL;
+	}
+
+	std::lock_guard<std::mutex> guard(MyIcons_Mutex);
+
+	for (int i = 0; i < MyIcons_DpiCount; i++) MyIcons_DeleteAll(MyIcons[i].icons);
+	MyIcons_DeleteAll(MyIcons_Evicted);
+	MyIcons_DpiCount = 0;
 }
 
 
@@ -317,7 +461,7 @@ void ApplyClassicMenuIfPossible(HWND hWnd, HMENU hMenu) {
 	GetClassNameA(hWnd, clsName, 256);
 
     if (strcmp(clsName, "TrayShowDesktopButtonWClass") == 0) {
-		if (settings.showIcons) SetMenuItemBitmaps(hMenu, 0x1A2D, MF_BYCOMMAND, MyIcons_Get(MYICON_SHOWDESKTOP), MyIcons_Get(MYICON_SHOWDESKTOP));
+		if (settings.showIcons) SetMenuItemBitmaps(hMenu, 0x1A2D, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SHOWDESKTOP), MyIcons_Get(hWnd, MYICON_SHOWDESKTOP));
 		ApplyClassicMenu(hMenu);
 
     } else if
@@ -353,23 +497,23 @@ LRESULT CALLBACK TaskbarSubclassProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
             GetCursorPos(&pt);
 
             if (((pt.x > rect.left)&(pt.x < rect.right)&(pt.y > rect.top)&(pt.y < rect.bottom))) {
-                SetMenuItemBitmaps((HMENU)wParam, 413, MF_BYCOMMAND, MyIcons_Get(MYICON_SETTING), MyIcons_Get(MYICON_SETTING));
-                SetMenuItemBitmaps((HMENU)wParam, 420, MF_BYCOMMAND, MyIcons_Get(MYICON_TASKMGR), MyIcons_Get(MYICON_TASKMGR));
-                SetMenuItemBitmaps((HMENU)wParam, 407, MF_BYCOMMAND, MyIcons_Get(MYICON_SHOWDESKTOP), MyIcons_Get(MYICON_SHOWDESKTOP));
+                SetMenuItemBitmaps((HMENU)wParam, 413, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SETTING), MyIcons_Get(hWnd, MYICON_SETTING));
+                SetMenuItemBitmaps((HMENU)wParam, 420, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_TASKMGR), MyIcons_Get(hWnd, MYICON_TASKMGR));
+                SetMenuItemBitmaps((HMENU)wParam, 407, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SHOWDESKTOP), MyIcons_Get(hWnd, MYICON_SHOWDESKTOP));
 
             } else if (hWnd_NotifyWnd == hWnd || hWnd_TaskBar == hWnd) {
-                SetMenuItemBitmaps((HMENU)wParam, 414, MF_BYCOMMAND, MyIcons_Get(MYICON_SETTING), MyIcons_Get(MYICON_SETTING));
-                SetMenuItemBitmaps((HMENU)wParam, 421, MF_BYCOMMAND, MyIcons_Get(MYICON_TASKMGR), MyIcons_Get(MYICON_TASKMGR));
-                SetMenuItemBitmaps((HMENU)wParam, 408, MF_BYCOMMAND, MyIcons_Get(MYICON_SHOWDESKTOP), MyIcons_Get(MYICON_SHOWDESKTOP));
+                SetMenuItemBitmaps((HMENU)wParam, 414, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SETTING), MyIcons_Get(hWnd, MYICON_SETTING));
+                SetMenuItemBitmaps((HMENU)wParam, 421, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_TASKMGR), MyIcons_Get(hWnd, MYICON_TASKMGR));
+                SetMenuItemBitmaps((HMENU)wParam, 408, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SHOWDESKTOP), MyIcons_Get(hWnd, MYICON_SHOWDESKTOP));
 
-                SetMenuItemBitmaps((HMENU)wParam, 413, MF_BYCOMMAND, MyIcons_Get(MYICON_SETTING), MyIcons_Get(MYICON_SETTING));
-                SetMenuItemBitmaps((HMENU)wParam, 420, MF_BYCOMMAND, MyIcons_Get(MYICON_TASKMGR), MyIcons_Get(MYICON_TASKMGR));
-                SetMenuItemBitmaps((HMENU)wParam, 407, MF_BYCOMMAND, MyIcons_Get(MYICON_SHOWDESKTOP), MyIcons_Get(MYICON_SHOWDESKTOP));
+                SetMenuItemBitmaps((HMENU)wParam, 413, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SETTING), MyIcons_Get(hWnd, MYICON_SETTING));
+                SetMenuItemBitmaps((HMENU)wParam, 420, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_TASKMGR), MyIcons_Get(hWnd, MYICON_TASKMGR));
+                SetMenuItemBitmaps((HMENU)wParam, 407, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SHOWDESKTOP), MyIcons_Get(hWnd, MYICON_SHOWDESKTOP));
 
             } else {
-                SetMenuItemBitmaps((HMENU)wParam, 0x019E, MF_BYCOMMAND, MyIcons_Get(MYICON_SETTING), MyIcons_Get(MYICON_SETTING));
-                SetMenuItemBitmaps((HMENU)wParam, 0x01A5, MF_BYCOMMAND, MyIcons_Get(MYICON_TASKMGR), MyIcons_Get(MYICON_TASKMGR));
-                SetMenuItemBitmaps((HMENU)wParam, 0x0198, MF_BYCOMMAND, MyIcons_Get(MYICON_SHOWDESKTOP), MyIcons_Get(MYICON_SHOWDESKTOP));
+                SetMenuItemBitmaps((HMENU)wParam, 0x019E, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SETTING), MyIcons_Get(hWnd, MYICON_SETTING));
+                SetMenuItemBitmaps((HMENU)wParam, 0x01A5, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_TASKMGR), MyIcons_Get(hWnd, MYICON_TASKMGR));
+                SetMenuItemBitmaps((HMENU)wParam, 0x0198, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SHOWDESKTOP), MyIcons_Get(hWnd, MYICON_SHOWDESKTOP));
             }
         }
 
@@ -389,9 +533,9 @@ LRESULT CALLBACK SecondTaskbarSubclassProc(HWND hWnd, UINT uMsg, WPARAM wParam,
 
 		if (!settings.showIcons) return DefSubclassProc(hWnd, uMsg, wParam, lParam);;
 
-		SetMenuItemBitmaps((HMENU)wParam, 0x19d, MF_BYCOMMAND, MyIcons_Get(MYICON_SETTING), MyIcons_Get(MYICON_SETTING));
-		SetMenuItemBitmaps((HMENU)wParam, 0x1a4, MF_BYCOMMAND, MyIcons_Get(MYICON_TASKMGR), MyIcons_Get(MYICON_TASKMGR));
-		SetMenuItemBitmaps((HMENU)wParam, 0x197, MF_BYCOMMAND, MyIcons_Get(MYICON_SHOWDESKTOP), MyIcons_Get(MYICON_SHOWDESKTOP));
+		SetMenuItemBitmaps((HMENU)wParam, 0x19d, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SETTING), MyIcons_Get(hWnd, MYICON_SETTING));
+		SetMenuItemBitmaps((HMENU)wParam, 0x1a4, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_TASKMGR), MyIcons_Get(hWnd, MYICON_TASKMGR));
+		SetMenuItemBitmaps((HMENU)wParam, 0x197, MF_BYCOMMAND, MyIcons_Get(hWnd, MYICON_SHOWDESKTOP), MyIcons_Get(hWnd, MYICON_SHOWDESKTOP));
 	}
 
 	return DefSubclassProc(hWnd, uMsg, wParam, lParam);
@@ -550,7 +694,7 @@ BOOL Wh_ModInit() {
 
     LoadSettings();
 
-    MyIcons_Load();
+    MyIcons_Init();
 
     // For the case where the shell is not already running and thus taskbar has not initialized yet
     Wh_SetFunctionHook((void*)CreateWindowExW, (void*)CreateWindowExWHook, (void**)&pOriginalCreateWindowExW);
@@ -575,6 +719,7 @@ BOOL Wh_ModInit() {
 void Wh_ModUninit() {
     Wh_Log(L"Uninit");
 
+	MyIcons_LogUsage();
 	MyIcons_Free();
 
     // Unsubclass the taskbars
@@ -585,5 +730,7 @@ void Wh_ModUninit() {
 void Wh_ModSettingsChanged() {
     Wh_Log(L"SettingsChanged");
 
+	MyIcons_LogUsage();
+
     LoadSettings();
 }
@@ -2,7 +2,7 @@
 // @id              classic-theme-enable-with-extended-compatibility
 // @name            Classic Theme Enable with extended compatibility
 // @description     Enables classic theme. Supports Remote Desktop sessions and is compatible with early / system start of Windhawk.
-// @version         1.3.1
+// @version         1.3.2
 // @author          Roland Pihlakas
 // @github          https://github.com/levitation
 // @homepage        https://www.simplify.ee/
@@ -458,13 +458,14 @@ bool IsAutomaticLogonEnabled() {
     return true;
 }
 
-BOOL TryInit(bool* abort, DWORD* retryInterval) {
+BOOL TryInit(bool* abort, DWORD* retryInterval, bool* sessionInactive) {
 
 #ifdef _DEBUG
     *retryInterval = 1000;
 #else
     *retryInterval = 1;
 #endif
+    *sessionInactive = false;
 
 
     // Retrieve the current session ID for the process.
@@ -550,6 +551,7 @@ BOOL TryInit(bool* abort, DWORD* retryInterval) {
                 }
             }
 
+            *sessionInactive = true;
             return FALSE;     //retry
         }
     }
@@ -652,6 +654,59 @@ void RestoreTimerResolution() {
     Wh_Log(L"Timer resolution restored");
 }
 
+//While the session is not active, the init thread waits for a session change notification instead of polling. The message-only window is needed only for receiving the notifications.
+HWND CreateSessionNotificationWindow() {
+
+    HWND hWnd = CreateWindowExW(0, L"Message", NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, NULL, NULL);
+    if (!hWnd) {
+        Wh_Log(L"CreateWindowExW failed");
+        return NULL;
+    }
+
+    //This fails until the Remote Desktop Services service has started, in which case the caller keeps polling and tries again later
+    if (!WTSRegisterSessionNotification(hWnd, NOTIFY_FOR_THIS_SESSION)) {
+#ifdef _DEBUG   //this function will run in a loop, therefore not logging failures by default
+        Wh_Log(L"WTSRegisterSessionNotification failed");
+#endif
+        DestroyWindow(hWnd);
+        return NULL;
+    }
+
+    Wh_Log(L"Session notifications registered");
+    return hWnd;
+}
+
+void DestroySessionNotificationWindow(HWND hWnd) {
+
+    if (hWnd) {
+        WTSUnRegisterSessionNotification(hWnd);
+        DestroyWindow(hWnd);
+    }
+}
+
+//Returns false if the init thread should stop
+bool WaitForRetry(HWND hSessionNotificationWnd, DWORD retryInterval) {
+
+    if (!hSessionNotificationWnd) {
+        return WaitForSingleObject(g_initThreadStopSignal, retryInterval) == WAIT_TIMEOUT;
+    }
+
+    DWORD waitResult = MsgWaitForMultipleObjects(1, &g_initThreadStopSignal, FALSE, retryInterval, QS_ALLINPUT);
+    if (waitResult == WAIT_OBJECT_0 || waitResult == WAIT_FAILED) {
+        return false;
+    }
+
+    MSG msg;
+    while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+        if (msg.message == WM_WTSSESSION_CHANGE) {
+            Wh_Log(L"Session change notification: %u", (unsigned)msg.wParam);
+        }
+        DispatchMessageW(&msg);
+    }
+
+    return true;
+}
+
 DWORD WINAPI InitThreadFunc(LPVOID param) {
 
     Wh_Log(L"InitThreadFunc enter");
@@ -662,6 +717,11 @@ DWORD WINAPI InitThreadFunc(LPVOID param) {
 #else 
     DWORD retryInterval = 1;
 #endif
+    bool sessionInactive = false;
+    HWND hSessionNotificationWnd = NULL;
+    DWORD lastSessionNotificationRegistrationTime = 0;
+    bool sessionNotificationRegistrationAttempted = false;
+    DWORD result;
     //If Windhawk loads the mod too early then the classic theme initialisation will fail. 
     //Therefore we need to loop until the initialisation succeeds. Also if the mod is loaded 
     //into a RDP session too early then for some reason that would block the RDP session from 
@@ -669,28 +729,54 @@ DWORD WINAPI InitThreadFunc(LPVOID param) {
     //sessions. This is another reason for having a loop here.
     //Console sessions will not fail, but video driver might fail if the session is modified 
     //too early. Waiting for the session active state helps with that as well.
+    //While the session is not active, the loop waits for the session change notification, 
+    //with a one second fallback interval. Fast polling is used only for the remaining time 
+    //until the theme section becomes available.
 retry:  
     if (isRetry) {
-        if (WaitForSingleObject(g_initThreadStopSignal, retryInterval) != WAIT_TIMEOUT) {
+        DWORD interval = (sessionInactive && hSessionNotificationWnd) ? 1000 : retryInterval;
+        if (!WaitForRetry(hSessionNotificationWnd, interval)) {
             Wh_Log(L"Shutting down InitThreadFunc before success");
             RestoreTimerResolution();
-            return FALSE;
+            result = FALSE;
+            goto cleanup;
         }
     }
     isRetry = true;
 
-    bool abort = false;
-    if (TryInit(&abort, &retryInterval)) {
-        RestoreTimerResolution();
-        return TRUE;    //classic theme enable done
-    }
-    else if (abort) {
-        RestoreTimerResolution();
-        return FALSE;   //a service session
+    {
+        bool abort = false;
+        if (TryInit(&abort, &retryInterval, &sessionInactive)) {
+            RestoreTimerResolution();
+            result = TRUE;    //classic theme enable done
+            goto cleanup;
+        }
+        else if (abort) {
+            RestoreTimerResolution();
+            result = FALSE;   //a service session
+            goto cleanup;
+        }
     }
-    else {      //If Windhawk loads the mod too early then the classic theme initialisation will fail. Therefore we need to loop until the initialisation succeeds. Also if the mod is loaded into a RDP session too early then for some reason that would block the RDP session from successfully connecting. So we need to wait for session "active" state in case of RDP sessions. This is another reason for having a loop here.
-        goto retry;
+
+    //Register for session change notifications once the session is known to be inactive. Registration fails until the Remote Desktop Services service is up, so it is retried at most once per second.
+    if (
+        sessionInactive 
+        && !hSessionNotificationWnd
+        && (!sessionNotificationRegistrationAttempted || GetTickCount() - lastSessionNotificationRegistrationTime >= 1000)
+    ) {
+        sessionNotificationRegistrationAttempted = true;
+        lastSessionNotificationRegistrationTime = GetTickCount();
+
+        hSessionNotificationWnd = CreateSessionNotificationWindow();
+        if (hSessionNotificationWnd) {
+            isRetry = false;    //the session may have become active before the registration, check again without waiting
+        }
     }
+    goto retry;
+
+cleanup:
+    DestroySessionNotificationWindow(hSessionNotificationWnd);
+    return result;
 }
 
 BOOL Wh_ModInit() {
@@ -700,7 +786,8 @@ BOOL Wh_ModInit() {
 
     bool abort = false;
     DWORD unusedRetryInterval;
-    if (TryInit(&abort, &unusedRetryInterval)) {
+    bool unusedSessionInactive;
+    if (TryInit(&abort, &unusedRetryInterval, &unusedSessionInactive)) {
         return TRUE;    //classic theme enable done
     }
     else if (abort) {
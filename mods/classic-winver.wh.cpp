@@ -2,7 +2,7 @@
 // @id              classic-winver
 // @name            Classic Winver
 // @description     Allows you to restore the Winver dialog from various versions of Windows
-// @version         1.1.0
+// @version         1.1.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -381,6 +381,86 @@ DWORD RegGetStringAndRealloc(HKEY hkey, LPCWSTR lpszValue, LPWSTR *lplpsz, LPDWO
     return err;
 }
 
+// Returns a LocalAlloc'd copy of a string value, or NULL if it couldn't be read
+LPWSTR RegGetStringAlloc(HKEY hkey, LPCWSTR lpszValue)
+{
+    DWORD  cb = 256;
+    LPWSTR lpsz = (LPWSTR)LocalAlloc(LPTR, cb);
+    if (lpsz && RegGetStringAndRealloc(hkey, lpszValue, &lpsz, &cb))
+    {
+        LocalFree(lpsz);
+        lpsz = NULL;
+    }
+    return lpsz;
+}
+
+// Values from HKLM\SOFTWARE\Microsoft\Windows NT\CurrentVersion that the
+// dialog shows. They are all read in one go so that the key is only opened
+// once, and values that are overridden by the settings aren't read at all.
+typedef struct {
+    LPWSTR pszBuildLab;
+    LPWSTR pszDisplayVersion;
+    LPWSTR pszRegisteredOwner;
+    LPWSTR pszRegisteredOrganization;
+    DWORD  dwUBR;
+} VERSION_REG_INFO, *LPVERSION_REG_INFO;
+
+void ReadVersionRegInfo(LPVERSION_REG_INFO lpvri)
+{
+    ZeroMemory(lpvri, sizeof(*lpvri));
+    lpvri->dwUBR = g_dwUBR;
+
+    HKEY hkey;
+    if (ERROR_SUCCESS != RegOpenKeyExW(
+        HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion",
+        0, KEY_READ, &hkey))
+    {
+        return;
+    }
+
+    if ((g_winverVersion == WVV_WINNT4 || g_winverVersion >= WVV_WIN2K)
+    && g_winverVersion < WVV_WIN10
+    && (g_fUseBuildLabEx || g_winverVersion == WVV_WINXP || g_winverVersion == WVV_WINSRV03)
+    && !g_spszBuildLab.get()[0])
+    {
+        lpvri->pszBuildLab = RegGetStringAlloc(hkey, g_fUseBuildLabEx ? L"BuildLabEx" : L"BuildLab");
+    }
+
+    if (g_winverVersion == WVV_WIN10)
+    {
+        if (lpvri->dwUBR == (DWORD)-1)
+        {
+            DWORD cbUBR = sizeof(DWORD);
+            RegQueryValueExW(hkey, L"UBR", nullptr, nullptr, (LPBYTE)&lpvri->dwUBR, &cbUBR);
+        }
+
+        if (!g_spszDisplayVersion.get()[0])
+        {
+            lpvri->pszDisplayVersion = RegGetStringAlloc(hkey, L"DisplayVersion");
+            if (!lpvri->pszDisplayVersion)
+                lpvri->pszDisplayVersion = RegGetStringAlloc(hkey, L"ReleaseID");
+        }
+    }
+
+    lpvri->pszRegisteredOwner = RegGetStringAlloc(hkey, L"RegisteredOwner");
+    lpvri->pszRegisteredOrganization = RegGetStringAlloc(hkey, L"RegisteredOrganization");
+
+    RegCloseKey(hkey);
+}
+
+void FreeVersionRegInfo(LPVERSION_REG_INFO lpvri)
+{
+    if (lpvri->pszBuildLab)
+        LocalFree(lpvri->pszBuildLab);
+    if (lpvri->pszDisplayVersion)
+        LocalFree(lpvri->pszDisplayVersion);
+    if (lpvri->pszRegisteredOwner)
+        LocalFree(lpvri->pszRegisteredOwner);
+    if (lpvri->pszRegisteredOrganization)
+        LocalFree(lpvri->pszRegisteredOrganization);
+    ZeroMemory(lpvri, sizeof(*lpvri));
+}
+
 
 #define BytesToK(pDW)   (*(pDW) = (*(pDW) + 512) / 1024)
 
@@ -562,6 +642,22 @@ void FreeAboutBitmaps(LPABOUT_PARAMS lpap)
     }
 }
 
+// The 7+ banner is stretched at paint time, so a DPI change only needs the
+// scaled size to be recalculated rather than the bitmap to be reloaded.
+void ScaleAboutBitmap(LPABOUT_PARAMS lpap)
+{
+    int dpiSystem = GetDpiForSystem();
+    if (dpiSystem == lpap->dpiWindow || !dpiSystem)
+    {
+        lpap->sizeScaled = lpap->sizeAbout;
+    }
+    else
+    {
+        lpap->sizeScaled.cx = MulDiv(lpap->sizeAbout.cx, lpap->dpiWindow, dpiSystem);
+        lpap->sizeScaled.cy = MulDiv(lpap->sizeAbout.cy, lpap->dpiWindow, dpiSystem);
+    }
+}
+
 void LoadAboutBitmaps(LPABOUT_PARAMS lpap)
 {
     FreeAboutBitmaps(lpap);
@@ -610,17 +706,7 @@ void LoadAboutBitmaps(LPABOUT_PARAMS lpap)
                 GetObjectW(hbmAbout, sizeof(bm), &bm);
                 lpap->sizeAbout.cx = bm.bmWidth;
                 lpap->sizeAbout.cy = bm.bmHeight;
-
-                int dpiSystem = GetDpiForSystem();
-                if (dpiSystem == lpap->dpiWindow || !dpiSystem)
-                {
-                    lpap->sizeScaled = lpap->sizeAbout;
-                }
-                else
-                {
-                    lpap->sizeScaled.cx = MulDiv(lpap->sizeAbout.cx, lpap->dpiWindow, dpiSystem);
-                    lpap->sizeScaled.cy = MulDiv(lpap->sizeAbout.cy, lpap->dpiWindow, dpiSystem);
-                }
+                ScaleAboutBitmap(lpap);
             }
             break;
         }
@@ -699,6 +785,9 @@ void _InitAboutDlg(HWND hwnd, LPABOUT_PARAMS lpap)
         g_winverVersion = WVV_WINNT4;
     }
 
+    VERSION_REG_INFO vri;
+    ReadVersionRegInfo(&vri);
+
     lpap->dpiWindow = GetDpiForWindow(hwnd);
 
     // If you have a string like test1#test2, then the dialog's title will be
@@ -809,29 +898,11 @@ void _InitAboutDlg(HWND hwnd, LPABOUT_PARAMS lpap)
             {
                 wcscpy_s(szBuildLab, g_spszBuildLab.get());
             }
-            else
+            else if (vri.pszBuildLab)
             {
-                HKEY hkey;
-                if (ERROR_SUCCESS == RegOpenKeyExW(
-                    HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion",
-                    0, KEY_READ, &hkey))
-                {
-                    LPWSTR lpszValue = NULL;
-                    DWORD  cb, err;
-                    cb = 256;
-                    if (NULL != (lpszValue = (LPWSTR)LocalAlloc(LPTR, cb)))
-                    {
-                        err = RegGetStringAndRealloc(hkey, g_fUseBuildLabEx ? L"BuildLabEx" : L"BuildLab", &lpszValue, &cb);
-                        if (!err)
-                        {
-                            LPWSTR pszDot = wcschr(lpszValue, L'.');
-                            if (pszDot)
-                                wcscpy_s(szBuildLab, pszDot + 1);
-                        }
-                        LocalFree(lpszValue);
-                    }
-                    RegCloseKey(hkey);
-                }
+                LPWSTR pszDot = wcschr(vri.pszBuildLab, L'.');
+                if (pszDot)
+                    wcscpy_s(szBuildLab, pszDot + 1);
             }
 
             if (szBuildLab[0])
@@ -870,44 +941,19 @@ void _InitAboutDlg(HWND hwnd, LPABOUT_PARAMS lpap)
     {
         LoadStringW(g_hmShell, IDS_VERSIONMSG, szBuffer, ARRAYSIZE(szBuffer));
 
-        DWORD dwUBR = g_dwUBR;
+        DWORD dwUBR = vri.dwUBR;
 
-        HKEY hkey;
-        if (ERROR_SUCCESS == RegOpenKeyExW(
-            HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion",
-            0, KEY_READ, &hkey))
+        szTitle[0] = L'\0';
+        if (g_spszDisplayVersion.get()[0])
         {
-            LPWSTR lpszValue = NULL;
-            DWORD  cb, err;
-            cb = 256;
-            if (NULL != (lpszValue = (LPWSTR)LocalAlloc(LPTR, cb)))
-            {
-                DWORD cbUBR = sizeof(DWORD);
-                if (dwUBR == (DWORD)-1)
-                    RegQueryValueExW(hkey, L"UBR", nullptr, nullptr, (LPBYTE)&dwUBR, &cbUBR);
-
-                szTitle[0] = L'\0';
-                if (g_spszDisplayVersion.get()[0])
-                {
-                    wcscpy_s(szTitle, g_spszDisplayVersion.get());
-                }
-                else
-                {
-                    err = RegGetStringAndRealloc(hkey, L"DisplayVersion", &lpszValue, &cb);
-                    if (err)
-                        err = RegGetStringAndRealloc(hkey, L"ReleaseID", &lpszValue, &cb);
-
-                    if (!err)
-                        wcscpy_s(szTitle, lpszValue);
-                }
-
-                LocalFree(lpszValue);
-            }
-
-            swprintf_s(szTemp, L"%d", g_osvi.dwBuildNumber);
-
-            RegCloseKey(hkey);
+            wcscpy_s(szTitle, g_spszDisplayVersion.get());
         }
+        else if (vri.pszDisplayVersion)
+        {
+            wcscpy_s(szTitle, vri.pszDisplayVersion);
+        }
+
+        swprintf_s(szTemp, L"%d", g_osvi.dwBuildNumber);
 
         szNumBuf1[0] = L'\0';
         if (GetSystemMetrics(SM_DEBUG))
@@ -937,30 +983,12 @@ void _InitAboutDlg(HWND hwnd, LPABOUT_PARAMS lpap)
     }
 
     // Set registered owner and organization
-    HKEY hkey;
-    if (ERROR_SUCCESS == RegOpenKeyExW(
-        HKEY_LOCAL_MACHINE, L"SOFTWARE\\Microsoft\\Windows NT\\CurrentVersion",
-        0, KEY_READ, &hkey))
-    {
-        LPWSTR lpszValue = NULL;
-        DWORD  cb, err;
-
-        cb = 256;
-        if (NULL != (lpszValue = (LPWSTR)LocalAlloc(LPTR, cb)))
-        {
-            err = RegGetStringAndRealloc(hkey, L"RegisteredOwner", &lpszValue, &cb);
-            if (!err)
-                SetDlgItemText(hwnd, IDD_USERNAME, lpszValue);
-
-            err = RegGetStringAndRealloc(hkey, L"RegisteredOrganization", &lpszValue, &cb);
-            if (!err)
-                SetDlgItemText(hwnd, IDD_COMPANYNAME, lpszValue);
+    if (vri.pszRegisteredOwner)
+        SetDlgItemText(hwnd, IDD_USERNAME, vri.pszRegisteredOwner);
+    if (vri.pszRegisteredOrganization)
+        SetDlgItemText(hwnd, IDD_COMPANYNAME, vri.pszRegisteredOrganization);
 
-            LocalFree(lpszValue);
-        }
-
-        RegCloseKey(hkey);
-    }
+    FreeVersionRegInfo(&vri);
 
     // Set up "Physical memory available to Windows" text
     if (g_winverVersion <= WVV_WINVISTA)
@@ -1225,7 +1253,10 @@ INT_PTR CALLBACK AboutDlgProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam
             {
                 LPABOUT_PARAMS lpap = (LPABOUT_PARAMS)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
                 lpap->dpiWindow = GetDpiForWindow(hwnd);
-                LoadAboutBitmaps(lpap);
+                if (lpap->hbmAbout)
+                    ScaleAboutBitmap(lpap);
+                else
+                    LoadAboutBitmaps(lpap);
                 ApplyLayout(hwnd, lpap);
             }
             return TRUE;
@@ -2,7 +2,7 @@
 // @id              custom-desktop-watermark
 // @name            Custom Desktop Watermark
 // @description     Lets you set your own desktop watermark text
-// @version         1.1.0
+// @version         1.1.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         explorer.exe
@@ -80,6 +80,29 @@ struct WatermarkLine
 std::vector<WatermarkLine> g_lines;
 bool g_fClassic = false;
 
+// Fonts and text metrics for the watermark. These are built on the first paint
+// and kept until the settings, the DPI or the system fonts change, so that
+// desktop repaints only have to draw the text.
+struct WatermarkLayout
+{
+    bool             valid;
+    int              dpi;
+    LOGFONTW         lfCaption;
+    LOGFONTW         lfMessage;
+    HFONT            hTitleFont;
+    HFONT            hMessageFont;
+    HFONT            hTitleFontBold;
+    HFONT            hMessageFontBold;
+    int              maxWidth;
+    std::vector<int> lineHeights;
+};
+
+WatermarkLayout g_layout = {};
+
+// Guards g_lines and g_layout, which are used by the desktop thread for
+// painting and replaced when the settings change.
+SRWLOCK g_layoutLock = SRWLOCK_INIT;
+
 bool (*CDesktopWatermark_s_WantWatermark_orig)(void);
 bool CDesktopWatermark_s_WantWatermark_hook(void)
 {
@@ -104,20 +127,15 @@ int PaintLine(
     HFONT          hFont,
     int            align,
     int            width,
+    int            height,
     int            offset
 )
 {
     HFONT hfOld = (HFONT)SelectObject(hDC, hFont);
-        
-    RECT rcText = { 0 };
-    int newOffset = DrawTextW(
-        hDC, lpszText, -1,
-        &rcText, DT_CALCRECT | DT_SINGLELINE
-    );
 
     RECT rcPaint = { 0 };
     rcPaint.left = lprc->right - width;
-    rcPaint.top = lprc->bottom - RECTHEIGHT(rcText);
+    rcPaint.top = lprc->bottom - height;
     rcPaint.right = lprc->right;
     rcPaint.bottom = lprc->bottom;
 
@@ -127,7 +145,67 @@ int PaintLine(
     DrawTextW(hDC, lpszText, -1, &rcPaint, DT_SINGLELINE | align);
 
     SelectObject(hDC, hfOld);
-    return newOffset;    
+    return height;
+}
+
+void FreeLayout(WatermarkLayout &layout)
+{
+    if (layout.hTitleFont)
+        DeleteObject(layout.hTitleFont);
+    if (layout.hMessageFont)
+        DeleteObject(layout.hMessageFont);
+    if (layout.hTitleFontBold)
+        DeleteObject(layout.hTitleFontBold);
+    if (layout.hMessageFontBold)
+        DeleteObject(layout.hMessageFontBold);
+    layout = {};
+}
+
+HFONT GetLineFont(const WatermarkLayout &layout, const WatermarkLine &line)
+{
+    bool fMessageFont = g_fClassic && !line.title;
+    return fMessageFont
+    ? (line.bold ? layout.hMessageFontBold : layout.hMessageFont)
+    : (line.bold ? layout.hTitleFontBold : layout.hTitleFont);
+}
+
+bool BuildLayout(HDC hDC, int dpi, const NONCLIENTMETRICSW &ncm)
+{
+    FreeLayout(g_layout);
+
+    g_layout.dpi = dpi;
+    g_layout.lfCaption = ncm.lfCaptionFont;
+    g_layout.lfMessage = ncm.lfMessageFont;
+
+    LOGFONTW lfCaptionBold = ncm.lfCaptionFont;
+    LOGFONTW lfMessageBold = ncm.lfMessageFont;
+    lfCaptionBold.lfWeight = FW_BOLD;
+    lfMessageBold.lfWeight = FW_BOLD;
+    g_layout.hTitleFont = CreateFontIndirectW(&ncm.lfCaptionFont);
+    g_layout.hMessageFont = CreateFontIndirectW(&ncm.lfMessageFont);
+    g_layout.hTitleFontBold = CreateFontIndirectW(&lfCaptionBold);
+    g_layout.hMessageFontBold = CreateFontIndirectW(&lfMessageBold);
+    if (!g_layout.hTitleFont || !g_layout.hMessageFont
+    || !g_layout.hTitleFontBold || !g_layout.hMessageFontBold)
+    {
+        FreeLayout(g_layout);
+        return false;
+    }
+
+    for (const WatermarkLine &line : g_lines)
+    {
+        HFONT hfOld = (HFONT)SelectObject(hDC, GetLineFont(g_layout, line));
+        int width;
+        int height = CalculateTextSize(hDC, line.text.c_str(), &width);
+        SelectObject(hDC, hfOld);
+
+        if (width > g_layout.maxWidth)
+            g_layout.maxWidth = width;
+        g_layout.lineHeights.push_back(height);
+    }
+
+    g_layout.valid = true;
+    return true;
 }
 
 void (*CDesktopWatermark_s_DesktopBuildPaint_orig)(HDC, LPCRECT, HFONT);
@@ -137,8 +215,6 @@ void CDesktopWatermark_s_DesktopBuildPaint_hook(
     HFONT   hFont
 )
 {
-    COLORREF cr = SetTextColor(hDC, RGB(255, 255, 255));
-    int bk = SetBkMode(hDC, TRANSPARENT);
     int offset = 0;
 
     NONCLIENTMETRICSW ncm = { sizeof(ncm) };
@@ -150,55 +226,44 @@ void CDesktopWatermark_s_DesktopBuildPaint_hook(
         0,
         dpi
     );
-    HFONT hTitleFont = CreateFontIndirectW(&ncm.lfCaptionFont);
-    HFONT hMessageFont = CreateFontIndirectW(&ncm.lfMessageFont);
-    ncm.lfCaptionFont.lfWeight = FW_BOLD;
-    ncm.lfMessageFont.lfWeight = FW_BOLD;
-    HFONT hTitleFontBold = CreateFontIndirectW(&ncm.lfCaptionFont);
-    HFONT hMessageFontBold = CreateFontIndirectW(&ncm.lfMessageFont);
-    if (!hTitleFont || !hMessageFont || !hTitleFontBold || !hMessageFontBold)
-        return;
-    int padding = MulDiv(3, dpi, 96);
-    offset += MulDiv(g_fClassic ? 4 : 1, dpi, 96);
 
-    int maxWidth = 0;
-    for (const WatermarkLine &line : g_lines)
+    AcquireSRWLockExclusive(&g_layoutLock);
+
+    // The system fonts are compared too, since they can be changed without
+    // the mod being notified.
+    if (!g_layout.valid || g_layout.dpi != dpi
+    || memcmp(&g_layout.lfCaption, &ncm.lfCaptionFont, sizeof(LOGFONTW))
+    || memcmp(&g_layout.lfMessage, &ncm.lfMessageFont, sizeof(LOGFONTW)))
     {
-        bool fMessageFont = g_fClassic && !line.title;
-        HFONT hFont = fMessageFont
-        ? (line.bold ? hMessageFontBold : hMessageFont)
-        : (line.bold ? hTitleFontBold : hTitleFont);
+        if (!BuildLayout(hDC, dpi, ncm))
+        {
+            ReleaseSRWLockExclusive(&g_layoutLock);
+            return;
+        }
+    }
 
-        HFONT hfOld = (HFONT)SelectObject(hDC, hFont);
-        int width;
-        CalculateTextSize(hDC, line.text.c_str(), &width);
-        SelectObject(hDC, hfOld);
+    COLORREF cr = SetTextColor(hDC, RGB(255, 255, 255));
+    int bk = SetBkMode(hDC, TRANSPARENT);
 
-        if (width > maxWidth)
-            maxWidth = width;
-    }
+    int padding = MulDiv(3, dpi, 96);
+    offset += MulDiv(g_fClassic ? 4 : 1, dpi, 96);
 
     for (size_t i = g_lines.size(); i--;)
     {
         WatermarkLine &line = g_lines.at(i);
-        bool fMessageFont = g_fClassic && !line.title;
-        HFONT hFont = fMessageFont
-        ? (line.bold ? hMessageFontBold : hMessageFont)
-        : (line.bold ? hTitleFontBold : hTitleFont);
 
         offset += PaintLine(
             hDC, lprc, line.text.c_str(),
-            hFont,
+            GetLineFont(g_layout, line),
             line.align,
-            maxWidth,
+            g_layout.maxWidth,
+            g_layout.lineHeights.at(i),
             offset
         ) + padding;
     }
 
-    DeleteObject(hTitleFont);
-    DeleteObject(hMessageFont);
-    DeleteObject(hTitleFontBold);
-    DeleteObject(hMessageFontBold);
+    ReleaseSRWLockExclusive(&g_layoutLock);
+
     SetBkMode(hDC, bk);
     SetTextColor(hDC, cr);
 }
@@ -224,6 +289,9 @@ const WindhawkUtils::SYMBOL_HOOK shell32DllHooks[] = {
 
 void LoadSettings(void)
 {
+    AcquireSRWLockExclusive(&g_layoutLock);
+
+    FreeLayout(g_layout);
     g_lines.clear();
     g_fClassic = Wh_GetIntSetting(L"classic");
 
@@ -252,6 +320,8 @@ void LoadSettings(void)
         g_lines.push_back(line);
         Wh_FreeStringSetting(pszText);
     }
+
+    ReleaseSRWLockExclusive(&g_layoutLock);
 }
 
 BOOL Wh_ModInit(void)
@@ -281,4 +351,11 @@ BOOL Wh_ModInit(void)
 void Wh_ModSettingsChanged(void)
 {
     LoadSettings();
-}
\ No newline at end of file
+}
+
+void Wh_ModUninit(void)
+{
+    AcquireSRWLockExclusive(&g_layoutLock);
+    FreeLayout(g_layout);
+    ReleaseSRWLockExclusive(&g_layoutLock);
+}
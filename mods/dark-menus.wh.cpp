@@ -1,6 +1,6 @@
 // ==WindhawkMod==
 // @id                dark-menus
-// @version           1.3.1
+// @version           1.3.2
 // @author            Mgg Sk
 // @github            https://github.com/MGGSK
 // @include           *
@@ -57,6 +57,8 @@ The code for dark menubars is based on [win32-darkmode](https://github.com/adzm/
 #include <windhawk_api.h>
 #include <winnt.h>
 
+#include <atomic>
+
 const COLORREF crItemForeground = 0xFFFFFF;
 const COLORREF crItemDisabled = 0xAAAAAA;
 const HBRUSH brBackground = CreateSolidBrush(0x262626);
@@ -214,6 +216,7 @@ bool CALLBACK UAHWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, LRE
         return true;
     }
     case WM_THEMECHANGED:
+    case WM_DPICHANGED:
     {
         CloseThemeData(g_menuTheme);
         g_menuTheme = nullptr;
@@ -225,6 +228,11 @@ bool CALLBACK UAHWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam, LRE
 }
 #pragma endregion
 
+bool IsColorSchemeChangeMessage(UINT uMsg, LPARAM lParam)
+{
+    return uMsg == WM_SETTINGCHANGE && lParam && lstrcmpiW((LPCWSTR)lParam, L"ImmersiveColorSet") == 0;
+}
+
 using RtlGetNtVersionNumbers_T = void (WINAPI *)(LPDWORD, LPDWORD, LPDWORD);
 RtlGetNtVersionNumbers_T RtlGetNtVersionNumbers;
 
@@ -250,9 +258,33 @@ ShouldAppsUseDarkMode_T ShouldAppsUseDarkMode;
 
 AppMode g_currentAppMode;
 
+//DefWindowProc runs for almost every message, so the result of
+//ShouldAppsUseDarkMode is cached until the color scheme changes.
+//-1 means it needs to be queried again.
+std::atomic<int> g_appsUseDarkMode { -1 };
+
+bool AppsUseDarkMode()
+{
+    int value = g_appsUseDarkMode.load(std::memory_order_relaxed);
+    if(value < 0)
+    {
+        value = ShouldAppsUseDarkMode() ? 1 : 0;
+        g_appsUseDarkMode.store(value, std::memory_order_relaxed);
+    }
+
+    return value != 0;
+}
+
 LRESULT CALLBACK DefWindowProcW_Hook(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
-    if(g_currentAppMode == AppMode::ForceDark || (g_currentAppMode == AppMode::AllowDark && ShouldAppsUseDarkMode()))
+    if(IsColorSchemeChangeMessage(uMsg, lParam))
+    {
+        g_appsUseDarkMode.store(-1, std::memory_order_relaxed);
+        CloseThemeData(g_menuTheme);
+        g_menuTheme = nullptr;
+    }
+
+    if(g_currentAppMode == AppMode::ForceDark || (g_currentAppMode == AppMode::AllowDark && AppsUseDarkMode()))
     {
         LRESULT lResult = 0;
         if(UAHWndProc(hWnd, uMsg, wParam, lParam, &lResult))
@@ -294,6 +326,7 @@ void ApplyTheme(const AppMode inputTheme = Max)
     SetPreferredAppMode(theme);
 
     g_currentAppMode = theme;
+    g_appsUseDarkMode.store(-1, std::memory_order_relaxed);
 }
 
 //Checks if the windows build is 18362 or later.
@@ -2,7 +2,7 @@
 // @id              dark-theme-browser-colors-fix
 // @name            Fix browser and Teams text colors in dark mode
 // @description     For dark theme users, fixes unreadable web sites with bright text on white background or black text on dark background. Likewise fixes Teams document viewer's text colors.
-// @version         1.0
+// @version         1.0.1
 // @author          Roland Pihlakas
 // @github          https://github.com/levitation
 // @homepage        https://www.simplify.ee/
@@ -81,11 +81,14 @@ Unloading this mod while a browser is running is not recommended. Unloading the
 #include <windowsx.h>
 #include <intrin.h>
 #include <shlwapi.h>
+#include <winternl.h>     //PCUNICODE_STRING, NT_SUCCESS
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 #include <map>
 #include <unordered_set>
+#include <vector>
 
 #pragma endregion Includes
 
@@ -168,8 +171,17 @@ DWORD g_processId = -1;
 
 std::atomic<size_t> g_hookRefCount;
 
+typedef struct tagCallerModuleRange {
+    ULONG_PTR start;
+    ULONG_PTR end;          //exclusive
+    bool isFilePicker;
+} CallerModuleRange;
+
 std::mutex g_filePickerDetectionMutex;
-std::map<void*, bool> g_filePickerDetectionMap;
+std::vector<CallerModuleRange> g_filePickerDetectionRanges;     //sorted by start address, so that a caller lookup is a binary search without any system calls
+unsigned int g_filePickerDetectionRangesUnloadCounter = 0;     //value of g_dllUnloadCounter when the ranges were last known to be valid
+std::atomic<unsigned int> g_dllUnloadCounter = 0;
+PVOID g_dllNotificationCookie = NULL;
 
 HMODULE hGdi32 = NULL;
 HMODULE hUser32 = NULL;
@@ -294,56 +306,105 @@ LPCWSTR GetModuleName(
     }
 }
 
+ULONG_PTR GetModuleEnd(HMODULE hModule) {
+
+    //the image headers of a loaded module stay mapped for as long as the module is loaded
+    const IMAGE_DOS_HEADER* dosHeader = (const IMAGE_DOS_HEADER*)hModule;
+    const IMAGE_NT_HEADERS* ntHeaders = (const IMAGE_NT_HEADERS*)((const BYTE*)hModule + dosHeader->e_lfanew);
+    return (ULONG_PTR)hModule + ntHeaders->OptionalHeader.SizeOfImage;
+}
+
+bool IsFilePickerDllPath(PCWSTR callerDllPath) {
+
+    if (!callerDllPath)
+        return false;
+
+    size_t callerDllPathLen = wcslen(callerDllPath);
+
+    for (unsigned int i = 0; i < ARRAYSIZE(filePickerDlls); i++) {
+
+        LPCWSTR checkPath = filePickerDlls[i];
+        size_t checkPathLen = wcslen(checkPath);
+        if (
+            callerDllPathLen >= checkPathLen
+            && wcsicmp(&callerDllPath[callerDllPathLen - checkPathLen], checkPath) == 0     //match end of path
+        ) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//Inserts the range at its sorted position. Any cached ranges which overlap the new one are replaced by it, since the new one comes from a fresh module lookup. Keeping the ranges non-overlapping keeps them sorted by their end address too, which the lookup relies on.
+void InsertCallerModuleRange(std::vector<CallerModuleRange>& ranges, const CallerModuleRange& range) {
+    auto first = std::lower_bound(
+        ranges.begin(),
+        ranges.end(),
+        range.start,
+        [](const CallerModuleRange& existing, ULONG_PTR start) { return existing.end <= start; }
+    );
+    auto last = std::lower_bound(
+        first,
+        ranges.end(),
+        range.end,
+        [](const CallerModuleRange& existing, ULONG_PTR end) { return existing.start < end; }
+    );
+    auto it = ranges.erase(first, last);
+    ranges.insert(it, range);
+}
+
 bool IsCallerFilePicker(void* returnAddress) {
 
-    bool result = false;
+    ULONG_PTR address = (ULONG_PTR)returnAddress;
 
     std::lock_guard<std::mutex> guard(g_filePickerDetectionMutex);
-    auto it = g_filePickerDetectionMap.find(returnAddress);
-    if (it != g_filePickerDetectionMap.end()) {
-        result = it->second;
-    }
-    else {
-        HMODULE callerModule = GetCallerModule(returnAddress);
 
-        WCHAR stackBuffer[nMaxDllPathLength];
-        PCWSTR callerDllPath = GetModuleName(
-            callerModule,
-            stackBuffer,
-            nMaxDllPathLength
-        );
+    //An unloaded module's address range might be reused by another module, so forget all ranges after any dll unload. Dll unloads are rare compared to the hooked calls.
+    unsigned int dllUnloadCounter = g_dllUnloadCounter;
+    if (dllUnloadCounter != g_filePickerDetectionRangesUnloadCounter) {
+        g_filePickerDetectionRanges.clear();
+        g_filePickerDetectionRangesUnloadCounter = dllUnloadCounter;
+    }
 
-        if (callerDllPath) {
+    //find the last range starting at or before the address
+    auto it = std::upper_bound(
+        g_filePickerDetectionRanges.begin(),
+        g_filePickerDetectionRanges.end(),
+        address,
+        [](ULONG_PTR address, const CallerModuleRange& range) { return address < range.start; }
+    );
+    if (it != g_filePickerDetectionRanges.begin() && address < (it - 1)->end) {
+        return (it - 1)->isFilePicker;
+    }
 
-            size_t callerDllPathLen = wcslen(callerDllPath);
 
-            for (unsigned int i = 0; i < ARRAYSIZE(filePickerDlls); i++) {
+    HMODULE callerModule = GetCallerModule(returnAddress);
 
-                LPCWSTR checkPath = filePickerDlls[i];
-                size_t checkPathLen = wcslen(checkPath);
-                if (
-                    callerDllPathLen >= checkPathLen
-                    && wcsicmp(&callerDllPath[callerDllPathLen - checkPathLen], checkPath) == 0     //match end of path
-                ) {
-                    result = true;
-                    break;
-                }
-            }
-        }
+    WCHAR stackBuffer[nMaxDllPathLength];
+    PCWSTR callerDllPath = GetModuleName(
+        callerModule,
+        stackBuffer,
+        nMaxDllPathLength
+    );
 
-        if (result) {
-            Wh_Log(L"A file picker caller detected: %ls", callerDllPath ? callerDllPath : L"");
-        }
-        else {
-            Wh_Log(L"A non file picker caller detected: %ls", callerDllPath ? callerDllPath : L"");
-        }
+    bool result = IsFilePickerDllPath(callerDllPath);
 
-        g_filePickerDetectionMap.insert({ 
-            returnAddress, 
-            result
-        });
+    if (result) {
+        Wh_Log(L"A file picker caller detected: %ls", callerDllPath ? callerDllPath : L"");
+    }
+    else {
+        Wh_Log(L"A non file picker caller detected: %ls", callerDllPath ? callerDllPath : L"");
     }
 
+    //If the module was not found (for example, .NET code) then remember only the return address itself
+    CallerModuleRange range;
+    range.start = callerModule ? (ULONG_PTR)callerModule : address;
+    range.end = callerModule ? GetModuleEnd(callerModule) : address + 1;
+    range.isFilePicker = result;
+
+    InsertCallerModuleRange(g_filePickerDetectionRanges, range);
+
     return result;
 }
 
@@ -351,6 +412,73 @@ bool IsCallerFilePicker(void* returnAddress) {
 
 
 
+#pragma region Dll unload notifications
+
+//https://learn.microsoft.com/en-us/windows/win32/devnotes/ldrdllnotification
+#define LDR_DLL_NOTIFICATION_REASON_UNLOADED    2
+
+typedef struct tagLdrDllNotificationData {
+    ULONG Flags;
+    PCUNICODE_STRING FullDllName;
+    PCUNICODE_STRING BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+} LdrDllNotificationData;
+
+typedef VOID(CALLBACK* LdrDllNotificationFunction_t)(ULONG, const LdrDllNotificationData*, PVOID);
+typedef NTSTATUS(NTAPI* LdrRegisterDllNotification_t)(ULONG, LdrDllNotificationFunction_t, PVOID, PVOID*);
+typedef NTSTATUS(NTAPI* LdrUnregisterDllNotification_t)(PVOID);
+
+VOID CALLBACK DllNotificationCallback(
+    ULONG NotificationReason,
+    const LdrDllNotificationData* NotificationData,
+    PVOID Context
+) {
+    //NB! This is called under the loader lock, so it must not take g_filePickerDetectionMutex. GetCallerModule() is called while holding that mutex and takes the loader lock.
+    if (NotificationReason == LDR_DLL_NOTIFICATION_REASON_UNLOADED)
+        g_dllUnloadCounter++;
+}
+
+void RegisterDllNotification() {
+
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    LdrRegisterDllNotification_t pLdrRegisterDllNotification = 
+        hNtdll ? (LdrRegisterDllNotification_t)GetProcAddress(hNtdll, "LdrRegisterDllNotification") : NULL;
+
+    if (
+        !pLdrRegisterDllNotification
+        || !NT_SUCCESS(pLdrRegisterDllNotification(
+            /*Flags = */0,
+            DllNotificationCallback,
+            /*Context = */NULL,
+            &g_dllNotificationCookie
+        ))
+    ) {
+        //without the notification the caller module ranges are never forgotten, which matches the behaviour of the earlier per return address cache
+        Wh_Log(L"LdrRegisterDllNotification failed");
+        g_dllNotificationCookie = NULL;
+    }
+}
+
+void UnregisterDllNotification() {
+
+    if (!g_dllNotificationCookie)
+        return;
+
+    HMODULE hNtdll = GetModuleHandleW(L"ntdll.dll");
+    LdrUnregisterDllNotification_t pLdrUnregisterDllNotification = 
+        hNtdll ? (LdrUnregisterDllNotification_t)GetProcAddress(hNtdll, "LdrUnregisterDllNotification") : NULL;
+
+    if (pLdrUnregisterDllNotification)
+        pLdrUnregisterDllNotification(g_dllNotificationCookie);
+
+    g_dllNotificationCookie = NULL;
+}
+
+#pragma endregion Dll unload notifications
+
+
+
 #pragma region Hooks
 
 DWORD WINAPI GetSysColorHook(IN int nIndex) {
@@ -502,6 +630,8 @@ BOOL Wh_ModInit() {
     }
 
 
+    RegisterDllNotification();
+
     Wh_SetFunctionHookT(pGetSysColor, GetSysColorHook, &pOriginalGetSysColor);
     Wh_SetFunctionHookT(pGetSysColorBrush, GetSysColorBrushHook, &pOriginalGetSysColorBrush);
     Wh_SetFunctionHookT(pDeleteObject, DeleteObjectHook, &pOriginalDeleteObject);
@@ -589,6 +719,9 @@ void Wh_ModUninit() {
     } while (g_hookRefCount > 0);
 
 
+    UnregisterDllNotification();
+
+
     for (int i = 0; i <= MAX_COLOR_INDEX; i++) {
         pOriginalDeleteObject(g_preallocatedBrushes[i]);
         g_preallocatedBrushes[i] = NULL;
@@ -2,7 +2,7 @@
 // @id              desktop-icons-view
 // @name            Desktop icons view
 // @description     Change desktop icons view to list, details, small icons, or tiles
-// @version         1.0.2
+// @version         1.0.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -66,6 +66,10 @@ struct {
     int monitor;
 } settings;
 
+// The desktop list view, cached to avoid walking Progman -> SHELLDLL_DefView
+// -> SysListView32 every time the style is applied.
+HWND g_hFolderViewWnd;
+
 HWND FindChild(HWND parent, LPCWSTR cls, LPCWSTR win) {
     if (parent == nullptr) {
         return nullptr;
@@ -115,6 +119,13 @@ bool IsFolderViewWnd(HWND hWnd) {
 }
 
 HWND GetFolderViewWnd() {
+    if (g_hFolderViewWnd && IsWindow(g_hFolderViewWnd) &&
+        IsFolderViewWnd(g_hFolderViewWnd)) {
+        return g_hFolderViewWnd;
+    }
+
+    g_hFolderViewWnd = nullptr;
+
     HWND hFolderFolderViewWnd =
         FindChild(FindChild(GetShellWindow(), L"SHELLDLL_DefView", L""),
                   L"SysListView32", L"FolderView");
@@ -128,6 +139,7 @@ HWND GetFolderViewWnd() {
         return nullptr;
     }
 
+    g_hFolderViewWnd = hFolderFolderViewWnd;
     return hFolderFolderViewWnd;
 }
 
@@ -157,20 +169,32 @@ HMONITOR GetMonitorById(int monitorId) {
     return monitorResult;
 }
 
+// Only the parts which differ from the current state are changed, so that
+// re-applying the same settings doesn't make the desktop re-layout its icons.
 void SetDesktopStyle(HWND hFolderViewWnd, int view) {
     DWORD style = GetWindowLong(hFolderViewWnd, GWL_STYLE);
+    bool viewChanged =
+        SendMessage(hFolderViewWnd, LVM_GETVIEW, 0, 0) != (LRESULT)view;
     if (view == LV_VIEW_ICON) {
-        SendMessage(hFolderViewWnd, LVM_SETVIEW, LV_VIEW_ICON, 0);
+        if (viewChanged) {
+            SendMessage(hFolderViewWnd, LVM_SETVIEW, LV_VIEW_ICON, 0);
+        }
 
-        SetWindowLong(hFolderViewWnd, GWL_STYLE, style | LVS_NOSCROLL);
+        if (!(style & LVS_NOSCROLL)) {
+            SetWindowLong(hFolderViewWnd, GWL_STYLE, style | LVS_NOSCROLL);
+        }
     } else {
         // Setup the style (removing noscroll), otherwise list style doesn't
         // seem to work correctly (docs say noscroll is incompatible with list).
-        SetWindowLong(hFolderViewWnd, GWL_STYLE, style & ~LVS_NOSCROLL);
+        if (style & LVS_NOSCROLL) {
+            SetWindowLong(hFolderViewWnd, GWL_STYLE, style & ~LVS_NOSCROLL);
+        }
         // Switch view.
-        SendMessage(hFolderViewWnd, LVM_SETVIEW, view, 0);
-        SendMessage(hFolderViewWnd, LVM_SETEXTENDEDLISTVIEWSTYLE,
-                    LVS_EX_DOUBLEBUFFER, 0);
+        if (viewChanged) {
+            SendMessage(hFolderViewWnd, LVM_SETVIEW, view, 0);
+            SendMessage(hFolderViewWnd, LVM_SETEXTENDEDLISTVIEWSTYLE,
+                        LVS_EX_DOUBLEBUFFER, 0);
+        }
         // Set the column width.
         ListView_SetColumnWidth(hFolderViewWnd, 0, settings.colwidth);
     }
@@ -192,7 +216,14 @@ void SetDesktopStyle(HWND hFolderViewWnd, int view) {
         int y = rc.top;
         int cx = rc.right - rc.left;
         int cy = rc.bottom - rc.top;
-        SetWindowPos(hFolderViewWnd, nullptr, x, y, cx, cy, SWP_NOZORDER);
+
+        RECT rcCurrent{};
+        GetWindowRect(hFolderViewWnd, &rcCurrent);
+        MapWindowPoints(nullptr, GetAncestor(hFolderViewWnd, GA_PARENT),
+                        (POINT*)(&rcCurrent), sizeof(RECT) / sizeof(POINT));
+        if (!EqualRect(&rcCurrent, &rc)) {
+            SetWindowPos(hFolderViewWnd, nullptr, x, y, cx, cy, SWP_NOZORDER);
+        }
     }
     // Refresh.
     UpdateWindow(hFolderViewWnd);
@@ -220,6 +251,7 @@ HWND WINAPI CreateWindowExW_Hook(DWORD dwExStyle,
     }
 
     Wh_Log(L"FolderView window created: %08X", (DWORD)(ULONG_PTR)hWnd);
+    g_hFolderViewWnd = hWnd;
     // SetDesktopStyle(hWnd, settings.style);
 
     static UINT s_timer = 0;
@@ -290,6 +322,15 @@ void Wh_ModUninit() {
 
 BOOL Wh_ModSettingsChanged(BOOL* bReload) {
     Wh_Log(L"Settings changed");
-    *bReload = TRUE;
+
+    // Apply the new settings in place instead of reloading the mod, which
+    // would switch the desktop back to icon view first.
+    LoadSettings();
+
+    if (HWND hFolderFolderViewWnd = GetFolderViewWnd()) {
+        SetDesktopStyle(hFolderFolderViewWnd, settings.style);
+    }
+
+    *bReload = FALSE;
     return TRUE;
 }
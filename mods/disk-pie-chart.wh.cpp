@@ -2,7 +2,7 @@
 // @id              disk-pie-chart
 // @name            Disk Pie Chart
 // @description     Makes the graph in disk properties a pie chart again
-// @version         1.0.0
+// @version         1.0.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -36,6 +36,9 @@ changes it back to the classic pie chart.
 
 #include <windhawk_utils.h>
 
+#include <cmath>
+#include <mutex>
+
 #ifdef _WIN64
 #   define SSTDCALL L"__cdecl"
 #else
@@ -77,45 +80,6 @@ enum
     DP_TOTAL_COLORS     // # of entries
 };
 
-int IntSqrt(DWORD dwNum)
-{
-    // We will keep shifting dwNum left and look at the top two bits.
-
-    // initialize sqrt and remainder to 0.
-    DWORD dwSqrt = 0, dwRemain = 0, dwTry;
-    int i;
-
-    // We iterate 16 times, once for each pair of bits.
-    for (i=0; i<16; ++i)
-    {
-        // Mask off the top two bits of dwNum and rotate them into the
-        // bottom of the remainder
-        dwRemain = (dwRemain<<2) | (dwNum>>30);
-
-        // Now we shift the sqrt left; next we'll determine whether the
-        // new bit is a 1 or a 0.
-        dwSqrt <<= 1;
-
-        // This is where we double what we already have, and try a 1 in
-        // the lowest bit.
-        dwTry = (dwSqrt << 1) + 1;
-
-        if (dwRemain >= dwTry)
-        {
-            // The remainder was big enough, so subtract dwTry from
-            // the remainder and tack a 1 onto the sqrt.
-            dwRemain -= dwTry;
-            dwSqrt |= 0x01;
-        }
-
-        // Shift dwNum to the left by 2 so we can work on the next few
-        // bits.
-        dwNum <<= 2;
-    }
-
-    return(dwSqrt);
-}
-
 STDMETHODIMP Draw3dPie(HDC hdc, LPRECT lprc, DWORD dwPer1000, DWORD dwPerCache1000, const COLORREF *lpColors)
 {
     if (lprc == NULL || lpColors == NULL)
@@ -198,19 +162,24 @@ STDMETHODIMP Draw3dPie(HDC hdc, LPRECT lprc, DWORD dwPer1000, DWORD dwPerCache10
             uQPctX10 = -uQPctX10;
         }
 
+        // The original integer square roots overflow 32 bits with the larger
+        // pies of high DPI displays, so this is done in floating point.
+        double dRx2 = (double)rx * rx;
+        double dRy2 = (double)ry * ry;
+        double dQ2 = (double)uQPctX10 * uQPctX10;
+        double dRest2 = (double)(250 - uQPctX10) * (250 - uQPctX10);
+
         if (uQPctX10 < 120)
         {
-            x[iLoop] = IntSqrt(((DWORD)rx*(DWORD)rx*(DWORD)uQPctX10*(DWORD)uQPctX10)
-                /((DWORD)uQPctX10*(DWORD)uQPctX10+(250L-(DWORD)uQPctX10)*(250L-(DWORD)uQPctX10)));
+            x[iLoop] = (int)sqrt(dRx2 * dQ2 / (dQ2 + dRest2));
 
-            y[iLoop] = IntSqrt(((DWORD)rx*(DWORD)rx-(DWORD)x[iLoop]*(DWORD)x[iLoop])*(DWORD)ry*(DWORD)ry/((DWORD)rx*(DWORD)rx));
+            y[iLoop] = (int)sqrt((dRx2 - (double)x[iLoop] * x[iLoop]) * dRy2 / dRx2);
         }
         else
         {
-            y[iLoop] = IntSqrt((DWORD)ry*(DWORD)ry*(250L-(DWORD)uQPctX10)*(250L-(DWORD)uQPctX10)
-                /((DWORD)uQPctX10*(DWORD)uQPctX10+(250L-(DWORD)uQPctX10)*(250L-(DWORD)uQPctX10)));
+            y[iLoop] = (int)sqrt(dRy2 * dRest2 / (dQ2 + dRest2));
 
-            x[iLoop] = IntSqrt(((DWORD)ry*(DWORD)ry-(DWORD)y[iLoop]*(DWORD)y[iLoop])*(DWORD)rx*(DWORD)rx/((DWORD)ry*(DWORD)ry));
+            x[iLoop] = (int)sqrt((dRy2 - (double)y[iLoop] * y[iLoop]) * dRx2 / dRy2);
         }
 
         // Switch on the actual quadrant
@@ -348,6 +317,128 @@ STDMETHODIMP Draw3dPie(HDC hdc, LPRECT lprc, DWORD dwPer1000, DWORD dwPerCache10
     return S_OK;    // Everything worked fine
 }
 
+// The last rendered classic pie, so that repaints (e.g. while the dialog is dragged)
+// are a masked blit instead of redrawing all the regions and arcs.
+struct {
+    std::mutex mutex;
+    HBITMAP hbmColor;   // The pie, black where transparent
+    HBITMAP hbmMask;    // White where transparent
+    LONG cx;
+    LONG cy;
+    DWORD dwPer1000;
+    DWORD dwPerCache1000;
+    COLORREF crFrame;
+} g_pieCache;
+
+void FreePieCache(void)
+{
+    if (g_pieCache.hbmColor)
+    {
+        DeleteObject(g_pieCache.hbmColor);
+        g_pieCache.hbmColor = NULL;
+    }
+
+    if (g_pieCache.hbmMask)
+    {
+        DeleteObject(g_pieCache.hbmMask);
+        g_pieCache.hbmMask = NULL;
+    }
+}
+
+bool RenderPieCache(HDC hdc, LONG cx, LONG cy, DWORD dwPer1000, DWORD dwPerCache1000, COLORREF crFrame)
+{
+    FreePieCache();
+
+    HDC hdcColor = CreateCompatibleDC(hdc);
+    HDC hdcMask = CreateCompatibleDC(hdc);
+    HBITMAP hbmColor = CreateCompatibleBitmap(hdc, cx, cy);
+    HBITMAP hbmMask = CreateBitmap(cx, cy, 1, 1, NULL);
+    if (!hdcColor || !hdcMask || !hbmColor || !hbmMask)
+    {
+        if (hdcColor) DeleteDC(hdcColor);
+        if (hdcMask) DeleteDC(hdcMask);
+        if (hbmColor) DeleteObject(hbmColor);
+        if (hbmMask) DeleteObject(hbmMask);
+        return false;
+    }
+
+    HGDIOBJ hOldColor = SelectObject(hdcColor, hbmColor);
+    HGDIOBJ hOldMask = SelectObject(hdcMask, hbmMask);
+
+    // Render over a key color which is used by neither the pie nor its outline.
+    COLORREF crKey = crFrame == RGB(1, 2, 3) ? RGB(3, 2, 1) : RGB(1, 2, 3);
+    RECT rc = { 0, 0, cx, cy };
+    HBRUSH hbrKey = CreateSolidBrush(crKey);
+    FillRect(hdcColor, &rc, hbrKey);
+    DeleteObject(hbrKey);
+
+    Draw3dPie(hdcColor, &rc, dwPer1000, dwPerCache1000, c_crPieColors);
+
+    // The key color becomes white in the mask, then black in the pie bitmap.
+    SetBkColor(hdcColor, crKey);
+    BitBlt(hdcMask, 0, 0, cx, cy, hdcColor, 0, 0, SRCCOPY);
+    SetBkColor(hdcColor, RGB(0, 0, 0));
+    SetTextColor(hdcColor, RGB(255, 255, 255));
+    BitBlt(hdcColor, 0, 0, cx, cy, hdcMask, 0, 0, SRCAND);
+
+    SelectObject(hdcColor, hOldColor);
+    SelectObject(hdcMask, hOldMask);
+    DeleteDC(hdcColor);
+    DeleteDC(hdcMask);
+
+    g_pieCache.hbmColor = hbmColor;
+    g_pieCache.hbmMask = hbmMask;
+    g_pieCache.cx = cx;
+    g_pieCache.cy = cy;
+    g_pieCache.dwPer1000 = dwPer1000;
+    g_pieCache.dwPerCache1000 = dwPerCache1000;
+    g_pieCache.crFrame = crFrame;
+    return true;
+}
+
+void DrawCached3dPie(HDC hdc, LPRECT lprc, DWORD dwPer1000, DWORD dwPerCache1000)
+{
+    LONG cx = lprc->right - lprc->left;
+    LONG cy = lprc->bottom - lprc->top;
+    COLORREF crFrame = GetSysColor(COLOR_WINDOWFRAME);
+
+    std::lock_guard<std::mutex> lock(g_pieCache.mutex);
+
+    bool cached = g_pieCache.hbmColor &&
+        g_pieCache.cx == cx &&
+        g_pieCache.cy == cy &&
+        g_pieCache.dwPer1000 == dwPer1000 &&
+        g_pieCache.dwPerCache1000 == dwPerCache1000 &&
+        g_pieCache.crFrame == crFrame;
+
+    if (!cached && (cx <= 0 || cy <= 0 || !RenderPieCache(hdc, cx, cy, dwPer1000, dwPerCache1000, crFrame)))
+    {
+        Draw3dPie(hdc, lprc, dwPer1000, dwPerCache1000, c_crPieColors);
+        return;
+    }
+
+    HDC hdcMem = CreateCompatibleDC(hdc);
+    if (!hdcMem)
+    {
+        Draw3dPie(hdc, lprc, dwPer1000, dwPerCache1000, c_crPieColors);
+        return;
+    }
+
+    // Keep the background where the mask is white, then paint the pie in.
+    COLORREF crOldBk = SetBkColor(hdc, RGB(255, 255, 255));
+    COLORREF crOldText = SetTextColor(hdc, RGB(0, 0, 0));
+
+    HGDIOBJ hOld = SelectObject(hdcMem, g_pieCache.hbmMask);
+    BitBlt(hdc, lprc->left, lprc->top, cx, cy, hdcMem, 0, 0, SRCAND);
+    SelectObject(hdcMem, g_pieCache.hbmColor);
+    BitBlt(hdc, lprc->left, lprc->top, cx, cy, hdcMem, 0, 0, SRCPAINT);
+    SelectObject(hdcMem, hOld);
+    DeleteDC(hdcMem);
+
+    SetBkColor(hdc, crOldBk);
+    SetTextColor(hdc, crOldText);
+}
+
 /* Color indicators */
 void (__fastcall *_DrvPrshtDrawItem_orig)(void *, LPDRAWITEMSTRUCT);
 void __fastcall _DrvPrshtDrawItem_hook(
@@ -477,7 +568,7 @@ int __fastcall DrawPie_hook(
 
                 if (settings.classic)
                 {
-                    Draw3dPie(hDDC, &rc, dwPer1000, dwPerCache1000, c_crPieColors);
+                    DrawCached3dPie(hDDC, &rc, dwPer1000, dwPerCache1000);
                 }
                 else
                 {
@@ -577,6 +668,12 @@ BOOL Wh_ModInit(void)
     return TRUE;
 }
 
+void Wh_ModUninit(void)
+{
+    std::lock_guard<std::mutex> lock(g_pieCache.mutex);
+    FreePieCache();
+}
+
 void Wh_ModSettingsChanged(void)
 {
     LoadSettings();
@@ -2,7 +2,7 @@
 // @id              dwm-ghost-mods
 // @name            DWM Ghost Mods
 // @description     Allows you to use basic or classic theme with your DWM ghost windows and more!
-// @version         1.2
+// @version         1.2.1
 // @author          ephemeralViolette
 // @github          https://github.com/ephemeralViolette
 // @include         dwm.exe
@@ -133,6 +133,13 @@ FrostPolicyType  g_prefFrostPolicy;
 #include <dwmapi.h>
 #include <uxtheme.h>
 
+#include <atomic>
+#include <mutex>
+
+// Incremented whenever the theme, the DPI or the settings change, which invalidates the cached
+// non-client metrics and the themes applied to the ghost windows.
+std::atomic<LONG> g_themeGeneration = 1;
+
 //==============================================================================================================================
 // Main implementation:
 //
@@ -158,9 +165,34 @@ typedef struct
 } NCWindowSizes;
 
 /*
- * GetNCWindowSizes: Get the dimensions of the non-client area as rendered on non-DWM windows.
+ * GetSystemDpi: Get the DPI which AdjustWindowRectEx uses in DWM.
  */
-HRESULT GetNCWindowSizes(NCWindowSizes *out)
+UINT GetSystemDpi()
+{
+    using GetDpiForSystem_t = UINT (WINAPI *)();
+    static GetDpiForSystem_t pGetDpiForSystem = (GetDpiForSystem_t)GetProcAddress(
+        GetModuleHandleW(L"user32.dll"), "GetDpiForSystem");
+
+    if (pGetDpiForSystem)
+    {
+        return pGetDpiForSystem();
+    }
+
+    // Windows 8.1 and early Windows 10 builds
+    HDC hdc = GetDC(NULL);
+    UINT dpi = hdc ? GetDeviceCaps(hdc, LOGPIXELSY) : USER_DEFAULT_SCREEN_DPI;
+    if (hdc)
+    {
+        ReleaseDC(NULL, hdc);
+    }
+
+    return dpi;
+}
+
+/*
+ * CalculateNCWindowSizes: Get the dimensions of the non-client area as rendered on non-DWM windows.
+ */
+HRESULT CalculateNCWindowSizes(NCWindowSizes *out)
 {
     RECT base;
     base.left = 0;
@@ -179,18 +211,59 @@ HRESULT GetNCWindowSizes(NCWindowSizes *out)
     return S_OK;
 }
 
+/*
+ * GetNCWindowSizes: Get the non-client dimensions, calculated only once per DPI and theme.
+ */
+HRESULT GetNCWindowSizes(NCWindowSizes *out)
+{
+    static std::mutex cacheMutex;
+    static LONG cachedGeneration = 0;
+    static UINT cachedDpi = 0;
+    static NCWindowSizes cachedSizes;
+
+    LONG generation = g_themeGeneration;
+    UINT dpi = GetSystemDpi();
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    if (cachedGeneration != generation || cachedDpi != dpi)
+    {
+        HRESULT hr = CalculateNCWindowSizes(&cachedSizes);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        cachedGeneration = generation;
+        cachedDpi = dpi;
+    }
+
+    *out = cachedSizes;
+    return S_OK;
+}
+
+// Window property holding the theme generation that was last applied to a ghost window.
+#define APPLIED_THEME_GENERATION_PROP L"Windhawk_DwmGhostMods_ThemeGeneration"
+
 /*
  * ApplyDesiredWindowTheme: Apply basic frames or the classic theme to a specified DWM child window. 
+ *                          Nothing is done if it's already applied for the current theme generation.
  */
 void ApplyDesiredWindowTheme(HWND hWnd)
 {
-    if (g_prefUseClassicTheme)
+    DWORD themeAppProperties = g_prefUseClassicTheme
+        ? STAP_ALLOW_CONTROLS | STAP_ALLOW_WEBCONTENT
+        : STAP_ALLOW_NONCLIENT | STAP_ALLOW_CONTROLS | STAP_ALLOW_WEBCONTENT;
+
+    if (GetThemeAppProperties() != themeAppProperties)
     {
-        SetThemeAppProperties(STAP_ALLOW_CONTROLS | STAP_ALLOW_WEBCONTENT);
+        SetThemeAppProperties(themeAppProperties);
     }
-    else
+
+    LONG generation = g_themeGeneration;
+    if ((LONG)(LONG_PTR)GetPropW(hWnd, APPLIED_THEME_GENERATION_PROP) == generation)
     {
-        SetThemeAppProperties(STAP_ALLOW_NONCLIENT | STAP_ALLOW_CONTROLS | STAP_ALLOW_WEBCONTENT);
+        return;
     }
 
     if (g_prefDisableDwmFrames)
@@ -198,6 +271,27 @@ void ApplyDesiredWindowTheme(HWND hWnd)
         DWMNCRENDERINGPOLICY policy = DWMNCRP_DISABLED;
         DwmSetWindowAttribute(hWnd, DWMWA_NCRENDERING_POLICY, &policy, sizeof(BOOL));
     }
+
+    SetPropW(hWnd, APPLIED_THEME_GENERATION_PROP, (HANDLE)(LONG_PTR)generation);
+}
+
+/*
+ * IsThemeOrDpiChangeMessage: Whether a window message can change the window theme or the
+ *                            non-client metrics.
+ */
+bool IsThemeOrDpiChangeMessage(UINT uMsg)
+{
+    switch (uMsg)
+    {
+        case WM_THEMECHANGED:
+        case WM_SETTINGCHANGE:
+        case WM_DPICHANGED:
+        case WM_DISPLAYCHANGE:
+        case WM_DWMCOMPOSITIONCHANGED:
+            return true;
+    }
+
+    return false;
 }
 
 typedef HWND (*CGhostWindow__CreateGhostWindow_t)(void *);
@@ -215,8 +309,19 @@ typedef __int64 (*CGhostWindow__s_GhostWndProc_t)(HWND, int, __int64, __int64);
 CGhostWindow__s_GhostWndProc_t CGhostWindow__s_GhostWndProc_orig;
 __int64 CGhostWindow__s_GhostWndProc_hook(HWND hWnd, int a, __int64 b, __int64 c)
 {
+    if (IsThemeOrDpiChangeMessage((UINT)a))
+    {
+        g_themeGeneration++;
+    }
+
     __int64 result = CGhostWindow__s_GhostWndProc_orig(hWnd, a, b, c);
 
+    if ((UINT)a == WM_NCDESTROY)
+    {
+        RemovePropW(hWnd, APPLIED_THEME_GENERATION_PROP);
+        return result;
+    }
+
     ApplyDesiredWindowTheme(hWnd);
 
     return result;
@@ -404,4 +509,5 @@ void Wh_ModSettingsChanged()
 {
     Wh_Log(L"SettingsChanged");
     LoadSettings();
+    g_themeGeneration++;
 }
@@ -2,7 +2,7 @@
 // @id              explorer-context-menu-classic
 // @name            Classic context menu on Windows 11
 // @description     Always show the classic context menu without having to select "Show More Options" or hold Shift
-// @version         1.0.2
+// @version         1.0.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -131,11 +131,6 @@ BOOL Wh_ModInit() {
 
     LoadSettings();
 
-    if (!HookExplorerFrameSymbols()) {
-        Wh_Log(L"Error hooking explorer frame symbols");
-        return FALSE;
-    }
-
     HMODULE shcoreModule = LoadLibrary(L"shcore.dll");
     if (!shcoreModule) {
         Wh_Log(L"Error loading shcore.dll");
@@ -157,6 +152,21 @@ BOOL Wh_ModInit() {
     return TRUE;
 }
 
+void Wh_ModAfterInit() {
+    Wh_Log(L">");
+
+    // The main menu hook above uses an export and is applied right away.
+    // Resolving the explorerframe.dll symbols might require downloading
+    // symbols after a Windows update, so it's done here, without holding back
+    // the rest of the mod.
+    if (!HookExplorerFrameSymbols()) {
+        Wh_Log(L"Error hooking explorer frame symbols");
+        return;
+    }
+
+    Wh_ApplyHookOperations();
+}
+
 void Wh_ModUninit() {
     Wh_Log(L">");
 }
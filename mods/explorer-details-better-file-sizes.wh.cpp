@@ -2,7 +2,7 @@
 // @id              explorer-details-better-file-sizes
 // @name            Better file sizes in Explorer details
 // @description     Optional improvements: show folder sizes, use MB/GB for large files (by default, all sizes are shown in KBs), use IEC terms (such as KiB instead of KB)
-// @version         1.4.11
+// @version         1.4.16
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -75,7 +75,8 @@ To show folder sizes via "Everything" integration:
 If you prefer to avoid installing "Everything", you can enable folder sizes and
 have them calculated manually. Since calculating folder sizes can be slow, it's
 not enabled by default, and there's an option to enable it only while holding
-the Shift key.
+the Shift key. When always enabled, sizes are calculated in the background and
+filled in as they become available, so the folder stays responsive.
 
 ## Mix files and folders when sorting by size
 
@@ -119,6 +120,12 @@ KiB?](https://devblogs.microsoft.com/oldnewthing/20090611-00/?p=17933).
   - everything: Enabled via "Everything" integration
   - always: Enabled, calculated manually (can be slow)
   - withShiftKey: Enabled, calculated manually while holding the Shift key
+- folderSizeCacheMemoryLimit: 16
+  $name: Folder size cache memory limit (MB)
+  $description: >-
+    When folder sizes are calculated manually, calculated sizes are remembered
+    and updated when files change, so that reopening or sorting a folder
+    doesn't calculate the sizes again. Set to 0 to disable the cache
 - sortSizesMixFolders: true
   $name: Mix files and folders when sorting by size
   $description: >-
@@ -136,12 +143,18 @@ KiB?](https://devblogs.microsoft.com/oldnewthing/20090611-00/?p=17933).
 
 #include <windhawk_utils.h>
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 using namespace std::string_view_literals;
@@ -153,6 +166,7 @@ using namespace std::string_view_literals;
 #include <shlobj.h>
 #include <shobjidl.h>
 #include <shtypes.h>
+#include <winternl.h>
 #include <winrt/base.h>
 
 enum class CalculateFolderSizes {
@@ -167,6 +181,7 @@ struct {
     bool sortSizesMixFolders;
     bool disableKbOnlySizes;
     bool useIecTerms;
+    int folderSizeCacheMemoryLimit;
 } g_settings;
 
 bool g_isEverything;
@@ -1261,6 +1276,89 @@ std::wstring ResolvePath(PCWSTR path) {
 
 DWORD WINAPI Everything4Wh_Thread(void* parameter);
 
+// Connected Everything IPC clients which aren't in use. Clients are kept
+// between queries to avoid connecting to the pipe for every folder, and a few
+// of them are kept to allow querying from several threads at once.
+constexpr size_t kEverythingClientPoolMaxSize = 4;
+std::mutex g_everythingClientPoolMutex;
+std::vector<EVERYTHING3_CLIENT*> g_everythingClientPool;
+
+EVERYTHING3_CLIENT* EverythingClientConnect() {
+    EVERYTHING3_CLIENT* pClient = Everything3_ConnectW(nullptr);
+    if (pClient) {
+        Wh_Log(L"Connected to Everything IPC (unnamed instance)");
+        return pClient;
+    }
+
+    pClient = Everything3_ConnectW(L"1.5a");
+    if (pClient) {
+        Wh_Log(L"Connected to Everything IPC (v1.5a)");
+        return pClient;
+    }
+
+    return nullptr;
+}
+
+EVERYTHING3_CLIENT* EverythingClientAcquire() {
+    {
+        std::lock_guard<std::mutex> guard(g_everythingClientPoolMutex);
+        if (!g_everythingClientPool.empty()) {
+            EVERYTHING3_CLIENT* pClient = g_everythingClientPool.back();
+            g_everythingClientPool.pop_back();
+            return pClient;
+        }
+    }
+
+    return EverythingClientConnect();
+}
+
+void EverythingClientRelease(EVERYTHING3_CLIENT* pClient) {
+    {
+        std::lock_guard<std::mutex> guard(g_everythingClientPoolMutex);
+        if (g_everythingClientPool.size() < kEverythingClientPoolMaxSize) {
+            g_everythingClientPool.push_back(pClient);
+            return;
+        }
+    }
+
+    Everything3_DestroyClient(pClient);
+}
+
+void EverythingClientPoolClear() {
+    std::lock_guard<std::mutex> guard(g_everythingClientPoolMutex);
+    for (EVERYTHING3_CLIENT* pClient : g_everythingClientPool) {
+        Everything3_DestroyClient(pClient);
+    }
+
+    g_everythingClientPool.clear();
+}
+
+// Returns false if the connection is broken, e.g. if Everything was restarted
+// since the client connected. Other errors, such as a folder which isn't
+// indexed or a bad request, are reported with a size of -1 and keep the
+// connection.
+bool EverythingClientGetFolderSize(EVERYTHING3_CLIENT* pClient,
+                                   PCWSTR folderPath,
+                                   int64_t* size) {
+    SetLastError(EVERYTHING3_OK);
+    *size = Everything3_GetFolderSizeFromFilenameW(pClient, folderPath);
+    if (*size != -1) {
+        return true;
+    }
+
+    switch (GetLastError()) {
+        case EVERYTHING3_ERROR_DISCONNECTED:
+        case EVERYTHING3_ERROR_SHUTDOWN:
+        case EVERYTHING3_ERROR_IPC_PIPE_NOT_FOUND:
+        case ERROR_BROKEN_PIPE:
+        case ERROR_PIPE_NOT_CONNECTED:
+        case ERROR_NO_DATA:
+            return false;
+    }
+
+    return true;
+}
+
 unsigned Everything4Wh_GetFileSize(PCWSTR folderPath, int64_t* size) {
     *size = 0;
 
@@ -1269,19 +1367,24 @@ unsigned Everything4Wh_GetFileSize(PCWSTR folderPath, int64_t* size) {
         return ES_QUERY_NO_ES_IPC;
     }
 
-    EVERYTHING3_CLIENT* pClient = Everything3_ConnectW(nullptr);
-    if (pClient) {
-        Wh_Log(L"Connected to Everything IPC (unnamed instance)");
-    } else {
-        pClient = Everything3_ConnectW(L"1.5a");
-        if (pClient) {
-            Wh_Log(L"Connected to Everything IPC (v1.5a)");
+    EVERYTHING3_CLIENT* pClient = EverythingClientAcquire();
+    if (pClient && !EverythingClientGetFolderSize(pClient, folderPath, size)) {
+        // The connection is broken, and other pooled clients were likely
+        // connected to the same instance. Reconnect and retry once.
+        Wh_Log(L"Everything IPC query failed, reconnecting");
+        Everything3_DestroyClient(pClient);
+        EverythingClientPoolClear();
+
+        pClient = EverythingClientConnect();
+        if (pClient &&
+            !EverythingClientGetFolderSize(pClient, folderPath, size)) {
+            Everything3_DestroyClient(pClient);
+            pClient = nullptr;
         }
     }
 
     if (pClient) {
-        *size = Everything3_GetFolderSizeFromFilenameW(pClient, folderPath);
-        Everything3_DestroyClient(pClient);
+        EverythingClientRelease(pClient);
 
         if (*size == -1) {
             return ES_QUERY_NO_INDEX;
@@ -1526,6 +1629,21 @@ std::vector<BYTE> PIDLToVector(const ITEMIDLIST* pidl) {
     return std::vector<BYTE>(ptr, ptr + size);
 }
 
+// Identifies a folder by its absolute ID list rather than by the object
+// pointer, which can be reused after the object is freed, and which differs
+// between two views of the same folder.
+std::vector<BYTE> GetShellFolderIDListKey(IShellFolder2* shellFolder) {
+    LPITEMIDLIST pidl;
+    HRESULT hr = SHGetIDListFromObject(shellFolder, &pidl);
+    if (FAILED(hr)) {
+        return {};
+    }
+
+    auto key = PIDLToVector(pidl);
+    CoTaskMemFree(pidl);
+    return key;
+}
+
 thread_local winrt::com_ptr<IShellFolder2> g_cacheShellFolder;
 thread_local std::map<std::vector<BYTE>, std::optional<ULONGLONG>>
     g_cacheShellFolderSizes;
@@ -1614,7 +1732,8 @@ class SizeCalculator : public INamespaceWalkCB2 {
     ULONGLONG m_totalSize;
 };
 
-std::optional<ULONGLONG> CalculateFolderSize(IShellFolder2* shellFolder) {
+std::optional<ULONGLONG> CalculateFolderSizeWithNamespaceWalk(
+    IShellFolder2* shellFolder) {
     // Create the namespace walker.
     winrt::com_ptr<INamespaceWalk> namespaceWalk;
     HRESULT hr = CoCreateInstance(CLSID_NamespaceWalker, nullptr, CLSCTX_INPROC,
@@ -1676,6 +1795,1137 @@ std::wstring GetFolderPathFromIShellFolder(IShellFolder2* shellFolder) {
     return path;
 }
 
+// Calculated folder sizes, shared by all threads and kept between views of the
+// folder. Entries are evicted in least recently used order when the estimated
+// memory usage exceeds the limit, and are invalidated by shell change
+// notifications.
+class FolderSizeCache {
+   public:
+    // Change notifications aren't reliable for network folders, so their
+    // sizes are only cached for a short while.
+    static constexpr DWORD kUncPathMaxAgeMs = 60 * 1000;
+
+    void SetMemoryLimit(size_t memoryLimit) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_memoryLimit = memoryLimit;
+        EvictIfNeeded();
+    }
+
+    bool IsEnabled() {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_memoryLimit > 0;
+    }
+
+    // A result calculated before an invalidation of the folder, one of its
+    // subfolders or one of its parent folders' subtrees is discarded, since it
+    // might be outdated. The value returned here must be passed to `Set`.
+    DWORD64 GetGeneration() {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        return m_generation;
+    }
+
+    std::optional<ULONGLONG> Get(std::wstring_view path) {
+        std::wstring key = MakeKey(path);
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            return std::nullopt;
+        }
+
+        if (IsUncPath(key.c_str()) &&
+            GetTickCount() - it->second.timestamp > kUncPathMaxAgeMs) {
+            Erase(it);
+            return std::nullopt;
+        }
+
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lruIt);
+        return it->second.size;
+    }
+
+    void Set(std::wstring_view path, ULONGLONG size, DWORD64 generation) {
+        std::wstring key = MakeKey(path);
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        if (m_memoryLimit == 0 || IsInvalidatedSince(key, generation)) {
+            return;
+        }
+
+        auto [it, inserted] = m_entries.try_emplace(std::move(key));
+        if (inserted) {
+            m_lru.push_front(&it->first);
+            it->second.lruIt = m_lru.begin();
+            m_memoryUsage += EntryMemoryUsage(it->first);
+        } else {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lruIt);
+        }
+
+        it->second.size = size;
+        it->second.timestamp = GetTickCount();
+
+        EvictIfNeeded();
+    }
+
+    // Invalidates the folder and its parent folders, whose sizes include it.
+    // If `subtree` is set, its subfolders are invalidated as well.
+    void Invalidate(std::wstring_view path, bool subtree) {
+        std::wstring key = MakeKey(path);
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        m_generation++;
+
+        if (m_invalidations.size() == kMaxInvalidations) {
+            m_trimmedGeneration = m_invalidations.front().generation;
+            m_invalidations.pop_front();
+        }
+
+        m_invalidations.push_back({m_generation, key, subtree});
+
+        if (subtree) {
+            std::wstring prefix = key + L'\\';
+            auto it = m_entries.lower_bound(prefix);
+            while (it != m_entries.end() && it->first.starts_with(prefix)) {
+                it = Erase(it);
+            }
+        }
+
+        while (true) {
+            auto it = m_entries.find(key);
+            if (it != m_entries.end()) {
+                Erase(it);
+            }
+
+            size_t pos = key.rfind(L'\\');
+            if (pos == key.npos) {
+                break;
+            }
+
+            key.resize(pos);
+        }
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_generation++;
+        m_clearGeneration = m_generation;
+        m_invalidations.clear();
+        m_entries.clear();
+        m_lru.clear();
+        m_memoryUsage = 0;
+    }
+
+   private:
+    struct Entry {
+        ULONGLONG size;
+        DWORD timestamp;
+        std::list<const std::wstring*>::iterator lruIt;
+    };
+
+    using EntryMap = std::map<std::wstring, Entry>;
+
+    struct Invalidation {
+        DWORD64 generation;
+        std::wstring key;
+        bool subtree;
+    };
+
+    // Enough for a burst of change notifications during a calculation. If
+    // more are received, older calculations are discarded as a whole.
+    static constexpr size_t kMaxInvalidations = 256;
+
+    static bool IsSameOrParentFolder(const std::wstring& parent,
+                                     const std::wstring& key) {
+        return key.starts_with(parent) &&
+               (key.size() == parent.size() || key[parent.size()] == L'\\');
+    }
+
+    bool IsInvalidatedSince(const std::wstring& key, DWORD64 generation) {
+        if (generation == m_generation) {
+            return false;
+        }
+
+        if (generation < m_clearGeneration ||
+            generation < m_trimmedGeneration) {
+            return true;
+        }
+
+        for (auto it = m_invalidations.rbegin();
+             it != m_invalidations.rend() && it->generation > generation;
+             ++it) {
+            // The size of a folder includes the sizes of all of its
+            // subfolders.
+            if (IsSameOrParentFolder(key, it->key) ||
+                (it->subtree && IsSameOrParentFolder(it->key, key))) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static std::wstring MakeKey(std::wstring_view path) {
+        while (path.size() > 1 && path.back() == L'\\') {
+            path.remove_suffix(1);
+        }
+
+        std::wstring key(path);
+        CharLowerBuff(key.data(), static_cast<DWORD>(key.size()));
+        return key;
+    }
+
+    static size_t EntryMemoryUsage(const std::wstring& key) {
+        // The map and list nodes, and the key's buffer.
+        constexpr size_t kNodesSize = sizeof(EntryMap::value_type) +
+                                      sizeof(void*) * 4 +
+                                      sizeof(const std::wstring*) +
+                                      sizeof(void*) * 2;
+        return kNodesSize + (key.capacity() + 1) * sizeof(WCHAR);
+    }
+
+    EntryMap::iterator Erase(EntryMap::iterator it) {
+        m_memoryUsage -= EntryMemoryUsage(it->first);
+        m_lru.erase(it->second.lruIt);
+        return m_entries.erase(it);
+    }
+
+    void EvictIfNeeded() {
+        while (m_memoryUsage > m_memoryLimit && !m_lru.empty()) {
+            Erase(m_entries.find(*m_lru.back()));
+        }
+    }
+
+    std::mutex m_mutex;
+    EntryMap m_entries;
+    std::list<const std::wstring*> m_lru;
+    size_t m_memoryUsage = 0;
+    size_t m_memoryLimit = 0;
+    DWORD64 m_generation = 0;
+    DWORD64 m_clearGeneration = 0;
+    DWORD64 m_trimmedGeneration = 0;
+    std::deque<Invalidation> m_invalidations;
+};
+
+FolderSizeCache g_folderSizeCache;
+
+std::atomic<HANDLE> g_folderSizeCacheWatcherThread;
+std::mutex g_folderSizeCacheWatcherThreadMutex;
+HANDLE g_folderSizeCacheWatcherThreadReadyEvent;
+
+constexpr UINT kFolderSizeCacheChangeNotifyMessage = WM_APP + 1;
+
+std::wstring GetPathFromIDList(PCIDLIST_ABSOLUTE pidl) {
+    WCHAR path[MAX_PATH];
+    if (!pidl || !SHGetPathFromIDList(pidl, path)) {
+        return {};
+    }
+
+    return path;
+}
+
+// Paths for which the mod sent an update notification to refresh the size
+// column after calculating the size in the background. These notifications
+// aren't changes, and must not invalidate the cache.
+struct FolderSizeRefreshNotification {
+    std::wstring path;
+    DWORD timestamp;
+};
+
+std::mutex g_folderSizeRefreshNotificationsMutex;
+std::list<FolderSizeRefreshNotification> g_folderSizeRefreshNotifications;
+
+// Notifications which weren't received in time, e.g. because they were merged
+// with others, are dropped.
+constexpr DWORD kFolderSizeRefreshNotificationMaxAgeMs = 10 * 1000;
+
+void FolderSizeRefreshNotificationAdd(const std::wstring& path) {
+    std::lock_guard<std::mutex> guard(g_folderSizeRefreshNotificationsMutex);
+
+    DWORD now = GetTickCount();
+    while (!g_folderSizeRefreshNotifications.empty() &&
+           now - g_folderSizeRefreshNotifications.front().timestamp >
+               kFolderSizeRefreshNotificationMaxAgeMs) {
+        g_folderSizeRefreshNotifications.pop_front();
+    }
+
+    g_folderSizeRefreshNotifications.push_back({path, now});
+}
+
+bool FolderSizeRefreshNotificationConsume(std::wstring_view path) {
+    std::lock_guard<std::mutex> guard(g_folderSizeRefreshNotificationsMutex);
+
+    DWORD now = GetTickCount();
+    for (auto it = g_folderSizeRefreshNotifications.begin();
+         it != g_folderSizeRefreshNotifications.end();) {
+        if (now - it->timestamp > kFolderSizeRefreshNotificationMaxAgeMs) {
+            it = g_folderSizeRefreshNotifications.erase(it);
+            continue;
+        }
+
+        if (CompareStringOrdinal(it->path.data(),
+                                 static_cast<int>(it->path.size()),
+                                 path.data(), static_cast<int>(path.size()),
+                                 TRUE) == CSTR_EQUAL) {
+            g_folderSizeRefreshNotifications.erase(it);
+            return true;
+        }
+
+        ++it;
+    }
+
+    return false;
+}
+
+LRESULT CALLBACK FolderSizeCacheWatcherWndProc(HWND hWnd,
+                                               UINT uMsg,
+                                               WPARAM wParam,
+                                               LPARAM lParam) {
+    if (uMsg != kFolderSizeCacheChangeNotifyMessage) {
+        return DefWindowProc(hWnd, uMsg, wParam, lParam);
+    }
+
+    PIDLIST_ABSOLUTE* pidls;
+    LONG event;
+    HANDLE hLock = SHChangeNotification_Lock(
+        (HANDLE)wParam, (DWORD)lParam, &pidls, &event);
+    if (!hLock) {
+        return 0;
+    }
+
+    // Removing, renaming or refreshing a folder affects all the folders
+    // below it.
+    bool subtree = event & (SHCNE_RMDIR | SHCNE_RENAMEFOLDER | SHCNE_UPDATEDIR |
+                            SHCNE_DRIVEREMOVED | SHCNE_MEDIAREMOVED);
+
+    for (int i = 0; i < 2; i++) {
+        std::wstring path = GetPathFromIDList(pidls[i]);
+        if (path.empty()) {
+            continue;
+        }
+
+        if (event == SHCNE_UPDATEITEM &&
+            FolderSizeRefreshNotificationConsume(path)) {
+            continue;
+        }
+
+        g_folderSizeCache.Invalidate(path, subtree);
+    }
+
+    SHChangeNotification_Unlock(hLock);
+    return 0;
+}
+
+DWORD WINAPI FolderSizeCacheWatcherThread(void* parameter) {
+    constexpr WCHAR kClassName[] =
+        L"WindhawkFolderSizeCacheWatcher_" WH_MOD_ID;
+
+    WNDCLASSEXW wc = {
+        .cbSize = sizeof(WNDCLASSEXW),
+        .lpfnWndProc = FolderSizeCacheWatcherWndProc,
+        .hInstance = GetCurrentModuleHandle(),
+        .lpszClassName = kClassName,
+    };
+
+    if (!RegisterClassEx(&wc)) {
+        Wh_Log(L"RegisterClassEx failed");
+        SetEvent(g_folderSizeCacheWatcherThreadReadyEvent);
+        return 1;
+    }
+
+    HWND hWnd = CreateWindowEx(0, wc.lpszClassName, nullptr, 0, 0, 0, 0, 0,
+                               HWND_MESSAGE, nullptr, wc.hInstance, nullptr);
+    if (!hWnd) {
+        Wh_Log(L"CreateWindowEx failed");
+        UnregisterClass(wc.lpszClassName, wc.hInstance);
+        SetEvent(g_folderSizeCacheWatcherThreadReadyEvent);
+        return 1;
+    }
+
+    // The empty ID list is the desktop, the root of the namespace.
+    ITEMIDLIST desktopIdList = {};
+    SHChangeNotifyEntry entry = {
+        .pidl = &desktopIdList,
+        .fRecursive = TRUE,
+    };
+
+    ULONG registrationId = SHChangeNotifyRegister(
+        hWnd,
+        SHCNRF_InterruptLevel | SHCNRF_ShellLevel | SHCNRF_NewDelivery,
+        SHCNE_CREATE | SHCNE_DELETE | SHCNE_MKDIR | SHCNE_RMDIR |
+            SHCNE_RENAMEITEM | SHCNE_RENAMEFOLDER | SHCNE_UPDATEITEM |
+            SHCNE_UPDATEDIR | SHCNE_DRIVEREMOVED | SHCNE_MEDIAREMOVED,
+        kFolderSizeCacheChangeNotifyMessage, 1, &entry);
+    if (!registrationId) {
+        // Without notifications, cached sizes can't be trusted.
+        Wh_Log(L"SHChangeNotifyRegister failed");
+        g_folderSizeCache.SetMemoryLimit(0);
+    }
+
+    SetEvent(g_folderSizeCacheWatcherThreadReadyEvent);
+
+    BOOL bRet;
+    MSG msg;
+    while ((bRet = GetMessage(&msg, nullptr, 0, 0)) != 0) {
+        if (bRet == -1) {
+            msg.wParam = 0;
+            break;
+        }
+
+        if (msg.hwnd == nullptr && msg.message == WM_APP) {
+            if (registrationId) {
+                SHChangeNotifyDeregister(registrationId);
+            }
+
+            DestroyWindow(hWnd);
+            PostQuitMessage(0);
+            continue;
+        }
+
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+
+    UnregisterClass(wc.lpszClassName, wc.hInstance);
+    return 0;
+}
+
+// Started on first use, since the mod is loaded in all processes, and most of
+// them never calculate folder sizes.
+void FolderSizeCacheWatcherThreadEnsureStarted() {
+    if (g_folderSizeCacheWatcherThread) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(g_folderSizeCacheWatcherThreadMutex);
+
+    if (g_folderSizeCacheWatcherThread) {
+        return;
+    }
+
+    g_folderSizeCacheWatcherThreadReadyEvent =
+        CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    HANDLE thread = CreateThread(nullptr, 0, FolderSizeCacheWatcherThread,
+                                 nullptr, 0, nullptr);
+    if (thread) {
+        // Wait for the notifications to be registered, so that no change is
+        // missed after the first calculation.
+        WaitForSingleObject(g_folderSizeCacheWatcherThreadReadyEvent, INFINITE);
+        g_folderSizeCacheWatcherThread = thread;
+    } else {
+        Wh_Log(L"CreateThread failed: %d", GetLastError());
+        g_folderSizeCache.SetMemoryLimit(0);
+    }
+
+    CloseHandle(g_folderSizeCacheWatcherThreadReadyEvent);
+    g_folderSizeCacheWatcherThreadReadyEvent = nullptr;
+}
+
+void FolderSizeCacheWatcherThreadStop() {
+    if (HANDLE thread = g_folderSizeCacheWatcherThread.exchange(nullptr)) {
+        PostThreadMessage(GetThreadId(thread), WM_APP, 0, 0);
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+}
+
+constexpr int kFolderSizeMaxDepth = 255;
+
+// Set when the mod is unloaded, to stop running calculations early.
+std::atomic<bool> g_folderSizeCalculationsCancelled;
+
+using NtQueryDirectoryFile_t = NTSTATUS(NTAPI*)(HANDLE FileHandle,
+                                                HANDLE Event,
+                                                PIO_APC_ROUTINE ApcRoutine,
+                                                PVOID ApcContext,
+                                                PIO_STATUS_BLOCK IoStatusBlock,
+                                                PVOID FileInformation,
+                                                ULONG Length,
+                                                ULONG FileInformationClass,
+                                                BOOLEAN ReturnSingleEntry,
+                                                PUNICODE_STRING FileName,
+                                                BOOLEAN RestartScan);
+
+// FILE_DIRECTORY_INFORMATION, returned for FileDirectoryInformation.
+struct FolderSizeDirectoryInformation {
+    ULONG NextEntryOffset;
+    ULONG FileIndex;
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+    LARGE_INTEGER AllocationSize;
+    ULONG FileAttributes;
+    ULONG FileNameLength;
+    WCHAR FileName[1];
+};
+
+constexpr ULONG kFileDirectoryInformation = 1;
+
+// Helper threads for the native folder walker, shared by all calculations and
+// limited in number, so that concurrent calculations don't each start their
+// own threads.
+constexpr DWORD kFolderSizeMaxHelperThreads = 7;
+std::mutex g_folderSizeThreadPoolMutex;
+PTP_POOL g_folderSizeThreadPool;
+
+PTP_POOL GetFolderSizeThreadPool() {
+    std::lock_guard<std::mutex> guard(g_folderSizeThreadPoolMutex);
+
+    if (!g_folderSizeThreadPool) {
+        PTP_POOL pool = CreateThreadpool(nullptr);
+        if (!pool) {
+            return nullptr;
+        }
+
+        SetThreadpoolThreadMaximum(pool, kFolderSizeMaxHelperThreads);
+        g_folderSizeThreadPool = pool;
+    }
+
+    return g_folderSizeThreadPool;
+}
+
+void FreeFolderSizeThreadPool() {
+    std::lock_guard<std::mutex> guard(g_folderSizeThreadPoolMutex);
+
+    if (g_folderSizeThreadPool) {
+        CloseThreadpool(g_folderSizeThreadPool);
+        g_folderSizeThreadPool = nullptr;
+    }
+}
+
+// Walks a folder tree by listing directories directly with
+// NtQueryDirectoryFile, using the calling thread and helper threads from the
+// shared pool. Each thread has its own queue of directories to list, and takes
+// directories from the other queues when its own queue is empty. The size of each directory is added to its parent once
+// all of its subdirectories are done, and is stored in the folder size cache,
+// so that only changed branches are listed again later.
+class NativeFolderSizeWalker {
+   public:
+    NativeFolderSizeWalker(NtQueryDirectoryFile_t pNtQueryDirectoryFile,
+                           size_t threadCount,
+                           const std::atomic<bool>* cancel)
+        : m_pNtQueryDirectoryFile(pNtQueryDirectoryFile),
+          m_queues(threadCount),
+          m_cancel(cancel) {}
+
+    std::optional<ULONGLONG> Walk(const std::wstring& path) {
+        auto* root = new Node{
+            .path = path,
+            .generation = g_folderSizeCache.GetGeneration(),
+        };
+        m_outstanding = 1;
+        m_queued = 1;
+        m_queues[0].nodes.push_back(root);
+
+        PTP_WORK work = nullptr;
+        if (m_queues.size() > 1) {
+            if (PTP_POOL pool = GetFolderSizeThreadPool()) {
+                TP_CALLBACK_ENVIRON callbackEnviron;
+                InitializeThreadpoolEnvironment(&callbackEnviron);
+                SetThreadpoolCallbackPool(&callbackEnviron, pool);
+
+                work = CreateThreadpoolWork(HelperWorkCallback, this,
+                                            &callbackEnviron);
+                DestroyThreadpoolEnvironment(&callbackEnviron);
+            }
+        }
+
+        if (work) {
+            for (size_t i = 1; i < m_queues.size(); i++) {
+                SubmitThreadpoolWork(work);
+            }
+        }
+
+        WorkerThread(0);
+
+        if (work) {
+            // Helpers which didn't start yet, e.g. since the pool is busy
+            // with other calculations, aren't needed anymore.
+            WaitForThreadpoolWorkCallbacks(work, TRUE);
+            CloseThreadpoolWork(work);
+        }
+
+        if (IsCancelled() || !m_rootListed) {
+            return std::nullopt;
+        }
+
+        return m_result;
+    }
+
+   private:
+    struct Node {
+        std::wstring path;
+        Node* parent = nullptr;
+        int depth = 0;
+        DWORD64 generation;
+        std::atomic<ULONGLONG> size = 0;
+        // The directory itself, plus one for each subdirectory which isn't
+        // done yet.
+        std::atomic<int> pending = 1;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Node*> nodes;
+    };
+
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    bool IsCancelled() const {
+        return g_folderSizeCalculationsCancelled ||
+               (m_cancel && m_cancel->load());
+    }
+
+    static void CALLBACK HelperWorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                            PVOID context,
+                                            PTP_WORK work) {
+        auto* walker = static_cast<NativeFolderSizeWalker*>(context);
+        size_t index = walker->m_nextHelperIndex++;
+        if (index < walker->m_queues.size()) {
+            walker->WorkerThread(index);
+        }
+    }
+
+    // Called after changing `m_queued` or `m_outstanding`. Taking the mutex
+    // makes sure that a thread which just checked them is already waiting.
+    void NotifyWorkers(bool all) {
+        { std::lock_guard<std::mutex> guard(m_workMutex); }
+
+        if (all) {
+            m_workCondition.notify_all();
+        } else {
+            m_workCondition.notify_one();
+        }
+    }
+
+    Node* PopNode(size_t index) {
+        // Newest first from the own queue, to walk depth first and keep the
+        // queues short. Oldest first from other queues, since these are
+        // likely larger subtrees.
+        {
+            auto& queue = m_queues[index];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            if (!queue.nodes.empty()) {
+                Node* node = queue.nodes.back();
+                queue.nodes.pop_back();
+                m_queued--;
+                return node;
+            }
+        }
+
+        for (size_t i = 1; i < m_queues.size(); i++) {
+            auto& queue = m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            if (!queue.nodes.empty()) {
+                Node* node = queue.nodes.front();
+                queue.nodes.pop_front();
+                m_queued--;
+                return node;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void PushNode(size_t index, Node* node) {
+        m_outstanding++;
+        {
+            auto& queue = m_queues[index];
+            std::lock_guard<std::mutex> guard(queue.mutex);
+            queue.nodes.push_back(node);
+            m_queued++;
+        }
+
+        NotifyWorkers(false);
+    }
+
+    void WorkerThread(size_t index) {
+        auto buffer = std::make_unique<BYTE[]>(kBufferSize);
+
+        while (m_outstanding > 0) {
+            Node* node = PopNode(index);
+            if (!node) {
+                // Other threads are still listing directories which might add
+                // more work.
+                std::unique_lock<std::mutex> lock(m_workMutex);
+                m_workCondition.wait(lock, [this] {
+                    return m_queued > 0 || m_outstanding == 0;
+                });
+                continue;
+            }
+
+            if (!IsCancelled()) {
+                ListDirectory(index, node, buffer.get());
+            }
+
+            FinishNode(node);
+            if (--m_outstanding == 0) {
+                NotifyWorkers(true);
+            }
+        }
+    }
+
+    void ListDirectory(size_t index, Node* node, BYTE* buffer) {
+        // Use the extended-length path syntax to support long paths.
+        std::wstring extendedPath =
+            IsUncPath(node->path.c_str())
+                ? L"\\\\?\\UNC\\" + node->path.substr(2)
+                : L"\\\\?\\" + node->path;
+
+        HANDLE handle = CreateFile(
+            extendedPath.c_str(), FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return;
+        }
+
+        if (!node->parent) {
+            m_rootListed = true;
+        }
+
+        ULONGLONG size = 0;
+        std::wstring_view parentPath = node->path;
+        if (parentPath.ends_with(L'\\')) {
+            parentPath.remove_suffix(1);
+        }
+
+        while (!IsCancelled()) {
+            IO_STATUS_BLOCK ioStatusBlock;
+            NTSTATUS status = m_pNtQueryDirectoryFile(
+                handle, nullptr, nullptr, nullptr, &ioStatusBlock, buffer,
+                kBufferSize, kFileDirectoryInformation, FALSE, nullptr, FALSE);
+            if (status < 0) {
+                break;
+            }
+
+            auto* entry =
+                reinterpret_cast<FolderSizeDirectoryInformation*>(buffer);
+            while (true) {
+                std::wstring_view name(entry->FileName,
+                                       entry->FileNameLength / sizeof(WCHAR));
+                if (!(entry->FileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                    size += entry->EndOfFile.QuadPart;
+                } else if (name != L"." && name != L".." &&
+                           !(entry->FileAttributes &
+                             FILE_ATTRIBUTE_REPARSE_POINT) &&
+                           node->depth < kFolderSizeMaxDepth) {
+                    // Like the namespace walker, don't traverse reparse
+                    // points such as junctions and symbolic links.
+                    std::wstring childPath(parentPath);
+                    childPath += L'\\';
+                    childPath += name;
+
+                    if (auto childSize = g_folderSizeCache.Get(childPath)) {
+                        size += *childSize;
+                    } else {
+                        auto* child = new Node{
+                            .path = std::move(childPath),
+                            .parent = node,
+                            .depth = node->depth + 1,
+                            .generation = g_folderSizeCache.GetGeneration(),
+                        };
+                        node->pending++;
+                        PushNode(index, child);
+                    }
+                }
+
+                if (!entry->NextEntryOffset) {
+                    break;
+                }
+
+                entry = reinterpret_cast<FolderSizeDirectoryInformation*>(
+                    reinterpret_cast<BYTE*>(entry) + entry->NextEntryOffset);
+            }
+        }
+
+        CloseHandle(handle);
+
+        node->size += size;
+    }
+
+    void FinishNode(Node* node) {
+        while (node && --node->pending == 0) {
+            ULONGLONG size = node->size;
+            if (!IsCancelled()) {
+                g_folderSizeCache.Set(node->path, size, node->generation);
+            }
+
+            Node* parent = node->parent;
+            if (parent) {
+                parent->size += size;
+            } else {
+                m_result = size;
+            }
+
+            delete node;
+            node = parent;
+        }
+    }
+
+    NtQueryDirectoryFile_t m_pNtQueryDirectoryFile;
+    std::vector<Queue> m_queues;
+    const std::atomic<bool>* m_cancel;
+    std::atomic<size_t> m_outstanding = 0;
+    std::atomic<size_t> m_queued = 0;
+    std::atomic<size_t> m_nextHelperIndex = 1;
+    std::mutex m_workMutex;
+    std::condition_variable m_workCondition;
+    std::atomic<bool> m_rootListed = false;
+    ULONGLONG m_result = 0;
+};
+
+NtQueryDirectoryFile_t GetNtQueryDirectoryFile() {
+    static NtQueryDirectoryFile_t pNtQueryDirectoryFile = []() {
+        HMODULE ntdllModule = GetModuleHandle(L"ntdll.dll");
+        return ntdllModule ? (NtQueryDirectoryFile_t)GetProcAddress(
+                                 ntdllModule, "NtQueryDirectoryFile")
+                           : nullptr;
+    }();
+    return pNtQueryDirectoryFile;
+}
+
+std::optional<ULONGLONG> CalculateFolderSizeNative(
+    const std::wstring& path,
+    const std::atomic<bool>* cancel) {
+    NtQueryDirectoryFile_t pNtQueryDirectoryFile = GetNtQueryDirectoryFile();
+    if (!pNtQueryDirectoryFile) {
+        return std::nullopt;
+    }
+
+    // Network folders are listed by a single thread to avoid flooding the
+    // server with requests.
+    size_t threadCount = 1;
+    if (!IsUncPath(path.c_str())) {
+        threadCount = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                 kFolderSizeMaxHelperThreads + 1);
+    }
+
+    NativeFolderSizeWalker walker(pNtQueryDirectoryFile, threadCount, cancel);
+    return walker.Walk(path);
+}
+
+std::optional<ULONGLONG> CalculateFolderSize(
+    IShellFolder2* shellFolder,
+    const std::atomic<bool>* cancel = nullptr) {
+    std::wstring path = GetFolderPathFromIShellFolder(shellFolder);
+    if (path.empty()) {
+        // Not a file system folder.
+        return CalculateFolderSizeWithNamespaceWalk(shellFolder);
+    }
+
+    if (g_folderSizeCache.IsEnabled()) {
+        FolderSizeCacheWatcherThreadEnsureStarted();
+
+        if (auto size = g_folderSizeCache.Get(path)) {
+            Wh_Log(L"Using cached folder size for %s", path.c_str());
+            return size;
+        }
+    }
+
+    if (auto size = CalculateFolderSizeNative(path, cancel)) {
+        return size;
+    }
+
+    if (g_folderSizeCalculationsCancelled || (cancel && *cancel)) {
+        return std::nullopt;
+    }
+
+    return CalculateFolderSizeWithNamespaceWalk(shellFolder);
+}
+
+// Calculations which are in progress, with the window which was in the
+// foreground when they were requested. When sizes are requested for another
+// folder in the same window, the user navigated away, and the calculations for
+// the previous folder are cancelled.
+struct FolderSizeCalculation {
+    HWND window;
+    std::vector<BYTE> parentFolder;
+    std::atomic<bool> cancel;
+};
+
+std::mutex g_folderSizeCalculationsMutex;
+std::list<FolderSizeCalculation*> g_folderSizeCalculations;
+
+HWND GetFolderSizeRequestWindow() {
+    return GetAncestor(GetForegroundWindow(), GA_ROOT);
+}
+
+void CancelOtherFolderSizeCalculations(
+    HWND window,
+    const std::vector<BYTE>& parentFolder) {
+    std::lock_guard<std::mutex> guard(g_folderSizeCalculationsMutex);
+
+    for (auto* calculation : g_folderSizeCalculations) {
+        if (calculation->window == window &&
+            calculation->parentFolder != parentFolder) {
+            calculation->cancel = true;
+        }
+    }
+}
+
+class FolderSizeCalculationScope {
+   public:
+    FolderSizeCalculationScope(HWND window,
+                               const std::vector<BYTE>& parentFolder) {
+        m_calculation.window = window;
+        m_calculation.parentFolder = parentFolder;
+
+        std::lock_guard<std::mutex> guard(g_folderSizeCalculationsMutex);
+        m_it = g_folderSizeCalculations.insert(g_folderSizeCalculations.end(),
+                                               &m_calculation);
+    }
+
+    ~FolderSizeCalculationScope() {
+        std::lock_guard<std::mutex> guard(g_folderSizeCalculationsMutex);
+        g_folderSizeCalculations.erase(m_it);
+    }
+
+    FolderSizeCalculationScope(const FolderSizeCalculationScope&) = delete;
+    FolderSizeCalculationScope& operator=(const FolderSizeCalculationScope&) =
+        delete;
+
+    const std::atomic<bool>* GetCancel() const { return &m_calculation.cancel; }
+    bool IsCancelled() const { return m_calculation.cancel; }
+
+   private:
+    FolderSizeCalculation m_calculation{};
+    std::list<FolderSizeCalculation*>::iterator m_it;
+};
+
+// Calculates folder sizes in the background, so that the view isn't blocked
+// while a large tree or a slow network folder is walked. Requests are handled
+// newest first, since Explorer requests the sizes of rows as they're shown, so
+// the latest requests are likely for the visible rows. When a size is ready,
+// an update notification is sent for the folder, and Explorer requests its
+// size again.
+class FolderSizeBackgroundCalculator {
+   public:
+    static constexpr size_t kThreadCount = 2;
+
+    // Results are kept for a while, since Explorer might request the size
+    // several times, from different threads, after the update notification.
+    static constexpr DWORD kResultMaxAgeMs = 5 * 1000;
+
+    // Returns the result of a finished calculation, if any.
+    std::optional<std::optional<ULONGLONG>> GetResult(
+        const std::wstring& path) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto it = m_results.find(path);
+        if (it == m_results.end()) {
+            return std::nullopt;
+        }
+
+        if (GetTickCount() - it->second.timestamp > kResultMaxAgeMs) {
+            m_results.erase(it);
+            return std::nullopt;
+        }
+
+        return it->second.size;
+    }
+
+    void Request(const std::wstring& path,
+                 HWND window,
+                 const std::vector<BYTE>& parentFolder) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        if (m_stopped) {
+            return;
+        }
+
+        // Drop requests for folders which are no longer shown in the window.
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            if (it->second.window == window &&
+                it->second.parentFolder != parentFolder) {
+                m_pendingPaths.erase(it->second.path);
+                it = m_pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (m_running.contains(path)) {
+            return;
+        }
+
+        // Move the request to the front if it's already pending.
+        if (auto it = m_pendingPaths.find(path); it != m_pendingPaths.end()) {
+            m_pending.erase(it->second);
+            m_pendingPaths.erase(it);
+        }
+
+        DWORD64 sequence = ++m_sequence;
+        m_pending[sequence] = {
+            .path = path,
+            .window = window,
+            .parentFolder = parentFolder,
+        };
+        m_pendingPaths[path] = sequence;
+
+        if (m_threads.size() < kThreadCount &&
+            m_pending.size() > m_idleThreads) {
+            m_threads.emplace_back(
+                &FolderSizeBackgroundCalculator::WorkerThread, this);
+        }
+
+        m_condition.notify_one();
+    }
+
+    void Stop() {
+        std::vector<std::thread> threads;
+
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stopped = true;
+            m_pending.clear();
+            m_pendingPaths.clear();
+            m_results.clear();
+            threads = std::move(m_threads);
+        }
+
+        m_condition.notify_all();
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+   private:
+    struct PendingRequest {
+        std::wstring path;
+        HWND window;
+        std::vector<BYTE> parentFolder;
+    };
+
+    struct Result {
+        std::optional<ULONGLONG> size;
+        DWORD timestamp;
+    };
+
+    // For paths which can't be listed directly, use the namespace walker with
+    // a shell folder bound on this thread.
+    static std::optional<ULONGLONG> CalculateWithNamespaceWalk(
+        const std::wstring& path) {
+        LPITEMIDLIST pidl;
+        HRESULT hr =
+            SHParseDisplayName(path.c_str(), nullptr, &pidl, 0, nullptr);
+        if (FAILED(hr)) {
+            Wh_Log(L"Failed: %08X", hr);
+            return std::nullopt;
+        }
+
+        winrt::com_ptr<IShellFolder2> shellFolder;
+        hr = SHBindToObject(nullptr, pidl, nullptr,
+                            IID_PPV_ARGS(shellFolder.put()));
+        CoTaskMemFree(pidl);
+        if (FAILED(hr) || !shellFolder) {
+            Wh_Log(L"Failed: %08X", hr);
+            return std::nullopt;
+        }
+
+        return CalculateFolderSizeWithNamespaceWalk(shellFolder.get());
+    }
+
+    void WorkerThread() {
+        HRESULT hrCoInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            m_idleThreads++;
+            m_condition.wait(lock,
+                             [this] { return m_stopped || !m_pending.empty(); });
+            m_idleThreads--;
+
+            if (m_stopped) {
+                break;
+            }
+
+            auto node = m_pending.extract(std::prev(m_pending.end()));
+            PendingRequest request = std::move(node.mapped());
+            m_pendingPaths.erase(request.path);
+            m_running.insert(request.path);
+
+            lock.unlock();
+
+            std::optional<ULONGLONG> size;
+            bool cancelled;
+            {
+                FolderSizeCalculationScope calculationScope(
+                    request.window, request.parentFolder);
+                if (g_folderSizeCache.IsEnabled()) {
+                    FolderSizeCacheWatcherThreadEnsureStarted();
+                }
+
+                size = CalculateFolderSizeNative(request.path,
+                                                 calculationScope.GetCancel());
+                cancelled = calculationScope.IsCancelled() ||
+                            g_folderSizeCalculationsCancelled;
+                if (!size && !cancelled) {
+                    size = CalculateWithNamespaceWalk(request.path);
+                }
+            }
+
+            lock.lock();
+
+            m_running.erase(request.path);
+
+            if (m_stopped) {
+                break;
+            }
+
+            if (cancelled) {
+                // Calculate again if the folder is shown again.
+                continue;
+            }
+
+            DWORD now = GetTickCount();
+            for (auto it = m_results.begin(); it != m_results.end();) {
+                if (now - it->second.timestamp > kResultMaxAgeMs) {
+                    it = m_results.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            m_results[request.path] = {size, now};
+
+            lock.unlock();
+
+            Wh_Log(L"Calculated size for %s", request.path.c_str());
+            FolderSizeRefreshNotificationAdd(request.path);
+            SHChangeNotify(SHCNE_UPDATEITEM, SHCNF_PATH | SHCNF_FLUSHNOWAIT,
+                           request.path.c_str(), nullptr);
+
+            lock.lock();
+        }
+
+        lock.unlock();
+
+        if (SUCCEEDED(hrCoInit)) {
+            CoUninitialize();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<std::thread> m_threads;
+    size_t m_idleThreads = 0;
+    bool m_stopped = false;
+    DWORD64 m_sequence = 0;
+    std::map<DWORD64, PendingRequest> m_pending;
+    std::map<std::wstring, DWORD64> m_pendingPaths;
+    std::set<std::wstring> m_running;
+    std::map<std::wstring, Result> m_results;
+};
+
+FolderSizeBackgroundCalculator g_folderSizeBackgroundCalculator;
+
 using CFSFolder__GetSize_t = HRESULT(WINAPI*)(void* pCFSFolder,
                                               const ITEMID_CHILD* itemidChild,
                                               const void* idFolder,
@@ -1790,7 +3040,49 @@ HRESULT WINAPI CFSFolder__GetSize_Hook(void* pCFSFolder,
                 Wh_Log(L"Failed to get path");
             }
         } else {
-            cacheIt->second = CalculateFolderSize(childFolder.get());
+            HWND window = GetFolderSizeRequestWindow();
+            auto parentFolder = GetShellFolderIDListKey(shellFolder2.get());
+            CancelOtherFolderSizeCalculations(window, parentFolder);
+
+            std::wstring path;
+            if (g_settings.calculateFolderSizes ==
+                CalculateFolderSizes::always) {
+                path = GetFolderPathFromIShellFolder(childFolder.get());
+            }
+
+            if (!path.empty()) {
+                std::optional<ULONGLONG> cachedSize;
+                if (g_folderSizeCache.IsEnabled()) {
+                    cachedSize = g_folderSizeCache.Get(path);
+                }
+
+                if (cachedSize) {
+                    cacheIt->second = cachedSize;
+                } else if (auto result =
+                               g_folderSizeBackgroundCalculator.GetResult(
+                                   path)) {
+                    cacheIt->second = *result;
+                } else {
+                    // Leave the size empty for now, it's updated when the
+                    // calculation is done.
+                    Wh_Log(L"Calculating size in the background");
+                    g_folderSizeBackgroundCalculator.Request(
+                        path, window, parentFolder);
+                    g_cacheShellFolderSizes.erase(cacheIt);
+                    return S_OK;
+                }
+            } else {
+                FolderSizeCalculationScope calculationScope(window,
+                                                            parentFolder);
+                cacheIt->second = CalculateFolderSize(
+                    childFolder.get(), calculationScope.GetCancel());
+                if (calculationScope.IsCancelled()) {
+                    // Calculate again if the folder is shown again.
+                    Wh_Log(L"Cancelled");
+                    g_cacheShellFolderSizes.erase(cacheIt);
+                    return S_OK;
+                }
+            }
         }
     } else {
         Wh_Log(L"Using cached size");
@@ -1853,6 +3145,37 @@ using CFSFolder_CompareIDs_t =
                      const ITEMIDLIST_RELATIVE* itemid1,
                      const ITEMIDLIST_RELATIVE* itemid2);
 CFSFolder_CompareIDs_t CFSFolder_CompareIDs_Original;
+
+// Sorting calls CompareIDs O(n log n) times, so each item's size is fetched
+// once and reused for the rest of the sort. The cache is reset when a
+// different folder is sorted or after a second of inactivity, similarly to
+// g_cacheShellFolderSizes. A reference to the folder is held, so that its
+// address can't be reused by another folder while the cache is in use.
+thread_local winrt::com_ptr<IUnknown> g_sortSizesShellFolder;
+thread_local std::map<std::vector<BYTE>, ULONGLONG> g_sortSizesCache;
+thread_local DWORD g_sortSizesCacheLastUsedTickCount;
+
+std::optional<ULONGLONG> GetSortSize(void* pCFSFolder,
+                                     const ITEMIDLIST_RELATIVE* itemid,
+                                     const PROPERTYKEY* scid) {
+    auto key = PIDLToVector(itemid);
+    if (auto it = g_sortSizesCache.find(key); it != g_sortSizesCache.end()) {
+        return it->second;
+    }
+
+    // Failures aren't cached, as folder sizes might still be calculated in
+    // the background.
+    _variant_t value;
+    if (FAILED(CFSFolder_GetDetailsEx_Original(pCFSFolder, itemid, scid,
+                                               value.GetAddress())) ||
+        value.vt != VT_UI8) {
+        return std::nullopt;
+    }
+
+    g_sortSizesCache.emplace(std::move(key), value.ullVal);
+    return value.ullVal;
+}
+
 HRESULT WINAPI CFSFolder_CompareIDs_Hook(void* pCFSFolder,
                                          int column,
                                          const ITEMIDLIST_RELATIVE* itemid1,
@@ -1875,22 +3198,27 @@ HRESULT WINAPI CFSFolder_CompareIDs_Hook(void* pCFSFolder,
         return original();
     }
 
-    _variant_t value1;
-    _variant_t value2;
-    bool succeeded =
-        SUCCEEDED(CFSFolder_GetDetailsEx_Original(
-            pCFSFolder, itemid1, &columnSCID, value1.GetAddress())) &&
-        value1.vt == VT_UI8 &&
-        SUCCEEDED(CFSFolder_GetDetailsEx_Original(
-            pCFSFolder, itemid2, &columnSCID, value2.GetAddress())) &&
-        value2.vt == VT_UI8;
+    DWORD tickCount = GetTickCount();
+    if (pCFSFolder != g_sortSizesShellFolder.get() ||
+        tickCount - g_sortSizesCacheLastUsedTickCount > 1000) {
+        g_sortSizesCache.clear();
+        g_sortSizesShellFolder.copy_from((IUnknown*)pCFSFolder);
+    }
+
+    g_sortSizesCacheLastUsedTickCount = tickCount;
 
-    if (!succeeded) {
+    auto size1Optional = GetSortSize(pCFSFolder, itemid1, &columnSCID);
+    if (!size1Optional) {
         return original();
     }
 
-    ULONGLONG size1 = value1.ullVal;
-    ULONGLONG size2 = value2.ullVal;
+    auto size2Optional = GetSortSize(pCFSFolder, itemid2, &columnSCID);
+    if (!size2Optional) {
+        return original();
+    }
+
+    ULONGLONG size1 = *size1Optional;
+    ULONGLONG size2 = *size2Optional;
 
     if (size1 > size2) {
         return 1;
@@ -2444,6 +3772,11 @@ void LoadSettings() {
     g_settings.sortSizesMixFolders = Wh_GetIntSetting(L"sortSizesMixFolders");
     g_settings.disableKbOnlySizes = Wh_GetIntSetting(L"disableKbOnlySizes");
     g_settings.useIecTerms = Wh_GetIntSetting(L"useIecTerms");
+
+    int folderSizeCacheMemoryLimit =
+        Wh_GetIntSetting(L"folderSizeCacheMemoryLimit");
+    g_settings.folderSizeCacheMemoryLimit =
+        folderSizeCacheMemoryLimit > 0 ? folderSizeCacheMemoryLimit : 0;
 }
 
 BOOL Wh_ModInit() {
@@ -2453,6 +3786,13 @@ BOOL Wh_ModInit() {
 
     LoadSettings();
 
+    if (g_settings.calculateFolderSizes == CalculateFolderSizes::always ||
+        g_settings.calculateFolderSizes == CalculateFolderSizes::withShiftKey) {
+        g_folderSizeCache.SetMemoryLimit(
+            static_cast<size_t>(g_settings.folderSizeCacheMemoryLimit) * 1024 *
+            1024);
+    }
+
     if (g_settings.calculateFolderSizes != CalculateFolderSizes::disabled) {
         if (!HookWindowsStorageSymbols()) {
             Wh_Log(L"Failed hooking Windows Storage symbols");
@@ -2550,6 +3890,8 @@ BOOL Wh_ModInit() {
 void Wh_ModUninit() {
     Wh_Log(L">");
 
+    g_folderSizeCalculationsCancelled = true;
+
     while (g_hookRefCount > 0) {
         Sleep(200);
     }
@@ -2559,6 +3901,13 @@ void Wh_ModUninit() {
         WaitForSingleObject(thread, INFINITE);
         CloseHandle(thread);
     }
+
+    EverythingClientPoolClear();
+
+    g_folderSizeBackgroundCalculator.Stop();
+    FreeFolderSizeThreadPool();
+    FolderSizeCacheWatcherThreadStop();
+    g_folderSizeCache.Clear();
 }
 
 BOOL Wh_ModSettingsChanged(BOOL* bReload) {
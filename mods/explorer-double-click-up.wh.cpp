@@ -2,7 +2,7 @@
 // @id              explorer-double-click-up
 // @name            Explorer Double Click Up
 // @description     Double click empty space to go up a folder
-// @version         1.0.1
+// @version         1.0.2
 // @author          wrldspawn
 // @github          https://github.com/wrldspawn
 // @include         explorer.exe
@@ -315,22 +315,22 @@ BOOL CALLBACK InitEnumChildWindowsProc(HWND hWnd, LPARAM lParam) {
     return TRUE;
 }
 
-BOOL CALLBACK InitEnumWindowsProc(HWND hWnd, LPARAM lParam) {
-    DWORD pid = 0;
-    GetWindowThreadProcessId(hWnd, &pid);
-    if (pid == GetCurrentProcessId()) {
-        wchar_t className[256];
-        GetClassName(hWnd, className, 256);
+void InitCabinetWindows() {
+    // Only visit cabinet windows instead of every top-level window, so many
+    // restored folder windows don't make the initial pass expensive.
+    HWND hWnd = NULL;
+    while ((hWnd = FindWindowEx(NULL, hWnd, L"CabinetWClass", NULL)) != NULL) {
+        DWORD pid = 0;
+        GetWindowThreadProcessId(hWnd, &pid);
+        if (pid != GetCurrentProcessId()) {
+            continue;
+        }
 
-        if (wcscmp(className, L"CabinetWClass") == 0) {
-            HWND shellTab = FindWindowEx(hWnd, NULL, L"ShellTabWindowClass", NULL);
-            if (shellTab != NULL) {
-                EnumChildWindows(shellTab, InitEnumChildWindowsProc, (LPARAM)shellTab);
-            }
+        HWND shellTab = FindWindowEx(hWnd, NULL, L"ShellTabWindowClass", NULL);
+        if (shellTab != NULL) {
+            EnumChildWindows(shellTab, InitEnumChildWindowsProc, (LPARAM)shellTab);
         }
     }
-
-    return TRUE;
 }
 
 BOOL Wh_ModInit() {
@@ -380,7 +380,7 @@ BOOL Wh_ModInit() {
 }
 
 void Wh_ModAfterInit() {
-    EnumWindows(InitEnumWindowsProc, 0);
+    InitCabinetWindows();
 }
 
 void Wh_ModUninit() {
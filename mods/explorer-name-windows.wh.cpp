@@ -2,7 +2,7 @@
 // @id              explorer-name-windows
 // @name            Name explorer windows
 // @description     Assign custom names to explorer windows, just like in Chrome
-// @version         1.0
+// @version         1.0.2
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -23,18 +23,27 @@ Assign custom names to explorer windows, just like in Chrome.
 
 #include <windhawk_utils.h>
 
+#include <mutex>
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 struct CabinedWindowData {
     std::wstring originalText;
     std::wstring customText;
 };
 
+// Explorer windows can run on different threads, and the mod is uninitialized
+// from yet another one. Don't send messages to a window while holding the lock,
+// its window procedure might need it.
+std::mutex g_cabinetWindowsMutex;
 std::unordered_map<HWND, CabinedWindowData> g_cabinetWindows;
 
 constexpr UINT_PTR IDM_MYSYSTEM = 1001;
+// The separator gets its own ID so that both items can be removed by command,
+// without walking the system menu.
+constexpr UINT_PTR IDM_MYSYSTEM_SEPARATOR = 1002;
 
 constexpr WCHAR g_szClassName[] = L"Windhawk_explorer-name-windows";
 
@@ -219,24 +228,41 @@ LRESULT CALLBACK CabinetWindowSubclassProc(HWND hWnd,
             if (wParam == IDM_MYSYSTEM) {
                 auto newTitle = PromptForNewTitle(hWnd);
                 if (newTitle) {
-                    auto it = g_cabinetWindows.find(hWnd);
-                    if (it != g_cabinetWindows.end()) {
-                        it->second.customText.clear();
-
-                        if (!newTitle->empty()) {
-                            if (it->second.originalText.empty()) {
-                                WCHAR text[1024];
-                                GetWindowText(hWnd, text, ARRAYSIZE(text));
-
-                                it->second.originalText = text;
+                    WCHAR text[1024];
+                    GetWindowText(hWnd, text, ARRAYSIZE(text));
+
+                    std::optional<std::wstring> textToSet;
+                    {
+                        std::lock_guard<std::mutex> guard(
+                            g_cabinetWindowsMutex);
+                        auto it = g_cabinetWindows.find(hWnd);
+                        if (it != g_cabinetWindows.end()) {
+                            it->second.customText.clear();
+
+                            if (!newTitle->empty()) {
+                                if (it->second.originalText.empty()) {
+                                    it->second.originalText = text;
+                                }
+
+                                textToSet = *newTitle;
+                            } else if (!it->second.originalText.empty()) {
+                                textToSet =
+                                    std::move(it->second.originalText);
+                                it->second.originalText.clear();
                             }
+                        }
+                    }
+
+                    if (textToSet) {
+                        SetWindowText(hWnd, textToSet->c_str());
+                    }
 
-                            SetWindowText(hWnd, newTitle->c_str());
+                    if (!newTitle->empty()) {
+                        std::lock_guard<std::mutex> guard(
+                            g_cabinetWindowsMutex);
+                        auto it = g_cabinetWindows.find(hWnd);
+                        if (it != g_cabinetWindows.end()) {
                             it->second.customText = *newTitle;
-                        } else if (!it->second.originalText.empty()) {
-                            SetWindowText(hWnd,
-                                          it->second.originalText.c_str());
-                            it->second.originalText.clear();
                         }
                     }
                 }
@@ -248,24 +274,32 @@ LRESULT CALLBACK CabinetWindowSubclassProc(HWND hWnd,
             break;
 
         case WM_SETTEXT: {
-            auto it = g_cabinetWindows.find(hWnd);
-            if (it != g_cabinetWindows.end()) {
-                PCWSTR str = it->second.customText.c_str();
-                if (*str != L'\0') {
+            std::wstring customText;
+            {
+                std::lock_guard<std::mutex> guard(g_cabinetWindowsMutex);
+                auto it = g_cabinetWindows.find(hWnd);
+                if (it != g_cabinetWindows.end() &&
+                    !it->second.customText.empty()) {
                     it->second.originalText = lParam ? (PCWSTR)lParam : L"";
-
-                    lParam = (LPARAM)str;
+                    customText = it->second.customText;
                 }
             }
 
+            if (!customText.empty()) {
+                lParam = (LPARAM)customText.c_str();
+            }
+
             result = DefSubclassProc(hWnd, uMsg, wParam, lParam);
         } break;
 
-        case WM_NCDESTROY:
-            g_cabinetWindows.erase(hWnd);
+        case WM_NCDESTROY: {
+            {
+                std::lock_guard<std::mutex> guard(g_cabinetWindowsMutex);
+                g_cabinetWindows.erase(hWnd);
+            }
 
             result = DefSubclassProc(hWnd, uMsg, wParam, lParam);
-            break;
+        } break;
 
         default:
             result = DefSubclassProc(hWnd, uMsg, wParam, lParam);
@@ -279,46 +313,25 @@ void HandleIdentifiedCabinetWindow(HWND hWnd) {
     HMENU hMenu = GetSystemMenu(hWnd, FALSE);
     InsertMenu(hMenu, SC_CLOSE, MF_BYCOMMAND | MF_STRING, IDM_MYSYSTEM,
                L"Name window...");
-    InsertMenu(hMenu, SC_CLOSE, MF_BYCOMMAND | MF_SEPARATOR, 0, nullptr);
+    InsertMenu(hMenu, SC_CLOSE, MF_BYCOMMAND | MF_SEPARATOR,
+               IDM_MYSYSTEM_SEPARATOR, nullptr);
 
-    g_cabinetWindows.try_emplace(hWnd);
+    {
+        std::lock_guard<std::mutex> guard(g_cabinetWindowsMutex);
+        g_cabinetWindows.try_emplace(hWnd);
+    }
     WindhawkUtils::SetWindowSubclassFromAnyThread(hWnd,
                                                   CabinetWindowSubclassProc, 0);
 }
 
-int GetMenuItemPositionFromCommandID(HMENU hMenu, UINT_PTR commandID) {
-    int itemCount = GetMenuItemCount(hMenu);
-    for (int i = 0; i < itemCount; i++) {
-        MENUITEMINFO menuItemInfo{
-            .cbSize = sizeof(MENUITEMINFO),
-            .fMask = MIIM_FTYPE | MIIM_ID,
-        };
-        if (GetMenuItemInfo(hMenu, i, TRUE, &menuItemInfo) &&
-            (menuItemInfo.wID == commandID)) {
-            return i;
-        }
-    }
-
-    return -1;
-}
-
 void ResetIdentifiedCabinetWindow(HWND hWnd) {
     WindhawkUtils::RemoveWindowSubclassFromAnyThread(hWnd,
                                                      CabinetWindowSubclassProc);
 
     HMENU hMenu = GetSystemMenu(hWnd, FALSE);
-    int pos = GetMenuItemPositionFromCommandID(hMenu, IDM_MYSYSTEM);
-    if (pos != -1) {
-        DeleteMenu(hMenu, pos, MF_BYPOSITION);
-
-        MENUITEMINFO menuItemInfo{
-            .cbSize = sizeof(MENUITEMINFO),
-            .fMask = MIIM_FTYPE,
-        };
-        if (GetMenuItemInfo(hMenu, pos, TRUE, &menuItemInfo) &&
-            (menuItemInfo.fType & MFT_SEPARATOR)) {
-            DeleteMenu(hMenu, pos, MF_BYPOSITION);
-        }
+    if (hMenu) {
+        DeleteMenu(hMenu, IDM_MYSYSTEM, MF_BYCOMMAND);
+        DeleteMenu(hMenu, IDM_MYSYSTEM_SEPARATOR, MF_BYCOMMAND);
     }
 }
 
@@ -354,28 +367,19 @@ HWND WINAPI CreateWindowExW_Hook(DWORD dwExStyle,
 }
 
 void HandleCurrentProcessCabinetWindows() {
-    EnumWindows(
-        [](HWND hWnd, LPARAM lParam) WINAPI -> BOOL {
-            DWORD dwProcessId = 0;
-            if (!GetWindowThreadProcessId(hWnd, &dwProcessId) ||
-                dwProcessId != GetCurrentProcessId()) {
-                return TRUE;
-            }
-
-            WCHAR szClassName[32];
-            if (GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName)) == 0) {
-                return TRUE;
-            }
-
-            if (_wcsicmp(szClassName, L"CabinetWClass") == 0) {
-                Wh_Log(L"CabinetWClass window found: %08X",
-                       (DWORD)(ULONG_PTR)hWnd);
-                HandleIdentifiedCabinetWindow(hWnd);
-            }
+    // Let the class lookup filter the top-level windows instead of checking
+    // the class of each of them.
+    HWND hWnd = nullptr;
+    while ((hWnd = FindWindowEx(nullptr, hWnd, L"CabinetWClass", nullptr))) {
+        DWORD dwProcessId = 0;
+        if (!GetWindowThreadProcessId(hWnd, &dwProcessId) ||
+            dwProcessId != GetCurrentProcessId()) {
+            continue;
+        }
 
-            return TRUE;
-        },
-        0);
+        Wh_Log(L"CabinetWClass window found: %08X", (DWORD)(ULONG_PTR)hWnd);
+        HandleIdentifiedCabinetWindow(hWnd);
+    }
 }
 
 BOOL Wh_ModInit() {
@@ -396,7 +400,16 @@ void Wh_ModAfterInit() {
 void Wh_ModUninit() {
     Wh_Log(L">");
 
-    for (const auto& [hWnd, _] : g_cabinetWindows) {
+    std::vector<HWND> cabinetWindows;
+    {
+        std::lock_guard<std::mutex> guard(g_cabinetWindowsMutex);
+        cabinetWindows.reserve(g_cabinetWindows.size());
+        for (const auto& [hWnd, _] : g_cabinetWindows) {
+            cabinetWindows.push_back(hWnd);
+        }
+    }
+
+    for (HWND hWnd : cabinetWindows) {
         ResetIdentifiedCabinetWindow(hWnd);
     }
 }
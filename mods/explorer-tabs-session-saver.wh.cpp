@@ -3,7 +3,7 @@
 // @name            Explorer Tabs Session Saver
 // @description     Saves and restores Explorer tabs when reopening
 // @github          https://github.com/noX1st
-// @version         1.0.0
+// @version         1.0.1
 // @author          noX1st
 // @include         explorer.exe
 // @compilerOptions -lshlwapi -lole32 -loleaut32 -lshell32 -luuid
@@ -35,12 +35,23 @@ Tab session save path - C:\Users\"User"\AppData\Roaming\WindhawkModsData\explore
 #include <string>
 #include <fstream>
 #include <olectl.h>
+#include <exdispid.h>
 #include <algorithm>
 
+// Delay for coalescing tab change notifications, e.g. a window with several
+// tabs being closed or a navigation renaming the window more than once.
+#define SAVE_DELAY 500
+// Fallback polling interval in case shell window events aren't available.
+#define POLL_INTERVAL 2000
+
 HANDLE g_hMainThread = NULL;
-bool   g_bIsRunning  = false;
+HANDLE g_hStopEvent  = NULL;
 std::vector<std::wstring> g_lastKnownTabs;
 static volatile LONG g_restoreScheduled = 0;
+UINT_PTR g_saveTimerId = 0;
+
+// {FE4106E0-399A-11D0-A48C-00A0C90A8F39}
+static const GUID XIID_DShellWindowsEvents = {0xFE4106E0, 0x399A, 0x11D0, {0xA4, 0x8C, 0x00, 0xA0, 0xC9, 0x0A, 0x8F, 0x39}};
 
 std::wstring GetTabListFilePath() {
     wchar_t modPathBuffer[MAX_PATH];
@@ -110,12 +121,30 @@ void WriteTabsToFile(const std::vector<std::wstring>& tabs) {
     std::wstring filePath = GetTabListFilePath();
     if (filePath.empty()) return;
 
-    std::wofstream tabFile(filePath.c_str());
-    if (tabFile.is_open()) {
+    // write to a temporary file and rename it over the old one, so that a
+    // crash or a restart in the middle of writing can't lose the session
+    std::wstring tempFilePath = filePath + L".tmp";
+    {
+        std::wofstream tabFile(tempFilePath.c_str());
+        if (!tabFile.is_open()) return;
+
         for (const auto& tab : tabs) {
-            tabFile << tab << std::endl;
+            tabFile << tab << L'\n';
+        }
+
+        tabFile.flush();
+        if (!tabFile) {
+            Wh_Log(L"Failed to write tab list.");
+            tabFile.close();
+            DeleteFileW(tempFilePath.c_str());
+            return;
         }
     }
+
+    if (!MoveFileExW(tempFilePath.c_str(), filePath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Wh_Log(L"Failed to replace tab list: %u", GetLastError());
+        DeleteFileW(tempFilePath.c_str());
+    }
 }
 
 void RestoreTabs() {
@@ -134,16 +163,41 @@ void RestoreTabs() {
 
     DeleteFileW(filePath.c_str());
 
-    if (paths.empty()) return;
-
+    // resolve all paths up front, dropping duplicates and folders which no
+    // longer exist, so that the actual opening isn't interleaved with disk
+    // access or blocked by error dialogs
+    std::vector<PIDLIST_ABSOLUTE> pidls;
+    std::vector<std::wstring> seen;
     for (const auto& path : paths) {
+        if (std::find_if(seen.begin(), seen.end(), [&](const std::wstring& p) { return lstrcmpiW(p.c_str(), path.c_str()) == 0; }) != seen.end()) {
+            continue;
+        }
+        seen.push_back(path);
+
+        if (!PathIsDirectoryW(path.c_str())) {
+            Wh_Log(L"Skipping missing folder: %s", path.c_str());
+            continue;
+        }
+
+        PIDLIST_ABSOLUTE pidl = ILCreateFromPathW(path.c_str());
+        if (pidl) pidls.push_back(pidl);
+    }
+
+    if (pidls.empty()) return;
+
+    Wh_Log(L"Restoring %d tabs.", (int)pidls.size());
+
+    for (PIDLIST_ABSOLUTE pidl : pidls) {
         SHELLEXECUTEINFOW sei = { sizeof(sei) };
-        sei.fMask = SEE_MASK_DEFAULT;
+        sei.fMask = SEE_MASK_IDLIST | SEE_MASK_FLAG_NO_UI;
         sei.lpVerb = L"open";
-        sei.lpFile = path.c_str();
+        sei.lpIDList = pidl;
         sei.nShow = SW_SHOWNORMAL;
         ShellExecuteExW(&sei);
-        Sleep(50);
+    }
+
+    for (PIDLIST_ABSOLUTE pidl : pidls) {
+        ILFree(pidl);
     }
 }
 
@@ -194,30 +248,140 @@ HWND WINAPI CreateWindowExW_Hook(
     return hwnd;
 }
 
+void SaveTabs() {
+    std::vector<std::wstring> currentTabs = GetCurrentTabs();
+
+    if (currentTabs != g_lastKnownTabs) {
+        if (currentTabs.empty() && !g_lastKnownTabs.empty()) {
+            WriteTabsToFile(g_lastKnownTabs);
+            Wh_Log(L"Last explorer window closed, saving final session.");
+        }
+        else {
+            WriteTabsToFile(currentTabs);
+        }
+
+        g_lastKnownTabs = currentTabs;
+    }
+
+    if (currentTabs.empty()) {
+        InterlockedExchange(&g_restoreScheduled, 0);
+    }
+}
+
+void ScheduleSave() {
+    // restart the timer, so that a burst of notifications results in a single
+    // tab enumeration
+    if (g_saveTimerId) {
+        KillTimer(NULL, g_saveTimerId);
+    }
+    g_saveTimerId = SetTimer(NULL, 0, SAVE_DELAY, NULL);
+}
+
+// Receives DShellWindowsEvents, which are fired when a tab or a window is
+// opened or closed.
+class ShellWindowsEventSink : public IDispatch {
+public:
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv) override {
+        if (riid == IID_IUnknown || riid == IID_IDispatch || riid == XIID_DShellWindowsEvents) {
+            *ppv = static_cast<IDispatch*>(this);
+            return S_OK;
+        }
+        *ppv = NULL;
+        return E_NOINTERFACE;
+    }
+
+    // the sink is a static object
+    STDMETHODIMP_(ULONG) AddRef() override { return 1; }
+    STDMETHODIMP_(ULONG) Release() override { return 1; }
+
+    STDMETHODIMP GetTypeInfoCount(UINT* pctinfo) override {
+        *pctinfo = 0;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetTypeInfo(UINT, LCID, ITypeInfo**) override { return E_NOTIMPL; }
+
+    STDMETHODIMP GetIDsOfNames(REFIID, LPOLESTR*, UINT, LCID, DISPID*) override { return E_NOTIMPL; }
+
+    STDMETHODIMP Invoke(DISPID dispIdMember, REFIID, LCID, WORD, DISPPARAMS*, VARIANT*, EXCEPINFO*, UINT*) override {
+        if (dispIdMember == DISPID_WINDOWREGISTERED || dispIdMember == DISPID_WINDOWREVOKED) {
+            ScheduleSave();
+        }
+        return S_OK;
+    }
+};
+
+ShellWindowsEventSink g_shellWindowsEventSink;
+
+// navigating a tab or switching to another one renames its window
+void CALLBACK WinEventProc(HWINEVENTHOOK, DWORD, HWND hwnd, LONG idObject, LONG, DWORD, DWORD) {
+    if (idObject != OBJID_WINDOW || !hwnd) return;
+
+    wchar_t className[64];
+    if (GetClassNameW(hwnd, className, ARRAYSIZE(className)) && lstrcmpW(className, L"CabinetWClass") == 0) {
+        ScheduleSave();
+    }
+}
+
 DWORD WINAPI MainThread(LPVOID) {
     CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 
-    while (g_bIsRunning) {
-        std::vector<std::wstring> currentTabs = GetCurrentTabs();
-        
-        if (currentTabs != g_lastKnownTabs) {
-            if (currentTabs.empty() && !g_lastKnownTabs.empty()) {
-                WriteTabsToFile(g_lastKnownTabs);
-                Wh_Log(L"Last explorer window closed, saving final session.");
-            }
-            else {
-                WriteTabsToFile(currentTabs);
+    IShellWindows* pShellWindows = NULL;
+    IConnectionPoint* pConnectionPoint = NULL;
+    DWORD adviseCookie = 0;
+    if (SUCCEEDED(CoCreateInstance(CLSID_ShellWindows, NULL, CLSCTX_ALL, IID_PPV_ARGS(&pShellWindows)))) {
+        IConnectionPointContainer* pContainer = NULL;
+        if (SUCCEEDED(pShellWindows->QueryInterface(IID_PPV_ARGS(&pContainer)))) {
+            if (SUCCEEDED(pContainer->FindConnectionPoint(XIID_DShellWindowsEvents, &pConnectionPoint))) {
+                if (FAILED(pConnectionPoint->Advise(&g_shellWindowsEventSink, &adviseCookie))) {
+                    adviseCookie = 0;
+                }
             }
-            
-            g_lastKnownTabs = currentTabs;
+            pContainer->Release();
         }
+    }
+
+    HWINEVENTHOOK hWinEventHook = SetWinEventHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, NULL, WinEventProc, GetCurrentProcessId(), 0, WINEVENT_OUTOFCONTEXT);
+
+    UINT_PTR pollTimerId = 0;
+    if (!adviseCookie || !hWinEventHook) {
+        Wh_Log(L"Shell window events unavailable, falling back to polling.");
+        pollTimerId = SetTimer(NULL, 0, POLL_INTERVAL, NULL);
+    }
+
+    SaveTabs();
 
-        if (currentTabs.empty()) {
-            InterlockedExchange(&g_restoreScheduled, 0);
+    for (;;) {
+        DWORD waitResult = MsgWaitForMultipleObjects(1, &g_hStopEvent, FALSE, INFINITE, QS_ALLINPUT);
+        if (waitResult != WAIT_OBJECT_0 + 1) break;
+
+        MSG msg;
+        while (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (msg.message == WM_TIMER && !msg.hwnd && (msg.wParam == g_saveTimerId || msg.wParam == pollTimerId)) {
+                if (msg.wParam == g_saveTimerId) {
+                    KillTimer(NULL, g_saveTimerId);
+                    g_saveTimerId = 0;
+                }
+                SaveTabs();
+                continue;
+            }
+
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
         }
+    }
 
-        Sleep(2000);
+    if (hWinEventHook) UnhookWinEvent(hWinEventHook);
+    if (pollTimerId) KillTimer(NULL, pollTimerId);
+    if (g_saveTimerId) {
+        KillTimer(NULL, g_saveTimerId);
+        g_saveTimerId = 0;
+    }
+    if (pConnectionPoint) {
+        if (adviseCookie) pConnectionPoint->Unadvise(adviseCookie);
+        pConnectionPoint->Release();
     }
+    if (pShellWindows) pShellWindows->Release();
 
     CoUninitialize();
     return 0;
@@ -229,7 +393,7 @@ BOOL Wh_ModInit() {
 
     Wh_SetFunctionHook((void*)CreateWindowExW, (void*)CreateWindowExW_Hook, (void**)&pCreateWindowExW_Orig);
     
-    g_bIsRunning = true;
+    g_hStopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
     g_hMainThread = CreateThread(NULL, 0, MainThread, NULL, 0, NULL);
     
     return TRUE;
@@ -238,10 +402,14 @@ BOOL Wh_ModInit() {
 void Wh_ModUninit() {
     Wh_Log(L"Uninitializing Explorer Tabs Session Saver...");
 
-    g_bIsRunning = false;
+    if (g_hStopEvent) SetEvent(g_hStopEvent);
     if (g_hMainThread) {
         WaitForSingleObject(g_hMainThread, 2500);
         CloseHandle(g_hMainThread);
         g_hMainThread = NULL;
     }
+    if (g_hStopEvent) {
+        CloseHandle(g_hStopEvent);
+        g_hStopEvent = NULL;
+    }
 }
\ No newline at end of file
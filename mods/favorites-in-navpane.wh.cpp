@@ -2,7 +2,7 @@
 // @id              favorites-in-navpane
 // @name            Favorites in Navigation Pane
 // @description     Replaces Windows 10 Quick Access with Favorites in Navigation Pane
-// @version         1.0.3
+// @version         1.0.4
 // @author          xalejandro
 // @github          https://github.com/tetawaves
 // @include         *
@@ -85,13 +85,79 @@ bool EndsWith(const wchar_t *str, const wchar_t *suffix)
     return 0 == wcsnicmp(str + lenstr - lensuffix, suffix, lensuffix);
 }
 
+// Order writes are coalesced and done on a thread pool thread, since dragging
+// favorites around saves the order after every change. The lock also keeps a
+// newer order from being overwritten by an older one.
+SRWLOCK g_pendingOrderLock = SRWLOCK_INIT;
+BYTE *g_lpPendingOrder = nullptr;
+DWORD g_cbPendingOrder = 0;
+PTP_TIMER g_pOrderWriteTimer = nullptr;
+const LONGLONG c_llOrderWriteDelay = -500 * 10000LL; // 500 ms, relative
+
+HRESULT WriteOrderRegistryData(const BYTE *lpData, DWORD cbData)
+{
+    HKEY hKey;
+    HRESULT hr = HRESULT_FROM_WIN32(RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\Modules\\CommonPlaces\\", 0, KEY_SET_VALUE, &hKey));
+    if (SUCCEEDED(hr))
+    {
+        hr = HRESULT_FROM_WIN32(RegSetValueExW(hKey, L"Order", 0, REG_BINARY, lpData, cbData));
+        RegCloseKey(hKey);
+    }
+    return hr;
+}
+
+void FlushPendingOrder()
+{
+    AcquireSRWLockExclusive(&g_pendingOrderLock);
+    if (g_lpPendingOrder)
+    {
+        if (FAILED(WriteOrderRegistryData(g_lpPendingOrder, g_cbPendingOrder)))
+        {
+            Wh_Log(L"Failed to write order list into registry");
+        }
+        delete[] g_lpPendingOrder;
+        g_lpPendingOrder = nullptr;
+        g_cbPendingOrder = 0;
+    }
+    ReleaseSRWLockExclusive(&g_pendingOrderLock);
+}
+
+VOID CALLBACK OrderWriteTimerCallback(PTP_CALLBACK_INSTANCE, PVOID, PTP_TIMER)
+{
+    FlushPendingOrder();
+}
+
+// Takes ownership of lpData
+void QueueOrderWrite(BYTE *lpData, DWORD cbData)
+{
+    AcquireSRWLockExclusive(&g_pendingOrderLock);
+    delete[] g_lpPendingOrder;
+    g_lpPendingOrder = lpData;
+    g_cbPendingOrder = cbData;
+    ReleaseSRWLockExclusive(&g_pendingOrderLock);
+
+    if (g_pOrderWriteTimer)
+    {
+        ULARGE_INTEGER ulDueTime;
+        ulDueTime.QuadPart = (ULONGLONG)c_llOrderWriteDelay;
+        FILETIME ftDueTime;
+        ftDueTime.dwLowDateTime = ulDueTime.LowPart;
+        ftDueTime.dwHighDateTime = ulDueTime.HighPart;
+        SetThreadpoolTimer(g_pOrderWriteTimer, &ftDueTime, 0, 0);
+    }
+    else
+    {
+        FlushPendingOrder();
+    }
+}
+
 HRESULT WriteOrderRegistry(IStream *pStream)
 {
     ULARGE_INTEGER streamSize;
     HRESULT hr = IStream_Size(pStream, &streamSize);    
     if (SUCCEEDED(hr))
     {
-        LARGE_INTEGER zero;
+        LARGE_INTEGER zero = {};
         hr = pStream->Seek(zero, STREAM_SEEK_SET, nullptr);
         if (SUCCEEDED(hr))
         {
@@ -99,15 +165,12 @@ HRESULT WriteOrderRegistry(IStream *pStream)
             hr = pStream->Read(lpData, streamSize.QuadPart, nullptr);
             if (SUCCEEDED(hr)) 
             {
-                HKEY hKey;
-                hr = HRESULT_FROM_WIN32(RegOpenKeyExW(HKEY_CURRENT_USER, L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\Modules\\CommonPlaces\\", 0, KEY_SET_VALUE, &hKey));
-                if (SUCCEEDED(hr))
-                {
-                    hr = HRESULT_FROM_WIN32(RegSetValueExW(hKey, L"Order", 0, REG_BINARY, lpData, streamSize.QuadPart));
-                    RegCloseKey(hKey);
-                }
+                QueueOrderWrite(lpData, (DWORD)streamSize.QuadPart);
+            }
+            else
+            {
+                delete[] lpData;
             }
-            delete[] lpData;
         }
     }
 
@@ -234,6 +297,8 @@ HRESULT STDCALL CProperTreeHost_GetOrderStream_hook(void *pThis, IShellItem *pIS
 {
     if (IsIShellItemFavorites(pIShellItem))
     {
+        // Don't read back an order that is still waiting to be written
+        FlushPendingOrder();
         *ppStream = SHOpenRegStream2W(HKEY_CURRENT_USER, L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\Modules\\CommonPlaces\\", L"Order", grfMode);
         return 0;
     }
@@ -278,7 +343,7 @@ HRESULT __fastcall OrderList_SaveToStream_hook(IStream *pStream, HDPA hdpa, IShe
 
     if (FAILED(WriteOrderRegistry(pStream)))
     {
-        Wh_Log(L"Failed to write order list into registry");
+        Wh_Log(L"Failed to read order list for the registry");
     }
 
     return hr;
@@ -390,5 +455,25 @@ BOOL Wh_ModInit() {
     Wh_SetFunctionHook((void*)GetProcAddress(LoadLibrary(L"kernelbase.dll"), "RegQueryValueExW"), 
                        (void*)RegQueryValueExW_hook, (void**)&RegQueryValueExW_orig);
 
+    g_pOrderWriteTimer = CreateThreadpoolTimer(OrderWriteTimerCallback, nullptr, nullptr);
+    if (!g_pOrderWriteTimer)
+    {
+        Wh_Log(L"Failed to create order write timer, writing synchronously");
+    }
+
     return TRUE;
 }
+
+void Wh_ModUninit() {
+    Wh_Log(L"Uninit");
+
+    if (g_pOrderWriteTimer)
+    {
+        SetThreadpoolTimer(g_pOrderWriteTimer, nullptr, 0, 0);
+        WaitForThreadpoolTimerCallbacks(g_pOrderWriteTimer, TRUE);
+        CloseThreadpoolTimer(g_pOrderWriteTimer);
+        g_pOrderWriteTimer = nullptr;
+    }
+
+    FlushPendingOrder();
+}
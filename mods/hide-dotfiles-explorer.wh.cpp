@@ -2,11 +2,11 @@
 // @id              hide-dotfiles-explorer
 // @name            Hide Dotfiles (Explorer only)
 // @description     Hide dotfiles and folders starting with . in Windows Explorer and Desktop
-// @version         1.0.1
+// @version         1.0.5
 // @author          @danalec
 // @github          https://github.com/danalec
 // @include         explorer.exe
-// @compilerOptions -lcomctl32 -lole32 -loleaut32 -lshell32 -lshlwapi
+// @compilerOptions -lcomctl32 -lole32 -loleaut32 -lshell32
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
@@ -42,8 +42,16 @@ Choose how dotfiles should be handled:
   - `?` matches exactly one character
   - Examples: `.env*` matches `.env`, `.env.local`, `.env.production`
 
+### Filter Scope
+Choose which directory listings are filtered:
+- **All enumerations**: Every directory listing in Explorer is filtered (default)
+- **Shell views only**: Only listings made by the shell for folder views, the
+  desktop and file dialogs are filtered. Other listings inside Explorer, such
+  as by shell extensions or thumbnail handlers, are left untouched
+
 ### Settings
 - **Display Mode**: How to handle dotfiles (Never show, Show as hidden, Show as system)
+- **Filter Scope**: Which directory listings are filtered (All enumerations, Shell views only)
 - **Dotfile Whitelist**: List of dotfile patterns to show (e.g., `.gitignore`, `.env*`, `.*.config`)
 - **Always Hide**: List of filename patterns to always hide, even if they don't start with a dot (e.g., `desktop.ini`, `Thumbs.db`, `*.tmp`)
 
@@ -71,6 +79,12 @@ Examples:
   - neverShow: Never show files (completely hidden)
   - showAsHidden: Show files as hidden (with hidden attribute)
   - showAsSystem: Show files as system (with hidden+system attributes)
+- filterScope: all
+  $name: Filter Scope
+  $description: Which directory listings in Explorer are filtered
+  $options:
+  - all: All enumerations
+  - shellViews: Shell views only (folder views, desktop, file dialogs)
 - dotfileWhitelist: [""]
   $name: Dotfile Whitelist
   $description: List of dotfile patterns to show
@@ -82,12 +96,19 @@ Examples:
 
 #include <windows.h>
 #include <shlobj.h>
-#include <shlwapi.h>
 #include <shobjidl.h>
 #include <winternl.h>
 #include <vector>
 #include <string>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 
 enum class DisplayMode {
     NeverShow,
@@ -95,12 +116,300 @@ enum class DisplayMode {
     ShowAsSystem
 };
 
+enum class FilterScope {
+    All,
+    ShellViews
+};
+
+// Matches file names against a list of patterns, with the same syntax as
+// PathMatchSpecW: case-insensitive, `*` and `?` wildcards, and several
+// patterns can be separated with `;`. The patterns are compiled once, so that
+// matching doesn't allocate and works directly on the names returned by
+// NtQueryDirectoryFile, which aren't null-terminated.
+class PatternMatcher {
+public:
+    void Compile(const std::vector<std::wstring>& patterns) {
+        m_matchAll = false;
+        m_storage.clear();
+        m_literals.clear();
+        m_prefixes.clear();
+        m_suffixes.clear();
+        m_wildcards.clear();
+
+        std::vector<std::wstring> specs;
+        for (const auto& pattern : patterns) {
+            std::wstring_view rest = pattern;
+            while (!rest.empty()) {
+                const size_t separator = rest.find(L';');
+                std::wstring_view spec = rest.substr(0, separator);
+                rest = separator == rest.npos ? std::wstring_view{} : rest.substr(separator + 1);
+
+                while (!spec.empty() && spec.front() == L' ') {
+                    spec.remove_prefix(1);
+                }
+
+                if (!spec.empty()) {
+                    specs.emplace_back(spec);
+                }
+            }
+        }
+
+        m_storage.reserve(specs.size());
+
+        for (auto& spec : specs) {
+            FoldCase(spec.data(), spec.size());
+
+            // PathMatchSpecW treats `*.*` as matching all names, including
+            // names without a dot.
+            if (spec == L"*" || spec == L"*.*") {
+                m_matchAll = true;
+                continue;
+            }
+
+            const size_t firstWildcard = spec.find_first_of(L"*?");
+            if (firstWildcard == spec.npos) {
+                m_literals.insert(m_storage.emplace_back(std::move(spec)));
+                continue;
+            }
+
+            const size_t lastWildcard = spec.find_last_of(L"*?");
+            if (firstWildcard == lastWildcard && spec[firstWildcard] == L'*') {
+                if (firstWildcard == spec.size() - 1) {
+                    spec.pop_back();
+                    m_prefixes.push_back(m_storage.emplace_back(std::move(spec)));
+                    continue;
+                }
+
+                if (firstWildcard == 0) {
+                    spec.erase(0, 1);
+                    m_suffixes.push_back(m_storage.emplace_back(std::move(spec)));
+                    continue;
+                }
+            }
+
+            m_wildcards.push_back(m_storage.emplace_back(std::move(spec)));
+        }
+    }
+
+    bool HasWildcards() const noexcept {
+        return !m_wildcards.empty();
+    }
+
+    bool IsEmpty() const noexcept {
+        return !m_matchAll && m_literals.empty() && m_prefixes.empty() &&
+               m_suffixes.empty() && m_wildcards.empty();
+    }
+
+    bool Matches(std::wstring_view name) const noexcept {
+        if (m_matchAll) {
+            return true;
+        }
+
+        if (IsEmpty()) {
+            return false;
+        }
+
+        // File names are at most 255 characters on common file systems, longer
+        // names aren't matched.
+        WCHAR buffer[512];
+        if (name.size() > ARRAYSIZE(buffer)) {
+            return false;
+        }
+
+        std::copy(name.begin(), name.end(), buffer);
+        FoldCase(buffer, name.size());
+        const std::wstring_view folded(buffer, name.size());
+
+        if (m_literals.contains(folded)) {
+            return true;
+        }
+
+        for (const auto prefix : m_prefixes) {
+            if (folded.starts_with(prefix)) {
+                return true;
+            }
+        }
+
+        for (const auto suffix : m_suffixes) {
+            if (folded.ends_with(suffix)) {
+                return true;
+            }
+        }
+
+        return std::ranges::any_of(m_wildcards, [folded](std::wstring_view pattern) {
+            return WildcardMatches(folded, pattern);
+        });
+    }
+
+private:
+    static void FoldCase(WCHAR* str, size_t length) noexcept {
+        CharLowerBuffW(str, static_cast<DWORD>(length));
+    }
+
+    // Matches with backtracking to the last `*` only, which is enough since a
+    // `*` can absorb any characters which a previous `*` would have.
+    static bool WildcardMatches(std::wstring_view name, std::wstring_view pattern) noexcept {
+        size_t n = 0;
+        size_t p = 0;
+        size_t starPattern = pattern.npos;
+        size_t starName = 0;
+
+        while (n < name.size()) {
+            if (p < pattern.size() && (pattern[p] == L'?' || pattern[p] == name[n])) {
+                n++;
+                p++;
+            } else if (p < pattern.size() && pattern[p] == L'*') {
+                starPattern = p++;
+                starName = n;
+            } else if (starPattern != pattern.npos) {
+                p = starPattern + 1;
+                n = ++starName;
+            } else {
+                return false;
+            }
+        }
+
+        while (p < pattern.size() && pattern[p] == L'*') {
+            p++;
+        }
+
+        return p == pattern.size();
+    }
+
+    bool m_matchAll = false;
+    // Owns the compiled patterns, the other members point into it. Reserved
+    // up front, so that the strings are never moved.
+    std::vector<std::wstring> m_storage;
+    std::unordered_set<std::wstring_view> m_literals;
+    std::vector<std::wstring_view> m_prefixes;
+    std::vector<std::wstring_view> m_suffixes;
+    std::vector<std::wstring_view> m_wildcards;
+};
+
 struct {
     DisplayMode displayMode = DisplayMode::NeverShow;
-    std::vector<std::wstring> dotfileWhitelist;
-    std::vector<std::wstring> alwaysHide;
+    FilterScope filterScope = FilterScope::All;
+    PatternMatcher dotfileWhitelist;
+    PatternMatcher alwaysHide;
 } g_settings;
 
+// Remembers whether names are hidden, since the same directories are
+// enumerated over and over by Explorer, Defender and indexers. Whether a name
+// is hidden only depends on the name and the settings, so the results are
+// valid in every directory until the settings change. Only used with wildcard
+// patterns, other patterns are matched with a lookup anyway.
+class HiddenNameCache {
+public:
+    static constexpr size_t kMaxEntries = 4096;
+
+    std::optional<bool> Get(std::wstring_view name) const noexcept {
+        std::shared_lock lock(m_mutex);
+        auto it = m_entries.find(name);
+        if (it == m_entries.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void Set(std::wstring_view name, bool hidden) noexcept {
+        std::unique_lock lock(m_mutex);
+        try {
+            if (m_entries.size() >= kMaxEntries) {
+                m_entries.clear();
+            }
+            m_entries.try_emplace(std::wstring(name), hidden);
+        } catch (...) {
+            // Out of memory, the name is matched again next time.
+        }
+    }
+
+    void Clear() noexcept {
+        std::unique_lock lock(m_mutex);
+        m_entries.clear();
+    }
+
+private:
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::wstring_view str) const noexcept {
+            return std::hash<std::wstring_view>{}(str);
+        }
+    };
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::wstring, bool, Hash, std::equal_to<>> m_entries;
+};
+
+HiddenNameCache g_hiddenNameCache;
+
+// The modules which enumerate folders for the shell views. Their address
+// ranges are resolved lazily, since they might not be loaded yet when the mod
+// is initialized, and are kept afterwards since they're never unloaded from
+// explorer.exe.
+constexpr PCWSTR kShellModules[] = {
+    L"windows.storage.dll",
+    L"shell32.dll",
+};
+
+struct ModuleRange {
+    std::atomic<bool> resolved;
+    std::atomic<uintptr_t> start;
+    std::atomic<uintptr_t> end;
+};
+
+ModuleRange g_shellModuleRanges[ARRAYSIZE(kShellModules)];
+
+bool GetShellModuleRange(size_t index, uintptr_t* start, uintptr_t* end) noexcept {
+    ModuleRange& range = g_shellModuleRanges[index];
+    if (!range.resolved.load(std::memory_order_acquire)) {
+        const HMODULE module = GetModuleHandleW(kShellModules[index]);
+        if (!module) {
+            return false;
+        }
+
+        const auto* dosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(module);
+        const auto* ntHeaders = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+            reinterpret_cast<const BYTE*>(module) + dosHeader->e_lfanew);
+        range.start.store(reinterpret_cast<uintptr_t>(module), std::memory_order_relaxed);
+        range.end.store(reinterpret_cast<uintptr_t>(module) + ntHeaders->OptionalHeader.SizeOfImage,
+                        std::memory_order_relaxed);
+        range.resolved.store(true, std::memory_order_release);
+    }
+
+    *start = range.start.load(std::memory_order_relaxed);
+    *end = range.end.load(std::memory_order_relaxed);
+    return true;
+}
+
+// Checks whether a shell module is among the recent callers. The shell views
+// enumerate through FindFirstFileEx and friends, so the shell module is a few
+// frames above the hook.
+bool IsCalledFromShell() noexcept {
+    void* frames[16];
+    const USHORT frameCount = RtlCaptureStackBackTrace(1, ARRAYSIZE(frames), frames, nullptr);
+
+    for (size_t i = 0; i < ARRAYSIZE(kShellModules); i++) {
+        uintptr_t start;
+        uintptr_t end;
+        if (!GetShellModuleRange(i, &start, &end)) {
+            continue;
+        }
+
+        for (USHORT frame = 0; frame < frameCount; frame++) {
+            const auto address = reinterpret_cast<uintptr_t>(frames[frame]);
+            if (address >= start && address < end) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool ShouldFilterForCaller() noexcept {
+    return g_settings.filterScope == FilterScope::All || IsCalledFromShell();
+}
+
 typedef NTSTATUS (NTAPI* NtQueryDirectoryFile_t)(
     HANDLE FileHandle,
     HANDLE Event,
@@ -133,9 +442,6 @@ typedef NTSTATUS (NTAPI* NtQueryDirectoryFileEx_t)(
 NtQueryDirectoryFileEx_t NtQueryDirectoryFileEx_Original;
 
 void ParseSettings() {
-    g_settings.dotfileWhitelist.clear();
-    g_settings.alwaysHide.clear();
-    
     PCWSTR displayModeStr = Wh_GetStringSetting(L"displayMode");
     if (wcscmp(displayModeStr, L"showAsHidden") == 0) {
         g_settings.displayMode = DisplayMode::ShowAsHidden;
@@ -145,21 +451,33 @@ void ParseSettings() {
         g_settings.displayMode = DisplayMode::NeverShow;
     }
     Wh_FreeStringSetting(displayModeStr);
+
+    PCWSTR filterScopeStr = Wh_GetStringSetting(L"filterScope");
+    if (wcscmp(filterScopeStr, L"shellViews") == 0) {
+        g_settings.filterScope = FilterScope::ShellViews;
+    } else {
+        g_settings.filterScope = FilterScope::All;
+    }
+    Wh_FreeStringSetting(filterScopeStr);
     
-    auto loadSettingList = [](const wchar_t* settingName, std::vector<std::wstring>& target) {
+    auto loadSettingList = [](const wchar_t* settingName, PatternMatcher& target) {
+        std::vector<std::wstring> patterns;
         for (int i = 0;; i++) {
             PCWSTR item = Wh_GetStringSetting(settingName, i);
             if (!*item) {
                 Wh_FreeStringSetting(item);
                 break;
             }
-            target.emplace_back(item);
+            patterns.emplace_back(item);
             Wh_FreeStringSetting(item);
         }
+        target.Compile(patterns);
     };
     
     loadSettingList(L"dotfileWhitelist[%d]", g_settings.dotfileWhitelist);
     loadSettingList(L"alwaysHide[%d]", g_settings.alwaysHide);
+
+    g_hiddenNameCache.Clear();
 }
 
 bool ShouldHideFile(std::wstring_view fileName) noexcept {
@@ -169,18 +487,23 @@ bool ShouldHideFile(std::wstring_view fileName) noexcept {
         return false;
     }
     
-    auto matchesPattern = [](std::wstring_view name, const std::vector<std::wstring>& patterns) noexcept -> bool {
-        std::wstring temp(name);
-        return std::ranges::any_of(patterns, [&temp](const std::wstring& pattern) {
-            return PathMatchSpecW(temp.c_str(), pattern.c_str()) != FALSE;
-        });
-    };
-    
-    if (fileName[0] == L'.') {
-        return !matchesPattern(fileName, g_settings.dotfileWhitelist);
+    const bool isDotfile = fileName[0] == L'.';
+    const PatternMatcher& matcher = isDotfile ? g_settings.dotfileWhitelist : g_settings.alwaysHide;
+
+    const bool useCache = matcher.HasWildcards();
+    if (useCache) {
+        if (auto hidden = g_hiddenNameCache.Get(fileName)) {
+            return *hidden;
+        }
     }
-    
-    return matchesPattern(fileName, g_settings.alwaysHide);
+
+    const bool hidden = isDotfile ? !matcher.Matches(fileName) : matcher.Matches(fileName);
+
+    if (useCache) {
+        g_hiddenNameCache.Set(fileName, hidden);
+    }
+
+    return hidden;
 }
 
 template<typename FileInfoType>
@@ -190,53 +513,70 @@ void FilterFilesInDirectory(void* FileInformation, ULONG_PTR* bytesReturned) noe
     }
     
     if (g_settings.displayMode == DisplayMode::NeverShow) {
-        auto* currentEntry = static_cast<FileInfoType*>(FileInformation);
-        auto* writeEntry = currentEntry;
-        ULONG_PTR totalBytesRead = 0;
-        ULONG_PTR totalBytesWritten = 0;
-        
-        const auto* const bufferEnd = reinterpret_cast<const BYTE*>(FileInformation) + *bytesReturned;
-        
-        while (totalBytesRead < *bytesReturned) {
+        // Survivors are compacted forward in a single pass. Consecutive
+        // survivors are moved together, so a listing with few hidden entries
+        // costs few moves, and the last survivor is remembered to end the
+        // chain without walking it again.
+        auto* const buffer = static_cast<BYTE*>(FileInformation);
+        const ULONG_PTR bufferSize = *bytesReturned;
+        const bool hasAlwaysHide = !g_settings.alwaysHide.IsEmpty();
+
+        ULONG_PTR readOffset = 0;
+        ULONG_PTR writeOffset = 0;
+        ULONG_PTR runStart = 0;
+        ULONG_PTR runLength = 0;
+        FileInfoType* lastKeptEntry = nullptr;
+
+        auto flushRun = [&]() noexcept {
+            if (runLength == 0) {
+                return;
+            }
+            if (writeOffset != runStart) {
+                std::memmove(buffer + writeOffset, buffer + runStart, runLength);
+            }
+            writeOffset += runLength;
+            runLength = 0;
+        };
+
+        while (readOffset < bufferSize) {
+            auto* currentEntry = reinterpret_cast<FileInfoType*>(buffer + readOffset);
             const ULONG nextEntryOffset = currentEntry->NextEntryOffset;
-            const ULONG currentEntrySize = nextEntryOffset ? nextEntryOffset : (*bytesReturned - totalBytesRead);
+            const ULONG_PTR currentEntrySize = nextEntryOffset ? nextEntryOffset : (bufferSize - readOffset);
             
             const ULONG fileNameLength = currentEntry->FileNameLength / sizeof(WCHAR);
-            const std::wstring_view fileName(currentEntry->FileName, fileNameLength);
-            
-            const bool shouldHide = fileNameLength > 0 && ShouldHideFile(fileName);
+
+            // Most names don't start with a dot, and without always-hide
+            // patterns they can't be hidden, so skip the full check.
+            const bool shouldHide = fileNameLength > 0 &&
+                (currentEntry->FileName[0] == L'.' || hasAlwaysHide) &&
+                ShouldHideFile(std::wstring_view(currentEntry->FileName, fileNameLength));
             
-            if (!shouldHide) {
-                if (writeEntry != currentEntry) {
-                    std::memmove(writeEntry, currentEntry, currentEntrySize);
+            if (shouldHide) {
+                flushRun();
+            } else {
+                if (runLength == 0) {
+                    runStart = readOffset;
                 }
-                totalBytesWritten += currentEntrySize;
-                writeEntry = reinterpret_cast<FileInfoType*>(reinterpret_cast<BYTE*>(writeEntry) + currentEntrySize);
+                // The entry's position after the pending run is moved.
+                lastKeptEntry = reinterpret_cast<FileInfoType*>(
+                    buffer + writeOffset + (readOffset - runStart));
+                runLength += currentEntrySize;
             }
             
-            totalBytesRead += currentEntrySize;
-            
-            if (nextEntryOffset == 0 || 
-                reinterpret_cast<const BYTE*>(currentEntry) + nextEntryOffset >= bufferEnd) {
+            if (nextEntryOffset == 0 || readOffset + nextEntryOffset >= bufferSize) {
                 break;
             }
             
-            currentEntry = reinterpret_cast<FileInfoType*>(
-                reinterpret_cast<BYTE*>(currentEntry) + nextEntryOffset);
+            readOffset += nextEntryOffset;
         }
+
+        flushRun();
         
-        if (totalBytesWritten > 0) {
-            auto* lastEntry = static_cast<FileInfoType*>(FileInformation);
-            while (lastEntry->NextEntryOffset && 
-                   reinterpret_cast<BYTE*>(lastEntry) + lastEntry->NextEntryOffset < 
-                   reinterpret_cast<BYTE*>(FileInformation) + totalBytesWritten) {
-                lastEntry = reinterpret_cast<FileInfoType*>(
-                    reinterpret_cast<BYTE*>(lastEntry) + lastEntry->NextEntryOffset);
-            }
-            lastEntry->NextEntryOffset = 0;
+        if (lastKeptEntry) {
+            lastKeptEntry->NextEntryOffset = 0;
         }
         
-        *bytesReturned = totalBytesWritten;
+        *bytesReturned = writeOffset;
     } else if constexpr (requires(FileInfoType t) { t.FileAttributes; }) {
             auto* currentEntry = static_cast<FileInfoType*>(FileInformation);
             ULONG_PTR totalBytesRead = 0;
@@ -323,7 +663,7 @@ NTSTATUS NTAPI NtQueryDirectoryFile_Hook(
         FileInformation, Length, FileInformationClass,
         ReturnSingleEntry, FileName, RestartScan);
     
-    if (NT_SUCCESS(status) && IoStatusBlock && FileInformation) {
+    if (NT_SUCCESS(status) && IoStatusBlock && FileInformation && ShouldFilterForCaller()) {
         ULONG_PTR bytesReturned = IoStatusBlock->Information;
         ProcessDirectoryListing(FileInformation, FileInformationClass, &bytesReturned);
         IoStatusBlock->Information = bytesReturned;
@@ -349,7 +689,7 @@ NTSTATUS NTAPI NtQueryDirectoryFileEx_Hook(
         FileInformation, Length, FileInformationClass,
         QueryFlags, FileName);
     
-    if (NT_SUCCESS(status) && IoStatusBlock && FileInformation) {
+    if (NT_SUCCESS(status) && IoStatusBlock && FileInformation && ShouldFilterForCaller()) {
         ULONG_PTR bytesReturned = IoStatusBlock->Information;
         ProcessDirectoryListing(FileInformation, FileInformationClass, &bytesReturned);
         IoStatusBlock->Information = bytesReturned;
@@ -2,7 +2,7 @@
 // @id hide-unc
 // @name Hide Network UNC Paths in Explorer
 // @description Removes UNC paths from network drives in Explorer and dialogs
-// @version 1.0.5
+// @version 1.0.6
 // @author @danalec
 // @github https://github.com/danalec
 // @include explorer.exe
@@ -76,6 +76,23 @@ void CleanUNCPath(LPWSTR text, size_t maxLen) {
     }
 }
 
+// Same as CleanUNCPath but for buffers the caller owns, e.g. CoTaskMem display
+// names. The cleaned text is never longer than the original, so it's rewritten in
+// place without reallocating. Returns false if there was nothing to remove.
+bool CleanUNCPathInPlace(LPWSTR text) {
+    if (!text || !*text) return false;
+    if (wcsncmp(text, L"(\\\\", 3) == 0) return false;
+    WCHAR* unc = wcsstr(text, L" (\\\\");
+    if (!unc) return false;
+    WCHAR* closing = wcschr(unc, L')');
+    if (closing) {
+        wmemmove(unc, closing + 1, wcslen(closing + 1) + 1);
+    } else {
+        *unc = L'\0';
+    }
+    return true;
+}
+
 typedef HRESULT (WINAPI *SHCreateItemFromParsingName_t)(PCWSTR pszPath, IBindCtx *pbc, REFIID riid, void **ppv);
 SHCreateItemFromParsingName_t SHCreateItemFromParsingName_Original;
 
@@ -84,15 +101,8 @@ GetDisplayName_t GetDisplayName_Original = NULL;
 
 HRESULT STDMETHODCALLTYPE GetDisplayName_Hook(void* pThis, SIGDN sigdnName, LPWSTR *ppszName) {
     HRESULT hr = GetDisplayName_Original(pThis, sigdnName, ppszName);
-    if (SUCCEEDED(hr) && ppszName && *ppszName && wcsstr(*ppszName, L" (\\\\")) {
-        size_t len = wcslen(*ppszName) + 1;
-        WCHAR* cleanCopy = (WCHAR*)CoTaskMemAlloc(len * sizeof(WCHAR));
-        if (cleanCopy) {
-            wcscpy_s(cleanCopy, len, *ppszName);
-            CleanUNCPath(cleanCopy, len);
-            CoTaskMemFree(*ppszName);
-            *ppszName = cleanCopy;
-        }
+    if (SUCCEEDED(hr) && ppszName) {
+        CleanUNCPathInPlace(*ppszName);
     }
     return hr;
 }
@@ -229,20 +239,15 @@ GetDisplayNameOf_t GetDisplayNameOf_Original = NULL;
 HRESULT STDMETHODCALLTYPE GetDisplayNameOf_Hook(void* pThis, PCUITEMID_CHILD pidl, SHGDNF uFlags, STRRET *pName) {
     HRESULT hr = GetDisplayNameOf_Original(pThis, pidl, uFlags, pName);
     if (SUCCEEDED(hr) && pName) {
-        if (pName->uType == STRRET_WSTR && pName->pOleStr && wcsstr(pName->pOleStr, L" (\\\\")) {
-            size_t len = wcslen(pName->pOleStr) + 1;
-            WCHAR* buffer = (WCHAR*)CoTaskMemAlloc(len * sizeof(WCHAR));
-            if (buffer) {
-                wcscpy_s(buffer, len, pName->pOleStr);
-                CleanUNCPath(buffer, len);
-                CoTaskMemFree(pName->pOleStr);
-                pName->pOleStr = buffer;
-            }
-        } else if (pName->uType == STRRET_CSTR) {
-            WCHAR szDisplay[32768];
-            int wideLen = MultiByteToWideChar(CP_ACP, 0, pName->cStr, -1, szDisplay, 32768);
-            if (wideLen > 0 && wcsstr(szDisplay, L" (\\\\")) {
-                CleanUNCPath(szDisplay, 32768);
+        if (pName->uType == STRRET_WSTR) {
+            CleanUNCPathInPlace(pName->pOleStr);
+        } else if (pName->uType == STRRET_CSTR && strstr(pName->cStr, " (\\\\")) {
+            // The ANSI check is exact, as none of these bytes can be a DBCS lead byte and
+            // neither the space nor '(' can be a trail byte. Only names that need
+            // cleaning pay for the conversion.
+            WCHAR szDisplay[ARRAYSIZE(pName->cStr)];
+            int wideLen = MultiByteToWideChar(CP_ACP, 0, pName->cStr, -1, szDisplay, ARRAYSIZE(szDisplay));
+            if (wideLen > 0 && CleanUNCPathInPlace(szDisplay)) {
                 WideCharToMultiByte(CP_ACP, 0, szDisplay, -1, pName->cStr, sizeof(pName->cStr), NULL, NULL);
             }
         }
@@ -2,7 +2,7 @@
 // @id              icon-resource-redirect
 // @name            Resource Redirect
 // @description     Define alternative files for loading various resources (e.g. icons in imageres.dll) for simple theming without having to modify system files
-// @version         1.2.2
+// @version         1.2.6
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -319,16 +319,18 @@ The resource lookup order then becomes:
 #include <psapi.h>
 #include <shldisp.h>
 #include <shlobj.h>
+#include <winternl.h>
 #include <winrt/base.h>
 
 #include <atomic>
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <shared_mutex>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -341,19 +343,229 @@ struct {
     bool allResourceRedirect;
 } g_settings;
 
-std::shared_mutex g_redirectionResourcePathsMutex;
-thread_local bool g_redirectionResourcePathsMutexLocked;
-std::unordered_map<std::wstring, std::vector<std::wstring>>
-    g_redirectionResourcePaths;
-std::unordered_map<std::string, std::vector<std::string>>
-    g_redirectionResourcePathsA;
-std::vector<std::pair<std::wstring, std::wstring>>
-    g_redirectionResourcePathPatterns;
-std::vector<std::pair<std::string, std::string>>
-    g_redirectionResourcePathPatternsA;
+// Allows looking up string keys with a string view, without creating a string.
+template <typename T>
+struct StringViewHash {
+    using is_transparent = void;
+
+    size_t operator()(std::basic_string_view<T> str) const {
+        return std::hash<std::basic_string_view<T>>{}(str);
+    }
+};
+
+template <typename T, typename Value>
+using StringMap = std::unordered_map<std::basic_string<T>,
+                                     Value,
+                                     StringViewHash<T>,
+                                     std::equal_to<>>;
+
+// The RT_STRING blocks of a loaded module, located on first use. Each block
+// holds 16 length-prefixed strings, and the cached pointers point into the
+// module's resources. The block slots are allocated in pages on first use,
+// since most modules only have a few blocks. Pages and blocks are never freed
+// while the cache exists, so lookups don't need locking.
+class StringTableCache {
+   public:
+    explicit StringTableCache(HMODULE module) : m_module(module) {}
+
+    ~StringTableCache() {
+        for (auto& pageSlot : m_pages) {
+            const Page* page = pageSlot;
+            if (!page) {
+                continue;
+            }
+
+            for (auto& block : page->blocks) {
+                const Block* value = block;
+                if (value && value != &kMissingBlock) {
+                    delete value;
+                }
+            }
+
+            delete page;
+        }
+    }
+
+    HMODULE Module() const { return m_module; }
+
+    // Returns the length-prefixed string, or nullptr if it doesn't exist.
+    PCWSTR Find(UINT uId) {
+        UINT blockIndex = uId / 16;
+        auto& pageSlot = m_pages[blockIndex / kBlocksPerPage];
+        Page* page = pageSlot;
+        if (!page) {
+            auto* newPage = new Page{};
+            if (pageSlot.compare_exchange_strong(page, newPage)) {
+                page = newPage;
+            } else {
+                delete newPage;
+            }
+        }
+
+        auto& slot = page->blocks[blockIndex % kBlocksPerPage];
+        const Block* block = slot;
+        if (!block) {
+            const Block* newBlock = LoadBlock(blockIndex);
+            if (slot.compare_exchange_strong(block, newBlock)) {
+                block = newBlock;
+            } else if (newBlock != &kMissingBlock) {
+                delete newBlock;
+            }
+        }
+
+        return block->strings[uId & 15];
+    }
+
+    static constexpr UINT kMaxId = 0xFFFF;
+
+   private:
+    struct Block {
+        PCWSTR strings[16];
+    };
+
+    static constexpr UINT kBlockCount = kMaxId / 16 + 1;
+    static constexpr UINT kBlocksPerPage = 64;
+
+    struct Page {
+        std::atomic<const Block*> blocks[kBlocksPerPage]{};
+    };
+
+    const Block* LoadBlock(UINT blockIndex) const {
+        HRSRC hrsrc = FindResourceEx(m_module, RT_STRING,
+                                     MAKEINTRESOURCE(blockIndex + 1), 0);
+        HGLOBAL hglob = hrsrc ? LoadResource(m_module, hrsrc) : nullptr;
+        auto pwsz =
+            hglob ? reinterpret_cast<PCWSTR>(LockResource(hglob)) : nullptr;
+        if (!pwsz) {
+            return &kMissingBlock;
+        }
+
+        // Strings which don't fit in the resource, e.g. in a malformed
+        // module, are treated as missing.
+        PCWSTR end = pwsz + SizeofResource(m_module, hrsrc) / sizeof(WCHAR);
 
-std::shared_mutex g_redirectionResourceModulesMutex;
-std::unordered_map<std::wstring, HMODULE> g_redirectionResourceModules;
+        auto* block = new Block{};
+        for (UINT i = 0; i < 16 && pwsz < end; i++) {
+            PCWSTR next = pwsz + 1 + (UINT)*pwsz;
+            if (next > end) {
+                break;
+            }
+
+            block->strings[i] = pwsz;
+            pwsz = next;
+        }
+
+        return block;
+    }
+
+    static inline const Block kMissingBlock{};
+
+    HMODULE m_module;
+    std::atomic<Page*> m_pages[kBlockCount / kBlocksPerPage]{};
+};
+
+// A file which resources are redirected to. The module is loaded on first use.
+// If loading fails, e.g. because the file is missing, it's not tried again
+// until the settings change, to avoid opening the file for every resource.
+struct RedirectionTarget {
+    std::wstring path;
+    mutable std::atomic<HMODULE> module;
+    mutable std::atomic<bool> loadFailed;
+    // Created on the first string lookup, and replaced if the module is freed
+    // and loaded again at another address.
+    mutable std::atomic<StringTableCache*> stringTableCache;
+    // Replaced caches, which other threads might still be reading.
+    mutable std::mutex retiredStringTableCachesMutex;
+    mutable std::vector<std::unique_ptr<StringTableCache>>
+        retiredStringTableCaches;
+
+    ~RedirectionTarget() { delete stringTableCache.load(); }
+};
+
+// A set of module handles which can be read without locking. Lookups and
+// insertions probe a few slots only, and handles which don't fit aren't added.
+class ModuleHandleSet {
+   public:
+    bool Contains(HMODULE module) const {
+        size_t index = Hash(module);
+        for (size_t i = 0; i < kMaxProbes; i++) {
+            HMODULE slot = m_slots[(index + i) % kSize];
+            if (slot == module) {
+                return true;
+            }
+
+            if (!slot) {
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    void Add(HMODULE module) {
+        size_t index = Hash(module);
+        for (size_t i = 0; i < kMaxProbes; i++) {
+            auto& slot = m_slots[(index + i) % kSize];
+            HMODULE value = slot;
+            if (value == module) {
+                return;
+            }
+
+            if ((!value || value == kRemoved) &&
+                slot.compare_exchange_strong(value, module)) {
+                return;
+            }
+        }
+    }
+
+    void Remove(HMODULE module) {
+        size_t index = Hash(module);
+        for (size_t i = 0; i < kMaxProbes; i++) {
+            auto& slot = m_slots[(index + i) % kSize];
+            HMODULE value = module;
+            if (slot.compare_exchange_strong(value, kRemoved) || !value) {
+                return;
+            }
+        }
+    }
+
+   private:
+    static constexpr size_t kSize = 256;
+    static constexpr size_t kMaxProbes = 8;
+
+    // Module handles are aligned to 64 KB, so this value is never a module.
+    static inline const HMODULE kRemoved = reinterpret_cast<HMODULE>(1);
+
+    static size_t Hash(HMODULE module) {
+        return (reinterpret_cast<ULONG_PTR>(module) >> 16) % kSize;
+    }
+
+    std::atomic<HMODULE> m_slots[kSize]{};
+};
+
+// The configured redirections, with upper-cased keys. A published instance is
+// never modified, so that the hooks can use it without locking. Replaced
+// instances are kept until the mod is unloaded, since hooks on other threads
+// might still be using them.
+struct RedirectionResources {
+    StringMap<WCHAR, RedirectionTarget> targets;
+    StringMap<WCHAR, std::vector<const RedirectionTarget*>> paths;
+    StringMap<char, std::vector<std::string>> pathsA;
+    std::vector<std::pair<std::wstring, const RedirectionTarget*>> pathPatterns;
+    std::vector<std::pair<std::string, std::string>> pathPatternsA;
+    // Loaded modules which were found to have no redirection. Datafile
+    // handles aren't added, since there's no notification when they're freed.
+    mutable ModuleHandleSet modulesWithoutRedirection;
+};
+
+std::atomic<const RedirectionResources*> g_redirectionResources;
+std::vector<std::unique_ptr<RedirectionResources>>
+    g_redirectionResourcesReplaced;
+
+// Incremented when a module is unloaded, to avoid adding a module handle which
+// was unloaded while its redirections were being checked.
+std::atomic<DWORD> g_moduleUnloadCounter;
+PVOID g_dllNotificationCookie;
 
 std::atomic<DWORD> g_operationCounter;
 
@@ -463,34 +675,29 @@ auto StrToW(PCSTR str) {
     return result;
 }
 
-// A helper function to skip locking if the thread already holds the lock, since
-// it's UB. Nested locks may happen if one hooked function is implemented with
-// the help of another hooked function. We assume here that the locks are freed
-// in reverse order.
-auto RedirectionResourcePathsMutexSharedLock() {
-    class Result {
-       public:
-        Result() = default;
-
-        Result(std::shared_mutex& mutex) : lock(std::shared_lock{mutex}) {
-            g_redirectionResourcePathsMutexLocked = true;
-        }
+// Upper-cases a file name to look it up in the redirections. The stack buffer
+// is used if it's large enough, to avoid an allocation in the common case.
+template <typename T, size_t N>
+std::basic_string_view<T> FileNameToUpper(const T* fileName,
+                                          T (&buffer)[N],
+                                          std::basic_string<T>& fallback) {
+    size_t length = std::char_traits<T>::length(fileName);
 
-        ~Result() {
-            if (lock) {
-                g_redirectionResourcePathsMutexLocked = false;
-            }
-        }
-
-       private:
-        std::optional<std::shared_lock<std::shared_mutex>> lock;
-    };
+    T* upper;
+    if (length <= N) {
+        upper = buffer;
+    } else {
+        fallback.resize(length);
+        upper = fallback.data();
+    }
 
-    if (g_redirectionResourcePathsMutexLocked) {
-        return Result{};
+    if (length > 0) {
+        (chooseAW<T, LCMapStringA, LCMapStringW>())(
+            LOCALE_USER_DEFAULT, LCMAP_UPPERCASE, fileName,
+            static_cast<int>(length), upper, static_cast<int>(length));
     }
 
-    return Result{g_redirectionResourcePathsMutex};
+    return {upper, length};
 }
 
 bool DevicePathToDosPath(const WCHAR* device_path,
@@ -533,115 +740,248 @@ bool DevicePathToDosPath(const WCHAR* device_path,
     return false;
 }
 
-HMODULE GetRedirectedModule(std::wstring_view fileName) {
-    std::wstring fileNameUpper{fileName};
-    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, &fileNameUpper[0],
-                  static_cast<int>(fileNameUpper.length()), &fileNameUpper[0],
-                  static_cast<int>(fileNameUpper.length()), nullptr, nullptr,
-                  0);
+HMODULE GetRedirectedModule(const RedirectionTarget& target) {
+    HMODULE module = target.module;
+    if (module) {
+        return module;
+    }
 
-    {
-        std::shared_lock lock{g_redirectionResourceModulesMutex};
-        const auto it = g_redirectionResourceModules.find(fileNameUpper);
-        if (it != g_redirectionResourceModules.end()) {
-            return it->second;
-        }
+    if (target.loadFailed) {
+        return nullptr;
     }
 
-    HINSTANCE module = LoadLibraryEx(
-        fileNameUpper.c_str(), nullptr,
+    module = LoadLibraryEx(
+        target.path.c_str(), nullptr,
         LOAD_LIBRARY_AS_DATAFILE | LOAD_LIBRARY_AS_IMAGE_RESOURCE);
     if (!module) {
         DWORD dwError = GetLastError();
         Wh_Log(L"LoadLibraryEx failed with error %u", dwError);
+        target.loadFailed = true;
         return nullptr;
     }
 
-    {
-        std::unique_lock lock{g_redirectionResourceModulesMutex};
-        g_redirectionResourceModules.try_emplace(fileNameUpper, module);
+    // Another thread might have loaded it in the meantime.
+    HMODULE loadedModule = nullptr;
+    if (!target.module.compare_exchange_strong(loadedModule, module)) {
+        FreeLibrary(module);
+        return loadedModule;
     }
 
     return module;
 }
 
-void FreeAndClearRedirectedModules() {
-    std::unordered_map<std::wstring, HMODULE> modules;
+// Returns false if the cache can't be used for the string ID. Otherwise, sets
+// the length-prefixed string, or nullptr if it doesn't exist.
+bool FindCachedStringResource(const RedirectionTarget& target,
+                              HMODULE module,
+                              UINT uId,
+                              PCWSTR* string) {
+    if (uId > StringTableCache::kMaxId) {
+        return false;
+    }
+
+    StringTableCache* cache = target.stringTableCache;
+    while (!cache || cache->Module() != module) {
+        // The module was loaded again if the cache is for another module. The
+        // old cache is kept until the target is freed, since other threads
+        // might still be reading it.
+        auto* newCache = new StringTableCache(module);
+        StringTableCache* oldCache = cache;
+        if (target.stringTableCache.compare_exchange_strong(cache, newCache)) {
+            if (oldCache) {
+                std::lock_guard<std::mutex> guard(
+                    target.retiredStringTableCachesMutex);
+                target.retiredStringTableCaches.emplace_back(oldCache);
+            }
 
-    {
-        std::unique_lock lock{g_redirectionResourceModulesMutex};
-        modules.swap(g_redirectionResourceModules);
+            cache = newCache;
+        } else {
+            delete newCache;
+        }
     }
 
-    for (const auto& it : modules) {
-        FreeLibrary(it.second);
+    *string = cache->Find(uId);
+    return true;
+}
+
+void FreeRedirectedModules(const RedirectionResources& redirectionResources) {
+    for (const auto& [path, target] : redirectionResources.targets) {
+        if (HMODULE module = target.module.exchange(nullptr)) {
+            FreeLibrary(module);
+        }
     }
 }
 
-template <typename T>
-bool RedirectFileName(DWORD c,
-                      const T* fileName,
-                      std::function<void()> beforeFirstRedirectionFunction,
-                      std::function<bool(const T*)> redirectFunction) {
-    if (!fileName) {
-        Wh_Log(L"[%u] Error, nullptr file name, falling back to original", c);
-        return false;
+void FreeReplacedRedirectedModules() {
+    for (const auto& redirectionResources : g_redirectionResourcesReplaced) {
+        FreeRedirectedModules(*redirectionResources);
     }
+}
 
-    std::basic_string<T> fileNameUpper{fileName};
-    (chooseAW<T, LCMapStringA, LCMapStringW>())(
-        LOCALE_USER_DEFAULT, LCMAP_UPPERCASE, &fileNameUpper[0],
-        static_cast<int>(fileNameUpper.length()), &fileNameUpper[0],
-        static_cast<int>(fileNameUpper.length()));
+void FreeAllRedirectedModules() {
+    FreeReplacedRedirectedModules();
 
-    bool triedRedirection = false;
+    if (const auto* redirectionResources = g_redirectionResources.load()) {
+        FreeRedirectedModules(*redirectionResources);
+    }
+}
 
-    {
-        auto lock{RedirectionResourcePathsMutexSharedLock()};
-
-        const auto& redirectionResourcePaths =
-            *(chooseAW<T, &g_redirectionResourcePathsA,
-                       &g_redirectionResourcePaths>());
-        if (const auto it = redirectionResourcePaths.find(fileNameUpper);
-            it != redirectionResourcePaths.end()) {
-            const auto& redirects = it->second;
-            for (const auto& redirect : redirects) {
-                if (!triedRedirection) {
-                    beforeFirstRedirectionFunction();
-                    triedRedirection = true;
-                }
+// https://learn.microsoft.com/en-us/windows/win32/devnotes/ldrdllnotification
+constexpr ULONG kLdrDllNotificationReasonUnloaded = 2;
 
-                Wh_Log(L"[%u] Trying %s", c, StrToW(redirect.c_str()).p);
+struct LdrDllNotificationData {
+    ULONG Flags;
+    PCUNICODE_STRING FullDllName;
+    PCUNICODE_STRING BaseDllName;
+    PVOID DllBase;
+    ULONG SizeOfImage;
+};
 
-                if (redirectFunction(redirect.c_str())) {
-                    return true;
-                }
-            }
-        }
+using LdrDllNotificationFunction_t =
+    VOID(CALLBACK*)(ULONG NotificationReason,
+                    const LdrDllNotificationData* NotificationData,
+                    PVOID Context);
+using LdrRegisterDllNotification_t =
+    NTSTATUS(NTAPI*)(ULONG Flags,
+                     LdrDllNotificationFunction_t NotificationFunction,
+                     PVOID Context,
+                     PVOID* Cookie);
+using LdrUnregisterDllNotification_t = NTSTATUS(NTAPI*)(PVOID Cookie);
 
-        const auto& redirectionResourcePathPatterns =
-            *(chooseAW<T, &g_redirectionResourcePathPatternsA,
-                       &g_redirectionResourcePathPatterns>());
-        for (const auto& [pattern, redirect] :
-             redirectionResourcePathPatterns) {
-            if (!strmatch(pattern.data(), pattern.size(), fileNameUpper.data(),
-                          fileNameUpper.size())) {
-                continue;
-            }
+VOID CALLBACK DllNotificationCallback(
+    ULONG NotificationReason,
+    const LdrDllNotificationData* NotificationData,
+    PVOID Context) {
+    if (NotificationReason != kLdrDllNotificationReasonUnloaded) {
+        return;
+    }
+
+    // The handle might be reused by another module, which might have
+    // redirections.
+    g_moduleUnloadCounter++;
+
+    if (const auto* redirectionResources = g_redirectionResources.load()) {
+        redirectionResources->modulesWithoutRedirection.Remove(
+            (HMODULE)NotificationData->DllBase);
+    }
+}
+
+void RegisterDllNotification() {
+    HMODULE ntdllModule = GetModuleHandle(L"ntdll.dll");
+    auto pLdrRegisterDllNotification =
+        (LdrRegisterDllNotification_t)GetProcAddress(
+            ntdllModule, "LdrRegisterDllNotification");
+    if (!pLdrRegisterDllNotification) {
+        Wh_Log(L"Couldn't find LdrRegisterDllNotification");
+        return;
+    }
+
+    // Without the notification, modules without redirection aren't
+    // remembered.
+    NTSTATUS status = pLdrRegisterDllNotification(
+        0, DllNotificationCallback, nullptr, &g_dllNotificationCookie);
+    if (!NT_SUCCESS(status)) {
+        Wh_Log(L"LdrRegisterDllNotification failed with status 0x%08X",
+               status);
+        g_dllNotificationCookie = nullptr;
+    }
+}
+
+void UnregisterDllNotification() {
+    if (!g_dllNotificationCookie) {
+        return;
+    }
+
+    HMODULE ntdllModule = GetModuleHandle(L"ntdll.dll");
+    auto pLdrUnregisterDllNotification =
+        (LdrUnregisterDllNotification_t)GetProcAddress(
+            ntdllModule, "LdrUnregisterDllNotification");
+    if (pLdrUnregisterDllNotification) {
+        pLdrUnregisterDllNotification(g_dllNotificationCookie);
+    }
+
+    g_dllNotificationCookie = nullptr;
+}
+
+PCWSTR RedirectionTargetPath(const RedirectionTarget* target) {
+    return target->path.c_str();
+}
+
+PCSTR RedirectionTargetPath(const std::string& target) {
+    return target.c_str();
+}
+
+template <typename T,
+          typename BeforeFirstRedirectionFunction,
+          typename RedirectFunction>
+bool RedirectFileName(
+    DWORD c,
+    const T* fileName,
+    BeforeFirstRedirectionFunction&& beforeFirstRedirectionFunction,
+    RedirectFunction&& redirectFunction) {
+    if (!fileName) {
+        Wh_Log(L"[%u] Error, nullptr file name, falling back to original", c);
+        return false;
+    }
+
+    const auto* redirectionResources = g_redirectionResources.load();
+    if (!redirectionResources) {
+        return false;
+    }
 
+    T fileNameUpperBuffer[MAX_PATH];
+    std::basic_string<T> fileNameUpperFallback;
+    std::basic_string_view<T> fileNameUpper =
+        FileNameToUpper(fileName, fileNameUpperBuffer, fileNameUpperFallback);
+
+    bool triedRedirection = false;
+
+    const auto& redirectionResourcePaths =
+        redirectionResources->*(chooseAW<T, &RedirectionResources::pathsA,
+                                         &RedirectionResources::paths>());
+    if (const auto it = redirectionResourcePaths.find(fileNameUpper);
+        it != redirectionResourcePaths.end()) {
+        const auto& redirects = it->second;
+        for (const auto& redirect : redirects) {
             if (!triedRedirection) {
                 beforeFirstRedirectionFunction();
                 triedRedirection = true;
             }
 
-            Wh_Log(L"[%u] Trying %s", c, StrToW(redirect.c_str()).p);
+            const T* redirectPath = RedirectionTargetPath(redirect);
+
+            Wh_Log(L"[%u] Trying %s", c, StrToW(redirectPath).p);
 
-            if (redirectFunction(redirect.c_str())) {
+            if (redirectFunction(redirectPath)) {
                 return true;
             }
         }
     }
 
+    const auto& redirectionResourcePathPatterns =
+        redirectionResources->*(
+            chooseAW<T, &RedirectionResources::pathPatternsA,
+                     &RedirectionResources::pathPatterns>());
+    for (const auto& [pattern, redirect] : redirectionResourcePathPatterns) {
+        if (!strmatch(pattern.data(), pattern.size(), fileNameUpper.data(),
+                      fileNameUpper.size())) {
+            continue;
+        }
+
+        if (!triedRedirection) {
+            beforeFirstRedirectionFunction();
+            triedRedirection = true;
+        }
+
+        const T* redirectPath = RedirectionTargetPath(redirect);
+
+        Wh_Log(L"[%u] Trying %s", c, StrToW(redirectPath).p);
+
+        if (redirectFunction(redirectPath)) {
+            return true;
+        }
+    }
+
     if (triedRedirection) {
         Wh_Log(L"[%u] No redirection succeeded, falling back to original", c);
     }
@@ -649,10 +989,44 @@ bool RedirectFileName(DWORD c,
     return false;
 }
 
-bool RedirectModule(DWORD c,
-                    HINSTANCE hInstance,
-                    std::function<void()> beforeFirstRedirectionFunction,
-                    std::function<bool(HINSTANCE)> redirectFunction) {
+// The redirect function can optionally take the redirection target as a second
+// argument.
+template <typename RedirectFunction>
+bool CallRedirectFunction(RedirectFunction& redirectFunction,
+                          HINSTANCE hInstanceRedirect,
+                          const RedirectionTarget& target) {
+    if constexpr (std::is_invocable_v<RedirectFunction&, HINSTANCE,
+                                      const RedirectionTarget&>) {
+        return redirectFunction(hInstanceRedirect, target);
+    } else {
+        return redirectFunction(hInstanceRedirect);
+    }
+}
+
+template <typename BeforeFirstRedirectionFunction, typename RedirectFunction>
+bool RedirectModule(
+    DWORD c,
+    HINSTANCE hInstance,
+    BeforeFirstRedirectionFunction&& beforeFirstRedirectionFunction,
+    RedirectFunction&& redirectFunction) {
+    const auto* redirectionResources = g_redirectionResources.load();
+    if (!redirectionResources || (redirectionResources->paths.empty() &&
+                                  redirectionResources->pathPatterns.empty())) {
+        return false;
+    }
+
+    // A null handle refers to the executable.
+    HMODULE loadedModule = nullptr;
+    if (!((ULONG_PTR)hInstance & 3) && g_dllNotificationCookie) {
+        loadedModule = hInstance ? hInstance : GetModuleHandle(nullptr);
+        if (redirectionResources->modulesWithoutRedirection.Contains(
+                loadedModule)) {
+            return false;
+        }
+    }
+
+    DWORD moduleUnloadCounter = g_moduleUnloadCounter;
+
     WCHAR szFileName[MAX_PATH];
     DWORD fileNameLen;
     if ((ULONG_PTR)hInstance & 3) {
@@ -698,59 +1072,68 @@ bool RedirectModule(DWORD c,
                   0);
 
     bool triedRedirection = false;
+    bool hasRedirection = false;
 
-    {
-        auto lock{RedirectionResourcePathsMutexSharedLock()};
-
-        if (const auto it = g_redirectionResourcePaths.find(szFileName);
-            it != g_redirectionResourcePaths.end()) {
-            const auto& redirects = it->second;
-            for (const auto& redirect : redirects) {
-                if (!triedRedirection) {
-                    beforeFirstRedirectionFunction();
-                    triedRedirection = true;
-                }
-
-                Wh_Log(L"[%u] Trying %s", c, redirect.c_str());
-
-                HINSTANCE hInstanceRedirect = GetRedirectedModule(redirect);
-                if (!hInstanceRedirect) {
-                    Wh_Log(L"[%u] GetRedirectedModule failed", c);
-                    continue;
-                }
-
-                if (redirectFunction(hInstanceRedirect)) {
-                    return true;
-                }
-            }
-        }
-
-        for (const auto& [pattern, redirect] :
-             g_redirectionResourcePathPatterns) {
-            if (!strmatch(pattern.data(), pattern.size(), szFileName,
-                          fileNameLen)) {
-                continue;
-            }
+    if (const auto it = redirectionResources->paths.find(
+            std::wstring_view{szFileName, fileNameLen});
+        it != redirectionResources->paths.end()) {
+        hasRedirection = true;
 
+        const auto& redirects = it->second;
+        for (const auto* redirect : redirects) {
             if (!triedRedirection) {
                 beforeFirstRedirectionFunction();
                 triedRedirection = true;
             }
 
-            Wh_Log(L"[%u] Trying %s", c, redirect.c_str());
+            Wh_Log(L"[%u] Trying %s", c, redirect->path.c_str());
 
-            HINSTANCE hInstanceRedirect = GetRedirectedModule(redirect);
+            HINSTANCE hInstanceRedirect = GetRedirectedModule(*redirect);
             if (!hInstanceRedirect) {
                 Wh_Log(L"[%u] GetRedirectedModule failed", c);
                 continue;
             }
 
-            if (redirectFunction(hInstanceRedirect)) {
+            if (CallRedirectFunction(redirectFunction, hInstanceRedirect,
+                                     *redirect)) {
                 return true;
             }
         }
     }
 
+    for (const auto& [pattern, redirect] :
+         redirectionResources->pathPatterns) {
+        if (!strmatch(pattern.data(), pattern.size(), szFileName,
+                      fileNameLen)) {
+            continue;
+        }
+
+        hasRedirection = true;
+
+        if (!triedRedirection) {
+            beforeFirstRedirectionFunction();
+            triedRedirection = true;
+        }
+
+        Wh_Log(L"[%u] Trying %s", c, redirect->path.c_str());
+
+        HINSTANCE hInstanceRedirect = GetRedirectedModule(*redirect);
+        if (!hInstanceRedirect) {
+            Wh_Log(L"[%u] GetRedirectedModule failed", c);
+            continue;
+        }
+
+        if (CallRedirectFunction(redirectFunction, hInstanceRedirect,
+                                 *redirect)) {
+            return true;
+        }
+    }
+
+    if (!hasRedirection && loadedModule &&
+        g_moduleUnloadCounter == moduleUnloadCounter) {
+        redirectionResources->modulesWithoutRedirection.Add(loadedModule);
+    }
+
     if (triedRedirection) {
         Wh_Log(L"[%u] No redirection succeeded, falling back to original", c);
     }
@@ -1331,6 +1714,27 @@ HWND WINAPI CreateDialogParamW_Hook(HINSTANCE hInstance,
         hInstance, lpTemplateName, hWndParent, lpDialogFunc, dwInitParam);
 }
 
+// Same as LoadStringW for a length-prefixed string from a string table block.
+int CopyStringResource(PCWSTR string, LPWSTR lpBuffer, int cchBufferMax) {
+    int length = string ? *string : 0;
+
+    if (cchBufferMax == 0) {
+        *reinterpret_cast<PCWSTR*>(lpBuffer) = string ? string + 1 : nullptr;
+        return length;
+    }
+
+    if (length > cchBufferMax - 1) {
+        length = cchBufferMax - 1;
+    }
+
+    if (length > 0) {
+        wmemcpy(lpBuffer, string + 1, length);
+    }
+
+    lpBuffer[length] = L'\0';
+    return length;
+}
+
 template <auto* Original, typename T>
 int LoadStringAW_Hook(HINSTANCE hInstance,
                       UINT uID,
@@ -1347,9 +1751,28 @@ int LoadStringAW_Hook(HINSTANCE hInstance,
 
     bool redirected = RedirectModule(
         c, hInstance, []() {},
-        [&](HINSTANCE hInstanceRedirect) {
-            result =
-                (*Original)(hInstanceRedirect, uID, lpBuffer, cchBufferMax);
+        [&](HINSTANCE hInstanceRedirect, const RedirectionTarget& target) {
+            // Look up wide strings in the target's string table cache instead
+            // of locating the string table block on each call.
+            bool cached = false;
+            if constexpr (std::is_same_v<T, WCHAR>) {
+                PCWSTR string;
+                if (lpBuffer && cchBufferMax >= 0 &&
+                    FindCachedStringResource(target, hInstanceRedirect, uID,
+                                             &string)) {
+                    result = CopyStringResource(string, lpBuffer, cchBufferMax);
+                    if (!result) {
+                        SetLastError(ERROR_RESOURCE_NAME_NOT_FOUND);
+                    }
+                    cached = true;
+                }
+            }
+
+            if (!cached) {
+                result =
+                    (*Original)(hInstanceRedirect, uID, lpBuffer, cchBufferMax);
+            }
+
             if (result) {
                 Wh_Log(L"[%u] Redirected successfully", c);
                 return true;
@@ -1806,7 +2229,7 @@ void* WINAPI DirectUI_CreateString_Hook(PCWSTR name, HINSTANCE hInstance) {
 
     bool redirected = RedirectModule(
         c, hInstance, []() {},
-        [&](HINSTANCE hInstanceRedirect) {
+        [&](HINSTANCE hInstanceRedirect, const RedirectionTarget& target) {
             // For other redirected functions, we check whether the function
             // succeeded. If it didn't, we try another redirection or fall back
             // to the original file.
@@ -1816,7 +2239,11 @@ void* WINAPI DirectUI_CreateString_Hook(PCWSTR name, HINSTANCE hInstance) {
             // missing. Therefore, only make sure that the string resource
             // exists.
             UINT uId = (DWORD)(ULONG_PTR)name;
-            PCWSTR string = FindStringResourceEx(hInstanceRedirect, uId, 0);
+            PCWSTR string;
+            if (!FindCachedStringResource(target, hInstanceRedirect, uId,
+                                          &string)) {
+                string = FindStringResourceEx(hInstanceRedirect, uId, 0);
+            }
             if (!string || !*string) {
                 Wh_Log(L"[%u] Resource not found", c);
                 return false;
@@ -2164,6 +2591,109 @@ void PromptToClearCache() {
         nullptr, 0, nullptr);
 }
 
+// Returns the upper-cased original paths which redirections differ between the
+// two configurations, or nullopt if the pattern redirections differ, since the
+// files which are affected by them can't be listed.
+std::optional<std::vector<std::wstring>> GetChangedRedirectionPaths(
+    const RedirectionResources& prev,
+    const RedirectionResources& next) {
+    auto sameTargets = [](const std::vector<const RedirectionTarget*>& a,
+                          const std::vector<const RedirectionTarget*>& b) {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+                          [](const RedirectionTarget* x,
+                             const RedirectionTarget* y) {
+                              return x->path == y->path;
+                          });
+    };
+
+    if (!std::equal(prev.pathPatterns.begin(), prev.pathPatterns.end(),
+                    next.pathPatterns.begin(), next.pathPatterns.end(),
+                    [](const auto& x, const auto& y) {
+                        return x.first == y.first &&
+                               x.second->path == y.second->path;
+                    })) {
+        return std::nullopt;
+    }
+
+    std::vector<std::wstring> changedPaths;
+
+    for (const auto& [path, targets] : prev.paths) {
+        auto it = next.paths.find(path);
+        if (it == next.paths.end() || !sameTargets(targets, it->second)) {
+            changedPaths.push_back(path);
+        }
+    }
+
+    for (const auto& [path, targets] : next.paths) {
+        if (!prev.paths.contains(path)) {
+            changedPaths.push_back(path);
+        }
+    }
+
+    return changedPaths;
+}
+
+// Above this, invalidating the whole icon cache is cheaper.
+constexpr size_t kMaxImageUpdates = 1000;
+
+// Notifies about the icons of the given files, both by position and by
+// resource id, so that only their shell icon cache entries are refreshed.
+// Returns false if there are too many icons.
+bool UpdateShellImagesForFiles(const std::vector<std::wstring>& paths) {
+    std::vector<std::pair<PCWSTR, int>> imageUpdates;
+
+    for (const auto& path : paths) {
+        HMODULE module = LoadLibraryEx(
+            path.c_str(), nullptr,
+            LOAD_LIBRARY_AS_DATAFILE | LOAD_LIBRARY_AS_IMAGE_RESOURCE);
+        if (!module) {
+            // Not a module, e.g. an .ico file.
+            imageUpdates.push_back({path.c_str(), 0});
+            continue;
+        }
+
+        struct EnumParam {
+            PCWSTR path;
+            std::vector<std::pair<PCWSTR, int>>* imageUpdates;
+            int index;
+        } param{path.c_str(), &imageUpdates, 0};
+
+        EnumResourceNames(
+            module, RT_GROUP_ICON,
+            [](HMODULE hModule, LPCWSTR lpType, LPWSTR lpName,
+               LONG_PTR lParam) WINAPI -> BOOL {
+                auto& param = *reinterpret_cast<EnumParam*>(lParam);
+                param.imageUpdates->push_back({param.path, param.index++});
+                if (IS_INTRESOURCE(lpName)) {
+                    param.imageUpdates->push_back(
+                        {param.path, -(int)(ULONG_PTR)lpName});
+                }
+
+                return param.imageUpdates->size() <= kMaxImageUpdates;
+            },
+            reinterpret_cast<LONG_PTR>(&param));
+
+        FreeLibrary(module);
+
+        if (imageUpdates.size() > kMaxImageUpdates) {
+            return false;
+        }
+    }
+
+    if (imageUpdates.size() > kMaxImageUpdates) {
+        return false;
+    }
+
+    Wh_Log(L"Updating %zu shell images of %zu files", imageUpdates.size(),
+           paths.size());
+
+    for (const auto& [path, index] : imageUpdates) {
+        SHUpdateImage(path, index, 0, -1);
+    }
+
+    return true;
+}
+
 HANDLE LockTempFileExclusive(PCWSTR filePath, DWORD timeoutMs) {
     HANDLE hFile =
         CreateFile(filePath, GENERIC_READ | GENERIC_WRITE,
@@ -2473,13 +3003,16 @@ void LoadSettings() {
     g_settings.iconTheme = WindhawkUtils::StringSetting::make(L"iconTheme");
     g_settings.allResourceRedirect = Wh_GetIntSetting(L"allResourceRedirect");
 
-    std::unordered_map<std::wstring, std::vector<std::wstring>> paths;
-    std::unordered_map<std::string, std::vector<std::string>> pathsA;
-    std::vector<std::pair<std::wstring, std::wstring>> pathPatterns;
-    std::vector<std::pair<std::string, std::string>> pathPatternsA;
+    auto redirectionResources = std::make_unique<RedirectionResources>();
+    auto& targets = redirectionResources->targets;
+    auto& paths = redirectionResources->paths;
+    auto& pathsA = redirectionResources->pathsA;
+    auto& pathPatterns = redirectionResources->pathPatterns;
+    auto& pathPatternsA = redirectionResources->pathPatternsA;
 
-    auto addRedirectionPath = [&paths, &pathsA, &pathPatterns, &pathPatternsA](
-                                  PCWSTR original, PCWSTR redirect) {
+    auto addRedirectionPath = [&targets, &paths, &pathsA, &pathPatterns,
+                               &pathPatternsA](PCWSTR original,
+                                               PCWSTR redirect) {
         WCHAR originalExpanded[MAX_PATH];
         DWORD originalExpandedLen = ExpandEnvironmentStrings(
             original, originalExpanded, ARRAYSIZE(originalExpanded));
@@ -2501,10 +3034,17 @@ void LoadSettings() {
                       originalExpanded, originalExpandedLen, originalExpanded,
                       originalExpandedLen, nullptr, nullptr, 0);
 
+        // Redirections to the same file share the loaded module.
+        auto [targetIt, targetInserted] = targets.try_emplace(redirect);
+        RedirectionTarget* target = &targetIt->second;
+        if (targetInserted) {
+            target->path = redirect;
+        }
+
         if (isPattern) {
-            pathPatterns.push_back({originalExpanded, redirect});
+            pathPatterns.push_back({originalExpanded, target});
         } else {
-            paths[originalExpanded].push_back(redirect);
+            paths[originalExpanded].push_back(target);
         }
 
         char originalExpandedA[MAX_PATH];
@@ -2630,11 +3170,12 @@ void LoadSettings() {
     std::reverse(pathPatterns.begin(), pathPatterns.end());
     std::reverse(pathPatternsA.begin(), pathPatternsA.end());
 
-    std::unique_lock lock{g_redirectionResourcePathsMutex};
-    g_redirectionResourcePaths = std::move(paths);
-    g_redirectionResourcePathsA = std::move(pathsA);
-    g_redirectionResourcePathPatterns = std::move(pathPatterns);
-    g_redirectionResourcePathPatternsA = std::move(pathPatternsA);
+    const auto* prevRedirectionResources =
+        g_redirectionResources.exchange(redirectionResources.release());
+    if (prevRedirectionResources) {
+        g_redirectionResourcesReplaced.emplace_back(
+            const_cast<RedirectionResources*>(prevRedirectionResources));
+    }
 }
 
 BOOL Wh_ModInit() {
@@ -2644,6 +3185,8 @@ BOOL Wh_ModInit() {
 
     LoadSettings();
 
+    RegisterDllNotification();
+
     HMODULE kernelBaseModule = GetModuleHandle(L"kernelbase.dll");
     HMODULE kernel32Module = GetModuleHandle(L"kernel32.dll");
 
@@ -2815,7 +3358,9 @@ BOOL Wh_ModInit() {
 void Wh_ModUninit() {
     Wh_Log(L">");
 
-    FreeAndClearRedirectedModules();
+    UnregisterDllNotification();
+
+    FreeAllRedirectedModules();
 
     HWND clearCachePromptWindow = g_clearCachePromptWindow;
     if (clearCachePromptWindow) {
@@ -2842,6 +3387,7 @@ BOOL Wh_ModSettingsChanged(BOOL* bReload) {
 
     auto prevIconTheme = std::move(g_settings.iconTheme);
     int prevAllResourceRedirect = g_settings.allResourceRedirect;
+    const auto* prevRedirectionResources = g_redirectionResources.load();
 
     LoadSettings();
 
@@ -2850,7 +3396,7 @@ BOOL Wh_ModSettingsChanged(BOOL* bReload) {
         return TRUE;
     }
 
-    FreeAndClearRedirectedModules();
+    FreeReplacedRedirectedModules();
 
     if (DoesCurrentProcessOwnTaskbar()) {
         if (wcscmp(g_settings.iconTheme, prevIconTheme) != 0) {
@@ -2860,8 +3406,20 @@ BOOL Wh_ModSettingsChanged(BOOL* bReload) {
         // Let other processes some time to load the new config.
         Sleep(400);
 
-        // Invalidate icon cache.
-        SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, nullptr, nullptr);
+        // Only refresh the icons of the files which redirections changed, if
+        // possible. Otherwise, invalidate the whole icon cache.
+        //
+        // Replaced redirection resources are kept until the mod is unloaded,
+        // so the previous instance is still valid here.
+        std::optional<std::vector<std::wstring>> changedPaths;
+        if (prevRedirectionResources) {
+            changedPaths = GetChangedRedirectionPaths(
+                *prevRedirectionResources, *g_redirectionResources.load());
+        }
+
+        if (!changedPaths || !UpdateShellImagesForFiles(*changedPaths)) {
+            SHChangeNotify(SHCNE_ASSOCCHANGED, SHCNF_IDLIST, nullptr, nullptr);
+        }
     }
 
     return TRUE;
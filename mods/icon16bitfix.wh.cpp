@@ -2,7 +2,7 @@
 // @id              icon16bitfix
 // @name            Icons of Win16 apps in Explorer
 // @description     Adds support for icons of 16-bit (Win16) applications in File Explorer
-// @version         1.0.2
+// @version         1.0.3
 // @author          anixx
 // @github          https://github.com/Anixx
 // @include         explorer.exe
@@ -22,6 +22,13 @@ License: LGPL-2.1 or later
 #include <windhawk_utils.h>
 #include <windows.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
 
 typedef WORD HANDLE16;
 
@@ -94,9 +101,194 @@ static BYTE* ICO_LoadIcon(BYTE* peimage, icoICONDIRENTRY* lpiIDE, ULONG* uSize)
     return peimage + lpiIDE->dwImageOffset;
 }
 
-char* get_search_path()
+// The icon resources of an NE executable, copied out of the file so that no
+// mapping of it has to be kept open between requests.
+struct NE_ICON_RESOURCES
+{
+    std::wstring path;
+    ULONGLONG fileSize;
+    FILETIME lastWriteTime;
+    // Group icon directories in resource order, empty if the file isn't an NE
+    // executable with icons.
+    std::vector<std::vector<BYTE>> groupIcons;
+    // Icon images by resource id.
+    std::vector<std::pair<WORD, std::vector<BYTE>>> icons;
+};
+
+#define NE_ICON_CACHE_SIZE 16
+
+// Most recently used first. Explorer asks for the icons of the same files over
+// and over while scrolling, so the files aren't opened and parsed every time.
+static std::mutex g_neIconCacheMutex;
+static std::vector<std::shared_ptr<const NE_ICON_RESOURCES>> g_neIconCache;
+
+static bool NE_CopyResource(const BYTE* image, DWORD imageSize, NE_NAMEINFO* pNInfo, WORD sizeShift, std::vector<BYTE>* data)
+{
+    ULONG uSize;
+    const BYTE* pRes = USER32_LoadResource(const_cast<BYTE*>(image), pNInfo, sizeShift, &uSize);
+    if (uSize > imageSize || static_cast<ULONG>(pRes - image) > imageSize - uSize)
+    {
+        return false;
+    }
+
+    data->assign(pRes, pRes + uSize);
+    return true;
+}
+
+static void NE_ParseIconResources(const BYTE* image, DWORD fsizel, NE_ICON_RESOURCES* resources)
+{
+    const BYTE* imageEnd = image + fsizel;
+
+    auto mz_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(image);
+    const IMAGE_OS2_HEADER* ne_header;
+
+    if (fsizel < sizeof(*mz_header)) return;
+    if (mz_header->e_magic != IMAGE_DOS_SIGNATURE) return;
+    if (mz_header->e_lfanew < 0 || mz_header->e_lfanew + sizeof(*ne_header) > fsizel) return;
+    ne_header = reinterpret_cast<const IMAGE_OS2_HEADER*>(image + mz_header->e_lfanew);
+    if (ne_header->ne_magic == IMAGE_NT_SIGNATURE) return;
+    if (ne_header->ne_magic != IMAGE_OS2_SIGNATURE) return;
+    if (ne_header->ne_rsrctab >= ne_header->ne_restab) return;
+
+    const BYTE* pData = image + mz_header->e_lfanew + ne_header->ne_rsrctab;
+    if (pData + sizeof(WORD) > imageEnd) return;
+
+    WORD sizeShift = *reinterpret_cast<const WORD*>(pData);
+    auto pTInfo = reinterpret_cast<NE_TYPEINFO*>(const_cast<BYTE*>(pData) + 2);
+    NE_NAMEINFO* pIconStorage = nullptr;
+    NE_NAMEINFO* pIconDir = nullptr;
+    UINT16 iconDirCount = 0, iconCount = 0;
+
+    while (reinterpret_cast<const BYTE*>(pTInfo + 1) <= imageEnd && pTInfo->type_id && !(pIconStorage && pIconDir))
+    {
+        auto pNInfo = reinterpret_cast<NE_NAMEINFO*>(pTInfo + 1);
+        if (reinterpret_cast<const BYTE*>(pNInfo + pTInfo->count) > imageEnd) return;
+
+        if (pTInfo->type_id == NE_RSCTYPE_GROUP_ICON)
+        {
+            iconDirCount = pTInfo->count;
+            pIconDir = pNInfo;
+        }
+        if (pTInfo->type_id == NE_RSCTYPE_ICON)
+        {
+            iconCount = pTInfo->count;
+            pIconStorage = pNInfo;
+        }
+        pTInfo = reinterpret_cast<NE_TYPEINFO*>(pNInfo + pTInfo->count);
+    }
+
+    if (!pIconStorage || !pIconDir) return;
+
+    resources->groupIcons.resize(iconDirCount);
+    for (UINT16 i = 0; i < iconDirCount; i++)
+    {
+        if (!NE_CopyResource(image, fsizel, pIconDir + i, sizeShift, &resources->groupIcons[i]))
+        {
+            resources->groupIcons[i].clear();
+        }
+    }
+
+    resources->icons.reserve(iconCount);
+    for (UINT16 i = 0; i < iconCount; i++)
+    {
+        std::vector<BYTE> data;
+        if (NE_CopyResource(image, fsizel, pIconStorage + i, sizeShift, &data))
+        {
+            resources->icons.emplace_back(pIconStorage[i].id, std::move(data));
+        }
+    }
+}
+
+static bool NE_ReadIconResources(NE_ICON_RESOURCES* resources, UINT* pError)
+{
+    HANDLE hFile;
+    HANDLE fmapping;
+    BYTE* image;
+    DWORD fsizeh, fsizel;
+
+    hFile = CreateFileW(resources->path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        *pError = 0;
+        return false;
+    }
+    fsizel = GetFileSize(hFile, &fsizeh);
+
+    fmapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY | SEC_COMMIT, 0, 0, nullptr);
+    CloseHandle(hFile);
+    if (!fmapping)
+    {
+        *pError = 0xFFFFFFFF;
+        return false;
+    }
+
+    image = static_cast<BYTE*>(MapViewOfFile(fmapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(fmapping);
+    if (!image)
+    {
+        *pError = 0xFFFFFFFF;
+        return false;
+    }
+
+    NE_ParseIconResources(image, fsizeh ? 0xFFFFFFFF : fsizel, resources);
+
+    UnmapViewOfFile(image);
+    return true;
+}
+
+static std::shared_ptr<const NE_ICON_RESOURCES> NE_GetIconResources(LPCWSTR szExePath, UINT* pError)
 {
-    return nullptr;
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExW(szExePath, GetFileExInfoStandard, &attributes))
+    {
+        *pError = 0;
+        return nullptr;
+    }
+
+    ULONGLONG fileSize = (static_cast<ULONGLONG>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+
+    auto isSameFile = [&](const NE_ICON_RESOURCES& resources)
+    {
+        return resources.fileSize == fileSize &&
+               CompareFileTime(&resources.lastWriteTime, &attributes.ftLastWriteTime) == 0 &&
+               _wcsicmp(resources.path.c_str(), szExePath) == 0;
+    };
+
+    {
+        std::lock_guard<std::mutex> guard(g_neIconCacheMutex);
+        for (auto it = g_neIconCache.begin(); it != g_neIconCache.end(); ++it)
+        {
+            if (isSameFile(**it))
+            {
+                std::rotate(g_neIconCache.begin(), it, it + 1);
+                return g_neIconCache.front();
+            }
+        }
+    }
+
+    auto resources = std::make_shared<NE_ICON_RESOURCES>();
+    resources->path = szExePath;
+    resources->fileSize = fileSize;
+    resources->lastWriteTime = attributes.ftLastWriteTime;
+    if (!NE_ReadIconResources(resources.get(), pError))
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(g_neIconCacheMutex);
+    // Drop a stale entry of a modified file, or one which another thread has
+    // just added.
+    std::erase_if(g_neIconCache, [&](const auto& entry)
+    {
+        return _wcsicmp(entry->path.c_str(), szExePath) == 0;
+    });
+    g_neIconCache.insert(g_neIconCache.begin(), resources);
+    if (g_neIconCache.size() > NE_ICON_CACHE_SIZE)
+    {
+        g_neIconCache.pop_back();
+    }
+
+    return resources;
 }
 
 UINT NE_ExtractIcon(LPCWSTR lpszExeFileName,
@@ -108,41 +300,23 @@ UINT NE_ExtractIcon(LPCWSTR lpszExeFileName,
     UINT* pIconId,
     UINT flags)
 {
-    UINT ret = 0;
     UINT cx1, cx2, cy1, cy2;
-    BYTE* pData;
-    HANDLE hFile;
-    UINT16 iconDirCount = 0, iconCount = 0;
-    BYTE* image;
-    HANDLE fmapping;
-    DWORD fsizeh, fsizel;
     WCHAR szExePath[MAX_PATH];
     DWORD dwSearchReturn;
+    UINT error;
 
-    char* path = get_search_path();
     dwSearchReturn = SearchPathW(nullptr, lpszExeFileName, nullptr, sizeof(szExePath) / sizeof(szExePath[0]), szExePath, nullptr);
-    HeapFree(GetProcessHeap(), 0, path);
     if ((dwSearchReturn == 0) || (dwSearchReturn > sizeof(szExePath) / sizeof(szExePath[0])))
     {
         return static_cast<UINT>(-1);
     }
 
-    hFile = CreateFileW(szExePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
-    if (hFile == INVALID_HANDLE_VALUE) return 0;
-    fsizel = GetFileSize(hFile, &fsizeh);
-
-    fmapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY | SEC_COMMIT, 0, 0, nullptr);
-    CloseHandle(hFile);
-    if (!fmapping)
-    {
-        return 0xFFFFFFFF;
-    }
-
-    image = static_cast<BYTE*>(MapViewOfFile(fmapping, FILE_MAP_READ, 0, 0, 0));
-    CloseHandle(fmapping);
-    if (!image)
+    // All the requested icons, including both sizes when two are requested,
+    // are extracted from a single parse of the file.
+    auto resources = NE_GetIconResources(szExePath, &error);
+    if (!resources)
     {
-        return 0xFFFFFFFF;
+        return error;
     }
 
     cx1 = LOWORD(cxDesired);
@@ -161,97 +335,70 @@ UINT NE_ExtractIcon(LPCWSTR lpszExeFileName,
         pIconId = reinterpret_cast<UINT*>(RetPtr);
     }
 
-    auto mz_header = reinterpret_cast<const IMAGE_DOS_HEADER*>(image);
-    const IMAGE_OS2_HEADER* ne_header;
+    const auto& groupIcons = resources->groupIcons;
+    const auto& icons = resources->icons;
+    UINT16 iconDirCount = static_cast<UINT16>(groupIcons.size());
 
-    if (fsizel < sizeof(*mz_header)) goto end;
-    if (mz_header->e_magic != IMAGE_DOS_SIGNATURE) goto end;
-    ne_header = reinterpret_cast<const IMAGE_OS2_HEADER*>(image + mz_header->e_lfanew);
-    if (mz_header->e_lfanew + sizeof(*ne_header) > fsizel) goto end;
-    if (ne_header->ne_magic == IMAGE_NT_SIGNATURE) goto end;
-    if (ne_header->ne_magic != IMAGE_OS2_SIGNATURE) goto end;
+    if (iconDirCount == 0)
+    {
+        return 0;
+    }
+
+    if (nIcons == 0)
+    {
+        return iconDirCount;
+    }
 
-    pData = image + mz_header->e_lfanew + ne_header->ne_rsrctab;
+    if (nIconIndex < 0 || nIconIndex >= iconDirCount)
+    {
+        return 0;
+    }
 
-    if (ne_header->ne_rsrctab < ne_header->ne_restab)
+    UINT16 i, icon;
+    if (nIcons > static_cast<UINT>(iconDirCount - nIconIndex))
     {
-        BYTE* pCIDir = nullptr;
-        auto pTInfo = reinterpret_cast<NE_TYPEINFO*>(pData + 2);
-        NE_NAMEINFO* pIconStorage = nullptr;
-        NE_NAMEINFO* pIconDir = nullptr;
-        ULONG uSize = 0;
+        nIcons = iconDirCount - nIconIndex;
+    }
 
-        while (pTInfo->type_id && !(pIconStorage && pIconDir))
+    for (i = 0; i < nIcons; i++)
+    {
+        const auto& groupIcon = groupIcons[i + nIconIndex];
+        auto pCIDir = groupIcon.empty() ? nullptr : const_cast<BYTE*>(groupIcon.data());
+        pIconId[i] = pCIDir ? LookupIconIdFromDirectoryEx(pCIDir, TRUE, cx1, cy1, flags) : 0;
+        if (cx2 && cy2)
         {
-            if (pTInfo->type_id == NE_RSCTYPE_GROUP_ICON)
-            {
-                iconDirCount = pTInfo->count;
-                pIconDir = reinterpret_cast<NE_NAMEINFO*>(pTInfo + 1);
-            }
-            if (pTInfo->type_id == NE_RSCTYPE_ICON)
-            {
-                iconCount = pTInfo->count;
-                pIconStorage = reinterpret_cast<NE_NAMEINFO*>(pTInfo + 1);
-            }
-            pTInfo = reinterpret_cast<NE_TYPEINFO*>(reinterpret_cast<char*>(pTInfo + 1) + pTInfo->count * sizeof(NE_NAMEINFO));
+            pIconId[++i] = pCIDir ? LookupIconIdFromDirectoryEx(pCIDir, TRUE, cx2, cy2, flags) : 0;
         }
+    }
 
-        if (pIconStorage && pIconDir)
+    for (icon = 0; icon < nIcons; icon++)
+    {
+        const std::vector<BYTE>* iconData = nullptr;
+        for (const auto& [id, data] : icons)
         {
-            if (nIcons == 0)
+            if (id == (static_cast<int>(pIconId[icon]) | 0x8000))
             {
-                ret = iconDirCount;
+                iconData = &data;
             }
-            else if (nIconIndex < iconDirCount)
+        }
+
+        if (iconData)
+        {
+            auto pIcon = const_cast<BYTE*>(iconData->data());
+            DWORD uSize = static_cast<DWORD>(iconData->size());
+            RetPtr[icon] = CreateIconFromResourceEx(pIcon, uSize, TRUE, 0x00030000, cx1, cy1, flags);
+            if (cx2 && cy2)
             {
-                UINT16 i, icon;
-                if (nIcons > iconDirCount - nIconIndex)
-                {
-                    nIcons = iconDirCount - nIconIndex;
-                }
-
-                for (i = 0; i < nIcons; i++)
-                {
-                    pCIDir = USER32_LoadResource(image, pIconDir + i + nIconIndex, *reinterpret_cast<WORD*>(pData), &uSize);
-                    pIconId[i] = LookupIconIdFromDirectoryEx(pCIDir, TRUE, cx1, cy1, flags);
-                    if (cx2 && cy2)
-                    {
-                        pIconId[++i] = LookupIconIdFromDirectoryEx(pCIDir, TRUE, cx2, cy2, flags);
-                    }
-                }
-
-                for (icon = 0; icon < nIcons; icon++)
-                {
-                    pCIDir = nullptr;
-                    for (i = 0; i < iconCount; i++)
-                    {
-                        if (pIconStorage[i].id == (static_cast<int>(pIconId[icon]) | 0x8000))
-                        {
-                            pCIDir = USER32_LoadResource(image, pIconStorage + i, *reinterpret_cast<WORD*>(pData), &uSize);
-                        }
-                    }
-
-                    if (pCIDir)
-                    {
-                        RetPtr[icon] = CreateIconFromResourceEx(pCIDir, uSize, TRUE, 0x00030000, cx1, cy1, flags);
-                        if (cx2 && cy2)
-                        {
-                            RetPtr[++icon] = CreateIconFromResourceEx(pCIDir, uSize, TRUE, 0x00030000, cx2, cy2, flags);
-                        }
-                    }
-                    else
-                    {
-                        RetPtr[icon] = nullptr;
-                    }
-                }
-                ret = icon;
+                RetPtr[++icon] = CreateIconFromResourceEx(pIcon, uSize, TRUE, 0x00030000, cx2, cy2, flags);
             }
         }
+        else
+        {
+            RetPtr[icon] = nullptr;
+        }
     }
 
-end:
-    UnmapViewOfFile(image);
-    return ret;
+    return icon;
 }
 
 typedef UINT (WINAPI *PrivateExtractIconsW_t)(
@@ -2,7 +2,7 @@
 // @id              ignore-focus-loss
 // @name            Ignore Focus Loss
 // @description     Make games believe they're always on top
-// @version         1.0.0
+// @version         1.0.2
 // @author          Vasher
 // @github          https://github.com/VasherMC
 // @compilerOptions -lcomctl32
@@ -38,6 +38,11 @@ The mod will immediately apply to those programs after you click "Save".
 
 #include <commctrl.h>
 
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 // the "Main" window
 // specifically, the first that receives focus/activation/is foregrounded
 HWND g_thisProgramWindow = 0;
@@ -198,6 +203,80 @@ BOOL SetWindowSubclassFromAnyThread(HWND hWnd,
     return param.result;
 }
 
+// ----- Subclassed windows
+// Windows we've subclassed, kept up to date by the window creation, SetParent
+// and destruction hooks, so that nothing needs to be queried per window or
+// enumerated to find them again
+std::mutex g_subclassedWindowsMutex;
+std::unordered_set<HWND> g_subclassedWindows;
+
+bool IsWindowSubclassed(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_subclassedWindowsMutex);
+    return g_subclassedWindows.count(hWnd) != 0;
+}
+
+void ForgetSubclassedWindow(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_subclassedWindowsMutex);
+    g_subclassedWindows.erase(hWnd);
+}
+
+LRESULT CALLBACK GameWindowSubclassProc(_In_ HWND hWnd,
+                                        _In_ UINT uMsg,
+                                        _In_ WPARAM wParam,
+                                        _In_ LPARAM lParam,
+                                        _In_ UINT_PTR uIdSubclass,
+                                        _In_ DWORD_PTR dwRefData);
+
+BOOL SubclassGameWindow(HWND hWnd) {
+    BOOL result = SetWindowSubclassFromAnyThread(hWnd, GameWindowSubclassProc, 0, 0);
+    if (result) {
+        std::lock_guard<std::mutex> guard(g_subclassedWindowsMutex);
+        g_subclassedWindows.insert(hWnd);
+    }
+    return result;
+}
+
+// Subclass several windows at once, installing the message hook only once
+// for each thread owning some of them
+void SubclassGameWindows(const std::vector<HWND>& windows) {
+    std::unordered_map<DWORD, std::vector<HWND>> windowsByThread;
+    for (HWND hWnd : windows) {
+        DWORD dwThreadId = GetWindowThreadProcessId(hWnd, nullptr);
+        if (dwThreadId) windowsByThread[dwThreadId].push_back(hWnd);
+    }
+
+    for (const auto& [dwThreadId, threadWindows] : windowsByThread) {
+        HHOOK hook = nullptr;
+        if (dwThreadId != GetCurrentThreadId()) {
+            hook = SetWindowsHookEx(WH_CALLWNDPROC, CallWndProcForWindowSubclass,
+                                    nullptr, dwThreadId);
+            if (!hook) continue;
+        }
+
+        for (HWND hWnd : threadWindows) {
+            BOOL result;
+            if (!hook) {
+                result = SetWindowSubclass(hWnd, GameWindowSubclassProc, 0, 0);
+            } else {
+                SET_WINDOW_SUBCLASS_FROM_ANY_THREAD_PARAM param;
+                param.pfnSubclass = GameWindowSubclassProc;
+                param.uIdSubclass = 0;
+                param.dwRefData = 0;
+                param.result = FALSE;
+                SendMessage(hWnd, g_subclassRegisteredMsg, TRUE, (WPARAM)&param);
+                result = param.result;
+            }
+
+            if (result) {
+                std::lock_guard<std::mutex> guard(g_subclassedWindowsMutex);
+                g_subclassedWindows.insert(hWnd);
+            }
+        }
+
+        if (hook) UnhookWindowsHookEx(hook);
+    }
+}
+
 // Suppress the messages we want to ignore
 // and prevent them from reaching the main windowProc
 LRESULT CALLBACK GameWindowSubclassProc(_In_ HWND hWnd,
@@ -231,6 +310,9 @@ LRESULT CALLBACK GameWindowSubclassProc(_In_ HWND hWnd,
             // SDL will check the focus here (ok since we hook GetForegroundWindow)
             // If we don't pass on the message, minimization may break; so don't mess with it
             break;
+        case WM_NCDESTROY:
+            ForgetSubclassedWindow(hWnd);
+            break;
 
         default:
             if (uMsg == g_subclassRegisteredMsg && !wParam) {
@@ -238,6 +320,7 @@ LRESULT CALLBACK GameWindowSubclassProc(_In_ HWND hWnd,
                 GetWindowTextW(hWnd, buf, 50);
                 Wh_Log(L"Unsubclassing %08X ... (%s)", (DWORD)(UINT_PTR)hWnd, buf);
                 RemoveWindowSubclass(hWnd, GameWindowSubclassProc, 0);
+                ForgetSubclassedWindow(hWnd);
             }
             break;
     }
@@ -261,14 +344,16 @@ SetParent_t pOriginalSetParent;
 HWND WINAPI SetParentHook(HWND hWndChild, HWND hWndNewParent) {
     bool now_messageOnly = (hWndNewParent == HWND_MESSAGE);
     HWND oldparent = pOriginalSetParent(hWndChild, hWndNewParent);
-    bool was_messageOnly = (oldparent == HWND_MESSAGE);
-    if (now_messageOnly && !was_messageOnly) {
+    if (!oldparent) return oldparent;
+    // The table tells whether the window was a game window before
+    bool was_subclassed = IsWindowSubclassed(hWndChild);
+    if (now_messageOnly && was_subclassed) {
         Wh_Log(L"Disabling subclass %08X", (DWORD)(UINT_PTR)hWndChild);
         SendMessage(hWndChild, g_subclassRegisteredMsg, FALSE, 0);
     }
-    if (was_messageOnly && !now_messageOnly) {
+    if (!now_messageOnly && !was_subclassed) {
         Wh_Log(L"Enabling subclass %08X", (DWORD)(UINT_PTR)hWndChild);
-        SetWindowSubclassFromAnyThread(hWndChild, GameWindowSubclassProc, 0, 0);
+        SubclassGameWindow(hWndChild);
     }
     return oldparent;
 }
@@ -284,7 +369,7 @@ HWND WINAPI CreateWindowExAHook(DWORD dwExStyle,LPCSTR lpClassName,LPCSTR lpWind
     if (!hWnd) return hWnd;
     if (hWndParent == HWND_MESSAGE) return hWnd; // do not subclass message-only window
     Wh_Log(L"New window subclassed: %08X (%s)", (DWORD)(UINT_PTR)hWnd, lpWindowName);
-    SetWindowSubclassFromAnyThread(hWnd, GameWindowSubclassProc, 0, 0);
+    SubclassGameWindow(hWnd);
     return hWnd;
 }
 
@@ -295,7 +380,7 @@ HWND WINAPI CreateWindowExWHook(DWORD dwExStyle,LPCWSTR lpClassName,LPCWSTR lpWi
     HWND hWnd = pOriginalCreateWindowExW(dwExStyle,lpClassName,lpWindowName,dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
     if (!hWnd) return hWnd;
     if (hWndParent == HWND_MESSAGE) return hWnd; // do not subclass message-only window
-    SetWindowSubclassFromAnyThread(hWnd, GameWindowSubclassProc, 0, 0);
+    SubclassGameWindow(hWnd);
     Wh_Log(L"New window subclassed: %08X (%s)", (DWORD)(UINT_PTR)hWnd, lpWindowName);
     return hWnd;
 }
@@ -309,12 +394,15 @@ BOOL DestroyWindowHook(HWND hWnd) {
         Wh_Log(L"Main window destroyed");
         g_thisProgramWindow = 0;
     }
-    return pOriginalDestroyWindow(hWnd);
+    BOOL result = pOriginalDestroyWindow(hWnd);
+    if (result) ForgetSubclassedWindow(hWnd);
+    return result;
 }
 
 // ------------------ Dealing with existing windows ------------------
 // We subclass all existing windows when the mod is enabled
 // while the program is already running
+// lParam - std::vector<HWND> collecting the windows to subclass
 BOOL CALLBACK InitialEnumGameWindowsFunc(HWND hWnd, LPARAM lParam) {
     DWORD dwProcessId = 0;
     DWORD dwThreadId = GetWindowThreadProcessId(hWnd, &dwProcessId);
@@ -326,28 +414,27 @@ BOOL CALLBACK InitialEnumGameWindowsFunc(HWND hWnd, LPARAM lParam) {
         WCHAR buf[50];
         GetWindowTextW(hWnd, buf, 50); // sends a WM_GETTEXT msg, returns chars written
         Wh_Log(L"Existing window subclassed: %08X (%s)", (DWORD)(UINT_PTR)hWnd, buf);
-        SetWindowSubclassFromAnyThread(hWnd, GameWindowSubclassProc, 0, 0);
+        ((std::vector<HWND>*)lParam)->push_back(hWnd);
     }
 
     return TRUE;
 }
 
 // ------------------ Clean up when mod is disabled ------------------
-// Send a message to each windowProc in the process
-// If it was subclassed, it will process the message and unsubclass itself
-BOOL CALLBACK EnumGameWindowsUnsubclassFunc(HWND hWnd, LPARAM lParam) {
-    DWORD dwProcessId = 0;
-    DWORD dwThreadId = GetWindowThreadProcessId(hWnd, &dwProcessId);
-    if (!dwThreadId || dwProcessId != GetCurrentProcessId()) {
-        return TRUE;
+// Send a message to each subclassed window in the process
+// It will process the message and unsubclass itself
+void UnsubclassGameWindows() {
+    std::unordered_set<HWND> windows;
+    {
+        std::lock_guard<std::mutex> guard(g_subclassedWindowsMutex);
+        windows.swap(g_subclassedWindows);
     }
 
-    if (IsGameWindow(hWnd)) {
+    for (HWND hWnd : windows) {
+        if (!IsWindow(hWnd)) continue;
         Wh_Log(L"Unsubclass: %08X", (DWORD)(UINT_PTR)hWnd);
         SendMessage(hWnd, g_subclassRegisteredMsg, FALSE, 0);
     }
-
-    return TRUE;
 }
 
 // We delegate checking whether the mod should load / apply hooks to the Windhawk runtime.
@@ -376,7 +463,9 @@ BOOL Wh_ModInit() {
 
 
     // Add subclass to existing windows
-    EnumWindows(InitialEnumGameWindowsFunc, 0);
+    std::vector<HWND> existingWindows;
+    EnumWindows(InitialEnumGameWindowsFunc, (LPARAM)&existingWindows);
+    SubclassGameWindows(existingWindows);
 
     // Add hooks for other functions
     Wh_SetFunctionHook((void*)GetForegroundWindow, (void*)GetForegroundWindowHook,
@@ -399,7 +488,7 @@ void Wh_ModUninit() {
     g_thisProgramWindow = 0;
     g_enabledHooks = false;
     // Unsubclass all windows
-    EnumWindows(EnumGameWindowsUnsubclassFunc, 0);
+    UnsubclassGameWindows();
 }
 
 // The mod setting were changed, reload them.
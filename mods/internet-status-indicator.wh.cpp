@@ -2,7 +2,7 @@
 // @id              internet-status-indicator
 // @name            Internet Status Indicator
 // @description     Real-time network connectivity monitoring with visual indicators as a Tray Icon
-// @version         0.7
+// @version         0.9
 // @author          ALMAS CP
 // @github          https://github.com/almas-cp
 // @homepage        https://github.com/almas-cp
@@ -21,8 +21,9 @@ connection by pinging target hosts and provides visual feedback.
 
 ## Features
 - **Real-time monitoring**: Continuous network connectivity checks
-- **Simple ping-based checking**: Pings primary host, falls back to secondary if needed
-- **Customizable visual indicators**: Choose colors and shapes for connected/disconnected states
+- **Simple ping-based checking**: Pings the primary and secondary hosts in parallel, connected if either replies
+- **Customizable visual indicators**: Choose colors and shapes for connected/degraded/disconnected states
+- **Latency statistics**: Round-trip time percentiles and packet loss in the tooltip
 - **Customizable settings**: Configure check intervals, target hosts, and timeouts
 - **Lightweight**: Minimal system resource usage
 - **Simple Bitmap Icons**: Clean, reliable icon rendering
@@ -36,10 +37,17 @@ connection by pinging target hosts and provides visual feedback.
 
 ## How it works
 The mod performs periodic connectivity checks by:
-1. Ping primary target host (default: 8.8.8.8)
-2. If primary fails, ping secondary host (default: 1.1.1.1)
-3. If either ping succeeds: Green icon (connected)
-4. If both pings fail: Red icon (disconnected)
+1. Ping primary target host (default: 8.8.8.8) and secondary host (default: 1.1.1.1) in parallel
+2. If either ping succeeds: Green icon (connected)
+3. If both pings fail: Red icon (disconnected)
+4. If connected but slow: Orange icon (degraded), see the latency threshold setting
+
+The tooltip shows the round-trip time percentiles (p50/p95/p99) and packet loss
+of each host over the last 60 checks.
+
+While the status stays the same, checks are gradually spaced out up to once a
+minute. Network changes, such as an adapter connecting or disconnecting or an IP
+address change, trigger a check right away.
 
 
 ## Usage
@@ -67,7 +75,7 @@ This mod runs as part of the windhawk.exe process for better stability and resou
 
 - checkInterval: 5000
   $name: Check Interval (ms)
-  $description: How often to check connectivity (minimum 1000ms recommended)
+  $description: How often to check connectivity (minimum 1000ms recommended). While the status is unchanged, checks are up to twice as far apart
 
 
 - targetHost: "8.8.8.8"
@@ -77,7 +85,7 @@ This mod runs as part of the windhawk.exe process for better stability and resou
 
 - secondaryHost: "1.1.1.1"
   $name: Secondary Target Host  
-  $description: Secondary host to ping if primary fails (Cloudflare DNS)
+  $description: Secondary host to ping alongside the primary host (Cloudflare DNS)
 
 
 - timeout: 3000
@@ -125,6 +133,26 @@ This mod runs as part of the windhawk.exe process for better stability and resou
   $description: Blue component of disconnected state color
 
 
+- degradedLatency: 200
+  $name: Degraded Latency Threshold (ms)
+  $description: Show the degraded icon when the 95th percentile round-trip time of the fastest host exceeds this value (0 to disable)
+
+
+- degradedColorR: 255
+  $name: Degraded Color - Red (0-255)
+  $description: Red component of degraded state color
+
+
+- degradedColorG: 165
+  $name: Degraded Color - Green (0-255)
+  $description: Green component of degraded state color
+
+
+- degradedColorB: 0
+  $name: Degraded Color - Blue (0-255)
+  $description: Blue component of degraded state color
+
+
 - iconShape: 0
   $name: Icon Shape
   $description: 0=Circle, 1=Square
@@ -165,6 +193,16 @@ This mod runs as part of the windhawk.exe process for better stability and resou
 #define SHAPE_SQUARE 1
 
 
+// Upper limit for the check interval while the connection status is
+// unchanged, as a multiple of the configured interval. Kept small, since
+// network change notifications don't cover upstream outages
+#define MAX_STABLE_CHECK_INTERVAL_FACTOR 2
+
+
+// Network changes usually arrive in bursts, wait for them to settle before checking
+#define NETWORK_CHANGE_SETTLE_TIME 1000
+
+
 struct NetworkSettings {
     int checkInterval;
     std::string targetHost;
@@ -180,10 +218,21 @@ struct NetworkSettings {
     int disconnectedColorR;
     int disconnectedColorG;
     int disconnectedColorB;
+    int degradedLatency; // 0=Disabled
+    int degradedColorR;
+    int degradedColorG;
+    int degradedColorB;
     int iconShape; // 0=Circle, 1=Square
 };
 
 
+enum class ConnectionStatus {
+    Disconnected,
+    Connected,
+    Degraded, // Connected, but with high latency
+};
+
+
 // System tray icon management
 class TrayIconManager {
 private:
@@ -191,8 +240,9 @@ private:
     HWND hwnd;
     HICON hIconConnected;
     HICON hIconDisconnected;
+    HICON hIconDegraded;
     bool iconVisible;
-    bool currentConnectionState;
+    ConnectionStatus currentStatus;
     bool isInitialized;
     
     // Clamp color values to valid range
@@ -300,8 +350,10 @@ private:
         // Clean up existing icons
         if (hIconConnected) DestroyIcon(hIconConnected);
         if (hIconDisconnected) DestroyIcon(hIconDisconnected);
+        if (hIconDegraded) DestroyIcon(hIconDegraded);
         hIconConnected = NULL;
         hIconDisconnected = NULL;
+        hIconDegraded = NULL;
         
         // Create colors from settings
         COLORREF connectedColor = RGB(
@@ -316,14 +368,29 @@ private:
             ClampColor(settings.disconnectedColorB)
         );
         
+        COLORREF degradedColor = RGB(
+            ClampColor(settings.degradedColorR),
+            ClampColor(settings.degradedColorG),
+            ClampColor(settings.degradedColorB)
+        );
+        
         // Create icons
         hIconConnected = CreateCustomBitmapIcon(connectedColor, settings.iconSize, settings.iconShape);
         hIconDisconnected = CreateCustomBitmapIcon(disconnectedColor, settings.iconSize, settings.iconShape);
+        hIconDegraded = CreateCustomBitmapIcon(degradedColor, settings.iconSize, settings.iconShape);
+    }
+    
+    HICON GetStatusIcon(ConnectionStatus status) const {
+        switch (status) {
+            case ConnectionStatus::Connected: return hIconConnected;
+            case ConnectionStatus::Degraded: return hIconDegraded;
+            default: return hIconDisconnected;
+        }
     }
     
 public:
-    TrayIconManager() : hwnd(NULL), hIconConnected(NULL), hIconDisconnected(NULL), 
-                        iconVisible(false), currentConnectionState(false), isInitialized(false) {
+    TrayIconManager() : hwnd(NULL), hIconConnected(NULL), hIconDisconnected(NULL), hIconDegraded(NULL),
+                        iconVisible(false), currentStatus(ConnectionStatus::Disconnected), isInitialized(false) {
         memset(&nid, 0, sizeof(nid));
     }
     
@@ -331,6 +398,7 @@ public:
         Hide();
         if (hIconConnected) DestroyIcon(hIconConnected);
         if (hIconDisconnected) DestroyIcon(hIconDisconnected);
+        if (hIconDegraded) DestroyIcon(hIconDegraded);
     }
     
     bool Initialize(HWND window, const NetworkSettings& settings) {
@@ -343,7 +411,7 @@ public:
         // Create icons with settings
         CreateIcons(settings);
         
-        if (!hIconConnected || !hIconDisconnected) {
+        if (!hIconConnected || !hIconDisconnected || !hIconDegraded) {
             return false;
         }
         
@@ -382,15 +450,29 @@ public:
         return result;
     }
     
-    void UpdateStatus(bool connected, bool forceUpdate = false) {
+    // details - additional tooltip lines, e.g. latency statistics (optional)
+    void UpdateStatus(ConnectionStatus status, const wchar_t* details, bool forceUpdate = false) {
         if (!iconVisible || !isInitialized) return;
-        if (!forceUpdate && currentConnectionState == connected) return;
         
-        currentConnectionState = connected;
-        nid.hIcon = connected ? hIconConnected : hIconDisconnected;
+        const wchar_t* statusText = L"Disconnected";
+        if (status == ConnectionStatus::Connected) {
+            statusText = L"Connected";
+        } else if (status == ConnectionStatus::Degraded) {
+            statusText = L"Degraded";
+        }
+        
+        WCHAR tip[ARRAYSIZE(nid.szTip)];
+        if (details && *details) {
+            _snwprintf_s(tip, _TRUNCATE, L"Internet Status: %s\n%s", statusText, details);
+        } else {
+            _snwprintf_s(tip, _TRUNCATE, L"Internet Status: %s", statusText);
+        }
         
-        const wchar_t* status = connected ? L"Connected" : L"Disconnected";
-        swprintf_s(nid.szTip, L"Internet Status: %s", status);
+        if (!forceUpdate && currentStatus == status && wcscmp(nid.szTip, tip) == 0) return;
+        
+        currentStatus = status;
+        nid.hIcon = GetStatusIcon(status);
+        wcscpy_s(nid.szTip, tip);
         
         Shell_NotifyIcon(NIM_MODIFY, &nid);
     }
@@ -399,12 +481,11 @@ public:
         if (!isInitialized) return;
         
         bool wasVisible = iconVisible;
-        bool wasConnected = currentConnectionState;
         
         CreateIcons(settings);
         
         if (wasVisible) {
-            nid.hIcon = wasConnected ? hIconConnected : hIconDisconnected;
+            nid.hIcon = GetStatusIcon(currentStatus);
             Shell_NotifyIcon(NIM_MODIFY, &nid);
         }
     }
@@ -414,7 +495,7 @@ public:
     void Cleanup() {
         Hide();
         isInitialized = false;
-        currentConnectionState = false;
+        currentStatus = ConnectionStatus::Disconnected;
     }
 };
 
@@ -473,6 +554,64 @@ public:
 const wchar_t* TrayWindow::CLASS_NAME = L"InternetStatusTrayWindow";
 
 
+// Rolling window of ping results of a single host
+class LatencyStats {
+private:
+    static const int CAPACITY = 60;
+    ULONG roundTripTimes[CAPACITY];
+    bool succeeded[CAPACITY];
+    int count = 0;
+    int next = 0;
+    
+public:
+    void Add(bool success, ULONG roundTripTime) {
+        roundTripTimes[next] = roundTripTime;
+        succeeded[next] = success;
+        next = (next + 1) % CAPACITY;
+        count = std::min(count + 1, CAPACITY);
+    }
+    
+    void Reset() {
+        count = 0;
+        next = 0;
+    }
+    
+    int GetLossPercent() const {
+        if (count == 0) return 0;
+        
+        int failed = 0;
+        for (int i = 0; i < count; i++) {
+            if (!succeeded[i]) failed++;
+        }
+        return failed * 100 / count;
+    }
+    
+    // Nearest-rank percentiles of the successful round-trip times, returns
+    // false if there are none
+    bool GetPercentiles(ULONG* p50, ULONG* p95, ULONG* p99) const {
+        ULONG sorted[CAPACITY];
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (succeeded[i]) sorted[n++] = roundTripTimes[i];
+        }
+        
+        if (n == 0) return false;
+        
+        std::sort(sorted, sorted + n);
+        
+        auto percentile = [&](int percent) {
+            int rank = (percent * n + 99) / 100;
+            return sorted[std::max(rank, 1) - 1];
+        };
+        
+        *p50 = percentile(50);
+        *p95 = percentile(95);
+        *p99 = percentile(99);
+        return true;
+    }
+};
+
+
 class InternetStatusMonitor {
 private:
     std::atomic<bool> isRunning{false};
@@ -480,6 +619,8 @@ private:
     std::thread monitorThread;
     NetworkSettings settings;
     HANDLE hIcmpFile;
+    HANDLE hIpInterfaceChange = nullptr;
+    HANDLE hUnicastIpAddressChange = nullptr;
     
     std::unique_ptr<TrayWindow> trayWindow;
     std::unique_ptr<TrayIconManager> trayIcon;
@@ -488,6 +629,19 @@ private:
     // For interruptible waiting
     std::condition_variable cv;
     std::mutex cv_mutex;
+    bool networkChanged = false; // protected by cv_mutex
+    
+    // Only accessed by the monitoring thread
+    LatencyStats primaryStats;
+    LatencyStats secondaryStats;
+    std::string primaryStatsHost;
+    std::string secondaryStatsHost;
+    
+    // The last status and tooltip details, to show them right away when the
+    // tray icon is shown again after a settings change
+    std::mutex lastStatusMutex;
+    ConnectionStatus lastStatus = ConnectionStatus::Disconnected;
+    std::wstring lastDetails;
     
 public:
     InternetStatusMonitor() : hIcmpFile(INVALID_HANDLE_VALUE), 
@@ -537,11 +691,7 @@ public:
         return hIcmpFile != INVALID_HANDLE_VALUE;
     }
     
-    bool PingHost(const std::string& hostname) {
-        if (hIcmpFile == INVALID_HANDLE_VALUE) {
-            if (!InitializeIcmp()) return false;
-        }
-        
+    bool ResolveHost(const std::string& hostname, IPAddr* destIP) {
         struct addrinfo hints = {0};
         struct addrinfo* result = nullptr;
         hints.ai_family = AF_INET;
@@ -551,31 +701,156 @@ public:
         }
         
         struct sockaddr_in* addr = (struct sockaddr_in*)result->ai_addr;
-        IPAddr destIP = addr->sin_addr.s_addr;
+        *destIP = addr->sin_addr.s_addr;
         freeaddrinfo(result);
+        return true;
+    }
+    
+    struct PingRequest {
+        HANDLE hEvent = nullptr;
+        LPVOID replyBuffer = nullptr;
+        DWORD replySize = 0;
+        bool pending = false;
+        bool success = false;
+        ULONG roundTripTime = 0;
+    };
+    
+    static constexpr char kPingData[] = "NetworkStatusCheck";
+    
+    // Starts an asynchronous ping, the request's event is signaled when it completes
+    void StartPing(const std::string& hostname, PingRequest& request) {
+        IPAddr destIP;
+        if (!ResolveHost(hostname, &destIP)) return;
         
-        char sendData[] = "NetworkStatusCheck";
-        DWORD replySize = sizeof(ICMP_ECHO_REPLY) + sizeof(sendData);
-        LPVOID replyBuffer = malloc(replySize);
+        // Room for an ICMP error and the IO_STATUS_BLOCK used by asynchronous requests
+        request.replySize = sizeof(ICMP_ECHO_REPLY) + sizeof(kPingData) + 8 + 2 * sizeof(ULONG_PTR);
+        request.replyBuffer = malloc(request.replySize);
+        if (!request.replyBuffer) return;
         
-        if (!replyBuffer) return false;
+        request.hEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        if (!request.hEvent) return;
         
         // Use shorter timeout for faster shutdown
         DWORD pingTimeout = std::min((DWORD)settings.timeout, 1000UL);
         
-        DWORD numReplies = IcmpSendEcho(
-            hIcmpFile, destIP, sendData, sizeof(sendData),
-            nullptr, replyBuffer, replySize, pingTimeout
+        DWORD numReplies = IcmpSendEcho2(
+            hIcmpFile, request.hEvent, nullptr, nullptr, destIP,
+            (LPVOID)kPingData, sizeof(kPingData), nullptr,
+            request.replyBuffer, request.replySize, pingTimeout
         );
         
-        bool success = false;
-        if (numReplies > 0) {
-            PICMP_ECHO_REPLY reply = (PICMP_ECHO_REPLY)replyBuffer;
-            success = (reply->Status == IP_SUCCESS);
+        if (numReplies == 0 && GetLastError() == ERROR_IO_PENDING) {
+            request.pending = true;
+        } else if (numReplies > 0) {
+            PICMP_ECHO_REPLY reply = (PICMP_ECHO_REPLY)request.replyBuffer;
+            request.success = (reply->Status == IP_SUCCESS);
+            request.roundTripTime = reply->RoundTripTime;
+        }
+    }
+    
+    void FinishPing(PingRequest& request) {
+        if (request.pending) {
+            if (IcmpParseReplies(request.replyBuffer, request.replySize) > 0) {
+                PICMP_ECHO_REPLY reply = (PICMP_ECHO_REPLY)request.replyBuffer;
+                request.success = (reply->Status == IP_SUCCESS);
+                request.roundTripTime = reply->RoundTripTime;
+            }
+            request.pending = false;
+        }
+        
+        if (request.hEvent) {
+            CloseHandle(request.hEvent);
+            request.hEvent = nullptr;
         }
         
-        free(replyBuffer);
-        return success;
+        free(request.replyBuffer);
+        request.replyBuffer = nullptr;
+    }
+    
+    // Pings both hosts in parallel, so that their timeouts don't add up
+    void PingHosts(bool* primaryPing, bool* secondaryPing) {
+        *primaryPing = false;
+        *secondaryPing = false;
+        
+        // Start over if the hosts were changed in the settings
+        if (primaryStatsHost != settings.targetHost) {
+            primaryStats.Reset();
+            primaryStatsHost = settings.targetHost;
+        }
+        if (secondaryStatsHost != settings.secondaryHost) {
+            secondaryStats.Reset();
+            secondaryStatsHost = settings.secondaryHost;
+        }
+        
+        if (hIcmpFile == INVALID_HANDLE_VALUE) {
+            if (!InitializeIcmp()) {
+                primaryStats.Add(false, 0);
+                secondaryStats.Add(false, 0);
+                return;
+            }
+        }
+        
+        PingRequest requests[2];
+        StartPing(settings.targetHost, requests[0]);
+        StartPing(settings.secondaryHost, requests[1]);
+        
+        HANDLE events[2];
+        DWORD eventCount = 0;
+        for (auto& request : requests) {
+            if (request.pending) {
+                events[eventCount++] = request.hEvent;
+            }
+        }
+        
+        // The requests always complete within the ping timeout, and the reply
+        // buffers must stay valid until then
+        if (eventCount > 0) {
+            WaitForMultipleObjects(eventCount, events, TRUE, INFINITE);
+        }
+        
+        for (auto& request : requests) {
+            FinishPing(request);
+        }
+        
+        *primaryPing = requests[0].success;
+        *secondaryPing = requests[1].success;
+        
+        primaryStats.Add(requests[0].success, requests[0].roundTripTime);
+        secondaryStats.Add(requests[1].success, requests[1].roundTripTime);
+    }
+    
+    // Appends a tooltip line with the p50/p95/p99 round-trip times, e.g.
+    // "8.8.8.8: 12/20/25 ms, 0% loss". The lines are kept short, the whole
+    // tooltip must fit in the 128 characters of szTip.
+    static void AppendHostStats(std::wstring& text, const std::string& host, const LatencyStats& stats) {
+        WCHAR line[64];
+        ULONG p50, p95, p99;
+        if (stats.GetPercentiles(&p50, &p95, &p99)) {
+            _snwprintf_s(line, _TRUNCATE, L"%S: %lu/%lu/%lu ms, %d%% loss",
+                         host.c_str(), p50, p95, p99, stats.GetLossPercent());
+        } else {
+            _snwprintf_s(line, _TRUNCATE, L"%S: no replies", host.c_str());
+        }
+        
+        if (!text.empty()) text += L"\n";
+        text += line;
+    }
+    
+    // High latency if even the faster host is slow most of the time
+    bool IsLatencyDegraded() const {
+        if (settings.degradedLatency <= 0) return false;
+        
+        bool hasLatency = false;
+        ULONG bestP95 = 0;
+        for (const LatencyStats* stats : {&primaryStats, &secondaryStats}) {
+            ULONG p50, p95, p99;
+            if (stats->GetPercentiles(&p50, &p95, &p99)) {
+                bestP95 = hasLatency ? std::min(bestP95, p95) : p95;
+                hasLatency = true;
+            }
+        }
+        
+        return hasLatency && bestP95 > (ULONG)settings.degradedLatency;
     }
     
     void PerformConnectivityCheck() {
@@ -584,20 +859,12 @@ public:
         
         bool wasConnected = isConnected.load();
         
-        // SIMPLIFIED LOGIC: Just ping primary host, then secondary if primary fails
-        bool primaryPing = PingHost(settings.targetHost);
-        bool secondaryPing = false;
+        bool primaryPing, secondaryPing;
+        PingHosts(&primaryPing, &secondaryPing);
         
         // Check again if we should stop (ping might have taken time)
         if (!isRunning.load()) return;
         
-        if (!primaryPing) {
-            secondaryPing = PingHost(settings.secondaryHost);
-        }
-        
-        // Check one more time if we should stop
-        if (!isRunning.load()) return;
-        
         // If either ping succeeds, we're connected. That's it!
         bool currentlyConnected = primaryPing || secondaryPing;
         
@@ -612,9 +879,24 @@ public:
             }
         }
         
+        ConnectionStatus status = ConnectionStatus::Disconnected;
+        if (currentlyConnected) {
+            status = IsLatencyDegraded() ? ConnectionStatus::Degraded : ConnectionStatus::Connected;
+        }
+        
+        std::wstring details;
+        AppendHostStats(details, settings.targetHost, primaryStats);
+        AppendHostStats(details, settings.secondaryHost, secondaryStats);
+        
+        {
+            std::lock_guard<std::mutex> lock(lastStatusMutex);
+            lastStatus = status;
+            lastDetails = details;
+        }
+        
         // Update tray icon
         if (settings.showTrayIcon && trayIcon && trayIcon->IsVisible()) {
-            trayIcon->UpdateStatus(currentlyConnected, false);
+            trayIcon->UpdateStatus(status, details.c_str(), false);
         }
         
         // Verbose logging
@@ -622,8 +904,58 @@ public:
             Wh_Log(L"Status: Primary=%s, Secondary=%s, Result=%s (%s)",
                    primaryPing ? L"✓" : L"✗",
                    secondaryPing ? L"✓" : L"✗", 
-                   currentlyConnected ? L"CONNECTED" : L"DISCONNECTED",
-                   currentlyConnected ? L"🟢" : L"🔴");
+                   status == ConnectionStatus::Degraded ? L"DEGRADED" :
+                       currentlyConnected ? L"CONNECTED" : L"DISCONNECTED",
+                   status == ConnectionStatus::Degraded ? L"🟠" :
+                       currentlyConnected ? L"🟢" : L"🔴");
+            Wh_Log(L"Latency: %s", details.c_str());
+        }
+    }
+    
+    void SignalNetworkChange() {
+        {
+            std::lock_guard<std::mutex> lock(cv_mutex);
+            networkChanged = true;
+        }
+        cv.notify_all();
+    }
+    
+    static void WINAPI OnIpInterfaceChange(PVOID callerContext,
+                                           PMIB_IPINTERFACE_ROW row,
+                                           MIB_NOTIFICATION_TYPE notificationType) {
+        ((InternetStatusMonitor*)callerContext)->SignalNetworkChange();
+    }
+    
+    static void WINAPI OnUnicastIpAddressChange(PVOID callerContext,
+                                                PMIB_UNICASTIPADDRESS_ROW row,
+                                                MIB_NOTIFICATION_TYPE notificationType) {
+        ((InternetStatusMonitor*)callerContext)->SignalNetworkChange();
+    }
+    
+    void RegisterNetworkChangeNotifications() {
+        if (NotifyIpInterfaceChange(AF_UNSPEC, OnIpInterfaceChange, this,
+                                    FALSE, &hIpInterfaceChange) != NO_ERROR) {
+            Wh_Log(L"⚠️ NotifyIpInterfaceChange failed");
+            hIpInterfaceChange = nullptr;
+        }
+        
+        if (NotifyUnicastIpAddressChange(AF_UNSPEC, OnUnicastIpAddressChange, this,
+                                         FALSE, &hUnicastIpAddressChange) != NO_ERROR) {
+            Wh_Log(L"⚠️ NotifyUnicastIpAddressChange failed");
+            hUnicastIpAddressChange = nullptr;
+        }
+    }
+    
+    void UnregisterNetworkChangeNotifications() {
+        // Waits for callbacks which are in progress
+        if (hIpInterfaceChange) {
+            CancelMibChangeNotify2(hIpInterfaceChange);
+            hIpInterfaceChange = nullptr;
+        }
+        
+        if (hUnicastIpAddressChange) {
+            CancelMibChangeNotify2(hUnicastIpAddressChange);
+            hUnicastIpAddressChange = nullptr;
         }
     }
     
@@ -633,9 +965,13 @@ public:
         Sleep(1000);
         PerformConnectivityCheck();
         
+        int checkInterval = settings.checkInterval;
+        
         while (isRunning.load()) {
             auto startTime = std::chrono::steady_clock::now();
             
+            bool wasConnected = isConnected.load();
+            
             try {
                 PerformConnectivityCheck();
             } catch (...) {
@@ -645,16 +981,38 @@ public:
             // Check if we should stop before waiting
             if (!isRunning.load()) break;
             
+            // Back off while the status is unchanged, check frequently again
+            // once it changes
+            if (isConnected.load() == wasConnected) {
+                checkInterval = std::min(checkInterval * 2,
+                                         settings.checkInterval * MAX_STABLE_CHECK_INTERVAL_FACTOR);
+            } else {
+                checkInterval = settings.checkInterval;
+            }
+            
             auto endTime = std::chrono::steady_clock::now();
             auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
                 endTime - startTime).count();
             
-            int sleepTime = settings.checkInterval - (int)elapsed;
+            int sleepTime = checkInterval - (int)elapsed;
             if (sleepTime > 0) {
-                // Use condition variable for interruptible wait
+                // Use condition variable for interruptible wait, network
+                // changes trigger a check early
                 std::unique_lock<std::mutex> lock(cv_mutex);
                 cv.wait_for(lock, std::chrono::milliseconds(sleepTime), 
+                           [this] { return !isRunning.load() || networkChanged; });
+            }
+            
+            std::unique_lock<std::mutex> lock(cv_mutex);
+            if (networkChanged) {
+                cv.wait_for(lock, std::chrono::milliseconds(NETWORK_CHANGE_SETTLE_TIME),
                            [this] { return !isRunning.load(); });
+                networkChanged = false;
+                checkInterval = settings.checkInterval;
+                
+                if (settings.logVerbose) {
+                    Wh_Log(L"🔄 Network change detected, checking connectivity");
+                }
             }
         }
         
@@ -666,12 +1024,17 @@ public:
         
         isRunning.store(true);
         monitorThread = std::thread(&InternetStatusMonitor::MonitorLoop, this);
+        
+        RegisterNetworkChangeNotifications();
     }
     
     void Stop() {
         if (!isRunning.load()) return;
         
         Wh_Log(L"🔄 Stopping Internet Status Monitor...");
+        
+        UnregisterNetworkChangeNotifications();
+        
         isRunning.store(false);
         
         // Wake up the monitoring thread immediately
@@ -698,7 +1061,8 @@ public:
         if (settings.showTrayIcon && !trayIconInitialized) {
             InitializeTrayIcon();
             if (trayIcon && trayIcon->IsVisible()) {
-                trayIcon->UpdateStatus(isConnected.load(), true);
+                std::lock_guard<std::mutex> lock(lastStatusMutex);
+                trayIcon->UpdateStatus(lastStatus, lastDetails.c_str(), true);
             }
         } else if (!settings.showTrayIcon && trayIconInitialized) {
             if (trayIcon) {
@@ -747,6 +1111,10 @@ void LoadSettings() {
     settings.disconnectedColorR = Wh_GetIntSetting(L"disconnectedColorR");
     settings.disconnectedColorG = Wh_GetIntSetting(L"disconnectedColorG");
     settings.disconnectedColorB = Wh_GetIntSetting(L"disconnectedColorB");
+    settings.degradedLatency = Wh_GetIntSetting(L"degradedLatency");
+    settings.degradedColorR = Wh_GetIntSetting(L"degradedColorR");
+    settings.degradedColorG = Wh_GetIntSetting(L"degradedColorG");
+    settings.degradedColorB = Wh_GetIntSetting(L"degradedColorB");
     settings.iconShape = Wh_GetIntSetting(L"iconShape");
     
     settings.logVerbose = Wh_GetIntSetting(L"logVerbose") != 0;
@@ -2,11 +2,11 @@
 // @id              legacy-file-copy
 // @name            Legacy File Copy
 // @description     Restores the Windows 7 file copy dialog
-// @version         1.0.0
+// @version         1.0.1
 // @author          rounk-ctrl
 // @github          https://github.com/rounk-ctrl
 // @include         explorer.exe
-// @compilerOptions -lole32 -loleaut32 -lruntimeobject -ldbghelp
+// @compilerOptions -lole32 -loleaut32 -lruntimeobject
 // @architecture    x86-64
 // ==/WindhawkMod==
 
@@ -21,7 +21,6 @@ The code is based on the implementation in [ExplorerPatcher](https://github.com/
 */
 // ==/WindhawkModReadme==
 #include <Windows.h>
-#include <dbghelp.h>
 
 typedef BOOL(*SHELL32_CanDisplayWin8CopyDialogFunc)();
 BOOL(*SHELL32_CanDisplayWin8CopyDialogOrig)();
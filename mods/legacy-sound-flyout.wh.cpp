@@ -2,7 +2,7 @@
 // @id           legacy-sound-flyout
 // @name         Legacy (Win32) sound volume flyout
 // @description  Enables legacy sound volume flyout on Win10 taskbar
-// @version      1.0.0
+// @version      1.0.1
 // @author       Anixx
 // @github       https://github.com/Anixx
 // @include      explorer.exe
@@ -17,6 +17,7 @@ Enables legacy sound volume flyout on Windows 10 taskbar (running under either W
 // ==/WindhawkModReadme==
 
 #include <windows.h>
+#include <wchar.h>
 
 typedef LONG (WINAPI *REGQUERYVALUEEXW)(HKEY hKey, LPCWSTR lpValueName, LPDWORD lpReserved, LPDWORD lpType, LPBYTE lpData, LPDWORD lpcbData);
 
@@ -25,7 +26,8 @@ REGQUERYVALUEEXW pOriginalRegQueryValueExW;
 LONG WINAPI RegQueryValueExWHook(HKEY hKey, LPCWSTR lpValueName, LPDWORD lpReserved, LPDWORD lpType, LPBYTE lpData, LPDWORD lpcbData)
 {   
 
-    if (lstrcmpiW(lpValueName, L"EnableMtcUvc") == 0)
+    // Called for every registry read in explorer, keep the common path cheap
+    if (lpValueName && _wcsicmp(lpValueName, L"EnableMtcUvc") == 0)
         
     { 
             if (lpType)
@@ -2,7 +2,7 @@
 // @id           lm-vs-solution-icon
 // @name         Visual Studio Solution Icon
 // @description  Add an icon overlay on the Visual Studio task bar icon
-// @version      0.7
+// @version      0.7.1
 // @author       Mark Jansen
 // @github       https://github.com/learn-more
 // @twitter      https://twitter.com/learn_more
@@ -40,6 +40,8 @@ Inspired by [SolutionIcon](https://github.com/ashmind/SolutionIcon/blob/master/S
 
 #include <string>
 #include <filesystem>
+#include <map>
+#include <mutex>
 #include <shobjidl.h>
 
 
@@ -142,6 +144,35 @@ static HWND MainWindow();
 static HICON CreateCustomIcon(const std::wstring& full_path, const std::wstring& text);
 };
 
+// Generated icons by "<solution path>|<letters>". The icon is re-applied every time
+// the taskbar button is recreated or VS re-registers its restart command line, so
+// it's only rendered once per solution. Owned by the cache, freed on uninit.
+std::mutex g_generatedIconsMutex;
+std::map<std::wstring, HICON> g_generatedIcons;
+
+static HICON GetGeneratedIcon(const std::wstring& full_path, const std::wstring& text)
+{
+    std::wstring key = full_path + L"|" + text;
+
+    std::lock_guard<std::mutex> lock(g_generatedIconsMutex);
+    auto it = g_generatedIcons.find(key);
+    if (it != g_generatedIcons.end())
+        return it->second;
+
+    HICON icon = Utils::CreateCustomIcon(full_path, text);
+    if (icon)
+        g_generatedIcons[key] = icon;
+    return icon;
+}
+
+static void FreeGeneratedIcons()
+{
+    std::lock_guard<std::mutex> lock(g_generatedIconsMutex);
+    for (auto& entry : g_generatedIcons)
+        ::DestroyIcon(entry.second);
+    g_generatedIcons.clear();
+}
+
 static void ApplyIcon(const std::wstring& commandline)
 {
     Wh_Log(L"Got %s", commandline.c_str());
@@ -158,6 +189,7 @@ static void ApplyIcon(const std::wstring& commandline)
         }
 
         HICON icon = NULL;
+        bool iconIsCached = false;
         if (!tmp.empty())
         {
             std::filesystem::path path = tmp;
@@ -175,7 +207,8 @@ static void ApplyIcon(const std::wstring& commandline)
                 std::wstring ico = Utils::LettersFromFilename(tmp);
                 Wh_Log(L"'%s' => '%s'", tmp.c_str(), ico.c_str());
                 // Generate an icon
-                icon = Utils::CreateCustomIcon(tmp, ico);
+                icon = GetGeneratedIcon(tmp, ico);
+                iconIsCached = true;
             }
         }
 
@@ -187,7 +220,8 @@ static void ApplyIcon(const std::wstring& commandline)
         else
         {
             g_TaskbarList3->SetOverlayIcon(Utils::MainWindow(), icon, NULL);
-            ::DestroyIcon(icon);
+            if (!iconIsCached)
+                ::DestroyIcon(icon);
         }
     }
 }
@@ -265,6 +299,8 @@ void Wh_ModUninit(void)
     }
     g_TaskbarList3 = nullptr;
 
+    FreeGeneratedIcons();
+
     if (SUCCEEDED(g_CoInit))
         CoUninitialize();
 }
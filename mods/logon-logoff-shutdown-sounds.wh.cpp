@@ -2,7 +2,7 @@
 // @id              logon-logoff-shutdown-sounds
 // @name            Logon, Logoff & Shutdown Sounds Restored
 // @description     Restores the logon, logoff and shutdown sounds from earlier versions of Windows
-// @version         1.0.3
+// @version         1.0.4
 // @author          Toru the Red Fox
 // @github          https://github.com/TorutheRedFox
 // @twitter         https://twitter.com/TorutheRedFox
@@ -129,9 +129,9 @@ HRESULT WINAPI HRESULTFromLastErrorError()
     return hr;
 }
 
-HRESULT WINAPI PlaySoundFile(HANDLE* hCurrentThread, LPCWSTR lpszFileName)
+HRESULT WINAPI ReadSoundFile(LPCWSTR lpszFileName, LPVOID* lplpSndBuf, DWORD* lpcbSndBuf)
 {
-    DWORD szSoundFile;           // eax
+    DWORD szSoundFile = 0;           // eax
     signed int hr = 0;    // esi
     DWORD NumberOfBytesRead;  // [esp+8h] [ebp-Ch] BYREF
     HANDLE hFile;             // [esp+Ch] [ebp-8h]
@@ -170,26 +170,49 @@ HRESULT WINAPI PlaySoundFile(HANDLE* hCurrentThread, LPCWSTR lpszFileName)
         hr = HRESULTFromLastErrorError();
     }
 
-    if (SUCCEEDED(hr))
+    if (FAILED(hr) && lpSndBuf)
     {
-        HANDLE hPlaySndThread = CreateThread(0, 0, PlaySoundFileThreadProc, lpSndBuf, 0, 0);
-        if (hPlaySndThread)
-        {
-            if (hCurrentThread)
-                *hCurrentThread = hPlaySndThread;
-            else
-                CloseHandle(hPlaySndThread);
-            return hr;
-        }
-        hr = HRESULTFromLastErrorError();
+        LocalFree(lpSndBuf);
+        lpSndBuf = 0;
     }
 
+    *lplpSndBuf = lpSndBuf;
+    *lpcbSndBuf = SUCCEEDED(hr) ? szSoundFile : 0;
+    return hr;
+}
+
+// Plays the sound in lpSndBuf on a new thread, which takes ownership of the
+// buffer.
+HRESULT WINAPI PlaySoundBuffer(HANDLE* hCurrentThread, LPVOID lpSndBuf)
+{
+    HANDLE hPlaySndThread = CreateThread(0, 0, PlaySoundFileThreadProc, lpSndBuf, 0, 0);
+    if (hPlaySndThread)
+    {
+        if (hCurrentThread)
+            *hCurrentThread = hPlaySndThread;
+        else
+            CloseHandle(hPlaySndThread);
+        return S_OK;
+    }
+
+    HRESULT hr = HRESULTFromLastErrorError();
     if (lpSndBuf)
         LocalFree(lpSndBuf);
     
     return hr;
 }
 
+HRESULT WINAPI PlaySoundFile(HANDLE* hCurrentThread, LPCWSTR lpszFileName)
+{
+    LPVOID lpSndBuf;
+    DWORD cbSndBuf;
+
+    HRESULT hr = ReadSoundFile(lpszFileName, &lpSndBuf, &cbSndBuf);
+    if (SUCCEEDED(hr))
+        hr = PlaySoundBuffer(hCurrentThread, lpSndBuf);
+    return hr;
+}
+
 typedef enum _ELOGONLOGOFFSOUNDTYPE
 {
     ST_LOGON,
@@ -198,13 +221,24 @@ typedef enum _ELOGONLOGOFFSOUNDTYPE
     ST_START,
 } ELOGONLOGOFFSOUNDTYPE;
 
-HRESULT PlayLogonLogoffSound(HANDLE* hThread, ELOGONLOGOFFSOUNDTYPE enSoundType)
+// The sound files are preloaded into memory, so that they start playing
+// right away even while the disk is busy with the logoff or shutdown.
+typedef struct _PRELOADED_SOUND
+{
+    WCHAR szFileName[264];
+    LPVOID lpSndBuf;
+    DWORD cbSndBuf;
+} PRELOADED_SOUND;
+
+PRELOADED_SOUND g_preloadedSounds[ST_START + 1];
+SRWLOCK g_preloadedSoundsLock = SRWLOCK_INIT;
+
+HRESULT GetLogonLogoffSoundFileName(ELOGONLOGOFFSOUNDTYPE enSoundType, WCHAR *pvData, DWORD cbData)
 {
     const wchar_t *szSoundType;
     HRESULT hr;
     DWORD pcbData[4];
     WCHAR szSubKey[264];
-    WCHAR pvData[264];
 
     switch (enSoundType) {
         case ST_LOGON:
@@ -221,7 +255,7 @@ HRESULT PlayLogonLogoffSound(HANDLE* hThread, ELOGONLOGOFFSOUNDTYPE enSoundType)
             break;
     }
     
-    pcbData[0] = 520;
+    pcbData[0] = cbData;
     
     hr = wsprintf(szSubKey, TEXT("AppEvents\\Schemes\\Apps\\.Default\\%ws\\.Current"), szSoundType);
 
@@ -229,13 +263,165 @@ HRESULT PlayLogonLogoffSound(HANDLE* hThread, ELOGONLOGOFFSOUNDTYPE enSoundType)
     {
         hr = RegGetValue(HKEY_CURRENT_USER, szSubKey, 0, 2u, 0, pvData, pcbData);
         if (hr == S_OK)
-            return PlaySoundFile(hThread, pvData);
+            return S_OK;
         else
             return HRESULT_FROM_WIN32((USHORT)hr);
     }
     return hr;
 }
 
+// Gets a copy of the preloaded sound, if it is still the one configured in
+// the scheme.
+LPVOID CopyPreloadedSound(ELOGONLOGOFFSOUNDTYPE enSoundType, LPCWSTR lpszFileName)
+{
+    LPVOID lpSndBuf = NULL;
+
+    AcquireSRWLockShared(&g_preloadedSoundsLock);
+    PRELOADED_SOUND *pSound = &g_preloadedSounds[enSoundType];
+    if (pSound->lpSndBuf && lstrcmpiW(pSound->szFileName, lpszFileName) == 0)
+    {
+        lpSndBuf = LocalAlloc(0, pSound->cbSndBuf);
+        if (lpSndBuf)
+            memcpy(lpSndBuf, pSound->lpSndBuf, pSound->cbSndBuf);
+    }
+    ReleaseSRWLockShared(&g_preloadedSoundsLock);
+
+    return lpSndBuf;
+}
+
+// Loads the sounds configured in the scheme, skipping the ones which are
+// already loaded.
+void PreloadSounds(void)
+{
+    for (int i = ST_LOGON; i <= ST_START; i++)
+    {
+        WCHAR szFileName[264];
+        if (FAILED(GetLogonLogoffSoundFileName((ELOGONLOGOFFSOUNDTYPE)i, szFileName, sizeof(szFileName))))
+            szFileName[0] = L'\0';
+
+        AcquireSRWLockShared(&g_preloadedSoundsLock);
+        BOOL bUnchanged = lstrcmpiW(g_preloadedSounds[i].szFileName, szFileName) == 0;
+        ReleaseSRWLockShared(&g_preloadedSoundsLock);
+
+        if (bUnchanged)
+            continue;
+
+        LPVOID lpSndBuf = NULL;
+        DWORD cbSndBuf = 0;
+        if (szFileName[0])
+        {
+            HRESULT hr = ReadSoundFile(szFileName, &lpSndBuf, &cbSndBuf);
+            if (FAILED(hr))
+                Wh_Log(TEXT("Failed to preload %s: 0x%08X"), szFileName, hr);
+        }
+
+        AcquireSRWLockExclusive(&g_preloadedSoundsLock);
+        PRELOADED_SOUND *pSound = &g_preloadedSounds[i];
+        LPVOID lpOldSndBuf = pSound->lpSndBuf;
+        lstrcpyW(pSound->szFileName, szFileName);
+        pSound->lpSndBuf = lpSndBuf;
+        pSound->cbSndBuf = cbSndBuf;
+        ReleaseSRWLockExclusive(&g_preloadedSoundsLock);
+
+        if (lpOldSndBuf)
+            LocalFree(lpOldSndBuf);
+    }
+}
+
+void FreePreloadedSounds(void)
+{
+    AcquireSRWLockExclusive(&g_preloadedSoundsLock);
+    for (int i = ST_LOGON; i <= ST_START; i++)
+    {
+        PRELOADED_SOUND *pSound = &g_preloadedSounds[i];
+        if (pSound->lpSndBuf)
+            LocalFree(pSound->lpSndBuf);
+        pSound->szFileName[0] = L'\0';
+        pSound->lpSndBuf = NULL;
+        pSound->cbSndBuf = 0;
+    }
+    ReleaseSRWLockExclusive(&g_preloadedSoundsLock);
+}
+
+#ifndef REG_NOTIFY_THREAD_AGNOSTIC
+#define REG_NOTIFY_THREAD_AGNOSTIC 0x10000000L
+#endif
+
+// Reloads the preloaded sounds whenever the sound scheme changes
+HKEY g_hSchemesKey;
+HANDLE g_hSchemesChangedEvent;
+HANDLE g_hSchemesChangedWait;
+
+BOOL WatchSoundSchemes(void)
+{
+    return RegNotifyChangeKeyValue(g_hSchemesKey, TRUE,
+        REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC,
+        g_hSchemesChangedEvent, TRUE) == ERROR_SUCCESS;
+}
+
+VOID CALLBACK SoundSchemesChangedCallback(PVOID lpParameter, BOOLEAN TimerOrWaitFired)
+{
+    // Re-arm first, so that changes made while reloading aren't missed
+    WatchSoundSchemes();
+    PreloadSounds();
+}
+
+void StartWatchingSoundSchemes(void)
+{
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, L"AppEvents\\Schemes\\Apps\\.Default", 0, KEY_NOTIFY, &g_hSchemesKey) != ERROR_SUCCESS)
+    {
+        g_hSchemesKey = NULL;
+        Wh_Log(TEXT("Failed to open the sound schemes key"));
+        return;
+    }
+
+    g_hSchemesChangedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!g_hSchemesChangedEvent
+    || !WatchSoundSchemes()
+    || !RegisterWaitForSingleObject(&g_hSchemesChangedWait, g_hSchemesChangedEvent, SoundSchemesChangedCallback, NULL, INFINITE, WT_EXECUTEDEFAULT))
+    {
+        g_hSchemesChangedWait = NULL;
+        Wh_Log(TEXT("Failed to watch the sound schemes"));
+    }
+}
+
+void StopWatchingSoundSchemes(void)
+{
+    if (g_hSchemesChangedWait)
+    {
+        // Waits for a running callback to finish
+        UnregisterWaitEx(g_hSchemesChangedWait, INVALID_HANDLE_VALUE);
+        g_hSchemesChangedWait = NULL;
+    }
+
+    if (g_hSchemesKey)
+    {
+        RegCloseKey(g_hSchemesKey);
+        g_hSchemesKey = NULL;
+    }
+
+    if (g_hSchemesChangedEvent)
+    {
+        CloseHandle(g_hSchemesChangedEvent);
+        g_hSchemesChangedEvent = NULL;
+    }
+}
+
+HRESULT PlayLogonLogoffSound(HANDLE* hThread, ELOGONLOGOFFSOUNDTYPE enSoundType)
+{
+    WCHAR pvData[264];
+
+    HRESULT hr = GetLogonLogoffSoundFileName(enSoundType, pvData, sizeof(pvData));
+    if (FAILED(hr))
+        return hr;
+
+    LPVOID lpSndBuf = CopyPreloadedSound(enSoundType, pvData);
+    if (lpSndBuf)
+        return PlaySoundBuffer(hThread, lpSndBuf);
+
+    return PlaySoundFile(hThread, pvData);
+}
+
 LRESULT SHDefWindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
     if (IsWindowUnicode(hwnd))
@@ -582,6 +768,8 @@ BOOL Wh_ModInit()
 
     if (IsDesktopProcess())
     {
+        PreloadSounds();
+        StartWatchingSoundSchemes();
         InitSoundWindow();
         SetProcessShutdownParameters(0x4FF, NULL);
         if (!HasLogonSoundBeenPlayed())
@@ -604,6 +792,9 @@ VOID Wh_ModUninit()
 
     if (g_hSoundThread) // make sure DLL stays alive until we finish playing
         WaitForSingleObject(g_hSoundThread, INFINITE);
+
+    StopWatchingSoundSchemes();
+    FreePreloadedSounds();
     
     if (g_hwSound)
     {
@@ -2,12 +2,12 @@
 // @id              magnifier-mod
 // @name            Taskbar Magnifier M🔍d
 // @description     Adds a magnifier window you can customize and dock at the top, bottom, left, or right of your screen and more.
-// @version         0.5.4
+// @version         0.5.5
 // @author          00face
 // @github          https://github.com/00face
 // @homepage        https://hyaenahyaena.com
 // @include         explorer.exe
-// @compilerOptions -lgdi32 -lcomdlg32 -luxtheme -lgdiplus
+// @compilerOptions -lgdi32 -lcomdlg32 -luxtheme -lgdiplus -ld3d11 -ldxgi -ld2d1 -ldcomp
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
@@ -28,12 +28,20 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
 - **Opacity**: Adjust the opacity level of the magnifier window.
 - **Monitor Selection**: Select which monitor to display the magnifier on.
 - **Click-through**: Does not interfere with your workspace.
+- **Rendering Backend**: Use the legacy Magnification API, or a GPU pipeline
+  based on Desktop Duplication which only redraws when the cursor moves or the
+  magnified area changes, synchronized to the display refresh (requires Windows
+  10 version 2004 or newer).
 
 ![Magnifier Example](https://raw.githubusercontent.com/00face/Windhawk-Mod-Magnifier/refs/heads/main/magmodcode-ezgif.com-resize.gif)
 ![Magnifier Example2](https://raw.githubusercontent.com/00face/Windhawk-Mod-Magnifier/refs/heads/main/magmodvideo-ezgif.com-resize.gif)
 
 # Changelog
 
+## [0.5.5]
+### Added
+- Added an optional Desktop Duplication rendering backend.
+
 ## [0.5.4] - 2025-01-20
 ### Added
 - Ensured the magnifier window moves to the correct monitor when switching between monitors.
@@ -108,6 +116,12 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
 - monitorIndex: 0
   $name: Monitor Index
   $description: The index of the monitor to display the magnifier on (0 for primary monitor).
+- backend: magnification
+  $name: Rendering Backend
+  $description: Desktop Duplication renders on the GPU and follows the cursor without lag. The Magnification API is used as a fallback if it's unavailable.
+  $options:
+  - magnification: Magnification API
+  - desktopDuplication: Desktop Duplication (GPU)
 */
 // ==/WindhawkModSettings==
 
@@ -123,6 +137,24 @@ This mod adds a magnifier window you can customize and dock at the top, bottom,
 #include <string>
 #include <locale>
 #include <codecvt>
+#include <vector>
+#include <climits>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <d2d1_1.h>
+#include <d2d1_1helper.h>
+#include <dcomp.h>
+#include <wrl/client.h>
+
+using Microsoft::WRL::ComPtr;
+
+#ifndef WDA_EXCLUDEFROMCAPTURE
+#define WDA_EXCLUDEFROMCAPTURE 0x00000011
+#endif
+
+// Upper bound for waiting on a new desktop frame, so that monitor changes and
+// uninitialization are noticed.
+#define DUPLICATION_FRAME_TIMEOUT 100
 
 #define WC_MAGNIFIER L"Magnifier"
 
@@ -185,6 +217,8 @@ struct {
     int frameCount;
     DWORD startTime;
     bool isEnabled;
+    bool useDuplication;
+    std::atomic<bool> duplicationActive;
 } settings = {0};
 
 void UpdateMagnifierPosition();
@@ -208,6 +242,10 @@ void LoadSettings() {
     settings.paddingLeft = Wh_GetIntSetting(L"paddingLeft");
     settings.opacity = Wh_GetIntSetting(L"opacity");
     settings.monitorIndex = Wh_GetIntSetting(L"monitorIndex");
+
+    PCWSTR backend = Wh_GetStringSetting(L"backend");
+    settings.useDuplication = wcscmp(backend, L"desktopDuplication") == 0;
+    Wh_FreeStringSetting(backend);
     Wh_Log(L"Settings loaded");
 }
 
@@ -236,6 +274,13 @@ BOOL LoadMagnificationAPI() {
 LRESULT CALLBACK HostWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch (msg) {
         case WM_PAINT: {
+            if (settings.duplicationActive) {
+                // Rendered with DirectComposition, there's no redirection
+                // surface to paint on.
+                ValidateRect(hwnd, NULL);
+                return 0;
+            }
+
             PAINTSTRUCT ps;
             HDC hdc = BeginPaint(hwnd, &ps);
             if (hdc) {
@@ -264,7 +309,7 @@ LRESULT CALLBACK HostWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
             }
             break;
         case WM_MOUSEMOVE:
-            if (settings.isEnabled) {
+            if (settings.isEnabled && !settings.duplicationActive) {
                 settings.isUpdating = TRUE;
                 POINT currCursorPos;
                 if (GetCursorPos(&currCursorPos)) {
@@ -311,7 +356,7 @@ LRESULT CALLBACK HostWndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hwnd, msg, wParam, lParam);
 }
 
-HWND CreateMagnifierHost() {
+HWND CreateMagnifierHost(bool noRedirectionBitmap) {
     WNDCLASSEX wc = {0};
     wc.cbSize = sizeof(WNDCLASSEX);
     wc.lpfnWndProc = HostWndProc;
@@ -320,12 +365,15 @@ HWND CreateMagnifierHost() {
     wc.hbrBackground = (HBRUSH)(COLOR_WINDOW+1);
     wc.hCursor = LoadCursor(NULL, IDC_ARROW); // Set default cursor
 
-    if (!RegisterClassEx(&wc)) {
+    // The class is kept registered if the Desktop Duplication backend fell
+    // back to the Magnification API
+    if (!RegisterClassEx(&wc) && GetLastError() != ERROR_CLASS_ALREADY_EXISTS) {
         return NULL;
     }
 
     HWND hwnd = CreateWindowEx(
-        WS_EX_TOPMOST | WS_EX_LAYERED | WS_EX_TOOLWINDOW | WS_EX_TRANSPARENT | WS_EX_LAYERED,
+        WS_EX_TOPMOST | WS_EX_LAYERED | WS_EX_TOOLWINDOW | WS_EX_TRANSPARENT | WS_EX_LAYERED |
+            (noRedirectionBitmap ? WS_EX_NOREDIRECTIONBITMAP : 0),
         wc.lpszClassName,
         L"Magnifier Host",
         WS_POPUP | WS_VISIBLE,
@@ -377,7 +425,11 @@ HWND CreateMagnifierWindow(HWND hwndHost) {
 }
 
 void UpdateMagnifierPosition() {
-    if (!settings.hwndHost || !settings.hwndMagnifier || settings.isUpdating) {
+    if (!settings.hwndHost || settings.isUpdating) {
+        return;
+    }
+
+    if (!settings.hwndMagnifier && !settings.duplicationActive) {
         return;
     }
 
@@ -448,6 +500,13 @@ void UpdateMagnifierPosition() {
         return;
     }
 
+    // The duplication renderer follows the host window size and the cursor by
+    // itself
+    if (settings.duplicationActive) {
+        Wh_Log(L"Magnifier position updated");
+        return;
+    }
+
     if (!SetWindowPos(settings.hwndMagnifier, NULL, 0, 0, magnifierWidth, magnifierHeight,
                       SWP_NOZORDER | SWP_NOACTIVATE | SWP_SHOWWINDOW)) {
         return;
@@ -496,7 +555,421 @@ void UpdateMagnifierPosition() {
     Wh_Log(L"Magnifier position updated");
 }
 
-void MagnifierThreadFunc() {
+////////////////////////////////////////////////////////////////////////////////
+// Desktop Duplication backend
+//
+// The output under the cursor is duplicated, the area around the cursor is
+// copied on the GPU and drawn scaled with Direct2D into a DirectComposition
+// swap chain. Frames are only acquired when the desktop image or the pointer
+// changes, and presenting is synchronized to the vertical blank.
+
+struct DuplicationRenderer {
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> context;
+    ComPtr<IDXGIOutputDuplication> duplication;
+    ComPtr<IDXGISwapChain1> swapChain;
+    ComPtr<IDCompositionDevice> dcompDevice;
+    ComPtr<IDCompositionTarget> dcompTarget;
+    ComPtr<IDCompositionVisual> dcompVisual;
+    ComPtr<ID2D1Factory1> d2dFactory;
+    ComPtr<ID2D1DeviceContext> d2dContext;
+    ComPtr<ID2D1Bitmap1> targetBitmap;
+    ComPtr<ID3D11Texture2D> sourceTexture;
+    ComPtr<ID2D1Bitmap1> sourceBitmap;
+    HMONITOR monitor;
+    RECT outputRect;
+    UINT width;
+    UINT height;
+    UINT sourceWidth;
+    UINT sourceHeight;
+};
+
+bool CreateDuplicationRenderer(DuplicationRenderer& renderer, HMONITOR monitor) {
+    renderer = DuplicationRenderer{};
+
+    ComPtr<IDXGIFactory1> factory;
+    if (FAILED(CreateDXGIFactory1(IID_PPV_ARGS(&factory)))) {
+        Wh_Log(L"CreateDXGIFactory1 failed");
+        return false;
+    }
+
+    // Find the adapter and the output which the monitor belongs to
+    ComPtr<IDXGIAdapter1> adapter;
+    ComPtr<IDXGIOutput> output;
+    DXGI_OUTPUT_DESC outputDesc;
+    ComPtr<IDXGIAdapter1> currentAdapter;
+    for (UINT i = 0; !output && factory->EnumAdapters1(i, &currentAdapter) != DXGI_ERROR_NOT_FOUND; i++) {
+        ComPtr<IDXGIOutput> currentOutput;
+        for (UINT j = 0; currentAdapter->EnumOutputs(j, &currentOutput) != DXGI_ERROR_NOT_FOUND; j++) {
+            if (SUCCEEDED(currentOutput->GetDesc(&outputDesc)) && outputDesc.Monitor == monitor) {
+                adapter = currentAdapter;
+                output = currentOutput;
+                break;
+            }
+            currentOutput.Reset();
+        }
+        currentAdapter.Reset();
+    }
+
+    if (!output) {
+        Wh_Log(L"No DXGI output for monitor %p", monitor);
+        return false;
+    }
+
+    if (outputDesc.Rotation != DXGI_MODE_ROTATION_IDENTITY && outputDesc.Rotation != DXGI_MODE_ROTATION_UNSPECIFIED) {
+        Wh_Log(L"Rotated outputs aren't supported");
+        return false;
+    }
+
+    renderer.monitor = monitor;
+    renderer.outputRect = outputDesc.DesktopCoordinates;
+
+    if (FAILED(D3D11CreateDevice(adapter.Get(), D3D_DRIVER_TYPE_UNKNOWN, NULL, D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+                                 NULL, 0, D3D11_SDK_VERSION, &renderer.device, NULL, &renderer.context))) {
+        Wh_Log(L"D3D11CreateDevice failed");
+        return false;
+    }
+
+    ComPtr<IDXGIOutput1> output1;
+    HRESULT hr = output.As(&output1);
+    if (SUCCEEDED(hr)) {
+        hr = output1->DuplicateOutput(renderer.device.Get(), &renderer.duplication);
+    }
+    if (FAILED(hr)) {
+        Wh_Log(L"DuplicateOutput failed: 0x%08X", hr);
+        return false;
+    }
+
+    ComPtr<IDXGIDevice> dxgiDevice;
+    renderer.device.As(&dxgiDevice);
+
+    ComPtr<ID2D1Device> d2dDevice;
+    if (FAILED(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, renderer.d2dFactory.GetAddressOf())) ||
+        FAILED(renderer.d2dFactory->CreateDevice(dxgiDevice.Get(), &d2dDevice)) ||
+        FAILED(d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, &renderer.d2dContext))) {
+        Wh_Log(L"Direct2D initialization failed");
+        return false;
+    }
+
+    if (FAILED(DCompositionCreateDevice(dxgiDevice.Get(), IID_PPV_ARGS(&renderer.dcompDevice))) ||
+        FAILED(renderer.dcompDevice->CreateTargetForHwnd(settings.hwndHost, TRUE, &renderer.dcompTarget)) ||
+        FAILED(renderer.dcompDevice->CreateVisual(&renderer.dcompVisual))) {
+        Wh_Log(L"DirectComposition initialization failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool EnsureSwapChain(DuplicationRenderer& renderer, UINT width, UINT height) {
+    if (renderer.swapChain && renderer.width == width && renderer.height == height) {
+        return true;
+    }
+
+    renderer.d2dContext->SetTarget(NULL);
+    renderer.targetBitmap.Reset();
+
+    if (renderer.swapChain) {
+        if (FAILED(renderer.swapChain->ResizeBuffers(0, width, height, DXGI_FORMAT_UNKNOWN, 0))) {
+            Wh_Log(L"ResizeBuffers failed");
+            return false;
+        }
+    } else {
+        ComPtr<IDXGIDevice> dxgiDevice;
+        ComPtr<IDXGIAdapter> dxgiAdapter;
+        ComPtr<IDXGIFactory2> dxgiFactory;
+        renderer.device.As(&dxgiDevice);
+        if (FAILED(dxgiDevice->GetAdapter(&dxgiAdapter)) ||
+            FAILED(dxgiAdapter->GetParent(IID_PPV_ARGS(&dxgiFactory)))) {
+            return false;
+        }
+
+        DXGI_SWAP_CHAIN_DESC1 desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+        desc.BufferCount = 2;
+        desc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
+        desc.AlphaMode = DXGI_ALPHA_MODE_IGNORE;
+        if (FAILED(dxgiFactory->CreateSwapChainForComposition(renderer.device.Get(), &desc, NULL, &renderer.swapChain))) {
+            Wh_Log(L"CreateSwapChainForComposition failed");
+            return false;
+        }
+
+        renderer.dcompVisual->SetContent(renderer.swapChain.Get());
+        renderer.dcompTarget->SetRoot(renderer.dcompVisual.Get());
+        renderer.dcompDevice->Commit();
+    }
+
+    ComPtr<IDXGISurface> backBuffer;
+    if (FAILED(renderer.swapChain->GetBuffer(0, IID_PPV_ARGS(&backBuffer)))) {
+        return false;
+    }
+
+    D2D1_BITMAP_PROPERTIES1 props = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_TARGET | D2D1_BITMAP_OPTIONS_CANNOT_DRAW,
+        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE));
+    if (FAILED(renderer.d2dContext->CreateBitmapFromDxgiSurface(backBuffer.Get(), &props, &renderer.targetBitmap))) {
+        return false;
+    }
+
+    renderer.d2dContext->SetTarget(renderer.targetBitmap.Get());
+    renderer.width = width;
+    renderer.height = height;
+    return true;
+}
+
+bool EnsureSourceTexture(DuplicationRenderer& renderer, UINT width, UINT height) {
+    if (renderer.sourceTexture && renderer.sourceWidth == width && renderer.sourceHeight == height) {
+        return true;
+    }
+
+    renderer.sourceBitmap.Reset();
+    renderer.sourceTexture.Reset();
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    if (FAILED(renderer.device->CreateTexture2D(&desc, NULL, &renderer.sourceTexture))) {
+        return false;
+    }
+
+    ComPtr<IDXGISurface> surface;
+    renderer.sourceTexture.As(&surface);
+
+    D2D1_BITMAP_PROPERTIES1 props = D2D1::BitmapProperties1(
+        D2D1_BITMAP_OPTIONS_NONE,
+        D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE));
+    if (FAILED(renderer.d2dContext->CreateBitmapFromDxgiSurface(surface.Get(), &props, &renderer.sourceBitmap))) {
+        renderer.sourceTexture.Reset();
+        return false;
+    }
+
+    renderer.sourceWidth = width;
+    renderer.sourceHeight = height;
+    return true;
+}
+
+// Returns whether the frame's dirty or moved regions (in output coordinates)
+// intersect the given rectangle.
+bool IsRectDamaged(IDXGIOutputDuplication* duplication, const DXGI_OUTDUPL_FRAME_INFO& frameInfo,
+                   const RECT& rect, std::vector<BYTE>& buffer) {
+    if (frameInfo.LastPresentTime.QuadPart == 0) {
+        // Only the pointer was updated
+        return false;
+    }
+
+    if (frameInfo.TotalMetadataBufferSize == 0) {
+        return true;
+    }
+
+    buffer.resize(frameInfo.TotalMetadataBufferSize);
+
+    RECT intersection;
+    UINT size = 0;
+    if (FAILED(duplication->GetFrameMoveRects((UINT)buffer.size(), (DXGI_OUTDUPL_MOVE_RECT*)buffer.data(), &size))) {
+        return true;
+    }
+
+    auto moveRects = (DXGI_OUTDUPL_MOVE_RECT*)buffer.data();
+    for (UINT i = 0; i < size / sizeof(DXGI_OUTDUPL_MOVE_RECT); i++) {
+        if (IntersectRect(&intersection, &moveRects[i].DestinationRect, &rect)) {
+            return true;
+        }
+    }
+
+    if (FAILED(duplication->GetFrameDirtyRects((UINT)buffer.size(), (RECT*)buffer.data(), &size))) {
+        return true;
+    }
+
+    auto dirtyRects = (RECT*)buffer.data();
+    for (UINT i = 0; i < size / sizeof(RECT); i++) {
+        if (IntersectRect(&intersection, &dirtyRects[i], &rect)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void RunDuplicationLoop() {
+    DuplicationRenderer renderer;
+    std::vector<BYTE> metadataBuffer;
+    bool needsRedraw = true;
+    POINT lastCursorPos = {LONG_MIN, LONG_MIN};
+    float lastZoomLevel = 0;
+    int lastOpacity = -1;
+
+    while (settings.isInitialized) {
+        MSG msg;
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+        }
+
+        POINT cursorPos;
+        if (!GetCursorPos(&cursorPos)) {
+            Sleep(DUPLICATION_FRAME_TIMEOUT);
+            continue;
+        }
+
+        HMONITOR monitor = MonitorFromPoint(cursorPos, MONITOR_DEFAULTTONEAREST);
+        if (!renderer.duplication || renderer.monitor != monitor) {
+            if (!CreateDuplicationRenderer(renderer, monitor)) {
+                // E.g. the secure desktop is shown or a mode change is in
+                // progress, try again later
+                renderer = DuplicationRenderer{};
+                Sleep(settings.idleUpdateInterval);
+                continue;
+            }
+            needsRedraw = true;
+        }
+
+        if (!settings.isEnabled) {
+            Sleep(DUPLICATION_FRAME_TIMEOUT);
+            continue;
+        }
+
+        DXGI_OUTDUPL_FRAME_INFO frameInfo;
+        ComPtr<IDXGIResource> desktopResource;
+        HRESULT hr = renderer.duplication->AcquireNextFrame(DUPLICATION_FRAME_TIMEOUT, &frameInfo, &desktopResource);
+        if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
+            continue;
+        }
+        if (FAILED(hr)) {
+            // DXGI_ERROR_ACCESS_LOST on mode changes, desktop switches, etc.
+            renderer.duplication.Reset();
+            continue;
+        }
+
+        RECT clientRect;
+        GetClientRect(settings.hwndHost, &clientRect);
+        UINT width = std::max(1L, clientRect.right - clientRect.left);
+        UINT height = std::max(1L, clientRect.bottom - clientRect.top);
+
+        float zoomLevel = std::max(0.01f, settings.zoomLevel);
+        LONG outputWidth = renderer.outputRect.right - renderer.outputRect.left;
+        LONG outputHeight = renderer.outputRect.bottom - renderer.outputRect.top;
+        LONG sourceWidth = std::clamp(static_cast<LONG>(width / zoomLevel), 1L, outputWidth);
+        LONG sourceHeight = std::clamp(static_cast<LONG>(height / zoomLevel), 1L, outputHeight);
+
+        // The area around the cursor, in output coordinates
+        RECT sourceRect;
+        sourceRect.left = std::clamp(cursorPos.x - renderer.outputRect.left - sourceWidth / 2, 0L, outputWidth - sourceWidth);
+        sourceRect.top = std::clamp(cursorPos.y - renderer.outputRect.top - sourceHeight / 2, 0L, outputHeight - sourceHeight);
+        sourceRect.right = sourceRect.left + sourceWidth;
+        sourceRect.bottom = sourceRect.top + sourceHeight;
+
+        if (width != renderer.width || height != renderer.height ||
+            zoomLevel != lastZoomLevel || settings.opacity != lastOpacity) {
+            needsRedraw = true;
+        }
+
+        if (cursorPos.x != lastCursorPos.x || cursorPos.y != lastCursorPos.y) {
+            needsRedraw = true;
+        }
+
+        if (!needsRedraw && !IsRectDamaged(renderer.duplication.Get(), frameInfo, sourceRect, metadataBuffer)) {
+            renderer.duplication->ReleaseFrame();
+            continue;
+        }
+
+        ComPtr<ID3D11Texture2D> desktopTexture;
+        bool ready = SUCCEEDED(desktopResource.As(&desktopTexture)) &&
+                     EnsureSwapChain(renderer, width, height) &&
+                     EnsureSourceTexture(renderer, sourceWidth, sourceHeight);
+        if (ready) {
+            D3D11_BOX box = {
+                static_cast<UINT>(sourceRect.left), static_cast<UINT>(sourceRect.top), 0,
+                static_cast<UINT>(sourceRect.right), static_cast<UINT>(sourceRect.bottom), 1
+            };
+            renderer.context->CopySubresourceRegion(renderer.sourceTexture.Get(), 0, 0, 0, 0, desktopTexture.Get(), 0, &box);
+        }
+
+        // Release the desktop image as soon as possible, it's held back from
+        // the compositor until then
+        desktopTexture.Reset();
+        desktopResource.Reset();
+        renderer.duplication->ReleaseFrame();
+
+        if (!ready) {
+            renderer.duplication.Reset();
+            continue;
+        }
+
+        // Blended over white, same as the magnifier control over the host
+        // window
+        renderer.d2dContext->BeginDraw();
+        renderer.d2dContext->Clear(D2D1::ColorF(D2D1::ColorF::White));
+        renderer.d2dContext->DrawBitmap(renderer.sourceBitmap.Get(),
+                                        D2D1::RectF(0, 0, static_cast<float>(width), static_cast<float>(height)),
+                                        settings.opacity / 255.0f, D2D1_INTERPOLATION_MODE_LINEAR, NULL);
+        hr = renderer.d2dContext->EndDraw();
+        if (SUCCEEDED(hr)) {
+            // Wait for the vertical blank
+            hr = renderer.swapChain->Present(1, 0);
+        }
+
+        if (FAILED(hr)) {
+            // Device removed or reset, recreate everything
+            renderer.duplication.Reset();
+            continue;
+        }
+
+        needsRedraw = false;
+        lastCursorPos = cursorPos;
+        lastZoomLevel = zoomLevel;
+        lastOpacity = settings.opacity;
+    }
+}
+
+bool RunDuplicationBackend() {
+    settings.hwndHost = CreateMagnifierHost(true);
+    if (!settings.hwndHost) {
+        return false;
+    }
+
+    // Without excluding the window, it would show up in its own capture
+    if (!SetWindowDisplayAffinity(settings.hwndHost, WDA_EXCLUDEFROMCAPTURE)) {
+        Wh_Log(L"SetWindowDisplayAffinity failed: %u", GetLastError());
+        DestroyWindow(settings.hwndHost);
+        settings.hwndHost = NULL;
+        return false;
+    }
+
+    POINT cursorPos = {0, 0};
+    GetCursorPos(&cursorPos);
+    DuplicationRenderer probe;
+    if (!CreateDuplicationRenderer(probe, MonitorFromPoint(cursorPos, MONITOR_DEFAULTTONEAREST))) {
+        DestroyWindow(settings.hwndHost);
+        settings.hwndHost = NULL;
+        return false;
+    }
+    probe = DuplicationRenderer{};
+
+    settings.isInitialized = TRUE;
+    settings.isEnabled = true;
+    settings.duplicationActive = true;
+
+    UpdateMagnifierPosition();
+
+    RunDuplicationLoop();
+
+    settings.duplicationActive = false;
+    DestroyWindow(settings.hwndHost);
+    settings.hwndHost = NULL;
+    return true;
+}
+
+void RunMagnificationBackend() {
     if (!LoadMagnificationAPI()) {
         return;
     }
@@ -506,9 +979,7 @@ void MagnifierThreadFunc() {
         return;
     }
 
-    LoadSettings();
-
-    settings.hwndHost = CreateMagnifierHost();
+    settings.hwndHost = CreateMagnifierHost(false);
     if (!settings.hwndHost) {
         return;
     }
@@ -557,6 +1028,17 @@ void MagnifierThreadFunc() {
     if (settings.hMagnification) {
         FreeLibrary(settings.hMagnification);
     }
+}
+
+void MagnifierThreadFunc() {
+    LoadSettings();
+
+    if (!settings.useDuplication || !RunDuplicationBackend()) {
+        if (settings.useDuplication) {
+            Wh_Log(L"Desktop Duplication unavailable, using the Magnification API");
+        }
+        RunMagnificationBackend();
+    }
 
     UnregisterClass(L"MagnifierHostClass_Unique", GetModuleHandle(NULL));
     UnregisterClass(L"MagnifierClass_Unique", GetModuleHandle(NULL));
@@ -608,7 +1090,20 @@ void Wh_ModUninit() {
 }
 
 void Wh_ModSettingsChanged() {
+    bool prevUseDuplication = settings.useDuplication;
     LoadSettings();
+
+    // Switching the backend requires recreating the windows, restart the
+    // magnifier thread
+    if (settings.useDuplication != prevUseDuplication) {
+        settings.isInitialized = FALSE;
+        if (settings.magnifierThread.joinable()) {
+            settings.magnifierThread.join();
+        }
+        settings.magnifierThread = std::thread(MagnifierThreadFunc);
+        Wh_Log(L"Settings changed");
+        return;
+    }
     if (settings.isInitialized) {
         UpdateMagnifierPosition();
         // Update the opacity of the magnifier window
@@ -2,7 +2,7 @@
 // @id              maintain-flux-colour-temperature
 // @name            Maintain colour temperature of f.lux
 // @description     Keeps your preferred f.lux colour temperature settings, eliminating automatic changes
-// @version         1.0
+// @version         1.0.1
 // @author          Roland Pihlakas
 // @github          https://github.com/levitation
 // @homepage        https://www.simplify.ee/
@@ -179,40 +179,106 @@ void FillLocalTime(SYSTEMTIME* systemTime, const SYSTEMTIME& actualSystemTime) {
     systemTime->wYear = actualSystemTime.wYear;     //Use the current year. This has two benefits. First, the daylight saving laws may change across years, so this code ensures that current daylight saving law is considered. Secondly, the user does not need to enter one more number for the year, which would not be essential for specifying the f.lux time.
 }
 
+struct FakeTimes {
+    FILETIME systemTimeAsFileTime;
+    SYSTEMTIME systemTime;
+    SYSTEMTIME localTime;
+};
+
+//The fake time only depends on the settings, the current year and the current time zone offset, so it is computed once and then reused. It is refreshed once a minute in order to pick up time zone and daylight saving changes.
+const ULONGLONG FAKE_TIMES_REFRESH_INTERVAL_MS = 60 * 1000;
+
+SRWLOCK g_fakeTimesLock = SRWLOCK_INIT;
+bool g_fakeTimesValid = false;
+ULONGLONG g_fakeTimesComputedAtTick;
+FakeTimes g_fakeTimes;
+
+bool ComputeFakeTimes(FakeTimes* fakeTimes) {
+
+    SYSTEMTIME actualSystemTime;
+    pOriginalGetSystemTime(&actualSystemTime);
+
+    SYSTEMTIME actualLocalTime;
+    pOriginalGetLocalTime(&actualLocalTime);
+
+    bool error = false;
+    __int64 offset = Subtract(&error, actualLocalTime, actualSystemTime);
+    Wh_Log(L"offset: %lli", (long long)offset);
+
+    if (error)
+        return false;
+
+    SYSTEMTIME localTime;
+    FillLocalTime(&localTime, actualLocalTime);
+    //The wDayOfWeek member of the SYSTEMTIME structure is ignored in SystemTimeToFileTime() function - https://learn.microsoft.com/en-us/windows/win32/api/timezoneapi/nf-timezoneapi-systemtimetofiletime
+
+    FILETIME localTimeAsFileTime;
+    if (!SystemTimeToFileTime(
+        &localTime,
+        &localTimeAsFileTime
+    )) {
+        Wh_Log(L"Error: SystemTimeToFileTime failed");
+        return false;
+    }
+
+    fakeTimes->systemTimeAsFileTime = Subtract(localTimeAsFileTime, offset);     //local time to system time
+
+    //calculate wDayOfWeek - https://stackoverflow.com/questions/3017745/given-date-get-day-of-week-systemtime
+    //the conversion from FILETIME will also compute the wDayOfWeek as a side effect
+    if (
+        !FileTimeToSystemTime(&fakeTimes->systemTimeAsFileTime, &fakeTimes->systemTime)
+        || !FileTimeToSystemTime(&localTimeAsFileTime, &fakeTimes->localTime)
+    ) {
+        Wh_Log(L"Error: FileTimeToSystemTime failed");
+        return false;
+    }
+
+    return true;
+}
+
+bool GetFakeTimes(FakeTimes* fakeTimes) {
+
+    ULONGLONG tickCount = GetTickCount64();
+
+    AcquireSRWLockShared(&g_fakeTimesLock);
+    bool valid = g_fakeTimesValid && tickCount - g_fakeTimesComputedAtTick < FAKE_TIMES_REFRESH_INTERVAL_MS;
+    if (valid)
+        *fakeTimes = g_fakeTimes;
+    ReleaseSRWLockShared(&g_fakeTimesLock);
+
+    if (valid)
+        return true;
+
+    if (!ComputeFakeTimes(fakeTimes))
+        return false;
+
+    AcquireSRWLockExclusive(&g_fakeTimesLock);
+    g_fakeTimes = *fakeTimes;
+    g_fakeTimesComputedAtTick = tickCount;
+    g_fakeTimesValid = true;
+    ReleaseSRWLockExclusive(&g_fakeTimesLock);
+
+    return true;
+}
+
+void InvalidateFakeTimes() {
+
+    AcquireSRWLockExclusive(&g_fakeTimesLock);
+    g_fakeTimesValid = false;
+    ReleaseSRWLockExclusive(&g_fakeTimesLock);
+}
+
 void WINAPI GetSystemTimeAsFileTimeHook(OUT LPFILETIME lpSystemTimeAsFileTime) {
 
     if (lpSystemTimeAsFileTime) {       //let the original function handle invalid arguments
 
         Wh_Log(L"GetSystemTimeAsFileTime");
 
-        SYSTEMTIME actualSystemTime;
-        pOriginalGetSystemTime(&actualSystemTime);
-
-        SYSTEMTIME actualLocalTime;
-        pOriginalGetLocalTime(&actualLocalTime);
-
-        bool error = false;
-        __int64 offset = Subtract(&error, actualLocalTime, actualSystemTime);
-        Wh_Log(L"offset: %lli", (long long)offset);
-
-        if (!error) {
-
-            SYSTEMTIME localTime;
-            FillLocalTime(&localTime, actualLocalTime);
-            //The wDayOfWeek member of the SYSTEMTIME structure is ignored in SystemTimeToFileTime() function - https://learn.microsoft.com/en-us/windows/win32/api/timezoneapi/nf-timezoneapi-systemtimetofiletime
-
-            FILETIME localTimeAsFileTime;
-            if (SystemTimeToFileTime(
-                &localTime,
-                &localTimeAsFileTime
-            )) {
-                //NB! write only once to the target variable in order to not cause any side effects by changing it twice
-                *lpSystemTimeAsFileTime = Subtract(localTimeAsFileTime, offset);     //local time to system time
-                return;
-            }
-            else {
-                Wh_Log(L"Error: SystemTimeToFileTime failed");
-            }
+        FakeTimes fakeTimes;
+        if (GetFakeTimes(&fakeTimes)) {
+            //NB! write only once to the target variable in order to not cause any side effects by changing it twice
+            *lpSystemTimeAsFileTime = fakeTimes.systemTimeAsFileTime;
+            return;
         }
     }
     
@@ -225,29 +291,11 @@ void WINAPI GetSystemTimeHook(OUT LPSYSTEMTIME lpSystemTime) {
 
         Wh_Log(L"GetSystemTime");
 
-        SYSTEMTIME actualSystemTime;
-        pOriginalGetSystemTime(&actualSystemTime);
-
-        SYSTEMTIME actualLocalTime;
-        pOriginalGetLocalTime(&actualLocalTime);
-
-        bool error = false;
-        __int64 offset = Subtract(&error, actualLocalTime, actualSystemTime);
-        Wh_Log(L"offset: %lli", (long long)offset);
-
-        if (!error) {
-
-            SYSTEMTIME localTime;
-            FillLocalTime(&localTime, actualLocalTime);
-
-            //calculate wDayOfWeek - https://stackoverflow.com/questions/3017745/given-date-get-day-of-week-systemtime
-            //The wDayOfWeek member of the SYSTEMTIME structure is ignored in SystemTimeToFileTime() function - https://learn.microsoft.com/en-us/windows/win32/api/timezoneapi/nf-timezoneapi-systemtimetofiletime
-            //the offset subtraction in Subtract() will also compute the wDayOfWeek as a side effect
-
+        FakeTimes fakeTimes;
+        if (GetFakeTimes(&fakeTimes)) {
             //NB! write only once to the target variable in order to not cause any side effects by changing it twice
-            *lpSystemTime = Subtract(&error, localTime, offset);     //local time to system time
-            if (!error)
-                return;
+            *lpSystemTime = fakeTimes.systemTime;
+            return;
         }
     }
 
@@ -260,32 +308,11 @@ void WINAPI GetLocalTimeHook(OUT LPSYSTEMTIME lpLocalTime) {
 
         Wh_Log(L"GetLocalTime");
 
-        SYSTEMTIME actualLocalTime;
-        pOriginalGetLocalTime(&actualLocalTime);
-
-        SYSTEMTIME localTime;
-        FillLocalTime(&localTime, actualLocalTime);
-
-        //calculate wDayOfWeek - https://stackoverflow.com/questions/3017745/given-date-get-day-of-week-systemtime
-        //The wDayOfWeek member of the SYSTEMTIME structure is ignored in SystemTimeToFileTime() function - https://learn.microsoft.com/en-us/windows/win32/api/timezoneapi/nf-timezoneapi-systemtimetofiletime
-        
-        FILETIME localTimeAsFileTime;
-        if (SystemTimeToFileTime(
-            &localTime,
-            &localTimeAsFileTime
-        )) {
-            if (FileTimeToSystemTime(
-                &localTimeAsFileTime,
-                lpLocalTime     //NB! write only once to the target variable in order to not cause any side effects by changing it twice
-            )) {
-                return;
-            }
-            else {
-                Wh_Log(L"Error: FileTimeToSystemTime failed");
-            }
-        }
-        else {
-            Wh_Log(L"Error: SystemTimeToFileTime failed");
+        FakeTimes fakeTimes;
+        if (GetFakeTimes(&fakeTimes)) {
+            //NB! write only once to the target variable in order to not cause any side effects by changing it twice
+            *lpLocalTime = fakeTimes.localTime;
+            return;
         }
     }
     
@@ -335,6 +362,7 @@ void Wh_ModSettingsChanged() {
     Wh_Log(L"SettingsChanged");
 
     LoadSettings();
+    InvalidateFakeTimes();
 }
 
 void Wh_ModUninit() {
@@ -2,7 +2,7 @@
 // @id              msg-box-font-fix
 // @name            Message Box Fix
 // @description     Fixes the MessageBox font size and optionally make them like Windows XP
-// @version         2.1.1
+// @version         2.1.2
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -183,6 +183,29 @@ static CONST WCHAR szEmpty[] = L"";
 #define DU_BTNHEIGHT      14  // D.U. of button height
 #define DU_BTNWIDTH       50  // D.U. of minimum button width in a message box
 
+/* Fonts shared by the font cache and the message boxes which use them. They're
+   deleted when the last reference is released, so that a font which is still
+   being used by a message box on another thread isn't deleted when the cache is
+   updated or freed. */
+typedef struct tagMSGBOXFONTS
+{
+    LONG cRef;
+    HFONT hMessageFont;
+    HFONT hCaptionFont;
+} MSGBOXFONTS, *LPMSGBOXFONTS;
+
+void ReleaseMessageBoxFonts(LPMSGBOXFONTS pFonts)
+{
+    if (InterlockedDecrement(&pFonts->cRef) == 0)
+    {
+        if (pFonts->hMessageFont)
+            DeleteObject(pFonts->hMessageFont);
+        if (pFonts->hCaptionFont)
+            DeleteObject(pFonts->hCaptionFont);
+        delete pFonts;
+    }
+}
+
 // Custom struct and function because we can't use gpsi
 typedef struct tagMSGBOXMETRICS
 {
@@ -191,8 +214,9 @@ typedef struct tagMSGBOXMETRICS
     WORD wMaxBtnSize;
     HFONT hCaptionFont;
     HFONT hMessageFont;
+    LPMSGBOXFONTS pFonts;
 } MSGBOXMETRICS, *LPMSGBOXMETRICS;
-MSGBOXMETRICS mbm;
+thread_local MSGBOXMETRICS mbm;
 
 int GetCharDimensions(HDC hdc, TEXTMETRICW *lptm, int *lpcy)
 {
@@ -276,42 +300,123 @@ UINT MB_FindLongestString(HDC hdc, LPCWSTR *ppszButtonText, DWORD cButtons)
     return wRetVal;
 }
 
+/* Fonts and their measurements only change with the DPI or the system fonts,
+   so they're kept around instead of being created and measured for every box. */
+typedef struct tagMSGBOXFONTCACHE
+{
+    UINT nDpi;
+    LOGFONTW lfMessageFont;
+    LOGFONTW lfCaptionFont;
+    LPMSGBOXFONTS pFonts;
+    int cxMsgFontChar;
+    int cyMsgFontChar;
+} MSGBOXFONTCACHE;
+MSGBOXFONTCACHE g_mbFontCache = { 0 };
+SRWLOCK g_mbFontCacheLock = SRWLOCK_INIT;
+
+void FreeMessageBoxFontCache(void)
+{
+    AcquireSRWLockExclusive(&g_mbFontCacheLock);
+    if (g_mbFontCache.pFonts)
+        ReleaseMessageBoxFonts(g_mbFontCache.pFonts);
+    ZeroMemory(&g_mbFontCache, sizeof(g_mbFontCache));
+    ReleaseSRWLockExclusive(&g_mbFontCacheLock);
+}
+
+/* Call with g_mbFontCacheLock held exclusively */
+BOOL UpdateMessageBoxFontCache(HDC hMemDC, UINT nDpi, const NONCLIENTMETRICSW *pncm)
+{
+    if (g_mbFontCache.pFonts
+    && g_mbFontCache.nDpi == nDpi
+    && 0 == memcmp(&g_mbFontCache.lfMessageFont, &pncm->lfMessageFont, sizeof(LOGFONTW))
+    && 0 == memcmp(&g_mbFontCache.lfCaptionFont, &pncm->lfCaptionFont, sizeof(LOGFONTW)))
+    {
+        return TRUE;
+    }
+
+    HFONT hf = CreateFontIndirectW(&pncm->lfMessageFont);
+    if (!hf)
+        return FALSE;
+
+    HFONT hfOld = (HFONT)SelectObject(hMemDC, hf);
+
+    TEXTMETRICW tm;
+    int iAverageCharHeight;
+    int iAverageCharWidth = GetCharDimensions(hMemDC, nullptr, &iAverageCharHeight);
+    BOOL succeeded = GetTextMetricsW(hMemDC, &tm);
+
+    SelectObject(hMemDC, hfOld);
+
+    if (!succeeded)
+    {
+        DeleteObject(hf);
+        return FALSE;
+    }
+
+    LPMSGBOXFONTS pFonts = new MSGBOXFONTS;
+    pFonts->cRef = 1;
+    pFonts->hMessageFont = hf;
+    pFonts->hCaptionFont = CreateFontIndirectW(&pncm->lfCaptionFont);
+
+    if (g_mbFontCache.pFonts)
+        ReleaseMessageBoxFonts(g_mbFontCache.pFonts);
+
+    g_mbFontCache.nDpi = nDpi;
+    g_mbFontCache.lfMessageFont = pncm->lfMessageFont;
+    g_mbFontCache.lfCaptionFont = pncm->lfCaptionFont;
+    g_mbFontCache.pFonts = pFonts;
+    g_mbFontCache.cxMsgFontChar = iAverageCharWidth;
+    g_mbFontCache.cyMsgFontChar = tm.tmHeight;
+    return TRUE;
+}
+
+/* The fonts in pmbm are referenced by pmbm->pFonts, which must be released
+   with ReleaseMessageBoxFonts when the message box is done with them. */
 BOOL GetMessageBoxMetrics(LPMSGBOXMETRICS pmbm, LPCWSTR *ppszButtonText, DWORD cButtons)
 {  
     if (!pmbm)
         return FALSE;
 
     ZeroMemory(pmbm, sizeof(MSGBOXMETRICS));
-    BOOL succeeded = TRUE;
     HDC hDesktopDC = GetDC(NULL);
     HDC hMemDC = CreateCompatibleDC(hDesktopDC);
-
-    HFONT hf = GetMessageBoxFontForDpi_hook(GetDeviceCaps(hMemDC, LOGPIXELSX));
-    SelectObject(hMemDC, hf);
+    UINT nDpi = GetDeviceCaps(hMemDC, LOGPIXELSX);
 
     NONCLIENTMETRICSW ncm;
     ncm.cbSize = sizeof(NONCLIENTMETRICSW);
-    SystemParametersInfoForDpi(
+    BOOL succeeded = SystemParametersInfoForDpi(
         SPI_GETNONCLIENTMETRICS,
         sizeof(ncm),
         &ncm,
         0,
-        GetDeviceCaps(hMemDC, LOGPIXELSX)
+        nDpi
     );
-    
-    TEXTMETRICW tm;
-    int iAverageCharHeight;
-    int iAverageCharWidth = GetCharDimensions(hMemDC, nullptr, &iAverageCharHeight);
-    succeeded = GetTextMetricsW(hMemDC, &tm);
+
     if (succeeded)
     {
-        pmbm->cxMsgFontChar = iAverageCharWidth;
-        pmbm->cyMsgFontChar = tm.tmHeight;
-        pmbm->wMaxBtnSize = (g_mbStyle == MBS_NT4)
-            ? MB_FindLongestString(hMemDC, ppszButtonText, cButtons)
-            : XPixFromXDU(DU_BTNWIDTH, iAverageCharWidth);
-        pmbm->hCaptionFont = CreateFontIndirectW(&ncm.lfCaptionFont);
-        pmbm->hMessageFont = hf;
+        AcquireSRWLockExclusive(&g_mbFontCacheLock);
+        succeeded = UpdateMessageBoxFontCache(hMemDC, nDpi, &ncm);
+        if (succeeded)
+        {
+            pmbm->cxMsgFontChar = g_mbFontCache.cxMsgFontChar;
+            pmbm->cyMsgFontChar = g_mbFontCache.cyMsgFontChar;
+            InterlockedIncrement(&g_mbFontCache.pFonts->cRef);
+            pmbm->pFonts = g_mbFontCache.pFonts;
+            pmbm->hCaptionFont = g_mbFontCache.pFonts->hCaptionFont;
+            pmbm->hMessageFont = g_mbFontCache.pFonts->hMessageFont;
+            if (g_mbStyle == MBS_NT4)
+            {
+                // Depends on the button texts, so this is still measured every time.
+                HFONT hfOld = (HFONT)SelectObject(hMemDC, pmbm->hMessageFont);
+                pmbm->wMaxBtnSize = MB_FindLongestString(hMemDC, ppszButtonText, cButtons);
+                SelectObject(hMemDC, hfOld);
+            }
+            else
+            {
+                pmbm->wMaxBtnSize = XPixFromXDU(DU_BTNWIDTH, pmbm->cxMsgFontChar);
+            }
+        }
+        ReleaseSRWLockExclusive(&g_mbFontCacheLock);
     }
 
     DeleteDC(hMemDC);
@@ -855,6 +960,10 @@ int SoftModalMessageBox_XP(
 
     GetMessageBoxMetrics(&mbm, lpmb->ppszButtonText, lpmb->cButtons);
 
+    // mbm can be reused by another message box shown on this thread while the
+    // dialog is open.
+    LPMSGBOXFONTS pFonts = mbm.pFonts;
+
     dwStyleMsg = lpmb->dwStyle;
 
     if (dwStyleMsg & MB_RIGHT) {
@@ -1214,14 +1323,9 @@ SMB_Exit:
         LocalFree(hText);
     }
 
-    if (mbm.hCaptionFont)
+    if (pFonts)
     {
-        DeleteObject(mbm.hCaptionFont);
-    }
-
-    if (mbm.hMessageFont)
-    {
-        DeleteObject(mbm.hMessageFont);
+        ReleaseMessageBoxFonts(pFonts);
     }
 
     return iRetVal;
@@ -1330,6 +1434,11 @@ BOOL Wh_ModInit(void)
     return TRUE;
 }
 
+void Wh_ModUninit(void)
+{
+    FreeMessageBoxFontCache();
+}
+
 void Wh_ModSettingsChanged(void)
 {
     LoadSettings();
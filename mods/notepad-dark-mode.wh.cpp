@@ -2,7 +2,7 @@
 // @id              notepad-dark-mode
 // @name            Dark Mode for Notepad
 // @description     The missing dark mode theme for Notepad
-// @version         1.0
+// @version         1.0.1
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -803,7 +803,16 @@ bool UAHDarkModeWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam, L
 
         return true;
     }
+    case WM_SETTINGCHANGE:
+    {
+        // the menu colors follow the color scheme
+        if (!IsColorSchemeChangeMessage(lParam)) {
+            return false;
+        }
+    }
+    [[fallthrough]];
     case WM_THEMECHANGED:
+    case WM_DPICHANGED:
     {
         if (g_menuTheme) {
             CloseThemeData(g_menuTheme);
@@ -1083,6 +1092,11 @@ void Wh_ModUninit(void)
     UnsubclassStatusBar();
     UnsetDarkModeEditWindow();
     UnsetDarkModeNotepadWindow();
+
+    if (g_menuTheme) {
+        CloseThemeData(g_menuTheme);
+        g_menuTheme = nullptr;
+    }
 }
 
 void Wh_ModSettingsChanged(void)
@@ -2,7 +2,7 @@
 // @id              notifications-placement
 // @name            Customize Windows notifications placement
 // @description     Move notifications to another monitor or another corner of the screen
-// @version         1.1
+// @version         1.1.1
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -70,6 +70,7 @@ Only Windows 10 64-bit and Windows 11 are supported.
 #include <windhawk_utils.h>
 
 #include <atomic>
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -173,6 +174,67 @@ HMONITOR GetMonitorByInterfaceNameSubstr(PCWSTR interfaceNameSubstr) {
     return monitorResult;
 }
 
+// Resolving the monitor by ID or interface name enumerates all monitors (and
+// display devices), so the result is kept until the display configuration or
+// the settings change.
+struct {
+    std::mutex mutex;
+    bool valid;
+    HMONITOR monitor;
+    int monitorCount;
+    RECT virtualScreen;
+} g_destMonitorCache;
+
+void GetDisplaySignature(int* monitorCount, RECT* virtualScreen) {
+    *monitorCount = GetSystemMetrics(SM_CMONITORS);
+    virtualScreen->left = GetSystemMetrics(SM_XVIRTUALSCREEN);
+    virtualScreen->top = GetSystemMetrics(SM_YVIRTUALSCREEN);
+    virtualScreen->right =
+        virtualScreen->left + GetSystemMetrics(SM_CXVIRTUALSCREEN);
+    virtualScreen->bottom =
+        virtualScreen->top + GetSystemMetrics(SM_CYVIRTUALSCREEN);
+}
+
+void InvalidateDestMonitorCache() {
+    std::lock_guard<std::mutex> guard(g_destMonitorCache.mutex);
+    g_destMonitorCache.valid = false;
+}
+
+HMONITOR GetConfiguredDestMonitor() {
+    int monitorCount;
+    RECT virtualScreen;
+    GetDisplaySignature(&monitorCount, &virtualScreen);
+
+    std::lock_guard<std::mutex> guard(g_destMonitorCache.mutex);
+
+    if (g_destMonitorCache.valid &&
+        g_destMonitorCache.monitorCount == monitorCount &&
+        EqualRect(&g_destMonitorCache.virtualScreen, &virtualScreen)) {
+        MONITORINFO monitorInfo{
+            .cbSize = sizeof(MONITORINFO),
+        };
+        if (!g_destMonitorCache.monitor ||
+            GetMonitorInfo(g_destMonitorCache.monitor, &monitorInfo)) {
+            return g_destMonitorCache.monitor;
+        }
+    }
+
+    HMONITOR monitor = nullptr;
+    if (*g_settings.monitorInterfaceName.get()) {
+        monitor = GetMonitorByInterfaceNameSubstr(
+            g_settings.monitorInterfaceName.get());
+    } else if (g_settings.monitor >= 1) {
+        monitor = GetMonitorById(g_settings.monitor - 1);
+    }
+
+    g_destMonitorCache.valid = true;
+    g_destMonitorCache.monitor = monitor;
+    g_destMonitorCache.monitorCount = monitorCount;
+    g_destMonitorCache.virtualScreen = virtualScreen;
+
+    return monitor;
+}
+
 bool GetMonitorWorkArea(HMONITOR monitor, RECT* rc) {
     MONITORINFO monitorInfo{
         .cbSize = sizeof(MONITORINFO),
@@ -213,8 +275,16 @@ bool IsTargetCoreWindow(HWND hWnd) {
         return false;
     }
 
-    if (_wcsicmp(GetProcessFileName(processId).c_str(),
-                 L"ShellExperienceHost.exe") != 0) {
+    // Most calls come from ShellExperienceHost.exe itself, so avoid opening
+    // the process every time for windows of the current process.
+    static const bool isCurrentProcessTarget =
+        GetModuleHandle(L"ShellExperienceHost.exe") != nullptr;
+    if (processId == GetCurrentProcessId()) {
+        if (!isCurrentProcessTarget) {
+            return false;
+        }
+    } else if (_wcsicmp(GetProcessFileName(processId).c_str(),
+                        L"ShellExperienceHost.exe") != 0) {
         return false;
     }
 
@@ -324,15 +394,13 @@ void AdjustCoreWindowPos(int* x, int* y, int* cx, int* cy) {
     HMONITOR destMonitor = nullptr;
 
     if (!g_unloading) {
-        if (*g_settings.monitorInterfaceName.get()) {
-            destMonitor = GetMonitorByInterfaceNameSubstr(
-                g_settings.monitorInterfaceName.get());
-        } else if (g_settings.monitor == 0) {
+        if (!*g_settings.monitorInterfaceName.get() &&
+            g_settings.monitor == 0) {
             POINT pt;
             GetCursorPos(&pt);
             destMonitor = MonitorFromPoint(pt, MONITOR_DEFAULTTONEAREST);
-        } else if (g_settings.monitor >= 1) {
-            destMonitor = GetMonitorById(g_settings.monitor - 1);
+        } else {
+            destMonitor = GetConfiguredDestMonitor();
         }
     }
 
@@ -580,6 +648,7 @@ void Wh_ModSettingsChanged() {
     Wh_Log(L">");
 
     LoadSettings();
+    InvalidateDestMonitorCache();
 
     ApplySettings();
 }
@@ -2,7 +2,7 @@
 // @id              per-app-language-preferences
 // @name            Per-app Language Preferences
 // @description     Override the preferred UI language for specific apps.
-// @version         1.2
+// @version         1.2.1
 // @author          yezhiyi9670
 // @github          https://github.com/yezhiyi9670
 // @include         *
@@ -69,6 +69,9 @@ Note that it changes the language only and does not affect the encoding used in
 
 int my_langid = -1;
 
+// The process image doesn't change, so it's only queried once.
+wchar_t my_filename[2048];
+
 using LangGetter_t = short(WINAPI*)();
 
 LangGetter_t GetUserDefaultUILanguage_Original;
@@ -99,9 +102,10 @@ short WINAPI GetUserDefaultLCID_Hook() {
 }
 
 void determine_my_langid() {
-    wchar_t *filename_buf = new wchar_t[2048];
-    GetModuleFileNameW(NULL, filename_buf, 2048);
-    Wh_Log(L">Process file: %ls", filename_buf);
+    if(!*my_filename) {
+        GetModuleFileNameW(NULL, my_filename, ARRAYSIZE(my_filename));
+    }
+    Wh_Log(L">Process file: %ls", my_filename);
 
     int lang_id = -1;
     for(int index = 0; ; index++) {
@@ -110,14 +114,13 @@ void determine_my_langid() {
             Wh_FreeStringSetting(glob);
             break;
         }
-        if(S_OK == PathMatchSpecExW(filename_buf, glob, PMSF_MULTIPLE)) {
+        if(S_OK == PathMatchSpecExW(my_filename, glob, PMSF_MULTIPLE)) {
             lang_id = Wh_GetIntSetting(L"programList[%d].langId", index);
             Wh_FreeStringSetting(glob);
             break;
         }
         Wh_FreeStringSetting(glob);
     }
-    delete[] filename_buf;
     my_langid = lang_id;
 }
 
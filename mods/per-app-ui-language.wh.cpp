@@ -2,7 +2,7 @@
 // @id              per-app-ui-language
 // @name            Per-Application UI Language
 // @description     Set the Windows UI language per application.
-// @version         1.0.0
+// @version         1.0.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -39,12 +39,20 @@ MUI system).
 
 bool g_fLangSet = false;
 
+// The process image doesn't change, so it's only queried once.
+WCHAR g_szAppPath[MAX_PATH];
+LPCWSTR g_pszAppName = nullptr;
+
 void UpdateUILanguage(void)
 {
     LPWSTR pszLanguages = nullptr;
 
-    WCHAR szAppPath[MAX_PATH];
-    GetModuleFileNameW(GetModuleHandleW(NULL), szAppPath, ARRAYSIZE(szAppPath));
+    if (!*g_szAppPath)
+    {
+        GetModuleFileNameW(GetModuleHandleW(NULL), g_szAppPath, ARRAYSIZE(g_szAppPath));
+        WCHAR *pchBackslash = wcsrchr(g_szAppPath, L'\\');
+        g_pszAppName = pchBackslash ? pchBackslash + 1 : nullptr;
+    }
 
     for (int i = 0;; i++)
     {
@@ -59,14 +67,13 @@ void UpdateUILanguage(void)
         ExpandEnvironmentStringsW(pszPath, szExpandedPath, ARRAYSIZE(szExpandedPath));
         Wh_FreeStringSetting(pszPath);
 
-        WCHAR *pchBackslash = wcsrchr(szAppPath, L'\\');
-        if (!wcsicmp(szAppPath, szExpandedPath)
-        || (pchBackslash && !wcsicmp(pchBackslash + 1, szExpandedPath)))
+        if (!wcsicmp(g_szAppPath, szExpandedPath)
+        || (g_pszAppName && !wcsicmp(g_pszAppName, szExpandedPath)))
         {
             LPCWSTR pszLang = Wh_GetStringSetting(L"langs[%d].lang", i);
             if (*pszLang)
             {
-                Wh_Log(L"Application \"%s\" using languages %s", szAppPath, pszLang);
+                Wh_Log(L"Application \"%s\" using languages %s", g_szAppPath, pszLang);
 
                 size_t cchLang = wcslen(pszLang) + 1;
                 size_t cchLanguages = cchLang + 1; // add one for double null terminator
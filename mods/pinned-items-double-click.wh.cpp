@@ -2,7 +2,7 @@
 // @id              pinned-items-double-click
 // @name            Open pinned items with double click
 // @description     Only open pinned items when double clicking on them to avoid accidental clicks
-// @version         1.0.2
+// @version         1.0.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -119,10 +119,11 @@ void WINAPI CTaskListWnd__HandleClick_Hook(PVOID pThis,
     ULONGLONG tickCount = GetTickCount64();
     DWORD messagePos = GetMessagePos();
 
-    if (firstClickTickCount &&
-        IsDoubleClickDistance(firstClickMessagePos, messagePos) &&
-        firstClickTaskBtnGroup == taskBtnGroup &&
-        tickCount - firstClickTickCount <= GetDoubleClickTime()) {
+    // Check the cheap conditions first, the system metrics are only queried
+    // for a second click on the same item.
+    if (firstClickTickCount && firstClickTaskBtnGroup == taskBtnGroup &&
+        tickCount - firstClickTickCount <= GetDoubleClickTime() &&
+        IsDoubleClickDistance(firstClickMessagePos, messagePos)) {
         // Double click detected, proceed.
         firstClickTickCount = 0;
         return original();
@@ -2,7 +2,7 @@
 // @id              prevent-focus-stealing
 // @name            Prevent Focus Stealing
 // @description     Prevents specific apps from stealing focus when a window is opened.
-// @version         1.0.1
+// @version         1.0.2
 // @author          bawNg
 // @github          https://github.com/bawNg
 // @include         *
@@ -165,6 +165,7 @@ WindowInfo* GetWindowInfo(LPCWSTR title) {
     return nullptr;
 }
 
+// A window property lookup, the state is attached to tracked windows when they're created or titled
 bool CanActivateWindow(HWND hWnd) {
     intptr_t timestamp = Wh_GetProp(intptr_t, hWnd, L"NoActivateTs");
     return !timestamp || GetTickCount64() / TS_PRECISION_MS - timestamp >= INITIAL_FOCUS_BLOCK_MS / TS_PRECISION_MS;
@@ -418,6 +419,7 @@ void Wh_ModAfterInit() {
         EnumWindows(EnumWindowsProc, reinterpret_cast<LPARAM>(&existing_windows));
         Wh_Log(L"Checking %lld existing windows", existing_windows.hwnds.size());
         uint64_t now = GetTickCount64();
+        HWND foreground_hwnd = GetForegroundWindow();
         for (HWND hWnd : existing_windows.hwnds) {
             wchar_t title[256];
             GetWindowTextW(hWnd, title, _countof(title));
@@ -433,7 +435,7 @@ void Wh_ModAfterInit() {
             }
             Wh_Log(L"Existing window 0x%p needs to be tracked: '%ls'%ls", hWnd, title, window_info->neverFocus ? L" (never focus)" : L"");
             Wh_SetProp(hWnd, L"NoActivateTs", window_info->neverFocus ? NEVER_FOCUS_TS : (now / TS_PRECISION_MS));
-            if (GetForegroundWindow() == hWnd) {
+            if (foreground_hwnd == hWnd) {
                 Wh_Log(L"Window 0x%p stole focus before mod initialized - switching to previous", hWnd);
                 SwitchToPreviousWindow(hWnd);
             }
@@ -2,7 +2,7 @@
 // @id              safediscshim
 // @name            SafeDiscShim
 // @description     Run SafeDisc protected games on Windows 10 and above.
-// @version         1.0
+// @version         1.0.1
 // @author          Rib
 // @github          https://github.com/RibShark
 // @include         *
@@ -36,6 +36,7 @@ fix such issues.
 // ==/WindhawkModReadme==
 
 #include <windhawk_utils.h>
+#include <atomic>
 #include <string>
 
 enum SafeDiscCommand : DWORD {
@@ -73,17 +74,50 @@ typedef struct SecDrvIoctlOutBuffer {
   DWORD ExtraData[0x80];
 } SecDrvIoctlOutBuffer;
 
-void BuildVerificationData(DWORD verificationData[0x100]) {
+struct StaticVerificationData {
+  DWORD Words[4];
+  DWORD Key;
+};
+
+/* words 1-3 don't depend on anything, only word 0 mixes in the tick count */
+constexpr StaticVerificationData BuildStaticVerificationData() {
+  StaticVerificationData data{};
   DWORD curValue = 0xF367AC7F;
 
+  for ( int i = 3; i > 0; --i ) {
+    curValue = 0x361962E9 - 0xD5ACB1B * curValue;
+    data.Words[i] = curValue;
+    data.Key ^= curValue;
+  }
+
+  return data;
+}
+
+constexpr StaticVerificationData g_staticVerificationData = BuildStaticVerificationData();
+
+void BuildVerificationData(DWORD verificationData[0x100]) {
   /* TODO: this is hacky, see if there are any better ways to get the kernel
    * tick count */
-  verificationData[0] = *reinterpret_cast<int*>(0x7FFE0320);
+  verificationData[0] = *reinterpret_cast<int*>(0x7FFE0320) ^ g_staticVerificationData.Key;
 
-  for ( int i = 3; i > 0; --i ) {
-    curValue = 0x361962E9 - 0xD5ACB1B * curValue;
-    verificationData[i] = curValue;
-    verificationData[0] ^= curValue;
+  for ( int i = 1; i < 4; ++i ) {
+    verificationData[i] = g_staticVerificationData.Words[i];
+  }
+}
+
+/* to tell whether slow launches come from the emulation, log how often the game talks to the driver */
+std::atomic<DWORD> g_secDrvIoctlCount;
+DWORD g_secDrvIoctlFirstTick;
+
+void CountSecDrvIoctl() {
+  DWORD count = ++g_secDrvIoctlCount;
+  if (count == 1) {
+    g_secDrvIoctlFirstTick = GetTickCount();
+    return;
+  }
+
+  if (count % 1000 == 0) {
+    Wh_Log(L"SafeDiscShim: %u secdrv ioctls in %u ms", count, GetTickCount() - g_secDrvIoctlFirstTick);
   }
 }
 
@@ -176,6 +210,7 @@ BOOL WINAPI DeviceIoControl_Hook(HANDLE hDevice,
                                     LPOVERLAPPED lpOverlapped) {
     // all IOCTLs will pass through this function, but it's probably fine since secdrv uses unique control codes
     if (dwIoControlCode == 0xEF002407) {
+        CountSecDrvIoctl();
         if ( ProcessSecDrvIoctl(lpInBuffer, nInBufferSize, lpOutBuffer, nOutBufferSize) ) {
             *lpBytesReturned = nOutBufferSize;
             return TRUE;
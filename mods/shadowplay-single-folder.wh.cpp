@@ -2,10 +2,11 @@
 // @id              shadowplay-single-folder
 // @name            ShadowPlay Save Folder Override
 // @description     Forces Nvidia ShadowPlay to save all clips into a single folder
-// @version         1.1
+// @version         1.2
 // @author          yuma-dev
 // @github          https://github.com/yuma-dev
 // @include         nvcontainer.exe
+// @compilerOptions -lshell32
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
@@ -21,13 +22,16 @@ into a single folder (e.g., C:\Users\USER\Videos), instead of separate folders f
 - savePath: "C:\\"
   $name: Save path
   $description: Where all ShadowPlay clips should be saved.
+- createSaveFolder: false
+  $name: Create save folder
+  $description: >-
+    Create the save folder if it doesn't exist, so that clips can be saved
+    into it directly.
 */
 // ==/WindhawkModSettings==
 
 #include <windows.h>
 #include <shlobj.h> // For SHGetKnownFolderPath
-#include <algorithm>
-#include <string>
 
 wchar_t g_savePath[MAX_PATH] = L"C:\\";
 
@@ -41,11 +45,28 @@ void LoadSettings() {
     }
 
     Wh_FreeStringSetting(settingValue);
+
+    if (Wh_GetIntSetting(L"createSaveFolder")) {
+        int result = SHCreateDirectoryExW(nullptr, g_savePath, nullptr);
+        if (result != ERROR_SUCCESS && result != ERROR_ALREADY_EXISTS) {
+            Wh_Log(L"Failed to create save folder: %d", result);
+        }
+    }
 }
 
-bool endsWith(const std::wstring& str, const std::wstring& suffix) {
-    if (suffix.size() > str.size()) return false;
-    return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin());
+// Called for every file nvcontainer.exe opens, so avoid allocations and
+// reject by length first.
+bool IsClipFileName(PCWSTR fileName) {
+    constexpr WCHAR kSuffix[] = L".DVR.mp4";
+    constexpr size_t kSuffixLen = ARRAYSIZE(kSuffix) - 1;
+
+    size_t len = wcslen(fileName);
+    if (len < kSuffixLen) {
+        return false;
+    }
+
+    return wcscmp(fileName + len - kSuffixLen, kSuffix) == 0 &&
+           wcsstr(fileName, L"\\Videos\\NVIDIA\\");
 }
 
 using CreateFileW_t = decltype(&CreateFileW);
@@ -60,12 +81,13 @@ HANDLE WINAPI CreateFileW_Hook(
     DWORD dwFlagsAndAttributes,
     HANDLE hTemplateFile
 ) {
-    if (lpFileName && endsWith(lpFileName, L".DVR.mp4") && wcsstr(lpFileName, L"\\Videos\\NVIDIA\\")) {
+    wchar_t redirectedPath[MAX_PATH];
+
+    if (lpFileName && IsClipFileName(lpFileName)) {
         Wh_Log(L"Intercepted clip save: %s", lpFileName);
 
         const wchar_t* pFileName = wcsrchr(lpFileName, L'\\');
         if (pFileName && *(pFileName + 1) != 0) {
-            static wchar_t redirectedPath[MAX_PATH];
             swprintf(redirectedPath, MAX_PATH, L"%s%s", g_savePath, pFileName);
             Wh_Log(L"Redirecting to: %s", redirectedPath);
             lpFileName = redirectedPath;
@@ -2,7 +2,7 @@
 // @id              sib-plusplus-tweaker
 // @name            StartIsBack++ Tweaker
 // @description     Modify StartIsBack++'s features (2.9.20)
-// @version         0.7.1
+// @version         0.7.2
 // @author          Erizur
 // @github          https://github.com/Erizur
 // @include         explorer.exe
@@ -112,6 +112,9 @@ Tries to match as close as possible the Start Menu Links used in Windows 7's def
 #include <shlobj.h>
 #include <uxtheme.h>
 #include <vector>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 struct _settings {
     LPCWSTR SIBPath = L"%PROGRAMFILES(X86)%\\StartIsBack\\StartIsBack64.dll";
@@ -378,42 +381,155 @@ LRESULT WINAPI SendMessageW_hook(
 
 using ILCreateFromPathW_t = decltype(&ILCreateFromPathW);
 ILCreateFromPathW_t ILCreateFromPathW_orig;
+
+// Parsing "shell:" paths goes through the whole shell namespace, and SIB does
+// it for its special folders every time the menu opens, so keep one PIDL per
+// path and hand out clones. Known folders can be moved, which changes their
+// PIDLs, so the cache is cleared when the user shell folders registry key
+// changes and when the settings change.
+// File system paths aren't cached, their items can be renamed or deleted.
+std::mutex g_shellPidlCacheMutex;
+std::unordered_map<std::wstring, PIDLIST_ABSOLUTE> g_shellPidlCache;
+HKEY g_shellFoldersKey;
+HANDLE g_shellFoldersChangedEvent;
+
+void WatchShellFoldersKey()
+{
+    if (RegNotifyChangeKeyValue(
+        g_shellFoldersKey,
+        TRUE,
+        REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_THREAD_AGNOSTIC,
+        g_shellFoldersChangedEvent,
+        TRUE
+    ) != ERROR_SUCCESS)
+    {
+        Wh_Log(L"Failed to watch the user shell folders key, not caching shell PIDLs");
+        CloseHandle(g_shellFoldersChangedEvent);
+        g_shellFoldersChangedEvent = nullptr;
+    }
+}
+
+void InitShellPidlCache()
+{
+    if (RegOpenKeyExW(
+        HKEY_CURRENT_USER,
+        L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\User Shell Folders",
+        0,
+        KEY_NOTIFY,
+        &g_shellFoldersKey
+    ) != ERROR_SUCCESS)
+    {
+        Wh_Log(L"Failed to open the user shell folders key, not caching shell PIDLs");
+        g_shellFoldersKey = nullptr;
+        return;
+    }
+
+    g_shellFoldersChangedEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (g_shellFoldersChangedEvent)
+        WatchShellFoldersKey();
+}
+
+// Must be called with g_shellPidlCacheMutex held.
+void ClearShellPidlCacheLocked()
+{
+    for (auto& [path, pidl] : g_shellPidlCache)
+    {
+        ILFree(pidl);
+    }
+    g_shellPidlCache.clear();
+}
+
+PIDLIST_ABSOLUTE CreateShellPidlCached(PCWSTR pszPath)
+{
+    if (_wcsnicmp(pszPath, L"shell:", 6) != 0)
+        return ILCreateFromPathW_orig(pszPath);
+
+    {
+        std::lock_guard<std::mutex> guard(g_shellPidlCacheMutex);
+        if (!g_shellFoldersChangedEvent)
+            return ILCreateFromPathW_orig(pszPath);
+
+        if (WaitForSingleObject(g_shellFoldersChangedEvent, 0) == WAIT_OBJECT_0)
+        {
+            ClearShellPidlCacheLocked();
+            WatchShellFoldersKey();
+        }
+
+        auto it = g_shellPidlCache.find(pszPath);
+        if (it != g_shellPidlCache.end())
+            return ILClone(it->second);
+    }
+
+    PIDLIST_ABSOLUTE pidl = ILCreateFromPathW_orig(pszPath);
+    if (!pidl)
+        return nullptr;
+
+    PIDLIST_ABSOLUTE pidlCached = ILClone(pidl);
+    if (pidlCached)
+    {
+        std::lock_guard<std::mutex> guard(g_shellPidlCacheMutex);
+        auto [it, inserted] = g_shellPidlCache.try_emplace(pszPath, pidlCached);
+        if (!inserted) ILFree(pidlCached);
+    }
+
+    return pidl;
+}
+
+void ClearShellPidlCache()
+{
+    std::lock_guard<std::mutex> guard(g_shellPidlCacheMutex);
+    ClearShellPidlCacheLocked();
+}
+
+void FreeShellPidlCache()
+{
+    std::lock_guard<std::mutex> guard(g_shellPidlCacheMutex);
+    ClearShellPidlCacheLocked();
+
+    // Closing the key first cancels the pending notification.
+    if (g_shellFoldersKey)
+    {
+        RegCloseKey(g_shellFoldersKey);
+        g_shellFoldersKey = nullptr;
+    }
+
+    if (g_shellFoldersChangedEvent)
+    {
+        CloseHandle(g_shellFoldersChangedEvent);
+        g_shellFoldersChangedEvent = nullptr;
+    }
+}
+
 PIDLIST_ABSOLUTE ILCreateFromPathW_hook(PCWSTR pszPath)
 {
     // Ensure that the caller is coming from SIB module:
     void *retaddr = __builtin_return_address(0);
-    if ( ((ULONGLONG)retaddr >  (ULONGLONG)g_hStartIsBackModule) && ((ULONGLONG)retaddr < ( (ULONGLONG)g_hStartIsBackModule + g_StartIsBackSize )) )
+    if ( pszPath && ((ULONGLONG)retaddr >  (ULONGLONG)g_hStartIsBackModule) && ((ULONGLONG)retaddr < ( (ULONGLONG)g_hStartIsBackModule + g_StartIsBackSize )) )
     {
-        WCHAR pszPathNew[1024];
+        PCWSTR pszPathNew = pszPath;
 
         if (0 == wcscmp(pszPath, L"shell:::{A8CDFF1C-4878-43be-B5FD-F8091C1C60D0}"))
         {
             // Documents
-            wcscpy(pszPathNew, L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{A8CDFF1C-4878-43be-B5FD-F8091C1C60D0}");
+            pszPathNew = L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{A8CDFF1C-4878-43be-B5FD-F8091C1C60D0}";
         }
         else if (0 == wcscmp(pszPath, L"shell:::{3ADD1653-EB32-4CB0-BBD7-DFA0ABB5ACCA}"))
         {
             // Pictures
-            wcscpy(pszPathNew, L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{3ADD1653-EB32-4CB0-BBD7-DFA0ABB5ACCA}");
+            pszPathNew = L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{3ADD1653-EB32-4CB0-BBD7-DFA0ABB5ACCA}";
         }
         else if (0 == wcscmp(pszPath, L"shell:::{1CF1260C-4DD0-4EBB-811F-33C572699FDE}"))
         {
             // Music
-            wcscpy(pszPathNew, L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{1CF1260C-4DD0-4EBB-811F-33C572699FDE}");
+            pszPathNew = L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{1CF1260C-4DD0-4EBB-811F-33C572699FDE}";
         }
         else if (0 == wcscmp(pszPath, L"shell:::{374DE290-123F-4565-9164-39C4925E467B}"))
         {
             // Downloads
-            wcscpy(pszPathNew, L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{374DE290-123F-4565-9164-39C4925E467B}");
-        }
-        else
-        {
-            // Copy the original string.
-            wcscpy(pszPathNew, pszPath);
+            pszPathNew = L"shell:::{59031a47-3f72-44a7-89c5-5595fe6b30ee}\\::{374DE290-123F-4565-9164-39C4925E467B}";
         }
 
-        PIDLIST_ABSOLUTE r = ILCreateFromPathW_orig(pszPathNew);
-        return r;
+        return CreateShellPidlCached(pszPathNew);
     }
 
     // If we're not SIB, then just return.
@@ -589,6 +705,8 @@ BOOL Wh_ModInit() {
     if(mod_settings.FixUserFolders == TRUE)
     {
         Wh_Log(L"- Fix User Folders...");
+        InitShellPidlCache();
+
         HMODULE hShell32 = LoadLibraryW(L"shell32.dll");
         FARPROC pfnILCreateFromPathW = GetProcAddress(hShell32, "ILCreateFromPathW");
 
@@ -607,6 +725,8 @@ BOOL Wh_ModInit() {
 void Wh_ModUninit() {
     Wh_Log(L"Exiting SIB++ Tweaker.");
 
+    FreeShellPidlCache();
+
     HWND restartExplorerPromptWindow = g_restartExplorerPromptWindow;
     if (restartExplorerPromptWindow) {
         PostMessage(restartExplorerPromptWindow, WM_CLOSE, 0, 0);
@@ -623,5 +743,7 @@ void Wh_ModUninit() {
 void Wh_ModSettingsChanged() {
     Wh_Log(L"SIB++ Tweaker settings changed. Attempting to restart explorer.");
 
+    ClearShellPidlCache();
+
     PromptForExplorerRestart();
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 // @id              slick-window-arrangement
 // @name            Slick Window Arrangement
 // @description     Make window arrangement more slick and pleasant with a sliding animation and snapping
-// @version         1.0.2
+// @version         1.0.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -61,10 +61,12 @@ sliding animation and window snapping.
 #include <windowsx.h>
 
 #include <atomic>
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <set>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <unordered_set>
@@ -619,11 +621,31 @@ private:
     MoveSnapshot* snapshot[3]{};
 };
 
-struct WindowSlideTimer {
+// The sliding animation was tuned for 15.6 ms steps, the default timer
+// resolution on Windows. Frames are now paced by the display, and the
+// physics are scaled by the actual frame time.
+constexpr double kSlideStepSeconds = 0.0156;
+constexpr int kSlideMaxSteps = 50;
+
+LONGLONG GetSlideFrameTime()
+{
+    // The time of the last vblank, so that all windows sliding during a frame
+    // are moved to where they should be when that frame is shown.
+    DWM_TIMING_INFO timingInfo = { sizeof(timingInfo) };
+    if (SUCCEEDED(DwmGetCompositionTimingInfo(nullptr, &timingInfo)) && timingInfo.qpcVBlank) {
+        return (LONGLONG)timingInfo.qpcVBlank;
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+struct WindowSlide {
 public:
-    WindowSlideTimer(TIMERPROC proc, int cursorX, int cursorY, int x, int y, double velocityX, double velocityY, std::optional<WindowMagnet> windowMagnet) :
+    WindowSlide(int cursorX, int cursorY, int x, int y, double velocityX, double velocityY, std::optional<WindowMagnet> windowMagnet) :
         cursorPoint{ cursorX, cursorY }, x((double)x), y((double)y), velocityX(velocityX), velocityY(velocityY), windowMagnet(std::move(windowMagnet)) {
-        timerId = SetTimer(nullptr, 0, 10, proc);
+        lastFrameTime = GetSlideFrameTime();
 
         HMONITOR monitor = MonitorFromPoint(cursorPoint, MONITOR_DEFAULTTONEAREST);
 
@@ -632,24 +654,35 @@ public:
         CopyRect(&workArea, &monitorInfo.rcWork);
     }
 
-    ~WindowSlideTimer() {
-        KillTimer(nullptr, timerId);
-    }
+    WindowSlide(const WindowSlide&) = delete;
+    WindowSlide(WindowSlide&&) = delete;
+    WindowSlide& operator=(const WindowSlide&) = delete;
+    WindowSlide& operator=(WindowSlide&&) = delete;
+
+    // Returns false when the slide is over. Otherwise, *move is set to true if
+    // the window has to be moved to *pos.
+    bool SlideNextFrame(HWND hWnd, LONGLONG frameTime, bool* move, POINT* pos) {
+        *move = false;
+
+        // If the frame time didn't advance, this frame was already handled.
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        double elapsed = (double)(frameTime - lastFrameTime) / (double)frequency.QuadPart;
+        if (elapsed <= 0) {
+            return true;
+        }
 
-    WindowSlideTimer(const WindowSlideTimer&) = delete;
-    WindowSlideTimer(WindowSlideTimer&&) = delete;
-    WindowSlideTimer& operator=(const WindowSlideTimer&) = delete;
-    WindowSlideTimer& operator=(WindowSlideTimer&&) = delete;
+        lastFrameTime = frameTime;
+        elapsedTotal += elapsed;
 
-    UINT_PTR GetTimerId() const {
-        return timerId;
-    }
+        // Frames the UI thread fell behind on are dropped, the window is moved
+        // by the whole elapsed time at once.
+        double steps = elapsed / kSlideStepSeconds;
 
-    bool SlideNextFrame(HWND hWnd) {
         RECT rect;
         GetWindowRect(hWnd, &rect);
         if (frame != 0) {
-            // If the window's position or size changed, stop timer.
+            // If the window's position or size changed, stop sliding.
             if (
                 lastX != rect.left ||
                 lastY != rect.top ||
@@ -663,15 +696,17 @@ public:
         int prevX = (int)x;
         int prevY = (int)y;
 
-        // The default timer resolution on Windows is 15.6 ms.
-        x += velocityX / (1000.0 / 15.6);
-        y += velocityY / (1000.0 / 15.6);
+        x += velocityX * elapsed;
+        y += velocityY * elapsed;
 
         int currentX = (int)x;
         int currentY = (int)y;
 
         if (currentX == prevX && currentY == prevY) {
-            return false;
+            // Less than a pixel per frame on high refresh rate displays, stop
+            // only if it would be so at the original step length too.
+            return std::abs(velocityX) * kSlideStepSeconds >= 1.0 ||
+                std::abs(velocityY) * kSlideStepSeconds >= 1.0;
         }
 
         POINT anchor{ currentX + cursorPoint.x, currentY + cursorPoint.y };
@@ -720,7 +755,7 @@ public:
             slidingAnimationSlowdown = 99;
         }
 
-        double slowdownMultiplier = (100 - g_settings.slidingAnimationSlowdown) / 100.0;
+        double slowdownMultiplier = std::pow((100 - g_settings.slidingAnimationSlowdown) / 100.0, steps);
 
         velocityX *= slowdownMultiplier;
         velocityY *= slowdownMultiplier;
@@ -745,8 +780,9 @@ public:
             }
         }
 
-        SetWindowPos(hWnd, nullptr, currentX, currentY, 0, 0,
-            SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOOWNERZORDER);
+        *move = true;
+        pos->x = currentX;
+        pos->y = currentY;
 
         lastX = currentX;
         lastY = currentY;
@@ -754,12 +790,13 @@ public:
         lastCy = rect.bottom - rect.top;
 
         frame++;
-        return frame < 50;
+        return elapsedTotal < kSlideMaxSteps * kSlideStepSeconds;
     }
 
 private:
-    UINT_PTR timerId;
     int frame = 0;
+    LONGLONG lastFrameTime;
+    double elapsedTotal = 0;
     POINT cursorPoint;
     RECT workArea;
     double x, y;
@@ -772,7 +809,25 @@ std::atomic<bool> g_uninitializing;
 std::atomic<int> g_hookRefCount;
 thread_local std::unordered_map<HWND, WindowMoving> g_winMoving;
 thread_local std::unordered_map<HWND, WindowMove> g_winMove;
-thread_local std::unordered_map<HWND, WindowSlideTimer> g_winSlideTimers;
+thread_local std::unordered_map<HWND, WindowSlide> g_winSlides;
+
+// A single pacer thread waits for each compositor frame and asks every UI
+// thread with sliding windows to step all of them, by posting a message to
+// one of its sliding windows. A thread that didn't handle the previous frame
+// yet isn't sent another one, and it catches up by the elapsed time instead.
+struct SlideThreadFrame {
+    HWND hWnd;
+    bool framePending;
+};
+
+UINT g_slideFrameRegisteredMessage = RegisterWindowMessage(
+    L"Windhawk_SlideFrame_slick-window-arrangement");
+std::mutex g_slideThreadsMutex;
+std::unordered_map<DWORD, SlideThreadFrame> g_slideThreads;
+HANDLE g_slidePacerEvent;
+// Started when the first slide begins, most processes never slide a window.
+std::thread g_slidePacerThread;
+std::mutex g_slidePacerThreadMutex;
 
 UINT g_unsubclassRegisteredMessage = RegisterWindowMessage(
     L"Windhawk_Unsubclass_slick-window-arrangement");
@@ -805,43 +860,172 @@ void UnsubclassWindow(HWND hWnd)
     }
 }
 
-bool KillWindowSlideTimer(HWND hWnd)
+void SlidePacerThread();
+
+void StartSlidePacerThread()
+{
+    std::lock_guard<std::mutex> guard(g_slidePacerThreadMutex);
+
+    if (!g_slidePacerEvent || g_slidePacerThread.joinable() || g_uninitializing) {
+        return;
+    }
+
+    g_slidePacerThread = std::thread(SlidePacerThread);
+}
+
+// Called on the UI thread whenever its set of sliding windows changes.
+void UpdateSlideThreadFrame()
 {
-    auto it = g_winSlideTimers.find(hWnd);
-    if (it == g_winSlideTimers.end()) {
+    DWORD dwThreadId = GetCurrentThreadId();
+
+    bool inserted;
+    {
+        std::lock_guard<std::mutex> guard(g_slideThreadsMutex);
+
+        if (g_winSlides.empty()) {
+            g_slideThreads.erase(dwThreadId);
+            return;
+        }
+
+        HWND hWnd = g_winSlides.begin()->first;
+        auto [it, newThread] = g_slideThreads.try_emplace(dwThreadId, SlideThreadFrame{ hWnd, false });
+        if (!newThread && g_winSlides.find(it->second.hWnd) == g_winSlides.end()) {
+            // The window that received the frame messages stopped sliding, a
+            // pending frame message won't be handled.
+            it->second = SlideThreadFrame{ hWnd, false };
+        }
+
+        inserted = newThread;
+    }
+
+    // Not under g_slideThreadsMutex, which the pacer thread takes while
+    // Wh_ModUninit waits for it.
+    if (inserted) {
+        StartSlidePacerThread();
+        SetEvent(g_slidePacerEvent);
+    }
+}
+
+bool KillWindowSlide(HWND hWnd)
+{
+    auto it = g_winSlides.find(hWnd);
+    if (it == g_winSlides.end()) {
         return false;
     }
 
-    g_winSlideTimers.erase(it);
+    g_winSlides.erase(it);
+    UpdateSlideThreadFrame();
     return true;
 }
 
-void CALLBACK WindowSlideTimerProc(HWND hWnd, UINT uMsg, UINT_PTR idTimer, DWORD dwTime)
+void OnSlideFrame()
 {
-    auto it = g_winSlideTimers.begin();
-    for (; it != g_winSlideTimers.end(); ++it) {
-        auto& timer = it->second;
-        if (timer.GetTimerId() == idTimer) {
-            break;
+    {
+        std::lock_guard<std::mutex> guard(g_slideThreadsMutex);
+
+        auto it = g_slideThreads.find(GetCurrentThreadId());
+        if (it != g_slideThreads.end()) {
+            it->second.framePending = false;
         }
     }
 
-    if (it == g_winSlideTimers.end()) {
-        return;
+    LONGLONG frameTime = GetSlideFrameTime();
+
+    struct SlideMove {
+        HWND hWnd;
+        POINT pos;
+    };
+
+    std::vector<SlideMove> moves;
+    std::vector<HWND> finished;
+    for (auto& [hWnd, slide] : g_winSlides) {
+        bool move;
+        POINT pos;
+        if (!slide.SlideNextFrame(hWnd, frameTime, &move, &pos)) {
+            finished.push_back(hWnd);
+        }
+
+        if (move) {
+            moves.push_back({ hWnd, pos });
+        }
+    }
+
+    // Move all windows of the frame together.
+    UINT flags = SWP_NOSIZE | SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOOWNERZORDER;
+    HDWP hDwp = moves.size() > 1 ? BeginDeferWindowPos((int)moves.size()) : nullptr;
+    for (size_t i = 0; hDwp && i < moves.size(); i++) {
+        const auto& move = moves[i];
+        hDwp = DeferWindowPos(hDwp, move.hWnd, nullptr, move.pos.x, move.pos.y, 0, 0, flags);
+    }
+
+    if (hDwp) {
+        EndDeferWindowPos(hDwp);
     }
+    else {
+        // A single window, or DeferWindowPos failed and discarded the batch.
+        for (const auto& move : moves) {
+            SetWindowPos(move.hWnd, nullptr, move.pos.x, move.pos.y, 0, 0, flags);
+        }
+    }
+
+    for (HWND hWnd : finished) {
+        g_winSlides.erase(hWnd);
+        UnsubclassWindow(hWnd);
+    }
+
+    if (!finished.empty()) {
+        UpdateSlideThreadFrame();
+    }
+}
+
+void SlidePacerThread()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
 
-    HWND hTargetWnd = it->first;
-    auto& timer = it->second;
+    while (!g_uninitializing) {
+        bool idle;
+        {
+            std::lock_guard<std::mutex> guard(g_slideThreadsMutex);
+            idle = g_slideThreads.empty();
+        }
+
+        if (idle) {
+            WaitForSingleObject(g_slidePacerEvent, INFINITE);
+            continue;
+        }
+
+        // One slide step per composed frame, so that the windows don't move
+        // more often than the screen shows them.
+        LARGE_INTEGER before, after;
+        QueryPerformanceCounter(&before);
+        HRESULT hr = DwmFlush();
+        QueryPerformanceCounter(&after);
+        if (FAILED(hr)) {
+            // No composition, step at about the original rate.
+            Sleep(10);
+        }
+        else if ((after.QuadPart - before.QuadPart) * 1000 < frequency.QuadPart) {
+            // DwmFlush didn't wait for a frame, for example if the sliding
+            // windows are covered. The steps catch up by the elapsed time, so
+            // there's no need to post frames in a tight loop.
+            Sleep(1);
+        }
+
+        std::lock_guard<std::mutex> guard(g_slideThreadsMutex);
 
-    if (!timer.SlideNextFrame(hTargetWnd)) {
-        g_winSlideTimers.erase(it);
-        UnsubclassWindow(hTargetWnd);
+        for (auto& [dwThreadId, slideThreadFrame] : g_slideThreads) {
+            if (!slideThreadFrame.framePending) {
+                slideThreadFrame.framePending = PostMessage(
+                    slideThreadFrame.hWnd, g_slideFrameRegisteredMessage, 0, 0);
+            }
+        }
     }
 }
 
 void OnEnterSizeMove(HWND hWnd)
 {
-    KillWindowSlideTimer(hWnd);
+    KillWindowSlide(hWnd);
 
     if (g_settings.snapWindowsWhenDragging) {
         g_winMoving.try_emplace(hWnd, hWnd);
@@ -866,8 +1050,7 @@ void OnExitSizeMove(HWND hWnd)
         if (windowMove.CompleteMove(&x, &y, &velocityX, &velocityY)) {
             DWORD messagePos = GetMessagePos();
 
-            g_winSlideTimers.try_emplace(hWnd,
-                WindowSlideTimerProc,
+            g_winSlides.try_emplace(hWnd,
                 GET_X_LPARAM(messagePos) - x,
                 GET_Y_LPARAM(messagePos) - y,
                 x,
@@ -879,6 +1062,7 @@ void OnExitSizeMove(HWND hWnd)
                     : std::optional(winMovingIt != g_winMoving.end()
                         ? std::move(winMovingIt->second.GetWindowMagnet())
                         : WindowMagnet(hWnd)));
+            UpdateSlideThreadFrame();
 
             unsubclass = false;
         }
@@ -951,7 +1135,7 @@ void OnWindowPosChanged(HWND hWnd, const WINDOWPOS* windowPos)
         // maximized.
         // 0x00300000 is set when the window is snapped, e.g. with Win+left.
         if ((windowPos->flags & SWP_STATECHANGED) || (windowPos->flags & 0x00300000)) {
-            if (KillWindowSlideTimer(hWnd)) {
+            if (KillWindowSlide(hWnd)) {
                 UnsubclassWindow(hWnd);
             }
         }
@@ -982,7 +1166,7 @@ void OnSysCommand(HWND hWnd, WPARAM command)
     case SC_KEYMENU:
     case SC_RESTORE:
         {
-            if (KillWindowSlideTimer(hWnd)) {
+            if (KillWindowSlide(hWnd)) {
                 UnsubclassWindow(hWnd);
             }
         }
@@ -992,7 +1176,7 @@ void OnSysCommand(HWND hWnd, WPARAM command)
 
 void OnNcDestroy(HWND hWnd)
 {
-    KillWindowSlideTimer(hWnd);
+    KillWindowSlide(hWnd);
     UnsubclassWindow(hWnd);
 }
 
@@ -1027,9 +1211,13 @@ LRESULT CALLBACK SubclassWndProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPa
 
     default:
         if (uMsg == g_unsubclassRegisteredMessage) {
-            KillWindowSlideTimer(hWnd);
+            KillWindowSlide(hWnd);
             RemoveWindowSubclass(hWnd, SubclassWndProc, 0);
         }
+        else if (uMsg == g_slideFrameRegisteredMessage) {
+            OnSlideFrame();
+            return 0;
+        }
         break;
     }
 
@@ -1196,6 +1384,8 @@ BOOL Wh_ModInit()
         pGetDpiForMonitor = (GetDpiForMonitor_t)GetProcAddress(hShcore, "GetDpiForMonitor");
     }
 
+    g_slidePacerEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
     // DispatchMessageA, DispatchMessageW could hopefully be enough to detect a message loop, but
     // DispatchMessageWorker, which implements DispatchMessageA, DispatchMessageW, is sometimes
     // called directly by functions such as DialogBoxParam.
@@ -1213,6 +1403,15 @@ void Wh_ModUninit()
 
     g_uninitializing = true;
 
+    {
+        std::lock_guard<std::mutex> guard(g_slidePacerThreadMutex);
+
+        if (g_slidePacerThread.joinable()) {
+            SetEvent(g_slidePacerEvent);
+            g_slidePacerThread.join();
+        }
+    }
+
     std::unordered_set<HWND> subclassedWindows;
     {
         std::lock_guard<std::mutex> guard(g_subclassedWindowsMutex);
@@ -1237,6 +1436,11 @@ void Wh_ModUninit()
     while (g_hookRefCount > 0) {
         Sleep(200);
     }
+
+    if (g_slidePacerEvent) {
+        CloseHandle(g_slidePacerEvent);
+        g_slidePacerEvent = nullptr;
+    }
 }
 
 void Wh_ModSettingsChanged()
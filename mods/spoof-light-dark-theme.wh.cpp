@@ -2,7 +2,7 @@
 // @id              spoof-light-dark-theme
 // @name            Spoof Light/Dark Theme
 // @description     Use light/dark theme on an application basis
-// @version         1.1.0
+// @version         1.1.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -95,6 +95,12 @@ void ApplyDarkModeSpoof(
     ULONG ulAlloc = 0;
     NTSTATUS status;
     KEY_NAME_INFORMATION *pNameInfo = nullptr;
+    union
+    {
+        KEY_NAME_INFORMATION info;
+        BYTE buffer[sizeof(ULONG) + 256 * sizeof(WCHAR)];
+    } nameBuffer;
+    LPCWSTR pName;
     HKEY hkeyQuery = hkey;
     bool fOpenedSubKey = false;
 
@@ -123,23 +129,34 @@ void ApplyDarkModeSpoof(
         fOpenedSubKey = true;
     }
 
-    // Check key name
-    status = NtQueryKey(hkeyQuery, KeyNameInformation, nullptr, 0, &ulAlloc);
-    if (status != STATUS_BUFFER_TOO_SMALL)
-        goto cleanup;
+    // Check key name. The Personalize key path fits in the stack buffer, so
+    // this is a single call for the values we're interested in.
+    ZeroMemory(&nameBuffer, sizeof(nameBuffer));
+    status = NtQueryKey(hkeyQuery, KeyNameInformation, &nameBuffer, sizeof(nameBuffer) - sizeof(WCHAR), &ulAlloc);
+    if (status == STATUS_SUCCESS)
+    {
+        pName = nameBuffer.info.Name;
+    }
+    else
+    {
+        if (status != STATUS_BUFFER_TOO_SMALL && status != STATUS_BUFFER_OVERFLOW)
+            goto cleanup;
 
-    // Add space for null terminator and allocate
-    ulAlloc += sizeof(WCHAR);
-    pNameInfo = (KEY_NAME_INFORMATION *)LocalAlloc(LPTR, ulAlloc);
-    if (!pNameInfo)
-        goto cleanup;
-    ZeroMemory(pNameInfo, ulAlloc);
+        // Add space for null terminator and allocate
+        ulAlloc += sizeof(WCHAR);
+        pNameInfo = (KEY_NAME_INFORMATION *)LocalAlloc(LPTR, ulAlloc);
+        if (!pNameInfo)
+            goto cleanup;
+        ZeroMemory(pNameInfo, ulAlloc);
 
-    status = NtQueryKey(hkeyQuery, KeyNameInformation, pNameInfo, ulAlloc, &ulAlloc);
-    if (status != STATUS_SUCCESS)
-        goto cleanup;
+        status = NtQueryKey(hkeyQuery, KeyNameInformation, pNameInfo, ulAlloc, &ulAlloc);
+        if (status != STATUS_SUCCESS)
+            goto cleanup;
+
+        pName = pNameInfo->Name;
+    }
 
-    if (!EndsWith(pNameInfo->Name, L"\\SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize"))
+    if (!EndsWith(pName, L"\\SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\Themes\\Personalize"))
         goto cleanup;
 
     *lpData = !g_fDarkTheme;
@@ -226,11 +243,14 @@ bool WINAPI ShouldAppsUseDarkMode_hook(void)
 
 void UpdateSpoofInfo(void)
 {
-    g_fSpoofTheme = false;
-    g_fDarkTheme = false;
+    // The hooks may run on other threads while this runs, so the decision is
+    // made in locals and published once.
+    bool fSpoofTheme = false;
+    bool fDarkTheme = false;
 
     WCHAR szAppPath[MAX_PATH];
     GetModuleFileNameW(GetModuleHandleW(NULL), szAppPath, MAX_PATH);
+    WCHAR *pBackslash = wcsrchr(szAppPath, L'\\');
 
     for (int i = 0;; i++)
     {
@@ -247,23 +267,22 @@ void UpdateSpoofInfo(void)
         Wh_FreeStringSetting(szPath);
 
         // Does the current application path or name match the spoof?
-        WCHAR *pBackslash = wcsrchr(szAppPath, L'\\');
         if (0 == wcsicmp(szAppPath, szExpandedPath)
         || (pBackslash && 0 == wcsicmp(pBackslash + 1, szExpandedPath)))
         {
-            g_fSpoofTheme = true;
-            g_fDarkTheme = Wh_GetIntSetting(L"spoofs[%d].dark", i);
-        }
+            fSpoofTheme = true;
+            fDarkTheme = Wh_GetIntSetting(L"spoofs[%d].dark", i);
 
-        if (g_fSpoofTheme)
-        {
             Wh_Log(
                 L"Application: %s, spoofing as %s theme",
-                szAppPath, g_fDarkTheme ? L"dark" : L"light"
+                szAppPath, fDarkTheme ? L"dark" : L"light"
             );
             break;
         }
     }
+
+    g_fDarkTheme = fDarkTheme;
+    g_fSpoofTheme = fSpoofTheme;
 }
 
 void Wh_ModSettingsChanged(void)
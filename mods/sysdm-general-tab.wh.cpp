@@ -2,7 +2,7 @@
 // @id              sysdm-general-tab
 // @name            System Properties "General" Tab
 // @description     Restores the "General" tab to the system properties dialog (sysdm.cpl).
-// @version         1.1
+// @version         1.1.1
 // @author          Isabella Lulamoon (kawapure)
 // @github          https://github.com/kawapure
 // @twitter         https://twitter.com/kawaipure
@@ -807,11 +807,101 @@ void CompleteGeneralDlgInitialization(HWND hDlg, INITDLGSTRUCT *pInitData)
     AddOEMHyperLinks(hDlg, &idCtrlCur);
 }
 
-DWORD WINAPI InitGeneralDlgThread(LPVOID lpParam)
+#define GENERAL_INFO_CACHE_VALUE L"generalInfoCache"
+
+// Processor and memory description from the last time the page was opened.
+// Querying WMI for the processor can take the better part of a second, so the
+// page is filled from this cache as long as the hardware signature matches.
+struct GENERAL_INFO_CACHE
+{
+    // Hardware signature:
+    UINT64 iInstalledMemoryKb;
+    DWORD dwResourceVersion;
+    BOOL fRamInKilobytes;
+    WCHAR szRegistryProcessorName[MAX_PATH];
+
+    // Cached description:
+    INT64 iMemoryAmount;
+    BOOL fShowProcessorName;
+    BOOL fShowProcessorClockSpeed;
+    WCHAR szProcessorName[MAX_PATH];
+    WCHAR szProcessorClockSpeed[MAX_PATH];
+};
+
+void _GetHardwareSignature(GENERAL_INFO_CACHE *pCache)
+{
+    if (!GetPhysicallyInstalledSystemMemory(&pCache->iInstalledMemoryKb))
+    {
+        pCache->iInstalledMemoryKb = 0;
+    }
+
+    // The clock speed and memory strings are formatted with the resource
+    // templates and settings, so treat those as part of the signature too.
+    pCache->dwResourceVersion = g_dwResourceVersion;
+    pCache->fRamInKilobytes = g_settings.fRamInKilobytes;
+
+    DWORD cbData = sizeof(pCache->szRegistryProcessorName);
+    if (SHRegGetValueW(HKEY_LOCAL_MACHINE, L"HARDWARE\\DESCRIPTION\\System\\CentralProcessor\\0",
+        L"ProcessorNameString", SRRF_RT_REG_SZ | SRRF_RT_REG_EXPAND_SZ | SRRF_NOEXPAND,
+        nullptr, (LPBYTE)pCache->szRegistryProcessorName, &cbData) != ERROR_SUCCESS)
+    {
+        pCache->szRegistryProcessorName[0] = L'\0';
+    }
+}
+
+bool LoadGeneralInfoCache(INITDLGSTRUCT *pData)
+{
+    GENERAL_INFO_CACHE cache = { 0 };
+    if (Wh_GetBinaryValue(GENERAL_INFO_CACHE_VALUE, &cache, sizeof(cache)) != sizeof(cache))
+    {
+        return false;
+    }
+
+    GENERAL_INFO_CACHE signature = { 0 };
+    _GetHardwareSignature(&signature);
+
+    if (cache.iInstalledMemoryKb != signature.iInstalledMemoryKb ||
+        cache.dwResourceVersion != signature.dwResourceVersion ||
+        cache.fRamInKilobytes != signature.fRamInKilobytes ||
+        StrCmpNW(cache.szRegistryProcessorName, signature.szRegistryProcessorName,
+            ARRAYSIZE(cache.szRegistryProcessorName)) != 0)
+    {
+        Wh_Log(L"Hardware signature changed, ignoring cached system information.");
+        return false;
+    }
+
+    pData->iMemoryAmount = cache.iMemoryAmount;
+    pData->fShowProcessorName = cache.fShowProcessorName;
+    pData->fShowProcessorClockSpeed = cache.fShowProcessorClockSpeed;
+    StringCchCopyNW(pData->processorInfo.szProcessorName, ARRAYSIZE(pData->processorInfo.szProcessorName),
+        cache.szProcessorName, ARRAYSIZE(cache.szProcessorName));
+    StringCchCopyNW(pData->processorInfo.szProcessorClockSpeed, ARRAYSIZE(pData->processorInfo.szProcessorClockSpeed),
+        cache.szProcessorClockSpeed, ARRAYSIZE(cache.szProcessorClockSpeed));
+
+    return true;
+}
+
+void SaveGeneralInfoCache(const INITDLGSTRUCT *pData)
 {
-    if (!lpParam)
-        return -1;
+    GENERAL_INFO_CACHE cache = { 0 };
+    _GetHardwareSignature(&cache);
+
+    cache.iMemoryAmount = pData->iMemoryAmount;
+    cache.fShowProcessorName = pData->fShowProcessorName;
+    cache.fShowProcessorClockSpeed = pData->fShowProcessorClockSpeed;
+    StringCchCopyW(cache.szProcessorName, ARRAYSIZE(cache.szProcessorName), pData->processorInfo.szProcessorName);
+    StringCchCopyW(cache.szProcessorClockSpeed, ARRAYSIZE(cache.szProcessorClockSpeed), pData->processorInfo.szProcessorClockSpeed);
 
+    Wh_SetBinaryValue(GENERAL_INFO_CACHE_VALUE, &cache, sizeof(cache));
+}
+
+/*
+ * Queries the processor and memory description and stores it in the cache.
+ * lpParam is the page to post the result to, or nullptr if the page was
+ * already filled from the cache and only the cache needs refreshing.
+ */
+DWORD WINAPI InitGeneralDlgThread(LPVOID lpParam)
+{
     INITDLGSTRUCT *pData = (INITDLGSTRUCT *)LocalAlloc(LPTR, sizeof(INITDLGSTRUCT));
 
     if (pData)
@@ -843,7 +933,12 @@ DWORD WINAPI InitGeneralDlgThread(LPVOID lpParam)
 
         pData->fShowProcessorName = _GetProcessorDescription(&pData->processorInfo, &pData->fShowProcessorClockSpeed);
 
-        PostMessage((HWND)lpParam, WM_SYSCPL_GEN_UPDATECPUINFO, (WPARAM)pData, 0);
+        SaveGeneralInfoCache(pData);
+
+        if (!lpParam || !PostMessage((HWND)lpParam, WM_SYSCPL_GEN_UPDATECPUINFO, (WPARAM)pData, 0))
+        {
+            LocalFree((HLOCAL)pData);
+        }
     }
 
     return 0;
@@ -1032,7 +1127,22 @@ INT_PTR CALLBACK GeneralPageDlgProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
                 RegCloseKey(hkey);
             }
 
-            SHCreateThread(InitGeneralDlgThread, hWnd, CTF_COINIT | CTF_FREELIBANDEXIT, nullptr);
+            // Fill the machine information from the cache straight away if possible,
+            // and only update the cache in the background.
+            HWND hWndUpdate = hWnd;
+            INITDLGSTRUCT *pCachedData = (INITDLGSTRUCT *)LocalAlloc(LPTR, sizeof(INITDLGSTRUCT));
+            if (pCachedData)
+            {
+                if (LoadGeneralInfoCache(pCachedData))
+                {
+                    CompleteGeneralDlgInitialization(hWnd, pCachedData);
+                    hWndUpdate = nullptr;
+                }
+
+                LocalFree((HLOCAL)pCachedData);
+            }
+
+            SHCreateThread(InitGeneralDlgThread, hWndUpdate, CTF_COINIT | CTF_FREELIBANDEXIT, nullptr);
 
             return TRUE;
         }
@@ -2,14 +2,14 @@
 // @id              taskbar-auto-hide-speed
 // @name            Taskbar auto-hide speed
 // @description     Customize the taskbar auto-hide speed and frame rate to make it feel less sluggish and janky
-// @version         1.0
+// @version         1.1
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
 // @homepage        https://m417z.com/
 // @include         explorer.exe
 // @architecture    x86-64
-// @compilerOptions -lversion
+// @compilerOptions -ldwmapi -lversion
 // ==/WindhawkMod==
 
 // Source code is published under The GNU General Public License v3.0.
@@ -43,6 +43,12 @@ sluggish and janky.
   $name: Animation frame rate
   $description: >-
     Frames per second, higher frame rate will use more CPU
+- syncToDisplay: false
+  $name: Sync to display refresh
+  $description: >-
+    Present each animation frame together with the desktop compositor instead
+    of using the frame rate above, for a smooth animation on high refresh rate
+    displays
 - oldTaskbarOnWin11: false
   $name: Customize the old taskbar on Windows 11
   $description: >-
@@ -53,6 +59,7 @@ sluggish and janky.
 
 #include <windhawk_utils.h>
 
+#include <dwmapi.h>
 #include <psapi.h>
 
 #include <atomic>
@@ -61,6 +68,7 @@ struct {
     int showSpeedup;
     int hideSpeedup;
     int frameRate;
+    bool syncToDisplay;
     bool oldTaskbarOnWin11;
 } g_settings;
 
@@ -150,6 +158,14 @@ void WINAPI Sleep_Hook(DWORD dwMilliseconds) {
         return;
     }
 
+    // DwmFlush blocks until the next composition pass, so frames are paced by
+    // the display refresh. It fails if composition is unavailable, in which
+    // case fall back to the fixed frame rate.
+    if (g_settings.syncToDisplay && SUCCEEDED(DwmFlush())) {
+        g_slideWindowLastFrameStartTime = TimerGetSeconds();
+        return;
+    }
+
     double frameTotalTime = 1000.0 / g_settings.frameRate;
 
     double frameElapsedTime =
@@ -370,6 +386,10 @@ void LoadSettings() {
     g_settings.showSpeedup = Wh_GetIntSetting(L"showSpeedup");
     g_settings.hideSpeedup = Wh_GetIntSetting(L"hideSpeedup");
     g_settings.frameRate = Wh_GetIntSetting(L"frameRate");
+    if (g_settings.frameRate <= 0) {
+        g_settings.frameRate = 90;
+    }
+    g_settings.syncToDisplay = Wh_GetIntSetting(L"syncToDisplay");
     g_settings.oldTaskbarOnWin11 = Wh_GetIntSetting(L"oldTaskbarOnWin11");
 }
 
@@ -2,7 +2,7 @@
 // @id              taskbar-auto-hide-when-maximized
 // @name            Taskbar auto-hide when maximized
 // @description     Makes the taskbar auto-hide only when a window is maximized or intersects the taskbar
-// @version         1.2.3
+// @version         1.2.5
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -118,6 +118,35 @@ std::mutex g_winEventHookThreadMutex;
 std::atomic<HANDLE> g_winEventHookThread;
 std::unordered_map<void*, HWND> g_taskbarsKeptShown;
 UINT_PTR g_pendingEventsTimer;
+std::atomic<HWND> g_lastTaskbarWnd;
+
+// Exclusion decisions per window, resolving them involves opening the process
+// and querying its app id. Entries are dropped when the window is shown or
+// destroyed, and all of them when the settings change.
+std::mutex g_windowExcludedCacheMutex;
+std::unordered_map<HWND, bool> g_windowExcludedCache;
+constexpr size_t kWindowExcludedCacheMaxSize = 4096;
+
+// App ids per window, querying them involves COM calls. Entries are dropped
+// along with the exclusion decisions, but are kept when the settings change.
+std::mutex g_windowAppIdCacheMutex;
+std::unordered_map<HWND, std::wstring> g_windowAppIdCache;
+constexpr size_t kWindowAppIdCacheMaxSize = 4096;
+
+// The last seen state of top-level windows, only accessed from the event hook
+// thread. Whether a taskbar can be hidden only depends on these states, so
+// events which leave the state of a window unchanged don't trigger an update.
+struct WindowState {
+    // Visible, not cloaked and not minimized. The other fields are only set
+    // for visible windows.
+    bool visible;
+    UINT showCmd;
+    bool arranged;
+    HMONITOR monitor;
+    RECT rect;
+};
+
+std::unordered_map<HWND, WindowState> g_windowStates;
 
 // TrayUI::_HandleTrayPrivateSettingMessage
 constexpr UINT kHandleTrayPrivateSettingMessage = WM_USER + 0x1CA;
@@ -167,17 +196,27 @@ bool IsWindowCloaked(HWND hwnd) {
            isCloaked;
 }
 
+bool IsCurrentProcessTaskbarWnd(HWND hWnd) {
+    DWORD dwProcessId;
+    WCHAR className[32];
+    return GetWindowThreadProcessId(hWnd, &dwProcessId) &&
+           dwProcessId == GetCurrentProcessId() &&
+           GetClassName(hWnd, className, ARRAYSIZE(className)) &&
+           _wcsicmp(className, L"Shell_TrayWnd") == 0;
+}
+
 HWND FindCurrentProcessTaskbarWnd() {
-    HWND hTaskbarWnd = nullptr;
+    // Avoid enumerating all windows while the taskbar window stays the same.
+    HWND hTaskbarWnd = g_lastTaskbarWnd;
+    if (hTaskbarWnd && IsCurrentProcessTaskbarWnd(hTaskbarWnd)) {
+        return hTaskbarWnd;
+    }
+
+    hTaskbarWnd = nullptr;
 
     EnumWindows(
         [](HWND hWnd, LPARAM lParam) -> BOOL {
-            DWORD dwProcessId;
-            WCHAR className[32];
-            if (GetWindowThreadProcessId(hWnd, &dwProcessId) &&
-                dwProcessId == GetCurrentProcessId() &&
-                GetClassName(hWnd, className, ARRAYSIZE(className)) &&
-                _wcsicmp(className, L"Shell_TrayWnd") == 0) {
+            if (IsCurrentProcessTaskbarWnd(hWnd)) {
                 *reinterpret_cast<HWND*>(lParam) = hWnd;
                 return FALSE;
             }
@@ -185,6 +224,7 @@ HWND FindCurrentProcessTaskbarWnd() {
         },
         reinterpret_cast<LPARAM>(&hTaskbarWnd));
 
+    g_lastTaskbarWnd = hTaskbarWnd;
     return hTaskbarWnd;
 }
 
@@ -311,11 +351,32 @@ std::wstring GetWindowAppId(HWND hWnd) {
     return result;
 }
 
-bool IsWindowExcluded(HWND hWnd) {
-    if (g_settings.excludedPrograms.empty()) {
-        return false;
+std::wstring GetWindowAppIdCached(HWND hWnd) {
+    {
+        std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+        auto it = g_windowAppIdCache.find(hWnd);
+        if (it != g_windowAppIdCache.end()) {
+            return it->second;
+        }
     }
 
+    std::wstring appId = GetWindowAppId(hWnd);
+
+    std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+    if (g_windowAppIdCache.size() >= kWindowAppIdCacheMaxSize) {
+        // Destroy events might have been missed, start over.
+        g_windowAppIdCache.clear();
+    }
+    g_windowAppIdCache[hWnd] = appId;
+    return appId;
+}
+
+void ForgetWindowAppId(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+    g_windowAppIdCache.erase(hWnd);
+}
+
+bool ResolveIsWindowExcluded(HWND hWnd) {
     DWORD resolvedWindowProcessPathLen = 0;
     WCHAR resolvedWindowProcessPath[MAX_PATH];
     WCHAR resolvedWindowProcessPathUpper[MAX_PATH];
@@ -360,7 +421,7 @@ bool IsWindowExcluded(HWND hWnd) {
         }
     }
 
-    std::wstring appId = GetWindowAppId(hWnd);
+    std::wstring appId = GetWindowAppIdCached(hWnd);
     LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, appId.data(),
                   appId.length(), appId.data(), appId.length(), nullptr,
                   nullptr, 0);
@@ -371,6 +432,107 @@ bool IsWindowExcluded(HWND hWnd) {
     return false;
 }
 
+bool IsWindowExcluded(HWND hWnd) {
+    if (g_settings.excludedPrograms.empty()) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        auto it = g_windowExcludedCache.find(hWnd);
+        if (it != g_windowExcludedCache.end()) {
+            return it->second;
+        }
+    }
+
+    bool excluded = ResolveIsWindowExcluded(hWnd);
+
+    std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+    if (g_windowExcludedCache.size() >= kWindowExcludedCacheMaxSize) {
+        // Destroy events might have been missed, start over.
+        g_windowExcludedCache.clear();
+    }
+    g_windowExcludedCache[hWnd] = excluded;
+    return excluded;
+}
+
+void ForgetWindowExcluded(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+    g_windowExcludedCache.erase(hWnd);
+}
+
+WindowState GetWindowState(HWND hWnd) {
+    WindowState state{};
+
+    state.visible =
+        IsWindowVisible(hWnd) && !IsWindowCloaked(hWnd) && !IsIconic(hWnd);
+    if (!state.visible) {
+        return state;
+    }
+
+    WINDOWPLACEMENT wp{
+        .length = sizeof(WINDOWPLACEMENT),
+    };
+    if (GetWindowPlacement(hWnd, &wp)) {
+        state.showCmd = wp.showCmd;
+    }
+
+    state.arranged = pIsWindowArranged && pIsWindowArranged(hWnd);
+    state.monitor = MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST);
+    DwmGetWindowAttribute(hWnd, DWMWA_EXTENDED_FRAME_BOUNDS, &state.rect,
+                          sizeof(state.rect));
+
+    return state;
+}
+
+bool AreWindowStatesEqual(const WindowState& a, const WindowState& b) {
+    return a.visible == b.visible && a.showCmd == b.showCmd &&
+           a.arranged == b.arranged && a.monitor == b.monitor &&
+           EqualRect(&a.rect, &b.rect);
+}
+
+// Updates the state of a window from an event, returns whether it might
+// affect the taskbars.
+bool UpdateWindowState(DWORD event, HWND hWnd) {
+    if (event == EVENT_SYSTEM_FOREGROUND) {
+        return true;
+    }
+
+    if (event == EVENT_OBJECT_DESTROY) {
+        ForgetWindowExcluded(hWnd);
+        ForgetWindowAppId(hWnd);
+
+        auto it = g_windowStates.find(hWnd);
+        if (it == g_windowStates.end()) {
+            return false;
+        }
+
+        bool wasVisible = it->second.visible;
+        g_windowStates.erase(it);
+        return wasVisible;
+    }
+
+    if (event == EVENT_OBJECT_SHOW) {
+        // The app id might have been set before showing the window.
+        ForgetWindowExcluded(hWnd);
+        ForgetWindowAppId(hWnd);
+    }
+
+    WindowState state = GetWindowState(hWnd);
+
+    auto [it, inserted] = g_windowStates.try_emplace(hWnd, state);
+    if (inserted) {
+        return state.visible;
+    }
+
+    if (AreWindowStatesEqual(it->second, state)) {
+        return false;
+    }
+
+    it->second = state;
+    return true;
+}
+
 bool CanHideTaskbarForWindow(HWND hWnd,
                              HMONITOR monitor,
                              const MONITORINFO* monitorInfo,
@@ -781,6 +943,10 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
         return;
     }
 
+    if (!UpdateWindowState(event, hWnd)) {
+        return;
+    }
+
     Wh_Log(L"> %08X", (DWORD)(ULONG_PTR)hWnd);
 
     if (g_pendingEventsTimer) {
@@ -807,6 +973,32 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
 }
 
 DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
+    g_windowStates.clear();
+
+    // Handles might have been reused while no events were received.
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        g_windowExcludedCache.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+        g_windowAppIdCache.clear();
+    }
+
+    // Record the windows which already exist, so that the first event of a
+    // window which was, for example, already maximized is compared against its
+    // actual state.
+    EnumWindows(
+        [](HWND hWnd, LPARAM lParam) -> BOOL {
+            if (!(GetWindowLong(hWnd, GWL_STYLE) & WS_CHILD) &&
+                !IsTaskbarWindow(hWnd)) {
+                g_windowStates.try_emplace(hWnd, GetWindowState(hWnd));
+            }
+            return TRUE;
+        },
+        0);
+
     HWINEVENTHOOK winObjectEventHook1 =
         SetWinEventHook(EVENT_OBJECT_CREATE, EVENT_OBJECT_HIDE, nullptr,
                         WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT);
@@ -1167,6 +1359,11 @@ void LoadSettings() {
 
     g_settings.excludedPrograms.clear();
 
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        g_windowExcludedCache.clear();
+    }
+
     for (int i = 0;; i++) {
         PCWSTR program = Wh_GetStringSetting(L"excludedPrograms[%d]", i);
 
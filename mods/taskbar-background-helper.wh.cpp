@@ -2,7 +2,7 @@
 // @id              taskbar-background-helper
 // @name            Taskbar Background Helper
 // @description     Sets the taskbar background for the transparent parts, always or only when there's a maximized window, designed to be used with Windows 11 Taskbar Styler
-// @version         1.1
+// @version         1.1.2
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -113,6 +113,7 @@ a workaround.
 #include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 
 enum class BackgroundStyle {
@@ -139,6 +140,33 @@ std::atomic<HANDLE> g_winEventHookThread;
 std::unordered_set<HMONITOR> g_pendingMonitors;
 UINT_PTR g_pendingMonitorsTimer;
 
+// Exclusion decisions per window, resolving them involves opening the process
+// and querying its app id. Entries are dropped when the window is shown or
+// destroyed, and all of them when the settings change.
+std::mutex g_windowExcludedCacheMutex;
+std::unordered_map<HWND, bool> g_windowExcludedCache;
+constexpr size_t kWindowExcludedCacheMaxSize = 4096;
+
+// App ids per window, querying them involves COM calls. Entries are dropped
+// along with the exclusion decisions, but are kept when the settings change.
+std::mutex g_windowAppIdCacheMutex;
+std::unordered_map<HWND, std::wstring> g_windowAppIdCache;
+constexpr size_t kWindowAppIdCacheMaxSize = 4096;
+
+// The windows which currently count as maximized and their monitors. Updated
+// by the event hook thread one window at a time, after being seeded with a
+// full enumeration when the thread starts or the settings change. Until then,
+// g_maximizedWindowsTracked is false and monitors are checked by enumerating
+// all windows.
+std::mutex g_maximizedWindowsMutex;
+std::unordered_map<HWND, HMONITOR> g_maximizedWindows;
+std::unordered_map<HMONITOR, int> g_maximizedWindowCountPerMonitor;
+bool g_maximizedWindowsTracked;
+DWORD g_trackedTaskbarThreadId;
+
+// Posted to the event hook thread to rebuild the tracked windows.
+constexpr UINT kMsgResyncMaximizedWindows = WM_APP + 1;
+
 #if __cplusplus < 202302L
 // Missing in older MinGW headers.
 DECLARE_HANDLE(CO_MTA_USAGE_COOKIE);
@@ -442,11 +470,32 @@ std::wstring GetWindowAppId(HWND hWnd) {
     return result;
 }
 
-bool IsWindowExcluded(HWND hWnd) {
-    if (g_settings.excludedPrograms.empty()) {
-        return false;
+std::wstring GetWindowAppIdCached(HWND hWnd) {
+    {
+        std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+        auto it = g_windowAppIdCache.find(hWnd);
+        if (it != g_windowAppIdCache.end()) {
+            return it->second;
+        }
     }
 
+    std::wstring appId = GetWindowAppId(hWnd);
+
+    std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+    if (g_windowAppIdCache.size() >= kWindowAppIdCacheMaxSize) {
+        // Destroy events might have been missed, start over.
+        g_windowAppIdCache.clear();
+    }
+    g_windowAppIdCache[hWnd] = appId;
+    return appId;
+}
+
+void ForgetWindowAppId(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+    g_windowAppIdCache.erase(hWnd);
+}
+
+bool ResolveIsWindowExcluded(HWND hWnd) {
     DWORD resolvedWindowProcessPathLen = 0;
     WCHAR resolvedWindowProcessPath[MAX_PATH];
     WCHAR resolvedWindowProcessPathUpper[MAX_PATH];
@@ -491,7 +540,7 @@ bool IsWindowExcluded(HWND hWnd) {
         }
     }
 
-    std::wstring appId = GetWindowAppId(hWnd);
+    std::wstring appId = GetWindowAppIdCached(hWnd);
     LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE, appId.data(),
                   appId.length(), appId.data(), appId.length(), nullptr,
                   nullptr, 0);
@@ -502,57 +551,158 @@ bool IsWindowExcluded(HWND hWnd) {
     return false;
 }
 
-bool DoesMonitorHaveMaximizedWindow(HMONITOR monitor, HWND hMMTaskbarWnd) {
-    bool hasMaximizedWindow = false;
+bool IsWindowExcluded(HWND hWnd) {
+    if (g_settings.excludedPrograms.empty()) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        auto it = g_windowExcludedCache.find(hWnd);
+        if (it != g_windowExcludedCache.end()) {
+            return it->second;
+        }
+    }
+
+    bool excluded = ResolveIsWindowExcluded(hWnd);
+
+    std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+    if (g_windowExcludedCache.size() >= kWindowExcludedCacheMaxSize) {
+        // Destroy events might have been missed, start over.
+        g_windowExcludedCache.clear();
+    }
+    g_windowExcludedCache[hWnd] = excluded;
+    return excluded;
+}
+
+void ForgetWindowExcluded(HWND hWnd) {
+    std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+    g_windowExcludedCache.erase(hWnd);
+}
+
+// Whether the window counts as maximized on the given monitor, which is
+// expected to be the window's monitor.
+bool IsWindowMaximizedOnMonitor(HWND hWnd,
+                                HMONITOR monitor,
+                                DWORD dwTaskbarThreadId) {
+    if (GetWindowThreadProcessId(hWnd, nullptr) == dwTaskbarThreadId) {
+        return false;
+    }
+
+    if (!IsWindowVisible(hWnd) || IsWindowCloaked(hWnd) || IsIconic(hWnd) ||
+        (GetWindowLong(hWnd, GWL_EXSTYLE) & WS_EX_NOACTIVATE)) {
+        return false;
+    }
+
+    if (hWnd == GetShellWindow() || GetProp(hWnd, L"DesktopWindow")) {
+        return false;
+    }
+
+    // Check this after the other checks, as it's the most expensive one.
+    if (IsWindowExcluded(hWnd)) {
+        return false;
+    }
+
+    WINDOWPLACEMENT wp{
+        .length = sizeof(WINDOWPLACEMENT),
+    };
+    if (GetWindowPlacement(hWnd, &wp) && wp.showCmd == SW_SHOWMAXIMIZED) {
+        return true;
+    }
 
     MONITORINFO monitorInfo{
         .cbSize = sizeof(monitorInfo),
     };
     GetMonitorInfo(monitor, &monitorInfo);
 
-    HWND hShellWindow = GetShellWindow();
+    RECT windowRect{};
+    DwmGetWindowAttribute(hWnd, DWMWA_EXTENDED_FRAME_BOUNDS, &windowRect,
+                          sizeof(windowRect));
 
-    DWORD dwTaskbarThreadId = GetWindowThreadProcessId(hMMTaskbarWnd, nullptr);
+    // Spans across the whole monitor, e.g. Win+Tab view.
+    return EqualRect(&windowRect, &monitorInfo.rcMonitor);
+}
 
-    auto enumWindowsProc = [&](HWND hWnd) -> BOOL {
-        if (GetWindowThreadProcessId(hWnd, nullptr) == dwTaskbarThreadId) {
-            return TRUE;
+bool DoesMonitorHaveMaximizedWindow(HMONITOR monitor, HWND hMMTaskbarWnd) {
+    {
+        std::lock_guard<std::mutex> guard(g_maximizedWindowsMutex);
+        if (g_maximizedWindowsTracked) {
+            auto it = g_maximizedWindowCountPerMonitor.find(monitor);
+            return it != g_maximizedWindowCountPerMonitor.end() &&
+                   it->second > 0;
         }
+    }
+
+    bool hasMaximizedWindow = false;
 
+    DWORD dwTaskbarThreadId = GetWindowThreadProcessId(hMMTaskbarWnd, nullptr);
+
+    auto enumWindowsProc = [&](HWND hWnd) -> BOOL {
         if (MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST) != monitor) {
             return TRUE;
         }
 
-        if (!IsWindowVisible(hWnd) || IsWindowCloaked(hWnd) || IsIconic(hWnd) ||
-            (GetWindowLong(hWnd, GWL_EXSTYLE) & WS_EX_NOACTIVATE)) {
-            return TRUE;
+        if (IsWindowMaximizedOnMonitor(hWnd, monitor, dwTaskbarThreadId)) {
+            hasMaximizedWindow = true;
+            return FALSE;
         }
 
-        if (hWnd == hShellWindow || GetProp(hWnd, L"DesktopWindow")) {
-            return TRUE;
-        }
+        return TRUE;
+    };
 
-        // Check this after the other checks, as it's the most expensive one.
-        if (IsWindowExcluded(hWnd)) {
-            return TRUE;
+    EnumWindows(
+        [](HWND hWnd, LPARAM lParam) -> BOOL {
+            auto& proc = *reinterpret_cast<decltype(enumWindowsProc)*>(lParam);
+            return proc(hWnd);
+        },
+        reinterpret_cast<LPARAM>(&enumWindowsProc));
+
+    return hasMaximizedWindow;
+}
+
+DWORD GetTaskbarThreadId() {
+    HWND hTaskbarWnd = FindCurrentProcessTaskbarWnd();
+    return hTaskbarWnd ? GetWindowThreadProcessId(hTaskbarWnd, nullptr) : 0;
+}
+
+void SetTrackedMaximizedWindowMonitor(HWND hWnd,
+                                      HMONITOR monitor,
+                                      HMONITOR* previousMonitor) {
+    *previousMonitor = nullptr;
+
+    auto it = g_maximizedWindows.find(hWnd);
+    if (it != g_maximizedWindows.end()) {
+        *previousMonitor = it->second;
+        if (it->second == monitor) {
+            return;
         }
 
-        WINDOWPLACEMENT wp{
-            .length = sizeof(WINDOWPLACEMENT),
-        };
-        if (GetWindowPlacement(hWnd, &wp) && wp.showCmd == SW_SHOWMAXIMIZED) {
-            hasMaximizedWindow = true;
-            return FALSE;
+        if (--g_maximizedWindowCountPerMonitor[it->second] == 0) {
+            g_maximizedWindowCountPerMonitor.erase(it->second);
         }
 
-        RECT windowRect{};
-        DwmGetWindowAttribute(hWnd, DWMWA_EXTENDED_FRAME_BOUNDS, &windowRect,
-                              sizeof(windowRect));
+        g_maximizedWindows.erase(it);
+    }
 
-        if (EqualRect(&windowRect, &monitorInfo.rcMonitor)) {
-            // Spans across the whole monitor, e.g. Win+Tab view.
-            hasMaximizedWindow = true;
-            return FALSE;
+    if (monitor) {
+        g_maximizedWindows[hWnd] = monitor;
+        g_maximizedWindowCountPerMonitor[monitor]++;
+    }
+}
+
+// Runs on the event hook thread.
+void ResyncMaximizedWindows() {
+    DWORD dwTaskbarThreadId = GetTaskbarThreadId();
+    g_trackedTaskbarThreadId = dwTaskbarThreadId;
+
+    std::unordered_map<HWND, HMONITOR> maximizedWindows;
+    std::unordered_map<HMONITOR, int> maximizedWindowCountPerMonitor;
+
+    auto enumWindowsProc = [&](HWND hWnd) -> BOOL {
+        HMONITOR monitor = MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST);
+        if (IsWindowMaximizedOnMonitor(hWnd, monitor, dwTaskbarThreadId)) {
+            maximizedWindows[hWnd] = monitor;
+            maximizedWindowCountPerMonitor[monitor]++;
         }
 
         return TRUE;
@@ -565,7 +715,11 @@ bool DoesMonitorHaveMaximizedWindow(HMONITOR monitor, HWND hMMTaskbarWnd) {
         },
         reinterpret_cast<LPARAM>(&enumWindowsProc));
 
-    return hasMaximizedWindow;
+    std::lock_guard<std::mutex> guard(g_maximizedWindowsMutex);
+    g_maximizedWindows = std::move(maximizedWindows);
+    g_maximizedWindowCountPerMonitor =
+        std::move(maximizedWindowCountPerMonitor);
+    g_maximizedWindowsTracked = true;
 }
 
 void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
@@ -585,10 +739,43 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
         return;
     }
 
-    Wh_Log(L"> %08X", (DWORD)(ULONG_PTR)hWnd);
+    if (event == EVENT_OBJECT_DESTROY || event == EVENT_OBJECT_SHOW) {
+        // Handles get reused after windows are destroyed, and the app id
+        // might have been set just before showing the window.
+        ForgetWindowExcluded(hWnd);
+        ForgetWindowAppId(hWnd);
+    }
 
     HMONITOR monitor = MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST);
-    g_pendingMonitors.insert(monitor);
+
+    HMONITOR maximizedMonitor =
+        event != EVENT_OBJECT_DESTROY &&
+                IsWindowMaximizedOnMonitor(hWnd, monitor,
+                                           g_trackedTaskbarThreadId)
+            ? monitor
+            : nullptr;
+
+    HMONITOR previousMaximizedMonitor;
+    {
+        std::lock_guard<std::mutex> guard(g_maximizedWindowsMutex);
+        SetTrackedMaximizedWindowMonitor(hWnd, maximizedMonitor,
+                                         &previousMaximizedMonitor);
+    }
+
+    // Only monitors which gained or lost a maximized window need an update.
+    if (maximizedMonitor == previousMaximizedMonitor) {
+        return;
+    }
+
+    Wh_Log(L"> %08X", (DWORD)(ULONG_PTR)hWnd);
+
+    if (previousMaximizedMonitor) {
+        g_pendingMonitors.insert(previousMaximizedMonitor);
+    }
+
+    if (maximizedMonitor) {
+        g_pendingMonitors.insert(maximizedMonitor);
+    }
 
     if (g_pendingMonitorsTimer) {
         return;
@@ -643,6 +830,17 @@ void CALLBACK WinEventProc(HWINEVENTHOOK hWinEventHook,
 }
 
 DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
+    // Handles might have been reused while no events were received.
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        g_windowExcludedCache.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+        g_windowAppIdCache.clear();
+    }
+
     HWINEVENTHOOK winObjectEventHook1 =
         SetWinEventHook(EVENT_OBJECT_CREATE, EVENT_OBJECT_HIDE, nullptr,
                         WinEventProc, 0, 0, WINEVENT_OUTOFCONTEXT);
@@ -664,6 +862,10 @@ DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
         Wh_Log(L"Error: SetWinEventHook");
     }
 
+    // Events which arrive meanwhile are queued, and handled on top of the
+    // initial state.
+    ResyncMaximizedWindows();
+
     BOOL bRet;
     MSG msg;
     while ((bRet = GetMessage(&msg, NULL, 0, 0)) != 0) {
@@ -677,6 +879,11 @@ DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
             continue;
         }
 
+        if (msg.hwnd == NULL && msg.message == kMsgResyncMaximizedWindows) {
+            ResyncMaximizedWindows();
+            continue;
+        }
+
         TranslateMessage(&msg);
         DispatchMessage(&msg);
     }
@@ -693,6 +900,13 @@ DWORD WINAPI WinEventHookThread(LPVOID lpThreadParameter) {
         UnhookWinEvent(winObjectEventHook3);
     }
 
+    {
+        std::lock_guard<std::mutex> guard(g_maximizedWindowsMutex);
+        g_maximizedWindowsTracked = false;
+        g_maximizedWindows.clear();
+        g_maximizedWindowCountPerMonitor.clear();
+    }
+
     return 0;
 }
 
@@ -783,6 +997,11 @@ void LoadSettings() {
 
     g_settings.excludedPrograms.clear();
 
+    {
+        std::lock_guard<std::mutex> guard(g_windowExcludedCacheMutex);
+        g_windowExcludedCache.clear();
+    }
+
     for (int i = 0;; i++) {
         PCWSTR program = Wh_GetStringSetting(L"excludedPrograms[%d]", i);
 
@@ -903,6 +1122,16 @@ void Wh_ModSettingsChanged() {
             CloseHandle(g_winEventHookThread);
             g_winEventHookThread = nullptr;
         }
+    } else if (g_winEventHookThread) {
+        // Excluded programs might have changed, enumerate all windows until
+        // the tracked windows are rebuilt.
+        {
+            std::lock_guard<std::mutex> guard(g_maximizedWindowsMutex);
+            g_maximizedWindowsTracked = false;
+        }
+
+        PostThreadMessage(GetThreadId(g_winEventHookThread),
+                          kMsgResyncMaximizedWindows, 0, 0);
     }
 
     AdjustAllTaskbarStyles();
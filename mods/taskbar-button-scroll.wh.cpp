@@ -2,7 +2,7 @@
 // @id              taskbar-button-scroll
 // @name            Taskbar minimize/restore on scroll
 // @description     Minimize/restore by scrolling the mouse wheel over taskbar buttons and thumbnail previews (Windows 11 only)
-// @version         1.1.2
+// @version         1.1.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -104,6 +104,8 @@ constexpr UINT_PTR kRefreshTaskbarTimer = 1731020327;
 
 int g_pointerWheelEventMouseWheelDelta;
 DWORD g_pointerWheelEventMouseWheelTime;
+DWORD g_pointerWheelSimulatedClickTime;
+bool g_pointerWheelSimulatedClickPending;
 WPARAM g_invokingContextMenuWParam;
 int g_thumbnailContextMenuLastIndex;
 void* g_lastScrollTarget;
@@ -235,6 +237,7 @@ int GetScrollCommand(void* scrollTarget) {
 
     int delta = g_pointerWheelEventMouseWheelDelta;
     g_pointerWheelEventMouseWheelDelta = 0;
+    g_pointerWheelSimulatedClickPending = false;
 
     if (g_lastScrollTarget == scrollTarget &&
         tickCountNow - g_lastScrollTime < kLongDelay) {
@@ -606,6 +609,19 @@ int TaskListButton_FlyoutFrame_OnPointerWheelChanged_Hook(
     g_pointerWheelEventMouseWheelDelta += delta;
     g_pointerWheelEventMouseWheelTime = GetTickCount();
 
+    // A simulated click is still on its way, and it will handle the
+    // accumulated delta. Only the net scroll amount of a fast wheel spin
+    // results in a command this way, instead of a command per wheel notch.
+    if (g_pointerWheelSimulatedClickPending &&
+        now - g_pointerWheelSimulatedClickTime < kShortDelay) {
+        Wh_Log(L"Accumulating delta %d", g_pointerWheelEventMouseWheelDelta);
+        args.Handled(true);
+        return 0;
+    }
+
+    g_pointerWheelSimulatedClickPending = true;
+    g_pointerWheelSimulatedClickTime = now;
+
     Wh_Log(L"Simulating a mouse click with delta %d",
            g_pointerWheelEventMouseWheelDelta);
 
@@ -698,7 +714,27 @@ void WINAPI CTaskListWnd_OnContextMenu_Hook(void* pThis,
         clicks = -clicks;
     }
 
-    if (clicks != 0) {
+    int command = 0;
+
+    if (clicks > 0) {
+        command = SC_RESTORE;
+    } else if (clicks < 0) {
+        command = SC_MINIMIZE;
+    }
+
+    DWORD tickCountNow = GetTickCount();
+
+    if (command && g_lastScrollTarget == taskItem &&
+        command == g_lastScrollCommand &&
+        tickCountNow - g_lastScrollCommandTime < kShortDelay) {
+        Wh_Log(L"Ignoring rapid event");
+        command = 0;
+    }
+
+    if (command) {
+        g_lastScrollCommand = command;
+        g_lastScrollCommandTime = tickCountNow;
+
         HWND hTaskItemWnd;
         if (*(void**)taskItem == CImmersiveTaskItem_vftable) {
             hTaskItemWnd = CImmersiveTaskItem_GetWindow_Original(taskItem);
@@ -712,16 +748,16 @@ void WINAPI CTaskListWnd_OnContextMenu_Hook(void* pThis,
 
             KillTimer(hWnd, 2006);
 
-            if (clicks > 0) {
+            if (command == SC_RESTORE) {
                 RestoreWithScroll(hTaskItemWnd);
-            } else if (clicks < 0) {
+            } else {
                 MinimizeWithScroll(hTaskItemWnd);
             }
         }
     }
 
     g_lastScrollTarget = taskItem;
-    g_lastScrollTime = GetTickCount();
+    g_lastScrollTime = tickCountNow;
     g_lastScrollDeltaRemainder = delta % WHEEL_DELTA;
 }
 
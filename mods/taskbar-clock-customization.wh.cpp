@@ -2,7 +2,7 @@
 // @id              taskbar-clock-customization
 // @name            Taskbar Clock Customization
 // @description     Custom date/time format, news feed, weather, performance metrics (upload/download speed, CPU, RAM), custom fonts and colors, and more
-// @version         1.6.3
+// @version         1.7
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -246,6 +246,13 @@ styles, such as the font color and size.
   $name: Web content update interval
   $description: >-
     The update interval, in minutes, of the weather and the web content items.
+- WebContentsSharedCache: false
+  $name: Share web content between sessions
+  $description: >-
+    If enabled, pages fetched in one user session are reused by the other
+    sessions on the machine until the update interval passes, instead of each
+    session fetching them. Useful on multi-user servers, where many identical
+    requests can get rate-limited.
 - TimeZones: ["Eastern Standard Time"]
   $name: Time zones
   $description: >-
@@ -394,6 +401,7 @@ styles, such as the font color and size.
 
 using WindhawkUtils::StringSetting;
 
+#include <algorithm>
 #include <atomic>
 #include <functional>
 #include <mutex>
@@ -401,6 +409,8 @@ using WindhawkUtils::StringSetting;
 #include <regex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 using namespace std::string_view_literals;
@@ -511,6 +521,7 @@ struct {
     WebContentWeatherUnits webContentWeatherUnits;
     std::vector<WebContentsSettings> webContentsItems;
     int webContentsUpdateInterval;
+    bool webContentsSharedCache;
     std::vector<StringSetting> timeZones;
     TextStyleSettings timeStyle;
     TextStyleSettings dateStyle;
@@ -541,9 +552,41 @@ std::atomic<bool> g_taskbarViewDllLoaded;
 std::atomic<bool> g_initialized;
 std::atomic<bool> g_explorerPatcherInitialized;
 
+// Formatted strings are recomputed only when the formatted time changes at the
+// granularity they depend on, so that several taskbars refreshing within the
+// same second share the results.
 DWORD g_formatIndex;
+DWORD g_formatDateIndex;
 SYSTEMTIME g_formatTime;
 
+bool IsSameFormatDate(const SYSTEMTIME* a, const SYSTEMTIME* b) {
+    return a->wYear == b->wYear && a->wMonth == b->wMonth &&
+           a->wDay == b->wDay;
+}
+
+bool IsSameFormatSecond(const SYSTEMTIME* a, const SYSTEMTIME* b) {
+    return IsSameFormatDate(a, b) && a->wHour == b->wHour &&
+           a->wMinute == b->wMinute && a->wSecond == b->wSecond;
+}
+
+void SetFormatTime(const SYSTEMTIME* time) {
+    if (IsSameFormatSecond(time, &g_formatTime)) {
+        return;
+    }
+
+    if (!IsSameFormatDate(time, &g_formatTime)) {
+        g_formatDateIndex++;
+    }
+
+    g_formatTime = *time;
+    g_formatIndex++;
+}
+
+void InvalidateFormattedStrings() {
+    g_formatIndex++;
+    g_formatDateIndex++;
+}
+
 template <size_t N>
 struct FormattedString {
     DWORD formatIndex;
@@ -571,6 +614,18 @@ FormattedString<FORMATTED_BUFFER_SIZE> g_ramFormatted;
 
 std::vector<std::optional<DYNAMIC_TIME_ZONE_INFORMATION>> g_timeZoneInformation;
 
+struct TimeZoneTime {
+    DWORD formatIndex = 0;
+    bool valid = false;
+    SYSTEMTIME time;
+    // The offset from UTC, and the end of the UTC quarter-hour in which it
+    // was computed. Time zone offsets and their transitions are aligned to
+    // 15 minutes, so the offset can't change before that.
+    LONGLONG offset;
+    ULONGLONG offsetValidUntil = 0;
+};
+std::vector<TimeZoneTime> g_timeZoneTime;
+
 HANDLE g_webContentUpdateThread;
 HANDLE g_webContentUpdateRefreshEvent;
 HANDLE g_webContentUpdateStopEvent;
@@ -625,78 +680,671 @@ GetDateFormatW_t GetDateFormatW_Original;
 using SendMessageW_t = decltype(&SendMessageW);
 SendMessageW_t SendMessageW_Original;
 
-std::optional<std::wstring> GetUrlContent(PCWSTR lpUrl,
-                                          bool failIfNot200 = true) {
+// Markers of a part of a web page to extract. The extracted part starts after
+// the first `start` marker which follows `blockStart`, and ends before the
+// following `end` marker, or at the end of the page if `end` is empty.
+struct WebContentMarkers {
+    PCWSTR blockStart;
+    PCWSTR start;
+    PCWSTR end;
+};
+
+// Matches the markers incrementally as the page is downloaded, keeping only
+// the text which might still be part of a marker or of the extracted part.
+class WebContentExtractor {
+   public:
+    // Extracted parts longer than that are truncated.
+    static constexpr size_t kMaxLength = 256 * 1024;
+
+    explicit WebContentExtractor(const WebContentMarkers& markers)
+        : markers_(markers) {}
+
+    bool IsDone() const { return phase_ == Phase::done; }
+
+    void Feed(std::wstring_view chunk) {
+        if (phase_ == Phase::done) {
+            return;
+        }
+
+        window_ += chunk;
+
+        if (phase_ == Phase::blockStart && !FindMarker(markers_.blockStart,
+                                                       /*skipMarker=*/false)) {
+            return;
+        }
+
+        if (phase_ == Phase::start &&
+            !FindMarker(markers_.start, /*skipMarker=*/true)) {
+            return;
+        }
+
+        if (phase_ == Phase::end) {
+            size_t endLength = wcslen(markers_.end);
+            size_t pos = endLength ? window_.find(markers_.end) : window_.npos;
+            if (pos != window_.npos) {
+                AppendResult(std::wstring_view(window_).substr(0, pos));
+                window_.clear();
+                phase_ = Phase::done;
+                return;
+            }
+
+            // Keep a possible partial end marker in the window.
+            size_t keep = std::min(window_.length(),
+                                   endLength ? endLength - 1 : 0);
+            AppendResult(std::wstring_view(window_).substr(
+                0, window_.length() - keep));
+            window_.erase(0, window_.length() - keep);
+        }
+    }
+
+    // Returns the extracted part, or an empty string if the markers weren't
+    // found.
+    std::wstring Finish() {
+        if (phase_ == Phase::end && !*markers_.end) {
+            AppendResult(window_);
+            phase_ = Phase::done;
+        }
+
+        window_.clear();
+
+        if (phase_ != Phase::done) {
+            result_.clear();
+        }
+
+        return std::move(result_);
+    }
+
+   private:
+    enum class Phase {
+        blockStart,
+        start,
+        end,
+        done,
+    };
+
+    // Advances to the next phase if the marker is in the window. Otherwise,
+    // drops the text which can no longer be part of the marker.
+    bool FindMarker(PCWSTR marker, bool skipMarker) {
+        size_t markerLength = wcslen(marker);
+        size_t pos = window_.find(marker);
+        if (pos == window_.npos) {
+            size_t keep =
+                std::min(window_.length(), markerLength ? markerLength - 1 : 0);
+            window_.erase(0, window_.length() - keep);
+            return false;
+        }
+
+        window_.erase(0, skipMarker ? pos + markerLength : pos);
+        phase_ = static_cast<Phase>(static_cast<int>(phase_) + 1);
+        return true;
+    }
+
+    void AppendResult(std::wstring_view text) {
+        if (result_.length() < kMaxLength) {
+            result_ += text.substr(0, kMaxLength - result_.length());
+        }
+    }
+
+    WebContentMarkers markers_;
+    Phase phase_ = Phase::blockStart;
+    std::wstring window_;
+    std::wstring result_;
+};
+
+std::wstring GetWebContentMarkersKey(
+    const std::vector<WebContentMarkers>& markers) {
+    std::wstring key;
+    for (const auto& item : markers) {
+        for (PCWSTR marker : {item.blockStart, item.start, item.end}) {
+            key += marker;
+            key += L'\0';
+        }
+    }
+
+    return key;
+}
+
+// Validators of the last successful download of each URL and the parts which
+// were extracted from it, used for conditional requests. The entries are also
+// saved in the mod storage folder, so that unchanged pages aren't downloaded
+// again after a restart.
+struct UrlContentCacheEntry {
+    std::wstring etag;
+    std::wstring lastModified;
+    std::wstring markersKey;
+    std::vector<std::wstring> contents;
+};
+
+std::mutex g_urlContentCacheMutex;
+std::unordered_map<std::wstring, UrlContentCacheEntry> g_urlContentCache;
+
+std::wstring GetUrlContentCacheFilePath(PCWSTR lpUrl) {
+    WCHAR storagePath[MAX_PATH];
+    if (!Wh_GetModStoragePath(storagePath, ARRAYSIZE(storagePath))) {
+        return std::wstring();
+    }
+
+    std::wstring path = storagePath;
+    CreateDirectory(path.c_str(), nullptr);
+    path += L"\\WebContentCache";
+    CreateDirectory(path.c_str(), nullptr);
+
+    WCHAR fileName[32];
+    swprintf_s(fileName, L"\\%016llX.bin",
+               static_cast<unsigned long long>(
+                   std::hash<std::wstring_view>{}(lpUrl)));
+    path += fileName;
+    return path;
+}
+
+// Cache files are a sequence of UTF-16 strings, each prefixed with its length.
+void AppendCacheFileString(std::wstring* data, std::wstring_view s) {
+    *data += static_cast<WCHAR>(s.size() & 0xFFFF);
+    *data += static_cast<WCHAR>(s.size() >> 16);
+    *data += s;
+}
+
+bool ParseCacheFileStrings(std::wstring_view data,
+                           std::vector<std::wstring>* strings) {
+    while (data.size() >= 2) {
+        size_t length = data[0] | (static_cast<size_t>(data[1]) << 16);
+        data = data.substr(2);
+        if (length > data.size()) {
+            return false;
+        }
+
+        strings->emplace_back(data.substr(0, length));
+        data = data.substr(length);
+    }
+
+    return true;
+}
+
+// File format: the URL, the ETag and Last-Modified values, the markers key and
+// the extracted parts.
+std::optional<UrlContentCacheEntry> LoadUrlContentCacheEntryFromFile(
+    PCWSTR lpUrl) {
+    std::wstring path = GetUrlContentCacheFilePath(lpUrl);
+    if (path.empty()) {
+        return std::nullopt;
+    }
+
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return std::nullopt;
+    }
+
+    std::wstring data;
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0 &&
+        fileSize.QuadPart < 16 * 1024 * 1024) {
+        data.resize(static_cast<size_t>(fileSize.QuadPart) / sizeof(WCHAR));
+        DWORD bytesRead;
+        if (!ReadFile(hFile, data.data(), data.size() * sizeof(WCHAR),
+                      &bytesRead, nullptr) ||
+            bytesRead != data.size() * sizeof(WCHAR)) {
+            data.clear();
+        }
+    }
+
+    CloseHandle(hFile);
+
+    std::vector<std::wstring> strings;
+    if (!ParseCacheFileStrings(data, &strings) || strings.size() < 4 ||
+        strings[0] != lpUrl) {
+        return std::nullopt;
+    }
+
+    UrlContentCacheEntry entry;
+    entry.etag = std::move(strings[1]);
+    entry.lastModified = std::move(strings[2]);
+    entry.markersKey = std::move(strings[3]);
+    entry.contents.assign(std::make_move_iterator(strings.begin() + 4),
+                          std::make_move_iterator(strings.end()));
+    return entry;
+}
+
+void SaveUrlContentCacheEntryToFile(PCWSTR lpUrl,
+                                    const UrlContentCacheEntry& entry) {
+    std::wstring path = GetUrlContentCacheFilePath(lpUrl);
+    if (path.empty()) {
+        return;
+    }
+
+    std::wstring data;
+    AppendCacheFileString(&data, lpUrl);
+    AppendCacheFileString(&data, entry.etag);
+    AppendCacheFileString(&data, entry.lastModified);
+    AppendCacheFileString(&data, entry.markersKey);
+    for (const auto& content : entry.contents) {
+        AppendCacheFileString(&data, content);
+    }
+
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                              CREATE_ALWAYS, 0, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        Wh_Log(L"Failed to create cache file: %u", GetLastError());
+        return;
+    }
+
+    DWORD bytesWritten;
+    if (!WriteFile(hFile, data.data(), data.size() * sizeof(WCHAR),
+                   &bytesWritten, nullptr)) {
+        Wh_Log(L"Failed to write cache file: %u", GetLastError());
+    }
+
+    CloseHandle(hFile);
+}
+
+std::optional<UrlContentCacheEntry> GetUrlContentCacheEntry(PCWSTR lpUrl) {
+    {
+        std::lock_guard<std::mutex> guard(g_urlContentCacheMutex);
+        auto it = g_urlContentCache.find(lpUrl);
+        if (it != g_urlContentCache.end()) {
+            return it->second;
+        }
+    }
+
+    auto entry = LoadUrlContentCacheEntryFromFile(lpUrl);
+    if (entry) {
+        std::lock_guard<std::mutex> guard(g_urlContentCacheMutex);
+        g_urlContentCache.try_emplace(lpUrl, *entry);
+    }
+
+    return entry;
+}
+
+void SetUrlContentCacheEntry(PCWSTR lpUrl, UrlContentCacheEntry entry) {
+    SaveUrlContentCacheEntryToFile(lpUrl, entry);
+
+    std::lock_guard<std::mutex> guard(g_urlContentCacheMutex);
+    g_urlContentCache[lpUrl] = std::move(entry);
+}
+
+// With the shared cache enabled, the parts extracted from each page are also
+// kept in a file in the mod storage folder which is shared by all sessions,
+// along with the time they were fetched. A session holds a lock on the file
+// while it fetches the page, and other sessions wait for it and then use the
+// result instead of fetching the page themselves.
+class SharedUrlContentCache {
+   public:
+    SharedUrlContentCache(PCWSTR lpUrl, const std::wstring& markersKey) {
+        key_ = lpUrl;
+        key_ += L'\0';
+        key_ += markersKey;
+
+        WCHAR storagePath[MAX_PATH];
+        if (!Wh_GetModStoragePath(storagePath, ARRAYSIZE(storagePath))) {
+            return;
+        }
+
+        std::wstring path = storagePath;
+        CreateDirectory(path.c_str(), nullptr);
+        path += L"\\SharedWebContentCache";
+        CreateDirectory(path.c_str(), nullptr);
+
+        WCHAR fileName[32];
+        swprintf_s(fileName, L"\\%016llX.bin",
+                   static_cast<unsigned long long>(
+                       std::hash<std::wstring>{}(key_)));
+        path += fileName;
+
+        hFile_ = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                            OPEN_ALWAYS, 0, nullptr);
+        if (hFile_ == INVALID_HANDLE_VALUE) {
+            Wh_Log(L"Failed to open shared cache file: %u", GetLastError());
+            return;
+        }
+
+        // Poll instead of blocking, so that unloading the mod isn't held back
+        // by another session's download.
+        constexpr DWORD kMaxWaitMs = 60 * 1000;
+        constexpr DWORD kPollMs = 200;
+        for (DWORD waited = 0; waited < kMaxWaitMs; waited += kPollMs) {
+            OVERLAPPED overlapped{};
+            if (LockFileEx(hFile_,
+                           LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+                           0, 1, 0, &overlapped)) {
+                locked_ = true;
+                return;
+            }
+
+            if (WaitForSingleObject(g_webContentUpdateStopEvent, kPollMs) ==
+                WAIT_OBJECT_0) {
+                stopped_ = true;
+                return;
+            }
+        }
+
+        Wh_Log(L"Timed out waiting for the shared cache lock");
+    }
+
+    ~SharedUrlContentCache() {
+        if (hFile_ == INVALID_HANDLE_VALUE) {
+            return;
+        }
+
+        if (locked_) {
+            OVERLAPPED overlapped{};
+            UnlockFileEx(hFile_, 0, 1, 0, &overlapped);
+        }
+
+        CloseHandle(hFile_);
+    }
+
+    SharedUrlContentCache(const SharedUrlContentCache&) = delete;
+    SharedUrlContentCache& operator=(const SharedUrlContentCache&) = delete;
+
+    bool IsStopped() const { return stopped_; }
+
+    // Returns the cached parts if they were fetched less than `maxAgeSeconds`
+    // ago.
+    std::optional<std::vector<std::wstring>> Read(DWORD maxAgeSeconds) {
+        if (!locked_) {
+            return std::nullopt;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(hFile_, &fileSize) || fileSize.QuadPart <= 0 ||
+            fileSize.QuadPart >= 16 * 1024 * 1024) {
+            return std::nullopt;
+        }
+
+        std::wstring data(
+            static_cast<size_t>(fileSize.QuadPart) / sizeof(WCHAR), L'\0');
+        DWORD bytesRead;
+        OVERLAPPED overlapped{};
+        if (!ReadFile(hFile_, data.data(), data.size() * sizeof(WCHAR),
+                      &bytesRead, &overlapped) ||
+            bytesRead != data.size() * sizeof(WCHAR)) {
+            return std::nullopt;
+        }
+
+        std::vector<std::wstring> strings;
+        if (!ParseCacheFileStrings(data, &strings) || strings.size() < 2 ||
+            strings[0] != key_) {
+            return std::nullopt;
+        }
+
+        ULONGLONG fetchTime = wcstoull(strings[1].c_str(), nullptr, 16);
+        ULONGLONG now = GetSystemTimeAsULONGLONG();
+        if (now < fetchTime ||
+            now - fetchTime >= maxAgeSeconds * 10000000ULL) {
+            return std::nullopt;
+        }
+
+        strings.erase(strings.begin(), strings.begin() + 2);
+        return strings;
+    }
+
+    void Write(const std::vector<std::wstring>& contents) {
+        if (!locked_) {
+            return;
+        }
+
+        WCHAR fetchTime[17];
+        swprintf_s(fetchTime, L"%016llX", GetSystemTimeAsULONGLONG());
+
+        std::wstring data;
+        AppendCacheFileString(&data, key_);
+        AppendCacheFileString(&data, fetchTime);
+        for (const auto& content : contents) {
+            AppendCacheFileString(&data, content);
+        }
+
+        DWORD bytesWritten;
+        if (SetFilePointer(hFile_, 0, nullptr, FILE_BEGIN) ==
+                INVALID_SET_FILE_POINTER ||
+            !WriteFile(hFile_, data.data(), data.size() * sizeof(WCHAR),
+                       &bytesWritten, nullptr) ||
+            !SetEndOfFile(hFile_)) {
+            Wh_Log(L"Failed to write shared cache file: %u", GetLastError());
+        }
+    }
+
+   private:
+    static ULONGLONG GetSystemTimeAsULONGLONG() {
+        FILETIME fileTime;
+        GetSystemTimeAsFileTime(&fileTime);
+        return (static_cast<ULONGLONG>(fileTime.dwHighDateTime) << 32) |
+               fileTime.dwLowDateTime;
+    }
+
+    std::wstring key_;
+    HANDLE hFile_ = INVALID_HANDLE_VALUE;
+    bool locked_ = false;
+    bool stopped_ = false;
+};
+
+std::wstring QueryUrlHeader(HINTERNET hUrlHandle, DWORD dwInfoLevel) {
+    WCHAR buffer[256];
+    DWORD bufferSize = sizeof(buffer);
+    if (!HttpQueryInfo(hUrlHandle, dwInfoLevel, buffer, &bufferSize, nullptr)) {
+        return std::wstring();
+    }
+
+    std::wstring value(buffer, bufferSize / sizeof(WCHAR));
+    if (value.find_first_of(L"\r\n") != value.npos) {
+        return std::wstring();
+    }
+
+    return value;
+}
+
+// Returns the length of the longest prefix of the UTF-8 data which doesn't end
+// with an incomplete character.
+size_t GetCompleteUtf8Length(const BYTE* data, size_t length) {
+    size_t i = length;
+    size_t continuationBytes = 0;
+    while (i > 0 && continuationBytes < 3 && (data[i - 1] & 0xC0) == 0x80) {
+        i--;
+        continuationBytes++;
+    }
+
+    if (i == 0) {
+        return length;
+    }
+
+    BYTE lead = data[i - 1];
+    size_t sequenceLength = (lead & 0xE0) == 0xC0   ? 2
+                            : (lead & 0xF0) == 0xE0 ? 3
+                            : (lead & 0xF8) == 0xF0 ? 4
+                                                    : 1;
+    if (sequenceLength > continuationBytes + 1) {
+        return i - 1;
+    }
+
+    return length;
+}
+
+// Downloads the page and extracts the parts delimited by the given markers,
+// using a separate extractor for each set of markers. Reading stops as soon as
+// all parts were extracted. If `notModified` is set, it's set to true if the
+// server responded with "304 Not Modified", in which case the parts extracted
+// from the previous download are returned.
+std::optional<std::vector<std::wstring>> GetUrlWebContents(
+    PCWSTR lpUrl,
+    const std::vector<WebContentMarkers>& markers,
+    bool failIfNot200 = true,
+    bool* notModified = nullptr) {
+    if (notModified) {
+        *notModified = false;
+    }
+
+    std::wstring markersKey = GetWebContentMarkersKey(markers);
+
+    std::optional<SharedUrlContentCache> sharedCache;
+    if (g_settings.webContentsSharedCache) {
+        sharedCache.emplace(lpUrl, markersKey);
+        if (sharedCache->IsStopped()) {
+            return std::nullopt;
+        }
+
+        // Leave some slack, so that sessions with the same interval reuse each
+        // other's results instead of just missing them.
+        constexpr DWORD kSlackSeconds = 30;
+        DWORD maxAgeSeconds =
+            std::max(g_settings.webContentsUpdateInterval, 1) * 60 -
+            kSlackSeconds;
+        if (auto contents = sharedCache->Read(maxAgeSeconds)) {
+            return contents;
+        }
+    }
+
+    auto cacheEntry = GetUrlContentCacheEntry(lpUrl);
+    if (cacheEntry && cacheEntry->markersKey != markersKey) {
+        cacheEntry.reset();
+    }
+
+    std::wstring headers;
+    if (cacheEntry) {
+        if (!cacheEntry->etag.empty()) {
+            headers += L"If-None-Match: ";
+            headers += cacheEntry->etag;
+            headers += L"\r\n";
+        }
+
+        if (!cacheEntry->lastModified.empty()) {
+            headers += L"If-Modified-Since: ";
+            headers += cacheEntry->lastModified;
+            headers += L"\r\n";
+        }
+    }
+
     HINTERNET hOpenHandle = InternetOpen(
         L"WindhawkMod", INTERNET_OPEN_TYPE_PRECONFIG, nullptr, nullptr, 0);
     if (!hOpenHandle) {
         return std::nullopt;
     }
 
-    HINTERNET hUrlHandle =
-        InternetOpenUrl(hOpenHandle, lpUrl, nullptr, 0,
-                        INTERNET_FLAG_NO_AUTH | INTERNET_FLAG_NO_CACHE_WRITE |
-                            INTERNET_FLAG_NO_COOKIES | INTERNET_FLAG_NO_UI |
-                            INTERNET_FLAG_PRAGMA_NOCACHE | INTERNET_FLAG_RELOAD,
-                        0);
+    HINTERNET hUrlHandle = InternetOpenUrl(
+        hOpenHandle, lpUrl, headers.empty() ? nullptr : headers.c_str(),
+        headers.empty() ? 0 : static_cast<DWORD>(-1),
+        INTERNET_FLAG_NO_AUTH | INTERNET_FLAG_NO_CACHE_WRITE |
+            INTERNET_FLAG_NO_COOKIES | INTERNET_FLAG_NO_UI |
+            INTERNET_FLAG_PRAGMA_NOCACHE | INTERNET_FLAG_RELOAD,
+        0);
     if (!hUrlHandle) {
         InternetCloseHandle(hOpenHandle);
         return std::nullopt;
     }
 
-    if (failIfNot200) {
-        DWORD dwStatusCode = 0;
-        DWORD dwStatusCodeSize = sizeof(dwStatusCode);
-        if (!HttpQueryInfo(hUrlHandle,
-                           HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER,
-                           &dwStatusCode, &dwStatusCodeSize, nullptr) ||
-            dwStatusCode != 200) {
-            InternetCloseHandle(hUrlHandle);
-            InternetCloseHandle(hOpenHandle);
-            return std::nullopt;
+    DWORD dwStatusCode = 0;
+    DWORD dwStatusCodeSize = sizeof(dwStatusCode);
+    if (!HttpQueryInfo(hUrlHandle,
+                       HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER,
+                       &dwStatusCode, &dwStatusCodeSize, nullptr)) {
+        dwStatusCode = 0;
+    }
+
+    if (dwStatusCode == HTTP_STATUS_NOT_MODIFIED && cacheEntry) {
+        InternetCloseHandle(hUrlHandle);
+        InternetCloseHandle(hOpenHandle);
+
+        if (notModified) {
+            *notModified = true;
+        }
+
+        if (sharedCache) {
+            sharedCache->Write(cacheEntry->contents);
         }
+
+        return std::move(cacheEntry->contents);
     }
 
-    LPBYTE pUrlContent = (LPBYTE)HeapAlloc(GetProcessHeap(), 0, 0x400);
-    if (!pUrlContent) {
+    if (failIfNot200 && dwStatusCode != HTTP_STATUS_OK) {
         InternetCloseHandle(hUrlHandle);
         InternetCloseHandle(hOpenHandle);
         return std::nullopt;
     }
 
-    DWORD dwNumberOfBytesRead;
-    InternetReadFile(hUrlHandle, pUrlContent, 0x400, &dwNumberOfBytesRead);
-    DWORD dwLength = dwNumberOfBytesRead;
+    UrlContentCacheEntry newCacheEntry;
+    if (dwStatusCode == HTTP_STATUS_OK) {
+        newCacheEntry.etag = QueryUrlHeader(hUrlHandle, HTTP_QUERY_ETAG);
+        newCacheEntry.lastModified =
+            QueryUrlHeader(hUrlHandle, HTTP_QUERY_LAST_MODIFIED);
+    }
+
+    std::vector<WebContentExtractor> extractors(markers.begin(),
+                                                markers.end());
 
-    while (dwNumberOfBytesRead) {
-        LPBYTE pNewUrlContent = (LPBYTE)HeapReAlloc(
-            GetProcessHeap(), 0, pUrlContent, dwLength + 0x400);
-        if (!pNewUrlContent) {
+    auto allDone = [&extractors]() {
+        return std::all_of(extractors.begin(), extractors.end(),
+                           [](const auto& e) { return e.IsDone(); });
+    };
+
+    // Assume UTF-8. An incomplete character at the end of a chunk is kept for
+    // the next chunk.
+    BYTE buffer[0x4000];
+    DWORD bufferLength = 0;
+    std::wstring chunk;
+    while (!allDone()) {
+        DWORD dwNumberOfBytesRead;
+        if (!InternetReadFile(hUrlHandle, buffer + bufferLength,
+                              sizeof(buffer) - bufferLength,
+                              &dwNumberOfBytesRead)) {
             InternetCloseHandle(hUrlHandle);
             InternetCloseHandle(hOpenHandle);
-            HeapFree(GetProcessHeap(), 0, pUrlContent);
             return std::nullopt;
         }
 
-        pUrlContent = pNewUrlContent;
-        InternetReadFile(hUrlHandle, pUrlContent + dwLength, 0x400,
-                         &dwNumberOfBytesRead);
-        dwLength += dwNumberOfBytesRead;
+        bufferLength += dwNumberOfBytesRead;
+
+        DWORD completeLength = dwNumberOfBytesRead
+                                   ? GetCompleteUtf8Length(buffer, bufferLength)
+                                   : bufferLength;
+        int charsNeeded = MultiByteToWideChar(
+            CP_UTF8, 0, (PCSTR)buffer, completeLength, nullptr, 0);
+        chunk.resize(charsNeeded);
+        MultiByteToWideChar(CP_UTF8, 0, (PCSTR)buffer, completeLength,
+                            chunk.data(), chunk.size());
+
+        for (auto& extractor : extractors) {
+            extractor.Feed(chunk);
+        }
+
+        memmove(buffer, buffer + completeLength, bufferLength - completeLength);
+        bufferLength -= completeLength;
+
+        if (!dwNumberOfBytesRead) {
+            break;
+        }
     }
 
     InternetCloseHandle(hUrlHandle);
     InternetCloseHandle(hOpenHandle);
 
-    // Assume UTF-8.
-    int charsNeeded = MultiByteToWideChar(CP_UTF8, 0, (PCSTR)pUrlContent,
-                                          dwLength, nullptr, 0);
-    std::wstring unicodeContent(charsNeeded, L'\0');
-    MultiByteToWideChar(CP_UTF8, 0, (PCSTR)pUrlContent, dwLength,
-                        unicodeContent.data(), unicodeContent.size());
+    std::vector<std::wstring> contents;
+    contents.reserve(extractors.size());
+    for (auto& extractor : extractors) {
+        contents.push_back(extractor.Finish());
+    }
+
+    if (!newCacheEntry.etag.empty() || !newCacheEntry.lastModified.empty()) {
+        newCacheEntry.markersKey = std::move(markersKey);
+        newCacheEntry.contents = contents;
+        SetUrlContentCacheEntry(lpUrl, std::move(newCacheEntry));
+    }
 
-    HeapFree(GetProcessHeap(), 0, pUrlContent);
+    if (sharedCache && dwStatusCode == HTTP_STATUS_OK) {
+        sharedCache->Write(contents);
+    }
 
-    return unicodeContent;
+    return contents;
+}
+
+std::optional<std::wstring> GetUrlContent(PCWSTR lpUrl,
+                                          bool failIfNot200 = true,
+                                          bool* notModified = nullptr) {
+    auto contents = GetUrlWebContents(lpUrl, {{L"", L"", L""}}, failIfNot200,
+                                      notModified);
+    if (!contents) {
+        return std::nullopt;
+    }
+
+    return std::move((*contents)[0]);
 }
 
 // https://stackoverflow.com/a/29752943
@@ -765,31 +1413,6 @@ int StringCopyTruncated(PWSTR dest,
     return i;
 }
 
-std::wstring ExtractWebContent(std::wstring_view webContent,
-                               PCWSTR webContentsBlockStart,
-                               PCWSTR webContentsStart,
-                               PCWSTR webContentsEnd) {
-    auto block = webContent.find(webContentsBlockStart);
-    if (block == webContent.npos) {
-        return std::wstring();
-    }
-
-    auto start = webContent.find(webContentsStart, block);
-    if (start == webContent.npos) {
-        return std::wstring();
-    }
-
-    start += wcslen(webContentsStart);
-
-    auto end = *webContentsEnd ? webContent.find(webContentsEnd, start)
-                               : webContent.length();
-    if (end == webContent.npos) {
-        return std::wstring();
-    }
-
-    return std::wstring(webContent.substr(start, end - start));
-}
-
 std::wstring ExtractTextFromHtml(std::wstring html) {
     winrt::com_ptr<IHTMLDocument2> doc;
     winrt::check_hresult(CoCreateInstance(CLSID_HTMLDocument, nullptr,
@@ -905,11 +1528,20 @@ bool UpdateWeatherWebContent() {
     }
     weatherUrl += L"format=";
     weatherUrl += EscapeUrlComponent(format.c_str());
-    std::optional<std::wstring> urlContent = GetUrlContent(weatherUrl.c_str());
+    bool notModified;
+    std::optional<std::wstring> urlContent =
+        GetUrlContent(weatherUrl.c_str(), /*failIfNot200=*/true, &notModified);
     if (!urlContent) {
         return false;
     }
 
+    if (notModified) {
+        std::lock_guard<std::mutex> guard(g_webContentMutex);
+        if (g_webContentWeather) {
+            return true;
+        }
+    }
+
     // Remove spaces after the %c emoji.
     std::wstring weatherContent;
 
@@ -937,24 +1569,107 @@ bool UpdateWeatherWebContent() {
     return true;
 }
 
+struct UrlWebContentsRequest {
+    std::wstring url;
+    std::vector<WebContentMarkers> markers;
+    std::optional<std::vector<std::wstring>> contents;
+    bool notModified = false;
+};
+
+// Downloads the requested pages concurrently, one thread per page.
+void GetUrlWebContentsConcurrently(
+    std::vector<UrlWebContentsRequest>& requests) {
+    auto fetch = [&requests](size_t i) {
+        auto& request = requests[i];
+        request.contents =
+            GetUrlWebContents(request.url.c_str(), request.markers,
+                              /*failIfNot200=*/false, &request.notModified);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < requests.size(); i++) {
+        threads.emplace_back(fetch, i);
+    }
+
+    if (!requests.empty()) {
+        fetch(0);
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+bool IsWebContentItemUsed(size_t index) {
+    WCHAR patternSubstring[32];
+    swprintf_s(patternSubstring, L"%%web%i%%", index + 1);
+
+    WCHAR patternSubstringFull[32];
+    swprintf_s(patternSubstringFull, L"%%web%i_full%%", index + 1);
+
+    return IsStrInDateTimePatternSettings(patternSubstring) ||
+           IsStrInDateTimePatternSettings(patternSubstringFull);
+}
+
 void UpdateWebContent() {
     int failed = 0;
 
-    std::wstring lastUrl;
-    std::optional<std::wstring> urlContent;
+    bool legacyWebContentUsed =
+        g_settings.webContentsUrl && g_settings.webContentsBlockStart &&
+        g_settings.webContentsStart && g_settings.webContentsEnd;
+
+    // Group the markers by URL, so that each page is downloaded once. Each
+    // extracted part is identified by its request and marker indices.
+    std::vector<UrlWebContentsRequest> requests;
+    auto addRequest =
+        [&requests](PCWSTR url,
+                    WebContentMarkers markers) -> std::pair<size_t, size_t> {
+        auto it = std::find_if(requests.begin(), requests.end(),
+                               [url](const auto& r) { return r.url == url; });
+        if (it == requests.end()) {
+            requests.push_back({url});
+            it = requests.end() - 1;
+        }
+
+        it->markers.push_back(markers);
+        return {it - requests.begin(), it->markers.size() - 1};
+    };
+
+    std::pair<size_t, size_t> legacyWebContentIndex;
+    if (legacyWebContentUsed) {
+        legacyWebContentIndex = addRequest(
+            g_settings.webContentsUrl,
+            {g_settings.webContentsBlockStart, g_settings.webContentsStart,
+             g_settings.webContentsEnd});
+    }
+
+    std::vector<std::pair<size_t, size_t>> itemIndices(
+        g_settings.webContentsItems.size());
+    for (size_t i = 0; i < g_settings.webContentsItems.size(); i++) {
+        if (IsWebContentItemUsed(i)) {
+            const auto& item = g_settings.webContentsItems[i];
+            itemIndices[i] = addRequest(
+                item.url, {item.blockStart, item.start, item.end});
+        }
+    }
+
+    // The weather is fetched in parallel with the other pages.
+    std::thread weatherThread;
+    bool weatherSucceeded = true;
+    if (IsStrInDateTimePatternSettings(L"%weather%")) {
+        weatherThread = std::thread([&weatherSucceeded]() {
+            weatherSucceeded = UpdateWeatherWebContent();
+        });
+    }
+
+    GetUrlWebContentsConcurrently(requests);
 
     // Kept for compatibility with old settings:
-    if (g_settings.webContentsUrl && g_settings.webContentsBlockStart &&
-        g_settings.webContentsStart && g_settings.webContentsEnd) {
-        lastUrl = g_settings.webContentsUrl;
-        urlContent =
-            GetUrlContent(g_settings.webContentsUrl, /*failIfNot200=*/false);
-
-        std::wstring extracted;
-        if (urlContent) {
-            extracted = ExtractWebContent(
-                *urlContent, g_settings.webContentsBlockStart,
-                g_settings.webContentsStart, g_settings.webContentsEnd);
+    if (legacyWebContentUsed) {
+        const auto& request = requests[legacyWebContentIndex.first];
+        if (request.contents) {
+            const std::wstring& extracted =
+                (*request.contents)[legacyWebContentIndex.second];
 
             std::lock_guard<std::mutex> guard(g_webContentMutex);
 
@@ -987,31 +1702,27 @@ void UpdateWebContent() {
     }
 
     for (size_t i = 0; i < g_settings.webContentsItems.size(); i++) {
-        WCHAR patternSubstring[32];
-        swprintf_s(patternSubstring, L"%%web%i%%", i + 1);
-
-        WCHAR patternSubstringFull[32];
-        swprintf_s(patternSubstringFull, L"%%web%i_full%%", i + 1);
-
-        if (!IsStrInDateTimePatternSettings(patternSubstring) &&
-            !IsStrInDateTimePatternSettings(patternSubstringFull)) {
+        if (!IsWebContentItemUsed(i)) {
             continue;
         }
 
         const auto& item = g_settings.webContentsItems[i];
 
-        if (item.url.get() != lastUrl) {
-            lastUrl = item.url;
-            urlContent = GetUrlContent(item.url, /*failIfNot200=*/false);
-        }
-
-        if (!urlContent) {
+        const auto& request = requests[itemIndices[i].first];
+        if (!request.contents) {
             failed++;
             continue;
         }
 
-        std::wstring extracted = ExtractWebContent(*urlContent, item.blockStart,
-                                                   item.start, item.end);
+        if (request.notModified) {
+            std::lock_guard<std::mutex> guard(g_webContentMutex);
+            if (g_webContentStrings[i]) {
+                // Unchanged since the last update, nothing to extract.
+                continue;
+            }
+        }
+
+        std::wstring extracted = (*request.contents)[itemIndices[i].second];
 
         try {
             switch (item.contentMode) {
@@ -1071,9 +1782,11 @@ void UpdateWebContent() {
         g_webContentStringsFull[i] = std::move(extracted);
     }
 
-    if (IsStrInDateTimePatternSettings(L"%weather%") &&
-        !UpdateWeatherWebContent()) {
-        failed++;
+    if (weatherThread.joinable()) {
+        weatherThread.join();
+        if (!weatherSucceeded) {
+            failed++;
+        }
     }
 
     if (failed == 0) {
@@ -1152,6 +1865,9 @@ void WebContentUpdateThreadUninit() {
     g_webContentStrings.clear();
     g_webContentStringsFull.clear();
     g_webContentWeather.reset();
+
+    std::lock_guard<std::mutex> cacheGuard(g_urlContentCacheMutex);
+    g_urlContentCache.clear();
 }
 
 std::optional<DYNAMIC_TIME_ZONE_INFORMATION> GetTimeZoneInformation(
@@ -1174,6 +1890,70 @@ std::optional<DYNAMIC_TIME_ZONE_INFORMATION> GetTimeZoneInformation(
     return std::nullopt;
 }
 
+ULONGLONG SystemTimeToTicks(const SYSTEMTIME* time) {
+    FILETIME fileTime;
+    SystemTimeToFileTime(time, &fileTime);
+    return ULARGE_INTEGER{
+        .LowPart = fileTime.dwLowDateTime,
+        .HighPart = fileTime.dwHighDateTime,
+    }
+        .QuadPart;
+}
+
+void TicksToSystemTime(ULONGLONG ticks, SYSTEMTIME* time) {
+    ULARGE_INTEGER ticksInt{.QuadPart = ticks};
+    FILETIME fileTime{
+        .dwLowDateTime = ticksInt.LowPart,
+        .dwHighDateTime = ticksInt.HighPart,
+    };
+    FileTimeToSystemTime(&fileTime, time);
+}
+
+// The formatted time in the configured time zone, shared by the time, date and
+// weekday of that zone.
+const SYSTEMTIME* GetFormatTimeForTimeZone(size_t index) {
+    auto& timeZoneTime = g_timeZoneTime[index];
+    if (timeZoneTime.formatIndex == g_formatIndex) {
+        return timeZoneTime.valid ? &timeZoneTime.time : nullptr;
+    }
+
+    timeZoneTime.formatIndex = g_formatIndex;
+    timeZoneTime.valid = false;
+
+    const auto& timeZoneInformation = g_timeZoneInformation[index];
+    if (!timeZoneInformation || !pSystemTimeToTzSpecificLocalTimeEx) {
+        return nullptr;
+    }
+
+    SYSTEMTIME systemTime;
+    if (!TzSpecificLocalTimeToSystemTime(nullptr, &g_formatTime,
+                                         &systemTime)) {
+        return nullptr;
+    }
+
+    constexpr ULONGLONG kQuarterHour = 10000000ULL * 60 * 15;
+    ULONGLONG systemTicks = SystemTimeToTicks(&systemTime);
+
+    // Also recompute if the clock was set back.
+    if (systemTicks >= timeZoneTime.offsetValidUntil ||
+        systemTicks + kQuarterHour < timeZoneTime.offsetValidUntil) {
+        SYSTEMTIME timeTz;
+        if (!pSystemTimeToTzSpecificLocalTimeEx(&*timeZoneInformation,
+                                                &systemTime, &timeTz)) {
+            return nullptr;
+        }
+
+        timeZoneTime.offset =
+            (LONGLONG)(SystemTimeToTicks(&timeTz) - systemTicks);
+        timeZoneTime.offsetValidUntil =
+            (systemTicks / kQuarterHour + 1) * kQuarterHour;
+    }
+
+    TicksToSystemTime(systemTicks + timeZoneTime.offset, &timeZoneTime.time);
+    timeZoneTime.valid = true;
+    return &timeZoneTime.time;
+}
+
 DWORD GetStartDayOfWeek(const SYSTEMTIME* time) {
     // https://stackoverflow.com/a/39344961
     DWORD startDayOfWeek;
@@ -1441,18 +2221,7 @@ PCWSTR GetTimeFormattedTz(size_t index) {
     auto& timeFormattedTz = g_timeFormattedTz[index];
 
     if (timeFormattedTz.formatIndex != g_formatIndex) {
-        const auto& timeZoneInformation = g_timeZoneInformation[index];
-        if (timeZoneInformation && pSystemTimeToTzSpecificLocalTimeEx) {
-            SYSTEMTIME systemTime;
-            TzSpecificLocalTimeToSystemTime(nullptr, &g_formatTime,
-                                            &systemTime);
-
-            SYSTEMTIME timeTz;
-            pSystemTimeToTzSpecificLocalTimeEx(&*timeZoneInformation,
-                                               &systemTime, &timeTz);
-
-            const SYSTEMTIME* time = &timeTz;
-
+        if (const SYSTEMTIME* time = GetFormatTimeForTimeZone(index)) {
             auto timeFormatParts =
                 SplitTimeFormatString(g_settings.timeFormat.get());
 
@@ -1472,7 +2241,7 @@ PCWSTR GetTimeFormattedTz(size_t index) {
 }
 
 PCWSTR GetDateFormattedWithExtra(std::vector<std::wstring>** extra) {
-    if (g_dateFormatted.formatIndex != g_formatIndex) {
+    if (g_dateFormatted.formatIndex != g_formatDateIndex) {
         const SYSTEMTIME* time = &g_formatTime;
 
         auto dateFormatParts =
@@ -1494,7 +2263,7 @@ PCWSTR GetDateFormattedWithExtra(std::vector<std::wstring>** extra) {
             g_dateFormattedExtra[i - 1] = formatted;
         }
 
-        g_dateFormatted.formatIndex = g_formatIndex;
+        g_dateFormatted.formatIndex = g_formatDateIndex;
     }
 
     if (extra) {
@@ -1522,18 +2291,7 @@ PCWSTR GetDateFormattedTz(size_t index) {
     auto& dateFormattedTz = g_dateFormattedTz[index];
 
     if (dateFormattedTz.formatIndex != g_formatIndex) {
-        const auto& timeZoneInformation = g_timeZoneInformation[index];
-        if (timeZoneInformation && pSystemTimeToTzSpecificLocalTimeEx) {
-            SYSTEMTIME systemTime;
-            TzSpecificLocalTimeToSystemTime(nullptr, &g_formatTime,
-                                            &systemTime);
-
-            SYSTEMTIME timeTz;
-            pSystemTimeToTzSpecificLocalTimeEx(&*timeZoneInformation,
-                                               &systemTime, &timeTz);
-
-            const SYSTEMTIME* time = &timeTz;
-
+        if (const SYSTEMTIME* time = GetFormatTimeForTimeZone(index)) {
             auto dateFormatParts =
                 SplitTimeFormatString(g_settings.dateFormat.get());
 
@@ -1571,13 +2329,13 @@ void FormatWeekday(const SYSTEMTIME* time, PWSTR buffer, size_t bufferSize) {
 }
 
 PCWSTR GetWeekdayFormatted() {
-    if (g_weekdayFormatted.formatIndex != g_formatIndex) {
+    if (g_weekdayFormatted.formatIndex != g_formatDateIndex) {
         const SYSTEMTIME* time = &g_formatTime;
 
         FormatWeekday(time, g_weekdayFormatted.buffer,
                       ARRAYSIZE(g_weekdayFormatted.buffer));
 
-        g_weekdayFormatted.formatIndex = g_formatIndex;
+        g_weekdayFormatted.formatIndex = g_formatDateIndex;
     }
 
     return g_weekdayFormatted.buffer;
@@ -1591,18 +2349,7 @@ PCWSTR GetWeekdayFormattedTz(size_t index) {
     auto& weekdayFormattedTz = g_weekdayFormattedTz[index];
 
     if (weekdayFormattedTz.formatIndex != g_formatIndex) {
-        const auto& timeZoneInformation = g_timeZoneInformation[index];
-        if (timeZoneInformation && pSystemTimeToTzSpecificLocalTimeEx) {
-            SYSTEMTIME systemTime;
-            TzSpecificLocalTimeToSystemTime(nullptr, &g_formatTime,
-                                            &systemTime);
-
-            SYSTEMTIME timeTz;
-            pSystemTimeToTzSpecificLocalTimeEx(&*timeZoneInformation,
-                                               &systemTime, &timeTz);
-
-            const SYSTEMTIME* time = &timeTz;
-
+        if (const SYSTEMTIME* time = GetFormatTimeForTimeZone(index)) {
             auto weekdayFormatParts =
                 SplitTimeFormatString(g_settings.weekdayFormat.get());
 
@@ -1619,7 +2366,7 @@ PCWSTR GetWeekdayFormattedTz(size_t index) {
 }
 
 PCWSTR GetWeekdayNumFormatted() {
-    if (g_weekdayNumFormatted.formatIndex != g_formatIndex) {
+    if (g_weekdayNumFormatted.formatIndex != g_formatDateIndex) {
         const SYSTEMTIME* time = &g_formatTime;
 
         DWORD startDayOfWeek = GetStartDayOfWeek(time);
@@ -1627,14 +2374,14 @@ PCWSTR GetWeekdayNumFormatted() {
         swprintf_s(g_weekdayNumFormatted.buffer, L"%d",
                    1 + (7 + time->wDayOfWeek - startDayOfWeek) % 7);
 
-        g_weekdayNumFormatted.formatIndex = g_formatIndex;
+        g_weekdayNumFormatted.formatIndex = g_formatDateIndex;
     }
 
     return g_weekdayNumFormatted.buffer;
 }
 
 PCWSTR GetWeeknumFormatted() {
-    if (g_weeknumFormatted.formatIndex != g_formatIndex) {
+    if (g_weeknumFormatted.formatIndex != g_formatDateIndex) {
         const SYSTEMTIME* time = &g_formatTime;
 
         DWORD startDayOfWeek = GetStartDayOfWeek(time);
@@ -1642,33 +2389,33 @@ PCWSTR GetWeeknumFormatted() {
         swprintf_s(g_weeknumFormatted.buffer, L"%d",
                    CalculateWeeknum(time, startDayOfWeek));
 
-        g_weeknumFormatted.formatIndex = g_formatIndex;
+        g_weeknumFormatted.formatIndex = g_formatDateIndex;
     }
 
     return g_weeknumFormatted.buffer;
 }
 
 PCWSTR GetWeeknumIsoFormatted() {
-    if (g_weeknumIsoFormatted.formatIndex != g_formatIndex) {
+    if (g_weeknumIsoFormatted.formatIndex != g_formatDateIndex) {
         const SYSTEMTIME* time = &g_formatTime;
 
         swprintf_s(g_weeknumIsoFormatted.buffer, L"%d",
                    CalculateWeeknumIso(time));
 
-        g_weeknumIsoFormatted.formatIndex = g_formatIndex;
+        g_weeknumIsoFormatted.formatIndex = g_formatDateIndex;
     }
 
     return g_weeknumIsoFormatted.buffer;
 }
 
 PCWSTR GetDayOfYearFormatted() {
-    if (g_dayOfYearFormatted.formatIndex != g_formatIndex) {
+    if (g_dayOfYearFormatted.formatIndex != g_formatDateIndex) {
         const SYSTEMTIME* time = &g_formatTime;
 
         swprintf_s(g_dayOfYearFormatted.buffer, L"%d",
                    CalculateDayOfYearNumber(time));
 
-        g_dayOfYearFormatted.formatIndex = g_formatIndex;
+        g_dayOfYearFormatted.formatIndex = g_formatDateIndex;
     }
 
     return g_dayOfYearFormatted.buffer;
@@ -1862,67 +2609,130 @@ class QueryDataCollectionSession {
     MetricData metrics_[static_cast<int>(MetricType::kCount)];
 };
 
-std::optional<QueryDataCollectionSession> g_dataCollectionSession;
-DWORD g_dataCollectionLastFormatIndex;
+// Published by the sampler thread, read by the UI threads without locking.
+struct DataCollectionSnapshot {
+    // Incremented after each sample, zero if no sample is available yet.
+    std::atomic<DWORD> sampleIndex;
+    std::atomic<double> values[static_cast<int>(MetricType::kCount)];
+    std::atomic<DWORD> memoryLoad;
+};
 
-void DataCollectionSessionInit() {
-    bool metrics[static_cast<int>(MetricType::kCount)]{};
-    metrics[static_cast<int>(MetricType::kUploadSpeed)] =
-        IsStrInDateTimePatternSettings(L"%upload_speed%");
-    metrics[static_cast<int>(MetricType::kDownloadSpeed)] =
-        IsStrInDateTimePatternSettings(L"%download_speed%");
-    metrics[static_cast<int>(MetricType::kCpu)] =
-        IsStrInDateTimePatternSettings(L"%cpu%");
+DataCollectionSnapshot g_dataCollectionSnapshot;
+std::atomic<bool> g_dataCollectionEnabled;
+bool g_dataCollectionMetrics[static_cast<int>(MetricType::kCount)];
+bool g_dataCollectionRam;
+HANDLE g_dataCollectionThread;
+HANDLE g_dataCollectionStopEvent;
+
+void DataCollectionPublishSample(QueryDataCollectionSession* session) {
+    if (session && session->SampleData()) {
+        for (size_t i = 0; i < ARRAYSIZE(g_dataCollectionMetrics); i++) {
+            if (g_dataCollectionMetrics[i]) {
+                g_dataCollectionSnapshot.values[i].store(
+                    session->QueryData(static_cast<MetricType>(i)),
+                    std::memory_order_relaxed);
+            }
+        }
+    }
 
-    if (!std::any_of(std::begin(metrics), std::end(metrics),
-                     [](bool x) { return x; })) {
-        return;
+    if (g_dataCollectionRam) {
+        MEMORYSTATUSEX status{
+            .dwLength = sizeof(status),
+        };
+        if (GlobalMemoryStatusEx(&status)) {
+            g_dataCollectionSnapshot.memoryLoad.store(
+                status.dwMemoryLoad, std::memory_order_relaxed);
+        }
     }
 
-    try {
-        g_dataCollectionSession.emplace();
-    } catch (...) {
-        HRESULT hr = winrt::to_hresult();
-        Wh_Log(L"Error %08X", hr);
-        return;
+    g_dataCollectionSnapshot.sampleIndex.fetch_add(1,
+                                                   std::memory_order_release);
+}
+
+DWORD WINAPI DataCollectionThread(LPVOID lpThreadParameter) {
+    std::optional<QueryDataCollectionSession> session;
+
+    if (g_dataCollectionEnabled) {
+        try {
+            session.emplace();
+        } catch (...) {
+            HRESULT hr = winrt::to_hresult();
+            Wh_Log(L"Error %08X", hr);
+        }
     }
 
-    for (size_t i = 0; i < ARRAYSIZE(metrics); i++) {
-        MetricType metric = static_cast<MetricType>(i);
-        g_dataCollectionSession->AddMetric(metric);
+    if (session) {
+        for (size_t i = 0; i < ARRAYSIZE(g_dataCollectionMetrics); i++) {
+            if (g_dataCollectionMetrics[i]) {
+                session->AddMetric(static_cast<MetricType>(i));
+            }
+        }
+
+        // Rate counters require two samples, the first one is only used as a
+        // baseline.
+        session->SampleData();
     }
 
-    g_dataCollectionSession->SampleData();
-}
+    DWORD intervalMs =
+        std::max(g_settings.dataCollection.updateInterval, 1) * 1000;
 
-void DataCollectionSessionUninit() {
-    g_dataCollectionSession.reset();
-    g_dataCollectionLastFormatIndex = 0;
-}
+    // Publish the first values quickly, then keep a fixed cadence.
+    DWORD waitMs = std::min(intervalMs, 1000UL);
 
-DWORD GetDataCollectionFormatIndex() {
-    FILETIME formatTimeFt{};
-    SystemTimeToFileTime(&g_formatTime, &formatTimeFt);
-    ULARGE_INTEGER formatTimeInt{
-        .LowPart = formatTimeFt.dwLowDateTime,
-        .HighPart = formatTimeFt.dwHighDateTime,
-    };
+    while (WaitForSingleObject(g_dataCollectionStopEvent, waitMs) ==
+           WAIT_TIMEOUT) {
+        DataCollectionPublishSample(session ? &*session : nullptr);
+        waitMs = intervalMs;
+    }
 
-    constexpr ULONGLONG kSecondIn100Ns = 10000000ULL;
-    ULONGLONG interval =
-        kSecondIn100Ns * std::max(g_settings.dataCollection.updateInterval, 1);
-    return static_cast<DWORD>(formatTimeInt.QuadPart / interval);
+    return 0;
 }
 
-void DataCollectionSampleIfNeeded() {
-    DWORD dataCollectionFormatIndex = GetDataCollectionFormatIndex();
-    if (g_dataCollectionLastFormatIndex != dataCollectionFormatIndex) {
-        if (g_dataCollectionSession) {
-            g_dataCollectionSession->SampleData();
-        }
+void DataCollectionSessionInit() {
+    g_dataCollectionMetrics[static_cast<int>(MetricType::kUploadSpeed)] =
+        IsStrInDateTimePatternSettings(L"%upload_speed%");
+    g_dataCollectionMetrics[static_cast<int>(MetricType::kDownloadSpeed)] =
+        IsStrInDateTimePatternSettings(L"%download_speed%");
+    g_dataCollectionMetrics[static_cast<int>(MetricType::kCpu)] =
+        IsStrInDateTimePatternSettings(L"%cpu%");
+    g_dataCollectionRam = IsStrInDateTimePatternSettings(L"%ram%");
 
-        g_dataCollectionLastFormatIndex = dataCollectionFormatIndex;
+    g_dataCollectionEnabled =
+        std::any_of(std::begin(g_dataCollectionMetrics),
+                    std::end(g_dataCollectionMetrics), [](bool x) { return x; });
+
+    if (!g_dataCollectionEnabled && !g_dataCollectionRam) {
+        return;
     }
+
+    g_dataCollectionStopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    g_dataCollectionThread =
+        CreateThread(nullptr, 0, DataCollectionThread, nullptr, 0, nullptr);
+    if (!g_dataCollectionThread) {
+        Wh_Log(L"CreateThread failed");
+        CloseHandle(g_dataCollectionStopEvent);
+        g_dataCollectionStopEvent = nullptr;
+        g_dataCollectionEnabled = false;
+    }
+}
+
+void DataCollectionSessionUninit() {
+    if (g_dataCollectionThread) {
+        SetEvent(g_dataCollectionStopEvent);
+        WaitForSingleObject(g_dataCollectionThread, INFINITE);
+        CloseHandle(g_dataCollectionThread);
+        g_dataCollectionThread = nullptr;
+        CloseHandle(g_dataCollectionStopEvent);
+        g_dataCollectionStopEvent = nullptr;
+    }
+
+    g_dataCollectionEnabled = false;
+    g_dataCollectionSnapshot.sampleIndex = 0;
+
+    g_uploadSpeedFormatted.formatIndex = 0;
+    g_downloadSpeedFormatted.formatIndex = 0;
+    g_cpuFormatted.formatIndex = 0;
+    g_ramFormatted.formatIndex = 0;
 }
 
 std::wstring FormatLocaleNum(double val, unsigned int digitsAfterDecimal) {
@@ -2078,26 +2888,29 @@ void FormatPercentValue(int val, PWSTR buffer, size_t bufferSize) {
 template <size_t N>
 PCWSTR GetMetricFormatted(FormattedString<N>& formattedString,
                           MetricType metricType) {
-    DataCollectionSampleIfNeeded();
-
-    DWORD dataCollectionFormatIndex = GetDataCollectionFormatIndex();
-    if (formattedString.formatIndex != dataCollectionFormatIndex) {
-        if (g_dataCollectionSession) {
-            double val = g_dataCollectionSession->QueryData(metricType);
-            if (metricType == MetricType::kUploadSpeed ||
-                metricType == MetricType::kDownloadSpeed) {
-                FormatTransferSpeed(val, formattedString.buffer,
-                                    ARRAYSIZE(formattedString.buffer));
-            } else {
-                FormatPercentValue(static_cast<int>(val),
-                                   formattedString.buffer,
-                                   ARRAYSIZE(formattedString.buffer));
-            }
+    DWORD sampleIndex =
+        g_dataCollectionSnapshot.sampleIndex.load(std::memory_order_acquire);
+    if (sampleIndex == 0 ||
+        !g_dataCollectionMetrics[static_cast<int>(metricType)]) {
+        wcscpy_s(formattedString.buffer, L"-");
+        formattedString.formatIndex = 0;
+        return formattedString.buffer;
+    }
+
+    if (formattedString.formatIndex != sampleIndex) {
+        double val =
+            g_dataCollectionSnapshot.values[static_cast<int>(metricType)].load(
+                std::memory_order_relaxed);
+        if (metricType == MetricType::kUploadSpeed ||
+            metricType == MetricType::kDownloadSpeed) {
+            FormatTransferSpeed(val, formattedString.buffer,
+                                ARRAYSIZE(formattedString.buffer));
         } else {
-            wcscpy_s(formattedString.buffer, L"-");
+            FormatPercentValue(static_cast<int>(val), formattedString.buffer,
+                               ARRAYSIZE(formattedString.buffer));
         }
 
-        formattedString.formatIndex = dataCollectionFormatIndex;
+        formattedString.formatIndex = sampleIndex;
     }
 
     return formattedString.buffer;
@@ -2117,19 +2930,21 @@ PCWSTR GetCpuFormatted() {
 }
 
 PCWSTR GetRamFormatted() {
-    DWORD dataCollectionFormatIndex = GetDataCollectionFormatIndex();
-    if (g_ramFormatted.formatIndex != dataCollectionFormatIndex) {
-        MEMORYSTATUSEX status{
-            .dwLength = sizeof(status),
-        };
-        if (GlobalMemoryStatusEx(&status)) {
-            FormatPercentValue(status.dwMemoryLoad, g_ramFormatted.buffer,
-                               ARRAYSIZE(g_ramFormatted.buffer));
-        } else {
-            wcscpy_s(g_ramFormatted.buffer, L"-");
-        }
+    DWORD sampleIndex =
+        g_dataCollectionSnapshot.sampleIndex.load(std::memory_order_acquire);
+    if (sampleIndex == 0 || !g_dataCollectionRam) {
+        wcscpy_s(g_ramFormatted.buffer, L"-");
+        g_ramFormatted.formatIndex = 0;
+        return g_ramFormatted.buffer;
+    }
+
+    if (g_ramFormatted.formatIndex != sampleIndex) {
+        FormatPercentValue(g_dataCollectionSnapshot.memoryLoad.load(
+                               std::memory_order_relaxed),
+                           g_ramFormatted.buffer,
+                           ARRAYSIZE(g_ramFormatted.buffer));
 
-        g_ramFormatted.formatIndex = dataCollectionFormatIndex;
+        g_ramFormatted.formatIndex = sampleIndex;
     }
 
     return g_ramFormatted.buffer;
@@ -2160,9 +2975,12 @@ int ResolveFormatTokenWithDigit(std::wstring_view format,
     return digitChar - L'0';
 }
 
-size_t ResolveFormatToken(
-    std::wstring_view format,
-    std::function<void(PCWSTR resolvedStr)> resolvedCallback) {
+using FormatTokenCallback = std::function<void(PCWSTR resolvedStr)>;
+using FormatTokenResolver =
+    std::function<void(const FormatTokenCallback& resolvedCallback)>;
+
+size_t ParseFormatToken(std::wstring_view format,
+                        FormatTokenResolver* resolver) {
     using FormattedStringValueGetter = PCWSTR (*)();
 
     struct {
@@ -2186,7 +3004,10 @@ size_t ResolveFormatToken(
 
     for (const auto& formatToken : formatTokens) {
         if (format.starts_with(formatToken.token)) {
-            resolvedCallback(formatToken.valueGetter());
+            *resolver = [valueGetter = formatToken.valueGetter](
+                            const FormatTokenCallback& resolvedCallback) {
+                resolvedCallback(valueGetter());
+            };
             return formatToken.token.size();
         }
     }
@@ -2209,24 +3030,32 @@ size_t ResolveFormatToken(
             continue;
         }
 
-        PCWSTR value = formatTzToken.valueGetter(digit - 1);
-        if (!value) {
-            value = L"-";
-        }
+        *resolver = [valueGetter = formatTzToken.valueGetter, index = digit - 1](
+                        const FormatTokenCallback& resolvedCallback) {
+            PCWSTR value = valueGetter(index);
+            if (!value) {
+                value = L"-";
+            }
 
-        resolvedCallback(value);
+            resolvedCallback(value);
+        };
         return formatTzToken.prefix.size() + 2;
     }
 
     if (auto token = L"%web%"sv; format.starts_with(token)) {
-        std::lock_guard<std::mutex> guard(g_webContentMutex);
-        resolvedCallback(*g_webContent ? g_webContent : L"Loading...");
+        *resolver = [](const FormatTokenCallback& resolvedCallback) {
+            std::lock_guard<std::mutex> guard(g_webContentMutex);
+            resolvedCallback(*g_webContent ? g_webContent : L"Loading...");
+        };
         return token.size();
     }
 
     if (auto token = L"%web_full%"sv; format.starts_with(token)) {
-        std::lock_guard<std::mutex> guard(g_webContentMutex);
-        resolvedCallback(*g_webContentFull ? g_webContentFull : L"Loading...");
+        *resolver = [](const FormatTokenCallback& resolvedCallback) {
+            std::lock_guard<std::mutex> guard(g_webContentMutex);
+            resolvedCallback(*g_webContentFull ? g_webContentFull
+                                               : L"Loading...");
+        };
         return token.size();
     }
 
@@ -2247,99 +3076,149 @@ size_t ResolveFormatToken(
             continue;
         }
 
-        const auto& valueVector = *formatExtraToken.valueVectorGetter();
+        *resolver = [valueVectorGetter = formatExtraToken.valueVectorGetter,
+                     digit](const FormatTokenCallback& resolvedCallback) {
+            const auto& valueVector = *valueVectorGetter();
 
-        PCWSTR value;
-        if (digit < 2 || static_cast<size_t>(digit - 2) >= valueVector.size()) {
-            value = L"-";
-        } else {
-            value = valueVector[digit - 2].c_str();
-        }
+            PCWSTR value;
+            if (digit < 2 ||
+                static_cast<size_t>(digit - 2) >= valueVector.size()) {
+                value = L"-";
+            } else {
+                value = valueVector[digit - 2].c_str();
+            }
 
-        resolvedCallback(value);
+            resolvedCallback(value);
+        };
         return formatExtraToken.prefix.size() + 2;
     }
 
     if (int digit = ResolveFormatTokenWithDigit(format, L"%web"sv, L"%"sv)) {
-        size_t index = digit - 1;
-
-        std::lock_guard<std::mutex> guard(g_webContentMutex);
+        *resolver = [index = static_cast<size_t>(digit - 1)](
+                        const FormatTokenCallback& resolvedCallback) {
+            std::lock_guard<std::mutex> guard(g_webContentMutex);
 
-        PCWSTR value;
-        if (index >= g_webContentStrings.size()) {
-            value = L"-";
-        } else if (!g_webContentStrings[index]) {
-            value = L"Loading...";
-        } else {
-            value = g_webContentStrings[index]->c_str();
-        }
+            PCWSTR value;
+            if (index >= g_webContentStrings.size()) {
+                value = L"-";
+            } else if (!g_webContentStrings[index]) {
+                value = L"Loading...";
+            } else {
+                value = g_webContentStrings[index]->c_str();
+            }
 
-        resolvedCallback(value);
+            resolvedCallback(value);
+        };
         return "%web1%"sv.size();
     }
 
     if (int digit =
             ResolveFormatTokenWithDigit(format, L"%web"sv, L"_full%"sv)) {
-        size_t index = digit - 1;
-
-        std::lock_guard<std::mutex> guard(g_webContentMutex);
+        *resolver = [index = static_cast<size_t>(digit - 1)](
+                        const FormatTokenCallback& resolvedCallback) {
+            std::lock_guard<std::mutex> guard(g_webContentMutex);
 
-        PCWSTR value;
-        if (index >= g_webContentStringsFull.size()) {
-            value = L"-";
-        } else if (!g_webContentStringsFull[index]) {
-            value = L"Loading...";
-        } else {
-            value = g_webContentStringsFull[index]->c_str();
-        }
+            PCWSTR value;
+            if (index >= g_webContentStringsFull.size()) {
+                value = L"-";
+            } else if (!g_webContentStringsFull[index]) {
+                value = L"Loading...";
+            } else {
+                value = g_webContentStringsFull[index]->c_str();
+            }
 
-        resolvedCallback(value);
+            resolvedCallback(value);
+        };
         return "%web1_full%"sv.size();
     }
 
     if (auto token = L"%weather%"sv; format.starts_with(token)) {
-        std::lock_guard<std::mutex> guard(g_webContentMutex);
-        resolvedCallback(g_webContentWeather ? g_webContentWeather->c_str()
-                                             : L"Loading...");
+        *resolver = [](const FormatTokenCallback& resolvedCallback) {
+            std::lock_guard<std::mutex> guard(g_webContentMutex);
+            resolvedCallback(g_webContentWeather ? g_webContentWeather->c_str()
+                                                 : L"Loading...");
+        };
         return token.size();
     }
 
     return 0;
 }
 
-int FormatLine(PWSTR buffer, size_t bufferSize, std::wstring_view format) {
-    if (bufferSize == 0) {
-        return 0;
-    }
+// A format line split into literal text and token resolvers. Lines are
+// compiled once when settings are loaded, so that refreshing the clock doesn't
+// need to scan the format strings for tokens.
+struct FormatLineSegment {
+    std::wstring literal;
+    FormatTokenResolver resolver;
+};
 
-    std::wstring_view formatSuffix = format;
+using FormatLineProgram = std::vector<FormatLineSegment>;
 
-    PWSTR bufferStart = buffer;
-    PWSTR bufferEnd = bufferStart + bufferSize;
-    while (!formatSuffix.empty() && bufferEnd - buffer > 1) {
+FormatLineProgram g_topLineProgram;
+FormatLineProgram g_bottomLineProgram;
+FormatLineProgram g_middleLineProgram;
+FormatLineProgram g_tooltipLineProgram;
+
+FormatLineProgram CompileFormatLine(std::wstring_view format) {
+    FormatLineProgram program;
+    std::wstring literal;
+
+    std::wstring_view formatSuffix = format;
+    while (!formatSuffix.empty()) {
         if (formatSuffix[0] == L'%') {
-            bool truncated = false;
-            size_t formatTokenLen = ResolveFormatToken(
-                formatSuffix,
-                [&buffer, bufferEnd, &truncated](PCWSTR resolvedStr) {
-                    buffer += StringCopyTruncated(buffer, bufferEnd - buffer,
-                                                  resolvedStr, &truncated);
-                });
+            FormatTokenResolver resolver;
+            size_t formatTokenLen = ParseFormatToken(formatSuffix, &resolver);
             if (formatTokenLen > 0) {
-                if (truncated) {
-                    break;
+                if (!literal.empty()) {
+                    program.push_back({std::move(literal), nullptr});
+                    literal.clear();
                 }
 
+                program.push_back({std::wstring(), std::move(resolver)});
                 formatSuffix = formatSuffix.substr(formatTokenLen);
                 continue;
             }
         }
 
-        *buffer++ = formatSuffix[0];
+        literal += formatSuffix[0];
         formatSuffix = formatSuffix.substr(1);
     }
 
-    if (!formatSuffix.empty() && bufferSize >= 4) {
+    if (!literal.empty()) {
+        program.push_back({std::move(literal), nullptr});
+    }
+
+    return program;
+}
+
+int FormatLine(PWSTR buffer,
+               size_t bufferSize,
+               const FormatLineProgram& program) {
+    if (bufferSize == 0) {
+        return 0;
+    }
+
+    PWSTR bufferStart = buffer;
+    PWSTR bufferEnd = bufferStart + bufferSize;
+    bool truncated = false;
+    for (const auto& segment : program) {
+        if (segment.resolver) {
+            segment.resolver(
+                [&buffer, bufferEnd, &truncated](PCWSTR resolvedStr) {
+                    buffer += StringCopyTruncated(buffer, bufferEnd - buffer,
+                                                  resolvedStr, &truncated);
+                });
+        } else {
+            buffer += StringCopyTruncated(buffer, bufferEnd - buffer,
+                                          segment.literal.c_str(), &truncated);
+        }
+
+        if (truncated) {
+            break;
+        }
+    }
+
+    if (truncated && bufferSize >= 4) {
         buffer[-1] = L'.';
         buffer[-2] = L'.';
         buffer[-3] = L'.';
@@ -2413,7 +3292,7 @@ void ClockSystemTrayIconDataModel_RefreshIcon_Hook_Impl(
     ClockSystemTrayIconDataModel_RefreshIcon_t original) {
     g_refreshIconThreadId = GetCurrentThreadId();
     g_refreshIconNeedToAdjustTimer = g_settings.showSeconds ||
-                                     g_dataCollectionSession ||
+                                     g_dataCollectionEnabled ||
                                      !g_webContentLoaded;
 
     original(pThis, param1);
@@ -2443,7 +3322,7 @@ void UpdateToolTipString(LPVOID tooltipPtrPtr) {
 
     WCHAR extraLine[256];
     size_t extraLength = FormatLine(extraLine, ARRAYSIZE(extraLine),
-                                    g_settings.tooltipLine.get());
+                                    g_tooltipLineProgram);
     if (extraLength == 0) {
         return;
     }
@@ -2861,11 +3740,35 @@ void WINAPI DateTimeIconContent_OnApplyTemplate_Hook(LPVOID pThis) {
     }
 }
 
+bool IsDateTimeIconContentStyleCurrent(
+    const winrt::Windows::Foundation::IInspectable& obj) {
+    DWORD clockElementStyleIndex = g_clockElementStyleIndex;
+
+    for (const auto& data : g_clockElementStyleData) {
+        if (data.styleIndex != clockElementStyleIndex) {
+            continue;
+        }
+
+        auto element = data.dateTimeIconContentElement.get();
+        if (element && element == obj) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 HRESULT WINAPI BadgeIconContent_get_ViewModel_Hook(LPVOID pThis, LPVOID pArgs) {
     // Wh_Log(L">");
 
     HRESULT ret = BadgeIconContent_get_ViewModel_Original(pThis, pArgs);
 
+    // Called on every clock refresh. Without custom styles there's nothing to
+    // apply or reset, so skip querying the element altogether.
+    if (!g_clockElementStyleEnabled && g_clockElementStyleData.empty()) {
+        return ret;
+    }
+
     try {
         winrt::Windows::Foundation::IInspectable obj = nullptr;
         winrt::check_hresult(
@@ -2874,6 +3777,12 @@ HRESULT WINAPI BadgeIconContent_get_ViewModel_Hook(LPVOID pThis, LPVOID pArgs) {
                     winrt::guid_of<winrt::Windows::Foundation::IInspectable>(),
                     winrt::put_abi(obj)));
 
+        // Styles are only applied when they change, avoid the class name
+        // lookup for elements which are already up to date.
+        if (IsDateTimeIconContentStyleCurrent(obj)) {
+            return ret;
+        }
+
         if (winrt::get_class_name(obj) == L"SystemTray.DateTimeIconContent") {
             auto dateTimeIconContentElement = obj.as<FrameworkElement>();
             if (dateTimeIconContentElement.IsLoaded()) {
@@ -3014,7 +3923,7 @@ int WINAPI GetTimeFormatEx_Hook_Win11(LPCWSTR lpLocaleName,
                 return FORMATTED_BUFFER_SIZE;
             }
 
-            return FormatLine(lpTimeStr, cchTime, g_settings.topLine.get()) + 1;
+            return FormatLine(lpTimeStr, cchTime, g_topLineProgram) + 1;
         }
     }
 
@@ -3073,8 +3982,7 @@ int WINAPI GetDateFormatEx_Hook_Win11(LPCWSTR lpLocaleName,
         if (!(dwFlags & DATE_LONGDATE)) {
             if (!cchDate || g_winVersion >= WinVersion::Win11_22H2) {
                 // First call, save date for formatting.
-                g_formatTime = *lpDate;
-                g_formatIndex++;
+                SetFormatTime(lpDate);
             }
 
             if (wcscmp(g_settings.bottomLine, L"-") != 0) {
@@ -3083,9 +3991,7 @@ int WINAPI GetDateFormatEx_Hook_Win11(LPCWSTR lpLocaleName,
                     return FORMATTED_BUFFER_SIZE;
                 }
 
-                return FormatLine(lpDateStr, cchDate,
-                                  g_settings.bottomLine.get()) +
-                       1;
+                return FormatLine(lpDateStr, cchDate, g_bottomLineProgram) + 1;
             }
         }
     }
@@ -3189,7 +4095,7 @@ HRESULT WINAPI ClockButton_v_GetTooltipText_Hook(LPVOID pThis,
         size_t size = g_getTooltipTextBufferSize + stringLen;
         if (size > 4) {
             wcscpy(p, L"\r\n\r\n");
-            FormatLine(p + 4, size - 4, g_settings.tooltipLine.get());
+            FormatLine(p + 4, size - 4, g_tooltipLineProgram);
         }
     }
 
@@ -3213,7 +4119,7 @@ ClockButton_UpdateTextStringsIfNecessary_Hook(LPVOID pThis, bool* param1) {
 
     g_updateTextStringThreadId = 0;
 
-    if (g_settings.showSeconds || g_dataCollectionSession ||
+    if (g_settings.showSeconds || g_dataCollectionEnabled ||
         !g_webContentLoaded) {
         // Return the time-out value for the time of the next update.
         SYSTEMTIME time;
@@ -3295,11 +4201,10 @@ int WINAPI GetTimeFormatEx_Hook_Win10(LPCWSTR lpLocaleName,
                                       LPWSTR lpTimeStr,
                                       int cchTime) {
     if (g_updateTextStringThreadId == GetCurrentThreadId()) {
-        g_formatTime = *lpTime;
-        g_formatIndex++;
+        SetFormatTime(lpTime);
 
         if (wcscmp(g_settings.topLine, L"-") != 0) {
-            return FormatLine(lpTimeStr, cchTime, g_settings.topLine.get()) + 1;
+            return FormatLine(lpTimeStr, cchTime, g_topLineProgram) + 1;
         }
     }
 
@@ -3318,10 +4223,14 @@ int WINAPI GetDateFormatEx_Hook_Win10(LPCWSTR lpLocaleName,
                                       LPCWSTR lpCalendar) {
     if (g_updateTextStringThreadId == GetCurrentThreadId()) {
         g_getDateFormatExCounter++;
-        PCWSTR format = g_getDateFormatExCounter > 1 ? g_settings.middleLine
-                                                     : g_settings.bottomLine;
+        bool middle = g_getDateFormatExCounter > 1;
+        PCWSTR format =
+            middle ? g_settings.middleLine : g_settings.bottomLine;
         if (wcscmp(format, L"-") != 0) {
-            return FormatLine(lpDateStr, cchDate, format) + 1;
+            return FormatLine(lpDateStr, cchDate,
+                              middle ? g_middleLineProgram
+                                     : g_bottomLineProgram) +
+                   1;
         }
     }
 
@@ -3717,6 +4626,11 @@ void LoadSettings() {
     g_settings.bottomLine = StringSetting::make(L"BottomLine");
     g_settings.middleLine = StringSetting::make(L"MiddleLine");
     g_settings.tooltipLine = StringSetting::make(L"TooltipLine");
+
+    g_topLineProgram = CompileFormatLine(g_settings.topLine.get());
+    g_bottomLineProgram = CompileFormatLine(g_settings.bottomLine.get());
+    g_middleLineProgram = CompileFormatLine(g_settings.middleLine.get());
+    g_tooltipLineProgram = CompileFormatLine(g_settings.tooltipLine.get());
     g_settings.width = Wh_GetIntSetting(L"Width");
     g_settings.height = Wh_GetIntSetting(L"Height");
     g_settings.maxWidth = Wh_GetIntSetting(L"MaxWidth");
@@ -3830,8 +4744,11 @@ void LoadSettings() {
 
     g_settings.webContentsUpdateInterval =
         Wh_GetIntSetting(L"WebContentsUpdateInterval");
+    g_settings.webContentsSharedCache =
+        Wh_GetIntSetting(L"WebContentsSharedCache");
 
     g_timeZoneInformation.clear();
+    g_timeZoneTime.clear();
     g_timeFormattedTz.clear();
     g_dateFormattedTz.clear();
     g_weekdayFormattedTz.clear();
@@ -3844,6 +4761,7 @@ void LoadSettings() {
         }
 
         g_timeZoneInformation.emplace_back(GetTimeZoneInformation(timeZone));
+        g_timeZoneTime.emplace_back();
         g_timeFormattedTz.emplace_back();
         g_dateFormattedTz.emplace_back();
         g_weekdayFormattedTz.emplace_back();
@@ -3912,6 +4830,8 @@ void LoadSettings() {
         g_settings.webContentsMaxLength =
             Wh_GetIntSetting(L"WebContentsMaxLength");
     }
+
+    InvalidateFormattedStrings();
 }
 
 HWND FindCurrentProcessTaskbarWnd() {
@@ -2,7 +2,7 @@
 // @id              taskbar-empty-space-clicks
 // @name            Click on empty taskbar space
 // @description     Trigger custom action when empty space on a taskbar is double/middle clicked
-// @version         1.9
+// @version         1.9.2
 // @author          m1lhaus
 // @github          https://github.com/m1lhaus
 // @include         explorer.exe
@@ -155,6 +155,9 @@ If you have request for new functions, suggestions or you are experiencing some
 #include <comutil.h>
 #include <winrt/base.h>
 
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -1120,8 +1123,13 @@ static struct
     TaskBarButtonsState secondaryTaskBarButtonsState2;
     std::vector<int> virtualKeypress;
     std::wstring processToStart;
+    std::wstring processToStartApplication; // resolved executable of processToStart, empty if not resolved
 } g_settings;
 
+// guards the non-trivial settings above (virtualKeypress, processToStart, processToStartApplication), which are read
+// by the action worker thread while LoadSettings might rewrite them
+static std::mutex g_settingsMutex;
+
 // wrapper to always call COM de-initialization
 class COMInitializer
 {
@@ -1343,7 +1351,8 @@ bool IsTaskbarWindow(HWND hWnd);
 bool IsDoubleClick();
 bool IsDoubleTap();
 bool IsTripleTap();
-void ExecuteTaskbarAction(TaskBarAction taskbarAction, HWND hWnd);
+void ExecuteTaskbarAction(TaskBarAction taskbarAction, HWND hWnd, const MouseClick &click);
+void QueueTaskbarAction(TaskBarAction taskbarAction, HWND hWnd, const MouseClick &click);
 void CALLBACK ProcessTripleTap(HWND, UINT, UINT_PTR, DWORD);
 bool OnMouseClick(MouseClick click);
 
@@ -1955,6 +1964,59 @@ void ParseVirtualKeypressSetting(const wchar_t *option, std::vector<int> &keys)
     }
 }
 
+/**
+ * @brief Resolves the executable of the command line once, so that it doesn't have to be searched for every time the
+ * process is started.
+ *
+ * @param command Command line of the process
+ * @return std::wstring Full path of the executable, or an empty string if it couldn't be resolved, in which case
+ * CreateProcess resolves it on its own
+ */
+std::wstring ResolveProcessApplication(const std::wstring &command)
+{
+    LOG_TRACE();
+
+    std::wstring executable;
+    size_t start = command.find_first_not_of(L" \t");
+    if (start == std::wstring::npos)
+    {
+        return std::wstring();
+    }
+
+    if (command[start] == L'"')
+    {
+        size_t end = command.find(L'"', start + 1);
+        if (end == std::wstring::npos)
+        {
+            return std::wstring();
+        }
+        executable = command.substr(start + 1, end - start - 1);
+    }
+    else
+    {
+        size_t end = command.find_first_of(L" \t", start);
+        executable = command.substr(start, end == std::wstring::npos ? std::wstring::npos : end - start);
+    }
+
+    WCHAR szPath[MAX_PATH];
+    DWORD length = SearchPath(NULL, executable.c_str(), L".exe", ARRAYSIZE(szPath), szPath, NULL);
+    if (length == 0 || length >= ARRAYSIZE(szPath))
+    {
+        LOG_DEBUG(L"Failed to resolve executable %s", executable.c_str());
+        return std::wstring();
+    }
+
+    // only executables can be passed as application name, let CreateProcess handle everything else (e.g. batch files)
+    PCWSTR extension = wcsrchr(szPath, L'.');
+    if (!extension || _wcsicmp(extension, L".exe") != 0)
+    {
+        return std::wstring();
+    }
+
+    LOG_DEBUG(L"Resolved executable %s to %s", executable.c_str(), szPath);
+    return szPath;
+}
+
 void LoadSettings()
 {
     LOG_TRACE();
@@ -1966,8 +2028,16 @@ void LoadSettings()
     g_settings.primaryTaskBarButtonsState2 = ParseTaskBarButtonsState(L"CombineTaskbarButtons.State2");
     g_settings.secondaryTaskBarButtonsState1 = ParseTaskBarButtonsState(L"CombineTaskbarButtons.StateSecondary1");
     g_settings.secondaryTaskBarButtonsState2 = ParseTaskBarButtonsState(L"CombineTaskbarButtons.StateSecondary2");
-    ParseVirtualKeypressSetting(L"VirtualKeyPress", g_settings.virtualKeypress);
-    g_settings.processToStart = WindhawkUtils::StringSetting::make(L"StartProcess");
+
+    std::vector<int> virtualKeypress;
+    ParseVirtualKeypressSetting(L"VirtualKeyPress", virtualKeypress);
+    std::wstring processToStart = WindhawkUtils::StringSetting::make(L"StartProcess").get();
+    std::wstring processToStartApplication = ResolveProcessApplication(processToStart);
+
+    std::lock_guard<std::mutex> guard(g_settingsMutex);
+    g_settings.virtualKeypress = std::move(virtualKeypress);
+    g_settings.processToStart = std::move(processToStart);
+    g_settings.processToStartApplication = std::move(processToStartApplication);
 }
 
 /**
@@ -2161,9 +2231,8 @@ void SendWinTabKeypress()
     SendKeypress({VK_LWIN, VK_TAB});
 }
 
-bool ClickStartMenu()
+bool ClickStartMenu(const MouseClick &lastClick)
 {
-    const MouseClick &lastClick = g_mouseClickQueue[-1];
     if (!lastClick.onEmptySpace)
     {
         LOG_ERROR(L"Failed to send Win keypress - last click was not on empty space");
@@ -2292,10 +2361,10 @@ bool ClickStartMenu()
     return true;
 }
 
-void OpenStartMenu()
+void OpenStartMenu(const MouseClick &click)
 {
     LOG_TRACE();
-    if (!ClickStartMenu())  // if user hide the start menu via other Windhawk mod, we can't click it
+    if (!ClickStartMenu(click))  // if user hide the start menu via other Windhawk mod, we can't click it
     {
         LOG_INFO(L"Sending Win keypress");
         SendKeypress({VK_LWIN});
@@ -2463,7 +2532,7 @@ bool SetCombineTaskbarButtons(const wchar_t *optionName, unsigned int option)
     return shallNotify;
 }
 
-void StartProcess(const std::wstring &command)
+void StartProcess(const std::wstring &command, const std::wstring &application)
 {
     LOG_TRACE();
     if (command.empty())
@@ -2478,7 +2547,10 @@ void StartProcess(const std::wstring &command)
     PROCESS_INFORMATION pi{};
     si.cb = sizeof(si);
 
-    if (!CreateProcess(NULL, (LPWSTR)command.c_str(), NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+    // CreateProcess may modify the command line buffer
+    std::wstring commandLine = command;
+    if (!CreateProcess(application.empty() ? NULL : application.c_str(), commandLine.data(), NULL, NULL, FALSE, 0, NULL,
+                       NULL, &si, &pi))
     {
         DWORD error = GetLastError();
         LOG_ERROR(L"Failed to start process - CreateProcess failed with error code: %d", error);
@@ -2587,16 +2659,16 @@ void CALLBACK ProcessTripleTap(HWND, UINT, UINT_PTR, DWORD)
 
     if (IsTripleTap())
     {
-        ExecuteTaskbarAction(g_settings.middleClickTaskbarAction, g_mouseClickQueue[-1].hWnd);
+        QueueTaskbarAction(g_settings.middleClickTaskbarAction, g_mouseClickQueue[-1].hWnd, g_mouseClickQueue[-1]);
     }
     else
     {
-        ExecuteTaskbarAction(g_settings.doubleClickTaskbarAction, g_mouseClickQueue[-1].hWnd);
+        QueueTaskbarAction(g_settings.doubleClickTaskbarAction, g_mouseClickQueue[-1].hWnd, g_mouseClickQueue[-1]);
     }
     g_mouseClickQueue.clear();
 }
 
-void ExecuteTaskbarAction(TaskBarAction taskbarAction, HWND hWnd)
+void ExecuteTaskbarAction(TaskBarAction taskbarAction, HWND hWnd, const MouseClick &click)
 {
     if (taskbarAction == ACTION_NOTHING)
     {
@@ -2650,16 +2722,27 @@ void ExecuteTaskbarAction(TaskBarAction taskbarAction, HWND hWnd)
     }
     else if (taskbarAction == ACTION_OPEN_START_MENU)
     {
-        OpenStartMenu();
+        OpenStartMenu(click);
     }
     else if (taskbarAction == ACTION_SEND_KEYPRESS)
     {
         LOG_INFO(L"Sending arbitrary keypress");
-        SendKeypress(g_settings.virtualKeypress);
+        std::vector<int> virtualKeypress;
+        {
+            std::lock_guard<std::mutex> guard(g_settingsMutex);
+            virtualKeypress = g_settings.virtualKeypress;
+        }
+        SendKeypress(virtualKeypress);
     }
     else if (taskbarAction == ACTION_START_PROCESS)
     {
-        StartProcess(g_settings.processToStart);
+        std::wstring processToStart, processToStartApplication;
+        {
+            std::lock_guard<std::mutex> guard(g_settingsMutex);
+            processToStart = g_settings.processToStart;
+            processToStartApplication = g_settings.processToStartApplication;
+        }
+        StartProcess(processToStart, processToStartApplication);
     }
     else
     {
@@ -2667,6 +2750,143 @@ void ExecuteTaskbarAction(TaskBarAction taskbarAction, HWND hWnd)
     }
 }
 
+// =====================================================================
+
+#pragma region action_worker
+
+// Actions are executed on a dedicated thread, since some of them (e.g. starting a process or broadcasting a settings
+// change) can take a while and would freeze the taskbar if executed from within its window procedure.
+struct TaskbarActionRequest
+{
+    TaskBarAction action;
+    HWND hWnd;
+    MouseClick click;
+};
+
+static std::mutex g_actionQueueMutex;
+static std::deque<TaskbarActionRequest> g_actionQueue;
+static HANDLE g_actionQueueEvent;
+static HANDLE g_actionWorkerThread;
+static std::atomic<bool> g_actionWorkerStop;
+
+DWORD WINAPI ActionWorkerThread(LPVOID)
+{
+    // ShellExecuteEx and UIAutomation expect an STA thread, thus window messages are pumped while waiting for requests
+    COMInitializer comInitializer;
+    if (!comInitializer.Init())
+    {
+        LOG_ERROR(L"COM initialization of the action worker failed");
+    }
+
+    while (!g_actionWorkerStop)
+    {
+        DWORD waitResult = MsgWaitForMultipleObjects(1, &g_actionQueueEvent, FALSE, INFINITE, QS_ALLINPUT);
+        if (waitResult == WAIT_OBJECT_0 + 1)
+        {
+            MSG msg;
+            while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+            {
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+            }
+            continue;
+        }
+        else if (waitResult != WAIT_OBJECT_0)
+        {
+            LOG_ERROR(L"Action worker wait failed with error code: %d", GetLastError());
+            break;
+        }
+
+        while (!g_actionWorkerStop)
+        {
+            TaskbarActionRequest request;
+            {
+                std::lock_guard<std::mutex> guard(g_actionQueueMutex);
+                if (g_actionQueue.empty())
+                {
+                    break;
+                }
+                request = g_actionQueue.front();
+                g_actionQueue.pop_front();
+            }
+            ExecuteTaskbarAction(request.action, request.hWnd, request.click);
+        }
+    }
+
+    return 0;
+}
+
+bool StartActionWorker()
+{
+    LOG_TRACE();
+
+    g_actionQueueEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!g_actionQueueEvent)
+    {
+        LOG_ERROR(L"Failed to create action queue event");
+        return false;
+    }
+
+    g_actionWorkerStop = false;
+    g_actionWorkerThread = CreateThread(NULL, 0, ActionWorkerThread, NULL, 0, NULL);
+    if (!g_actionWorkerThread)
+    {
+        LOG_ERROR(L"Failed to create action worker thread");
+        CloseHandle(g_actionQueueEvent);
+        g_actionQueueEvent = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void StopActionWorker()
+{
+    LOG_TRACE();
+
+    if (g_actionWorkerThread)
+    {
+        g_actionWorkerStop = true;
+        SetEvent(g_actionQueueEvent);
+        WaitForSingleObject(g_actionWorkerThread, INFINITE);
+        CloseHandle(g_actionWorkerThread);
+        g_actionWorkerThread = NULL;
+    }
+
+    if (g_actionQueueEvent)
+    {
+        CloseHandle(g_actionQueueEvent);
+        g_actionQueueEvent = NULL;
+    }
+
+    std::lock_guard<std::mutex> guard(g_actionQueueMutex);
+    g_actionQueue.clear();
+}
+
+// called from the taskbar thread, the action itself is executed by the action worker
+void QueueTaskbarAction(TaskBarAction taskbarAction, HWND hWnd, const MouseClick &click)
+{
+    if (taskbarAction == ACTION_NOTHING)
+    {
+        return;
+    }
+
+    if (!g_actionWorkerThread)
+    {
+        // worker failed to start, fall back to executing the action directly
+        ExecuteTaskbarAction(taskbarAction, hWnd, click);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_actionQueueMutex);
+        g_actionQueue.push_back(TaskbarActionRequest{taskbarAction, hWnd, click});
+    }
+    SetEvent(g_actionQueueEvent);
+}
+
+#pragma endregion // action_worker
+
 // main body of the mod called every time a taskbar is clicked
 bool OnMouseClick(MouseClick click)
 {
@@ -2680,7 +2900,7 @@ bool OnMouseClick(MouseClick click)
     // directly handle middle click
     if (click.button == MouseClick::Button::MIDDLE)
     {
-        ExecuteTaskbarAction(g_settings.middleClickTaskbarAction, click.hWnd);
+        QueueTaskbarAction(g_settings.middleClickTaskbarAction, click.hWnd, click);
     }
     // buffer left clicks to detect double and triple clicks
     else if (click.button == MouseClick::Button::LEFT)
@@ -2701,20 +2921,26 @@ bool OnMouseClick(MouseClick click)
             // even though ProcessTripleTap callback should be called within this thread, just to be sure and avoid race condition,
             // clear the queue to avoid executing the action twice
             g_mouseClickQueue.clear();
-            ExecuteTaskbarAction(g_settings.middleClickTaskbarAction, click.hWnd);
+            QueueTaskbarAction(g_settings.middleClickTaskbarAction, click.hWnd, click);
         }
         else if (IsDoubleTap())
         {
+            // without a triple tap (middle click) action there's nothing to wait for, execute the double tap action right away
+            if (g_settings.middleClickTaskbarAction == ACTION_NOTHING)
+            {
+                g_mouseClickQueue.clear();
+                QueueTaskbarAction(g_settings.doubleClickTaskbarAction, click.hWnd, click);
+            }
             // setup triple click timer if not running already
             // if within given time another tap is detected, triple tap (middle click) is executed, else double click is executed
-            if (gMouseClickTimer == 0)
+            else if (gMouseClickTimer == 0)
             {
                 gMouseClickTimer = SetTimer(NULL, 0, GetDoubleClickTime(), ProcessTripleTap);
             }
         }
         else if (IsDoubleClick())
         {
-            ExecuteTaskbarAction(g_settings.doubleClickTaskbarAction, click.hWnd);
+            QueueTaskbarAction(g_settings.doubleClickTaskbarAction, click.hWnd, click);
             g_mouseClickQueue.clear();
         }
     }
@@ -2780,6 +3006,10 @@ BOOL Wh_ModInit()
         LOG_INFO(L"DeviceEnumerator COM initilized");
     }
 
+    // actions are executed on a worker thread so that they don't block the taskbar, if it fails to start they're
+    // executed directly
+    StartActionWorker();
+
     // hook CreateWindowExW to be able to identify taskbar windows on re-creation
     if (!Wh_SetFunctionHook((void *)CreateWindowExW, (void *)CreateWindowExW_Hook, (void **)&CreateWindowExW_Original))
     {
@@ -2847,5 +3077,6 @@ void Wh_ModUninit()
             UnsubclassTaskbarWindow(hSecondaryWnd);
         }
     }
+    StopActionWorker();
     g_comInitializer.Uninit();
 }
@@ -2,7 +2,7 @@
 // @id              taskbar-grouping
 // @name            Disable grouping on the taskbar
 // @description     Causes a separate button to be created on the taskbar for each new window
-// @version         1.3.10
+// @version         1.3.12
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -121,6 +121,7 @@ or a similar tool), enable the relevant option in the mod's settings.
 #include <shlwapi.h>
 #include <winrt/base.h>
 
+#include <algorithm>
 #include <atomic>
 #include <functional>
 #include <string>
@@ -322,18 +323,29 @@ void ProcessResolvedWindow(PVOID pThis, RESOLVEDWINDOW* resolvedWindow) {
            resolvedWindow->bSetPinnableAndLaunchable);
     Wh_Log(L"bSetThumbFlag=%d", resolvedWindow->bSetThumbFlag);
 
-    DWORD resolvedAppIdStrLen = wcslen(resolvedWindow->szAppIdStr);
+    // The upper case app id and process path are only used to look up the
+    // configured program items. Resolving the process path opens the process,
+    // which adds up when many windows are resolved at once, such as after
+    // logon or an explorer restart, so skip it if there's nothing to look up.
+    bool hasProgramItems = !g_settings.excludedProgramItems.empty() ||
+                           !g_settings.customGroupProgramItems.empty();
+
     WCHAR resolvedAppIdStrUpper[MAX_PATH];
-    LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
-                  resolvedWindow->szAppIdStr, resolvedAppIdStrLen + 1,
-                  resolvedAppIdStrUpper, resolvedAppIdStrLen + 1, nullptr,
-                  nullptr, 0);
+    if (hasProgramItems) {
+        DWORD resolvedAppIdStrLen = wcslen(resolvedWindow->szAppIdStr);
+        LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
+                      resolvedWindow->szAppIdStr, resolvedAppIdStrLen + 1,
+                      resolvedAppIdStrUpper, resolvedAppIdStrLen + 1, nullptr,
+                      nullptr, 0);
+    } else {
+        *resolvedAppIdStrUpper = L'\0';
+    }
 
     DWORD resolvedWindowProcessPathLen = 0;
     WCHAR resolvedWindowProcessPath[MAX_PATH];
     WCHAR resolvedWindowProcessPathUpper[MAX_PATH];
     PCWSTR programFileNameUpper = nullptr;
-    if (resolvedWindow->hButtonWnd) {
+    if (hasProgramItems && resolvedWindow->hButtonWnd) {
         DWORD dwProcessId = 0;
         if (GetWindowThreadProcessId(resolvedWindow->hButtonWnd,
                                      &dwProcessId)) {
@@ -883,6 +895,97 @@ PVOID FindTaskBtnGroup(PVOID taskList,
     return taskBtnGroup;
 }
 
+// Task groups with an unsuffixed app id, keyed by the upper case app id. Used
+// to find the pinned item of an app without matching each taskbar item. The
+// pointers aren't referenced, entries might be stale and are verified before
+// use. Built on first use, and rebuilt after app ids are swapped.
+std::unordered_map<std::wstring, std::vector<PVOID>> g_taskGroupsByAppId;
+bool g_taskGroupsByAppIdValid;
+
+std::wstring TaskGroupIndexKey(PCWSTR appId) {
+    std::wstring key = appId;
+    LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, key.data(),
+                  key.length(), key.data(), key.length(), nullptr, nullptr,
+                  0);
+    return key;
+}
+
+void IndexTaskGroup(PVOID taskGroup) {
+    PCWSTR appId = CTaskGroup_GetAppID_Original(taskGroup);
+    if (!appId || FindAppIdSuffix(appId)) {
+        return;
+    }
+
+    auto& taskGroups = g_taskGroupsByAppId[TaskGroupIndexKey(appId)];
+    if (std::find(taskGroups.begin(), taskGroups.end(), taskGroup) ==
+        taskGroups.end()) {
+        taskGroups.push_back(taskGroup);
+    }
+}
+
+void InvalidateTaskGroupIndex() {
+    g_taskGroupsByAppId.clear();
+    g_taskGroupsByAppIdValid = false;
+}
+
+// Returns the first task button group on the task list which matches the
+// unsuffixed app id, like a FindTaskBtnGroup call with a matching callback.
+PVOID FindTaskBtnGroupByAppId(PVOID taskList, PCWSTR appIdOriginal) {
+    if (!g_taskGroupsByAppIdValid) {
+        FindTaskBtnGroup(taskList, [](PVOID taskBtnGroup) {
+            if (PVOID taskGroup =
+                    CTaskBtnGroup_GetGroup_Original(taskBtnGroup)) {
+                IndexTaskGroup(taskGroup);
+            }
+
+            return false;
+        });
+        g_taskGroupsByAppIdValid = true;
+    }
+
+    auto it = g_taskGroupsByAppId.find(TaskGroupIndexKey(appIdOriginal));
+    if (it == g_taskGroupsByAppId.end()) {
+        return nullptr;
+    }
+
+    auto& taskGroups = it->second;
+
+    PVOID taskBtnGroupMatched = nullptr;
+    int taskBtnGroupMatchedIndex = -1;
+
+    for (auto taskGroupIt = taskGroups.begin();
+         taskGroupIt != taskGroups.end();) {
+        // Only compares the pointer with the groups of the task list, so it's
+        // safe for stale entries.
+        int index = -1;
+        PVOID taskBtnGroup = CTaskListWnd__GetTBGroupFromGroup_Original(
+            taskList, *taskGroupIt, &index);
+        if (!taskBtnGroup) {
+            taskGroupIt = taskGroups.erase(taskGroupIt);
+            continue;
+        }
+
+        int windowMatchConfidence;
+        winrt::com_ptr<IUnknown> taskItemMatched;
+        HRESULT hr = CTaskGroup_DoesWindowMatch_Original(
+            *taskGroupIt, nullptr, nullptr, appIdOriginal,
+            &windowMatchConfidence, taskItemMatched.put_void());
+        if (SUCCEEDED(hr) &&
+            (!taskBtnGroupMatched || index < taskBtnGroupMatchedIndex)) {
+            taskBtnGroupMatched = taskBtnGroup;
+            taskBtnGroupMatchedIndex = index;
+        }
+
+        ++taskGroupIt;
+    }
+
+    if (taskGroups.empty()) {
+        g_taskGroupsByAppId.erase(it);
+    }
+
+    return taskBtnGroupMatched;
+}
+
 using CTaskListWnd_IsOnPrimaryTaskband_t = BOOL(WINAPI*)(PVOID pThis);
 CTaskListWnd_IsOnPrimaryTaskband_t CTaskListWnd_IsOnPrimaryTaskband_Original;
 
@@ -901,6 +1004,10 @@ PVOID WINAPI CTaskListWnd__CreateTBGroup_Hook(PVOID pThis,
 
     g_cTaskListWnd__CreateTBGroup_ThreadId = 0;
 
+    if (ret && g_taskGroupsByAppIdValid) {
+        IndexTaskGroup(taskGroup);
+    }
+
     return ret;
 }
 
@@ -1039,6 +1146,8 @@ CTaskListWnd_HandleTaskGroupUnpinned_t
     CTaskListWnd_HandleTaskGroupUnpinned_Original;
 
 void SwapTaskGroupIds(PVOID taskGroup1, PVOID taskGroup2) {
+    InvalidateTaskGroupIndex();
+
     WCHAR appId1Copy[MAX_PATH] = L"";
     if (PCWSTR appId1 = CTaskGroup_GetAppID_Original(taskGroup1)) {
         wcscpy_s(appId1Copy, appId1);
@@ -1231,21 +1340,7 @@ void HandleSuffixedInstanceOnTaskCreated(PVOID taskList_TaskListUI,
     }
 
     PVOID taskBtnGroupMatched =
-        FindTaskBtnGroup(taskList, [appIdOriginal](PVOID taskBtnGroup) {
-            PVOID taskGroup = CTaskBtnGroup_GetGroup_Original(taskBtnGroup);
-            if (!taskGroup) {
-                return false;
-            }
-
-            int windowMatchConfidence;
-            winrt::com_ptr<IUnknown> taskItemMatched;
-            HRESULT hr = CTaskGroup_DoesWindowMatch_Original(
-                taskGroup, nullptr, nullptr, appIdOriginal,
-                &windowMatchConfidence, taskItemMatched.put_void());
-            bool matched = SUCCEEDED(hr);
-
-            return matched;
-        });
+        FindTaskBtnGroupByAppId(taskList, appIdOriginal);
     if (!taskBtnGroupMatched) {
         return;
     }
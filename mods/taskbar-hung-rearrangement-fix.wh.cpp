@@ -2,7 +2,7 @@
 // @id              taskbar-hung-rearrangement-fix
 // @name            Taskbar hung windows rearrangement fix
 // @description     Fixes a taskbar bug which causes taskbar items of hung windows to move to the end of the taskbar
-// @version         1.0
+// @version         1.0.1
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -74,6 +74,10 @@ std::atomic<bool> g_explorerPatcherInitialized;
 bool IsGhostWindowClass(HWND hWnd) {
     static ATOM ghostAtom;
 
+    if (!hWnd) {
+        return false;
+    }
+
     if (!ghostAtom) {
         WNDCLASS wndClass;
         ghostAtom = (ATOM)GetClassInfo(NULL, L"Ghost", &wndClass);
@@ -2,7 +2,7 @@
 // @id              taskbar-icon-size
 // @name            Taskbar height and icon size
 // @description     Control the taskbar height and icon size, improve icon quality (Windows 11 only)
-// @version         1.3.5
+// @version         1.3.9
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -94,6 +94,7 @@ Also check out the **Taskbar tray icon spacing** mod.
 
 #include <atomic>
 #include <functional>
+#include <future>
 #include <limits>
 #include <optional>
 #include <regex>
@@ -167,6 +168,53 @@ size_t OffsetFromAssemblyRegex(void* func,
     return defValue;
 }
 
+// Offsets found by scanning code only change along with the binary, so they
+// are kept in mod storage. The stored key identifies the module build by its
+// timestamp and image size, together with the RVA of the scanned function,
+// and a stored offset is only used if all of them match. Failed scans aren't
+// stored, so that they're retried on the next load.
+template <typename F>
+auto CachedCodeOffset(PCWSTR name, const void* func, F&& scan)
+    -> decltype(scan()) {
+    WCHAR key[64] = L"";
+    HMODULE module;
+    if (func &&
+        GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                              GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                          (PCWSTR)func, &module)) {
+        IMAGE_DOS_HEADER* dosHeader = (IMAGE_DOS_HEADER*)module;
+        IMAGE_NT_HEADERS* header =
+            (IMAGE_NT_HEADERS*)((BYTE*)dosHeader + dosHeader->e_lfanew);
+        swprintf_s(key, L"%08X-%X-%X", header->FileHeader.TimeDateStamp,
+                   header->OptionalHeader.SizeOfImage,
+                   (DWORD)((const BYTE*)func - (const BYTE*)module));
+    }
+
+    WCHAR valueName[96];
+    swprintf_s(valueName, L"offset-%s", name);
+
+    if (*key) {
+        WCHAR cached[96] = L"";
+        Wh_GetStringValue(valueName, cached, ARRAYSIZE(cached));
+        size_t keyLen = wcslen(key);
+        if (wcsncmp(cached, key, keyLen) == 0 && cached[keyLen] == L'=') {
+            auto offset = (decltype(scan()))wcstoul(cached + keyLen + 1,
+                                                    nullptr, 16);
+            Wh_Log(L"%s=0x%X (cached)", name, offset);
+            return offset;
+        }
+    }
+
+    auto offset = scan();
+    if (*key && offset) {
+        WCHAR value[96];
+        swprintf_s(value, L"%s=%X", key, (DWORD)offset);
+        Wh_SetStringValue(valueName, value);
+    }
+
+    return offset;
+}
+
 std::optional<bool> IsOsFeatureEnabled(UINT32 featureId) {
     enum FEATURE_ENABLED_STATE {
         FEATURE_ENABLED_STATE_DEFAULT = 0,
@@ -260,6 +308,56 @@ FrameworkElement FindChildByClassName(FrameworkElement element,
     });
 }
 
+// The overridden values are boxed once and reused, since the lookups happen
+// very often during layout. Boxed values are agile, so they can be shared by
+// all threads.
+struct BoxedResourceValue {
+    double value;
+    winrt::Windows::Foundation::IInspectable boxed;
+};
+
+enum class OverriddenResource {
+    mediumTaskbarButtonExtent,
+    smallTaskbarButtonExtent,
+    count,
+};
+
+SRWLOCK g_boxedResourceValuesLock = SRWLOCK_INIT;
+BoxedResourceValue
+    g_boxedResourceValues[static_cast<size_t>(OverriddenResource::count)];
+
+winrt::Windows::Foundation::IInspectable GetBoxedResourceValue(
+    OverriddenResource resource,
+    double value) {
+    auto& entry = g_boxedResourceValues[static_cast<size_t>(resource)];
+
+    AcquireSRWLockShared(&g_boxedResourceValuesLock);
+    winrt::Windows::Foundation::IInspectable boxed =
+        entry.value == value ? entry.boxed : nullptr;
+    ReleaseSRWLockShared(&g_boxedResourceValuesLock);
+
+    if (boxed) {
+        return boxed;
+    }
+
+    boxed = winrt::box_value(value);
+
+    AcquireSRWLockExclusive(&g_boxedResourceValuesLock);
+    entry.value = value;
+    entry.boxed = boxed;
+    ReleaseSRWLockExclusive(&g_boxedResourceValuesLock);
+
+    return boxed;
+}
+
+void FreeBoxedResourceValues() {
+    AcquireSRWLockExclusive(&g_boxedResourceValuesLock);
+    for (auto& entry : g_boxedResourceValues) {
+        entry.boxed = nullptr;
+    }
+    ReleaseSRWLockExclusive(&g_boxedResourceValuesLock);
+}
+
 void OverrideResourceDirectoryLookup(
     PCSTR sourceFunctionName,
     const winrt::Windows::Foundation::IInspectable* key,
@@ -273,10 +371,13 @@ void OverrideResourceDirectoryLookup(
         return;
     }
 
+    OverriddenResource resource;
     double newValueDouble;
     if (*keyString == L"MediumTaskbarButtonExtent") {
+        resource = OverriddenResource::mediumTaskbarButtonExtent;
         newValueDouble = g_settings.taskbarButtonWidth;
     } else if (*keyString == L"SmallTaskbarButtonExtent") {
+        resource = OverriddenResource::smallTaskbarButtonExtent;
         newValueDouble = g_settings.taskbarButtonWidthSmall;
     } else {
         return;
@@ -290,7 +391,7 @@ void OverrideResourceDirectoryLookup(
     if (newValueDouble != *valueDouble) {
         Wh_Log(L"[%S] Overriding value %s: %f->%f", sourceFunctionName,
                keyString->c_str(), *valueDouble, newValueDouble);
-        *value = winrt::box_value(newValueDouble);
+        *value = GetBoxedResourceValue(resource, newValueDouble);
     }
 }
 
@@ -650,7 +751,10 @@ using TaskListButton_IconHeight_t = void(WINAPI*)(void* pThis, double height);
 TaskListButton_IconHeight_t TaskListButton_IconHeight_Original;
 
 size_t GetIconHeightOffset() {
-    static size_t iconHeightOffset = []() {
+    static size_t iconHeightOffset = CachedCodeOffset(
+        L"iconHeightOffset",
+        (void*)TaskListButton_IconHeight_Original,
+        []() {
         size_t offset =
 #if defined(_M_X64)
             OffsetFromAssemblyRegex(
@@ -669,7 +773,7 @@ size_t GetIconHeightOffset() {
 #endif
         Wh_Log(L"iconHeightOffset=0x%X", offset);
         return offset > 0xFFFF ? 0 : offset;
-    }();
+    });
 
     return iconHeightOffset;
 }
@@ -736,7 +840,10 @@ TaskbarConfiguration_UpdateFrameSize_t
     TaskbarConfiguration_UpdateFrameSize_SymbolAddress;
 
 LONG GetFrameSizeOffset() {
-    static LONG frameSizeOffset = []() -> LONG {
+    static LONG frameSizeOffset = CachedCodeOffset(
+        L"frameSizeOffset",
+        (void*)TaskbarConfiguration_UpdateFrameSize_SymbolAddress,
+        []() -> LONG {
         // Find the offset to the frame size.
         // str d16, [x19, #0x50]
         const DWORD* start =
@@ -767,7 +874,7 @@ LONG GetFrameSizeOffset() {
 
         Wh_Log(L"frameSizeOffset not found");
         return 0;
-    }();
+    });
 
     return frameSizeOffset;
 }
@@ -821,7 +928,10 @@ SystemTrayController_UpdateFrameSize_t
     SystemTrayController_UpdateFrameSize_SymbolAddress;
 
 LONG GetLastHeightOffset() {
-    static LONG lastHeightOffset = []() -> LONG {
+    static LONG lastHeightOffset = CachedCodeOffset(
+        L"lastHeightOffset",
+        (void*)SystemTrayController_UpdateFrameSize_SymbolAddress,
+        []() -> LONG {
     // Find the last height offset to reset the height value.
 #if defined(_M_X64)
         // 66 0f 2e b3 b0 00 00 00 UCOMISD    uVar4,qword ptr [RBX + 0xb0]
@@ -894,7 +1004,7 @@ LONG GetLastHeightOffset() {
 
         Wh_Log(L"lastHeightOffset not found");
         return 0;
-    }();
+    });
 
     return lastHeightOffset;
 }
@@ -942,7 +1052,10 @@ void WINAPI TaskbarFrame_Height_double_Hook(void* pThis, double value) {
 void* TaskbarController_OnGroupingModeChanged_Original;
 
 LONG GetTaskbarFrameOffset() {
-    static LONG taskbarFrameOffset = []() -> LONG {
+    static LONG taskbarFrameOffset = CachedCodeOffset(
+        L"taskbarFrameOffset",
+        TaskbarController_OnGroupingModeChanged_Original,
+        []() -> LONG {
 #if defined(_M_X64)
         // 48:83EC 28               | sub rsp,28
         // 48:8B81 88020000         | mov rax,qword ptr ds:[rcx+288]
@@ -993,7 +1106,7 @@ LONG GetTaskbarFrameOffset() {
 
         Wh_Log(L"taskbarFrameOffset not found");
         return 0;
-    }();
+    });
 
     return taskbarFrameOffset;
 }
@@ -1202,7 +1315,10 @@ void WINAPI TaskListButton_UpdateBadge_Hook(void* pThis) {
 void* TaskListButton_UpdateIconColumnDefinition_Original;
 
 LONG GetMediumTaskbarButtonExtentOffset() {
-    static LONG mediumTaskbarButtonExtentOffset = []() -> LONG {
+    static LONG mediumTaskbarButtonExtentOffset = CachedCodeOffset(
+        L"mediumTaskbarButtonExtentOffset",
+        TaskListButton_UpdateIconColumnDefinition_Original,
+        []() -> LONG {
 #if defined(_M_X64)
         // 40:53              | push rbx
         // 48:83EC 60         | sub rsp,60
@@ -1293,7 +1409,7 @@ LONG GetMediumTaskbarButtonExtentOffset() {
 
         Wh_Log(L"Error: mediumTaskbarButtonExtentOffset not found");
         return 0;
-    }();
+    });
 
     return mediumTaskbarButtonExtentOffset;
 }
@@ -1750,6 +1866,11 @@ HWND FindCurrentProcessTaskbarWnd() {
 }
 
 bool ProtectAndMemcpy(DWORD protect, void* dst, const void* src, size_t size) {
+    // Skip the protection round-trip if there's nothing to change.
+    if (memcmp(dst, src, size) == 0) {
+        return true;
+    }
+
     DWORD oldProtect;
     if (!VirtualProtect(dst, size, protect, &oldProtect)) {
         return false;
@@ -1760,6 +1881,19 @@ bool ProtectAndMemcpy(DWORD protect, void* dst, const void* src, size_t size) {
     return true;
 }
 
+// For Windows 11 version 21H2, the taskbar height is patched in the constant
+// itself.
+void UpdateDouble48Value() {
+    if (TaskbarConfiguration_GetFrameSize_Original ||
+        !double_48_value_Original) {
+        return;
+    }
+
+    double tempTaskbarHeight = g_taskbarHeight;
+    ProtectAndMemcpy(PAGE_READWRITE, double_48_value_Original,
+                     &tempTaskbarHeight, sizeof(double));
+}
+
 void ApplySettings(int taskbarHeight) {
     if (taskbarHeight < 2) {
         taskbarHeight = 2;
@@ -1789,12 +1923,7 @@ void ApplySettings(int taskbarHeight) {
 
         // Temporarily change the height to force a UI refresh.
         g_taskbarHeight = taskbarHeight - 1;
-        if (!TaskbarConfiguration_GetFrameSize_Original &&
-            double_48_value_Original) {
-            double tempTaskbarHeight = g_taskbarHeight;
-            ProtectAndMemcpy(PAGE_READWRITE, double_48_value_Original,
-                             &tempTaskbarHeight, sizeof(double));
-        }
+        UpdateDouble48Value();
 
         // Trigger TrayUI::_HandleSettingChange.
         SendMessage(hTaskbarWnd, WM_SETTINGCHANGE, SPI_SETLOGICALDPIOVERRIDE,
@@ -1813,12 +1942,7 @@ void ApplySettings(int taskbarHeight) {
     g_pendingMeasureOverride = true;
 
     g_taskbarHeight = taskbarHeight;
-    if (!TaskbarConfiguration_GetFrameSize_Original &&
-        double_48_value_Original) {
-        double tempTaskbarHeight = g_taskbarHeight;
-        ProtectAndMemcpy(PAGE_READWRITE, double_48_value_Original,
-                         &tempTaskbarHeight, sizeof(double));
-    }
+    UpdateDouble48Value();
 
     // Trigger TrayUI::_HandleSettingChange.
     SendMessage(hTaskbarWnd, WM_SETTINGCHANGE, SPI_SETLOGICALDPIOVERRIDE, 0);
@@ -2224,32 +2348,45 @@ BOOL Wh_ModInit() {
 
     LoadSettings();
 
-    if (!HookTaskbarDllSymbols()) {
-        return FALSE;
-    }
-
     bool delayLoadingNeeded = false;
 
+    // Symbols of the modules which are already loaded are resolved
+    // concurrently with taskbar.dll, so that init takes as long as the slowest
+    // module instead of all of them combined. The hooks themselves are only
+    // applied after Wh_ModInit returns.
+    std::future<bool> taskbarViewDllHooked;
     if (HMODULE taskbarViewModule = GetTaskbarViewModuleHandle()) {
         g_taskbarViewDllLoaded = true;
-        if (!HookTaskbarViewDllSymbols(taskbarViewModule)) {
-            return FALSE;
-        }
+        taskbarViewDllHooked =
+            std::async(std::launch::async, HookTaskbarViewDllSymbols,
+                       taskbarViewModule);
     } else {
         Wh_Log(L"Taskbar view module not loaded yet");
         delayLoadingNeeded = true;
     }
 
+    std::future<bool> searchUxUiDllHooked;
     if (HMODULE searchUxUiModule = GetSearchUxUiModuleHandle()) {
         g_searchUxUiDllLoaded = true;
-        if (!HookSearchUxUiDllSymbols(searchUxUiModule)) {
-            return FALSE;
-        }
+        searchUxUiDllHooked = std::async(
+            std::launch::async, HookSearchUxUiDllSymbols, searchUxUiModule);
     } else {
         Wh_Log(L"Search UX UI module not loaded yet");
         delayLoadingNeeded = true;
     }
 
+    bool taskbarDllHooked = HookTaskbarDllSymbols();
+
+    // Wait for all of them before bailing out on a failure.
+    bool taskbarViewDllSucceeded =
+        !taskbarViewDllHooked.valid() || taskbarViewDllHooked.get();
+    bool searchUxUiDllSucceeded =
+        !searchUxUiDllHooked.valid() || searchUxUiDllHooked.get();
+    if (!taskbarDllHooked || !taskbarViewDllSucceeded ||
+        !searchUxUiDllSucceeded) {
+        return FALSE;
+    }
+
     if (delayLoadingNeeded) {
         HMODULE kernelBaseModule = GetModuleHandle(L"kernelbase.dll");
         auto pKernelBaseLoadLibraryExW =
@@ -2314,6 +2451,8 @@ void Wh_ModUninit() {
     while (g_hookCallCounter > 0) {
         Sleep(100);
     }
+
+    FreeBoxedResourceValues();
 }
 
 void Wh_ModSettingsChanged() {
@@ -2,7 +2,7 @@
 // @id              taskbar-labels
 // @name            Taskbar Labels for Windows 11
 // @description     Customize text labels and combining for running programs on the taskbar (Windows 11 only)
-// @version         1.4.2
+// @version         1.4.5
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -190,8 +190,11 @@ Labels can also be shown or hidden per-program in the settings.
 #include <algorithm>
 #include <atomic>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 using namespace winrt::Windows::UI::Xaml;
 
@@ -241,6 +244,11 @@ double g_initialTaskbarItemWidth;
 UINT_PTR g_invalidateTaskListButtonTimer;
 std::unordered_set<FrameworkElement> g_taskListButtonsWithLabelMissing;
 
+// Incremented when the settings change, stored in the tag of the label of
+// each button to tell whether its layout was applied with the current
+// settings.
+int g_settingsGeneration;
+
 #if __cplusplus < 202302L
 // Missing in older MinGW headers.
 DECLARE_HANDLE(CO_MTA_USAGE_COOKIE);
@@ -373,6 +381,43 @@ std::wstring GetWindowAppId(HWND hWnd) {
     return result;
 }
 
+struct WindowAppIdCacheEntry {
+    DWORD threadId;
+    std::wstring appId;
+};
+
+// App ids per window, querying them involves COM calls. There are no window
+// destruction notifications here, so entries are validated against the thread
+// of the window, which changes if the handle is reused by another program.
+std::mutex g_windowAppIdCacheMutex;
+std::unordered_map<HWND, WindowAppIdCacheEntry> g_windowAppIdCache;
+constexpr size_t kWindowAppIdCacheMaxSize = 4096;
+
+std::wstring GetWindowAppIdCached(HWND hWnd) {
+    DWORD threadId = GetWindowThreadProcessId(hWnd, nullptr);
+    if (!threadId) {
+        return std::wstring();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+        auto it = g_windowAppIdCache.find(hWnd);
+        if (it != g_windowAppIdCache.end() && it->second.threadId == threadId) {
+            return it->second.appId;
+        }
+    }
+
+    std::wstring appId = GetWindowAppId(hWnd);
+
+    std::lock_guard<std::mutex> guard(g_windowAppIdCacheMutex);
+    if (g_windowAppIdCache.size() >= kWindowAppIdCacheMaxSize) {
+        // Most of the entries are probably of destroyed windows, start over.
+        g_windowAppIdCache.clear();
+    }
+    g_windowAppIdCache[hWnd] = {threadId, appId};
+    return appId;
+}
+
 void RecalculateLabels() {
     HWND hTaskbarWnd = FindCurrentProcessTaskbarWnd();
     if (!hTaskbarWnd) {
@@ -578,6 +623,59 @@ double CalculateTaskbarItemWidth(FrameworkElement taskbarFrameRepeaterElement,
     return width;
 }
 
+struct TaskbarItemWidthCacheEntry {
+    FrameworkElement taskbarFrameRepeaterElement;
+    double minWidth;
+    double maxWidth;
+    double width;
+};
+
+// Widths calculated for the current frame. Calculating the width iterates over
+// all taskbar items, and a layout pass updates each of them, so the
+// calculation is done once per taskbar until the next frame is rendered.
+std::vector<TaskbarItemWidthCacheEntry> g_taskbarItemWidthCache;
+winrt::event_token g_taskbarItemWidthCacheRenderingToken;
+
+double CalculateTaskbarItemWidthCached(
+    FrameworkElement taskbarFrameRepeaterElement,
+    double minWidth,
+    double maxWidth) {
+    for (const auto& entry : g_taskbarItemWidthCache) {
+        if (entry.taskbarFrameRepeaterElement == taskbarFrameRepeaterElement &&
+            entry.minWidth == minWidth && entry.maxWidth == maxWidth) {
+            return entry.width;
+        }
+    }
+
+    double width = CalculateTaskbarItemWidth(taskbarFrameRepeaterElement,
+                                             minWidth, maxWidth);
+
+    // Don't leave a rendering handler behind when unloading.
+    if (g_unloading) {
+        return width;
+    }
+
+    if (g_taskbarItemWidthCache.empty()) {
+        g_taskbarItemWidthCacheRenderingToken =
+            Media::CompositionTarget::Rendering(
+                [](winrt::Windows::Foundation::IInspectable const&,
+                   winrt::Windows::Foundation::IInspectable const&) {
+                    Media::CompositionTarget::Rendering(
+                        g_taskbarItemWidthCacheRenderingToken);
+                    g_taskbarItemWidthCache.clear();
+                });
+    }
+
+    g_taskbarItemWidthCache.push_back({
+        .taskbarFrameRepeaterElement = taskbarFrameRepeaterElement,
+        .minWidth = minWidth,
+        .maxWidth = maxWidth,
+        .width = width,
+    });
+
+    return width;
+}
+
 using CTaskListThumbnailWnd_DisplayUI_t = void*(WINAPI*)(void* pThis,
                                                          void* param1,
                                                          void* param2,
@@ -1253,7 +1351,7 @@ void UpdateTaskListButtonCustomizations(
     double widthToSet;
 
     if (showLabels) {
-        widthToSet = CalculateTaskbarItemWidth(
+        widthToSet = CalculateTaskbarItemWidthCached(
             taskbarFrameRepeaterElement, minWidth, g_settings.taskbarItemWidth);
 
         if (widthToSet <= iconElement.ActualWidth() +
@@ -1265,10 +1363,25 @@ void UpdateTaskListButtonCustomizations(
         widthToSet = minWidth;
     }
 
+    bool layoutUpToDate = false;
+
     auto windhawkTextControl =
         FindChildByName(iconPanelElement, L"WindhawkText")
             .as<Controls::TextBlock>();
-    if (!windhawkTextControl) {
+    if (windhawkTextControl) {
+        // Layout passes update all buttons, but usually only a few of them
+        // change their running state or width.
+        layoutUpToDate =
+            !g_unloading &&
+            winrt::unbox_value_or<int>(windhawkTextControl.Tag(), -1) ==
+                g_settingsGeneration &&
+            iconPanelElement.Width() == widthToSet &&
+            (windhawkTextControl.Visibility() == Visibility::Visible) ==
+                showLabels &&
+            windhawkTextControl.Margin().Left ==
+                g_settings.leftAndRightPaddingSize + iconElement.ActualWidth() +
+                    g_settings.spaceBetweenIconAndLabel;
+    } else {
         PCWSTR xaml =
             LR"(
                 <TextBlock
@@ -1293,7 +1406,11 @@ void UpdateTaskListButtonCustomizations(
             windhawkTextControl);
     }
 
-    UpdateTaskListButtonWidth(taskListButtonElement, widthToSet, showLabels);
+    if (!layoutUpToDate) {
+        UpdateTaskListButtonWidth(taskListButtonElement, widthToSet,
+                                  showLabels);
+        windhawkTextControl.Tag(winrt::box_value(g_settingsGeneration));
+    }
 
     bool textLabelMissing = false;
 
@@ -1469,9 +1586,16 @@ void WINAPI TaskListButton_Icon_Hook(void* pThis, LONG_PTR randomAccessStream) {
                 .as<Controls::TextBlock>();
         if (windhawkTextControl) {
             // Avoid setting empty text as it's used for missing titles.
-            windhawkTextControl.Text(*g_taskBtnGroupTitleInGroupChanged
-                                         ? g_taskBtnGroupTitleInGroupChanged
-                                         : L" ");
+            PCWSTR text = *g_taskBtnGroupTitleInGroupChanged
+                              ? g_taskBtnGroupTitleInGroupChanged
+                              : L" ";
+
+            // Group changes are also reported for icon, progress and other
+            // changes, and many titles flicker back and forth. Only set the
+            // text if it changed to avoid a new text measurement.
+            if (windhawkTextControl.Text() != text) {
+                windhawkTextControl.Text(text);
+            }
         }
     }
 }
@@ -1632,7 +1756,7 @@ TaskListWindowViewModel_ITaskbarAppItemViewModel_get_HasLabel_Hook(
             }
 
             if (!excluded) {
-                std::wstring appId = GetWindowAppId(hWnd);
+                std::wstring appId = GetWindowAppIdCached(hWnd);
                 LCMapStringEx(LOCALE_NAME_USER_DEFAULT, LCMAP_UPPERCASE,
                               appId.data(), appId.length(), appId.data(),
                               appId.length(), nullptr, nullptr, 0);
@@ -1750,6 +1874,8 @@ WilFeatureTraits_Feature_29785186_IsEnabled_t
     WilFeatureTraits_Feature_29785186_IsEnabled_Original;
 
 void LoadSettings() {
+    g_settingsGeneration++;
+
     PCWSTR mode = Wh_GetStringSetting(L"mode");
     g_settings.mode = Mode::labelsWithoutCombining;
     if (wcscmp(mode, L"noLabelsWithCombining") == 0) {
@@ -2,7 +2,7 @@
 // @id              taskbar-language-indicator-layout-control
 // @name            Taskbar language indicator layout control
 // @description     Prevents the Tray area from jumping around when the language indicator is hidden while RDP client window is active. There are multiple mitigations you can choose from.
-// @version         1.0
+// @version         1.0.1
 // @author          Roland Pihlakas
 // @github          https://github.com/levitation
 // @homepage        https://www.simplify.ee/
@@ -82,6 +82,7 @@ HANDLE g_initThread = NULL;
 HANDLE g_initThreadStopSignal = NULL;
 HWND g_hwndTaskbar = NULL;
 
+HWND g_hwndLanguageIndicatorFrame = NULL;     //cached in order to avoid calling GetClassNameW() on every ShowWindow() call in the Taskbar process
 HWND g_hwndLanguageIndicatorText = NULL;
 
 bool g_windowsShowConfig;
@@ -163,7 +164,21 @@ void SetWindowsConfig(bool show) {
 
 bool IsLanguageIndicatorFrameWindow(HWND hWnd) {
 
-    if (hWnd) {
+    if (!hWnd)
+        return false;
+
+    HWND hwndLanguageIndicatorFrame = g_hwndLanguageIndicatorFrame;
+    if (hwndLanguageIndicatorFrame) {
+
+        if (hWnd == hwndLanguageIndicatorFrame)
+            return true;
+        else if (IsWindow(hwndLanguageIndicatorFrame))     //there is only one language indicator frame, so as long as the cached one exists, any other window is not the frame
+            return false;
+        else    //the Tray area was recreated
+            g_hwndLanguageIndicatorFrame = NULL;
+    }
+
+    {
 
         wchar_t buf[32];
         if (!GetClassNameW(
@@ -176,6 +191,7 @@ bool IsLanguageIndicatorFrameWindow(HWND hWnd) {
         else {
             if (wcscmp(buf, g_languageIndicatorFrameClass) == 0) {
 
+                g_hwndLanguageIndicatorFrame = hWnd;
                 return true;
             }
         }
@@ -221,8 +237,13 @@ BOOL CALLBACK FindLanguageIndicatorTextWindowEnumProc(HWND hWnd, LPARAM lParam)
 
 HWND FindLanguageIndicatorTextHwnd() {
 
-    if (g_hwndLanguageIndicatorText)    //we can cache that value, the language indicator text is created only once
-        return g_hwndLanguageIndicatorText;
+    if (g_hwndLanguageIndicatorText) {    //we can cache that value, the language indicator text is created only once per Tray area
+
+        if (IsWindow(g_hwndLanguageIndicatorText))
+            return g_hwndLanguageIndicatorText;
+
+        g_hwndLanguageIndicatorText = NULL;     //the Tray area was recreated, find the new one
+    }
 
     //FindWindowEx would not work here since we need a recursive search
     EnumChildWindows(g_hwndTaskbar, FindLanguageIndicatorTextWindowEnumProc, NULL);     //NB! cannot check for return value here, accoding to documentation, "The return value is not used." - https://learn.microsoft.com/en-us/windows/win32/api/winuser/nf-winuser-enumchildwindows
@@ -2,7 +2,7 @@
 // @id              taskbar-multirow
 // @name            Multirow taskbar for Windows 11
 // @description     Span taskbar items across multiple rows, just like it was possible before Windows 11
-// @version         1.1.2
+// @version         1.1.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -85,6 +85,22 @@ struct TaskbarState {
 
 std::unordered_map<void*, TaskbarState> g_taskbarState;
 
+// Values shared by all elements arranged in a single
+// TaskbarCollapsibleLayoutXamlTraits::ArrangeOverride call. Finding them
+// requires iterating over the taskbar items and the taskbar visual tree, so
+// they're only looked up for the first arranged element.
+struct ArrangePassState {
+    bool initialized;
+    bool valid;
+    FrameworkElement taskbarFrameRepeater{nullptr};
+    FrameworkElement startButton{nullptr};
+    double startButtonWidth;
+    double widthWithoutExtent;
+    TaskbarState* taskbarState;
+};
+
+thread_local ArrangePassState* g_arrangePassState;
+
 HWND FindCurrentProcessTaskbarWnd() {
     HWND hTaskbarWnd = nullptr;
 
@@ -490,6 +506,55 @@ HRESULT WINAPI CTaskListWnd_ComputeJumpViewPosition_Hook(
     return ret;
 }
 
+void InitArrangePassState(ArrangePassState* passState,
+                          FrameworkElement taskbarFrameRepeater) {
+    *passState = ArrangePassState{
+        .initialized = true,
+        .taskbarFrameRepeater = taskbarFrameRepeater,
+    };
+
+    if (g_settings.fullHeightStartButton) {
+        passState->startButton =
+            EnumChildElements(taskbarFrameRepeater, [](FrameworkElement child) {
+                auto childClassName = winrt::get_class_name(child);
+                if (childClassName != L"Taskbar.ExperienceToggleButton") {
+                    return false;
+                }
+
+                auto automationId =
+                    Automation::AutomationProperties::GetAutomationId(child);
+                return automationId == L"StartButton";
+            });
+    }
+
+    passState->startButtonWidth =
+        passState->startButton ? passState->startButton.ActualWidth() : 0;
+
+    auto xamlRoot = taskbarFrameRepeater.XamlRoot();
+
+    passState->taskbarState = GetTaskbarState(xamlRoot);
+
+    auto xamlRootContent = xamlRoot.Content().as<FrameworkElement>();
+
+    auto taskbarFrameElement =
+        FindChildByName(xamlRootContent, L"TaskbarFrame");
+    if (!taskbarFrameElement) {
+        return;
+    }
+
+    auto systemTrayFrame =
+        FindChildByClassName(xamlRootContent, L"SystemTray.SystemTrayFrame");
+    if (!systemTrayFrame) {
+        return;
+    }
+
+    double systemTrayFrameWidth = systemTrayFrame.ActualWidth();
+
+    passState->widthWithoutExtent =
+        taskbarFrameElement.Width() - systemTrayFrameWidth;
+    passState->valid = true;
+}
+
 using IUIElement_Arrange_t =
     HRESULT(WINAPI*)(void* pThis, winrt::Windows::Foundation::Rect rect);
 IUIElement_Arrange_t IUIElement_Arrange_Original;
@@ -519,48 +584,19 @@ HRESULT WINAPI IUIElement_Arrange_Hook(void* pThis,
         return original();
     }
 
-    FrameworkElement startButton = nullptr;
-    if (g_settings.fullHeightStartButton) {
-        startButton =
-            EnumChildElements(taskbarFrameRepeater, [](FrameworkElement child) {
-                auto childClassName = winrt::get_class_name(child);
-                if (childClassName != L"Taskbar.ExperienceToggleButton") {
-                    return false;
-                }
-
-                auto automationId =
-                    Automation::AutomationProperties::GetAutomationId(child);
-                return automationId == L"StartButton";
-            });
-        if (element == startButton) {
-            return original();
-        }
+    ArrangePassState* passState = g_arrangePassState;
+    if (!passState->initialized ||
+        passState->taskbarFrameRepeater != taskbarFrameRepeater) {
+        InitArrangePassState(passState, taskbarFrameRepeater);
     }
 
-    double startButtonWidth = startButton ? startButton.ActualWidth() : 0;
-
-    auto xamlRoot = taskbarFrameRepeater.XamlRoot();
-
-    TaskbarState* taskbarState = GetTaskbarState(xamlRoot);
-
-    auto xamlRootContent = xamlRoot.Content().as<FrameworkElement>();
-
-    auto taskbarFrameElement =
-        FindChildByName(xamlRootContent, L"TaskbarFrame");
-    if (!taskbarFrameElement) {
-        return original();
-    }
-
-    auto systemTrayFrame =
-        FindChildByClassName(xamlRootContent, L"SystemTray.SystemTrayFrame");
-    if (!systemTrayFrame) {
+    if (!passState->valid || element == passState->startButton) {
         return original();
     }
 
-    double systemTrayFrameWidth = systemTrayFrame.ActualWidth();
-
-    double widthWithoutExtent =
-        taskbarFrameElement.Width() - systemTrayFrameWidth;
+    double startButtonWidth = passState->startButtonWidth;
+    TaskbarState* taskbarState = passState->taskbarState;
+    double widthWithoutExtent = passState->widthWithoutExtent;
 
     winrt::Windows::Foundation::Rect newRect = rect;
     newRect.Height /= g_settings.rows;
@@ -614,6 +650,10 @@ HRESULT WINAPI TaskbarCollapsibleLayoutXamlTraits_ArrangeOverride_Hook(
         return true;
     }();
 
+    ArrangePassState passState{};
+    ArrangePassState* previousPassState = g_arrangePassState;
+    g_arrangePassState = &passState;
+
     g_inTaskbarCollapsibleLayoutXamlTraits_ArrangeOverride = true;
 
     HRESULT ret = TaskbarCollapsibleLayoutXamlTraits_ArrangeOverride_Original(
@@ -621,6 +661,8 @@ HRESULT WINAPI TaskbarCollapsibleLayoutXamlTraits_ArrangeOverride_Hook(
 
     g_inTaskbarCollapsibleLayoutXamlTraits_ArrangeOverride = false;
 
+    g_arrangePassState = previousPassState;
+
     return ret;
 }
 
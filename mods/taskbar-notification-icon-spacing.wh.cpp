@@ -2,7 +2,7 @@
 // @id              taskbar-notification-icon-spacing
 // @name            Taskbar tray icon spacing and grid
 // @description     Reduce or increase the spacing between tray icons on the taskbar, optionally have a grid of tray icons (Windows 11 only)
-// @version         1.2
+// @version         1.2.1
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -72,7 +72,7 @@ versions check out [7+ Taskbar Tweaker](https://tweaker.ramensoftware.com/).
 #include <windhawk_utils.h>
 
 #include <atomic>
-#include <functional>
+#include <initializer_list>
 #include <list>
 
 #undef GetCurrentTime
@@ -103,6 +103,14 @@ std::list<FrameworkElementLoadedEventRevoker> g_autoRevokerList;
 winrt::weak_ref<FrameworkElement> g_notificationAreaIconsStackPanel;
 winrt::weak_ref<FrameworkElement> g_overflowRootGrid;
 
+// The SystemTrayFrameGrid element, along with the elements it was resolved
+// from. Revalidated by checking that the chain of parents is unchanged.
+struct {
+    winrt::weak_ref<FrameworkElement> root;
+    winrt::weak_ref<FrameworkElement> systemTrayFrame;
+    winrt::weak_ref<FrameworkElement> systemTrayFrameGrid;
+} g_systemTrayFrameGridCache;
+
 HWND FindCurrentProcessTaskbarWnd() {
     HWND hTaskbarWnd = nullptr;
 
@@ -154,9 +162,8 @@ bool IsChildOfElementByClassName(FrameworkElement element, PCWSTR className) {
     }
 }
 
-FrameworkElement EnumChildElements(
-    FrameworkElement element,
-    std::function<bool(FrameworkElement)> enumCallback) {
+template <typename F>
+FrameworkElement EnumChildElements(FrameworkElement element, F&& enumCallback) {
     int childrenCount = Media::VisualTreeHelper::GetChildrenCount(element);
 
     for (int i = 0; i < childrenCount; i++) {
@@ -188,6 +195,60 @@ FrameworkElement FindChildByClassName(FrameworkElement element,
     });
 }
 
+// Descends the tree along the given path. Each step is a class name, or an
+// element name if prefixed with '#'.
+FrameworkElement FindChildByPath(FrameworkElement element,
+                                 std::initializer_list<PCWSTR> path) {
+    for (PCWSTR step : path) {
+        if (!element) {
+            break;
+        }
+
+        if (step[0] == L'#') {
+            element = FindChildByName(element, step + 1);
+        } else {
+            element = FindChildByClassName(element, step);
+        }
+    }
+
+    return element;
+}
+
+bool IsParentElement(FrameworkElement element, FrameworkElement parent) {
+    return Media::VisualTreeHelper::GetParent(element) == parent;
+}
+
+FrameworkElement FindSystemTrayFrameGrid(FrameworkElement root) {
+    auto& cache = g_systemTrayFrameGridCache;
+
+    if (auto systemTrayFrameGrid = cache.systemTrayFrameGrid.get()) {
+        auto systemTrayFrame = cache.systemTrayFrame.get();
+        if (systemTrayFrame && cache.root.get() == root &&
+            IsParentElement(systemTrayFrame, root) &&
+            IsParentElement(systemTrayFrameGrid, systemTrayFrame)) {
+            return systemTrayFrameGrid;
+        }
+    }
+
+    auto systemTrayFrame =
+        FindChildByClassName(root, L"SystemTray.SystemTrayFrame");
+    if (!systemTrayFrame) {
+        return nullptr;
+    }
+
+    auto systemTrayFrameGrid =
+        FindChildByName(systemTrayFrame, L"SystemTrayFrameGrid");
+    if (!systemTrayFrameGrid) {
+        return nullptr;
+    }
+
+    cache.root = root;
+    cache.systemTrayFrame = systemTrayFrame;
+    cache.systemTrayFrameGrid = systemTrayFrameGrid;
+
+    return systemTrayFrameGrid;
+}
+
 void ApplyNotifyIconViewOverflowStyle(FrameworkElement notifyIconViewElement,
                                       int width) {
     Wh_Log(L"Setting MinWidth=%d for NotifyIconView (overflow)", width);
@@ -196,10 +257,10 @@ void ApplyNotifyIconViewOverflowStyle(FrameworkElement notifyIconViewElement,
     Wh_Log(L"Setting Height=%d for NotifyIconView (overflow)", width);
     notifyIconViewElement.Height(width);
 
-    FrameworkElement child = notifyIconViewElement;
-    if ((child = FindChildByName(child, L"ContainerGrid")) &&
-        (child = FindChildByName(child, L"ContentPresenter")) &&
-        (child = FindChildByName(child, L"ContentGrid"))) {
+    FrameworkElement child = FindChildByPath(
+        notifyIconViewElement,
+        {L"#ContainerGrid", L"#ContentPresenter", L"#ContentGrid"});
+    if (child) {
         EnumChildElements(child, [](FrameworkElement child) {
             auto className = winrt::get_class_name(child);
             if (className == L"SystemTray.ImageIconContent") {
@@ -224,10 +285,10 @@ void ApplyNotifyIconViewStyle(FrameworkElement notifyIconViewElement,
     Wh_Log(L"Setting MinWidth=%d for NotifyIconView", width);
     notifyIconViewElement.MinWidth(width);
 
-    FrameworkElement child = notifyIconViewElement;
-    if ((child = FindChildByName(child, L"ContainerGrid")) &&
-        (child = FindChildByName(child, L"ContentPresenter")) &&
-        (child = FindChildByName(child, L"ContentGrid"))) {
+    FrameworkElement child = FindChildByPath(
+        notifyIconViewElement,
+        {L"#ContainerGrid", L"#ContentPresenter", L"#ContentGrid"});
+    if (child) {
         EnumChildElements(child, [width](FrameworkElement child) {
             auto className = winrt::get_class_name(child);
             if (className == L"SystemTray.TextIconContent" ||
@@ -342,11 +403,11 @@ bool ApplyNotifyIconsStyle(FrameworkElement notificationAreaIcons,
                            int width) {
     FrameworkElement stackPanel = nullptr;
 
-    FrameworkElement child = notificationAreaIcons;
-    if ((child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.ItemsPresenter")) &&
-        (child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.StackPanel"))) {
+    FrameworkElement child =
+        FindChildByPath(notificationAreaIcons,
+                        {L"Windows.UI.Xaml.Controls.ItemsPresenter",
+                         L"Windows.UI.Xaml.Controls.StackPanel"});
+    if (child) {
         stackPanel = child;
     }
 
@@ -382,11 +443,11 @@ void ApplySystemTrayIconStyle(FrameworkElement systemTrayIconElement,
                               int width) {
     Wh_Log(L"Setting width %d for SystemTrayIcon", width);
 
-    FrameworkElement child = systemTrayIconElement;
-    if ((child = FindChildByName(child, L"ContainerGrid")) &&
-        (child = FindChildByName(child, L"ContentGrid")) &&
-        (child = FindChildByClassName(child, L"SystemTray.TextIconContent")) &&
-        (child = FindChildByName(child, L"ContainerGrid"))) {
+    FrameworkElement child =
+        FindChildByPath(systemTrayIconElement,
+                        {L"#ContainerGrid", L"#ContentGrid",
+                         L"SystemTray.TextIconContent", L"#ContainerGrid"});
+    if (child) {
         auto childControl = child.try_as<Controls::Grid>();
         if (childControl) {
             int newPadding = 4;
@@ -413,14 +474,12 @@ bool ApplyControlCenterButtonStyle(FrameworkElement controlCenterButton,
                                    int width) {
     FrameworkElement stackPanel = nullptr;
 
-    FrameworkElement child = controlCenterButton;
-    if ((child =
-             FindChildByClassName(child, L"Windows.UI.Xaml.Controls.Grid")) &&
-        (child = FindChildByName(child, L"ContentPresenter")) &&
-        (child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.ItemsPresenter")) &&
-        (child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.StackPanel"))) {
+    FrameworkElement child =
+        FindChildByPath(controlCenterButton,
+                        {L"Windows.UI.Xaml.Controls.Grid", L"#ContentPresenter",
+                         L"Windows.UI.Xaml.Controls.ItemsPresenter",
+                         L"Windows.UI.Xaml.Controls.StackPanel"});
+    if (child) {
         stackPanel = child;
     }
 
@@ -455,13 +514,11 @@ bool ApplyIconStackStyle(PCWSTR containerName,
                          int width) {
     FrameworkElement stackPanel = nullptr;
 
-    FrameworkElement child = container;
-    if ((child = FindChildByName(child, L"Content")) &&
-        (child = FindChildByName(child, L"IconStack")) &&
-        (child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.ItemsPresenter")) &&
-        (child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.StackPanel"))) {
+    FrameworkElement child =
+        FindChildByPath(container, {L"#Content", L"#IconStack",
+                                    L"Windows.UI.Xaml.Controls.ItemsPresenter",
+                                    L"Windows.UI.Xaml.Controls.StackPanel"});
+    if (child) {
         stackPanel = child;
     }
 
@@ -507,11 +564,9 @@ bool ApplyIconStackStyle(PCWSTR containerName,
 bool ApplyStyle(XamlRoot xamlRoot, int rows, int width) {
     FrameworkElement systemTrayFrameGrid = nullptr;
 
-    FrameworkElement child = xamlRoot.Content().try_as<FrameworkElement>();
-    if (child &&
-        (child = FindChildByClassName(child, L"SystemTray.SystemTrayFrame")) &&
-        (child = FindChildByName(child, L"SystemTrayFrameGrid"))) {
-        systemTrayFrameGrid = child;
+    FrameworkElement root = xamlRoot.Content().try_as<FrameworkElement>();
+    if (root) {
+        systemTrayFrameGrid = FindSystemTrayFrameGrid(root);
     }
 
     if (!systemTrayFrameGrid) {
@@ -627,13 +682,12 @@ void* WINAPI IconView_IconView_Hook(void* pThis) {
 void ApplyOverflowStyle(FrameworkElement overflowRootGrid) {
     Controls::WrapGrid wrapGrid = nullptr;
 
-    FrameworkElement child = overflowRootGrid;
-    if ((child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.ItemsControl")) &&
-        (child = FindChildByClassName(
-             child, L"Windows.UI.Xaml.Controls.ItemsPresenter")) &&
-        (child = FindChildByClassName(child,
-                                      L"Windows.UI.Xaml.Controls.WrapGrid"))) {
+    FrameworkElement child =
+        FindChildByPath(overflowRootGrid,
+                        {L"Windows.UI.Xaml.Controls.ItemsControl",
+                         L"Windows.UI.Xaml.Controls.ItemsPresenter",
+                         L"Windows.UI.Xaml.Controls.WrapGrid"});
+    if (child) {
         wrapGrid = child.try_as<Controls::WrapGrid>();
     }
 
@@ -2,7 +2,7 @@
 // @id              taskbar-on-top
 // @name            Taskbar on top for Windows 11
 // @description     Moves the Windows 11 taskbar to the top of the screen
-// @version         1.1.4
+// @version         1.1.5
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -79,6 +79,8 @@ versions weren't tested and are probably not compatible.
 #include <atomic>
 #include <functional>
 #include <list>
+#include <mutex>
+#include <unordered_map>
 
 #ifdef _M_ARM64
 #include <regex>
@@ -252,12 +254,66 @@ std::optional<bool> IsOsFeatureEnabled(UINT32 featureId) {
     return std::nullopt;
 }
 
-bool GetMonitorRect(HMONITOR monitor, RECT* rc) {
+struct MonitorGeometry {
+    RECT rect;
+    UINT dpiX;
+    UINT dpiY;
+};
+
+// Monitor rects and DPIs, which are queried for every taskbar position
+// adjustment. Cleared by the taskbar window procedure when the display
+// configuration, DPI or settings change.
+std::mutex g_monitorGeometryCacheMutex;
+std::unordered_map<HMONITOR, MonitorGeometry> g_monitorGeometryCache;
+constexpr size_t kMonitorGeometryCacheMaxSize = 64;
+
+void ClearMonitorGeometryCache() {
+    std::lock_guard<std::mutex> guard(g_monitorGeometryCacheMutex);
+    g_monitorGeometryCache.clear();
+}
+
+bool GetMonitorGeometry(HMONITOR monitor, MonitorGeometry* geometry) {
+    {
+        std::lock_guard<std::mutex> guard(g_monitorGeometryCacheMutex);
+        auto it = g_monitorGeometryCache.find(monitor);
+        if (it != g_monitorGeometryCache.end()) {
+            *geometry = it->second;
+            return true;
+        }
+    }
+
     MONITORINFO monitorInfo{
         .cbSize = sizeof(MONITORINFO),
     };
-    return GetMonitorInfo(monitor, &monitorInfo) &&
-           CopyRect(rc, &monitorInfo.rcMonitor);
+    if (!GetMonitorInfo(monitor, &monitorInfo)) {
+        return false;
+    }
+
+    geometry->rect = monitorInfo.rcMonitor;
+    geometry->dpiX = 96;
+    geometry->dpiY = 96;
+    GetDpiForMonitor(monitor, MDT_DEFAULT, &geometry->dpiX, &geometry->dpiY);
+
+    std::lock_guard<std::mutex> guard(g_monitorGeometryCacheMutex);
+    if (g_monitorGeometryCache.size() >= kMonitorGeometryCacheMaxSize) {
+        g_monitorGeometryCache.clear();
+    }
+    g_monitorGeometryCache[monitor] = *geometry;
+    return true;
+}
+
+bool GetMonitorRect(HMONITOR monitor, RECT* rc) {
+    MonitorGeometry geometry;
+    return GetMonitorGeometry(monitor, &geometry) &&
+           CopyRect(rc, &geometry.rect);
+}
+
+void GetMonitorDpi(HMONITOR monitor, UINT* dpiX, UINT* dpiY) {
+    MonitorGeometry geometry;
+    if (GetMonitorGeometry(monitor, &geometry)) {
+        *dpiX = geometry.dpiX;
+        *dpiY = geometry.dpiY;
+    }
 }
 
 HWND FindCurrentProcessTaskbarWnd() {
@@ -401,7 +457,7 @@ DWORD WINAPI TrayUI_GetDockedRect_Hook(void* pThis, RECT* rect, BOOL param2) {
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     int height = rect->bottom - rect->top;
 
@@ -446,7 +502,7 @@ void WINAPI TrayUI_MakeStuckRect_Hook(void* pThis,
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     int height = rect->bottom - rect->top;
 
@@ -490,6 +546,12 @@ void TaskbarWndProcPreProcess(HWND hWnd,
                               WPARAM* wParam,
                               LPARAM* lParam) {
     switch (Msg) {
+        case WM_DISPLAYCHANGE:
+        case WM_DPICHANGED:
+        case WM_SETTINGCHANGE:
+            ClearMonitorGeometryCache();
+            break;
+
         case 0x5C3: {
             // On Windows 11 23H2, setting the taskbar location here also causes
             // the start menu to be opened on the left of the screen, even if
@@ -743,7 +805,7 @@ void* WINAPI XamlExplorerHostWindow_XamlExplorerHostWindow_Hook(
             GetMonitorInfo(monitor, &monitorInfo);
             UINT monitorDpiX = 96;
             UINT monitorDpiY = 96;
-            GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+            GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
             winrt::Windows::Foundation::Rect rectNew = *rect;
             rectNew.Y = monitorInfo.rcWork.top + MulDiv(12, monitorDpiY, 96);
@@ -1288,7 +1350,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
 
         UINT monitorDpiX = 96;
         UINT monitorDpiY = 96;
-        GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+        GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
         if (g_inCTaskListThumbnailWnd_DisplayUI) {
             Y = monitorInfo.rcWork.top + MulDiv(12, monitorDpiY, 96);
@@ -1323,7 +1385,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
 
         UINT monitorDpiX = 96;
         UINT monitorDpiY = 96;
-        GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+        GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
         bool adjusted = false;
 
@@ -1418,8 +1480,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                          L"XamlExplorerHostIslandWindow") == 0) {
                 UINT monitorDpiX = 96;
                 UINT monitorDpiY = 96;
-                GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX,
-                                 &monitorDpiY);
+                GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
                 int overflowHeight = MulDiv(54 + 12, monitorDpiY, 96);
 
@@ -1498,7 +1559,7 @@ BOOL WINAPI MoveWindow_Hook(HWND hWnd,
 
         UINT monitorDpiX = 96;
         UINT monitorDpiY = 96;
-        GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+        GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
         Y = monitorInfo.rcWork.top + MulDiv(12, monitorDpiY, 96);
     } else {
@@ -1578,7 +1639,7 @@ int WINAPI MapWindowPoints_Hook(HWND hWndFrom,
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     int flyoutHeight = MulDiv(flyoutPositionSize.Height, monitorDpiY, 96);
 
@@ -1684,7 +1745,7 @@ HRESULT WINAPI DwmSetWindowAttribute_Hook(HWND hwnd,
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     RECT targetRect;
     if (!GetWindowRect(hwnd, &targetRect)) {
@@ -2,14 +2,14 @@
 // @id              taskbar-scroll-actions
 // @name            Taskbar Scroll Actions
 // @description     Assign actions for scrolling over the taskbar, including virtual desktop switching and monitor brightness control
-// @version         1.1
+// @version         1.1.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
 // @homepage        https://m417z.com/
 // @include         explorer.exe
 // @architecture    x86-64
-// @compilerOptions -lcomctl32 -lgdi32 -lole32 -loleaut32 -lversion
+// @compilerOptions -lcomctl32 -ldxva2 -lgdi32 -lole32 -loleaut32 -lversion
 // ==/WindhawkMod==
 
 // Source code is published under The GNU General Public License v3.0.
@@ -87,12 +87,17 @@ issue](https://tweaker.userecho.com/topics/826-scroll-on-trackpadtouchpad-doesnt
 #include <commctrl.h>
 #include <comutil.h>
 #include <endpointvolume.h>
+#include <highlevelmonitorconfigurationapi.h>
 #include <mmdeviceapi.h>
+#include <physicalmonitorenumerationapi.h>
 #include <psapi.h>
 #include <wbemcli.h>
 #include <windowsx.h>
 
+#include <algorithm>
+#include <atomic>
 #include <unordered_set>
+#include <vector>
 
 enum class ScrollAction {
     virtualDesktopSwitch,
@@ -177,6 +182,12 @@ UINT GetDpiForWindowWithFallback(HWND hWnd) {
 }
 
 bool IsTaskbarWindow(HWND hWnd) {
+    // Checked for each wheel message, skip the class name lookup for the
+    // main taskbar.
+    if (hWnd && hWnd == g_hTaskbarWnd) {
+        return true;
+    }
+
     WCHAR szClassName[32];
     if (!GetClassName(hWnd, szClassName, ARRAYSIZE(szClassName))) {
         return false;
@@ -207,10 +218,25 @@ HWND FindCurrentProcessTaskbarWnd() {
     return hTaskbarWnd;
 }
 
+// The notification area window of the main taskbar, looked up again only if
+// it's gone.
+HWND g_hTrayNotifyWnd;
+
+HWND GetTrayNotifyWnd(HWND hTaskbarWnd) {
+    HWND hTrayNotifyWnd = g_hTrayNotifyWnd;
+    if (!hTrayNotifyWnd || !IsWindow(hTrayNotifyWnd) ||
+        GetParent(hTrayNotifyWnd) != hTaskbarWnd) {
+        hTrayNotifyWnd =
+            FindWindowEx(hTaskbarWnd, NULL, L"TrayNotifyWnd", NULL);
+        g_hTrayNotifyWnd = hTrayNotifyWnd;
+    }
+
+    return hTrayNotifyWnd;
+}
+
 bool GetNotificationAreaRect(HWND hMMTaskbarWnd, RECT* rcResult) {
     if (hMMTaskbarWnd == g_hTaskbarWnd) {
-        HWND hTrayNotifyWnd =
-            FindWindowEx(hMMTaskbarWnd, NULL, L"TrayNotifyWnd", NULL);
+        HWND hTrayNotifyWnd = GetTrayNotifyWnd(hMMTaskbarWnd);
         if (hTrayNotifyWnd && GetWindowRect(hTrayNotifyWnd, rcResult) &&
             !IsRectEmpty(rcResult)) {
             return true;
@@ -413,317 +439,351 @@ BOOL WindowsVersionInit() {
 // Reference:
 // https://github.com/stefankueng/tools/blob/e7cd50c6ac3a50f6dac84c6aace519349164155e/Misc/AAClr/src/Utils.cpp
 
-int GetBrightness() {
-    int ret = -1;
+// Querying and changing the brightness can take hundreds of milliseconds, so
+// it's done on a dedicated thread which keeps the WMI connection alive. Scroll
+// clicks which arrive while a change is in progress are accumulated and applied
+// at once. If WMI brightness control isn't available, e.g. for external
+// monitors, DDC/CI is used instead.
 
-    IWbemLocator* pLocator = NULL;
-    IWbemServices* pNamespace = 0;
-    IEnumWbemClassObject* pEnum = NULL;
-    HRESULT hr = S_OK;
+HANDLE g_brightnessThread;
+HANDLE g_brightnessEvent;
+std::atomic<bool> g_brightnessThreadStop;
+std::atomic<int> g_brightnessPendingClicks;
+std::atomic<HMONITOR> g_brightnessMonitor;
 
-    BSTR path = SysAllocString(L"root\\wmi");
-    BSTR ClassPath = SysAllocString(L"WmiMonitorBrightness");
-    BSTR bstrQuery = SysAllocString(L"Select * from WmiMonitorBrightness");
+// Only accessed by the brightness thread.
+IWbemServices* g_wmiNamespace;
+IWbemClassObject* g_wmiSetBrightnessInParams;
+std::vector<_bstr_t> g_wmiBrightnessMethodsPaths;
 
-    if (!path || !ClassPath) {
-        goto cleanup;
-    }
+void WmiBrightnessUninit() {
+    g_wmiBrightnessMethodsPaths.clear();
 
-    // Initialize COM and connect up to CIMOM
+    if (g_wmiSetBrightnessInParams) {
+        g_wmiSetBrightnessInParams->Release();
+        g_wmiSetBrightnessInParams = NULL;
+    }
 
-    hr = CoInitialize(0);
-    if (FAILED(hr)) {
-        goto cleanup;
+    if (g_wmiNamespace) {
+        g_wmiNamespace->Release();
+        g_wmiNamespace = NULL;
     }
+}
 
-    //  NOTE:
-    //  When using asynchronous WMI API's remotely in an environment where the
-    //  "Local System" account has no network identity (such as non-Kerberos
-    //  domains), the authentication level of RPC_C_AUTHN_LEVEL_NONE is needed.
-    //  However, lowering the authentication level to RPC_C_AUTHN_LEVEL_NONE
-    //  makes your application less secure. It is wise to
-    // use semi-synchronous API's for accessing WMI data and events instead of
-    // the asynchronous ones.
+bool WmiBrightnessInit() {
+    bool bRet = false;
 
-    hr = CoInitializeSecurity(
-        NULL, -1, NULL, NULL, RPC_C_AUTHN_LEVEL_PKT_PRIVACY,
-        RPC_C_IMP_LEVEL_IMPERSONATE, NULL,
-        EOAC_SECURE_REFS,  // change to EOAC_NONE if you change dwAuthnLevel to
-                           // RPC_C_AUTHN_LEVEL_NONE
-        NULL);
+    IWbemLocator* pLocator = NULL;
+    IWbemClassObject* pClass = NULL;
+    IWbemClassObject* pInClass = NULL;
+    IEnumWbemClassObject* pEnum = NULL;
+    HRESULT hr = S_OK;
 
     hr = CoCreateInstance(CLSID_WbemLocator, 0, CLSCTX_INPROC_SERVER,
                           IID_IWbemLocator, (LPVOID*)&pLocator);
     if (FAILED(hr)) {
         goto cleanup;
     }
-    hr = pLocator->ConnectServer(path, NULL, NULL, NULL, 0, NULL, NULL,
-                                 &pNamespace);
+
+    hr = pLocator->ConnectServer(_bstr_t(L"root\\wmi"), NULL, NULL, NULL, 0,
+                                 NULL, NULL, &g_wmiNamespace);
     if (hr != WBEM_S_NO_ERROR) {
+        g_wmiNamespace = NULL;
         goto cleanup;
     }
 
-    hr = CoSetProxyBlanket(pNamespace, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE,
+    hr = CoSetProxyBlanket(g_wmiNamespace, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE,
                            NULL, RPC_C_AUTHN_LEVEL_PKT,
                            RPC_C_IMP_LEVEL_IMPERSONATE, NULL, EOAC_NONE);
+    if (hr != WBEM_S_NO_ERROR) {
+        goto cleanup;
+    }
 
+    // Get the input arguments of the method, they're reused for each call.
+    hr = g_wmiNamespace->GetObject(_bstr_t(L"WmiMonitorBrightnessMethods"), 0,
+                                   NULL, &pClass, NULL);
     if (hr != WBEM_S_NO_ERROR) {
         goto cleanup;
     }
 
-    hr = pNamespace->ExecQuery(
-        _bstr_t(L"WQL"),               // Query Language
-        bstrQuery,                     // Query to Execute
-        WBEM_FLAG_RETURN_IMMEDIATELY,  // Make a semi-synchronous call
-        NULL,                          // Context
-        &pEnum                         // Enumeration Interface
-    );
+    hr = pClass->GetMethod(L"WmiSetBrightness", 0, &pInClass, NULL);
+    if (hr != WBEM_S_NO_ERROR) {
+        goto cleanup;
+    }
 
+    hr = pInClass->SpawnInstance(0, &g_wmiSetBrightnessInParams);
     if (hr != WBEM_S_NO_ERROR) {
+        g_wmiSetBrightnessInParams = NULL;
         goto cleanup;
     }
 
-    hr = WBEM_S_NO_ERROR;
+    hr = g_wmiNamespace->ExecQuery(
+        _bstr_t(L"WQL"),
+        _bstr_t(L"Select * from WmiMonitorBrightnessMethods"),
+        WBEM_FLAG_RETURN_IMMEDIATELY | WBEM_FLAG_FORWARD_ONLY, NULL, &pEnum);
+    if (hr != WBEM_S_NO_ERROR) {
+        pEnum = NULL;
+        goto cleanup;
+    }
 
-    while (WBEM_S_NO_ERROR == hr) {
+    while (true) {
         ULONG ulReturned;
         IWbemClassObject* pObj;
 
-        // Get the Next Object from the collection
-        hr = pEnum->Next(WBEM_INFINITE,  // Timeout
-                         1,              // No of objects requested
-                         &pObj,          // Returned Object
-                         &ulReturned     // No of object returned
-        );
-
+        hr = pEnum->Next(WBEM_INFINITE, 1, &pObj, &ulReturned);
         if (hr != WBEM_S_NO_ERROR) {
-            goto cleanup;
+            break;
         }
 
-        VARIANT var1;
-        hr = pObj->Get(_bstr_t(L"CurrentBrightness"), 0, &var1, NULL, NULL);
-
-        ret = V_UI1(&var1);
+        VARIANT pathVariable;
+        VariantInit(&pathVariable);
 
-        VariantClear(&var1);
-        if (hr != WBEM_S_NO_ERROR) {
-            goto cleanup;
+        hr = pObj->Get(L"__PATH", 0, &pathVariable, NULL, NULL);
+        if (hr == WBEM_S_NO_ERROR && V_VT(&pathVariable) == VT_BSTR) {
+            g_wmiBrightnessMethodsPaths.push_back(V_BSTR(&pathVariable));
         }
-    }
 
-    // Free up resources
-cleanup:
+        VariantClear(&pathVariable);
+        pObj->Release();
+    }
 
-    SysFreeString(path);
-    SysFreeString(ClassPath);
-    SysFreeString(bstrQuery);
+    bRet = !g_wmiBrightnessMethodsPaths.empty();
 
+cleanup:
+    if (pEnum)
+        pEnum->Release();
+    if (pInClass)
+        pInClass->Release();
+    if (pClass)
+        pClass->Release();
     if (pLocator)
         pLocator->Release();
-    if (pNamespace)
-        pNamespace->Release();
 
-    CoUninitialize();
+    if (!bRet) {
+        WmiBrightnessUninit();
+    }
 
-    return ret;
+    return bRet;
 }
 
-bool SetBrightness(int val) {
-    bool bRet = true;
+int WmiGetBrightness() {
+    int ret = -1;
 
-    IWbemLocator* pLocator = NULL;
-    IWbemServices* pNamespace = 0;
-    IWbemClassObject* pClass = NULL;
-    IWbemClassObject* pInClass = NULL;
-    IWbemClassObject* pInInst = NULL;
     IEnumWbemClassObject* pEnum = NULL;
-    HRESULT hr = S_OK;
+    HRESULT hr = g_wmiNamespace->ExecQuery(
+        _bstr_t(L"WQL"), _bstr_t(L"Select * from WmiMonitorBrightness"),
+        WBEM_FLAG_RETURN_IMMEDIATELY | WBEM_FLAG_FORWARD_ONLY, NULL, &pEnum);
+    if (hr != WBEM_S_NO_ERROR) {
+        return -1;
+    }
 
-    BSTR path = SysAllocString(L"root\\wmi");
-    BSTR ClassPath = SysAllocString(L"WmiMonitorBrightnessMethods");
-    BSTR MethodName = SysAllocString(L"WmiSetBrightness");
-    BSTR ArgName0 = SysAllocString(L"Timeout");
-    BSTR ArgName1 = SysAllocString(L"Brightness");
-    BSTR bstrQuery =
-        SysAllocString(L"Select * from WmiMonitorBrightnessMethods");
+    while (true) {
+        ULONG ulReturned;
+        IWbemClassObject* pObj;
 
-    if (!path || !ClassPath || !MethodName || !ArgName0) {
-        bRet = false;
-        goto cleanup;
-    }
+        hr = pEnum->Next(WBEM_INFINITE, 1, &pObj, &ulReturned);
+        if (hr != WBEM_S_NO_ERROR) {
+            break;
+        }
 
-    // Initialize COM and connect up to CIMOM
+        VARIANT var1;
+        hr = pObj->Get(L"CurrentBrightness", 0, &var1, NULL, NULL);
+        if (hr == WBEM_S_NO_ERROR) {
+            ret = V_UI1(&var1);
+        }
 
-    hr = CoInitialize(0);
-    if (FAILED(hr)) {
-        bRet = false;
-        goto cleanup;
+        VariantClear(&var1);
+        pObj->Release();
     }
 
-    //  NOTE:
-    //  When using asynchronous WMI API's remotely in an environment where the
-    //  "Local System" account has no network identity (such as non-Kerberos
-    //  domains), the authentication level of RPC_C_AUTHN_LEVEL_NONE is needed.
-    //  However, lowering the authentication level to RPC_C_AUTHN_LEVEL_NONE
-    //  makes your application less secure. It is wise to
-    // use semi-synchronous API's for accessing WMI data and events instead of
-    // the asynchronous ones.
+    pEnum->Release();
 
-    hr = CoInitializeSecurity(
-        NULL, -1, NULL, NULL, RPC_C_AUTHN_LEVEL_PKT_PRIVACY,
-        RPC_C_IMP_LEVEL_IMPERSONATE, NULL,
-        EOAC_SECURE_REFS,  // change to EOAC_NONE if you change dwAuthnLevel to
-                           // RPC_C_AUTHN_LEVEL_NONE
-        NULL);
+    return ret;
+}
 
-    hr = CoCreateInstance(CLSID_WbemLocator, 0, CLSCTX_INPROC_SERVER,
-                          IID_IWbemLocator, (LPVOID*)&pLocator);
-    if (FAILED(hr)) {
-        bRet = false;
-        goto cleanup;
-    }
-    hr = pLocator->ConnectServer(path, NULL, NULL, NULL, 0, NULL, NULL,
-                                 &pNamespace);
-    if (hr != WBEM_S_NO_ERROR) {
-        bRet = false;
-        goto cleanup;
-    }
+bool WmiSetBrightness(int val) {
+    HRESULT hr;
 
-    hr = CoSetProxyBlanket(pNamespace, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE,
-                           NULL, RPC_C_AUTHN_LEVEL_PKT,
-                           RPC_C_IMP_LEVEL_IMPERSONATE, NULL, EOAC_NONE);
+    VARIANT var1;
+    VariantInit(&var1);
 
+    V_VT(&var1) = VT_BSTR;
+    V_BSTR(&var1) = SysAllocString(L"0");
+    hr = g_wmiSetBrightnessInParams->Put(L"Timeout", 0, &var1, CIM_UINT32);
+    VariantClear(&var1);
     if (hr != WBEM_S_NO_ERROR) {
-        bRet = false;
-        goto cleanup;
+        return false;
     }
 
-    hr = pNamespace->ExecQuery(
-        _bstr_t(L"WQL"),               // Query Language
-        bstrQuery,                     // Query to Execute
-        WBEM_FLAG_RETURN_IMMEDIATELY,  // Make a semi-synchronous call
-        NULL,                          // Context
-        &pEnum                         // Enumeration Interface
-    );
+    VARIANT var;
+    VariantInit(&var);
 
+    V_VT(&var) = VT_BSTR;
+    WCHAR buf[10] = {0};
+    swprintf_s(buf, _countof(buf), L"%d", val);
+    V_BSTR(&var) = SysAllocString(buf);
+    hr = g_wmiSetBrightnessInParams->Put(L"Brightness", 0, &var, CIM_UINT8);
+    VariantClear(&var);
     if (hr != WBEM_S_NO_ERROR) {
-        bRet = false;
-        goto cleanup;
+        return false;
     }
 
-    hr = WBEM_S_NO_ERROR;
-
-    while (WBEM_S_NO_ERROR == hr) {
-        ULONG ulReturned;
-        IWbemClassObject* pObj;
-
-        // Get the Next Object from the collection
-        hr = pEnum->Next(WBEM_INFINITE,  // Timeout
-                         1,              // No of objects requested
-                         &pObj,          // Returned Object
-                         &ulReturned     // No of object returned
-        );
+    bool bRet = true;
 
+    for (const auto& path : g_wmiBrightnessMethodsPaths) {
+        hr = g_wmiNamespace->ExecMethod(path, _bstr_t(L"WmiSetBrightness"), 0,
+                                        NULL, g_wmiSetBrightnessInParams, NULL,
+                                        NULL);
         if (hr != WBEM_S_NO_ERROR) {
             bRet = false;
-            goto cleanup;
         }
+    }
 
-        // Get the class object
-        hr = pNamespace->GetObject(ClassPath, 0, NULL, &pClass, NULL);
-        if (hr != WBEM_S_NO_ERROR) {
-            bRet = false;
-            goto cleanup;
-        }
+    return bRet;
+}
 
-        // Get the input argument and set the property
-        hr = pClass->GetMethod(MethodName, 0, &pInClass, NULL);
-        if (hr != WBEM_S_NO_ERROR) {
-            bRet = false;
-            goto cleanup;
+// The brightness of each physical monitor is changed by the given percent of
+// its range.
+bool DdcAddBrightness(HMONITOR monitor, int clicks) {
+    DWORD count;
+    if (!GetNumberOfPhysicalMonitorsFromHMONITOR(monitor, &count) || !count) {
+        return false;
+    }
+
+    std::vector<PHYSICAL_MONITOR> physicalMonitors(count);
+    if (!GetPhysicalMonitorsFromHMONITOR(monitor, count,
+                                         physicalMonitors.data())) {
+        return false;
+    }
+
+    bool bRet = false;
+
+    for (const auto& physicalMonitor : physicalMonitors) {
+        DWORD minimum, current, maximum;
+        if (!GetMonitorBrightness(physicalMonitor.hPhysicalMonitor, &minimum,
+                                  &current, &maximum) ||
+            maximum <= minimum) {
+            continue;
         }
 
-        hr = pInClass->SpawnInstance(0, &pInInst);
-        if (hr != WBEM_S_NO_ERROR) {
-            bRet = false;
-            goto cleanup;
+        int change = MulDiv(clicks, maximum - minimum, 100);
+        if (change == 0) {
+            change = clicks > 0 ? 1 : -1;
         }
 
-        VARIANT var1;
-        VariantInit(&var1);
+        int newValue = std::clamp((int)current + change, (int)minimum,
+                                  (int)maximum);
 
-        V_VT(&var1) = VT_BSTR;
-        V_BSTR(&var1) = SysAllocString(L"0");
-        hr = pInInst->Put(ArgName0, 0, &var1, CIM_UINT32);  // CIM_UINT64
+        Wh_Log(L"Changing DDC/CI brightness from %u to %d (range %u-%u)",
+               current, newValue, minimum, maximum);
 
-        // var1.vt = VT_I4;
-        // var1.ullVal = 0;
-        //    hr = pInInst->Put(ArgName0, 0, &var1, 0);
-        VariantClear(&var1);
-        if (hr != WBEM_S_NO_ERROR) {
-            bRet = false;
-            goto cleanup;
+        if (SetMonitorBrightness(physicalMonitor.hPhysicalMonitor, newValue)) {
+            bRet = true;
         }
+    }
+
+    DestroyPhysicalMonitors(count, physicalMonitors.data());
 
-        VARIANT var;
-        VariantInit(&var);
+    return bRet;
+}
 
-        V_VT(&var) = VT_BSTR;
-        WCHAR buf[10] = {0};
-        swprintf_s(buf, _countof(buf), L"%d", val);
-        V_BSTR(&var) = SysAllocString(buf);
-        hr = pInInst->Put(ArgName1, 0, &var, CIM_UINT8);
+DWORD WINAPI BrightnessThread(LPVOID lpThreadParameter) {
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    bool bComInitialized = SUCCEEDED(hr);
 
-        // var.vt=VT_UI1;
-        // var.uiVal = 100;
-        // hr = pInInst->Put(ArgName1, 0, &var, 0);
-        VariantClear(&var);
-        if (hr != WBEM_S_NO_ERROR) {
-            bRet = false;
-            goto cleanup;
+    //  NOTE:
+    //  When using asynchronous WMI API's remotely in an environment where the
+    //  "Local System" account has no network identity (such as non-Kerberos
+    //  domains), the authentication level of RPC_C_AUTHN_LEVEL_NONE is needed.
+    //  However, lowering the authentication level to RPC_C_AUTHN_LEVEL_NONE
+    //  makes your application less secure. It is wise to
+    // use semi-synchronous API's for accessing WMI data and events instead of
+    // the asynchronous ones.
+
+    CoInitializeSecurity(
+        NULL, -1, NULL, NULL, RPC_C_AUTHN_LEVEL_PKT_PRIVACY,
+        RPC_C_IMP_LEVEL_IMPERSONATE, NULL,
+        EOAC_SECURE_REFS,  // change to EOAC_NONE if you change dwAuthnLevel to
+                           // RPC_C_AUTHN_LEVEL_NONE
+        NULL);
+
+    bool bWmiInitialized = false;
+    bool bWmiAvailable = false;
+
+    while (WaitForSingleObject(g_brightnessEvent, INFINITE) == WAIT_OBJECT_0 &&
+           !g_brightnessThreadStop) {
+        int clicks = g_brightnessPendingClicks.exchange(0);
+        if (clicks == 0) {
+            continue;
         }
-        // Call the method
 
-        VARIANT pathVariable;
-        VariantInit(&pathVariable);
+        if (!bWmiInitialized) {
+            bWmiAvailable = WmiBrightnessInit();
+            bWmiInitialized = true;
 
-        hr = pObj->Get(_bstr_t(L"__PATH"), 0, &pathVariable, NULL, NULL);
-        if (hr != WBEM_S_NO_ERROR)
-            goto cleanup;
+            if (!bWmiAvailable) {
+                Wh_Log(L"WMI brightness control unavailable, using DDC/CI");
+            }
+        }
 
-        hr = pNamespace->ExecMethod(pathVariable.bstrVal, MethodName, 0, NULL,
-                                    pInInst, NULL, NULL);
-        VariantClear(&pathVariable);
-        if (hr != WBEM_S_NO_ERROR) {
-            bRet = false;
-            goto cleanup;
+        if (bWmiAvailable) {
+            int brightness = WmiGetBrightness();
+            if (brightness != -1) {
+                int newBrightness = std::clamp(brightness + clicks, 0, 100);
+                Wh_Log(L"Changing brightness from %d to %d", brightness,
+                       newBrightness);
+                WmiSetBrightness(newBrightness);
+            } else {
+                Wh_Log(L"Error getting current brightness");
+            }
+        } else if (!DdcAddBrightness(g_brightnessMonitor, clicks)) {
+            Wh_Log(L"Error changing DDC/CI brightness");
         }
     }
 
-    // Free up resources
-cleanup:
+    WmiBrightnessUninit();
 
-    SysFreeString(path);
-    SysFreeString(ClassPath);
-    SysFreeString(MethodName);
-    SysFreeString(ArgName0);
-    SysFreeString(ArgName1);
-    SysFreeString(bstrQuery);
+    if (bComInitialized) {
+        CoUninitialize();
+    }
 
-    if (pClass)
-        pClass->Release();
-    if (pInInst)
-        pInInst->Release();
-    if (pInClass)
-        pInClass->Release();
-    if (pLocator)
-        pLocator->Release();
-    if (pNamespace)
-        pNamespace->Release();
+    return 0;
+}
 
-    CoUninitialize();
+void QueueBrightnessChange(int clicks, HMONITOR monitor) {
+    if (!g_brightnessThread) {
+        if (!g_brightnessEvent) {
+            g_brightnessEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+            if (!g_brightnessEvent) {
+                return;
+            }
+        }
 
-    return bRet;
+        g_brightnessThread =
+            CreateThread(NULL, 0, BrightnessThread, NULL, 0, NULL);
+        if (!g_brightnessThread) {
+            return;
+        }
+    }
+
+    g_brightnessMonitor = monitor;
+    g_brightnessPendingClicks += clicks;
+    SetEvent(g_brightnessEvent);
+}
+
+void BrightnessUninit() {
+    if (g_brightnessThread) {
+        g_brightnessThreadStop = true;
+        SetEvent(g_brightnessEvent);
+        WaitForSingleObject(g_brightnessThread, INFINITE);
+        CloseHandle(g_brightnessThread);
+        g_brightnessThread = NULL;
+    }
+
+    if (g_brightnessEvent) {
+        CloseHandle(g_brightnessEvent);
+        g_brightnessEvent = NULL;
+    }
 }
 
 #pragma endregion  // brightness
@@ -799,68 +859,170 @@ const static GUID XIID_IAudioEndpointVolume = {
     0x841E,
     0x4546,
     {0x97, 0x22, 0x0C, 0xF7, 0x40, 0x78, 0x22, 0x9A}};
+const static GUID XIID_IMMNotificationClient = {
+    0x7991EEC9,
+    0x7E89,
+    0x4D85,
+    {0x83, 0x90, 0x6C, 0x70, 0x3C, 0xEC, 0x60, 0xC0}};
 
 bool g_bMicVolInitialized;
 IMMDeviceEnumerator* g_pDeviceEnumerator;
 
+// Activating the endpoint volume interface on every mouse wheel tick is
+// expensive, so it's kept until the default capture device changes.
+IAudioEndpointVolume* g_pMicEndpointVolume;
+std::atomic<bool> g_micEndpointVolumeOutdated;
+
+class DefaultDeviceNotificationClient : public IMMNotificationClient {
+   public:
+    // IUnknown methods
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid,
+                                             void** ppvObject) override {
+        if (IsEqualIID(riid, __uuidof(IUnknown)) ||
+            IsEqualIID(riid, XIID_IMMNotificationClient)) {
+            *ppvObject = static_cast<IMMNotificationClient*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    // A single static instance is used, no reference counting is needed.
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+
+    // IMMNotificationClient methods
+    HRESULT STDMETHODCALLTYPE
+    OnDefaultDeviceChanged(EDataFlow flow,
+                           ERole role,
+                           LPCWSTR pwstrDefaultDeviceId) override {
+        // Called on a system thread, the interface is re-activated on the next
+        // use.
+        if (flow == eCapture && role == eConsole) {
+            g_micEndpointVolumeOutdated = true;
+        }
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR pwstrDeviceId) override {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR pwstrDeviceId) override {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR pwstrDeviceId,
+                                                   DWORD dwNewState) override {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    OnPropertyValueChanged(LPCWSTR pwstrDeviceId,
+                           const PROPERTYKEY key) override {
+        return S_OK;
+    }
+};
+
+DefaultDeviceNotificationClient g_defaultDeviceNotificationClient;
+bool g_defaultDeviceNotificationClientRegistered;
+
 void MicVolInit() {
     HRESULT hr = CoCreateInstance(
         XIID_MMDeviceEnumerator, NULL, CLSCTX_INPROC_SERVER,
         XIID_IMMDeviceEnumerator, (LPVOID*)&g_pDeviceEnumerator);
-    if (FAILED(hr))
+    if (FAILED(hr)) {
         g_pDeviceEnumerator = NULL;
+        return;
+    }
+
+    hr = g_pDeviceEnumerator->RegisterEndpointNotificationCallback(
+        &g_defaultDeviceNotificationClient);
+    if (SUCCEEDED(hr)) {
+        g_defaultDeviceNotificationClientRegistered = true;
+    } else {
+        Wh_Log(L"RegisterEndpointNotificationCallback failed: %08X", hr);
+    }
+}
+
+void ReleaseMicEndpointVolume() {
+    if (g_pMicEndpointVolume) {
+        g_pMicEndpointVolume->Release();
+        g_pMicEndpointVolume = NULL;
+    }
 }
 
 void MicVolUninit() {
     if (g_pDeviceEnumerator) {
+        if (g_defaultDeviceNotificationClientRegistered) {
+            g_pDeviceEnumerator->UnregisterEndpointNotificationCallback(
+                &g_defaultDeviceNotificationClient);
+            g_defaultDeviceNotificationClientRegistered = false;
+        }
+
         g_pDeviceEnumerator->Release();
         g_pDeviceEnumerator = NULL;
     }
-}
 
-BOOL AddMicMasterVolumeLevelScalar(float fMasterVolumeAdd) {
-    IMMDevice* defaultDevice = NULL;
-    IAudioEndpointVolume* endpointVolume = NULL;
-    HRESULT hr;
-    float fMasterVolume;
-    BOOL bSuccess = FALSE;
+    ReleaseMicEndpointVolume();
+}
 
+IAudioEndpointVolume* GetMicEndpointVolume() {
     if (!g_bMicVolInitialized) {
         MicVolInit();
         g_bMicVolInitialized = true;
     }
 
-    if (g_pDeviceEnumerator) {
-        hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(eCapture, eConsole,
-                                                          &defaultDevice);
+    if (g_micEndpointVolumeOutdated.exchange(false)) {
+        ReleaseMicEndpointVolume();
+    }
+
+    if (!g_pMicEndpointVolume && g_pDeviceEnumerator) {
+        IMMDevice* defaultDevice = NULL;
+        HRESULT hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(
+            eCapture, eConsole, &defaultDevice);
         if (SUCCEEDED(hr)) {
             hr = defaultDevice->Activate(XIID_IAudioEndpointVolume,
                                          CLSCTX_INPROC_SERVER, NULL,
-                                         (LPVOID*)&endpointVolume);
-            if (SUCCEEDED(hr)) {
-                if (SUCCEEDED(endpointVolume->GetMasterVolumeLevelScalar(
-                        &fMasterVolume))) {
-                    fMasterVolume += fMasterVolumeAdd;
-
-                    if (fMasterVolume < 0.0)
-                        fMasterVolume = 0.0;
-                    else if (fMasterVolume > 1.0)
-                        fMasterVolume = 1.0;
-
-                    if (SUCCEEDED(endpointVolume->SetMasterVolumeLevelScalar(
-                            fMasterVolume, NULL))) {
-                        bSuccess = TRUE;
-                    }
-                }
-
-                endpointVolume->Release();
-            }
+                                         (LPVOID*)&g_pMicEndpointVolume);
+            if (FAILED(hr))
+                g_pMicEndpointVolume = NULL;
 
             defaultDevice->Release();
         }
     }
 
-    return bSuccess;
+    return g_pMicEndpointVolume;
+}
+
+BOOL AddMicMasterVolumeLevelScalar(float fMasterVolumeAdd) {
+    float fMasterVolume;
+
+    IAudioEndpointVolume* endpointVolume = GetMicEndpointVolume();
+    if (!endpointVolume)
+        return FALSE;
+
+    if (FAILED(endpointVolume->GetMasterVolumeLevelScalar(&fMasterVolume))) {
+        // The device might have been invalidated, re-activate next time.
+        ReleaseMicEndpointVolume();
+        return FALSE;
+    }
+
+    fMasterVolume += fMasterVolumeAdd;
+
+    if (fMasterVolume < 0.0)
+        fMasterVolume = 0.0;
+    else if (fMasterVolume > 1.0)
+        fMasterVolume = 1.0;
+
+    if (FAILED(endpointVolume->SetMasterVolumeLevelScalar(fMasterVolume,
+                                                          NULL))) {
+        ReleaseMicEndpointVolume();
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 #pragma endregion  // microphone_volume
@@ -906,14 +1068,10 @@ void InvokeScrollAction(WPARAM wParam, LPARAM lMousePosParam) {
                 break;
 
             case ScrollAction::brightnessChange: {
-                int brightness = GetBrightness();
-                if (brightness != -1) {
-                    Wh_Log(L"Changing brightness from %d to %d", brightness,
-                           brightness + clicks);
-                    SetBrightness(brightness + clicks);
-                } else {
-                    Wh_Log(L"Error getting current brightness");
-                }
+                POINT pt{GET_X_LPARAM(lMousePosParam),
+                         GET_Y_LPARAM(lMousePosParam)};
+                QueueBrightnessChange(
+                    clicks, MonitorFromPoint(pt, MONITOR_DEFAULTTONEAREST));
                 break;
             }
 
@@ -1443,6 +1601,7 @@ void Wh_ModUninit() {
     }
 
     MicVolUninit();
+    BrightnessUninit();
 }
 
 BOOL Wh_ModSettingsChanged(BOOL* bReload) {
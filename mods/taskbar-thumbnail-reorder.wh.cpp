@@ -2,7 +2,7 @@
 // @id              taskbar-thumbnail-reorder
 // @name            Taskbar Thumbnail Reorder
 // @description     Reorder taskbar thumbnails with the left mouse button
-// @version         1.1.3
+// @version         1.1.5
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -124,6 +124,11 @@ winrt::weak_ref<winrt::Windows::Foundation::IInspectable>
 
 bool g_reorderingXamlThumbnails;
 
+// The thumbnail list repeater found for the thumbnail list during the current
+// drag, so that the element tree isn't walked on each pointer move.
+winrt::weak_ref<FrameworkElement> g_dragThumbnailList;
+winrt::weak_ref<FrameworkElement> g_dragThumbnailListRepeater;
+
 FrameworkElement EnumChildElements(
     FrameworkElement element,
     std::function<bool(FrameworkElement)> enumCallback) {
@@ -229,6 +234,20 @@ bool WINAPI TaskItemFilter_IsTaskAllowed_Hook(void* pThis, void* pTaskItem) {
     return TaskItemFilter_IsTaskAllowed_Original(pThis, pTaskItem);
 }
 
+// Moves the item at indexFrom to indexTo, shifting the items in between by one
+// position, all in a single pass over the affected range.
+void MoveArrayItem(void** items, int indexFrom, int indexTo) {
+    void* item = items[indexFrom];
+    if (indexFrom < indexTo) {
+        memmove(&items[indexFrom], &items[indexFrom + 1],
+                (indexTo - indexFrom) * sizeof(void*));
+    } else {
+        memmove(&items[indexTo + 1], &items[indexTo],
+                (indexFrom - indexTo) * sizeof(void*));
+    }
+    items[indexTo] = item;
+}
+
 bool MoveTaskInTaskList(HWND hMMTaskListWnd,
                         void* lpMMTaskListLongPtr,
                         void* taskGroup,
@@ -274,12 +293,14 @@ bool MoveTaskInTaskList(HWND hMMTaskListWnd,
         return false;
     }
 
-    void* button = (void*)DPA_DeletePtr(buttonsArray, indexFrom);
-    if (!button) {
+    if (indexFrom >= buttonsArray->cpItems ||
+        indexTo >= buttonsArray->cpItems) {
         return false;
     }
 
-    DPA_InsertPtr(buttonsArray, indexTo, button);
+    // Unlike DPA_DeletePtr + DPA_InsertPtr, this doesn't shift the whole tail
+    // of the array twice, and never reallocates it.
+    MoveArrayItem((void**)buttonsArray->pArray, indexFrom, indexTo);
 
     if (g_winVersion <= WinVersion::Win10) {
         InvalidateRect(hMMTaskListWnd, nullptr, FALSE);
@@ -364,38 +385,23 @@ bool MoveTaskInGroup(void* taskGroup, void* taskItemFrom, void* taskItemTo) {
     void** taskItems = (void**)taskItemsArray->pArray;
 
     int indexFrom = -1;
-    for (int i = 0; i < taskItemsCount; i++) {
-        if (taskItems[i] == taskItemFrom) {
+    int indexTo = -1;
+    for (int i = 0;
+         i < taskItemsCount && (indexFrom == -1 || indexTo == -1); i++) {
+        if (indexFrom == -1 && taskItems[i] == taskItemFrom) {
             indexFrom = i;
-            break;
         }
-    }
-
-    if (indexFrom == -1) {
-        return false;
-    }
 
-    int indexTo = -1;
-    for (int i = 0; i < taskItemsCount; i++) {
-        if (taskItems[i] == taskItemTo) {
+        if (indexTo == -1 && taskItems[i] == taskItemTo) {
             indexTo = i;
-            break;
         }
     }
 
-    if (indexTo == -1) {
+    if (indexFrom == -1 || indexTo == -1) {
         return false;
     }
 
-    void* taskItemTemp = taskItems[indexFrom];
-    if (indexFrom < indexTo) {
-        memmove(&taskItems[indexFrom], &taskItems[indexFrom + 1],
-                (indexTo - indexFrom) * sizeof(void*));
-    } else {
-        memmove(&taskItems[indexTo + 1], &taskItems[indexTo],
-                (indexFrom - indexTo) * sizeof(void*));
-    }
-    taskItems[indexTo] = taskItemTemp;
+    MoveArrayItem(taskItems, indexFrom, indexTo);
 
     auto taskbarEnumProc = [taskGroup, taskItemFrom, taskItemTo](
                                HWND hMMTaskbarWnd, bool secondary) {
@@ -787,6 +793,8 @@ int WINAPI TaskItemThumbnailList_OnPointerMoved_Hook(void* pThis, void* pArgs) {
 
     if (!GetCapture()) {
         g_reorderingXamlThumbnails = false;
+        g_dragThumbnailList = nullptr;
+        g_dragThumbnailListRepeater = nullptr;
         return original();
     }
 
@@ -805,28 +813,36 @@ int WINAPI TaskItemThumbnailList_OnPointerMoved_Hook(void* pThis, void* pArgs) {
         return original();
     }
 
-    auto className = winrt::get_class_name(element);
-    Wh_Log(L"%s", className.c_str());
-
     FrameworkElement taskItemThumbnailListRepeater = nullptr;
 
-    if (className == L"Taskbar.TaskItemThumbnailList") {
-        taskItemThumbnailListRepeater =
-            FindChildByName(element, L"TaskItemThumbnailListRepeater");
-    } else if (className == L"Taskbar.TaskItemThumbnailScrollableList") {
-        FrameworkElement child = element;
-        if ((child = FindChildByName(
-                 child, L"TaskItemThumbnailScrollableListScrollViewer")) &&
-            (child = FindChildByName(child, L"Root")) &&
-            (child = FindChildByClassName(child,
-                                          L"Windows.UI.Xaml.Controls.Grid")) &&
-            (child = FindChildByName(child, L"ScrollContentPresenter")) &&
-            (child =
-                 FindChildByName(child, L"TaskItemThumbnailListRepeater"))) {
-            taskItemThumbnailListRepeater = child;
+    if (g_dragThumbnailList.get() == element) {
+        taskItemThumbnailListRepeater = g_dragThumbnailListRepeater.get();
+    }
+
+    // Otherwise, it was found during an earlier pointer move of the current
+    // drag.
+    if (!taskItemThumbnailListRepeater) {
+        auto className = winrt::get_class_name(element);
+        Wh_Log(L"%s", className.c_str());
+
+        if (className == L"Taskbar.TaskItemThumbnailList") {
+            taskItemThumbnailListRepeater =
+                FindChildByName(element, L"TaskItemThumbnailListRepeater");
+        } else if (className == L"Taskbar.TaskItemThumbnailScrollableList") {
+            FrameworkElement child = element;
+            if ((child = FindChildByName(
+                     child, L"TaskItemThumbnailScrollableListScrollViewer")) &&
+                (child = FindChildByName(child, L"Root")) &&
+                (child = FindChildByClassName(
+                     child, L"Windows.UI.Xaml.Controls.Grid")) &&
+                (child = FindChildByName(child, L"ScrollContentPresenter")) &&
+                (child = FindChildByName(child,
+                                         L"TaskItemThumbnailListRepeater"))) {
+                taskItemThumbnailListRepeater = child;
+            }
+        } else {
+            return original();
         }
-    } else {
-        return original();
     }
 
     if (!taskItemThumbnailListRepeater) {
@@ -834,6 +850,9 @@ int WINAPI TaskItemThumbnailList_OnPointerMoved_Hook(void* pThis, void* pArgs) {
         return original();
     }
 
+    g_dragThumbnailList = element;
+    g_dragThumbnailListRepeater = taskItemThumbnailListRepeater;
+
     Input::PointerRoutedEventArgs args = nullptr;
     ((IUnknown*)pArgs)
         ->QueryInterface(winrt::guid_of<Input::PointerRoutedEventArgs>(),
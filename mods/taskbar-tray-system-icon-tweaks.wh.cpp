@@ -2,7 +2,7 @@
 // @id              taskbar-tray-system-icon-tweaks
 // @name            Taskbar tray system icon tweaks
 // @description     Allows hiding system icons: volume, network, battery, microphone, location/GPS, Studio Effects, language bar, bell (always or when there are no new notifications), and the "Show desktop" button (hide or set width)
-// @version         1.2.3
+// @version         1.2.4
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -112,11 +112,16 @@ using FrameworkElementLoadedEventRevoker = winrt::impl::event_revoker<
 
 std::list<FrameworkElementLoadedEventRevoker> g_autoRevokerList;
 
+using FrameworkElementLayoutUpdatedEventRevoker = winrt::impl::event_revoker<
+    IFrameworkElement,
+    &winrt::impl::abi<IFrameworkElement>::type::remove_LayoutUpdated>;
+
 winrt::weak_ref<Controls::TextBlock> g_mainStackInnerTextBlock;
 int64_t g_mainStackTextChangedToken;
 
 winrt::weak_ref<FrameworkElement> g_bellSystemTrayIconElement;
 int64_t g_bellAutomationNameChangedToken;
+FrameworkElementLayoutUpdatedEventRevoker g_bellLayoutUpdatedRevoker;
 
 HWND FindCurrentProcessTaskbarWnd() {
     HWND hTaskbarWnd = nullptr;
@@ -742,28 +747,49 @@ void ApplyControlCenterButtonIconStyle(FrameworkElement systemTrayIconElement) {
 void ApplyBellIconStyle(FrameworkElement systemTrayIconElement);
 
 // When the clock is hidden, the bell icon behaves differently - its content is
-// recreated each time the bell icon changes. Therefore we retry until the
-// content is there.
-void ApplyBellIconStyleWithRetry(FrameworkElement systemTrayIconElement,
-                                 int attempt) {
-    Wh_Log(L"> %d", attempt);
+// recreated each time the bell icon changes. Therefore we wait for the next
+// layout pass in which the content is there. LayoutUpdated is raised for layout
+// passes anywhere in the tree, so the wait is given up after a while in case
+// the content doesn't show up.
+constexpr int kBellIconMaxLayoutUpdates = 100;
 
-    if (attempt == 10) {
-        return;
-    }
+void ApplyBellIconStyleWhenReady(FrameworkElement systemTrayIconElement) {
+    Wh_Log(L">");
 
-    FrameworkElement containerGrid =
-        FindChildByName(systemTrayIconElement, L"ContainerGrid");
-    if (!containerGrid) {
-        systemTrayIconElement.Dispatcher().TryRunAsync(
-            winrt::Windows::UI::Core::CoreDispatcherPriority::Low,
-            [systemTrayIconElement, attempt]() {
-                ApplyBellIconStyleWithRetry(systemTrayIconElement, attempt + 1);
-            });
+    g_bellLayoutUpdatedRevoker.revoke();
+
+    if (FindChildByName(systemTrayIconElement, L"ContainerGrid")) {
+        ApplyBellIconStyle(systemTrayIconElement);
         return;
     }
 
-    ApplyBellIconStyle(systemTrayIconElement);
+    // The sender of LayoutUpdated is always null, so the element is captured
+    // instead.
+    auto systemTrayIconElementWeakRef = winrt::make_weak(systemTrayIconElement);
+    g_bellLayoutUpdatedRevoker = systemTrayIconElement.LayoutUpdated(
+        winrt::auto_revoke_t{},
+        [systemTrayIconElementWeakRef, layoutUpdates = 0](
+            winrt::Windows::Foundation::IInspectable const& sender,
+            winrt::Windows::Foundation::IInspectable const& e) mutable {
+            auto systemTrayIconElement = systemTrayIconElementWeakRef.get();
+            if (!systemTrayIconElement) {
+                g_bellLayoutUpdatedRevoker.revoke();
+                return;
+            }
+
+            if (!FindChildByName(systemTrayIconElement, L"ContainerGrid")) {
+                if (++layoutUpdates >= kBellIconMaxLayoutUpdates) {
+                    Wh_Log(L"Bell icon content didn't show up, giving up");
+                    g_bellLayoutUpdatedRevoker.revoke();
+                }
+                return;
+            }
+
+            Wh_Log(L"Bell icon content is ready");
+
+            g_bellLayoutUpdatedRevoker.revoke();
+            ApplyBellIconStyle(systemTrayIconElement);
+        });
 }
 
 void ApplyBellIconStyle(FrameworkElement systemTrayIconElement) {
@@ -865,8 +891,8 @@ void ApplyBellIconStyle(FrameworkElement systemTrayIconElement) {
                                 return;
                             }
 
-                            ApplyBellIconStyleWithRetry(
-                                bellSystemTrayIconElement, 0);
+                            ApplyBellIconStyleWhenReady(
+                                bellSystemTrayIconElement);
                         });
             }
         }
@@ -1397,6 +1423,7 @@ void ApplySettings() {
             ApplySettingsParam& param = *(ApplySettingsParam*)pParam;
 
             g_autoRevokerList.clear();
+            g_bellLayoutUpdatedRevoker.revoke();
 
             if (auto bellSystemTrayIconElement =
                     g_bellSystemTrayIconElement.get()) {
@@ -2,7 +2,7 @@
 // @id              taskbar-vertical
 // @name            Vertical Taskbar for Windows 11
 // @description     Finally, the missing vertical taskbar option for Windows 11! Move the taskbar to the left or right side of the screen.
-// @version         1.3.5
+// @version         1.3.8
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -11,7 +11,7 @@
 // @include         ShellExperienceHost.exe
 // @include         ShellHost.exe
 // @architecture    x86-64
-// @compilerOptions -ldwmapi -lole32 -loleaut32 -lruntimeobject -lshcore
+// @compilerOptions -DWINVER=0x0A00 -ldwmapi -lole32 -loleaut32 -lruntimeobject -lshcore
 // ==/WindhawkMod==
 
 // Source code is published under The GNU General Public License v3.0.
@@ -132,6 +132,8 @@ With labels:
 #include <functional>
 #include <limits>
 #include <list>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 #ifdef _M_ARM64
@@ -195,6 +197,7 @@ HWND g_startMenuWnd;
 HWND g_notificationCenterWnd;
 
 std::vector<winrt::weak_ref<XamlRoot>> g_notifyIconsUpdated;
+std::vector<winrt::weak_ref<XamlRoot>> g_taskbarStylePendingXamlRoots;
 
 using FrameworkElementLoadedEventRevoker = winrt::impl::event_revoker<
     IFrameworkElement,
@@ -205,6 +208,32 @@ std::list<FrameworkElementLoadedEventRevoker> g_notifyIconAutoRevokerList;
 int g_copilotPosTimerCounter;
 UINT_PTR g_copilotPosTimer;
 
+// Logs how long a startup phase took, to be able to tell how much of the
+// explorer startup time is spent in the mod, and where.
+class StartupPhaseTimer {
+   public:
+    explicit StartupPhaseTimer(PCWSTR name) : m_name(name) {
+        QueryPerformanceCounter(&m_start);
+    }
+
+    ~StartupPhaseTimer() {
+        LARGE_INTEGER end, frequency;
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&frequency);
+
+        ULONGLONG us =
+            (end.QuadPart - m_start.QuadPart) * 1000000 / frequency.QuadPart;
+        Wh_Log(L"%s took %llu.%03llu ms", m_name, us / 1000, us % 1000);
+    }
+
+    StartupPhaseTimer(const StartupPhaseTimer&) = delete;
+    StartupPhaseTimer& operator=(const StartupPhaseTimer&) = delete;
+
+   private:
+    PCWSTR m_name;
+    LARGE_INTEGER m_start;
+};
+
 std::optional<bool> IsOsFeatureEnabled(UINT32 featureId) {
     enum FEATURE_ENABLED_STATE {
         FEATURE_ENABLED_STATE_DEFAULT = 0,
@@ -290,12 +319,73 @@ std::wstring GetThreadIdDescriptionAsString(DWORD threadId) {
     return result;
 }
 
-bool GetMonitorRect(HMONITOR monitor, RECT* rc) {
+struct MonitorGeometry {
+    RECT rect;
+    UINT dpiX;
+    UINT dpiY;
+};
+
+// Monitor rects and DPIs, which are queried for every taskbar position
+// adjustment. Cleared by the taskbar window procedure when the display
+// configuration, DPI or settings change.
+std::mutex g_monitorGeometryCacheMutex;
+std::unordered_map<HMONITOR, MonitorGeometry> g_monitorGeometryCache;
+constexpr size_t kMonitorGeometryCacheMaxSize = 64;
+
+void ClearMonitorGeometryCache() {
+    std::lock_guard<std::mutex> guard(g_monitorGeometryCacheMutex);
+    g_monitorGeometryCache.clear();
+}
+
+bool GetMonitorGeometry(HMONITOR monitor, MonitorGeometry* geometry) {
+    // Other processes don't get the taskbar messages which clear the cache.
+    bool useCache = g_target == Target::Explorer;
+
+    if (useCache) {
+        std::lock_guard<std::mutex> guard(g_monitorGeometryCacheMutex);
+        auto it = g_monitorGeometryCache.find(monitor);
+        if (it != g_monitorGeometryCache.end()) {
+            *geometry = it->second;
+            return true;
+        }
+    }
+
     MONITORINFO monitorInfo{
         .cbSize = sizeof(MONITORINFO),
     };
-    return GetMonitorInfo(monitor, &monitorInfo) &&
-           CopyRect(rc, &monitorInfo.rcMonitor);
+    if (!GetMonitorInfo(monitor, &monitorInfo)) {
+        return false;
+    }
+
+    geometry->rect = monitorInfo.rcMonitor;
+    geometry->dpiX = 96;
+    geometry->dpiY = 96;
+    GetDpiForMonitor(monitor, MDT_DEFAULT, &geometry->dpiX, &geometry->dpiY);
+
+    if (!useCache) {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> guard(g_monitorGeometryCacheMutex);
+    if (g_monitorGeometryCache.size() >= kMonitorGeometryCacheMaxSize) {
+        g_monitorGeometryCache.clear();
+    }
+    g_monitorGeometryCache[monitor] = *geometry;
+    return true;
+}
+
+bool GetMonitorRect(HMONITOR monitor, RECT* rc) {
+    MonitorGeometry geometry;
+    return GetMonitorGeometry(monitor, &geometry) &&
+           CopyRect(rc, &geometry.rect);
+}
+
+void GetMonitorDpi(HMONITOR monitor, UINT* dpiX, UINT* dpiY) {
+    MonitorGeometry geometry;
+    if (GetMonitorGeometry(monitor, &geometry)) {
+        *dpiX = geometry.dpiX;
+        *dpiY = geometry.dpiY;
+    }
 }
 
 bool GetMonitorRectDpiUnscaled(HMONITOR monitor, RECT* rc) {
@@ -305,7 +395,7 @@ bool GetMonitorRectDpiUnscaled(HMONITOR monitor, RECT* rc) {
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     rc->left = MulDiv(rc->left, 96, monitorDpiX);
     rc->top = MulDiv(rc->top, 96, monitorDpiY);
@@ -390,6 +480,22 @@ FrameworkElement FindChildByClassName(FrameworkElement element,
     });
 }
 
+// Replacing the transform with an identical one still invalidates the
+// rendering of the element. Styles are re-applied on every layout pass, so only
+// replace it if the angle changed.
+void SetRotateTransform(UIElement element, double angle) {
+    auto currentTransform =
+        element.RenderTransform().try_as<Media::RotateTransform>();
+    if (currentTransform && currentTransform.Angle() == angle &&
+        currentTransform.CenterX() == 0 && currentTransform.CenterY() == 0) {
+        return;
+    }
+
+    Media::RotateTransform transform;
+    transform.Angle(angle);
+    element.RenderTransform(transform);
+}
+
 TaskbarLocation GetTaskbarLocationForMonitor(HMONITOR monitor) {
     if (g_settings.taskbarLocation == g_settings.taskbarLocationSecondary) {
         return g_settings.taskbarLocation;
@@ -476,7 +582,7 @@ DWORD WINAPI TrayUI_GetDockedRect_Hook(void* pThis, RECT* rect, BOOL param2) {
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     if (!g_unloading) {
         int taskbarWidthScaled =
@@ -533,7 +639,7 @@ void WINAPI TrayUI_MakeStuckRect_Hook(void* pThis,
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     if (!g_unloading) {
         int taskbarWidthScaled =
@@ -589,6 +695,12 @@ void TaskbarWndProcPreProcess(HWND hWnd,
                               WPARAM* wParam,
                               LPARAM* lParam) {
     switch (Msg) {
+        case WM_DISPLAYCHANGE:
+        case WM_DPICHANGED:
+        case WM_SETTINGCHANGE:
+            ClearMonitorGeometryCache();
+            break;
+
         case 0x5C3: {
             // The taskbar location that affects the jump list animations.
             if (!g_unloading && *wParam == ABE_BOTTOM) {
@@ -897,7 +1009,7 @@ void* WINAPI XamlExplorerHostWindow_XamlExplorerHostWindow_Hook(
 
         UINT monitorDpiX = 96;
         UINT monitorDpiY = 96;
-        GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+        GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
         winrt::Windows::Foundation::Rect rectNew = *rect;
         rectNew.Width = MulDiv(72, monitorDpiX, 96);
@@ -1390,9 +1502,7 @@ bool ApplyStyle(FrameworkElement taskbarFrame) {
         Media::VisualTreeHelper::GetParent(contentGrid).as<FrameworkElement>();
 
     double angle = g_unloading ? 0 : 90;
-    Media::RotateTransform transform;
-    transform.Angle(angle);
-    contentGrid.RenderTransform(transform);
+    SetRotateTransform(contentGrid, angle);
 
     float origin = g_unloading ? 0 : 0.5;
     contentGrid.RenderTransformOrigin({origin, origin});
@@ -1574,9 +1684,7 @@ void WINAPI RepeatButton_Width_Hook(void* pThis, double width) {
 
             Wh_Log(L"Setting angle=%f for child", angle);
 
-            Media::RotateTransform transform;
-            transform.Angle(angle);
-            child.RenderTransform(transform);
+            SetRotateTransform(child, angle);
 
             float origin = g_unloading ? 0 : 0.5;
             child.RenderTransformOrigin({origin, origin});
@@ -1606,9 +1714,7 @@ void WINAPI RepeatButton_Width_Hook(void* pThis, double width) {
 
             Wh_Log(L"Setting angle=%f for small badge", angle);
 
-            Media::RotateTransform transform;
-            transform.Angle(angle);
-            badgeSmall.RenderTransform(transform);
+            SetRotateTransform(badgeSmall, angle);
 
             float origin = g_unloading ? 0 : 0.5;
             badgeSmall.RenderTransformOrigin({origin, origin});
@@ -1624,9 +1730,7 @@ void WINAPI RepeatButton_Width_Hook(void* pThis, double width) {
 
             Wh_Log(L"Setting angle=%f for small badge", angle);
 
-            Media::RotateTransform transform;
-            transform.Angle(angle);
-            badgeLarge.RenderTransform(transform);
+            SetRotateTransform(badgeLarge, angle);
 
             float origin = g_unloading ? 0 : 0.5;
             badgeLarge.RenderTransformOrigin({origin, origin});
@@ -1646,9 +1750,7 @@ void ApplyNotifyIconViewStyle(FrameworkElement notifyIconViewElement) {
         (child =
              FindChildByClassName(child, L"Windows.UI.Xaml.Controls.Image"))) {
         double angle = g_unloading ? 0 : -90;
-        Media::RotateTransform transform;
-        transform.Angle(angle);
-        child.RenderTransform(transform);
+        SetRotateTransform(child, angle);
 
         float origin = g_unloading ? 0 : 0.5;
         child.RenderTransformOrigin({origin, origin});
@@ -1704,9 +1806,7 @@ void ApplySystemTrayIconStyle(FrameworkElement systemTrayIconElement) {
     }
 
     double angle = g_unloading ? 0 : -90;
-    Media::RotateTransform transform;
-    transform.Angle(angle);
-    iconContent.RenderTransform(transform);
+    SetRotateTransform(iconContent, angle);
 
     float origin = g_unloading ? 0 : 0.5;
     iconContent.RenderTransformOrigin({origin, origin});
@@ -1796,9 +1896,7 @@ void ApplySystemTrayChevronIconViewStyle(
     }
 
     double angle = g_unloading ? 0 : 180;
-    Media::RotateTransform transform;
-    transform.Angle(angle);
-    baseTextBlock.RenderTransform(transform);
+    SetRotateTransform(baseTextBlock, angle);
 
     float origin = g_unloading ? 0 : 0.5;
     baseTextBlock.RenderTransformOrigin({origin, origin});
@@ -2056,6 +2154,87 @@ bool UpdateNotifyIconsIfNeeded(XamlRoot xamlRoot) {
     return true;
 }
 
+void ApplyTaskbarStyleIfNeeded(XamlRoot xamlRoot) {
+    try {
+        ApplyStyleIfNeeded(xamlRoot);
+    } catch (...) {
+        HRESULT hr = winrt::to_hresult();
+        Wh_Log(L"Error %08X", hr);
+    }
+
+    try {
+        UpdateNotifyIconsIfNeeded(xamlRoot);
+    } catch (...) {
+        HRESULT hr = winrt::to_hresult();
+        Wh_Log(L"Error %08X", hr);
+    }
+}
+
+// Button updates come in bursts when taskbars are rebuilt, e.g. after a
+// monitor is connected or the DPI changes. Apply the taskbar styles once per
+// taskbar after the burst instead of for each of the updated buttons.
+void ScheduleTaskbarStyleIfNeeded(FrameworkElement element) {
+    auto xamlRoot = element.XamlRoot();
+    if (!xamlRoot) {
+        return;
+    }
+
+    if (g_unloading) {
+        ApplyTaskbarStyleIfNeeded(xamlRoot);
+        return;
+    }
+
+    bool pending = std::find_if(g_taskbarStylePendingXamlRoots.begin(),
+                                g_taskbarStylePendingXamlRoots.end(),
+                                [&xamlRoot](auto x) {
+                                    auto element = x.get();
+                                    return element && element == xamlRoot;
+                                }) != g_taskbarStylePendingXamlRoots.end();
+    if (pending) {
+        return;
+    }
+
+    auto removePending = [](const winrt::weak_ref<XamlRoot>& xamlRootWeak) {
+        g_taskbarStylePendingXamlRoots.erase(
+            std::remove_if(g_taskbarStylePendingXamlRoots.begin(),
+                           g_taskbarStylePendingXamlRoots.end(),
+                           [&xamlRootWeak](auto x) {
+                               auto element = x.get();
+                               return !element ||
+                                      element == xamlRootWeak.get();
+                           }),
+            g_taskbarStylePendingXamlRoots.end());
+    };
+
+    auto xamlRootWeak = winrt::make_weak(xamlRoot);
+    g_taskbarStylePendingXamlRoots.push_back(xamlRootWeak);
+
+    // Keep the mod loaded until the operation completes, whether or not the
+    // callback was run.
+    g_hookCallCounter++;
+
+    try {
+        auto operation = element.Dispatcher().TryRunAsync(
+            winrt::Windows::UI::Core::CoreDispatcherPriority::Low,
+            [xamlRootWeak, removePending]() {
+                removePending(xamlRootWeak);
+
+                if (auto xamlRoot = xamlRootWeak.get()) {
+                    ApplyTaskbarStyleIfNeeded(xamlRoot);
+                }
+            });
+
+        operation.Completed([](auto&&, auto&&) { g_hookCallCounter--; });
+    } catch (...) {
+        HRESULT hr = winrt::to_hresult();
+        Wh_Log(L"Error %08X", hr);
+
+        // The callback won't run if queuing it failed.
+        removePending(xamlRootWeak);
+        g_hookCallCounter--;
+    }
+}
+
 void UpdateTaskListButton(FrameworkElement taskListButtonElement) {
     auto iconPanelElement =
         FindChildByName(taskListButtonElement, L"IconPanel");
@@ -2073,9 +2252,7 @@ void UpdateTaskListButton(FrameworkElement taskListButtonElement) {
         winrt::Windows::Foundation::Numerics::float3::zero());
 
     double angle = g_unloading ? 0 : -90;
-    Media::RotateTransform transform;
-    transform.Angle(angle);
-    iconElement.RenderTransform(transform);
+    SetRotateTransform(iconElement, angle);
 
     float origin = g_unloading ? 0 : 0.5;
     iconElement.RenderTransformOrigin({origin, origin});
@@ -2084,9 +2261,7 @@ void UpdateTaskListButton(FrameworkElement taskListButtonElement) {
         FindChildByName(iconPanelElement, L"LabelControl");
     if (labelControlElement) {
         double angle = g_unloading ? 0 : -90;
-        Media::RotateTransform transform;
-        transform.Angle(angle);
-        labelControlElement.RenderTransform(transform);
+        SetRotateTransform(labelControlElement, angle);
 
         float origin = g_unloading ? 0 : 0.5;
         labelControlElement.RenderTransformOrigin({origin, origin});
@@ -2123,9 +2298,7 @@ void UpdateTaskListButton(FrameworkElement taskListButtonElement) {
         auto badgeElement = FindChildByName(iconPanelElement, badgeElementName);
         if (badgeElement) {
             double angle = g_unloading ? 0 : -90;
-            Media::RotateTransform transform;
-            transform.Angle(angle);
-            badgeElement.RenderTransform(transform);
+            SetRotateTransform(badgeElement, angle);
 
             winrt::Windows::Foundation::Point origin{};
             if (!g_unloading) {
@@ -2204,22 +2377,7 @@ void WINAPI TaskListButton_UpdateVisualStates_Hook(void* pThis) {
     if (taskbarFrameRepeaterElement &&
         taskbarFrameRepeaterElement.Name() == L"TaskbarFrameRepeater") {
         // Can also be "OverflowFlyoutListRepeater".
-        auto xamlRoot = taskListButtonElement.XamlRoot();
-        if (xamlRoot) {
-            try {
-                ApplyStyleIfNeeded(xamlRoot);
-            } catch (...) {
-                HRESULT hr = winrt::to_hresult();
-                Wh_Log(L"Error %08X", hr);
-            }
-
-            try {
-                UpdateNotifyIconsIfNeeded(xamlRoot);
-            } catch (...) {
-                HRESULT hr = winrt::to_hresult();
-                Wh_Log(L"Error %08X", hr);
-            }
-        }
+        ScheduleTaskbarStyleIfNeeded(taskListButtonElement);
     }
 }
 
@@ -2236,9 +2394,7 @@ void ApplyExperienceButtonStyle(FrameworkElement toggleButtonElement) {
     }
 
     double angle = g_unloading ? 0 : -90;
-    Media::RotateTransform transform;
-    transform.Angle(angle);
-    iconElement.RenderTransform(transform);
+    SetRotateTransform(iconElement, angle);
 
     float origin = g_unloading ? 0 : 0.5;
     iconElement.RenderTransformOrigin({origin, origin});
@@ -2246,22 +2402,7 @@ void ApplyExperienceButtonStyle(FrameworkElement toggleButtonElement) {
     iconElement.MaxHeight(g_unloading ? std::numeric_limits<double>::infinity()
                                       : 24);
 
-    auto xamlRoot = toggleButtonElement.XamlRoot();
-    if (xamlRoot) {
-        try {
-            ApplyStyleIfNeeded(xamlRoot);
-        } catch (...) {
-            HRESULT hr = winrt::to_hresult();
-            Wh_Log(L"Error %08X", hr);
-        }
-
-        try {
-            UpdateNotifyIconsIfNeeded(xamlRoot);
-        } catch (...) {
-            HRESULT hr = winrt::to_hresult();
-            Wh_Log(L"Error %08X", hr);
-        }
-    }
+    ScheduleTaskbarStyleIfNeeded(toggleButtonElement);
 }
 
 using ExperienceToggleButton_UpdateVisualStates_t = void(WINAPI*)(void* pThis);
@@ -2342,9 +2483,7 @@ void WINAPI OverflowFlyoutList_OnApplyTemplate_Hook(LPVOID pThis) {
         return;
     }
 
-    Media::RotateTransform transform;
-    transform.Angle(90);
-    element.RenderTransform(transform);
+    SetRotateTransform(element, 90);
 
     float origin = 0.5;
     element.RenderTransformOrigin({origin, origin});
@@ -2398,9 +2537,7 @@ void WINAPI CopilotIcon_UpdateVisualStates_Hook(void* pThis) {
         (child = FindChildByName(child, L"ContentGrid")) &&
         (child = FindChildByName(child, L"LottieIcon"))) {
         double angle = g_unloading ? 0 : -90;
-        Media::RotateTransform transform;
-        transform.Angle(angle);
-        child.RenderTransform(transform);
+        SetRotateTransform(child, angle);
 
         float origin = g_unloading ? 0 : 0.5;
         child.RenderTransformOrigin({origin, origin});
@@ -2884,8 +3021,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                              L"XamlExplorerHostIslandWindow") == 0) {
                     UINT monitorDpiX = 96;
                     UINT monitorDpiY = 96;
-                    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX,
-                                     &monitorDpiY);
+                    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
                     int overflowWidth = MulDiv(54 + 12, monitorDpiX, 96);
 
@@ -3022,8 +3158,7 @@ BOOL WINAPI SetWindowPos_Hook(HWND hWnd,
                          L"XamlExplorerHostIslandWindow") == 0) {
                 UINT monitorDpiX = 96;
                 UINT monitorDpiY = 96;
-                GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX,
-                                 &monitorDpiY);
+                GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
                 int overflowWidth = MulDiv(54 + 12, monitorDpiX, 96);
 
@@ -3184,7 +3319,7 @@ int WINAPI MapWindowPoints_Hook(HWND hWndFrom,
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     int flyoutHeight = MulDiv(hoverFlyoutGrid.ActualHeight(), monitorDpiY, 96);
 
@@ -3270,7 +3405,7 @@ HRESULT WINAPI DwmSetWindowAttribute_Hook(HWND hwnd,
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     MONITORINFO monitorInfo{
         .cbSize = sizeof(MONITORINFO),
@@ -3476,7 +3611,7 @@ void AdjustCoreWindowPos(int* x, int* y, int width, int height) {
 
     UINT monitorDpiX = 96;
     UINT monitorDpiY = 96;
-    GetDpiForMonitor(monitor, MDT_DEFAULT, &monitorDpiX, &monitorDpiY);
+    GetMonitorDpi(monitor, &monitorDpiX, &monitorDpiY);
 
     RECT rc;
     if (!GetMonitorRect(monitor, &rc)) {
@@ -3692,6 +3827,8 @@ void ApplySettings(bool waitForApply = true) {
 }
 
 bool HookTaskbarViewDllSymbols(HMODULE module) {
+    StartupPhaseTimer phaseTimer(L"Hooking taskbar view symbols");
+
     // Taskbar.View.dll, ExplorerExtensions.dll
     WindhawkUtils::SYMBOL_HOOK symbolHooks[] =  //
         {
@@ -3894,6 +4031,8 @@ HMODULE WINAPI LoadLibraryExW_Hook(LPCWSTR lpLibFileName,
 }
 
 bool HookTaskbarDllSymbols() {
+    StartupPhaseTimer phaseTimer(L"Hooking taskbar.dll symbols");
+
     HMODULE module =
         LoadLibraryEx(L"taskbar.dll", nullptr, LOAD_LIBRARY_SEARCH_SYSTEM32);
     if (!module) {
@@ -3979,6 +4118,8 @@ bool HookTaskbarDllSymbols() {
 BOOL Wh_ModInit() {
     Wh_Log(L">");
 
+    StartupPhaseTimer phaseTimer(L"Init");
+
     LoadSettings();
 
     g_target = Target::Explorer;
@@ -4077,7 +4218,10 @@ void Wh_ModAfterInit() {
             }
         }
 
-        ApplySettings();
+        {
+            StartupPhaseTimer phaseTimer(L"Applying settings");
+            ApplySettings();
+        }
     } else if (g_target == Target::ShellExperienceHost ||
                g_target == Target::ShellHost) {
         CoreWindowUI::ApplySettings();
@@ -2,7 +2,7 @@
 // @id              taskbar-volume-control
 // @name            Taskbar Volume Control
 // @description     Control the system volume by scrolling over the taskbar
-// @version         1.2.2
+// @version         1.2.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -412,150 +412,211 @@ const static GUID XIID_IAudioEndpointVolume = {
     0x841E,
     0x4546,
     {0x97, 0x22, 0x0C, 0xF7, 0x40, 0x78, 0x22, 0x9A}};
+const static GUID XIID_IMMNotificationClient = {
+    0x7991EEC9,
+    0x7E89,
+    0x4D85,
+    {0x83, 0x90, 0x6C, 0x70, 0x3C, 0xEC, 0x60, 0xC0}};
 
 static IMMDeviceEnumerator* g_pDeviceEnumerator;
 
-BOOL IsDefaultAudioEndpointAvailable() {
-    IMMDevice* defaultDevice = NULL;
-    HRESULT hr;
-    BOOL bSuccess = FALSE;
+// Activating the endpoint volume interface on every mouse wheel tick is
+// expensive, so it's kept until the default audio device changes.
+static IAudioEndpointVolume* g_pEndpointVolume;
+static std::atomic<bool> g_endpointVolumeOutdated;
+
+class DefaultDeviceNotificationClient : public IMMNotificationClient {
+   public:
+    // IUnknown methods
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid,
+                                             void** ppvObject) override {
+        if (IsEqualIID(riid, __uuidof(IUnknown)) ||
+            IsEqualIID(riid, XIID_IMMNotificationClient)) {
+            *ppvObject = static_cast<IMMNotificationClient*>(this);
+            AddRef();
+            return S_OK;
+        }
+        *ppvObject = nullptr;
+        return E_NOINTERFACE;
+    }
+
+    // A single static instance is used, no reference counting is needed.
+    ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+    ULONG STDMETHODCALLTYPE Release() override { return 1; }
+
+    // IMMNotificationClient methods
+    HRESULT STDMETHODCALLTYPE
+    OnDefaultDeviceChanged(EDataFlow flow,
+                           ERole role,
+                           LPCWSTR pwstrDefaultDeviceId) override {
+        // Called on a system thread, the interface is re-activated on the next
+        // use.
+        if (flow == eRender && role == eConsole) {
+            g_endpointVolumeOutdated = true;
+        }
+        return S_OK;
+    }
 
-    if (g_pDeviceEnumerator) {
-        hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole,
-                                                          &defaultDevice);
-        if (SUCCEEDED(hr)) {
-            bSuccess = TRUE;
+    HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR pwstrDeviceId) override {
+        return S_OK;
+    }
 
-            defaultDevice->Release();
-        }
+    HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR pwstrDeviceId) override {
+        return S_OK;
     }
 
-    return bSuccess;
+    HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR pwstrDeviceId,
+                                                   DWORD dwNewState) override {
+        return S_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE
+    OnPropertyValueChanged(LPCWSTR pwstrDeviceId,
+                           const PROPERTYKEY key) override {
+        return S_OK;
+    }
+};
+
+static DefaultDeviceNotificationClient g_defaultDeviceNotificationClient;
+static bool g_defaultDeviceNotificationClientRegistered;
+
+void ReleaseDefaultAudioEndpointVolume() {
+    if (g_pEndpointVolume) {
+        g_pEndpointVolume->Release();
+        g_pEndpointVolume = NULL;
+    }
 }
 
-BOOL IsVolMuted(BOOL* pbMuted) {
-    IMMDevice* defaultDevice = NULL;
-    IAudioEndpointVolume* endpointVolume = NULL;
-    HRESULT hr;
-    BOOL bSuccess = FALSE;
+IAudioEndpointVolume* GetDefaultAudioEndpointVolume() {
+    if (g_endpointVolumeOutdated.exchange(false)) {
+        ReleaseDefaultAudioEndpointVolume();
+    }
 
-    if (g_pDeviceEnumerator) {
-        hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole,
-                                                          &defaultDevice);
+    if (!g_pEndpointVolume && g_pDeviceEnumerator) {
+        IMMDevice* defaultDevice = NULL;
+        HRESULT hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(
+            eRender, eConsole, &defaultDevice);
         if (SUCCEEDED(hr)) {
             hr = defaultDevice->Activate(XIID_IAudioEndpointVolume,
                                          CLSCTX_INPROC_SERVER, NULL,
-                                         (LPVOID*)&endpointVolume);
-            if (SUCCEEDED(hr)) {
-                if (SUCCEEDED(endpointVolume->GetMute(pbMuted)))
-                    bSuccess = TRUE;
-
-                endpointVolume->Release();
-            }
+                                         (LPVOID*)&g_pEndpointVolume);
+            if (FAILED(hr))
+                g_pEndpointVolume = NULL;
 
             defaultDevice->Release();
         }
     }
 
-    return bSuccess;
+    return g_pEndpointVolume;
+}
+
+BOOL IsDefaultAudioEndpointAvailable() {
+    return GetDefaultAudioEndpointVolume() != NULL;
+}
+
+BOOL IsVolMuted(BOOL* pbMuted) {
+    IAudioEndpointVolume* endpointVolume = GetDefaultAudioEndpointVolume();
+    if (!endpointVolume)
+        return FALSE;
+
+    if (FAILED(endpointVolume->GetMute(pbMuted))) {
+        // The device might have been invalidated, re-activate next time.
+        ReleaseDefaultAudioEndpointVolume();
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 BOOL ToggleVolMuted() {
-    IMMDevice* defaultDevice = NULL;
-    IAudioEndpointVolume* endpointVolume = NULL;
-    HRESULT hr;
     BOOL bMuted;
-    BOOL bSuccess = FALSE;
 
-    if (g_pDeviceEnumerator) {
-        hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole,
-                                                          &defaultDevice);
-        if (SUCCEEDED(hr)) {
-            hr = defaultDevice->Activate(XIID_IAudioEndpointVolume,
-                                         CLSCTX_INPROC_SERVER, NULL,
-                                         (LPVOID*)&endpointVolume);
-            if (SUCCEEDED(hr)) {
-                if (SUCCEEDED(endpointVolume->GetMute(&bMuted))) {
-                    if (SUCCEEDED(endpointVolume->SetMute(!bMuted, NULL)))
-                        bSuccess = TRUE;
-                }
-
-                endpointVolume->Release();
-            }
+    IAudioEndpointVolume* endpointVolume = GetDefaultAudioEndpointVolume();
+    if (!endpointVolume)
+        return FALSE;
 
-            defaultDevice->Release();
-        }
+    if (FAILED(endpointVolume->GetMute(&bMuted)) ||
+        FAILED(endpointVolume->SetMute(!bMuted, NULL))) {
+        ReleaseDefaultAudioEndpointVolume();
+        return FALSE;
     }
 
-    return bSuccess;
+    return TRUE;
 }
 
 BOOL AddMasterVolumeLevelScalar(float fMasterVolumeAdd) {
-    IMMDevice* defaultDevice = NULL;
-    IAudioEndpointVolume* endpointVolume = NULL;
-    HRESULT hr;
     float fMasterVolume;
-    BOOL bSuccess = FALSE;
 
-    if (g_pDeviceEnumerator) {
-        hr = g_pDeviceEnumerator->GetDefaultAudioEndpoint(eRender, eConsole,
-                                                          &defaultDevice);
-        if (SUCCEEDED(hr)) {
-            hr = defaultDevice->Activate(XIID_IAudioEndpointVolume,
-                                         CLSCTX_INPROC_SERVER, NULL,
-                                         (LPVOID*)&endpointVolume);
-            if (SUCCEEDED(hr)) {
-                if (SUCCEEDED(endpointVolume->GetMasterVolumeLevelScalar(
-                        &fMasterVolume))) {
-                    fMasterVolume += fMasterVolumeAdd;
-
-                    if (fMasterVolume < 0.0)
-                        fMasterVolume = 0.0;
-                    else if (fMasterVolume > 1.0)
-                        fMasterVolume = 1.0;
-
-                    if (SUCCEEDED(endpointVolume->SetMasterVolumeLevelScalar(
-                            fMasterVolume, NULL))) {
-                        bSuccess = TRUE;
-
-                        if (!g_settings.noAutomaticMuteToggle) {
-                            // Windows displays the volume rounded to the
-                            // nearest percentage. The range [0, 0.005) is
-                            // displayed as 0%, [0.005, 0.015) as 1%, etc. It
-                            // also mutes the volume when it becomes zero, we do
-                            // the same.
-
-                            if (fMasterVolume < 0.005)
-                                endpointVolume->SetMute(TRUE, NULL);
-                            else
-                                endpointVolume->SetMute(FALSE, NULL);
-                        }
-                    }
-                }
+    IAudioEndpointVolume* endpointVolume = GetDefaultAudioEndpointVolume();
+    if (!endpointVolume)
+        return FALSE;
 
-                endpointVolume->Release();
-            }
+    if (FAILED(endpointVolume->GetMasterVolumeLevelScalar(&fMasterVolume))) {
+        ReleaseDefaultAudioEndpointVolume();
+        return FALSE;
+    }
 
-            defaultDevice->Release();
-        }
+    fMasterVolume += fMasterVolumeAdd;
+
+    if (fMasterVolume < 0.0)
+        fMasterVolume = 0.0;
+    else if (fMasterVolume > 1.0)
+        fMasterVolume = 1.0;
+
+    if (FAILED(endpointVolume->SetMasterVolumeLevelScalar(fMasterVolume,
+                                                          NULL))) {
+        ReleaseDefaultAudioEndpointVolume();
+        return FALSE;
     }
 
-    return bSuccess;
+    if (!g_settings.noAutomaticMuteToggle) {
+        // Windows displays the volume rounded to the nearest percentage. The
+        // range [0, 0.005) is displayed as 0%, [0.005, 0.015) as 1%, etc. It
+        // also mutes the volume when it becomes zero, we do the same.
+
+        if (fMasterVolume < 0.005)
+            endpointVolume->SetMute(TRUE, NULL);
+        else
+            endpointVolume->SetMute(FALSE, NULL);
+    }
+
+    return TRUE;
 }
 
 void SndVolInit() {
+    if (g_pDeviceEnumerator)
+        return;
+
     HRESULT hr = CoCreateInstance(
         XIID_MMDeviceEnumerator, NULL, CLSCTX_INPROC_SERVER,
         XIID_IMMDeviceEnumerator, (LPVOID*)&g_pDeviceEnumerator);
-    if (FAILED(hr))
+    if (FAILED(hr)) {
         g_pDeviceEnumerator = NULL;
+        return;
+    }
+
+    hr = g_pDeviceEnumerator->RegisterEndpointNotificationCallback(
+        &g_defaultDeviceNotificationClient);
+    if (SUCCEEDED(hr)) {
+        g_defaultDeviceNotificationClientRegistered = true;
+    } else {
+        Wh_Log(L"RegisterEndpointNotificationCallback failed: %08X", hr);
+    }
 }
 
 void SndVolUninit() {
     if (g_pDeviceEnumerator) {
+        if (g_defaultDeviceNotificationClientRegistered) {
+            g_pDeviceEnumerator->UnregisterEndpointNotificationCallback(
+                &g_defaultDeviceNotificationClient);
+            g_defaultDeviceNotificationClientRegistered = false;
+        }
+
         g_pDeviceEnumerator->Release();
         g_pDeviceEnumerator = NULL;
     }
+
+    ReleaseDefaultAudioEndpointVolume();
 }
 
 #pragma endregion  // volume_functions
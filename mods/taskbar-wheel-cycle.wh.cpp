@@ -2,7 +2,7 @@
 // @id              taskbar-wheel-cycle
 // @name            Cycle taskbar buttons with mouse wheel
 // @description     Use the mouse wheel and/or keyboard shortcuts to cycle between taskbar buttons
-// @version         1.1.9
+// @version         1.1.10
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -118,6 +118,20 @@ HWND g_lastScrollTarget = nullptr;
 DWORD g_lastScrollTime;
 short g_lastScrollDeltaRemainder;
 
+// Wheel notches which arrive in quick succession are accumulated and applied
+// at once, so that intermediate windows aren't activated.
+HWND g_pendingScrollTarget;
+int g_pendingScrollClicks;
+UINT_PTR g_pendingScrollTimer;
+bool g_pendingScrollDisabled;
+
+// The active button is updated asynchronously after switching, so for a
+// while after a switch, the next one continues from the switched-to item.
+constexpr DWORD kSwitchSettleTimeMs = 500;
+HWND g_lastSwitchTaskList;
+PVOID g_lastSwitchTaskItem;
+DWORD g_lastSwitchTime;
+
 bool g_hotkeyLeftRegistered = false;
 bool g_hotkeyRightRegistered = false;
 
@@ -427,7 +441,8 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
     int button_groups_count = (int)plp[0];
     LONG_PTR** button_groups = (LONG_PTR**)plp[1];
 
-    int button_group_index_active, button_index_active;
+    int button_group_index_active = -1, button_index_active = -1;
+    bool src_task_item_found = false;
 
     if (src_task_item) {
         int i;
@@ -443,6 +458,7 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
                             button_groups[i], j) == src_task_item) {
                         button_group_index_active = i;
                         button_index_active = j;
+                        src_task_item_found = true;
                         break;
                     }
                 }
@@ -452,12 +468,10 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
                 }
             }
         }
+    }
 
-        if (i == button_groups_count) {
-            button_group_index_active = -1;
-            button_index_active = -1;
-        }
-    } else {
+    // If the source item is gone, continue from the active button.
+    if (!src_task_item_found) {
         void* taskList_ITaskListAcc = QueryViaVtable(
             (void*)lpMMTaskListLongPtr, CTaskListWnd_vftable_ITaskListAcc);
 
@@ -497,6 +511,58 @@ LONG_PTR* TaskbarScroll(LONG_PTR lpMMTaskListLongPtr,
 
 #pragma endregion  // scroll
 
+void ApplyPendingScroll() {
+    HWND hMMTaskListWnd = g_pendingScrollTarget;
+    int clicks = g_pendingScrollClicks;
+
+    g_pendingScrollTarget = nullptr;
+    g_pendingScrollClicks = 0;
+
+    if (!hMMTaskListWnd || clicks == 0) {
+        return;
+    }
+
+    PVOID srcTaskItem = nullptr;
+    if (g_lastSwitchTaskList == hMMTaskListWnd &&
+        GetTickCount() - g_lastSwitchTime < kSwitchSettleTimeMs) {
+        srcTaskItem = g_lastSwitchTaskItem;
+    }
+
+    LONG_PTR lpMMTaskListLongPtr = GetWindowLongPtr(hMMTaskListWnd, 0);
+    PVOID targetTaskItem = TaskbarScroll(
+        lpMMTaskListLongPtr, clicks, g_settings.skipMinimizedWindows,
+        g_settings.wrapAround, (LONG_PTR*)srcTaskItem);
+    if (targetTaskItem) {
+        SwitchToTaskItem(lpMMTaskListLongPtr, targetTaskItem);
+
+        g_lastSwitchTaskList = hMMTaskListWnd;
+        g_lastSwitchTaskItem = targetTaskItem;
+        g_lastSwitchTime = GetTickCount();
+    }
+}
+
+void CALLBACK PendingScrollTimerProc(HWND hWnd,
+                                     UINT uMsg,
+                                     UINT_PTR idEvent,
+                                     DWORD dwTime) {
+    KillTimer(nullptr, g_pendingScrollTimer);
+    g_pendingScrollTimer = 0;
+
+    ApplyPendingScroll();
+}
+
+// Must be called from the taskbar thread, which owns the timer.
+void CancelPendingScroll() {
+    if (g_pendingScrollTimer) {
+        KillTimer(nullptr, g_pendingScrollTimer);
+        g_pendingScrollTimer = 0;
+    }
+
+    g_pendingScrollTarget = nullptr;
+    g_pendingScrollClicks = 0;
+    g_pendingScrollDisabled = true;
+}
+
 void OnTaskListScroll(HWND hMMTaskListWnd, short delta) {
     if (g_lastScrollTarget == hMMTaskListWnd &&
         GetTickCount() - g_lastScrollTime < 1000 * 5) {
@@ -511,12 +577,21 @@ void OnTaskListScroll(HWND hMMTaskListWnd, short delta) {
             clicks = -clicks;
         }
 
-        LONG_PTR lpMMTaskListLongPtr = GetWindowLongPtr(hMMTaskListWnd, 0);
-        PVOID targetTaskItem = TaskbarScroll(lpMMTaskListLongPtr, clicks,
-                                             g_settings.skipMinimizedWindows,
-                                             g_settings.wrapAround, nullptr);
-        if (targetTaskItem) {
-            SwitchToTaskItem(lpMMTaskListLongPtr, targetTaskItem);
+        if (g_pendingScrollTarget && g_pendingScrollTarget != hMMTaskListWnd) {
+            ApplyPendingScroll();
+        }
+
+        g_pendingScrollTarget = hMMTaskListWnd;
+        g_pendingScrollClicks += clicks;
+
+        if (g_pendingScrollDisabled) {
+            ApplyPendingScroll();
+        } else if (!g_pendingScrollTimer) {
+            g_pendingScrollTimer = SetTimer(nullptr, 0, USER_TIMER_MINIMUM,
+                                            PendingScrollTimerProc);
+            if (!g_pendingScrollTimer) {
+                ApplyPendingScroll();
+            }
         }
     }
 
@@ -1022,6 +1097,9 @@ LRESULT WINAPI CTaskBand_v_WndProc_Hook(void* pThis,
 
                     case HOTKEY_UNREGISTER:
                         UnregisterHotkeys(hWnd);
+                        // Sent before unloading, the timer procedure must not
+                        // run afterwards.
+                        CancelPendingScroll();
                         break;
 
                     case HOTKEY_UPDATE:
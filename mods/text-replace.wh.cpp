@@ -2,13 +2,13 @@
 // @id              text-replace
 // @name            Text Replace
 // @description     Replace any text with any other text in any program
-// @version         1.0
+// @version         1.3.4
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
 // @homepage        https://m417z.com/
 // @include         *
-// @compilerOptions -lgdi32
+// @compilerOptions -lgdi32 -O3
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
@@ -19,6 +19,12 @@ Replace any text with any other text in any program. The mod is able to
 replace some texts in some programs, while some other programs and
 elements are not supported. The replacement works best in native elements,
 and usually doesn't work in custom ones.
+
+A replacement can be limited to windows of a given class, such as `#32770`
+for dialogs or `Button` for buttons, by setting the window class name. Such
+replacements apply to window titles, control texts, and text which is painted
+in these windows, but not to menus. Programs without any replacements aren't
+hooked at all.
 */
 // ==/WindhawkModReadme==
 
@@ -31,64 +37,542 @@ and usually doesn't work in custom ones.
       $name: The text to be replaced
     - Replace: WindPad
       $name: The replacement text
+    - WindowClass: ""
+      $name: Window class
+      $description: >-
+        Optional, only replace the text in windows of this class
   - - Name: mspaint.exe
     - Search: Paint
     - Replace: PhotoHawk
   $name: Per-program configuration
+- HookPaintFunctions: true
+  $name: Replace painted text
+  $description: >-
+    Also replace text which is painted directly with TextOut, ExtTextOut and
+    DrawText. These functions are called much more often than the others, and
+    can be disabled if only window titles and menus need to be replaced.
+- SinglePass: false
+  $name: Replace in a single pass
+  $description: >-
+    Replace all search strings in a single pass over the text, which is faster
+    with many replacements. Items then don't apply to the output of earlier
+    items, and for overlapping matches the leftmost one wins. By default, items
+    are applied one by one in the order above.
+- LogStatistics: false
+  $name: Log statistics
+  $description: >-
+    Periodically write to the mod log how many texts were checked and
+    replaced, and how much time it took. Can be used to find out how much the
+    mod costs in a given program.
 */
 // ==/WindhawkModSettings==
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <mutex>
+#include <map>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
-struct ReplacementItem {
-    std::string searchA;
-    std::string replaceA;
-    std::wstring searchW;
-    std::wstring replaceW;
-};
+// Finds all the search strings in a single pass over the text, with an
+// Aho-Corasick automaton which is built when the settings are loaded. By
+// default, the automaton only finds out whether anything matches, and the
+// items are then applied one by one, so that each item applies to the output
+// of the earlier ones. In single pass mode, the matches found by the automaton
+// are replaced directly.
+template<typename T>
+class Replacer
+{
+public:
+    void SetSinglePass(bool singlePass)
+    {
+        m_singlePass = singlePass;
+    }
+
+    void Add(std::basic_string<T> search, std::basic_string<T> replace)
+    {
+        m_patterns.push_back({std::move(search), std::move(replace)});
+    }
+
+    void Build()
+    {
+        m_nodes.clear();
+        m_nodes.emplace_back();
+
+        for (size_t i = 0; i < m_patterns.size(); i++) {
+            int state = 0;
+            for (T ch : m_patterns[i].search) {
+                int next = Child(state, ch);
+                if (next == -1) {
+                    next = (int)m_nodes.size();
+                    auto& children = m_nodes[state].children;
+                    children.insert(std::upper_bound(children.begin(), children.end(), std::pair{ch, 0},
+                        [](const auto& a, const auto& b) { return a.first < b.first; }), {ch, next});
+                    m_nodes.emplace_back();
+                }
+                state = next;
+            }
+
+            // If the same text is searched more than once, the first item
+            // wins, as it did when the items were applied one by one.
+            if (m_nodes[state].pattern == -1) {
+                m_nodes[state].pattern = (int)i;
+            }
+
+            m_firstChars.set(FirstCharBit(m_patterns[i].search[0]));
+        }
+
+        // Breadth-first, so that the fallback of each node is computed before
+        // its children.
+        std::vector<int> queue;
+        for (const auto& [ch, child] : m_nodes[0].children) {
+            queue.push_back(child);
+        }
+
+        for (size_t i = 0; i < queue.size(); i++) {
+            int state = queue[i];
+            for (const auto& [ch, child] : m_nodes[state].children) {
+                int fallback = m_nodes[state].fallback;
+                while (fallback != 0 && Child(fallback, ch) == -1) {
+                    fallback = m_nodes[fallback].fallback;
+                }
+                int next = Child(fallback, ch);
+                m_nodes[child].fallback = next != -1 ? next : 0;
+
+                int output = m_nodes[child].fallback;
+                m_nodes[child].output = m_nodes[output].pattern != -1 ? output : m_nodes[output].output;
+
+                queue.push_back(child);
+            }
+        }
+    }
+
+    // A quick check without allocating or locking, which rejects most texts
+    // without a search string: a search string can only be found if the text
+    // has one of their first characters. Different characters can share a
+    // bit, which only makes the check less strict.
+    bool MightMatch(std::basic_string_view<T> text) const
+    {
+        if (m_patterns.empty()) {
+            return false;
+        }
+
+        for (T ch : text) {
+            if (m_firstChars.test(FirstCharBit(ch))) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Returns the text with the search strings replaced, or nothing if no
+    // search string was found.
+    std::optional<std::basic_string<T>> Replace(std::basic_string_view<T> text) const
+    {
+        if (m_patterns.empty()) {
+            return std::nullopt;
+        }
+
+        if (!m_singlePass) {
+            return ReplaceSequential(text);
+        }
+
+        struct Match {
+            size_t start;
+            int pattern;
+        };
+
+        std::vector<Match> matches;
+
+        int state = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            state = Next(state, text[i]);
+
+            int output = m_nodes[state].pattern != -1 ? state : m_nodes[state].output;
+            while (output != -1) {
+                int pattern = m_nodes[output].pattern;
+                matches.push_back({i + 1 - m_patterns[pattern].search.size(), pattern});
+                output = m_nodes[output].output;
+            }
+        }
+
+        if (matches.empty()) {
+            return std::nullopt;
+        }
+
+        // Leftmost matches win, and for matches at the same position, the
+        // item which comes first in the settings.
+        std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+            return a.start != b.start ? a.start < b.start : a.pattern < b.pattern;
+        });
+
+        size_t resultLength = 0;
+        size_t end = 0;
+        size_t count = 0;
+        for (const auto& match : matches) {
+            if (match.start < end) {
+                continue;
+            }
+
+            const auto& pattern = m_patterns[match.pattern];
+            resultLength += match.start - end + pattern.replace.size();
+            end = match.start + pattern.search.size();
+            matches[count++] = match;
+        }
+
+        resultLength += text.size() - end;
+
+        std::basic_string<T> result;
+        result.reserve(resultLength);
+
+        end = 0;
+        for (size_t i = 0; i < count; i++) {
+            const auto& pattern = m_patterns[matches[i].pattern];
+            result.append(text.substr(end, matches[i].start - end));
+            result.append(pattern.replace);
+            end = matches[i].start + pattern.search.size();
+        }
 
-std::vector<ReplacementItem> g_replacementItems;
+        result.append(text.substr(end));
 
+        return result;
+    }
+
+private:
+    struct Pattern {
+        std::basic_string<T> search;
+        std::basic_string<T> replace;
+    };
+
+    struct Node {
+        // Sorted by character.
+        std::vector<std::pair<T, int>> children;
+        // The longest proper suffix which is also in the trie.
+        int fallback = 0;
+        // The item which ends at this node, or -1.
+        int pattern = -1;
+        // The next node in the fallback chain with an item, or -1.
+        int output = -1;
+    };
+
+    static constexpr size_t kFirstCharBits = 1024;
+
+    bool HasMatch(std::basic_string_view<T> text) const
+    {
+        int state = 0;
+        for (T ch : text) {
+            state = Next(state, ch);
+            if (m_nodes[state].pattern != -1 || m_nodes[state].output != -1) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::optional<std::basic_string<T>> ReplaceSequential(std::basic_string_view<T> text) const
+    {
+        if (!HasMatch(text)) {
+            return std::nullopt;
+        }
+
+        std::basic_string<T> result(text);
+
+        for (const auto& pattern : m_patterns) {
+            size_t start_pos = 0;
+            while ((start_pos = result.find(pattern.search, start_pos)) != result.npos) {
+                result.replace(start_pos, pattern.search.length(), pattern.replace);
+                start_pos += pattern.replace.length(); // Handles case where 'to' is a substring of 'from'
+            }
+        }
+
+        return result;
+    }
+
+    static size_t FirstCharBit(T ch)
+    {
+        return (std::make_unsigned_t<T>)ch % kFirstCharBits;
+    }
+
+    int Child(int state, T ch) const
+    {
+        const auto& children = m_nodes[state].children;
+        auto it = std::lower_bound(children.begin(), children.end(), ch,
+            [](const auto& child, T value) { return child.first < value; });
+        return it != children.end() && it->first == ch ? it->second : -1;
+    }
+
+    int Next(int state, T ch) const
+    {
+        while (true) {
+            int next = Child(state, ch);
+            if (next != -1) {
+                return next;
+            }
+            if (state == 0) {
+                return 0;
+            }
+            state = m_nodes[state].fallback;
+        }
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<Pattern> m_patterns;
+    std::bitset<kFirstCharBits> m_firstChars;
+    bool m_singlePass = false;
+};
+
+// Remembers the results for recent texts, since the same menu items and
+// window titles are set over and over. Texts without replacements are
+// remembered too, they're the most common ones.
 template<typename T>
-T ReplaceAll(T str, const T& from, const T& to)
+class ReplacementCache
 {
-    size_t start_pos = 0;
-    while((start_pos = str.find(from, start_pos)) != T::npos) {
-        str.replace(start_pos, from.length(), to);
-        start_pos += to.length(); // Handles case where 'to' is a substring of 'from'
+public:
+    static constexpr size_t kMaxEntries = 1024;
+    static constexpr size_t kMaxTextLength = 256;
+
+    template<typename ReplaceFunction>
+    std::optional<std::basic_string<T>> Get(std::basic_string_view<T> text, ReplaceFunction&& replace)
+    {
+        if (text.size() > kMaxTextLength) {
+            return replace(text);
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            auto it = m_entries.find(text);
+            if (it != m_entries.end()) {
+                return it->second;
+            }
+        }
+
+        auto result = replace(text);
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_entries.size() >= kMaxEntries) {
+            m_entries.clear();
+        }
+        m_entries.try_emplace(std::basic_string<T>(text), result);
+
+        return result;
+    }
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_entries.clear();
     }
-    return str;
+
+private:
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::basic_string_view<T> str) const
+        {
+            return std::hash<std::basic_string_view<T>>{}(str);
+        }
+    };
+
+    std::mutex m_mutex;
+    std::unordered_map<std::basic_string<T>, std::optional<std::basic_string<T>>, Hash, std::equal_to<>> m_entries;
+};
+
+// The replacements which apply to a window class, or to all windows. The
+// replacements for all windows are also part of each window class rule set, so
+// that a text is always checked in a single pass.
+struct RuleSet {
+    Replacer<char> replacerA;
+    Replacer<WCHAR> replacerW;
+    ReplacementCache<char> replacementCacheA;
+    ReplacementCache<WCHAR> replacementCacheW;
+};
+
+struct Rules {
+    RuleSet allWindows;
+    // Keyed by the lowercase window class name.
+    std::map<std::wstring, RuleSet, std::less<>> windowClasses;
+};
+
+// What a text belongs to, used to find its window class. Texts which can't be
+// associated with a window, such as menu items, only get the replacements for
+// all windows.
+struct TextOwner {
+    HWND hWnd = nullptr;
+    HDC hdc = nullptr;
+    PCWSTR className = nullptr;
+    PCSTR classNameA = nullptr;
+};
+
+bool g_hookPaintFunctions;
+bool g_logStatistics;
+bool g_hooksInstalled;
+
+// Replaced as a whole when the settings change, while the hooks hold a shared
+// lock for as long as they use it.
+std::unique_ptr<Rules> g_rules;
+std::shared_mutex g_rulesMutex;
+
+// Counters for the LogStatistics option. They're updated with relaxed atomic
+// operations, and only when the option is enabled.
+struct ReplaceStatistics {
+    std::atomic<ULONGLONG> calls;
+    std::atomic<ULONGLONG> replaced;
+    std::atomic<ULONGLONG> ticks;
+};
+
+constexpr LONGLONG kStatisticsLogIntervalSeconds = 60;
+
+ReplaceStatistics g_replaceStatisticsA;
+ReplaceStatistics g_replaceStatisticsW;
+LONGLONG g_performanceFrequency;
+std::atomic<LONGLONG> g_lastStatisticsLogTime;
+
+void LogReplaceStatistics(PCWSTR name, ReplaceStatistics& statistics)
+{
+    ULONGLONG ticks = statistics.ticks.load(std::memory_order_relaxed);
+    Wh_Log(L"%s: %llu calls, %llu replaced, %llu us", name,
+        statistics.calls.load(std::memory_order_relaxed),
+        statistics.replaced.load(std::memory_order_relaxed),
+        g_performanceFrequency ? ticks * 1000000 / g_performanceFrequency : 0);
+}
+
+void LogStatistics()
+{
+    LogReplaceStatistics(L"ReplaceStringA", g_replaceStatisticsA);
+    LogReplaceStatistics(L"ReplaceStringW", g_replaceStatisticsW);
+}
+
+void ResetStatistics()
+{
+    for (auto* statistics : {&g_replaceStatisticsA, &g_replaceStatisticsW}) {
+        statistics->calls = 0;
+        statistics->replaced = 0;
+        statistics->ticks = 0;
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    g_lastStatisticsLogTime = now.QuadPart;
 }
 
-std::string ReplaceStringA(PCSTR string, size_t len = -1)
+template<typename ReplaceFunction>
+auto MeasureReplace(ReplaceStatistics& statistics, ReplaceFunction&& replace)
 {
-    if (len == -1) {
-        len = strlen(string);
+    if (!g_logStatistics) {
+        return replace();
     }
 
-    std::string result(string, len);
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    auto result = replace();
+    QueryPerformanceCounter(&end);
 
-    for (const auto& item : g_replacementItems) {
-        result = ReplaceAll<std::string>(std::move(result), item.searchA, item.replaceA);
+    statistics.calls.fetch_add(1, std::memory_order_relaxed);
+    if (result) {
+        statistics.replaced.fetch_add(1, std::memory_order_relaxed);
+    }
+    statistics.ticks.fetch_add(end.QuadPart - start.QuadPart, std::memory_order_relaxed);
+
+    // Only one of the threads which find that the interval has passed logs.
+    LONGLONG lastLogTime = g_lastStatisticsLogTime.load(std::memory_order_relaxed);
+    if (end.QuadPart - lastLogTime >= g_performanceFrequency * kStatisticsLogIntervalSeconds &&
+        g_lastStatisticsLogTime.compare_exchange_strong(lastLogTime, end.QuadPart)) {
+        LogStatistics();
     }
 
     return result;
 }
 
-std::wstring ReplaceStringW(PCWSTR string, size_t len = -1)
+// Must be called with g_rulesMutex held. The window class is only looked up if
+// there are window class rules.
+RuleSet& GetRuleSet(const TextOwner& owner)
 {
-    if (len == -1) {
-        len = wcslen(string);
+    auto& windowClasses = g_rules->windowClasses;
+    if (windowClasses.empty()) {
+        return g_rules->allWindows;
     }
 
-    std::wstring result(string, len);
+    WCHAR className[256];
+    if (owner.className) {
+        size_t len = wcslen(owner.className);
+        if (len >= ARRAYSIZE(className)) {
+            return g_rules->allWindows;
+        }
+
+        wmemcpy(className, owner.className, len + 1);
+    }
+    else if (owner.classNameA) {
+        if (!MultiByteToWideChar(CP_ACP, 0, owner.classNameA, -1, className, ARRAYSIZE(className))) {
+            return g_rules->allWindows;
+        }
+    }
+    else {
+        HWND hWnd = owner.hWnd;
+        if (!hWnd && owner.hdc) {
+            hWnd = WindowFromDC(owner.hdc);
+        }
 
-    for (const auto& item : g_replacementItems) {
-        result = ReplaceAll<std::wstring>(std::move(result), item.searchW, item.replaceW);
+        if (!hWnd || !GetClassName(hWnd, className, ARRAYSIZE(className))) {
+            return g_rules->allWindows;
+        }
     }
 
-    return result;
+    CharLowerBuff(className, wcslen(className));
+
+    auto it = windowClasses.find(std::wstring_view(className));
+    return it != windowClasses.end() ? it->second : g_rules->allWindows;
+}
+
+std::optional<std::string> ReplaceStringA(PCSTR string, size_t len = -1, const TextOwner& owner = {})
+{
+    return MeasureReplace(g_replaceStatisticsA, [&]() -> std::optional<std::string> {
+        if (len == -1) {
+            len = strlen(string);
+        }
+
+        std::shared_lock lock(g_rulesMutex);
+
+        RuleSet& ruleSet = GetRuleSet(owner);
+
+        std::string_view text(string, len);
+        if (!ruleSet.replacerA.MightMatch(text)) {
+            return std::nullopt;
+        }
+
+        return ruleSet.replacementCacheA.Get(text, [&ruleSet](std::string_view str) {
+            return ruleSet.replacerA.Replace(str);
+        });
+    });
+}
+
+std::optional<std::wstring> ReplaceStringW(PCWSTR string, size_t len = -1, const TextOwner& owner = {})
+{
+    return MeasureReplace(g_replaceStatisticsW, [&]() -> std::optional<std::wstring> {
+        if (len == -1) {
+            len = wcslen(string);
+        }
+
+        std::shared_lock lock(g_rulesMutex);
+
+        RuleSet& ruleSet = GetRuleSet(owner);
+
+        std::wstring_view text(string, len);
+        if (!ruleSet.replacerW.MightMatch(text)) {
+            return std::nullopt;
+        }
+
+        return ruleSet.replacementCacheW.Get(text, [&ruleSet](std::wstring_view str) {
+            return ruleSet.replacerW.Replace(str);
+        });
+    });
 }
 
 using SetWindowTextA_t = decltype(&SetWindowTextA);
@@ -96,8 +580,9 @@ SetWindowTextA_t pOriginalSetWindowTextA;
 BOOL WINAPI SetWindowTextAHook(HWND hWnd, LPCSTR lpString)
 {
     if (lpString) {
-        std::string str = ReplaceStringA(lpString);
-        return pOriginalSetWindowTextA(hWnd, str.c_str());
+        if (auto str = ReplaceStringA(lpString, -1, {.hWnd = hWnd})) {
+            return pOriginalSetWindowTextA(hWnd, str->c_str());
+        }
     }
 
     return pOriginalSetWindowTextA(hWnd, lpString);
@@ -108,8 +593,9 @@ SetWindowTextW_t pOriginalSetWindowTextW;
 BOOL WINAPI SetWindowTextWHook(HWND hWnd, LPCWSTR lpString)
 {
     if (lpString) {
-        std::wstring str = ReplaceStringW(lpString);
-        return pOriginalSetWindowTextW(hWnd, str.c_str());
+        if (auto str = ReplaceStringW(lpString, -1, {.hWnd = hWnd})) {
+            return pOriginalSetWindowTextW(hWnd, str->c_str());
+        }
     }
 
     return pOriginalSetWindowTextW(hWnd, lpString);
@@ -120,8 +606,9 @@ InsertMenuA_t pOriginalInsertMenuA;
 BOOL WINAPI InsertMenuAHook(HMENU hMenu,UINT uPosition,UINT uFlags,UINT_PTR uIDNewItem,LPCSTR lpNewItem)
 {
     if (!(uFlags & (MF_BITMAP | MF_OWNERDRAW)) && lpNewItem) {
-        std::string str = ReplaceStringA(lpNewItem);
-        return pOriginalInsertMenuA(hMenu,uPosition,uFlags,uIDNewItem,str.c_str());
+        if (auto str = ReplaceStringA(lpNewItem)) {
+            return pOriginalInsertMenuA(hMenu,uPosition,uFlags,uIDNewItem,str->c_str());
+        }
     }
 
     return pOriginalInsertMenuA(hMenu,uPosition,uFlags,uIDNewItem,lpNewItem);
@@ -132,8 +619,9 @@ InsertMenuW_t pOriginalInsertMenuW;
 BOOL WINAPI InsertMenuWHook(HMENU hMenu,UINT uPosition,UINT uFlags,UINT_PTR uIDNewItem,LPCWSTR lpNewItem)
 {
     if (!(uFlags & (MF_BITMAP | MF_OWNERDRAW)) && lpNewItem) {
-        std::wstring str = ReplaceStringW(lpNewItem);
-        return pOriginalInsertMenuW(hMenu,uPosition,uFlags,uIDNewItem,str.c_str());
+        if (auto str = ReplaceStringW(lpNewItem)) {
+            return pOriginalInsertMenuW(hMenu,uPosition,uFlags,uIDNewItem,str->c_str());
+        }
     }
 
     return pOriginalInsertMenuW(hMenu,uPosition,uFlags,uIDNewItem,lpNewItem);
@@ -144,8 +632,9 @@ AppendMenuA_t pOriginalAppendMenuA;
 BOOL WINAPI AppendMenuAHook(HMENU hMenu,UINT uFlags,UINT_PTR uIDNewItem,LPCSTR lpNewItem)
 {
     if (!(uFlags & (MF_BITMAP | MF_OWNERDRAW)) && lpNewItem) {
-        std::string str = ReplaceStringA(lpNewItem);
-        return pOriginalAppendMenuA(hMenu,uFlags,uIDNewItem,str.c_str());
+        if (auto str = ReplaceStringA(lpNewItem)) {
+            return pOriginalAppendMenuA(hMenu,uFlags,uIDNewItem,str->c_str());
+        }
     }
 
     return pOriginalAppendMenuA(hMenu,uFlags,uIDNewItem,lpNewItem);
@@ -156,8 +645,9 @@ AppendMenuW_t pOriginalAppendMenuW;
 BOOL WINAPI AppendMenuWHook(HMENU hMenu,UINT uFlags,UINT_PTR uIDNewItem,LPCWSTR lpNewItem)
 {
     if (!(uFlags & (MF_BITMAP | MF_OWNERDRAW)) && lpNewItem) {
-        std::wstring str = ReplaceStringW(lpNewItem);
-        return pOriginalAppendMenuW(hMenu,uFlags,uIDNewItem,str.c_str());
+        if (auto str = ReplaceStringW(lpNewItem)) {
+            return pOriginalAppendMenuW(hMenu,uFlags,uIDNewItem,str->c_str());
+        }
     }
 
     return pOriginalAppendMenuW(hMenu,uFlags,uIDNewItem,lpNewItem);
@@ -168,8 +658,9 @@ ModifyMenuA_t pOriginalModifyMenuA;
 BOOL WINAPI ModifyMenuAHook(HMENU hMenu,UINT uPosition,UINT uFlags,UINT_PTR uIDNewItem,LPCSTR lpNewItem)
 {
     if (!(uFlags & (MF_BITMAP | MF_OWNERDRAW)) && lpNewItem) {
-        std::string str = ReplaceStringA(lpNewItem);
-        return pOriginalModifyMenuA(hMenu,uPosition,uFlags,uIDNewItem,str.c_str());
+        if (auto str = ReplaceStringA(lpNewItem)) {
+            return pOriginalModifyMenuA(hMenu,uPosition,uFlags,uIDNewItem,str->c_str());
+        }
     }
 
     return pOriginalModifyMenuA(hMenu,uPosition,uFlags,uIDNewItem,lpNewItem);
@@ -180,8 +671,9 @@ ModifyMenuW_t pOriginalModifyMenuW;
 BOOL WINAPI ModifyMenuWHook(HMENU hMenu,UINT uPosition,UINT uFlags,UINT_PTR uIDNewItem,LPCWSTR lpNewItem)
 {
     if (!(uFlags & (MF_BITMAP | MF_OWNERDRAW)) && lpNewItem) {
-        std::wstring str = ReplaceStringW(lpNewItem);
-        return pOriginalModifyMenuW(hMenu,uPosition,uFlags,uIDNewItem,str.c_str());
+        if (auto str = ReplaceStringW(lpNewItem)) {
+            return pOriginalModifyMenuW(hMenu,uPosition,uFlags,uIDNewItem,str->c_str());
+        }
     }
 
     return pOriginalModifyMenuW(hMenu,uPosition,uFlags,uIDNewItem,lpNewItem);
@@ -195,10 +687,11 @@ BOOL WINAPI InsertMenuItemAHook(HMENU hmenu,UINT item,WINBOOL fByPosition,LPCMEN
         (lpmi->fMask & MIIM_STRING) ||
         ((lpmi->fMask & MIIM_TYPE) && (lpmi->fType & MFT_STRING))
     ) && lpmi->dwTypeData) {
-        std::string str = ReplaceStringA(lpmi->dwTypeData);
-        MENUITEMINFOA mi = *lpmi;
-        mi.dwTypeData = str.data();
-        return pOriginalInsertMenuItemA(hmenu,item,fByPosition,&mi);
+        if (auto str = ReplaceStringA(lpmi->dwTypeData)) {
+            MENUITEMINFOA mi = *lpmi;
+            mi.dwTypeData = str->data();
+            return pOriginalInsertMenuItemA(hmenu,item,fByPosition,&mi);
+        }
     }
 
     return pOriginalInsertMenuItemA(hmenu,item,fByPosition,lpmi);
@@ -212,10 +705,11 @@ BOOL WINAPI InsertMenuItemWHook(HMENU hmenu,UINT item,WINBOOL fByPosition,LPCMEN
         (lpmi->fMask & MIIM_STRING) ||
         ((lpmi->fMask & MIIM_TYPE) && (lpmi->fType & MFT_STRING))
     ) && lpmi->dwTypeData) {
-        std::wstring str = ReplaceStringW(lpmi->dwTypeData);
-        MENUITEMINFOW mi = *lpmi;
-        mi.dwTypeData = str.data();
-        return pOriginalInsertMenuItemW(hmenu,item,fByPosition,&mi);
+        if (auto str = ReplaceStringW(lpmi->dwTypeData)) {
+            MENUITEMINFOW mi = *lpmi;
+            mi.dwTypeData = str->data();
+            return pOriginalInsertMenuItemW(hmenu,item,fByPosition,&mi);
+        }
     }
 
     return pOriginalInsertMenuItemW(hmenu,item,fByPosition,lpmi);
@@ -229,10 +723,11 @@ BOOL WINAPI SetMenuItemInfoAHook(HMENU hmenu,UINT item,WINBOOL fByPosition,LPCME
         (lpmi->fMask & MIIM_STRING) ||
         ((lpmi->fMask & MIIM_TYPE) && (lpmi->fType & MFT_STRING))
     ) && lpmi->dwTypeData) {
-        std::string str = ReplaceStringA(lpmi->dwTypeData);
-        MENUITEMINFOA mi = *lpmi;
-        mi.dwTypeData = str.data();
-        return pOriginalSetMenuItemInfoA(hmenu,item,fByPosition,&mi);
+        if (auto str = ReplaceStringA(lpmi->dwTypeData)) {
+            MENUITEMINFOA mi = *lpmi;
+            mi.dwTypeData = str->data();
+            return pOriginalSetMenuItemInfoA(hmenu,item,fByPosition,&mi);
+        }
     }
 
     return pOriginalSetMenuItemInfoA(hmenu,item,fByPosition,lpmi);
@@ -246,10 +741,11 @@ BOOL WINAPI SetMenuItemInfoWHook(HMENU hmenu,UINT item,WINBOOL fByPosition,LPCME
         (lpmi->fMask & MIIM_STRING) ||
         ((lpmi->fMask & MIIM_TYPE) && (lpmi->fType & MFT_STRING))
     ) && lpmi->dwTypeData) {
-        std::wstring str = ReplaceStringW(lpmi->dwTypeData);
-        MENUITEMINFOW mi = *lpmi;
-        mi.dwTypeData = str.data();
-        return pOriginalSetMenuItemInfoW(hmenu,item,fByPosition,&mi);
+        if (auto str = ReplaceStringW(lpmi->dwTypeData)) {
+            MENUITEMINFOW mi = *lpmi;
+            mi.dwTypeData = str->data();
+            return pOriginalSetMenuItemInfoW(hmenu,item,fByPosition,&mi);
+        }
     }
 
     return pOriginalSetMenuItemInfoW(hmenu,item,fByPosition,lpmi);
@@ -260,8 +756,9 @@ TextOutA_t pOriginalTextOutA;
 BOOL WINAPI TextOutAHook(HDC hdc,int x,int y,LPCSTR lpString,int c)
 {
     if (lpString) {
-        std::string str = ReplaceStringA(lpString, c);
-        return pOriginalTextOutA(hdc,x,y,str.c_str(),str.length());
+        if (auto str = ReplaceStringA(lpString, c, {.hdc = hdc})) {
+            return pOriginalTextOutA(hdc,x,y,str->c_str(),str->length());
+        }
     }
 
     return pOriginalTextOutA(hdc,x,y,lpString,c);
@@ -272,8 +769,9 @@ TextOutW_t pOriginalTextOutW;
 BOOL WINAPI TextOutWHook(HDC hdc,int x,int y,LPCWSTR lpString,int c)
 {
     if (lpString) {
-        std::wstring str = ReplaceStringW(lpString, c);
-        return pOriginalTextOutW(hdc,x,y,str.c_str(),str.length());
+        if (auto str = ReplaceStringW(lpString, c, {.hdc = hdc})) {
+            return pOriginalTextOutW(hdc,x,y,str->c_str(),str->length());
+        }
     }
 
     return pOriginalTextOutW(hdc,x,y,lpString,c);
@@ -284,8 +782,9 @@ ExtTextOutA_t pOriginalExtTextOutA;
 BOOL WINAPI ExtTextOutAHook(HDC hdc,int x,int y,UINT options,CONST RECT *lprect,LPCSTR lpString,UINT c,CONST INT *lpDx)
 {
     if (!(options & ETO_GLYPH_INDEX) && lpString) {
-        std::string str = ReplaceStringA(lpString, c);
-        return pOriginalExtTextOutA(hdc,x,y,options,lprect,str.c_str(),str.length(),lpDx);
+        if (auto str = ReplaceStringA(lpString, c, {.hdc = hdc})) {
+            return pOriginalExtTextOutA(hdc,x,y,options,lprect,str->c_str(),str->length(),lpDx);
+        }
     }
 
     return pOriginalExtTextOutA(hdc,x,y,options,lprect,lpString,c,lpDx);
@@ -296,8 +795,9 @@ ExtTextOutW_t pOriginalExtTextOutW;
 BOOL WINAPI ExtTextOutWHook(HDC hdc,int x,int y,UINT options,CONST RECT *lprect,LPCWSTR lpString,UINT c,CONST INT *lpDx)
 {
     if (!(options & ETO_GLYPH_INDEX) && lpString) {
-        std::wstring str = ReplaceStringW(lpString, c);
-        return pOriginalExtTextOutW(hdc,x,y,options,lprect,str.c_str(),str.length(),lpDx);
+        if (auto str = ReplaceStringW(lpString, c, {.hdc = hdc})) {
+            return pOriginalExtTextOutW(hdc,x,y,options,lprect,str->c_str(),str->length(),lpDx);
+        }
     }
 
     return pOriginalExtTextOutW(hdc,x,y,options,lprect,lpString,c,lpDx);
@@ -308,12 +808,13 @@ DrawTextA_t pOriginalDrawTextA;
 int WINAPI DrawTextAHook(HDC hdc,LPCSTR lpchText,int cchText,LPRECT lprc,UINT format)
 {
     if (lpchText) {
-        std::string str = ReplaceStringA(lpchText, cchText);
-        int len = str.length();
-        if (format & DT_MODIFYSTRING) {
-            str.resize(len + 4);
+        if (auto str = ReplaceStringA(lpchText, cchText, {.hdc = hdc})) {
+            int len = str->length();
+            if (format & DT_MODIFYSTRING) {
+                str->resize(len + 4);
+            }
+            return pOriginalDrawTextA(hdc,str->c_str(),len,lprc,format);
         }
-        return pOriginalDrawTextA(hdc,str.c_str(),len,lprc,format);
     }
 
     return pOriginalDrawTextA(hdc,lpchText,cchText,lprc,format);
@@ -324,12 +825,13 @@ DrawTextW_t pOriginalDrawTextW;
 int WINAPI DrawTextWHook(HDC hdc,LPCWSTR lpchText,int cchText,LPRECT lprc,UINT format)
 {
     if (lpchText) {
-        std::wstring str = ReplaceStringW(lpchText, cchText);
-        int len = str.length();
-        if (format & DT_MODIFYSTRING) {
-            str.resize(len + 4);
+        if (auto str = ReplaceStringW(lpchText, cchText, {.hdc = hdc})) {
+            int len = str->length();
+            if (format & DT_MODIFYSTRING) {
+                str->resize(len + 4);
+            }
+            return pOriginalDrawTextW(hdc,str->c_str(),len,lprc,format);
         }
-        return pOriginalDrawTextW(hdc,str.c_str(),len,lprc,format);
     }
 
     return pOriginalDrawTextW(hdc,lpchText,cchText,lprc,format);
@@ -340,12 +842,13 @@ DrawTextExA_t pOriginalDrawTextExA;
 int WINAPI DrawTextExAHook(HDC hdc,LPSTR lpchText,int cchText,LPRECT lprc,UINT format,LPDRAWTEXTPARAMS lpdtp)
 {
     if (lpchText) {
-        std::string str = ReplaceStringA(lpchText, cchText);
-        int len = str.length();
-        if (format & DT_MODIFYSTRING) {
-            str.resize(len + 4);
+        if (auto str = ReplaceStringA(lpchText, cchText, {.hdc = hdc})) {
+            int len = str->length();
+            if (format & DT_MODIFYSTRING) {
+                str->resize(len + 4);
+            }
+            return pOriginalDrawTextExA(hdc,str->data(),len,lprc,format,lpdtp);
         }
-        return pOriginalDrawTextExA(hdc,str.data(),len,lprc,format,lpdtp);
     }
 
     return pOriginalDrawTextExA(hdc,lpchText,cchText,lprc,format,lpdtp);
@@ -356,12 +859,13 @@ DrawTextExW_t pOriginalDrawTextExW;
 int WINAPI DrawTextExWHook(HDC hdc,LPWSTR lpchText,int cchText,LPRECT lprc,UINT format,LPDRAWTEXTPARAMS lpdtp)
 {
     if (lpchText) {
-        std::wstring str = ReplaceStringW(lpchText, cchText);
-        int len = str.length();
-        if (format & DT_MODIFYSTRING) {
-            str.resize(len + 4);
+        if (auto str = ReplaceStringW(lpchText, cchText, {.hdc = hdc})) {
+            int len = str->length();
+            if (format & DT_MODIFYSTRING) {
+                str->resize(len + 4);
+            }
+            return pOriginalDrawTextExW(hdc,str->data(),len,lprc,format,lpdtp);
         }
-        return pOriginalDrawTextExW(hdc,str.data(),len,lprc,format,lpdtp);
     }
 
     return pOriginalDrawTextExW(hdc,lpchText,cchText,lprc,format,lpdtp);
@@ -372,8 +876,9 @@ CreateWindowExA_t pOriginalCreateWindowExA;
 HWND WINAPI CreateWindowExAHook(DWORD dwExStyle,LPCSTR lpClassName,LPCSTR lpWindowName,DWORD dwStyle,int X,int Y,int nWidth,int nHeight,HWND hWndParent,HMENU hMenu,HINSTANCE hInstance,LPVOID lpParam)
 {
     if (lpWindowName) {
-        std::string str = ReplaceStringA(lpWindowName);
-        return pOriginalCreateWindowExA(dwExStyle,lpClassName,str.c_str(),dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
+        if (auto str = ReplaceStringA(lpWindowName, -1, {.classNameA = IS_INTRESOURCE(lpClassName) ? nullptr : lpClassName})) {
+            return pOriginalCreateWindowExA(dwExStyle,lpClassName,str->c_str(),dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
+        }
     }
 
     return pOriginalCreateWindowExA(dwExStyle,lpClassName,lpWindowName,dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
@@ -384,8 +889,9 @@ CreateWindowExW_t pOriginalCreateWindowExW;
 HWND WINAPI CreateWindowExWHook(DWORD dwExStyle,LPCWSTR lpClassName,LPCWSTR lpWindowName,DWORD dwStyle,int X,int Y,int nWidth,int nHeight,HWND hWndParent,HMENU hMenu,HINSTANCE hInstance,LPVOID lpParam)
 {
     if (lpWindowName) {
-        std::wstring str = ReplaceStringW(lpWindowName);
-        return pOriginalCreateWindowExW(dwExStyle,lpClassName,str.c_str(),dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
+        if (auto str = ReplaceStringW(lpWindowName, -1, {.className = IS_INTRESOURCE(lpClassName) ? nullptr : lpClassName})) {
+            return pOriginalCreateWindowExW(dwExStyle,lpClassName,str->c_str(),dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
+        }
     }
 
     return pOriginalCreateWindowExW(dwExStyle,lpClassName,lpWindowName,dwStyle,X,Y,nWidth,nHeight,hWndParent,hMenu,hInstance,lpParam);
@@ -396,8 +902,9 @@ SendMessageA_t pOriginalSendMessageA;
 LRESULT WINAPI SendMessageAHook(HWND hWnd,UINT Msg,WPARAM wParam,LPARAM lParam)
 {
     if (Msg == WM_SETTEXT && lParam) {
-        std::string str = ReplaceStringA((PCSTR)lParam);
-        return pOriginalSendMessageA(hWnd,Msg,wParam,(LPARAM)str.c_str());
+        if (auto str = ReplaceStringA((PCSTR)lParam, -1, {.hWnd = hWnd})) {
+            return pOriginalSendMessageA(hWnd,Msg,wParam,(LPARAM)str->c_str());
+        }
     }
 
     return pOriginalSendMessageA(hWnd,Msg,wParam,lParam);
@@ -408,16 +915,20 @@ SendMessageW_t pOriginalSendMessageW;
 LRESULT WINAPI SendMessageWHook(HWND hWnd,UINT Msg,WPARAM wParam,LPARAM lParam)
 {
     if (Msg == WM_SETTEXT && lParam) {
-        std::wstring str = ReplaceStringW((PCWSTR)lParam);
-        return pOriginalSendMessageW(hWnd,Msg,wParam,(LPARAM)str.c_str());
+        if (auto str = ReplaceStringW((PCWSTR)lParam, -1, {.hWnd = hWnd})) {
+            return pOriginalSendMessageW(hWnd,Msg,wParam,(LPARAM)str->c_str());
+        }
     }
 
     return pOriginalSendMessageW(hWnd,Msg,wParam,lParam);
 }
 
-void LoadSettings()
+// Returns whether any replacement applies to the current program.
+bool LoadSettings()
 {
-    g_replacementItems.clear();
+    g_hookPaintFunctions = Wh_GetIntSetting(L"HookPaintFunctions");
+    bool singlePass = Wh_GetIntSetting(L"SinglePass");
+    g_logStatistics = Wh_GetIntSetting(L"LogStatistics");
 
     WCHAR programPath[1024];
     DWORD dwSize = ARRAYSIZE(programPath);
@@ -433,6 +944,14 @@ void LoadSettings()
         }
     }
 
+    struct Rule {
+        std::wstring windowClass;
+        std::wstring search;
+        std::wstring replace;
+    };
+
+    std::vector<Rule> rules;
+
     for (int i = 0; ; i++) {
         bool matched = false;
 
@@ -456,26 +975,77 @@ void LoadSettings()
         if (matched) {
             PCWSTR search = Wh_GetStringSetting(L"PerProgramConfig[%d].Search", i);
             PCWSTR replace = Wh_GetStringSetting(L"PerProgramConfig[%d].Replace", i);
+            PCWSTR windowClass = Wh_GetStringSetting(L"PerProgramConfig[%d].WindowClass", i);
 
             if (*search) {
-                g_replacementItems.push_back({
-                    std::string(search, search + wcslen(search)),
-                    std::string(replace, replace + wcslen(replace)),
-                    search, replace
-                });
+                std::wstring windowClassLower = windowClass;
+                CharLowerBuff(windowClassLower.data(), windowClassLower.length());
+                rules.push_back({std::move(windowClassLower), search, replace});
             }
 
             Wh_FreeStringSetting(search);
             Wh_FreeStringSetting(replace);
+            Wh_FreeStringSetting(windowClass);
+        }
+    }
+
+    auto newRules = std::make_unique<Rules>();
+
+    for (const auto& rule : rules) {
+        if (!rule.windowClass.empty()) {
+            newRules->windowClasses.try_emplace(rule.windowClass);
         }
     }
+
+    // The items are added in the settings order, which is the order they're
+    // applied in, or in single pass mode, decides which item wins for matches
+    // at the same position.
+    auto buildRuleSet = [&rules, singlePass](RuleSet& ruleSet, std::wstring_view windowClass) {
+        ruleSet.replacerA.SetSinglePass(singlePass);
+        ruleSet.replacerW.SetSinglePass(singlePass);
+
+        for (const auto& rule : rules) {
+            if (rule.windowClass.empty() || rule.windowClass == windowClass) {
+                ruleSet.replacerA.Add(
+                    std::string(rule.search.begin(), rule.search.end()),
+                    std::string(rule.replace.begin(), rule.replace.end()));
+                ruleSet.replacerW.Add(rule.search, rule.replace);
+            }
+        }
+
+        ruleSet.replacerA.Build();
+        ruleSet.replacerW.Build();
+    };
+
+    buildRuleSet(newRules->allWindows, {});
+    for (auto& [windowClass, ruleSet] : newRules->windowClasses) {
+        buildRuleSet(ruleSet, windowClass);
+    }
+
+    {
+        std::unique_lock lock(g_rulesMutex);
+        g_rules.swap(newRules);
+    }
+
+    ResetStatistics();
+
+    return !rules.empty();
 }
 
 BOOL Wh_ModInit(void)
 {
     Wh_Log(L"Init");
 
-    LoadSettings();
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    g_performanceFrequency = frequency.QuadPart;
+
+    if (!LoadSettings()) {
+        Wh_Log(L"No replacements for this program, not hooking");
+        return TRUE;
+    }
+
+    g_hooksInstalled = true;
 
     // Covers SetDlgItemText and SetDlgItemInt.
     Wh_SetFunctionHook((void*)SetWindowTextA, (void*)SetWindowTextAHook, (void**)&pOriginalSetWindowTextA);
@@ -496,17 +1066,19 @@ BOOL Wh_ModInit(void)
     Wh_SetFunctionHook((void*)SetMenuItemInfoA, (void*)SetMenuItemInfoAHook, (void**)&pOriginalSetMenuItemInfoA);
     Wh_SetFunctionHook((void*)SetMenuItemInfoW, (void*)SetMenuItemInfoWHook, (void**)&pOriginalSetMenuItemInfoW);
 
-    Wh_SetFunctionHook((void*)TextOutA, (void*)TextOutAHook, (void**)&pOriginalTextOutA);
-    Wh_SetFunctionHook((void*)TextOutW, (void*)TextOutWHook, (void**)&pOriginalTextOutW);
+    if (g_hookPaintFunctions) {
+        Wh_SetFunctionHook((void*)TextOutA, (void*)TextOutAHook, (void**)&pOriginalTextOutA);
+        Wh_SetFunctionHook((void*)TextOutW, (void*)TextOutWHook, (void**)&pOriginalTextOutW);
 
-    Wh_SetFunctionHook((void*)ExtTextOutA, (void*)ExtTextOutAHook, (void**)&pOriginalExtTextOutA);
-    Wh_SetFunctionHook((void*)ExtTextOutW, (void*)ExtTextOutWHook, (void**)&pOriginalExtTextOutW);
+        Wh_SetFunctionHook((void*)ExtTextOutA, (void*)ExtTextOutAHook, (void**)&pOriginalExtTextOutA);
+        Wh_SetFunctionHook((void*)ExtTextOutW, (void*)ExtTextOutWHook, (void**)&pOriginalExtTextOutW);
 
-    Wh_SetFunctionHook((void*)DrawTextA, (void*)DrawTextAHook, (void**)&pOriginalDrawTextA);
-    Wh_SetFunctionHook((void*)DrawTextW, (void*)DrawTextWHook, (void**)&pOriginalDrawTextW);
+        Wh_SetFunctionHook((void*)DrawTextA, (void*)DrawTextAHook, (void**)&pOriginalDrawTextA);
+        Wh_SetFunctionHook((void*)DrawTextW, (void*)DrawTextWHook, (void**)&pOriginalDrawTextW);
 
-    Wh_SetFunctionHook((void*)DrawTextExA, (void*)DrawTextExAHook, (void**)&pOriginalDrawTextExA);
-    Wh_SetFunctionHook((void*)DrawTextExW, (void*)DrawTextExWHook, (void**)&pOriginalDrawTextExW);
+        Wh_SetFunctionHook((void*)DrawTextExA, (void*)DrawTextExAHook, (void**)&pOriginalDrawTextExA);
+        Wh_SetFunctionHook((void*)DrawTextExW, (void*)DrawTextExWHook, (void**)&pOriginalDrawTextExW);
+    }
 
     Wh_SetFunctionHook((void*)CreateWindowExA, (void*)CreateWindowExAHook, (void**)&pOriginalCreateWindowExA);
     Wh_SetFunctionHook((void*)CreateWindowExW, (void*)CreateWindowExWHook, (void**)&pOriginalCreateWindowExW);
@@ -520,11 +1092,32 @@ BOOL Wh_ModInit(void)
 void Wh_ModUninit(void)
 {
     Wh_Log(L"Uninit");
+
+    if (g_logStatistics) {
+        LogStatistics();
+    }
 }
 
-void Wh_ModSettingsChanged(void)
+BOOL Wh_ModSettingsChanged(BOOL* bReload)
 {
     Wh_Log(L"SettingsChanged");
 
-    LoadSettings();
+    if (g_logStatistics) {
+        LogStatistics();
+    }
+
+    bool prevHookPaintFunctions = g_hookPaintFunctions;
+
+    bool hasRules = LoadSettings();
+
+    // The functions are hooked on init, and only if there are replacements
+    // for the program.
+    if (g_hooksInstalled) {
+        *bReload = g_hookPaintFunctions != prevHookPaintFunctions;
+    }
+    else {
+        *bReload = hasRules;
+    }
+
+    return TRUE;
 }
@@ -2,7 +2,7 @@
 // @id              themed-regedit-listview
 // @name            Themed Regedit ListView
 // @description     Makes the ListView in Regedit themed
-// @version         1.0.0
+// @version         1.0.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         regedit.exe
@@ -49,14 +49,19 @@ struct
 
 void UpdateListView(BOOL bInit)
 {
+    if (!hListView || !IsWindow(hListView))
+    {
+        return;
+    }
+
     if (settings.bThemed)
     {
+        /* SetWindowTheme sends WM_THEMECHANGED itself */
         SetWindowTheme(
             hListView,
             bInit ? L"Explorer" : NULL,
             NULL
         );
-        SendMessageW(hListView, WM_THEMECHANGED, NULL, NULL);
     }
 
     if (settings.bFullrow)
@@ -117,28 +122,25 @@ void LoadSettings(void)
     settings.bFullrow = Wh_GetIntSetting(L"fullrow");
 }
 
-BOOL CALLBACK FindListViewProc(HWND hWnd, LPARAM lParam)
-{
-    DWORD pId;
-    WCHAR lpClass[256];
-
-    GetWindowThreadProcessId(hWnd, &pId);
-    GetClassNameW(hWnd, lpClass, 256);
-
-    if (pId == (DWORD)lParam
-    &&  0 == wcscmp(lpClass, L"RegEdit_RegEdit"))
-    {
-        hListView = FindWindowExW(hWnd, NULL, L"SysListView32", NULL);
-        return FALSE;
-    }
-
-    return TRUE;
-}
-
+/**
+  * Only walks the RegEdit_RegEdit windows instead of every top level
+  * window, and is only needed once, for a window which existed before
+  * the mod was loaded. Later list views are bound in CreateWindowExW_hook.
+  */
 BOOL FindListView(void)
 {
     DWORD pId = GetCurrentProcessId();
-    EnumWindows(FindListViewProc, (LPARAM)pId);
+    HWND hWnd = NULL;
+    while ((hWnd = FindWindowExW(NULL, hWnd, L"RegEdit_RegEdit", NULL)) != NULL)
+    {
+        DWORD pWndId;
+        GetWindowThreadProcessId(hWnd, &pWndId);
+        if (pWndId == pId)
+        {
+            hListView = FindWindowExW(hWnd, NULL, L"SysListView32", NULL);
+            break;
+        }
+    }
     return (hListView != NULL);
 }
 
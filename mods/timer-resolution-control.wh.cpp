@@ -2,7 +2,7 @@
 // @id           timer-resolution-control
 // @name         Timer Resolution Control
 // @description  Prevent programs from changing the Windows timer resolution and increasing power consumption
-// @version      1.0
+// @version      1.1
 // @author       m417z
 // @github       https://github.com/m417z
 // @twitter      https://twitter.com/m417z
@@ -21,8 +21,17 @@ to determine which programs are allowed to change the timer resolution.
 More details:
 [Windows Timer Resolution: Megawatts Wasted](https://randomascii.wordpress.com/2013/07/08/windows-timer-resolution-megawatts-wasted/)
 
-The changes will apply the next time the target program(s) will change the timer resolution. To make
-sure the changes apply, you might want to restart the target program(s) or restart the computer.
+Programs which currently hold a timer resolution request are re-evaluated when the settings change.
+Programs which requested a resolution before the mod was loaded keep it until they change it again, so
+you might want to restart the target program(s) or restart the computer.
+
+Background programs can be restricted further: with the background option enabled, the configured
+limits apply only while the program owns the foreground window, and a separate (usually coarser) limit
+applies otherwise. Requests are re-evaluated when the program moves to or from the foreground.
+
+To find programs which keep the timer resolution high, enable the statistics log option. Each program
+logs which resolutions it requested, how long they were held, what was actually granted, and the
+resulting system-wide timer resolution.
 */
 // ==/WindhawkModReadme==
 
@@ -38,6 +47,15 @@ sure the changes apply, you might want to restart the target program(s) or resta
 - DefaultLimit: 10
   $name: Default timer resolution limit (for the limit configuration)
   $description: The lowest possible delay between timer events, in milliseconds
+- BackgroundLimitEnabled: false
+  $name: Limit background programs
+  $description: Apply the background limit below while the program doesn't own the foreground window
+- BackgroundLimit: 15
+  $name: Background timer resolution limit
+  $description: The lowest possible delay between timer events for background programs, in milliseconds
+- StatsInterval: 0
+  $name: Statistics log interval
+  $description: While a program holds a timer resolution request, log its statistics every this many seconds (0 to only log when the request is released)
 - PerProgramConfig:
   - - Name: notepad.exe
       $name: Program name or path
@@ -53,10 +71,16 @@ sure the changes apply, you might want to restart the target program(s) or resta
 */
 // ==/WindhawkModSettings==
 
+#include <mutex>
+#include <vector>
+
 #ifndef NT_SUCCESS
 #define NT_SUCCESS(Status) ((NTSTATUS)(Status) >= 0)
 #endif
 
+// How often an active request is re-evaluated for foreground changes.
+#define REEVALUATE_INTERVAL 1000
+
 enum class Config {
     allow,
     block,
@@ -66,6 +90,30 @@ enum class Config {
 ULONG g_minimumResolution;
 ULONG g_maximumResolution;
 ULONG g_limitResolution;
+bool g_backgroundLimitEnabled;
+ULONG g_backgroundLimitResolution;
+ULONGLONG g_statsInterval;
+
+typedef NTSTATUS (WINAPI *NtQueryTimerResolution_t)(PULONG, PULONG, PULONG);
+NtQueryTimerResolution_t pNtQueryTimerResolution;
+
+struct ResolutionStats {
+    ULONG resolution;
+    ULONG requests;
+    ULONGLONG totalTime;
+};
+
+// The state of the current process's request. The system keeps a single
+// request per process, a new request replaces the previous one.
+std::mutex g_requestMutex;
+bool g_requestActive;
+ULONG g_requestedResolution;
+ULONG g_grantedResolution;
+ULONGLONG g_grantedSince;
+ULONGLONG g_lastStatsLogTime;
+std::vector<ResolutionStats> g_requestedStats;
+std::vector<ResolutionStats> g_grantedStats;
+HANDLE g_reevaluateTimer;
 
 Config ConfigFromString(PCWSTR string) {
     if (wcscmp(string, L"block") == 0) {
@@ -82,22 +130,177 @@ Config ConfigFromString(PCWSTR string) {
 typedef NTSTATUS (WINAPI *NtSetTimerResolution_t)(ULONG, BOOLEAN, PULONG);
 NtSetTimerResolution_t pOriginalNtSetTimerResolution;
 
+bool IsProcessInForeground()
+{
+    // The mod is loaded into all processes, avoid loading user32.dll into
+    // those which don't use it. Such processes can't own the foreground window.
+    HMODULE hUser32 = GetModuleHandle(L"user32.dll");
+    if (!hUser32) {
+        return false;
+    }
+
+    using GetForegroundWindow_t = HWND (WINAPI *)();
+    using GetWindowThreadProcessId_t = DWORD (WINAPI *)(HWND, LPDWORD);
+    auto pGetForegroundWindow = (GetForegroundWindow_t)GetProcAddress(hUser32, "GetForegroundWindow");
+    auto pGetWindowThreadProcessId = (GetWindowThreadProcessId_t)GetProcAddress(hUser32, "GetWindowThreadProcessId");
+    if (!pGetForegroundWindow || !pGetWindowThreadProcessId) {
+        return false;
+    }
+
+    HWND hForegroundWnd = pGetForegroundWindow();
+    if (!hForegroundWnd) {
+        return false;
+    }
+
+    DWORD processId = 0;
+    pGetWindowThreadProcessId(hForegroundWnd, &processId);
+    return processId == GetCurrentProcessId();
+}
+
+ULONG ArbitrateResolution(ULONG desiredResolution)
+{
+    ULONG limitResolution = g_limitResolution;
+    if (g_backgroundLimitEnabled && g_backgroundLimitResolution > limitResolution && !IsProcessInForeground()) {
+        limitResolution = g_backgroundLimitResolution;
+    }
+
+    return desiredResolution < limitResolution ? limitResolution : desiredResolution;
+}
+
+ResolutionStats& GetStatsEntry(std::vector<ResolutionStats>& stats, ULONG resolution)
+{
+    for (auto& entry : stats) {
+        if (entry.resolution == resolution) {
+            return entry;
+        }
+    }
+
+    stats.push_back({resolution, 0, 0});
+    return stats.back();
+}
+
+// Must be called with g_requestMutex held.
+void AccountRequestTime(ULONGLONG now)
+{
+    if (g_requestActive) {
+        ULONGLONG elapsed = now - g_grantedSince;
+        GetStatsEntry(g_requestedStats, g_requestedResolution).totalTime += elapsed;
+        GetStatsEntry(g_grantedStats, g_grantedResolution).totalTime += elapsed;
+    }
+
+    g_grantedSince = now;
+}
+
+// Must be called with g_requestMutex held.
+void LogStats(ULONGLONG now)
+{
+    AccountRequestTime(now);
+    g_lastStatsLogTime = now;
+
+    for (const auto& entry : g_requestedStats) {
+        Wh_Log(L"Stats: requested %f milliseconds %u time(s), held for %f seconds",
+            (double)entry.resolution / 10000.0, entry.requests, (double)entry.totalTime / 1000.0);
+    }
+
+    for (const auto& entry : g_grantedStats) {
+        Wh_Log(L"Stats: granted %f milliseconds for %f seconds",
+            (double)entry.resolution / 10000.0, (double)entry.totalTime / 1000.0);
+    }
+
+    ULONG minimumResolution, maximumResolution, currentResolution;
+    if (pNtQueryTimerResolution &&
+        NT_SUCCESS(pNtQueryTimerResolution(&minimumResolution, &maximumResolution, &currentResolution))) {
+        Wh_Log(L"Stats: effective system resolution: %f milliseconds", (double)currentResolution / 10000.0);
+    }
+}
+
+// Applies the current policy to an active request, e.g. after the process
+// moved to or from the foreground or the settings changed.
+void ReevaluateRequest()
+{
+    std::lock_guard<std::mutex> guard(g_requestMutex);
+
+    if (!g_requestActive) {
+        return;
+    }
+
+    ULONGLONG now = GetTickCount64();
+
+    ULONG grantedResolution = ArbitrateResolution(g_requestedResolution);
+    if (grantedResolution != g_grantedResolution) {
+        AccountRequestTime(now);
+        g_grantedResolution = grantedResolution;
+
+        Wh_Log(L"* Re-evaluated, granting %f milliseconds (requested %f milliseconds)",
+            (double)grantedResolution / 10000.0, (double)g_requestedResolution / 10000.0);
+
+        ULONG currentResolution;
+        pOriginalNtSetTimerResolution(grantedResolution, TRUE, &currentResolution);
+    }
+
+    if (g_statsInterval && now - g_lastStatsLogTime >= g_statsInterval) {
+        LogStats(now);
+    }
+}
+
+VOID CALLBACK ReevaluateTimerCallback(PVOID, BOOLEAN)
+{
+    ReevaluateRequest();
+}
+
+// Must be called with g_requestMutex held. The timer is only needed while the
+// process holds a request, which is rare for most processes, and only if the
+// settings rely on it. Once created, it's kept until the mod is unloaded.
+void EnsureReevaluateTimer()
+{
+    if (g_reevaluateTimer || !g_requestActive || (!g_backgroundLimitEnabled && !g_statsInterval)) {
+        return;
+    }
+
+    if (!CreateTimerQueueTimer(&g_reevaluateTimer, nullptr, ReevaluateTimerCallback, nullptr,
+            REEVALUATE_INTERVAL, REEVALUATE_INTERVAL, WT_EXECUTEDEFAULT)) {
+        g_reevaluateTimer = nullptr;
+    }
+}
+
 NTSTATUS WINAPI NtSetTimerResolutionHook(ULONG DesiredResolution, BOOLEAN SetResolution, PULONG CurrentResolution)
 {
+    std::lock_guard<std::mutex> guard(g_requestMutex);
+
+    ULONGLONG now = GetTickCount64();
+
     if (!SetResolution) {
         Wh_Log(L"< SetResolution is FALSE");
+
+        if (g_requestActive) {
+            LogStats(now);
+            g_requestActive = false;
+        }
+
         return pOriginalNtSetTimerResolution(DesiredResolution, SetResolution, CurrentResolution);
     }
 
     Wh_Log(L"> DesiredResolution: %f milliseconds", (double)DesiredResolution / 10000.0);
 
-    ULONG limitResolution = g_limitResolution;
-    if (DesiredResolution < limitResolution) {
-        Wh_Log(L"* Overriding resolution: %f milliseconds", (double)limitResolution / 10000.0);
-        DesiredResolution = limitResolution;
+    AccountRequestTime(now);
+
+    ULONG grantedResolution = ArbitrateResolution(DesiredResolution);
+    if (grantedResolution != DesiredResolution) {
+        Wh_Log(L"* Overriding resolution: %f milliseconds", (double)grantedResolution / 10000.0);
     }
 
-    return pOriginalNtSetTimerResolution(DesiredResolution, SetResolution, CurrentResolution);
+    if (!g_requestActive) {
+        g_lastStatsLogTime = now;
+    }
+
+    g_requestActive = true;
+    g_requestedResolution = DesiredResolution;
+    g_grantedResolution = grantedResolution;
+    GetStatsEntry(g_requestedStats, DesiredResolution).requests++;
+
+    EnsureReevaluateTimer();
+
+    return pOriginalNtSetTimerResolution(grantedResolution, SetResolution, CurrentResolution);
 }
 
 void LoadSettings(void)
@@ -181,6 +384,23 @@ void LoadSettings(void)
         Wh_Log(L"Config loaded: Allowing changes");
         g_limitResolution = g_maximumResolution;
     }
+
+    g_backgroundLimitEnabled = Wh_GetIntSetting(L"BackgroundLimitEnabled") != 0;
+    if (g_backgroundLimitEnabled) {
+        ULONG backgroundLimitResolution = Wh_GetIntSetting(L"BackgroundLimit") * 10000;
+        if (backgroundLimitResolution > g_minimumResolution) {
+            backgroundLimitResolution = g_minimumResolution;
+        }
+        else if (backgroundLimitResolution < g_maximumResolution) {
+            backgroundLimitResolution = g_maximumResolution;
+        }
+
+        Wh_Log(L"Config loaded: Limiting background to %f milliseconds", (double)backgroundLimitResolution / 10000.0);
+        g_backgroundLimitResolution = backgroundLimitResolution;
+    }
+
+    int statsInterval = Wh_GetIntSetting(L"StatsInterval");
+    g_statsInterval = statsInterval > 0 ? (ULONGLONG)statsInterval * 1000 : 0;
 }
 
 BOOL Wh_ModInit(void)
@@ -192,7 +412,7 @@ BOOL Wh_ModInit(void)
         return FALSE;
     }
 
-    FARPROC pNtQueryTimerResolution = GetProcAddress(hNtdll, "NtQueryTimerResolution");
+    pNtQueryTimerResolution = (NtQueryTimerResolution_t)GetProcAddress(hNtdll, "NtQueryTimerResolution");
     if (!pNtQueryTimerResolution) {
         return FALSE;
     }
@@ -205,8 +425,7 @@ BOOL Wh_ModInit(void)
     ULONG MinimumResolution;
     ULONG MaximumResolution;
     ULONG CurrentResolution;
-    NTSTATUS status = ((NTSTATUS(WINAPI*)(PULONG, PULONG, PULONG))pNtQueryTimerResolution)(
-        &MinimumResolution, &MaximumResolution, &CurrentResolution);
+    NTSTATUS status = pNtQueryTimerResolution(&MinimumResolution, &MaximumResolution, &CurrentResolution);
     if (NT_SUCCESS(status)) {
         Wh_Log(L"NtQueryTimerResolution: min=%f, max=%f, current=%f",
             (double)MinimumResolution / 10000.0,
@@ -223,9 +442,38 @@ BOOL Wh_ModInit(void)
     return TRUE;
 }
 
+void Wh_ModUninit(void)
+{
+    Wh_Log(L"Uninit");
+
+    if (g_reevaluateTimer) {
+        DeleteTimerQueueTimer(nullptr, g_reevaluateTimer, INVALID_HANDLE_VALUE);
+        g_reevaluateTimer = nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(g_requestMutex);
+
+    if (g_requestActive) {
+        LogStats(GetTickCount64());
+
+        // Give the program the resolution it asked for, the hook is about to
+        // be removed.
+        if (g_grantedResolution != g_requestedResolution) {
+            ULONG currentResolution;
+            pOriginalNtSetTimerResolution(g_requestedResolution, TRUE, &currentResolution);
+        }
+    }
+}
+
 void Wh_ModSettingsChanged(void)
 {
     Wh_Log(L"SettingsChanged");
 
-    LoadSettings();
+    {
+        std::lock_guard<std::mutex> guard(g_requestMutex);
+        LoadSettings();
+        EnsureReevaluateTimer();
+    }
+
+    ReevaluateRequest();
 }
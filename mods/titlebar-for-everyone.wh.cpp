@@ -2,7 +2,7 @@
 // @id              titlebar-for-everyone
 // @name            Titlebar For Everyone
 // @description     Force native title bars and frames for various programs
-// @version         0.4
+// @version         0.4.1
 // @author          Ingan121
 // @github          https://github.com/Ingan121
 // @twitter         https://twitter.com/Ingan121
@@ -142,6 +142,7 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <atomic>
 
 #ifndef WS_EX_NOREDIRECTIONBITMAP // WH 1.4
 #define WS_EX_NOREDIRECTIONBITMAP 0x00200000L
@@ -171,6 +172,9 @@ WorkingMode mode = MODE_DEFAULT;
 BOOL isSteam = FALSE;
 wchar_t steamIndexHtml[MAX_PATH];
 wchar_t steamIndexHtmlModded[MAX_PATH];
+HANDLE steamPrepareThread = NULL;
+std::atomic<bool> steamPrepared = false;
+thread_local bool inSteamPrepareThread = false;
 
 BOOL isBrave = FALSE;
 
@@ -568,7 +572,13 @@ HANDLE WINAPI CreateFileW_hook(
         compareFileName += 4;
     }
 
-    if (wcsicmp(compareFileName, steamIndexHtml) == 0) {
+    // The prepare thread reads the original file, it must not wait for itself
+    if (!inSteamPrepareThread &&
+        wcsicmp(compareFileName, steamIndexHtml) == 0 &&
+        // The modified file is prepared in the background, it's normally done
+        // long before Steam gets to load its UI
+        WaitForSingleObject(steamPrepareThread, 5000) == WAIT_OBJECT_0 &&
+        steamPrepared) {
         Wh_Log(L"lpFileName = %s", compareFileName);
         Wh_Log(L"=>");
         Wh_Log(L"lpFileName = %s", steamIndexHtmlModded);
@@ -586,6 +596,17 @@ HANDLE WINAPI CreateFileW_hook(
     );
 }
 
+BOOL ReadFileContents(PCWSTR path, std::string& contents) {
+    std::ifstream inFile(path, std::ios::binary);
+    if (!inFile)
+        return FALSE;
+
+    std::ostringstream buffer;
+    buffer << inFile.rdbuf();
+    contents = buffer.str();
+    return TRUE;
+}
+
 BOOL PrepareSteamIndexHtml() {
     wchar_t tempPath[MAX_PATH];
     if (!GetTempPathW(MAX_PATH, tempPath))
@@ -594,15 +615,10 @@ BOOL PrepareSteamIndexHtml() {
     if (!PathCombineW(steamIndexHtmlModded, tempPath, L"tb4e-steam-index.html"))
         return FALSE;
 
-    std::ifstream inFile(steamIndexHtml, std::ios::binary);
-    if (!inFile)
+    std::string html;
+    if (!ReadFileContents(steamIndexHtml, html))
         return FALSE;
 
-    std::ostringstream buffer;
-    buffer << inFile.rdbuf();
-    std::string html = buffer.str();
-    inFile.close();
-
     // Hook window.open to override browserType to 3
     const char* injectScript =
         "<script>window.open=(()=>{const o=window.open;return(s,t,f)=>{const u=new URL(s);u.searchParams.set('browserType','3');return o(u.toString(),t,f);};})();</script>";
@@ -614,16 +630,40 @@ BOOL PrepareSteamIndexHtml() {
 
     html.insert(insertPos, injectScript);
 
-    std::ofstream outFile(steamIndexHtmlModded, std::ios::binary);
+    // Skip the write if the file left by the previous launch is up to date
+    std::string existingHtml;
+    if (ReadFileContents(steamIndexHtmlModded, existingHtml) && existingHtml == html) {
+        Wh_Log(L"Modified steam index.html is up to date: %s", steamIndexHtmlModded);
+        return TRUE;
+    }
+
+    // Write to a temporary file first, so that the modified file is never seen
+    // half-written
+    wchar_t steamIndexHtmlModdedTemp[MAX_PATH];
+    if (swprintf_s(steamIndexHtmlModdedTemp, L"%s.%lu.tmp", steamIndexHtmlModded, GetCurrentProcessId()) < 0)
+        return FALSE;
+
+    std::ofstream outFile(steamIndexHtmlModdedTemp, std::ios::binary);
     if (!outFile)
         return FALSE;
 
     outFile.write(html.data(), html.size());
     outFile.close();
+    if (!outFile ||
+        !MoveFileExW(steamIndexHtmlModdedTemp, steamIndexHtmlModded, MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(steamIndexHtmlModdedTemp);
+        return FALSE;
+    }
 
     Wh_Log(L"Modified steam index.html written to: %s", steamIndexHtmlModded);
     return TRUE;
 }
+
+DWORD WINAPI PrepareSteamIndexHtmlThreadProc(LPVOID) {
+    inSteamPrepareThread = true;
+    steamPrepared = PrepareSteamIndexHtml();
+    return 0;
+}
 #pragma endregion
 
 void LoadSettings() {
@@ -658,7 +698,6 @@ BOOL Wh_ModInit() {
     wchar_t modulePath[MAX_PATH];
     GetModuleFileName(NULL, modulePath, MAX_PATH);
     isSteam = wcsstr(_wcsupr(modulePath), L"STEAMWEBHELPER.EXE") != NULL;
-    BOOL steamPrepared = FALSE;
     if (isSteam) {
         Wh_Log(L"Steam detected");
         PathRemoveFileSpecW(modulePath);
@@ -667,7 +706,8 @@ BOOL Wh_ModInit() {
         PathCombineW(temp, modulePath, L"..\\..\\..\\steamui\\index.html");
         GetFullPathNameW(temp, MAX_PATH, steamIndexHtml, NULL);
 
-        steamPrepared = PrepareSteamIndexHtml();
+        // Don't hold up the process startup with the file I/O
+        steamPrepareThread = CreateThread(NULL, 0, PrepareSteamIndexHtmlThreadProc, NULL, 0, NULL);
     }
 
     isBrave = wcsstr(modulePath, L"BRAVE.EXE") != NULL;
@@ -687,7 +727,7 @@ BOOL Wh_ModInit() {
                        (void**)&ShowWindow_original);
     Wh_SetFunctionHook((void*)SetParent, (void*)SetParent_hook,
                        (void**)&SetParent_original);
-    if (isSteam && steamPrepared) {
+    if (isSteam && steamPrepareThread) {
         Wh_SetFunctionHook((void*)CreateFileW, (void*)CreateFileW_hook,
                            (void**)&CreateFileW_original);
     }
@@ -700,6 +740,12 @@ BOOL Wh_ModInit() {
 void Wh_ModUninit() {
     Wh_Log(L"Uninit");
     EnumWindows(UninitEnumWindowsProc, 1);
+
+    if (steamPrepareThread) {
+        WaitForSingleObject(steamPrepareThread, INFINITE);
+        CloseHandle(steamPrepareThread);
+        steamPrepareThread = NULL;
+    }
 }
 
 void Wh_ModSettingsChanged() {
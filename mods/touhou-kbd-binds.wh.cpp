@@ -2,7 +2,7 @@
 // @id              touhou-kbd-binds
 // @name            Touhou Keyboard Binds
 // @description     Allows you to change keyboard binds in Touhou
-// @version         1.0.0
+// @version         1.0.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         東方紅魔郷.exe
@@ -61,12 +61,17 @@ Numpad2, Numpad3, Numpad4, Numpad5, Numpad6, Numpad7, Numpad8, Numpad9
   $name: Shoot/Confirm
 - bomb: "X"
   $name: Bomb/Back
+- logpolllatency: false
+  $name: Log poll latency
+  $description: Logs how long applying the binds takes, averaged every 1000 polls
 */
 // ==/WindhawkModSettings==
 
 #include <windhawk_utils.h>
 #include <dinput.h>
 
+#include <atomic>
+
 BYTE g_vkUp    = VK_UP;
 BYTE g_vkDown  = VK_DOWN;
 BYTE g_vkLeft  = VK_LEFT;
@@ -85,7 +90,122 @@ BYTE g_dikSpeed = DIK_LCONTROL;
 BYTE g_dikShoot = DIK_Z;
 BYTE g_dikBomb  = DIK_X;
 
-#define SET_KEY_STATE(i, v) if (v) lpKeyState[i] = lpKeyState[v]
+bool g_fLogPollLatency = false;
+
+#define KEY_BIND_COUNT 8
+
+// The binds, compiled into (target, source) pairs when the settings are
+// loaded. All sources are read before any target is written, so binds which
+// swap keys work regardless of their order.
+typedef struct _KEY_REMAP_TABLE
+{
+    BYTE cRemaps;
+    BYTE rgTarget[KEY_BIND_COUNT];
+    BYTE rgSource[KEY_BIND_COUNT];
+} KEY_REMAP_TABLE;
+
+typedef struct _KEY_REMAPS
+{
+    KEY_REMAP_TABLE vk;
+    KEY_REMAP_TABLE dik;
+} KEY_REMAPS;
+
+// Settings are compiled into the table not in use and then published by
+// swapping the index, so that the game's polling thread never sees a half
+// built table. Readers are counted per table, and a table is only rewritten
+// once the readers which picked it before the last swap are done with it.
+KEY_REMAPS g_rgKeyRemaps[2];
+std::atomic<LONG> g_iKeyRemaps = 0;
+std::atomic<LONG> g_rgcKeyRemapsReaders[2];
+
+LONG AcquireKeyRemaps(void)
+{
+    for (;;)
+    {
+        LONG i = g_iKeyRemaps;
+        g_rgcKeyRemapsReaders[i]++;
+        if (g_iKeyRemaps == i)
+            return i;
+        g_rgcKeyRemapsReaders[i]--;
+    }
+}
+
+void ReleaseKeyRemaps(LONG i)
+{
+    g_rgcKeyRemapsReaders[i]--;
+}
+
+void AddKeyRemap(KEY_REMAP_TABLE *pTable, BYTE bTarget, BYTE bSource)
+{
+    // 0 means the bind is unset
+    if (bSource && bSource != bTarget)
+    {
+        pTable->rgTarget[pTable->cRemaps] = bTarget;
+        pTable->rgSource[pTable->cRemaps] = bSource;
+        pTable->cRemaps++;
+    }
+}
+
+void CompileKeyRemaps(void)
+{
+    LONG iNext = 1 - g_iKeyRemaps;
+    while (g_rgcKeyRemapsReaders[iNext] != 0)
+        SwitchToThread();
+
+    KEY_REMAPS *pRemaps = &g_rgKeyRemaps[iNext];
+    ZeroMemory(pRemaps, sizeof(*pRemaps));
+
+    AddKeyRemap(&pRemaps->vk, VK_UP,      g_vkUp);
+    AddKeyRemap(&pRemaps->vk, VK_DOWN,    g_vkDown);
+    AddKeyRemap(&pRemaps->vk, VK_LEFT,    g_vkLeft);
+    AddKeyRemap(&pRemaps->vk, VK_RIGHT,   g_vkRight);
+    AddKeyRemap(&pRemaps->vk, VK_SHIFT,   g_vkFocus);
+    AddKeyRemap(&pRemaps->vk, VK_CONTROL, g_vkSpeed);
+    AddKeyRemap(&pRemaps->vk, 'Z',        g_vkShoot);
+    AddKeyRemap(&pRemaps->vk, 'X',        g_vkBomb);
+
+    AddKeyRemap(&pRemaps->dik, DIK_UP,       g_dikUp);
+    AddKeyRemap(&pRemaps->dik, DIK_DOWN,     g_dikDown);
+    AddKeyRemap(&pRemaps->dik, DIK_LEFT,     g_dikLeft);
+    AddKeyRemap(&pRemaps->dik, DIK_RIGHT,    g_dikRight);
+    AddKeyRemap(&pRemaps->dik, DIK_LSHIFT,   g_dikFocus);
+    AddKeyRemap(&pRemaps->dik, DIK_LCONTROL, g_dikSpeed);
+    AddKeyRemap(&pRemaps->dik, DIK_Z,        g_dikShoot);
+    AddKeyRemap(&pRemaps->dik, DIK_X,        g_dikBomb);
+
+    g_iKeyRemaps = iNext;
+}
+
+void ApplyKeyRemaps(const KEY_REMAP_TABLE *pTable, PBYTE lpKeyState)
+{
+    BYTE rgState[KEY_BIND_COUNT];
+    for (BYTE i = 0; i < pTable->cRemaps; i++)
+        rgState[i] = lpKeyState[pTable->rgSource[i]];
+    for (BYTE i = 0; i < pTable->cRemaps; i++)
+        lpKeyState[pTable->rgTarget[i]] = rgState[i];
+}
+
+// Poll latency instrumentation, enabled by the logpolllatency setting.
+struct
+{
+    LARGE_INTEGER liFrequency;
+    LONGLONG llTotal;
+    DWORD cPolls;
+} g_pollStats;
+
+void RecordPollLatency(LONGLONG llStart)
+{
+    LARGE_INTEGER liEnd;
+    QueryPerformanceCounter(&liEnd);
+    g_pollStats.llTotal += liEnd.QuadPart - llStart;
+    if (++g_pollStats.cPolls == 1000)
+    {
+        Wh_Log(L"Average bind cost: %lld ns per poll",
+            g_pollStats.llTotal * 1000000000 / g_pollStats.liFrequency.QuadPart / g_pollStats.cPolls);
+        g_pollStats.llTotal = 0;
+        g_pollStats.cPolls = 0;
+    }
+}
 
 BOOL (WINAPI *GetKeyboardState_orig)(PBYTE);
 BOOL WINAPI GetKeyboardState_hook(PBYTE lpKeyState)
@@ -93,14 +213,13 @@ BOOL WINAPI GetKeyboardState_hook(PBYTE lpKeyState)
     if (!GetKeyboardState_orig(lpKeyState))
         return FALSE;
 
-    SET_KEY_STATE(VK_UP,      g_vkUp);
-    SET_KEY_STATE(VK_DOWN,    g_vkDown);
-    SET_KEY_STATE(VK_LEFT,    g_vkLeft);
-    SET_KEY_STATE(VK_RIGHT,   g_vkRight);
-    SET_KEY_STATE(VK_SHIFT,   g_vkFocus);
-    SET_KEY_STATE(VK_CONTROL, g_vkSpeed);
-    SET_KEY_STATE('Z',        g_vkShoot);
-    SET_KEY_STATE('X',        g_vkBomb);
+    LARGE_INTEGER liStart;
+    if (g_fLogPollLatency)
+        QueryPerformanceCounter(&liStart);
+
+    LONG iRemaps = AcquireKeyRemaps();
+    ApplyKeyRemaps(&g_rgKeyRemaps[iRemaps].vk, lpKeyState);
+    ReleaseKeyRemaps(iRemaps);
 
     // Prevent alternate keys from applying alongside
     // our custom binds
@@ -118,6 +237,9 @@ BOOL WINAPI GetKeyboardState_hook(PBYTE lpKeyState)
     {
         lpKeyState[bKey] = 0;
     }
+
+    if (g_fLogPollLatency)
+        RecordPollLatency(liStart.QuadPart);
     return TRUE;
 }
 
@@ -132,14 +254,14 @@ STDMETHODIMP CKbd_GetDeviceState_hook(
     if (SUCCEEDED(hr))
     {
         PBYTE lpKeyState = (PBYTE)lpvData;
-        SET_KEY_STATE(DIK_UP,       g_dikUp);
-        SET_KEY_STATE(DIK_DOWN,     g_dikDown);
-        SET_KEY_STATE(DIK_LEFT,     g_dikLeft);
-        SET_KEY_STATE(DIK_RIGHT,    g_dikRight);
-        SET_KEY_STATE(DIK_LSHIFT,   g_dikFocus);
-        SET_KEY_STATE(DIK_LCONTROL, g_dikSpeed);
-        SET_KEY_STATE(DIK_Z,        g_dikShoot);
-        SET_KEY_STATE(DIK_X,        g_dikBomb);
+
+        LARGE_INTEGER liStart;
+        if (g_fLogPollLatency)
+            QueryPerformanceCounter(&liStart);
+
+        LONG iRemaps = AcquireKeyRemaps();
+        ApplyKeyRemaps(&g_rgKeyRemaps[iRemaps].dik, lpKeyState);
+        ReleaseKeyRemaps(iRemaps);
 
         // Prevent alternate keys from applying alongside
         // our custom binds
@@ -159,6 +281,9 @@ STDMETHODIMP CKbd_GetDeviceState_hook(
         {
             lpKeyState[bKey] = 0;
         }
+
+        if (g_fLogPollLatency)
+            RecordPollLatency(liStart.QuadPart);
     }
     return hr;
 }
@@ -244,7 +369,7 @@ bool LoadKey(LPCWSTR pszName, LPBYTE pbvk, LPBYTE pbdik)
 
 bool LoadSettings(void)
 {
-    return LoadKey(L"up", &g_vkUp, &g_dikUp)
+    bool fSuccess = LoadKey(L"up", &g_vkUp, &g_dikUp)
     && LoadKey(L"down", &g_vkDown, &g_dikDown)
     && LoadKey(L"left", &g_vkLeft, &g_dikLeft)
     && LoadKey(L"right", &g_vkRight, &g_dikRight)
@@ -252,6 +377,10 @@ bool LoadSettings(void)
     && LoadKey(L"speed", &g_vkSpeed, &g_dikSpeed)
     && LoadKey(L"shoot", &g_vkShoot, &g_dikShoot)
     && LoadKey(L"bomb", &g_vkBomb, &g_dikBomb);
+
+    g_fLogPollLatency = Wh_GetIntSetting(L"logpolllatency");
+    CompileKeyRemaps();
+    return fSuccess;
 }
 
 const WindhawkUtils::SYMBOL_HOOK dinput8DllHooks[] = {
@@ -267,6 +396,8 @@ const WindhawkUtils::SYMBOL_HOOK dinput8DllHooks[] = {
 
 BOOL Wh_ModInit(void)
 {
+    QueryPerformanceFrequency(&g_pollStats.liFrequency);
+
     if (!LoadSettings())
         return FALSE;
     
@@ -2,7 +2,7 @@
 // @id              translucent-windows
 // @name            Translucent Windows
 // @description     Enables native translucent effects in Windows 11
-// @version         1.6.3
+// @version         1.7.1
 // @author          Undisputed00x
 // @github          https://github.com/Undisputed00x
 // @include         *
@@ -60,6 +60,18 @@ maximized or snapped to the edge of the screen, this is caused by default.
       $name: Text alpha blending
       $description: >-
        Alpha blends Windows GDI text rendering.
+    - HardwarePartRendering: FALSE
+      $name: Hardware accelerated theme parts
+      $description: >-
+       Draws the cached parts of Windows theme custom rendering with a hardware Direct2D
+       render target instead of GDI. Falls back to GDI if the graphics device is lost.
+       (Requires Windows theme custom rendering)
+    - StretchedPartCache: FALSE
+      $name: Cache stretched theme parts
+      $description: >-
+       Keeps copies of the cached parts stretched to the sizes drawn most recently, so that
+       views with many items of the same size, e.g. folders of thumbnails, draw each item
+       with a single blit. Uses more memory. (Requires Windows theme custom rendering)
   $name: Rendering Customization
 - type: none
   $name: Effects
@@ -280,7 +292,11 @@ maximized or snapped to the edge of the screen, this is caused by default.
 #include <random>
 #include <string>
 #include <array>
+#include <memory>
 #include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <vector>
 #include <unordered_set>
 #include <d2d1.h>
 #include <wrl.h>
@@ -298,6 +314,48 @@ static constexpr UINT DEFAULT = 0; // DWMWCP_DEFAULT
 static constexpr UINT DONTROUND = 1; // DWMWCP_DONOTROUND
 static constexpr UINT SMALLROUND = 3; // DWMWCP_ROUNDSMALL
 
+// Paint failures tend to repeat on every paint (e.g. until the device is
+// recreated), so logging each one floods the log and slows down painting.
+// A call site logs at most kBurst lines per interval, and the
+// number of dropped lines is reported with the next line which is logged.
+struct LogRateLimiter
+{
+    static constexpr DWORD kIntervalMs = 5000;
+    static constexpr LONG kBurst = 5;
+
+    std::atomic<DWORD> intervalStart{};
+    std::atomic<LONG> count{};
+    std::atomic<LONG> dropped{};
+
+    bool Allow(LONG* droppedSinceLastLine)
+    {
+        DWORD now = GetTickCount();
+        DWORD start = intervalStart.load(std::memory_order_relaxed);
+        if (now - start >= kIntervalMs && intervalStart.compare_exchange_strong(start, now))
+            count = 0;
+
+        if (count.fetch_add(1, std::memory_order_relaxed) >= kBurst)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        *droppedSinceLastLine = dropped.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+#define Wh_LogRateLimited(message, ...)                                       \
+    do {                                                                      \
+        static LogRateLimiter logRateLimiter;                                 \
+        LONG droppedSinceLastLine;                                            \
+        if (logRateLimiter.Allow(&droppedSinceLastLine)) {                    \
+            if (droppedSinceLastLine)                                         \
+                Wh_Log(L"(%ld similar lines dropped)", droppedSinceLastLine); \
+            Wh_Log(message, ##__VA_ARGS__);                                   \
+        }                                                                     \
+    } while (0)
+
 // Get DPI value from the primary monitor without dependance to DPI-aware API
 // TODO: Get DPI per window monitor
 UINT GetDpiFromMonitor()
@@ -331,9 +389,12 @@ static auto DrawTextWithGlow = (pDrawTextWithGlow)GetProcAddress(GetModuleHandle
 //typedef HRESULT(WINAPI* pShouldSystemUseDarkMode)();
 //static auto ShouldSystemUseDarkMode = (pShouldSystemUseDarkMode)GetProcAddress(GetModuleHandle(L"uxtheme.dll"), MAKEINTRESOURCEA(138));
 
-thread_local HHOOK g_callWndProcHook;
+// One WH_CALLWNDPROC hook per GUI thread, shared by all of its windows
 std::mutex g_allCallWndProcHooksMutex;
-std::unordered_set<HHOOK> g_allCallWndProcHooks;
+std::unordered_map<DWORD, HHOOK> g_allCallWndProcHooks;
+// Set on a hooked thread, when the hook is installed from it or on the first
+// hook call, so that other threads don't take the lock when they exit
+thread_local BOOL g_threadHasCallWndProcHook;
 
 using PUNICODE_STRING = PVOID;
 
@@ -342,6 +403,8 @@ struct Settings{
     BOOL AccentColorize = FALSE;
     COLORREF AccentColor = 0xFFFFFFFF;
     BOOL TextAlphaBlend = FALSE;
+    BOOL HardwarePartRendering = FALSE;
+    BOOL StretchedPartCache = FALSE;
     COLORREF AccentBlurBehindClr = 0x00000000;
     BOOL ImmersiveDarkmode = TRUE;
     BOOL ExtendFrame = FALSE;
@@ -519,12 +582,21 @@ VOID NewWindowShown(HWND);
 BOOL IsWindowClass(HWND hWnd, LPCWSTR ClassName)
 {
     WCHAR ClassNameBuffer[256]; 
-    GetClassNameW(hWnd, ClassNameBuffer, sizeof(ClassNameBuffer));
+    if (!GetClassNameW(hWnd, ClassNameBuffer, ARRAYSIZE(ClassNameBuffer)))
+        return FALSE;
     if(!wcscmp(ClassName, ClassNameBuffer))
         return TRUE;
     return FALSE;
 }
 
+BOOL IsChromeWindowClass(HWND hWnd)
+{
+    WCHAR ClassNameBuffer[256];
+    if (!GetClassNameW(hWnd, ClassNameBuffer, ARRAYSIZE(ClassNameBuffer)))
+        return FALSE;
+    return !wcscmp(ClassNameBuffer, L"Chrome_WidgetWin_1") || !wcscmp(ClassNameBuffer, L"Chrome_WidgetWin_0");
+}
+
 BOOL IsWindowEligible(HWND hWnd) 
 {      
     LONG_PTR styleEx = GetWindowLongPtrW(hWnd, GWL_EXSTYLE);
@@ -545,8 +617,9 @@ BOOL IsWindowEligible(HWND hWnd)
         return FALSE;
 
     // Don't block CEF apps
-    if (!((IsWindowClass(hWnd, L"Chrome_WidgetWin_1") || IsWindowClass(hWnd, L"Chrome_WidgetWin_0")) || style & WS_POPUP || styleEx & WS_EX_APPWINDOW || styleEx & WS_EX_DLGMODALFRAME)
-        && !(style & WS_THICKFRAME || style & WS_MINIMIZEBOX || style & WS_MAXIMIZEBOX || style & 0x00000080l)) // Firefox dialog
+    // The class name is only needed when neither the styles decide, so query it last
+    if (!(style & WS_THICKFRAME || style & WS_MINIMIZEBOX || style & WS_MAXIMIZEBOX || style & 0x00000080l) // Firefox dialog
+        && !(style & WS_POPUP || styleEx & WS_EX_APPWINDOW || styleEx & WS_EX_DLGMODALFRAME || IsChromeWindowClass(hWnd)))
         return FALSE;
     
     return TRUE;
@@ -565,17 +638,23 @@ enum AccentColorShade
     AccentColorCount
 };
 
-class AccentPalette
+// An immutable snapshot of the accent palette. It's replaced as a whole when
+// the colorization changes, so that paint threads never see a partially
+// updated palette. Replaced snapshots are kept until the mod is unloaded, since
+// other threads might still be reading them.
+struct AccentPalette
 {
-public:
-    std::array<COLORREF, AccentColorCount> Colors;
+    std::array<COLORREF, AccentColorCount> Colors{};
     BOOL LoadAccentPalette();
-    AccentPalette()
-    {
-        LoadAccentPalette();
-    }
 };
-AccentPalette g_AccentPalette;
+
+std::atomic<const AccentPalette*> g_accentPalette;
+std::mutex g_accentPalettesReplacedMutex;
+std::vector<std::unique_ptr<const AccentPalette>> g_accentPalettesReplaced;
+
+// The last WM_DWMCOLORIZATIONCOLORCHANGED color, since every top level window
+// of the process gets the broadcast.
+std::atomic<LONG_PTR> g_lastColorizationColor{ -1 };
 
 BOOL AccentPalette::LoadAccentPalette()
 {
@@ -606,6 +685,27 @@ BOOL AccentPalette::LoadAccentPalette()
     return true;
 }
 
+VOID UpdateAccentPalette()
+{
+    auto palette = std::make_unique<AccentPalette>();
+    // Keep the current palette if the new one can't be read
+    if (!palette->LoadAccentPalette() && g_accentPalette)
+        return;
+
+    const AccentPalette* prevPalette = g_accentPalette.exchange(palette.release());
+    if (prevPalette)
+    {
+        std::lock_guard<std::mutex> guard(g_accentPalettesReplacedMutex);
+        g_accentPalettesReplaced.emplace_back(prevPalette);
+    }
+}
+
+COLORREF GetAccentPaletteColor(AccentColorShade AccentShade)
+{
+    const AccentPalette* palette = g_accentPalette;
+    return palette ? palette->Colors[(INT)AccentShade] : RGB(0, 0, 0);
+}
+
 BOOL GetAccentColor(COLORREF& outColor)
 {
     // In some programs, e.g. snippingtool.exe, the default blue accent color is used instead of the Windows theme with DwmGetColorizationColor.
@@ -665,9 +765,10 @@ D2D1_COLOR_F IsAccentColorPossibleD2D(BYTE A, BYTE R, BYTE G, BYTE B, AccentColo
             AccentShade = static_cast<AccentColorShade>(6 - AccentShade);
         else if (!ShouldSystemUseDarkMode() && AccentShade < 3)
             AccentShade = static_cast<AccentColorShade>(6 - AccentShade); */
-        R = GetRValue(g_AccentPalette.Colors[(INT)AccentShade]);
-        G = GetGValue(g_AccentPalette.Colors[(INT)AccentShade]);
-        B = GetBValue(g_AccentPalette.Colors[(INT)AccentShade]);
+        COLORREF AccentClr = GetAccentPaletteColor(AccentShade);
+        R = GetRValue(AccentClr);
+        G = GetGValue(AccentClr);
+        B = GetBValue(AccentClr);
         return MyD2D1Color(A, R, G, B);
     }
     else
@@ -683,9 +784,10 @@ D2D1_COLOR_F IsAccentColorPossibleD2D(BYTE R, BYTE G, BYTE B, AccentColorShade A
             AccentShade = static_cast<AccentColorShade>(6 - AccentShade);
         else if (!ShouldSystemUseDarkMode() && AccentShade < 3)
             AccentShade = static_cast<AccentColorShade>(6 - AccentShade); */
-        R = GetRValue(g_AccentPalette.Colors[(INT)AccentShade]);
-        G = GetGValue(g_AccentPalette.Colors[(INT)AccentShade]);
-        B = GetBValue(g_AccentPalette.Colors[(INT)AccentShade]);
+        COLORREF AccentClr = GetAccentPaletteColor(AccentShade);
+        R = GetRValue(AccentClr);
+        G = GetGValue(AccentClr);
+        B = GetBValue(AccentClr);
         return MyD2D1Color(255, R, G, B);
     }
     else
@@ -1495,47 +1597,64 @@ HRESULT CreateBoundD2DRenderTarget(HDC hdc, LPCRECT pRect, ID2D1Factory* pFactor
     Microsoft::WRL::ComPtr<ID2D1DCRenderTarget> renderTarget;
     HRESULT hr = pFactory->CreateDCRenderTarget(&rtProps, &renderTarget);
     if (FAILED(hr)) {
-        Wh_Log(L"Failed to create DC target [ERROR]: 0x%08X\n", hr);
+        Wh_LogRateLimited(L"Failed to create DC target [ERROR]: 0x%08X\n", hr);
         return hr;
     }
 
     hr = renderTarget->BindDC(hdc, pRect);
     if (FAILED(hr)) {
-        Wh_Log(L"Failed to Bind DC target [ERROR]: 0x%08X\n", hr);
+        Wh_LogRateLimited(L"Failed to Bind DC target [ERROR]: 0x%08X\n", hr);
         return hr;
     }
     *ppRenderTarget = renderTarget.Detach();
     return S_OK;
 }
 
+struct CachedPart
+{
+    HDC hdc = nullptr;
+    // Bitmap dimensions and pixels, recorded on creation so paints don't query GDI for them
+    INT width = 0;
+    INT height = 0;
+    VOID* bits = nullptr;
+    // Tick count of the last paint, used to evict parts which went cold
+    mutable std::atomic<ULONGLONG> lastUse = 0;
+
+    operator HDC() const { return hdc; }
+};
+
 class CThemeCache
 {
 public:
-    std::array<HDC, 4> pushbutton;
-    std::array<HDC, 8> radiobutton;
-    std::array<HDC, 20> checkbutton;
-    std::array<HDC, 4> commandlinkbutton;
-    std::array<HDC, 3> commandlinkglyph;
-    std::array<HDC, 14> listview;
-    std::array<HDC, 4> scrollbar;
-    std::array<HDC, 4> tab;
-    std::array<HDC, 8> combobox;
-    std::array<HDC, 4> editbox;
-    std::array<HDC, 5> treeview;
-    std::array<HDC, 6> itemsview;
-    std::array<HDC, 10> progressbar;
-    std::array<HDC, 2> indeterminatebar;
-    std::array<HDC, 2> trackbar;
-    std::array<HDC, 24> trackbarthumb;
-    std::array<HDC, 2> header;
-    std::array<HDC, 1> previewseperator;
-    std::array<HDC, 4> modulebutton;
-    std::array<HDC, 4> modulelocationbutton;
-    std::array<HDC, 8> modulesplitbutton;
-    std::array<HDC, 12> navigationbutton;
-    std::array<HDC, 5> toolbarbutton;
-    std::array<HDC, 4> addressband;
-    std::array<HDC, 3> menuitem;
+    std::array<CachedPart, 4> pushbutton;
+    std::array<CachedPart, 8> radiobutton;
+    std::array<CachedPart, 20> checkbutton;
+    std::array<CachedPart, 4> commandlinkbutton;
+    std::array<CachedPart, 3> commandlinkglyph;
+    std::array<CachedPart, 14> listview;
+    std::array<CachedPart, 4> scrollbar;
+    std::array<CachedPart, 4> tab;
+    std::array<CachedPart, 8> combobox;
+    std::array<CachedPart, 4> editbox;
+    std::array<CachedPart, 5> treeview;
+    std::array<CachedPart, 6> itemsview;
+    std::array<CachedPart, 10> progressbar;
+    std::array<CachedPart, 2> indeterminatebar;
+    std::array<CachedPart, 2> trackbar;
+    std::array<CachedPart, 24> trackbarthumb;
+    std::array<CachedPart, 2> header;
+    std::array<CachedPart, 1> previewseperator;
+    std::array<CachedPart, 4> modulebutton;
+    std::array<CachedPart, 4> modulelocationbutton;
+    std::array<CachedPart, 8> modulesplitbutton;
+    std::array<CachedPart, 12> navigationbutton;
+    std::array<CachedPart, 5> toolbarbutton;
+    std::array<CachedPart, 4> addressband;
+    std::array<CachedPart, 3> menuitem;
+
+    // Bumped whenever a part is created or deleted, so copies of the cached
+    // bitmaps held elsewhere know they are stale
+    std::atomic<UINT> generation = 0;
 
     BOOL CachePushButton(HDC, INT, INT);
     BOOL CacheRadioButton(HDC, LPCRECT, INT, INT);
@@ -1566,8 +1685,12 @@ public:
     BOOL CacheAddressBand(HDC, INT, INT);
     BOOL CacheMenuItem(HDC, INT, INT, INT);
 
-    BOOL CreateDIB(HDC& elementHdc, HDC hDC, INT Width, INT Height)
+    BOOL CreateDIB(CachedPart& part, HDC hDC, INT Width, INT Height)
     {
+        std::lock_guard<std::mutex> guard(m_partsMutex);
+        m_misses++;
+
+        HDC& elementHdc = part.hdc;
         if (!elementHdc) {
             if (!(elementHdc = CreateCompatibleDC(hDC)))
                 return FALSE;
@@ -1592,68 +1715,153 @@ public:
             return FALSE;
         
         SelectObject(elementHdc, hBitmap);
+        part.width = Width;
+        part.height = Height;
+        part.bits = pvBits;
+        part.lastUse = GetTickCount64();
+        generation++;
         return TRUE;
     }
 
+    template <typename F>
+    VOID ForEachPart(F&& f)
+    {
+        for (CachedPart& part : pushbutton)
+            f(part);
+        for (CachedPart& part : radiobutton)
+            f(part);
+        for (CachedPart& part : checkbutton)
+            f(part);
+        for (CachedPart& part : commandlinkbutton)
+            f(part);
+        for (CachedPart& part : commandlinkglyph)
+            f(part);
+        for (CachedPart& part : listview)
+            f(part);
+        for (CachedPart& part : scrollbar)
+            f(part);
+        for (CachedPart& part : tab)
+            f(part);
+        for (CachedPart& part : combobox)
+            f(part);
+        for (CachedPart& part : editbox)
+            f(part);
+        for (CachedPart& part : treeview)
+            f(part);
+        for (CachedPart& part : itemsview)
+            f(part);
+        for (CachedPart& part : progressbar)
+            f(part);
+        for (CachedPart& part : indeterminatebar)
+            f(part);
+        for (CachedPart& part : trackbar)
+            f(part);
+        for (CachedPart& part : trackbarthumb)
+            f(part);
+        for (CachedPart& part : header)
+            f(part);
+        for (CachedPart& part : previewseperator)
+            f(part);
+        for (CachedPart& part : modulebutton)
+            f(part);
+        for (CachedPart& part : modulelocationbutton)
+            f(part);
+        for (CachedPart& part : modulesplitbutton)
+            f(part);
+        for (CachedPart& part : navigationbutton)
+            f(part);
+        for (CachedPart& part : toolbarbutton)
+            f(part);
+        for (CachedPart& part : addressband)
+            f(part);
+        for (CachedPart& part : menuitem)
+            f(part);
+    }
+
     VOID ClearCache()
     {
-        for (HDC& hDC : pushbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : radiobutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : checkbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : commandlinkbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : commandlinkglyph)
-            DeleteHDC(hDC);
-        for (HDC& hDC : listview)
-            DeleteHDC(hDC);
-        for (HDC& hDC : scrollbar)
-            DeleteHDC(hDC);
-        for (HDC& hDC : tab)
-            DeleteHDC(hDC);
-        for (HDC& hDC : combobox)
-            DeleteHDC(hDC);
-        for (HDC& hDC : editbox)
-            DeleteHDC(hDC);
-        for (HDC& hDC : treeview)
-            DeleteHDC(hDC);
-        for (HDC& hDC : itemsview)
-            DeleteHDC(hDC);
-        for (HDC& hDC : progressbar)
-            DeleteHDC(hDC);
-        for (HDC& hDC : indeterminatebar)
-            DeleteHDC(hDC);
-        for (HDC& hDC : trackbar)
-            DeleteHDC(hDC);
-        for (HDC& hDC : trackbarthumb)
-            DeleteHDC(hDC);
-        for (HDC& hDC : header)
-            DeleteHDC(hDC);
-        for (HDC& hDC : previewseperator)
-            DeleteHDC(hDC);
-        for (HDC& hDC : modulebutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : modulelocationbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : modulesplitbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : navigationbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : toolbarbutton)
-            DeleteHDC(hDC);
-        for (HDC& hDC : addressband)
-            DeleteHDC(hDC);
-        for (HDC& hDC : menuitem)
-            DeleteHDC(hDC);
-    }
-
-    VOID DeleteHDC(HDC& hDC)
-    {
-        if (hDC) {
+        std::lock_guard<std::mutex> guard(m_partsMutex);
+        ForEachPart([this](CachedPart& part) { DeleteHDC(part); });
+        FreeEvictedParts();
+    }
+
+    // Runs at most once per sweep interval from the paint path. Parts which
+    // weren't drawn for a while are detached and only freed on the next sweep,
+    // so a paint which picked up the handle just before can still finish with it
+    VOID EvictIdleParts(ULONGLONG now)
+    {
+        ULONGLONG due = m_nextSweep.load(std::memory_order_relaxed);
+        if (now < due || !m_nextSweep.compare_exchange_strong(due, now + kSweepInterval))
+            return;
+
+        std::lock_guard<std::mutex> guard(m_partsMutex);
+        FreeEvictedParts();
+
+        UINT evicted = 0;
+        ForEachPart([&](CachedPart& part) {
+            if (part.hdc && now - part.lastUse >= kIdleTimeout) {
+                m_evictedParts.push_back(std::exchange(part.hdc, nullptr));
+                part.bits = nullptr;
+                evicted++;
+            }
+        });
+        if (evicted) {
+            generation++;
+            LogUsageLocked(evicted);
+        }
+    }
+
+    // Also called when the settings change, so that the cache of a long running
+    // process can be checked on demand
+    VOID LogUsage()
+    {
+        std::lock_guard<std::mutex> guard(m_partsMutex);
+        LogUsageLocked(0);
+    }
+
+    VOID LogUsageLocked(UINT evicted)
+    {
+        UINT cached = 0;
+        ULONGLONG bytes = 0;
+        ForEachPart([&](CachedPart& part) {
+            if (part.hdc) {
+                cached++;
+                bytes += (ULONGLONG)part.width * part.height * 4;
+            }
+        });
+
+        // Each part holds a memory DC and its bitmap, evicted parts until the next sweep
+        UINT handles = (cached + (UINT)m_evictedParts.size()) * 2;
+        UINT misses = m_misses;
+        UINT draws = m_draws;
+        HANDLE hProcess = GetCurrentProcess();
+        Wh_Log(L"Theme cache: %u hits, %u misses, %u parts cached (%llu KB, %u GDI handles), %u evicted, %u GDI and %u USER objects in process",
+            draws > misses ? draws - misses : 0, misses, cached, bytes / 1024, handles, evicted,
+            GetGuiResources(hProcess, GR_GDIOBJECTS), GetGuiResources(hProcess, GR_USEROBJECTS));
+    }
+
+    VOID CountDraw()
+    {
+        m_draws.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    VOID FreeEvictedParts()
+    {
+        for (HDC hDC : m_evictedParts) {
             DeleteObject((HBITMAP)GetCurrentObject(hDC, OBJ_BITMAP));
-            DeleteDC(std::exchange(hDC, nullptr));
+            DeleteDC(hDC);
+        }
+        m_evictedParts.clear();
+    }
+
+    VOID DeleteHDC(CachedPart& part)
+    {
+        if (part.hdc) {
+            DeleteObject((HBITMAP)GetCurrentObject(part.hdc, OBJ_BITMAP));
+            DeleteDC(std::exchange(part.hdc, nullptr));
+            part.width = part.height = 0;
+            part.bits = nullptr;
+            generation++;
         }
     }
 
@@ -1661,100 +1869,330 @@ public:
     {
         ClearCache();
     }
+
+private:
+    static constexpr ULONGLONG kSweepInterval = 60 * 1000;
+    static constexpr ULONGLONG kIdleTimeout = 5 * 60 * 1000;
+
+    std::mutex m_partsMutex;
+    std::vector<HDC> m_evictedParts;
+    std::atomic<ULONGLONG> m_nextSweep = 0;
+    std::atomic<UINT> m_draws = 0;
+    std::atomic<UINT> m_misses = 0;
 };
 CThemeCache g_cache;
 
-VOID DrawNineGridStretch(HDC hdc, HDC& srcDC, LPCRECT dstRect, INT left = 0, INT top = 0, INT right = 0, INT bottom = 0)
+// Part of a nine-grid along one axis, in pixels relative to the destination and source origins
+struct NineGridSlice
 {
-    HBITMAP hBmp = (HBITMAP)GetCurrentObject(srcDC, OBJ_BITMAP);
-    BITMAP bmp = {};
-    GetObject(hBmp, sizeof(bmp), &bmp);
+    INT dst, src, dstLen, srcLen;
+};
 
-    INT srcW = bmp.bmWidth;
-    INT srcH = bmp.bmHeight;
-    INT dstW = dstRect->right - dstRect->left;
-    INT dstH = dstRect->bottom - dstRect->top;
+// Draws cached parts through a shared hardware Direct2D render target. Bitmaps
+// are created from the pixels of the cached DIBs on first use and dropped when
+// the theme cache changes
+class CPartRenderer
+{
+public:
+    BOOL Draw(HDC hdc, const CachedPart& part, LPCRECT dstRect,
+              const NineGridSlice* cols, INT colCount, const NineGridSlice* rows, INT rowCount)
+    {
+        if (!g_d2dFactory || !part.bits)
+            return FALSE;
 
-    left   = std::min(left, dstW);
-    right  = std::min(right, dstW - left);
-    top    = std::min(top, dstH);
-    bottom = std::min(bottom, dstH - top);
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (m_unavailable)
+            return FALSE;
 
-    INT centerW = dstW - left - right;
-    INT centerH = dstH - top - bottom;
+        if (!m_renderTarget)
+        {
+            D2D1_RENDER_TARGET_PROPERTIES rtProps = D2D1::RenderTargetProperties(
+                D2D1_RENDER_TARGET_TYPE_HARDWARE,
+                D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)
+            );
+            HRESULT hr = g_d2dFactory->CreateDCRenderTarget(&rtProps, &m_renderTarget);
+            if (FAILED(hr)) {
+                // No usable graphics device, stay on the GDI path
+                Wh_Log(L"Failed to create hardware DC target [ERROR]: 0x%08X\n", hr);
+                m_unavailable = TRUE;
+                return FALSE;
+            }
+        }
 
-    INT srcCenterW = srcW - left - right;
-    INT srcCenterH = srcH - top - bottom;
+        UINT generation = g_cache.generation;
+        if (generation != m_generation) {
+            m_bitmaps.clear();
+            m_generation = generation;
+        }
 
-    BLENDFUNCTION blend = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+        ID2D1Bitmap* bitmap = GetBitmap(part);
+        if (!bitmap || FAILED(m_renderTarget->BindDC(hdc, dstRect)))
+            return FALSE;
 
-    // Full stretch
-    if (left + right >= srcW || top + bottom >= srcH)
+        m_renderTarget->BeginDraw();
+        for (INT r = 0; r < rowCount; r++)
+        {
+            for (INT c = 0; c < colCount; c++)
+            {
+                D2D1_RECT_F dst = D2D1::RectF((FLOAT)cols[c].dst, (FLOAT)rows[r].dst,
+                    (FLOAT)(cols[c].dst + cols[c].dstLen), (FLOAT)(rows[r].dst + rows[r].dstLen));
+                D2D1_RECT_F src = D2D1::RectF((FLOAT)cols[c].src, (FLOAT)rows[r].src,
+                    (FLOAT)(cols[c].src + cols[c].srcLen), (FLOAT)(rows[r].src + rows[r].srcLen));
+                m_renderTarget->DrawBitmap(bitmap, dst, 1.f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, src);
+            }
+        }
+        HRESULT hr = m_renderTarget->EndDraw();
+        if (hr == D2DERR_RECREATE_TARGET) {
+            // Recreated on the next paint, this one goes through GDI
+            Wh_Log(L"Direct2D device lost, falling back to GDI\n");
+            m_bitmaps.clear();
+            m_renderTarget.Reset();
+        }
+        return SUCCEEDED(hr);
+    }
+
+    VOID Reset()
     {
-        AlphaBlend(hdc, dstRect->left, dstRect->top, dstW, dstH,
-                srcDC, 0, 0, srcW, srcH, blend);
-        return;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_bitmaps.clear();
+        m_renderTarget.Reset();
     }
-    // Short-circuit if the entire region is fully covered by the top-left corner
-    if (dstW <= left && dstH <= top)
+
+private:
+    ID2D1Bitmap* GetBitmap(const CachedPart& part)
     {
-        AlphaBlend(hdc, dstRect->left, dstRect->top, dstW, dstH,
-                   srcDC, 0, 0, dstW, dstH, blend);
-        return;
+        auto it = m_bitmaps.find(part.bits);
+        if (it != m_bitmaps.end())
+            return it->second.Get();
+
+        // Make sure pending GDI/D2D output to the DIB has landed before copying it
+        GdiFlush();
+
+        Microsoft::WRL::ComPtr<ID2D1Bitmap> bitmap;
+        HRESULT hr = m_renderTarget->CreateBitmap(
+            D2D1::SizeU(part.width, part.height), part.bits, part.width * 4,
+            D2D1::BitmapProperties(D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED)),
+            &bitmap);
+        if (FAILED(hr)) {
+            Wh_LogRateLimited(L"Failed to create part bitmap [ERROR]: 0x%08X\n", hr);
+            return nullptr;
+        }
+        return (m_bitmaps[part.bits] = std::move(bitmap)).Get();
     }
-    // Center
-    if (centerW > 0 && centerH > 0 && srcCenterW > 0 && srcCenterH > 0)
+
+    std::mutex m_mutex;
+    Microsoft::WRL::ComPtr<ID2D1DCRenderTarget> m_renderTarget;
+    std::unordered_map<const VOID*, Microsoft::WRL::ComPtr<ID2D1Bitmap>> m_bitmaps;
+    UINT m_generation = 0;
+    BOOL m_unavailable = FALSE;
+};
+CPartRenderer g_partRenderer;
+
+// Copies of cached parts stretched to the sizes drawn most recently. Views
+// with many items of the same size draw each one with a single blit instead of
+// one per nine-grid slice. Entries are dropped when the theme cache changes
+class CStretchedPartCache
+{
+public:
+    BOOL Draw(HDC hdc, const CachedPart& part, LPCRECT dstRect,
+              const NineGridSlice* cols, INT colCount, const NineGridSlice* rows, INT rowCount)
     {
-        AlphaBlend(hdc, dstRect->left + left, dstRect->top + top, centerW, centerH,
-                   srcDC, left, top, srcCenterW, srcCenterH, blend);
+        INT width = dstRect->right - dstRect->left;
+        INT height = dstRect->bottom - dstRect->top;
+        if (!part.hdc || width <= 0 || height <= 0 || width * height > kMaxPixels)
+            return FALSE;
+
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        UINT generation = g_cache.generation;
+        if (generation != m_generation) {
+            ClearLocked();
+            m_generation = generation;
+        }
+
+        Entry* entry = nullptr;
+        for (Entry& e : m_entries)
+        {
+            if (e.hdc && e.bits == part.bits && e.width == width && e.height == height) {
+                entry = &e;
+                break;
+            }
+        }
+
+        BLENDFUNCTION blend = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+
+        if (!entry)
+        {
+            entry = &m_entries[m_next];
+            m_next = (m_next + 1) % m_entries.size();
+            DeleteEntry(*entry);
+
+            BITMAPINFO bmi = {};
+            bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+            bmi.bmiHeader.biWidth = width;
+            bmi.bmiHeader.biHeight = -height;
+            bmi.bmiHeader.biPlanes = 1;
+            bmi.bmiHeader.biBitCount = 32;
+            bmi.bmiHeader.biCompression = BI_RGB;
+
+            HDC entryHdc = CreateCompatibleDC(hdc);
+            if (!entryHdc)
+                return FALSE;
+
+            // A new DIB section is zeroed, i.e. fully transparent, so blending the
+            // premultiplied slices onto it copies them
+            VOID* pvBits;
+            HBITMAP hBitmap = CreateDIBSection(entryHdc, &bmi, DIB_RGB_COLORS, &pvBits, nullptr, 0);
+            if (!hBitmap) {
+                DeleteDC(entryHdc);
+                return FALSE;
+            }
+            SelectObject(entryHdc, hBitmap);
+
+            for (INT r = 0; r < rowCount; r++)
+            {
+                for (INT c = 0; c < colCount; c++)
+                {
+                    AlphaBlend(entryHdc, cols[c].dst, rows[r].dst, cols[c].dstLen, rows[r].dstLen,
+                               part.hdc, cols[c].src, rows[r].src, cols[c].srcLen, rows[r].srcLen, blend);
+                }
+            }
+
+            *entry = { part.bits, width, height, entryHdc };
+        }
+
+        return AlphaBlend(hdc, dstRect->left, dstRect->top, width, height,
+                          entry->hdc, 0, 0, width, height, blend);
     }
-    // Top-left
-    if (left > 0 && top > 0)
+
+    VOID Reset()
     {
-        AlphaBlend(hdc, dstRect->left, dstRect->top, left, top,
-                   srcDC, 0, 0, left, top, blend);
+        std::lock_guard<std::mutex> guard(m_mutex);
+        ClearLocked();
     }
-    // Top
-    if (centerW > 0 && top > 0 && srcCenterW > 0)
+
+    ~CStretchedPartCache()
     {
-        AlphaBlend(hdc, dstRect->left + left, dstRect->top, centerW, top,
-                   srcDC, left, 0, srcCenterW, top, blend);
+        ClearLocked();
     }
-    // Top-right
-    if (right > 0 && top > 0)
+
+private:
+    // Bounds the memory to 8 MB, larger than this covers big thumbnails on 4K
+    static constexpr INT kMaxPixels = 512 * 512;
+
+    struct Entry
+    {
+        const VOID* bits = nullptr;
+        INT width = 0;
+        INT height = 0;
+        HDC hdc = nullptr;
+    };
+
+    VOID DeleteEntry(Entry& entry)
     {
-        AlphaBlend(hdc, dstRect->right - right, dstRect->top, right, top,
-                   srcDC, srcW - right, 0, right, top, blend);
+        if (entry.hdc) {
+            DeleteObject((HBITMAP)GetCurrentObject(entry.hdc, OBJ_BITMAP));
+            DeleteDC(entry.hdc);
+        }
+        entry = {};
     }
-    // Left
-    if (left > 0 && centerH > 0 && srcCenterH > 0)
+
+    VOID ClearLocked()
     {
-        AlphaBlend(hdc, dstRect->left, dstRect->top + top, left, centerH,
-                   srcDC, 0, top, left, srcCenterH, blend);
+        for (Entry& entry : m_entries)
+            DeleteEntry(entry);
+        m_next = 0;
     }
-    // Right
-    if (right > 0 && centerH > 0 && srcCenterH > 0)
+
+    std::mutex m_mutex;
+    std::array<Entry, 8> m_entries;
+    size_t m_next = 0;
+    UINT m_generation = 0;
+};
+CStretchedPartCache g_stretchedPartCache;
+
+VOID DrawNineGridStretch(HDC hdc, const CachedPart& srcDC, LPCRECT dstRect, INT left = 0, INT top = 0, INT right = 0, INT bottom = 0)
+{
+    INT srcW = srcDC.width;
+    INT srcH = srcDC.height;
+    INT dstW = dstRect->right - dstRect->left;
+    INT dstH = dstRect->bottom - dstRect->top;
+
+    left   = std::min(left, dstW);
+    right  = std::min(right, dstW - left);
+    top    = std::min(top, dstH);
+    bottom = std::min(bottom, dstH - top);
+
+    INT centerW = dstW - left - right;
+    INT centerH = dstH - top - bottom;
+
+    INT srcCenterW = srcW - left - right;
+    INT srcCenterH = srcH - top - bottom;
+
+    ULONGLONG now = GetTickCount64();
+    srcDC.lastUse.store(now, std::memory_order_relaxed);
+    g_cache.CountDraw();
+    g_cache.EvictIdleParts(now);
+
+    NineGridSlice cols[3], rows[3];
+    INT colCount = 0, rowCount = 0;
+
+    // Full stretch
+    if (left + right >= srcW || top + bottom >= srcH)
     {
-        AlphaBlend(hdc, dstRect->right - right, dstRect->top + top, right, centerH,
-                   srcDC, srcW - right, top, right, srcCenterH, blend);
+        cols[colCount++] = { 0, 0, dstW, srcW };
+        rows[rowCount++] = { 0, 0, dstH, srcH };
     }
-    // Bottom-left
-    if (left > 0 && bottom > 0)
+    // Short-circuit if the entire region is fully covered by the top-left corner
+    else if (dstW <= left && dstH <= top)
     {
-        AlphaBlend(hdc, dstRect->left, dstRect->bottom - bottom, left, bottom,
-                   srcDC, 0, srcH - bottom, left, bottom, blend);
+        cols[colCount++] = { 0, 0, dstW, dstW };
+        rows[rowCount++] = { 0, 0, dstH, dstH };
     }
-    // Bottom
-    if (centerW > 0 && bottom > 0 && srcCenterW > 0)
+    else
     {
-        AlphaBlend(hdc, dstRect->left + left, dstRect->bottom - bottom, centerW, bottom,
-                   srcDC, left, srcH - bottom, srcCenterW, bottom, blend);
+        // An axis drawn at its cached size maps 1:1, so its three slices
+        // collapse into one and fixed size parts end up as a single blit
+        if (dstW == srcW)
+            cols[colCount++] = { 0, 0, dstW, srcW };
+        else {
+            if (left > 0)
+                cols[colCount++] = { 0, 0, left, left };
+            if (centerW > 0 && srcCenterW > 0)
+                cols[colCount++] = { left, left, centerW, srcCenterW };
+            if (right > 0)
+                cols[colCount++] = { dstW - right, srcW - right, right, right };
+        }
+
+        if (dstH == srcH)
+            rows[rowCount++] = { 0, 0, dstH, srcH };
+        else {
+            if (top > 0)
+                rows[rowCount++] = { 0, 0, top, top };
+            if (centerH > 0 && srcCenterH > 0)
+                rows[rowCount++] = { top, top, centerH, srcCenterH };
+            if (bottom > 0)
+                rows[rowCount++] = { dstH - bottom, srcH - bottom, bottom, bottom };
+        }
     }
-    // Bottom-right
-    if (right > 0 && bottom > 0)
+
+    if (g_settings.HardwarePartRendering
+    && g_partRenderer.Draw(hdc, srcDC, dstRect, cols, colCount, rows, rowCount))
+        return;
+
+    // A single slice is a single blit already
+    if (g_settings.StretchedPartCache && colCount * rowCount > 1
+    && g_stretchedPartCache.Draw(hdc, srcDC, dstRect, cols, colCount, rows, rowCount))
+        return;
+
+    BLENDFUNCTION blend = { AC_SRC_OVER, 0, 255, AC_SRC_ALPHA };
+    for (INT r = 0; r < rowCount; r++)
     {
-        AlphaBlend(hdc, dstRect->right - right, dstRect->bottom - bottom, right, bottom,
-                   srcDC, srcW - right, srcH - bottom, right, bottom, blend);
+        for (INT c = 0; c < colCount; c++)
+        {
+            AlphaBlend(hdc, dstRect->left + cols[c].dst, dstRect->top + rows[r].dst, cols[c].dstLen, rows[r].dstLen,
+                       srcDC, cols[c].src, rows[r].src, cols[c].srcLen, rows[r].srcLen, blend);
+        }
     }
 }
 
@@ -1804,7 +2242,7 @@ BOOL CThemeCache::CacheScrollbar(HDC hdc, INT iPartId, INT iStateId, INT stateIn
     pRenderTarget->BeginDraw();
     pRenderTarget->FillRoundedRectangle(&rr, brush.Get());
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -1898,7 +2336,7 @@ BOOL PaintScrollBarArrows(HDC hdc, INT iPartId, INT iStateId, LPCRECT pRect)
         }
     }
     auto hr = dcRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -1951,7 +2389,7 @@ BOOL CThemeCache::CachePushButton(HDC hdc, INT iStateId, INT stateIndex)
     pRenderTarget->FillRoundedRectangle(&rr, fillBrush.Get());
     pRenderTarget->DrawRoundedRectangle(&rr, borderBrush.Get(), scale);
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2048,7 +2486,7 @@ BOOL CThemeCache::CacheRadioButton(HDC hdc, LPCRECT pRect,  INT iStateId, INT st
         pRenderTarget->FillEllipse(innerEllipse, brush.Get());
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2166,7 +2604,7 @@ BOOL CThemeCache::CacheCheckButton(HDC hdc, LPCRECT pRect, INT iStateId, INT sta
             pRenderTarget->DrawLine((D2D1::Point2F(width *.3f, height/2.f)), (D2D1::Point2F(width *.7f, height/2.f)), glyphBrush.Get());        
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2226,7 +2664,7 @@ BOOL PaintGroupBox(HDC hdc, INT iPartId, INT iStateId, LPCRECT pRect, LPCRECT pC
     sink->Close();
     pRenderTarget->DrawGeometry(geometry.Get(), brush.Get());
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
 
     return TRUE;
 }
@@ -2286,7 +2724,7 @@ BOOL CThemeCache::CacheCommandlinkButton(HDC hdc, INT iStateId, INT stateIndex)
             break;
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return FALSE;
 }
 
@@ -2356,7 +2794,7 @@ BOOL CThemeCache::CacheCommandlinkGlyph(HDC hdc, INT iStateId, INT stateIndex)
         brush.Get()
     );  
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2446,7 +2884,7 @@ BOOL CThemeCache::CacheCombobox(HDC hdc, INT iPartId, INT iStateId, INT stateInd
         }
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2536,7 +2974,7 @@ BOOL CThemeCache::CacheEditBox(HDC hdc, INT iPartId, INT iStateId, INT stateInde
         pRenderTarget->FillRoundedRectangle(rect, brush.Get());
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2584,7 +3022,7 @@ BOOL PaintListBox(HDC hdc, INT iPartId, INT iStateId, LPCRECT pRect)
         pRenderTarget->FillRectangle(&rect, borderBrush.Get());
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2637,7 +3075,7 @@ BOOL PaintDropDownArrow(HDC hdc, INT iPartId, INT iStateId, LPCRECT pRect, BOOL
     pRenderTarget->DrawLine(ptLeft, ptTip, brush.Get(), scale*1.2f);
     pRenderTarget->DrawLine(ptRight, ptTip, brush.Get(), scale*1.2f);
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2712,7 +3150,7 @@ BOOL CThemeCache::CacheTab(HDC hdc, INT iStateId, INT stateIndex)
         pRenderTarget->FillRoundedRectangle(pillRect, brush.Get());
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2747,7 +3185,7 @@ BOOL CThemeCache::CacheTrackBar(HDC hdc, INT iPartId, INT stateIndex)
     pRenderTarget->CreateSolidColorBrush(MyD2D1Color(96, 96, 96), &brush);
     pRenderTarget->FillRoundedRectangle(&body, brush.Get());
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2793,7 +3231,7 @@ BOOL CThemeCache::CacheTrackBarThumb(HDC hdc, INT iPartId, INT iStateId, INT sta
     pRenderTarget->BeginDraw();
     pRenderTarget->FillRoundedRectangle(&body, brush.Get());
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -2934,7 +3372,7 @@ BOOL CThemeCache::CacheTrackBarPointedThumb(HDC hdc, INT iPartId, INT iStateId,
         pRenderTarget->FillGeometry(triangleGeo.Get(), brush.Get());
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3053,7 +3491,7 @@ BOOL CThemeCache::CacheProgressBar(HDC hdc, INT iPartId, INT iStateId, INT state
         }
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3112,7 +3550,7 @@ BOOL CThemeCache::CacheIndeterminateBar(HDC hdc, INT iPartId, INT stateIndex)
     pRenderTarget->BeginDraw();
     pRenderTarget->FillRoundedRectangle(&rounded, brush.Get());
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3180,7 +3618,7 @@ BOOL CThemeCache::CacheListItem(HDC hdc, INT iPartId, INT iStateId, INT stateInd
         pRenderTarget->BeginDraw();
         pRenderTarget->FillRectangle(&rect, brush.Get());
         auto hr = pRenderTarget->EndDraw();
-        if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+        if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     }
     else
     {
@@ -3224,7 +3662,7 @@ BOOL CThemeCache::CacheListItem(HDC hdc, INT iPartId, INT iStateId, INT stateInd
             pRenderTarget->DrawRoundedRectangle(&rounded, brush.Get(), 2.f * scale);
         }
         auto hr = pRenderTarget->EndDraw();
-        if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+        if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     }
     return TRUE;
 }
@@ -3256,7 +3694,7 @@ BOOL CThemeCache::CacheListGroupHeader(HDC hdc, INT iPartId, INT iStateId, INT s
         pRenderTarget->BeginDraw();
         pRenderTarget->DrawLine(D2D1_POINT_2F(width, y), D2D1_POINT_2F(width, height), brush.Get());
         auto hr = pRenderTarget->EndDraw();
-        if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+        if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     }
     else if (iPartId == LVP_GROUPHEADER)
     {
@@ -3305,7 +3743,7 @@ BOOL CThemeCache::CacheListGroupHeader(HDC hdc, INT iPartId, INT iStateId, INT s
             pRenderTarget->DrawRoundedRectangle(&rounded, brush.Get(), 2.f * scale);
         }
         auto hr = pRenderTarget->EndDraw();
-        if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+        if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     }
     else
     {
@@ -3314,7 +3752,7 @@ BOOL CThemeCache::CacheListGroupHeader(HDC hdc, INT iPartId, INT iStateId, INT s
         pRenderTarget->BeginDraw();
         pRenderTarget->FillRectangle(&rect, brush.Get());
         auto hr = pRenderTarget->EndDraw();
-        if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+        if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     }
     return TRUE;
 }
@@ -3383,7 +3821,7 @@ BOOL CThemeCache::CacheTreeView(HDC hdc, INT iPartId, INT iStateId, INT stateInd
         }
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3461,7 +3899,7 @@ BOOL CThemeCache::CacheItemsView(HDC hdc, INT iPartId, INT iStateId, INT stateIn
     }
 
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3534,7 +3972,7 @@ BOOL CThemeCache::CacheHeader(HDC hdc, INT iStateId, INT stateIndex)
     pRenderTarget->FillGeometry(geometry.Get(), brush.Get());
 
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3571,7 +4009,7 @@ BOOL CThemeCache::CachePreviewPaneSeperator(HDC hdc)
     pRenderTarget->DrawLine(D2D1_POINT_2F(x, y), D2D1_POINT_2F(x, height), brush.Get());
     auto hr = pRenderTarget->EndDraw();
 
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3643,7 +4081,7 @@ BOOL CThemeCache::CacheModuleButton(HDC hdc, INT iStateId, INT stateIndex)
         pRenderTarget->DrawRoundedRectangle(&roundedRect, borderBrush.Get(), Border2pxOffset);
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3718,7 +4156,7 @@ BOOL CThemeCache::CacheModuleLocationButton(HDC hdc, INT iStateId, INT stateInde
     pRenderTarget->DrawRoundedRectangle(&roundedRect, borderBrush.Get(), Border2pxOffset);
 
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3834,7 +4272,7 @@ BOOL CThemeCache::CacheModuleSplitButton(HDC hdc, INT iPartId, INT iStateId, INT
         }
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -3973,7 +4411,7 @@ BOOL CThemeCache::CacheNavigationButton(HDC hdc, INT iPartId, INT iStateId, INT
         pRenderTarget->DrawLine(ptRight, ptTip, arrowBrush.Get(), 2.f);
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -4023,7 +4461,7 @@ BOOL CThemeCache::CacheToolbarButton(HDC hdc, INT iStateId, INT stateIndex)
         pRenderTarget->DrawLine(D2D1::Point2F(pillOffset, height-1), D2D1::Point2F(width - pillOffset, height-1), fillBrush.Get(), 2.0f);
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -4071,7 +4509,7 @@ BOOL PaintToolbarSplitDropDown(HDC hdc, INT iPartId,  INT iStateId, LPCRECT pRec
     }
 
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -4133,7 +4571,7 @@ BOOL CThemeCache::CacheAddressBand(HDC hdc, INT iStateId, INT stateIndex)
     pRenderTarget->DrawLine(D2D1::Point2F(cornerRadius/2 - 1.5f, height-1.5f), D2D1::Point2F(width - cornerRadius/2 + 1.5f, height-1.5f), fillBrush.Get());
 
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -4188,7 +4626,7 @@ BOOL CThemeCache::CacheMenuItem(HDC hdc, INT iPartId, INT iStateId, INT indexSta
         pRenderTarget->FillRoundedRectangle(&Rect, fillBrush.Get());
     }
     auto hr = pRenderTarget->EndDraw();
-    if (FAILED(hr)) {Wh_Log(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
+    if (FAILED(hr)) {Wh_LogRateLimited(L"Failed D2D drawing [ERROR]: 0x%08X\n", hr); return FALSE;}
     return TRUE;
 }
 
@@ -4620,6 +5058,8 @@ VOID CALLBACK MyRainbowTimerProc(HWND, UINT, UINT_PTR t_id, DWORD)
 
 LRESULT CALLBACK CallWndProc(INT nCode, WPARAM wParam, LPARAM lParam)
 {
+    g_threadHasCallWndProcHook = TRUE;
+
     const CWPSTRUCT* cwp = (const CWPSTRUCT*)lParam;
     if (nCode != HC_ACTION) {
         return CallNextHookEx(nullptr, nCode, wParam, lParam);
@@ -4746,16 +5186,19 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved)
         break;
 
     case DLL_THREAD_DETACH:
-        if (g_callWndProcHook) {
-            std::lock_guard<std::mutex> guard(g_allCallWndProcHooksMutex);
+    {
+        if (!g_threadHasCallWndProcHook)
+            break;
 
-            auto it = g_allCallWndProcHooks.find(g_callWndProcHook);
-            if (it != g_allCallWndProcHooks.end()) {
-                UnhookWindowsHookEx(g_callWndProcHook);
-                g_allCallWndProcHooks.erase(it);
-            }
+        std::lock_guard<std::mutex> guard(g_allCallWndProcHooksMutex);
+
+        auto it = g_allCallWndProcHooks.find(GetCurrentThreadId());
+        if (it != g_allCallWndProcHooks.end()) {
+            UnhookWindowsHookEx(it->second);
+            g_allCallWndProcHooks.erase(it);
         }
         break;
+    }
 
     case DLL_PROCESS_DETACH:
         break;
@@ -4766,13 +5209,14 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpReserved)
 
 static LRESULT WINAPI HookedDefWindowProcW(HWND hWnd, UINT Msg, WPARAM wParam, LPARAM lParam)
 {
-    if (Msg == WM_DWMCOLORIZATIONCOLORCHANGED && g_settings.AccentColorize)
+    if (Msg == WM_DWMCOLORIZATIONCOLORCHANGED && g_settings.AccentColorize
+        && g_lastColorizationColor.exchange((LONG_PTR)wParam) != (LONG_PTR)wParam)
     {
         COLORREF oldAccentClr = g_settings.AccentColor;
         GetAccentColor(g_settings.AccentColor);
         if (oldAccentClr != g_settings.AccentColor) {
             ColorizeSysColors();
-            g_AccentPalette.LoadAccentPalette();
+            UpdateAccentPalette();
             g_cache.ClearCache();
         }
     }
@@ -4821,14 +5265,19 @@ VOID NewWindowShown(HWND hWnd)
         {
             std::lock_guard<std::mutex> guard(g_allCallWndProcHooksMutex);   
             DWORD dwThreadId = GetWindowThreadProcessId(hWnd, NULL);
-            HHOOK callWndProcHook = SetWindowsHookEx(WH_CALLWNDPROC, CallWndProc, nullptr, dwThreadId);
-            if (callWndProcHook) {
-                g_callWndProcHook = callWndProcHook;
-                g_allCallWndProcHooks.insert(callWndProcHook);
-                Wh_Log(L"SetWindowsHookEx succeeded for thread %u", dwThreadId);
+            // The hook already sees the messages of every window on a hooked thread
+            if (g_allCallWndProcHooks.find(dwThreadId) == g_allCallWndProcHooks.end())
+            {
+                HHOOK callWndProcHook = SetWindowsHookEx(WH_CALLWNDPROC, CallWndProc, nullptr, dwThreadId);
+                if (callWndProcHook) {
+                    g_allCallWndProcHooks[dwThreadId] = callWndProcHook;
+                    if (dwThreadId == GetCurrentThreadId())
+                        g_threadHasCallWndProcHook = TRUE;
+                    Wh_Log(L"SetWindowsHookEx succeeded for thread %u", dwThreadId);
+                }
+                else
+                    Wh_Log(L"[ERROR] SetWindowsHookEx failed for thread %u", dwThreadId);
             }
-            else
-                Wh_Log(L"[ERROR] SetWindowsHookEx failed for thread %u", dwThreadId);
         }
         if (g_settings.BorderRainbowFlag || g_settings.CaptionRainbowFlag || g_settings.TitlebarRainbowFlag)
             SendMessage(hWnd, g_msgRainbowTimer, RAINBOW_LOAD, 0);
@@ -5046,12 +5495,16 @@ VOID LoadSettings(VOID)
     g_settings.AccentColorize = Wh_GetIntSetting(L"RenderingMod.AccentColorControls");
     if (g_settings.AccentColorize)
        g_settings.AccentColorize = GetAccentColor(g_settings.AccentColor);
+    if (g_settings.AccentColorize)
+        UpdateAccentPalette();
 
     g_settings.FillBg = Wh_GetIntSetting(L"RenderingMod.ThemeBackground");
     if(g_settings.FillBg)
         FillBackgroundElements();
     
     g_settings.TextAlphaBlend = Wh_GetIntSetting(L"RenderingMod.TextAlphaBlend");
+    g_settings.HardwarePartRendering = Wh_GetIntSetting(L"RenderingMod.HardwarePartRendering") && g_settings.FillBg;
+    g_settings.StretchedPartCache = Wh_GetIntSetting(L"RenderingMod.StretchedPartCache") && g_settings.FillBg;
     if(g_settings.TextAlphaBlend)
         TextRenderingHook();
      
@@ -5261,6 +5714,8 @@ VOID Wh_ModUninit(VOID)
     if (g_settings.FillBg)
     {
         RevertSysColors();
+        g_partRenderer.Reset();
+        g_stretchedPartCache.Reset();
         g_d2dFactory->Release();
     }
 
@@ -5286,7 +5741,7 @@ VOID Wh_ModUninit(VOID)
     {
         std::lock_guard<std::mutex> guard(g_allCallWndProcHooksMutex);
 
-        for (HHOOK hook : g_allCallWndProcHooks) {
+        for (const auto& [dwThreadId, hook] : g_allCallWndProcHooks) {
             UnhookWindowsHookEx(hook);
         }
 
@@ -5299,6 +5754,8 @@ VOID Wh_ModUninit(VOID)
 BOOL Wh_ModSettingsChanged(BOOL* bReload) 
 {
     Wh_Log(L"SettingsChanged");
+    if (g_settings.FillBg)
+        g_cache.LogUsage();
     *bReload = TRUE;
     return TRUE;
 }
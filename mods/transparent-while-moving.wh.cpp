@@ -1,22 +1,23 @@
 // ==WindhawkMod==
 // @id              transparent-while-moving
 // @name            Transparent While Moving (with Fade)
-// @description     Fade to semi-transparent while dragging/resizing, then fade back on release. Uses thread-pool timers for reliability (Explorer-friendly). Per-app include/exclude supported.
-// @version         0.6
+// @description     Fade to semi-transparent while dragging/resizing, then fade back on release. Fades run on a shared thread synced to the compositor (Explorer-friendly). Per-app include/exclude supported.
+// @version         0.7
 // @author          You
 // @github          vicomannen
 // @include         *
 // @exclude         windhawk.exe
 // @license         MIT
-// @compilerOptions -std=c++17
+// @compilerOptions -std=c++17 -ldwmapi
 // ==/WindhawkMod==
 
 // ==WindhawkModReadme==
 /*
 Fades a window to a chosen opacity while it is being moved/resized
 (`WM_ENTERSIZEMOVE`) and fades it back to fully opaque when finished
-(`WM_EXITSIZEMOVE`). For better reliability in Explorer, animation runs via
-**thread-pool timers** (not `WM_TIMER`). The mod also supports per-process
+(`WM_EXITSIZEMOVE`). For better reliability in Explorer, animation runs on a
+**dedicated thread** (not `WM_TIMER`), which drives the fades of all windows and
+ticks once per compositor frame. The mod also supports per-process
 include/exclude lists.
 
 ### Tips
@@ -64,12 +65,16 @@ include/exclude lists.
 
 #include <windhawk_api.h>
 #include <windows.h>
+#include <dwmapi.h>
 #include <cwctype>
 #include <cwchar>
-#include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 // ---------------- Settings ----------------
 static int  g_targetOpacity = 180;   // 0..255
@@ -77,11 +82,18 @@ static int  g_fadeMs        = 120;   // ms; 0 => instant
 static int  g_scope         = 0;     // 0 = allExceptListed, 1 = onlyListed
 static bool g_enabled       = true;  // computed per process
 
-// Thread-pool timers (reliable under Explorer move/size loop)
-static HANDLE g_timerQueue = nullptr;
-static const ULONG kTickMs = 15; // ~60–70 FPS
+// Animation thread (reliable under Explorer move/size loop), started on the
+// first fade, as most processes never move a window
+static std::thread       g_animThread;
+static std::atomic<bool> g_animThreadStarted{false};
+static std::mutex        g_animThreadMutex;
+static HANDLE            g_animWakeEvent = nullptr;
+static std::atomic<bool> g_animStop{false};
+static std::mutex        g_animMutex;
+static const DWORD kFallbackTickMs = 15; // ~60–70 FPS, without composition
 
 struct WinAnim {
+    HWND      hwnd         = nullptr;
     bool      active       = false;
     BYTE      startAlpha   = 255;
     BYTE      targetAlpha  = 255;
@@ -90,12 +102,41 @@ struct WinAnim {
 
     // our own truth of last applied alpha
     BYTE      lastApplied  = 255;
+};
+
+// Windows which are fading or not opaque, guarded by g_animMutex. Entries are
+// removed once a window is opaque again, the storage is reused.
+static std::vector<WinAnim> g_anim;
 
-    // thread-pool timer
-    HANDLE    hTimer       = nullptr;
+struct AlphaUpdate {
+    HWND hwnd;
+    BYTE alpha;
+    bool writeAlpha;     // false if the alpha is already applied
+    bool releaseLayered;
 };
 
-static std::unordered_map<HWND, WinAnim> g_anim;
+static WinAnim* FindAnim(HWND hwnd) {
+    for (auto& st : g_anim) {
+        if (st.hwnd == hwnd) return &st;
+    }
+    return nullptr;
+}
+
+static WinAnim* AddAnim(HWND hwnd) {
+    g_anim.push_back(WinAnim{});
+    g_anim.back().hwnd = hwnd;
+    return &g_anim.back();
+}
+
+static void RemoveAnim(HWND hwnd) {
+    for (size_t i = 0; i < g_anim.size(); i++) {
+        if (g_anim[i].hwnd == hwnd) {
+            g_anim[i] = g_anim.back();
+            g_anim.pop_back();
+            return;
+        }
+    }
+}
 
 // ---------------- Helpers ----------------
 static void SetLayered(HWND hwnd, bool on) {
@@ -109,10 +150,15 @@ static void SetLayered(HWND hwnd, bool on) {
     }
 }
 
-static void ApplyAlphaRemember(HWND hwnd, BYTE a) {
-    SetLayered(hwnd, true);
-    SetLayeredWindowAttributes(hwnd, 0, a, LWA_ALPHA);
-    g_anim[hwnd].lastApplied = a;
+static void ApplyAlphaUpdate(const AlphaUpdate& u) {
+    if (!IsWindow(u.hwnd)) return;
+    if (u.writeAlpha) {
+        SetLayered(u.hwnd, true);
+        SetLayeredWindowAttributes(u.hwnd, 0, u.alpha, LWA_ALPHA);
+    }
+    if (u.releaseLayered) {
+        SetLayered(u.hwnd, false);
+    }
 }
 
 static BYTE ClampByte(int v) {
@@ -153,17 +199,10 @@ static std::unordered_set<std::wstring> ParseAppListToSet(const wchar_t* s) {
     return out;
 }
 
-// ---------------- Animation (thread-pool) ----------------
-static VOID CALLBACK FadeTickCb(PVOID ctx, BOOLEAN /*fired*/) {
-    HWND hwnd = (HWND)ctx;
-    if (!IsWindow(hwnd)) return;
-
-    auto it = g_anim.find(hwnd);
-    if (it == g_anim.end()) return;
-    WinAnim& st = it->second;
-    if (!st.active) return;
-
-    ULONGLONG now = GetTickCount64();
+// ---------------- Animation (shared thread) ----------------
+// All active fades are driven by a single thread which ticks once per
+// compositor frame (DwmFlush), instead of a thread-pool timer per window.
+static AlphaUpdate ComputeFadeStep(WinAnim& st, ULONGLONG now, bool* finished) {
     double t = (st.durationMs > 0)
              ? std::min(1.0, (double)(now - st.startTick) / (double)st.durationMs)
              : 1.0;
@@ -171,68 +210,149 @@ static VOID CALLBACK FadeTickCb(PVOID ctx, BOOLEAN /*fired*/) {
     double v = (1.0 - t) * (double)st.startAlpha + t * (double)st.targetAlpha;
     BYTE a = ClampByte((int)(v + 0.5));
 
-    ApplyAlphaRemember(hwnd, a);
+    AlphaUpdate u{st.hwnd, a, a != st.lastApplied, false};
+    st.lastApplied = a;
 
-    if (t >= 1.0) {
-        HANDLE h = st.hTimer;
-        st.hTimer = nullptr;
+    *finished = t >= 1.0;
+    if (*finished) {
         st.active = false;
-        if (h) DeleteTimerQueueTimer(g_timerQueue, h, INVALID_HANDLE_VALUE);
+        u.releaseLayered = st.targetAlpha == 255; // release layered at rest
+    }
+    return u;
+}
 
-        if (st.targetAlpha == 255) {
-            SetLayered(hwnd, false);   // release layered at rest
-            st.lastApplied = 255;
+// Returns whether any fade is still running. Must be called with g_animMutex held.
+static bool CollectFadeUpdates(ULONGLONG now, std::vector<AlphaUpdate>& updates) {
+    bool anyActive = false;
+    for (size_t i = 0; i < g_anim.size();) {
+        WinAnim& st = g_anim[i];
+        if (!st.active) {
+            i++;
+            continue;
         }
+
+        bool finished;
+        AlphaUpdate u = ComputeFadeStep(st, now, &finished);
+        if (u.writeAlpha || u.releaseLayered)
+            updates.push_back(u);
+
+        if (!finished) {
+            anyActive = true;
+        } else if (u.releaseLayered) {
+            // Opaque at rest, the slot goes back to the pool
+            g_anim[i] = g_anim.back();
+            g_anim.pop_back();
+            continue;
+        }
+        i++;
     }
+    return anyActive;
 }
 
-static void StopFade(HWND hwnd, bool forceToTarget) {
-    auto it = g_anim.find(hwnd);
-    if (it == g_anim.end()) return;
-    WinAnim& st = it->second;
+static void AnimationThread() {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    std::vector<AlphaUpdate> updates;
+    while (!g_animStop) {
+        bool anyActive;
+        updates.clear();
+        {
+            std::lock_guard<std::mutex> lock(g_animMutex);
+            anyActive = CollectFadeUpdates(GetTickCount64(), updates);
+        }
 
-    HANDLE h = st.hTimer;
-    st.hTimer = nullptr;
-    st.active = false;
-    if (h) DeleteTimerQueueTimer(g_timerQueue, h, INVALID_HANDLE_VALUE);
+        // Applied without holding the lock, changing the style of a window
+        // sends messages to its thread
+        for (const auto& u : updates)
+            ApplyAlphaUpdate(u);
 
-    if (forceToTarget) {
-        ApplyAlphaRemember(hwnd, st.targetAlpha);
-    }
-    if (st.targetAlpha == 255) {
-        SetLayered(hwnd, false);
-        st.lastApplied = 255;
+        if (!anyActive) {
+            WaitForSingleObject(g_animWakeEvent, INFINITE);
+            continue;
+        }
+
+        LARGE_INTEGER before, after;
+        QueryPerformanceCounter(&before);
+        HRESULT hr = DwmFlush();
+        QueryPerformanceCounter(&after);
+        if (FAILED(hr)) {
+            // No composition, e.g. DWM is disabled on Windows 7
+            Sleep(kFallbackTickMs);
+        } else if ((after.QuadPart - before.QuadPart) * 1000 < freq.QuadPart) {
+            // DwmFlush returns right away when nothing is being presented
+            Sleep(1);
+        }
     }
 }
 
-static void StartFade(HWND hwnd, BYTE targetAlpha, int durMs) {
-    WinAnim& st = g_anim[hwnd];
+static void StartAnimationThread() {
+    if (g_animThreadStarted)
+        return;
 
-    if (st.hTimer) {
-        DeleteTimerQueueTimer(g_timerQueue, st.hTimer, INVALID_HANDLE_VALUE);
-        st.hTimer = nullptr;
-    }
+    std::lock_guard<std::mutex> lock(g_animThreadMutex);
+    if (g_animThreadStarted || g_animStop)
+        return;
 
-    st.startAlpha  = st.lastApplied;
-    st.targetAlpha = targetAlpha;
-    st.startTick   = GetTickCount64();
-    st.durationMs  = std::max(0, durMs);
-    st.active      = true;
+    g_animThread = std::thread(AnimationThread);
+    g_animThreadStarted = true;
+}
 
-    if (st.durationMs == 0 || st.startAlpha == st.targetAlpha) {
-        ApplyAlphaRemember(hwnd, st.targetAlpha);
-        st.active = false;
-        if (st.targetAlpha == 255) {
-            SetLayered(hwnd, false);
-            st.lastApplied = 255;
+static void StartFade(HWND hwnd, BYTE targetAlpha, int durMs) {
+    AlphaUpdate u{hwnd, targetAlpha, false, false};
+    bool animate = false;
+    {
+        std::lock_guard<std::mutex> lock(g_animMutex);
+        WinAnim* st = FindAnim(hwnd);
+        BYTE current = st ? st->lastApplied : 255;
+
+        if (durMs <= 0 || current == targetAlpha) {
+            if (!st) {
+                if (targetAlpha == 255)
+                    return; // Already opaque and not layered by us
+                st = AddAnim(hwnd);
+            }
+            st->active = false;
+            u.writeAlpha = current != targetAlpha;
+            st->lastApplied = targetAlpha;
+            if (targetAlpha == 255) {
+                u.releaseLayered = true;
+                RemoveAnim(hwnd);
+            }
+        } else {
+            if (!st)
+                st = AddAnim(hwnd);
+            st->startAlpha  = current;
+            st->targetAlpha = targetAlpha;
+            st->startTick   = GetTickCount64();
+            st->durationMs  = durMs;
+            st->active      = true;
+            animate = true;
+            u.alpha = current;
         }
-        return;
     }
 
-    SetLayered(hwnd, true); // ensure layered while animating
-    if (!g_timerQueue) g_timerQueue = CreateTimerQueue();
-    CreateTimerQueueTimer(&st.hTimer, g_timerQueue, FadeTickCb,
-                          (PVOID)hwnd, 0, kTickMs, WT_EXECUTEDEFAULT);
+    if (animate) {
+        // Ensure layered while animating, with the alpha set right away, as
+        // the first frame won't write the unchanged start alpha
+        u.writeAlpha = true;
+        ApplyAlphaUpdate(u);
+        StartAnimationThread();
+        SetEvent(g_animWakeEvent);
+    } else {
+        ApplyAlphaUpdate(u);
+    }
+}
+
+// The window is going away, forget it and do not leave it transparent
+static void ForgetWindow(HWND hwnd) {
+    {
+        std::lock_guard<std::mutex> lock(g_animMutex);
+        if (!FindAnim(hwnd))
+            return;
+        RemoveAnim(hwnd);
+    }
+    ApplyAlphaUpdate({hwnd, 255, true, true});
 }
 
 // ---------------- Hook ----------------
@@ -271,10 +391,7 @@ static LRESULT WINAPI DefWindowProcW_Hook(HWND hWnd, UINT Msg, WPARAM wParam, LP
 
     case WM_DESTROY:
     case WM_NCDESTROY:
-        StopFade(root, /*forceToTarget=*/false);
-        ApplyAlphaRemember(root, 255);  // fail-safe: do not leave transparent
-        SetLayered(root, false);
-        g_anim.erase(root);
+        if (hWnd == root) ForgetWindow(root); // fail-safe: do not leave transparent
         break;
     }
 
@@ -300,25 +417,46 @@ static void LoadSettings() {
 
 BOOL Wh_ModInit() {
     LoadSettings();
-    g_timerQueue = CreateTimerQueue();
+
+    g_animWakeEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!g_animWakeEvent) {
+        Wh_Log(L"[TWM] Failed to create the wake event");
+        return FALSE;
+    }
 
     if (!Wh_SetFunctionHook((void*)DefWindowProcW,
                             (void*)DefWindowProcW_Hook,
                             (void**)&DefWindowProcW_Original)) {
         Wh_Log(L"[TWM] Failed to hook DefWindowProcW");
+        CloseHandle(g_animWakeEvent);
+        g_animWakeEvent = nullptr;
         return FALSE;
     }
+
     return TRUE;
 }
 
 void Wh_ModUninit() {
-    for (auto& kv : g_anim) {
-        if (kv.second.hTimer) DeleteTimerQueueTimer(g_timerQueue, kv.second.hTimer, INVALID_HANDLE_VALUE);
+    g_animStop = true;
+    if (g_animWakeEvent) SetEvent(g_animWakeEvent);
+    {
+        std::lock_guard<std::mutex> lock(g_animThreadMutex);
+        if (g_animThread.joinable()) g_animThread.join();
+    }
+
+    // Do not leave windows transparent
+    std::vector<WinAnim> remaining;
+    {
+        std::lock_guard<std::mutex> lock(g_animMutex);
+        remaining.swap(g_anim);
     }
-    g_anim.clear();
-    if (g_timerQueue) {
-        DeleteTimerQueue(g_timerQueue);
-        g_timerQueue = nullptr;
+    for (const auto& st : remaining) {
+        ApplyAlphaUpdate({st.hwnd, 255, true, true});
+    }
+
+    if (g_animWakeEvent) {
+        CloseHandle(g_animWakeEvent);
+        g_animWakeEvent = nullptr;
     }
 }
 
@@ -2,7 +2,7 @@
 // @id              uxtheme-hook
 // @name            UXTheme hook
 // @description     Allows you to apply custom themes
-// @version         1.4
+// @version         1.4.1
 // @author          rounk-ctrl
 // @github          https://github.com/rounk-ctrl
 // @include         winlogon.exe
@@ -80,7 +80,10 @@ HRESULT STDCALL CThemeSignature_VerifyHook(
 using SetSysColors_t = decltype(&SetSysColors);
 SetSysColors_t SetSysColors_orig;
 
-int WINAPI SetSysColors_hook(int cElements, const INT *lpaElements, const COLORREF *lpaRgbValues)
+// number of default colors, read once on init instead of on every call
+DWORD g_defaultColorsCount;
+
+DWORD GetDefaultColorsCount()
 {
     // default fallback
     DWORD elemCount = 13;
@@ -93,8 +96,13 @@ int WINAPI SetSysColors_hook(int cElements, const INT *lpaElements, const COLORR
         RegCloseKey(hKey);
     }
 
+    return elemCount;
+}
+
+int WINAPI SetSysColors_hook(int cElements, const INT *lpaElements, const COLORREF *lpaRgbValues)
+{
     // logonui
-    if (cElements == (int)elemCount) return TRUE;
+    if (cElements == (int)g_defaultColorsCount) return TRUE;
     return SetSysColors_orig(cElements, lpaElements, lpaRgbValues);
 }
 
@@ -148,6 +156,7 @@ BOOL Wh_ModInit() {
     }
     
     // for logonui
+    g_defaultColorsCount = GetDefaultColorsCount();
     WindhawkUtils::SetFunctionHook(SetSysColors, SetSysColors_hook, &SetSysColors_orig);
 
     if (settings.preventSettings)
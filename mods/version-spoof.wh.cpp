@@ -2,7 +2,7 @@
 // @id              version-spoof
 // @name            Version Spoof
 // @description     Fakes the Windows version reported to applications
-// @version         1.0.0
+// @version         1.0.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         *
@@ -46,6 +46,10 @@ struct OSSPOOFINFO {
 } g_osSpoofInfo = { 0 };
 bool g_bSpoofVersion = false;
 
+// The process image doesn't change, so it's only queried once.
+WCHAR g_szAppPath[MAX_PATH];
+LPCWSTR g_pszAppName = nullptr;
+
 BOOL (WINAPI *GetVersionExW_orig)(LPOSVERSIONINFOW);
 BOOL WINAPI GetVersionExW_hook(
     LPOSVERSIONINFOW lpVersionInformation
@@ -160,8 +164,12 @@ void UpdateSpoofInfo(void)
     g_bSpoofVersion = false;
     ZeroMemory(&g_osSpoofInfo, sizeof(OSSPOOFINFO));
 
-    WCHAR szAppPath[MAX_PATH];
-    GetModuleFileNameW(GetModuleHandleW(NULL), szAppPath, MAX_PATH);
+    if (!*g_szAppPath)
+    {
+        GetModuleFileNameW(GetModuleHandleW(NULL), g_szAppPath, MAX_PATH);
+        WCHAR *pBackslash = wcsrchr(g_szAppPath, L'\\');
+        g_pszAppName = pBackslash ? pBackslash + 1 : nullptr;
+    }
 
     // 1000 entries maximum.
     for (int i = 0;; i++)
@@ -176,9 +184,8 @@ void UpdateSpoofInfo(void)
         }
 
         // Does the current application path or name match the spoof?
-        WCHAR *pBackslash = wcsrchr(szAppPath, L'\\');
-        if (0 == wcsicmp(szAppPath, szPath)
-        || (pBackslash && 0 == wcsicmp(pBackslash + 1, szPath)))
+        if (0 == wcsicmp(g_szAppPath, szPath)
+        || (g_pszAppName && 0 == wcsicmp(g_pszAppName, szPath)))
         {
             g_bSpoofVersion = true;
             g_osSpoofInfo.dwMajorVersion = Wh_GetIntSetting(L"spoofs[%d].major", i);
@@ -192,7 +199,7 @@ void UpdateSpoofInfo(void)
         {
             Wh_Log(
                 L"Application: %s, spoofing as %d.%d.%d Service Pack %d",
-                szAppPath,
+                g_szAppPath,
                 g_osSpoofInfo.dwMajorVersion,
                 g_osSpoofInfo.dwMinorVersion,
                 g_osSpoofInfo.dwBuildNumber,
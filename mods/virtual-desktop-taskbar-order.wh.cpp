@@ -2,7 +2,7 @@
 // @id              virtual-desktop-taskbar-order
 // @name            Virtual Desktop Preserve Taskbar Order
 // @description     The order on the taskbar isn't preserved between virtual desktop switches, this mod fixes it
-// @version         1.0.4
+// @version         1.0.6
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -38,6 +38,7 @@ Taskbar Tweaker](https://tweaker.ramensoftware.com/).
 #include <regex>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 
 #include <commctrl.h>
@@ -308,6 +309,23 @@ void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
         return;
     }
 
+    // Resolve the task groups to the right of the new group and the task
+    // items of the new group upfront, to keep the work done while holding the
+    // app view array lock, which the taskbar thread contends for, minimal.
+    std::vector<LONG_PTR*> right_task_groups;
+    right_task_groups.reserve(button_groups_count - nButtonGroupIndex - 1);
+    for (int j = nButtonGroupIndex + 1; j < button_groups_count; j++) {
+        right_task_groups.push_back(
+            (LONG_PTR*)CTaskBtnGroup_GetGroup(button_groups[j]));
+    }
+
+    std::vector<LONG_PTR*> task_items;
+    task_items.reserve(buttons_count);
+    for (int j = 0; j < buttons_count; j++) {
+        task_items.push_back(
+            (LONG_PTR*)CTaskBtnGroup_GetTaskItem(button_group, j));
+    }
+
     plp = *(LONG_PTR**)task_group;
     void** ppTaskGroupRelease = (void**)&plp[2];
     PointerRedirectionAdd(ppTaskGroupRelease, (void*)TaskGroupReleaseHook,
@@ -362,20 +380,14 @@ void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
         }
 
         if (g_taskGroupVirtualDesktopReleased != task_group) {
-            if (nRightNeighbourItemIndex == nArraySize) {
-                for (int j = nButtonGroupIndex + 1; j < button_groups_count;
-                     j++) {
-                    LONG_PTR* check_button_group = button_groups[j];
-                    LONG_PTR* check_task_group =
-                        (LONG_PTR*)CTaskBtnGroup_GetGroup(check_button_group);
-                    if (g_taskGroupVirtualDesktopReleased == check_task_group) {
-                        // The current item in lpArray is from the same group
-                        // of at least one of the items in button_groups to the
-                        // right of the newly added item.
-                        nRightNeighbourItemIndex = i - nMatchCount;
-                        break;
-                    }
-                }
+            if (nRightNeighbourItemIndex == nArraySize &&
+                std::find(right_task_groups.begin(), right_task_groups.end(),
+                          g_taskGroupVirtualDesktopReleased) !=
+                    right_task_groups.end()) {
+                // The current item in lpArray is from the same group
+                // of at least one of the items in button_groups to the
+                // right of the newly added item.
+                nRightNeighbourItemIndex = i - nMatchCount;
             }
 
             continue;
@@ -385,23 +397,18 @@ void OnButtonGroupInserted(LONG_PTR lpTaskSwLongPtr,
             continue;
         }
 
-        for (int j = 0; j < buttons_count; j++) {
-            LONG_PTR* task_item =
-                (LONG_PTR*)CTaskBtnGroup_GetTaskItem(button_group, j);
-
-            if (g_taskItemVirtualDesktopReleased == task_item) {
-                // The current item in lpArray matches one of the
-                // buttons in the newly added item.
-                if (i > (size_t)nMatchCount) {
-                    LONG_PTR lpTemp = lpArray[i];
-                    memmove(&lpArray[nMatchCount + 1], &lpArray[nMatchCount],
-                            (i - nMatchCount) * sizeof(LONG_PTR));
-                    lpArray[nMatchCount] = lpTemp;
-                }
-
-                nMatchCount++;
-                break;
+        if (std::find(task_items.begin(), task_items.end(),
+                      g_taskItemVirtualDesktopReleased) != task_items.end()) {
+            // The current item in lpArray matches one of the
+            // buttons in the newly added item.
+            if (i > (size_t)nMatchCount) {
+                LONG_PTR lpTemp = lpArray[i];
+                memmove(&lpArray[nMatchCount + 1], &lpArray[nMatchCount],
+                        (i - nMatchCount) * sizeof(LONG_PTR));
+                lpArray[nMatchCount] = lpTemp;
             }
+
+            nMatchCount++;
         }
     }
 
@@ -802,6 +809,15 @@ std::optional<std::wstring> GetUrlContent(PCWSTR lpUrl) {
         return std::nullopt;
     }
 
+    // The online cache is only a shortcut, don't hold up explorer's startup
+    // for long if the network is slow, the symbols can still be resolved
+    // without it.
+    DWORD dwTimeout = 5000;
+    InternetSetOption(hOpenHandle, INTERNET_OPTION_CONNECT_TIMEOUT, &dwTimeout,
+                      sizeof(dwTimeout));
+    InternetSetOption(hOpenHandle, INTERNET_OPTION_RECEIVE_TIMEOUT, &dwTimeout,
+                      sizeof(dwTimeout));
+
     HINTERNET hUrlHandle =
         InternetOpenUrl(hOpenHandle, lpUrl, nullptr, 0,
                         INTERNET_FLAG_NO_AUTH | INTERNET_FLAG_NO_CACHE_WRITE |
@@ -866,18 +882,11 @@ std::optional<std::wstring> GetUrlContent(PCWSTR lpUrl) {
     return unicodeContent;
 }
 
-bool HookSymbolsWithOnlineCacheFallback(HMODULE module,
-                                        const SYMBOL_HOOK* symbolHooks,
-                                        size_t symbolHooksCount) {
+bool GetOnlineCacheUrl(HMODULE module,
+                       std::wstring* cacheStrKeyResult,
+                       std::wstring* onlineCacheUrlResult) {
     constexpr WCHAR kModIdForCache[] = L"virtual-desktop-taskbar-order";
 
-    if (HookSymbols(module, symbolHooks, symbolHooksCount,
-                    /*cacheOnly=*/true)) {
-        return true;
-    }
-
-    Wh_Log(L"HookSymbols() from cache failed, trying to get an online cache");
-
     WCHAR moduleFilePath[MAX_PATH];
     DWORD moduleFilePathLen =
         GetModuleFileName(module, moduleFilePath, ARRAYSIZE(moduleFilePath));
@@ -928,16 +937,70 @@ bool HookSymbolsWithOnlineCacheFallback(HMODULE module,
     onlineCacheUrl += imageSize;
     onlineCacheUrl += L".txt";
 
-    Wh_Log(L"Looking for an online cache at %s", onlineCacheUrl.c_str());
+    *cacheStrKeyResult = std::move(cacheStrKey);
+    *onlineCacheUrlResult = std::move(onlineCacheUrl);
+    return true;
+}
 
-    auto onlineCache = GetUrlContent(onlineCacheUrl.c_str());
-    if (onlineCache) {
-        Wh_SetStringValue(cacheStrKey.c_str(), onlineCache->c_str());
-    } else {
-        Wh_Log(L"Failed to get online cache");
+struct MODULE_SYMBOL_HOOKS {
+    HMODULE module;
+    const SYMBOL_HOOK* symbolHooks;
+    size_t symbolHooksCount;
+};
+
+bool HookSymbolsWithOnlineCacheFallback(const MODULE_SYMBOL_HOOKS* moduleHooks,
+                                        size_t moduleHooksCount) {
+    std::vector<const MODULE_SYMBOL_HOOKS*> uncachedModuleHooks;
+    for (size_t i = 0; i < moduleHooksCount; i++) {
+        const auto& hooks = moduleHooks[i];
+        if (!HookSymbols(hooks.module, hooks.symbolHooks,
+                         hooks.symbolHooksCount,
+                         /*cacheOnly=*/true)) {
+            uncachedModuleHooks.push_back(&hooks);
+        }
+    }
+
+    if (uncachedModuleHooks.empty()) {
+        return true;
+    }
+
+    Wh_Log(L"HookSymbols() from cache failed, trying to get an online cache");
+
+    // Fetch the online caches of all modules concurrently, so that init waits
+    // for a single round trip instead of one per module.
+    std::vector<std::thread> fetchThreads;
+    for (const auto* hooks : uncachedModuleHooks) {
+        fetchThreads.emplace_back([module = hooks->module]() {
+            std::wstring cacheStrKey;
+            std::wstring onlineCacheUrl;
+            if (!GetOnlineCacheUrl(module, &cacheStrKey, &onlineCacheUrl)) {
+                return;
+            }
+
+            Wh_Log(L"Looking for an online cache at %s",
+                   onlineCacheUrl.c_str());
+
+            auto onlineCache = GetUrlContent(onlineCacheUrl.c_str());
+            if (onlineCache) {
+                Wh_SetStringValue(cacheStrKey.c_str(), onlineCache->c_str());
+            } else {
+                Wh_Log(L"Failed to get online cache");
+            }
+        });
     }
 
-    return HookSymbols(module, symbolHooks, symbolHooksCount);
+    for (auto& thread : fetchThreads) {
+        thread.join();
+    }
+
+    for (const auto* hooks : uncachedModuleHooks) {
+        if (!HookSymbols(hooks->module, hooks->symbolHooks,
+                         hooks->symbolHooksCount)) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 BOOL Wh_ModInit() {
@@ -993,11 +1056,6 @@ BOOL Wh_ModInit() {
         return FALSE;
     }
 
-    if (!HookSymbolsWithOnlineCacheFallback(taskbarModule, taskbarDllHooks,
-                                            ARRAYSIZE(taskbarDllHooks))) {
-        return FALSE;
-    }
-
     // twinui.pcshell.dll
     SYMBOL_HOOK twinuiPcshellSymbolHooks[] = {
         // For offsets:
@@ -1013,9 +1071,14 @@ BOOL Wh_ModInit() {
         return FALSE;
     }
 
-    if (!HookSymbolsWithOnlineCacheFallback(
-            twinuiPcshellModule, twinuiPcshellSymbolHooks,
-            ARRAYSIZE(twinuiPcshellSymbolHooks))) {
+    MODULE_SYMBOL_HOOKS moduleHooks[] = {
+        {taskbarModule, taskbarDllHooks, ARRAYSIZE(taskbarDllHooks)},
+        {twinuiPcshellModule, twinuiPcshellSymbolHooks,
+         ARRAYSIZE(twinuiPcshellSymbolHooks)},
+    };
+
+    if (!HookSymbolsWithOnlineCacheFallback(moduleHooks,
+                                            ARRAYSIZE(moduleHooks))) {
         return FALSE;
     }
 
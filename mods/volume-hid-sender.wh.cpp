@@ -2,12 +2,12 @@
 // @id              volume-hid-sender
 // @name            Volume HID Sendeer
 // @description     HID Mod For Volume (Mountain Everest Max Only)
-// @version         0.1
+// @version         0.2
 // @author          rom4ster
 // @github          https://github.com/rom4ster
 // @include         explorer.exe
 // @include         ShellHost.exe
-// @compilerOptions -lcomctl32 -lole32 -loleaut32 -lurlmon -lruntimeobject
+// @compilerOptions -lcomctl32 -lole32 -loleaut32 -lurlmon -lruntimeobject -lhid -lsetupapi
 // ==/WindhawkMod==
 // ==WindhawkModReadme==
 /*
@@ -21,10 +21,12 @@ Custom timeouts may be supported in the future
 
 Arbritary HID output will be supported in the future
 
-Requires HID HIDApiTester. 
+By default the volume is sent to the keyboard directly. HIDApiTester is only
+required if the native HID output is disabled, or as a fallback if the keyboard
+can't be opened directly.
 
 # Getting started
-First get HIDAPITester
+Optionally get HIDAPITester
 [here](https://github.com/todbot/hidapitester/releases).
 
 Next set the HIDApiTesterPath variable in settings to where you downloaded HIDAPITester to
@@ -46,6 +48,11 @@ https://github.com/todbot/hidapitester
 # Check out the documentation for more information:
 # https://github.com/ramensoftware/windhawk/wiki/Creating-a-new-mod#settings
 - HIDApiTesterPath: I:\\hidapitest\\hidapitester.exe
+- UseNativeHID: true
+  $name: Send to the device directly
+  $description: >-
+   Open the keyboard once and write the reports to it directly, instead of
+   starting HIDApiTester for every volume change
 */
 // ==/WindhawkModSettings==
 
@@ -64,6 +71,11 @@ https://github.com/todbot/hidapitester
 #include <string>
 #include <sstream>
 #include <Urlmon.h>
+#include <setupapi.h>
+#include <hidsdi.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
 #include <windhawk_utils.h>
 
 
@@ -82,6 +94,12 @@ https://github.com/todbot/hidapitester
 #define SPACE + L" " +
 
 #define HIDTesterSetting L"HIDApiTesterPath"
+#define NativeHIDSetting L"UseNativeHID"
+
+#define HID_VID 0x3282
+#define HID_PID 0x0001
+#define HID_USAGE_PAGE 0xFF00
+#define HID_USAGE 0x01
 
 
 
@@ -107,7 +125,15 @@ enum class VolumeUnit {
 };
 
 
- PCWSTR HID_PATH = nullptr;
+ // Read by the sender thread, the settings can change meanwhile
+ std::mutex HID_PATH_MUTEX;
+ std::wstring HID_PATH;
+ std::atomic<bool> USE_NATIVE_HID = true;
+
+std::wstring Get_HID_Path() {
+    std::lock_guard<std::mutex> guard(HID_PATH_MUTEX);
+    return HID_PATH;
+}
 
 
 DLLExport float GetSystemVolume(VolumeUnit vUnit) {
@@ -147,6 +173,15 @@ DLLExport float GetSystemVolume(VolumeUnit vUnit) {
 
 
 
+BOOL FileExists(LPCTSTR szPath)
+{
+  DWORD dwAttrib = GetFileAttributes(szPath);
+
+  return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
+         !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
+}
+
+
 using SendMessageW_t = decltype(&SendMessageW);
 SendMessageW_t  SendMessageW_Original;
 
@@ -180,7 +215,7 @@ VOID startup(LPCTSTR lpApplicationName, LPWSTR cmdLine )
 }
 
 
-std::wstring  FormCommand(float vol) {
+std::wstring  FormCommand(const std::wstring & hidPath, float vol) {
     LPWSTR vid = (LPWSTR) L"3282"; //setting
     LPWSTR pid = (LPWSTR) L"0001"; //setting
     LPWSTR usage_page = (LPWSTR) L"65280"; //setting
@@ -197,7 +232,7 @@ std::wstring  FormCommand(float vol) {
     std::wstring commandp2(L",00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00,00"); //Setting
     std::wstring command = commandp1 + volstring + commandp2;
     std::wstring q1 = std::wstring(L"\"");
-    std::wstring fullstr(q1 + HID_PATH + q1);
+    std::wstring fullstr(q1 + hidPath + q1);
 
     std::wstring completestr =  std::wstring(fullstr SPACE L"--vidpid" SPACE vid + L":" + pid SPACE L"--usagePage" SPACE usage_page SPACE L"--usage" SPACE usage SPACE L"--open" SPACE L"--send-output" SPACE command);     
     Wh_Log( L"%s", ( PCWSTR) completestr.c_str());
@@ -213,21 +248,176 @@ std::wstring  FormCommand(float vol) {
 }
 
 
+// Same report as the one FormCommand passes to HIDApiTester, the first byte
+// is the report ID
+std::vector<BYTE> FormReport(float vol, size_t length) {
+    std::vector<BYTE> report(length, 0);
+    const BYTE header[] = { 64, 0x11, 0x83, 0x00, 0x00 };
+    memcpy(report.data(), header, sizeof(header));
+    report[sizeof(header)] = (BYTE) (int) (vol*100);
+    return report;
+}
+
+
+// Signaled when the mod is being unloaded
+HANDLE STOP_EVENT = nullptr;
+
+// The keyboard is opened once, on the sender thread only, and reopened after a
+// failed write, e.g. after it was reconnected
+HANDLE HID_DEVICE = INVALID_HANDLE_VALUE;
+USHORT HID_REPORT_LENGTH = 0;
+
+void Close_HID_Device() {
+    if (HID_DEVICE != INVALID_HANDLE_VALUE) {
+        CloseHandle(HID_DEVICE);
+        HID_DEVICE = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool Open_HID_Device() {
+    if (HID_DEVICE != INVALID_HANDLE_VALUE) {
+        return true;
+    }
+
+    GUID hidGuid;
+    HidD_GetHidGuid(&hidGuid);
+
+    HDEVINFO devInfo = SetupDiGetClassDevsW(&hidGuid, nullptr, nullptr, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (devInfo == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    SP_DEVICE_INTERFACE_DATA interfaceData = { sizeof(interfaceData) };
+    for (DWORD i = 0; HID_DEVICE == INVALID_HANDLE_VALUE &&
+         SetupDiEnumDeviceInterfaces(devInfo, nullptr, &hidGuid, i, &interfaceData); i++) {
+        DWORD size = 0;
+        SetupDiGetDeviceInterfaceDetailW(devInfo, &interfaceData, nullptr, 0, &size, nullptr);
+        if (size < sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W)) {
+            continue;
+        }
+
+        std::vector<BYTE> detailBuffer(size);
+        auto detail = (PSP_DEVICE_INTERFACE_DETAIL_DATA_W) detailBuffer.data();
+        detail->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA_W);
+        if (!SetupDiGetDeviceInterfaceDetailW(devInfo, &interfaceData, detail, size, nullptr, nullptr)) {
+            continue;
+        }
+
+        HANDLE device = CreateFileW(detail->DevicePath, GENERIC_READ | GENERIC_WRITE,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                                    FILE_FLAG_OVERLAPPED, nullptr);
+        if (device == INVALID_HANDLE_VALUE) {
+            continue;
+        }
+
+        HIDD_ATTRIBUTES attributes = { sizeof(attributes) };
+        PHIDP_PREPARSED_DATA preparsedData = nullptr;
+        HIDP_CAPS caps = {};
+        bool match = HidD_GetAttributes(device, &attributes) &&
+            attributes.VendorID == HID_VID && attributes.ProductID == HID_PID &&
+            HidD_GetPreparsedData(device, &preparsedData);
+        if (match) {
+            match = HidP_GetCaps(preparsedData, &caps) == HIDP_STATUS_SUCCESS &&
+                caps.UsagePage == HID_USAGE_PAGE && caps.Usage == HID_USAGE &&
+                caps.OutputReportByteLength > 5;
+            HidD_FreePreparsedData(preparsedData);
+        }
+
+        if (match) {
+            HID_DEVICE = device;
+            HID_REPORT_LENGTH = caps.OutputReportByteLength;
+            Wh_Log(L"Opened HID device %s", detail->DevicePath);
+        } else {
+            CloseHandle(device);
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(devInfo);
+    return HID_DEVICE != INVALID_HANDLE_VALUE;
+}
+
+// A keyboard which stopped reading reports would block a synchronous write,
+// and with it the unload of the mod, so the write is overlapped and given up
+// after a timeout or when the mod is being unloaded
+bool Write_HID_Report(const std::vector<BYTE> & report) {
+    HANDLE writeEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!writeEvent) {
+        return false;
+    }
+
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = writeEvent;
+    DWORD written;
+    bool result = WriteFile(HID_DEVICE, report.data(), (DWORD) report.size(), nullptr, &overlapped);
+    if (!result && GetLastError() == ERROR_IO_PENDING) {
+        HANDLE events[] = { STOP_EVENT, writeEvent };
+        if (WaitForMultipleObjects(2, events, FALSE, 1 SECONDS) != WAIT_OBJECT_0 + 1) {
+            CancelIoEx(HID_DEVICE, &overlapped);
+        }
+        result = GetOverlappedResult(HID_DEVICE, &overlapped, &written, TRUE);
+    }
+
+    DWORD error = GetLastError();
+    CloseHandle(writeEvent);
+    SetLastError(error);
+    return result;
+}
+
+bool Send_Native(float vol) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!Open_HID_Device()) {
+            return false;
+        }
+
+        std::vector<BYTE> report = FormReport(vol, HID_REPORT_LENGTH);
+        if (Write_HID_Report(report)) {
+            return true;
+        }
+
+        Wh_Log(L"HID write failed: %u", GetLastError());
+        Close_HID_Device();
+    }
+    return false;
+}
+
+void Send_Volume(float vol) {
+    Wh_Log(L"Volume Info: %f", vol);
+    if (USE_NATIVE_HID && Send_Native(vol)) {
+        return;
+    }
+    std::wstring hidPath = Get_HID_Path();
+    if (FileExists(hidPath.c_str())) {
+        startup(hidPath.c_str(), ((LPWSTR) FormCommand(hidPath, vol).c_str()));
+    }
+}
+
+
+// A single sender thread. Volume changes only signal it, so the changes of a
+// slider drag are coalesced into one send of the latest volume
+HANDLE VOLUME_CHANGED_EVENT = nullptr;
+HANDLE SENDER_THREAD = nullptr;
+
+// Returns false if the mod is being unloaded
+bool Wait_Or_Stop(DWORD timeout) {
+    return WaitForSingleObject(STOP_EVENT, timeout) == WAIT_TIMEOUT;
+}
+
 DWORD WINAPI ThreadFunc(void * data) {
-        Sleep(2 SECONDS);
-        float vol = GetSystemVolume(VolumeUnit::Scalar);
-
-        Wh_Log(L"Volume Info: %f", vol);
-        startup(HID_PATH, ((LPWSTR) FormCommand(vol).c_str()));
-        Sleep(5 SECONDS);
-        vol = GetSystemVolume(VolumeUnit::Scalar);
-        Wh_Log(L"Volume Info: %f", vol);
-        startup(HID_PATH, ((LPWSTR) FormCommand(vol).c_str()));
-        Sleep(2 SECONDS);
-        //Sleep(15 SECONDS);
-        //vol = GetSystemVolume(VolumeUnit::Scalar);
-        //Wh_Log(L"Volume Info: %f", vol);
-        //startup(L"hidapitester.exe", FormCommand(vol));
+        HANDLE events[] = { STOP_EVENT, VOLUME_CHANGED_EVENT };
+        while (WaitForMultipleObjects(2, events, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+            if (!Wait_Or_Stop(2 SECONDS)) {
+                break;
+            }
+            Send_Volume(GetSystemVolume(VolumeUnit::Scalar));
+
+            // The volume reported right after a change is sometimes stale,
+            // send it again once it settled unless it changed again meanwhile
+            if (WaitForMultipleObjects(2, events, FALSE, 5 SECONDS) == WAIT_OBJECT_0) {
+                break;
+            }
+            Send_Volume(GetSystemVolume(VolumeUnit::Scalar));
+        }
+        Close_HID_Device();
         return 0;
 }
 
@@ -243,7 +433,7 @@ DWORD WINAPI ThreadFunc(void * data) {
     if (Msg == 1046) {
         Wh_Log(L" PTR FOUND %i",  (unsigned short ) lParam );
         if ((unsigned short) lParam >= 0) {
-            CreateThread(nullptr, 0, ThreadFunc, nullptr, 0, nullptr);
+            SetEvent(VOLUME_CHANGED_EVENT);
         }
         
     }
@@ -281,31 +471,36 @@ void Download_EXE() {
     MessageBox(NULL, message, L"HIDApiTester Not Found", MB_OK);
 
 }
-BOOL FileExists(LPCTSTR szPath)
-{
-  DWORD dwAttrib = GetFileAttributes(szPath);
-
-  return (dwAttrib != INVALID_FILE_ATTRIBUTES && 
-         !(dwAttrib & FILE_ATTRIBUTE_DIRECTORY));
-}
 
 
-void UnInit_Settings() {
-    if (HID_PATH != nullptr) {
-         Wh_FreeStringSetting(HID_PATH);
+void Init_Settings() {
+    PCWSTR hidPath = Wh_GetStringSetting(HIDTesterSetting);
+    {
+        std::lock_guard<std::mutex> guard(HID_PATH_MUTEX);
+        HID_PATH = hidPath;
     }
-    
+    Wh_FreeStringSetting(hidPath);
+    USE_NATIVE_HID = Wh_GetIntSetting(NativeHIDSetting);
 }
 
-void Init_Settings() {
-     UnInit_Settings();
-    HID_PATH = Wh_GetStringSetting(HIDTesterSetting);
+void Close_Events() {
+    if (VOLUME_CHANGED_EVENT) {
+        CloseHandle(VOLUME_CHANGED_EVENT);
+        VOLUME_CHANGED_EVENT = nullptr;
+    }
+    if (STOP_EVENT) {
+        CloseHandle(STOP_EVENT);
+        STOP_EVENT = nullptr;
+    }
 }
 
 
 
 bool Check_Requirements() {
-    if (!FileExists(HID_PATH)) {
+    if (USE_NATIVE_HID) {
+        return TRUE;
+    }
+    if (!FileExists(Get_HID_Path().c_str())) {
         Download_EXE();
         return FALSE;
     }
@@ -318,7 +513,16 @@ void Wh_ModSettingsChanged() {
 }
 
 void Wh_ModBeforeUninit() {
-    UnInit_Settings();
+    if (SENDER_THREAD) {
+        SetEvent(STOP_EVENT);
+        WaitForSingleObject(SENDER_THREAD, INFINITE);
+        CloseHandle(SENDER_THREAD);
+        SENDER_THREAD = nullptr;
+    }
+}
+
+void Wh_ModUninit() {
+    Close_Events();
 }
 
 BOOL Wh_ModInit() {
@@ -343,6 +547,18 @@ BOOL Wh_ModInit() {
     if (!Check_Requirements()) {
         return FALSE;
     }
+    WhL("Begin Sender")
+    VOLUME_CHANGED_EVENT = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    STOP_EVENT = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!VOLUME_CHANGED_EVENT || !STOP_EVENT) {
+        Close_Events();
+        return FALSE;
+    }
+    SENDER_THREAD = CreateThread(nullptr, 0, ThreadFunc, nullptr, 0, nullptr);
+    if (!SENDER_THREAD) {
+        Close_Events();
+        return FALSE;
+    }
     WhL("Begin Hooks")
     Set_Hooks();
     //if (!FileExists(L"hidapitester.exe")) {
@@ -2,7 +2,7 @@
 // @id              vscode-tweaker
 // @name            VSCode Tweaker
 // @description     Tweak Microsoft Visual Studio Code by injecting custom JavaScript and CSS code
-// @version         1.0.1
+// @version         1.0.2
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -61,9 +61,11 @@ No files are modified on disk - to revert all changes, disable the mod and resta
 
 #include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <regex>
 #include <sstream>
 #include <string>
+#include <vector>
 
 enum VSCODE_FILE {
     // Configurable with the mod.
@@ -106,6 +108,23 @@ struct {
     std::string newFileHash;
 } g_vscodeFiles[VSCODE_FILE_COUNT];
 
+enum class SnippetSource {
+    Inline,
+    File,
+    InlineReplace,
+};
+
+// The snippet settings, read and compiled once on init.
+struct CodeSnippet {
+    std::wstring type;
+    SnippetSource source;
+    std::wstring code;
+    std::regex search;   // InlineReplace only.
+    std::string replace; // InlineReplace only.
+};
+
+std::vector<CodeSnippet> g_codeSnippets;
+
 // https://gist.github.com/tomykaira/f0fd86b6c73063283afe550bc5d77594
 std::string Base64Encode(const BYTE* data, size_t in_len)
 {
@@ -270,7 +289,7 @@ void GetInitialTempFileName(WCHAR tempFileName[MAX_PATH])
     GetTempFileName(tempPath, L"vst", 0, tempFileName);
 }
 
-void RenameToFinalTempFileName(WCHAR tempFileName[MAX_PATH], const std::string& fileHash, WCHAR finalTempFileName[MAX_PATH])
+void GetFinalTempFileName(const std::string& fileHash, WCHAR finalTempFileName[MAX_PATH])
 {
     std::wstring fileName = std::wstring(fileHash.begin(), fileHash.end());
     std::replace(fileName.begin(), fileName.end(), L'+', L'-');
@@ -278,6 +297,11 @@ void RenameToFinalTempFileName(WCHAR tempFileName[MAX_PATH], const std::string&
 
     GetModTempPath(finalTempFileName);
     PathAppend(finalTempFileName, fileName.c_str());
+}
+
+void RenameToFinalTempFileName(WCHAR tempFileName[MAX_PATH], const std::string& fileHash, WCHAR finalTempFileName[MAX_PATH])
+{
+    GetFinalTempFileName(fileHash, finalTempFileName);
 
     if (GetFileAttributes(finalTempFileName) == INVALID_FILE_ATTRIBUTES) {
         MoveFile(tempFileName, finalTempFileName);
@@ -307,111 +331,257 @@ std::string wide_string_to_string(PCWSTR wide_string)
     return result;
 }
 
-std::string MakeReplacementsInCode(std::string code, PCWSTR fileType)
+void LoadCodeSnippets()
 {
     for (int i = 0; ; i++) {
         PCWSTR type = Wh_GetStringSetting(L"CodeSnippets[%d].Type", i);
         bool done = !*type;
-        bool typeMatch = !done && wcscmp(type, fileType) == 0;
+        CodeSnippet snippet;
+        snippet.type = type;
         Wh_FreeStringSetting(type);
 
         if (done) {
             break;
         }
 
-        if (!typeMatch) {
-            continue;
-        }
-
         PCWSTR source = Wh_GetStringSetting(L"CodeSnippets[%d].Source", i);
-        bool isInlineReplace = wcscmp(source, L"inline_replace") == 0;
+        if (wcscmp(source, L"file") == 0) {
+            snippet.source = SnippetSource::File;
+        }
+        else if (wcscmp(source, L"inline_replace") == 0) {
+            snippet.source = SnippetSource::InlineReplace;
+        }
+        else {
+            snippet.source = SnippetSource::Inline;
+        }
         Wh_FreeStringSetting(source);
 
-        if (!isInlineReplace) {
-            continue;
+        PCWSTR code = Wh_GetStringSetting(L"CodeSnippets[%d].Code", i);
+        snippet.code = code;
+        Wh_FreeStringSetting(code);
+
+        if (snippet.source == SnippetSource::InlineReplace) {
+            std::string searchReplace = wide_string_to_string(snippet.code.c_str());
+            auto splitPos = searchReplace.find("=>");
+            if (splitPos == std::string::npos) {
+                continue;
+            }
+
+            snippet.search = std::regex(searchReplace.substr(0, splitPos));
+            snippet.replace = searchReplace.substr(splitPos + 2);
         }
 
-        PCWSTR searchReplaceCode = Wh_GetStringSetting(L"CodeSnippets[%d].Code", i);
-        std::string searchReplace = wide_string_to_string(searchReplaceCode);
-        Wh_FreeStringSetting(searchReplaceCode);
+        g_codeSnippets.push_back(std::move(snippet));
+    }
+}
 
-        auto splitPos = searchReplace.find("=>");
-        if (splitPos == std::string::npos) {
+// FNV-1a, only used to detect changes, not for VSCode's checksums.
+uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const BYTE* bytes = (const BYTE*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+uint64_t HashFileStat(uint64_t hash, PCWSTR path)
+{
+    hash = HashBytes(hash, path, wcslen(path) * sizeof(WCHAR));
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (GetFileAttributesEx(path, GetFileExInfoStandard, &data)) {
+        hash = HashBytes(hash, &data.nFileSizeHigh, sizeof(data.nFileSizeHigh));
+        hash = HashBytes(hash, &data.nFileSizeLow, sizeof(data.nFileSizeLow));
+        hash = HashBytes(hash, &data.ftLastWriteTime, sizeof(data.ftLastWriteTime));
+    }
+
+    return hash;
+}
+
+// Identifies the generated file: the source file and the snippets which apply to it.
+uint64_t GetCacheKey(PCWSTR fileType, PCWSTR sourceFilePath)
+{
+    uint64_t hash = HashFileStat(0xCBF29CE484222325ULL, sourceFilePath);
+
+    for (const auto& snippet : g_codeSnippets) {
+        if (snippet.type != fileType) {
             continue;
         }
 
-        std::string search = searchReplace.substr(0, splitPos);
-        std::string replace = searchReplace.substr(splitPos + 2);
+        hash = HashBytes(hash, &snippet.source, sizeof(snippet.source));
+        hash = HashBytes(hash, snippet.code.c_str(), (snippet.code.length() + 1) * sizeof(WCHAR));
+        if (snippet.source == SnippetSource::File) {
+            hash = HashFileStat(hash, snippet.code.c_str());
+        }
+    }
+
+    return hash;
+}
+
+// The value format is <cache key>|<file hash>, the file name is derived from
+// the file hash.
+bool LoadCachedFile(PCWSTR fileType, uint64_t cacheKey, WCHAR targetFilePath[MAX_PATH], std::string& fileHash)
+{
+    WCHAR valueName[64];
+    swprintf_s(valueName, L"Cache_%s", fileType);
+
+    WCHAR value[128];
+    if (!Wh_GetStringValue(valueName, value, ARRAYSIZE(value))) {
+        return false;
+    }
+
+    WCHAR cacheKeyString[17];
+    swprintf_s(cacheKeyString, L"%016llX", cacheKey);
+
+    PCWSTR separator = wcschr(value, L'|');
+    if (!separator || separator - value != 16 || wcsncmp(value, cacheKeyString, 16) != 0) {
+        return false;
+    }
+
+    std::string cachedHash = wide_string_to_string(separator + 1);
+    if (cachedHash.empty()) {
+        return false;
+    }
 
-        std::regex regex(search);
-        code = std::regex_replace(code, regex, replace);
+    GetFinalTempFileName(cachedHash, targetFilePath);
+    if (GetFileAttributes(targetFilePath) == INVALID_FILE_ATTRIBUTES) {
+        return false;
     }
 
-    return code;
+    Wh_Log(L"Using cached %s file", fileType);
+    fileHash = cachedHash;
+    return true;
 }
 
-void AppendModCodeToStream(std::ofstream& output, PCWSTR typeToAppend)
+void StoreCachedFile(PCWSTR fileType, uint64_t cacheKey, const std::string& fileHash)
 {
-    for (int i = 0; ; i++) {
-        PCWSTR type = Wh_GetStringSetting(L"CodeSnippets[%d].Type", i);
-        bool done = !*type;
-        bool typeMatch = !done && wcscmp(type, typeToAppend) == 0;
-        Wh_FreeStringSetting(type);
+    WCHAR valueName[64];
+    swprintf_s(valueName, L"Cache_%s", fileType);
 
-        if (done) {
-            break;
+    WCHAR value[128];
+    swprintf_s(value, L"%016llX|%S", cacheKey, fileHash.c_str());
+    Wh_SetStringValue(valueName, value);
+}
+
+// Streams the source file to the output, applying the inline replace snippets.
+// The source is memory-mapped, and a copy is only made when there's more than
+// one replacement to chain.
+void WriteReplacedSourceToStream(std::ofstream& output, PCWSTR sourceFilePath, PCWSTR fileType)
+{
+    std::vector<const CodeSnippet*> replacements;
+    for (const auto& snippet : g_codeSnippets) {
+        if (snippet.type == fileType && snippet.source == SnippetSource::InlineReplace) {
+            replacements.push_back(&snippet);
         }
+    }
 
-        if (!typeMatch) {
-            continue;
+    HANDLE hFile = CreateFile(sourceFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    LARGE_INTEGER fileSize;
+    HANDLE hMapping = NULL;
+    const char* data = nullptr;
+    if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0) {
+        hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping) {
+            data = (const char*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
         }
+    }
 
-        PCWSTR source = Wh_GetStringSetting(L"CodeSnippets[%d].Source", i);
-        bool fromFile = wcscmp(source, L"file") == 0;
-        bool fromInlineCode = wcscmp(source, L"inline") == 0;
-        Wh_FreeStringSetting(source);
+    if (data) {
+        const char* begin = data;
+        const char* end = data + fileSize.QuadPart;
+        std::string code;
+        std::string nextCode;
+        for (size_t i = 0; i < replacements.size(); i++) {
+            const auto* snippet = replacements[i];
+            if (i == replacements.size() - 1) {
+                std::regex_replace(std::ostreambuf_iterator<char>(output), begin, end, snippet->search, snippet->replace);
+            }
+            else {
+                nextCode.clear();
+                std::regex_replace(std::back_inserter(nextCode), begin, end, snippet->search, snippet->replace);
+                code.swap(nextCode);
+                begin = code.data();
+                end = begin + code.length();
+            }
+        }
 
-        PCWSTR code = Wh_GetStringSetting(L"CodeSnippets[%d].Code", i);
+        if (replacements.empty()) {
+            output.write(begin, end - begin);
+        }
+
+        UnmapViewOfFile(data);
+    }
+
+    if (hMapping) {
+        CloseHandle(hMapping);
+    }
+    CloseHandle(hFile);
+}
+
+void AppendModCodeToStream(std::ofstream& output, PCWSTR typeToAppend)
+{
+    for (const auto& snippet : g_codeSnippets) {
+        if (snippet.type != typeToAppend) {
+            continue;
+        }
 
         output << '\n';
 
-        if (fromFile) {
-            std::ifstream input(code);
+        if (snippet.source == SnippetSource::File) {
+            std::ifstream input(snippet.code.c_str());
             output << input.rdbuf();
         }
-        else if (fromInlineCode) {
-            output << wide_string_to_string(code);
+        else if (snippet.source == SnippetSource::Inline) {
+            output << wide_string_to_string(snippet.code.c_str());
         }
-
-        Wh_FreeStringSetting(code);
     }
 }
 
 std::string CreateNewVscodeFile(PCWSTR fileType, WCHAR sourceFilePath[MAX_PATH], WCHAR targetFilePath[MAX_PATH])
 {
-    std::stringstream buffer;
-    {
-        std::ifstream input(sourceFilePath);
-        buffer << input.rdbuf();
+    uint64_t cacheKey = GetCacheKey(fileType, sourceFilePath);
+
+    std::string fileHash;
+    if (LoadCachedFile(fileType, cacheKey, targetFilePath, fileHash)) {
+        return fileHash;
     }
 
     WCHAR tempFilePath[MAX_PATH];
     GetInitialTempFileName(tempFilePath);
 
     {
-        std::ofstream output(tempFilePath);
-        output << MakeReplacementsInCode(buffer.str(), fileType);
+        std::ofstream output(tempFilePath, std::ios::binary);
+        WriteReplacedSourceToStream(output, sourceFilePath, fileType);
         AppendModCodeToStream(output, fileType);
     }
 
-    std::string fileHash = FileHash(tempFilePath);
+    fileHash = FileHash(tempFilePath);
     RenameToFinalTempFileName(tempFilePath, fileHash, targetFilePath);
+    StoreCachedFile(fileType, cacheKey, fileHash);
 
     return fileHash;
 }
 
 std::string CreateNewProductFile(WCHAR sourceFilePath[MAX_PATH], WCHAR targetFilePath[MAX_PATH])
 {
+    // The product file only depends on the source file and the new hashes.
+    uint64_t cacheKey = HashFileStat(0xCBF29CE484222325ULL, sourceFilePath);
+    for (size_t i = 0; i < VSCODE_FILE_PRODUCT_JSON; i++) {
+        const std::string& hash = g_vscodeFiles[i].newFileHash;
+        cacheKey = HashBytes(cacheKey, hash.c_str(), hash.length() + 1);
+    }
+
+    std::string fileHash;
+    if (LoadCachedFile(L"product_json", cacheKey, targetFilePath, fileHash)) {
+        return fileHash;
+    }
+
     std::stringstream buffer;
     {
         std::ifstream input(sourceFilePath);
@@ -454,8 +624,9 @@ std::string CreateNewProductFile(WCHAR sourceFilePath[MAX_PATH], WCHAR targetFil
         output << newContent;
     }
 
-    std::string fileHash = FileHash(tempFilePath);
+    fileHash = FileHash(tempFilePath);
     RenameToFinalTempFileName(tempFilePath, fileHash, targetFilePath);
+    StoreCachedFile(L"product_json", cacheKey, fileHash);
 
     return fileHash;
 }
@@ -468,6 +639,8 @@ BOOL Wh_ModInit(void)
     GetModuleFileName(nullptr, modulePath, ARRAYSIZE(modulePath));
     PathRemoveFileSpec(modulePath);
 
+    LoadCodeSnippets();
+
     for (size_t i = 0; i < VSCODE_FILE_COUNT; i++) {
         PathCombine(g_vscodeFiles[i].filePath, modulePath, g_vscodeFilePaths[i]);
 
@@ -3,7 +3,7 @@
 // @name            Win+D per monitor(show desktop)
 // @description     Press Win+D to only manage the windows on the monitor where the mouse is located.
 // @description:zh-CN   按下Win+D时 只最小化/还原鼠标所在显示器的窗口
-// @version         1.1.20250811
+// @version         1.1.20261014
 // @author          easyatm
 // @github          https://github.com/easyatm
 // @include         explorer.exe
@@ -35,6 +35,10 @@ where the mouse cursor is located.
 
 ## Changelog
 
+### 2026-10-14 (v1.1.20261014)
+- Restore the window order with a single deferred window position transaction
+- 使用单次延迟窗口位置事务恢复窗口顺序
+
 ### 2025-08-11 (v1.1.20250811)
 - Added option to ignore topmost tool windows without title bar during Win+D operation
 - 新增忽略置顶且无标题栏的工具窗口选项，在Win+D操作时保持这类窗口可见
@@ -53,7 +57,6 @@ Fixes:
 #include <dwmapi.h>
 #include <errhandlingapi.h>
 #include <format>
-#include <list>
 #include <map>
 #include <set>
 #include <string>
@@ -89,10 +92,9 @@ class WindShowDesktop
     struct WndInfo
     {
         HWND wnd = nullptr;
-        std::string cls;
         HWND ownerWnd = nullptr;
     };
-    inline static std::map<HMONITOR, std::list<WndInfo>> mapWnd;
+    inline static std::map<HMONITOR, std::vector<WndInfo>> mapWnd;
 
     // 激活指定窗口
     static void activeWnd(HWND hWnd)
@@ -165,16 +167,15 @@ class WindShowDesktop
     {
         auto& listWnd = mapWnd[hMonitor];
         HWND hLastWnd = nullptr;
-        for (auto it = listWnd.begin(); it != listWnd.end();)
+        for (const auto& rc : listWnd)
         {
-            auto curIt = it++;
-            if (curIt->ownerWnd)
+            if (rc.ownerWnd)
             {
-                ShowOwnedPopups(curIt->ownerWnd, true);
-                hLastWnd = curIt->wnd;
-                listWnd.erase(curIt);
+                ShowOwnedPopups(rc.ownerWnd, true);
+                hLastWnd = rc.wnd;
             }
         }
+        std::erase_if(listWnd, [](const WndInfo& rc) { return rc.ownerWnd != nullptr; });
         if (hLastWnd && isActive)
             activeWnd(hLastWnd);
         return hLastWnd != nullptr;
@@ -213,6 +214,33 @@ class WindShowDesktop
         return true;
     }
 
+    // 将窗口按原有顺序置于顶部（从底到顶排列），通过单次DeferWindowPos事务完成，
+    // 避免逐个窗口重绘造成的层叠效果
+    static void bringWindowsToTop(const std::vector<HWND>& vecWnd)
+    {
+        if (vecWnd.empty())
+            return;
+
+        HDWP hDwp = BeginDeferWindowPos((int)vecWnd.size());
+        HWND hInsertAfter = HWND_TOP;
+        for (auto it = vecWnd.rbegin(); it != vecWnd.rend() && hDwp; ++it)
+        {
+            hDwp = DeferWindowPos(hDwp, *it, hInsertAfter, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE);
+            hInsertAfter = *it;
+        }
+
+        if (hDwp && EndDeferWindowPos(hDwp))
+            return;
+
+        // 事务失败时（例如某个窗口已被销毁），逐个窗口处理
+        log("DeferWindowPos failed, error:{}", ::GetLastError());
+        for (HWND hWnd : vecWnd)
+        {
+            SetWindowPos(hWnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE);
+            SetWindowPos(hWnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE);
+        }
+    }
+
 public:
     // 显示桌面功能的主要实现
     static bool showDesktop()
@@ -286,7 +314,7 @@ public:
                 log("Processing window: class='{}', title='{}', size={}x{}, hwnd=0x{:x}, owner=0x{:x}",
                     wndClass, windowTitle, width, height, (uintptr_t)hWndCcc, (uintptr_t)ownerWnd);
 
-                vec.push_back({ hWndCcc, wndClass, ownerWnd });
+                vec.push_back({ hWndCcc, ownerWnd });
             }
             return vec;
         };
@@ -302,12 +330,8 @@ public:
         if (!vecCur.empty())
         {
 
-            for (auto it = listWnd.begin(); it != listWnd.end();)
-            {
-                auto curIt = it++;
-                if (!curIt->ownerWnd)
-                    listWnd.erase(curIt);
-            }
+            std::erase_if(listWnd, [](const WndInfo& rc) { return rc.ownerWnd == nullptr; });
+            listWnd.reserve(listWnd.size() + vecCur.size());
 
             for (auto& rc : vecCur)
             {
@@ -322,7 +346,7 @@ public:
                     PostMessage(rc.wnd, WM_SYSCOMMAND, SC_MINIMIZE, 0);
                 }
 
-                listWnd.emplace_back(std::move(rc));
+                listWnd.push_back(rc);
             }
 
             activeWnd(hDesktop);
@@ -331,10 +355,11 @@ public:
         {
 
             HWND hLastWnd = nullptr;
+            std::vector<HWND> vecRestored;
+            vecRestored.reserve(listWnd.size());
 
-            for (auto it = listWnd.begin(); it != listWnd.end(); it++)
+            for (const auto& rc : listWnd)
             {
-                auto& rc = *it;
                 if (!::IsWindow(rc.wnd))
                     continue;
 
@@ -349,11 +374,11 @@ public:
                     hLastWnd = rc.wnd;
                 }
 
-                SetWindowPos(rc.wnd, HWND_TOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE);
-                SetWindowPos(rc.wnd, HWND_NOTOPMOST, 0, 0, 0, 0, SWP_NOSIZE | SWP_NOMOVE | SWP_NOACTIVATE);
+                vecRestored.push_back(rc.wnd);
             }
 
             listWnd.clear();
+            bringWindowsToTop(vecRestored);
             activeWnd(hLastWnd);
         }
 
@@ -2,7 +2,7 @@
 // @id              win11-accent-border
 // @name            Windows 11 Accent Window Border
 // @description     Show the accent color on the border but not on the titlebar
-// @version         1.0.2
+// @version         1.0.3
 // @author          Guerra24
 // @github          https://github.com/Guerra24
 // @include         *
@@ -35,10 +35,22 @@ You can use `AccentColorInactive` in `HKEY_CURRENT_USER\Software\Microsoft\Windo
 #include <dwmapi.h>
 #include <windhawk_api.h>
 
+#include <atomic>
+#include <unordered_map>
+
 COLORREF BorderActive;
 COLORREF BorderInactive = 0x000000;
 const COLORREF ColorDefault = DWMWA_COLOR_DEFAULT;
 
+// The border color last set for each window, to skip redundant DWM calls.
+SRWLOCK g_borderColorsLock = SRWLOCK_INIT;
+std::unordered_map<HWND, COLORREF> g_borderColors;
+
+// The colorization (wParam, lParam) of the last WM_DWMCOLORIZATIONCOLORCHANGED
+// the colors were loaded for. The message is broadcast to every top level
+// window, but the colors only need to be read once.
+std::atomic<ULONGLONG> g_loadedColorization{ULLONG_MAX};
+
 void LoadColors() {
     DWORD color;
     DWORD colorSize = sizeof(color);
@@ -51,6 +63,15 @@ void LoadColors() {
     }
 }
 
+void LoadColorsForColorization(WPARAM wParam, LPARAM lParam)
+{
+    ULONGLONG colorization = ((ULONGLONG)(DWORD)wParam << 32) | (DWORD)lParam;
+    if (g_loadedColorization.exchange(colorization) != colorization)
+    {
+        LoadColors();
+    }
+}
+
 void SetBorderColor(HWND hWnd, BOOL activate)
 {
     DWORD dwStyle = GetWindowLongPtr(hWnd, GWL_STYLE);
@@ -59,17 +80,35 @@ void SetBorderColor(HWND hWnd, BOOL activate)
     {
         return;
     }
-    Wh_Log(L"Activate: %d", activate);
-    if (activate)
+
+    COLORREF color = activate ? BorderActive : BorderInactive;
+
+    AcquireSRWLockShared(&g_borderColorsLock);
+    auto it = g_borderColors.find(hWnd);
+    bool unchanged = it != g_borderColors.end() && it->second == color;
+    ReleaseSRWLockShared(&g_borderColorsLock);
+
+    if (unchanged)
     {
-        DwmSetWindowAttribute(hWnd, DWMWA_BORDER_COLOR, &BorderActive, sizeof(BorderActive));
+        return;
     }
-    else
+
+    Wh_Log(L"Activate: %d", activate);
+    if (SUCCEEDED(DwmSetWindowAttribute(hWnd, DWMWA_BORDER_COLOR, &color, sizeof(color))))
     {
-        DwmSetWindowAttribute(hWnd, DWMWA_BORDER_COLOR, &BorderInactive, sizeof(BorderInactive));
+        AcquireSRWLockExclusive(&g_borderColorsLock);
+        g_borderColors[hWnd] = color;
+        ReleaseSRWLockExclusive(&g_borderColorsLock);
     }
 }
 
+void ForgetBorderColor(HWND hWnd)
+{
+    AcquireSRWLockExclusive(&g_borderColorsLock);
+    g_borderColors.erase(hWnd);
+    ReleaseSRWLockExclusive(&g_borderColorsLock);
+}
+
 typedef LRESULT (WINAPI *DefWindowProcA_t)(HWND, UINT, WPARAM, LPARAM);
 DefWindowProcA_t DefWindowProcA_orig;
 LRESULT WINAPI DefWindowProcA_hook(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
@@ -82,9 +121,12 @@ LRESULT WINAPI DefWindowProcA_hook(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
             SetBorderColor(hWnd, wParam);
         break;
         case WM_DWMCOLORIZATIONCOLORCHANGED:
-            LoadColors();
+            LoadColorsForColorization(wParam, lParam);
             SetBorderColor(hWnd, GetForegroundWindow() == hWnd);
         break;
+        case WM_NCDESTROY:
+            ForgetBorderColor(hWnd);
+        break;
     }
 
     return result;
@@ -102,9 +144,12 @@ LRESULT WINAPI DefWindowProcW_hook(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM l
             SetBorderColor(hWnd, wParam);
         break;
         case WM_DWMCOLORIZATIONCOLORCHANGED:
-            LoadColors();
+            LoadColorsForColorization(wParam, lParam);
             SetBorderColor(hWnd, GetForegroundWindow() == hWnd);
         break;
+        case WM_NCDESTROY:
+            ForgetBorderColor(hWnd);
+        break;
     }
 
     return result;
@@ -222,4 +267,8 @@ void Wh_ModUninit() {
     Wh_Log(L"Uninit");
 
     EnumWindows(DisableEnumWindowsCallback, GetCurrentProcessId());
+
+    AcquireSRWLockExclusive(&g_borderColorsLock);
+    g_borderColors.clear();
+    ReleaseSRWLockExclusive(&g_borderColorsLock);
 }
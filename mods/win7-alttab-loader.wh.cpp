@@ -2,7 +2,7 @@
 // @id              win7-alttab-loader
 // @name            Windows 7/8.x Alt+Tab Loader
 // @description     Loads Windows 7/8.x Alt+Tab on Windows 10.
-// @version         2.1.0
+// @version         2.1.1
 // @author          aubymori
 // @github          https://github.com/aubymori
 // @include         explorer.exe
@@ -50,6 +50,10 @@ This mod allows the Windows 7/8.x Alt+Tab UI to work on Windows 10.
 #include <propkey.h>
 #include <shlguid.h>
 
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 HMODULE g_hAltTab = NULL;
 
 DEFINE_GUID(CLSID_AltTabSSO, 0xA1607060, 0x5D4C, 0x467A, 0xB7,0x11, 0x2B,0x59,0xA6,0xF2,0x59,0x57);
@@ -110,75 +114,134 @@ HRESULT WINAPI DwmpActivateLivePreview_hook(
 
 DEFINE_GUID(GUID_AppUserModelIdProperty, 0x9F4C2855, 0x9F79, 0x4B39, 0xA8,0xD0, 0xE1,0xD4,0x2D,0xE1,0xD5,0xF3);
 
+/* Extracted UWP icons, keyed by "<size>|<AppUserModelID>". Alt+Tab gets a copy,
+   so the shell only has to extract each app's icon once. */
+std::mutex g_uwpIconCacheMutex;
+std::unordered_map<std::wstring, HICON> g_uwpIconCache;
+
+/* Apps that come and go over a long session shouldn't grow the cache forever */
+constexpr size_t c_cUwpIconCacheMax = 128;
+
+void ClearUWPIconCache(void)
+{
+    std::lock_guard<std::mutex> lock(g_uwpIconCacheMutex);
+    for (auto &entry : g_uwpIconCache)
+        DestroyIcon(entry.second);
+    g_uwpIconCache.clear();
+}
+
+bool GetWindowAppUserModelId(HWND hWnd, std::wstring &appUserModelId)
+{
+    IPropertyStore *pps = nullptr;
+    HRESULT hr = SHGetPropertyStoreForWindow(
+        hWnd, IID_PPV_ARGS(&pps)
+    );
+    if (FAILED(hr))
+        return false;
+
+    PROPERTYKEY pKey;
+    pKey.fmtid = GUID_AppUserModelIdProperty;
+    pKey.pid = 5;
+    PROPVARIANT prop;
+    PropVariantInit(&prop);
+    pps->GetValue(pKey, &prop);
+    pps->Release();
+
+    bool bFound = prop.vt == VT_LPWSTR && prop.pwszVal && *prop.pwszVal;
+    if (bFound)
+        appUserModelId = prop.pwszVal;
+    PropVariantClear(&prop);
+    return bFound;
+}
+
 /**
   * Implementation taken from Simple Window Switcher.
   * https://github.com/valinet/sws/blob/971a3f20262c065c3b001c1781b6d75f9083680e/SimpleWindowSwitcher/sws_IconPainter.c#L253
   */
-HICON GetUWPIcon(HWND hWnd)
+HICON CreateUWPIcon(LPCWSTR pszAppUserModelId, int szIcon)
 {
     HICON result = NULL;
-    HRESULT hr = S_OK;
     IShellItemImageFactory *psiif = nullptr;
     SIIGBF flags = SIIGBF_RESIZETOFIT | SIIGBF_ICONBACKGROUND;
 
-    IPropertyStore *pps = nullptr;
-    hr = SHGetPropertyStoreForWindow(
-        hWnd, IID_PPV_ARGS(&pps)
+    SHCreateItemInKnownFolder(
+        FOLDERID_AppsFolder,
+        KF_FLAG_DONT_VERIFY,
+        pszAppUserModelId,
+        IID_PPV_ARGS(&psiif)
     );
-    if (SUCCEEDED(hr))
+    if (psiif)
     {
-        PROPERTYKEY pKey;
-        pKey.fmtid = GUID_AppUserModelIdProperty;
-        pKey.pid = 5;
-        PROPVARIANT prop;
-        ZeroMemory(&prop, sizeof(PROPVARIANT));
-        pps->GetValue(pKey, &prop);
-        pps->Release();
-        if (prop.bstrVal)
+        SIZE size;
+        size.cx = szIcon;
+        size.cy = szIcon;
+        HBITMAP hBitmap;
+        HRESULT hr = psiif->GetImage(
+            size,
+            flags,
+            &hBitmap
+        );
+        if (SUCCEEDED(hr))
         {
-            SHCreateItemInKnownFolder(
-                FOLDERID_AppsFolder,
-                KF_FLAG_DONT_VERIFY,
-                prop.bstrVal,
-                IID_PPV_ARGS(&psiif)
-            );
-            if (psiif)
+            // Easiest way to get an HICON from an HBITMAP
+            // I have turned the Internet upside down and was unable to find this
+            // Only a convoluted example using GDI+
+            // This is from the disassembly of StartIsBack/StartAllBack
+            HIMAGELIST hImageList = ImageList_Create(size.cx, size.cy, ILC_COLOR32, 1, 0);
+            if (hImageList)
             {
-                int szIcon = GetSystemMetrics(SM_CXICON);
-
-                SIZE size;
-                size.cx = szIcon;
-                size.cy = szIcon;
-                HBITMAP hBitmap;
-                hr = psiif->GetImage(
-                    size,
-                    flags,
-                    &hBitmap
-                );
-                if (SUCCEEDED(hr))
+                if (ImageList_Add(hImageList, hBitmap, NULL) != -1)
                 {
-                    // Easiest way to get an HICON from an HBITMAP
-                    // I have turned the Internet upside down and was unable to find this
-                    // Only a convoluted example using GDI+
-                    // This is from the disassembly of StartIsBack/StartAllBack
-                    HIMAGELIST hImageList = ImageList_Create(size.cx, size.cy, ILC_COLOR32, 1, 0);
-                    if (ImageList_Add(hImageList, hBitmap, NULL) != -1)
-                    {
-                        result = ImageList_GetIcon(hImageList, 0, 0);
-                        ImageList_Destroy(hImageList);
-
-                        DeleteObject(hBitmap);
-                        psiif->Release();
-                    }
-                    DeleteObject(hBitmap);
+                    result = ImageList_GetIcon(hImageList, 0, 0);
                 }
-                psiif->Release();
+                ImageList_Destroy(hImageList);
             }
+            DeleteObject(hBitmap);
         }
+        psiif->Release();
     }
     return result;
 }
 
+/* Returns an icon owned by the caller */
+HICON GetUWPIcon(HWND hWnd)
+{
+    std::wstring appUserModelId;
+    if (!GetWindowAppUserModelId(hWnd, appUserModelId))
+        return NULL;
+
+    int szIcon = GetSystemMetrics(SM_CXICON);
+    std::wstring key = std::to_wstring(szIcon) + L"|" + appUserModelId;
+
+    {
+        std::lock_guard<std::mutex> lock(g_uwpIconCacheMutex);
+        auto it = g_uwpIconCache.find(key);
+        if (it != g_uwpIconCache.end())
+            return CopyIcon(it->second);
+    }
+
+    // Extract without holding the lock, this can take a while.
+    HICON hIcon = CreateUWPIcon(appUserModelId.c_str(), szIcon);
+    if (!hIcon)
+        return NULL;
+
+    std::lock_guard<std::mutex> lock(g_uwpIconCacheMutex);
+    if (g_uwpIconCache.size() >= c_cUwpIconCacheMax)
+    {
+        for (auto &entry : g_uwpIconCache)
+            DestroyIcon(entry.second);
+        g_uwpIconCache.clear();
+    }
+
+    auto inserted = g_uwpIconCache.insert({ key, hIcon });
+    if (!inserted.second)
+    {
+        // Another thread extracted it in the meantime.
+        DestroyIcon(hIcon);
+    }
+    return CopyIcon(inserted.first->second);
+}
+
 /* Support UWP icons */
 SENDASYNCPROC CWindowInfo__GetIconProc_orig;
 void WINAPI CWindowInfo__GetIconProc_hook(
@@ -355,6 +418,7 @@ BOOL Wh_ModInit(void)
 
 void Wh_ModUninit(void)
 {
+    ClearUWPIconCache();
     if (g_pAltTabSSO)
         g_pAltTabSSO->Release();
     if (g_hAltTab)
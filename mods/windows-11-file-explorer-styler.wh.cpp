@@ -2,7 +2,7 @@
 // @id              windows-11-file-explorer-styler
 // @name            Windows 11 File Explorer Styler
 // @description     Customize the File Explorer with themes contributed by others or create your own
-// @version         1.2.1
+// @version         1.2.3
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -759,6 +759,8 @@ HRESULT InjectWindhawkTAP() noexcept
 #include <windhawk_utils.h>
 
 #include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
@@ -1765,6 +1767,11 @@ std::optional<PropertyOverrideValue> ParseNonXamlPropertyOverrideValue(
     };
 }
 
+// Parsed styles by their full XAML source. Identical setters for the same
+// type are only parsed once per settings load, as XamlReader::Load is
+// relatively expensive.
+thread_local std::unordered_map<std::wstring, Style> g_xamlStyleCache;
+
 Style GetStyleFromXamlSetters(const std::wstring_view type,
                               const std::wstring_view xamlStyleSetters) {
     std::wstring xaml =
@@ -1800,6 +1807,12 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         L"    </Style>\n"
         L"</ResourceDictionary>";
 
+    if (auto it = g_xamlStyleCache.find(xaml); it != g_xamlStyleCache.end()) {
+        Wh_Log(L"Using cached style for %.*s", static_cast<int>(type.length()),
+               type.data());
+        return it->second;
+    }
+
     Wh_Log(L"======================================== XAML:");
     std::wstringstream ss(xaml);
     std::wstring line;
@@ -1812,7 +1825,9 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         Markup::XamlReader::Load(xaml).as<ResourceDictionary>();
 
     auto [styleKey, styleInspectable] = resourceDictionary.First().Current();
-    return styleInspectable.as<Style>();
+    auto style = styleInspectable.as<Style>();
+    g_xamlStyleCache.try_emplace(std::move(xaml), style);
+    return style;
 }
 
 const PropertyOverrides& GetResolvedPropertyOverrides(
@@ -2568,8 +2583,10 @@ std::wstring AdjustTypeName(std::wstring_view type) {
     return std::wstring{type};
 }
 
-void AddElementCustomizationRules(std::wstring_view target,
-                                  std::vector<std::wstring> styles) {
+void AddElementCustomizationRules(
+    std::vector<ElementCustomizationRules>& rules,
+    std::wstring_view target,
+    std::vector<std::wstring> styles) {
     ElementCustomizationRules elementCustomizationRules;
 
     auto targetParts = SplitStringView(target, L" > ");
@@ -2607,11 +2624,11 @@ void AddElementCustomizationRules(std::wstring_view target,
         first = false;
     }
 
-    g_elementsCustomizationRules.push_back(
-        std::move(elementCustomizationRules));
+    rules.push_back(std::move(elementCustomizationRules));
 }
 
 bool ProcessSingleTargetStylesFromSettings(
+    std::vector<ElementCustomizationRules>& rules,
     int index,
     const StyleConstants& styleConstants) {
     string_setting_unique_ptr targetStringSetting(
@@ -2646,14 +2663,16 @@ bool ProcessSingleTargetStylesFromSettings(
     }
 
     if (styles.size() > 0) {
-        AddElementCustomizationRules(targetStringSetting.get(),
+        AddElementCustomizationRules(rules, targetStringSetting.get(),
                                      std::move(styles));
     }
 
     return true;
 }
 
-void ProcessAllStylesFromSettings() {
+std::vector<ElementCustomizationRules> ProcessAllStylesFromSettings() {
+    std::vector<ElementCustomizationRules> rules;
+
     PCWSTR themeName = Wh_GetStringSetting(L"theme");
     const Theme* theme = nullptr;
     if (wcscmp(themeName, L"Minimal Explorer11") == 0) {
@@ -2681,7 +2700,7 @@ void ProcessAllStylesFromSettings() {
                     styles.push_back(ApplyStyleConstants(s, styleConstants));
                 }
 
-                AddElementCustomizationRules(themeTargetStyle.target,
+                AddElementCustomizationRules(rules, themeTargetStyle.target,
                                              std::move(styles));
             } catch (winrt::hresult_error const& ex) {
                 Wh_Log(L"Error %08X", ex.code());
@@ -2698,7 +2717,8 @@ void ProcessAllStylesFromSettings() {
 
     for (int i = 0;; i++) {
         try {
-            if (!ProcessSingleTargetStylesFromSettings(i, styleConstants)) {
+            if (!ProcessSingleTargetStylesFromSettings(rules, i,
+                                                       styleConstants)) {
                 break;
             }
         } catch (winrt::hresult_error const& ex) {
@@ -2707,18 +2727,98 @@ void ProcessAllStylesFromSettings() {
             Wh_Log(L"Error: %S", ex.what());
         }
     }
+
+    return rules;
 }
 
-bool ProcessSingleResourceVariableFromSettings(int index) {
-    string_setting_unique_ptr variableKeyStringSetting(
-        Wh_GetStringSetting(L"resourceVariables[%d].variableKey", index));
-    if (!*variableKeyStringSetting.get()) {
-        return false;
+struct ResourceVariableSetting {
+    std::wstring variableKey;
+    std::wstring value;
+};
+
+std::vector<ResourceVariableSetting> LoadResourceVariablesFromSettings() {
+    std::vector<ResourceVariableSetting> result;
+
+    for (int i = 0;; i++) {
+        string_setting_unique_ptr variableKeyStringSetting(
+            Wh_GetStringSetting(L"resourceVariables[%d].variableKey", i));
+        if (!*variableKeyStringSetting.get()) {
+            break;
+        }
+
+        string_setting_unique_ptr valueStringSetting(
+            Wh_GetStringSetting(L"resourceVariables[%d].value", i));
+
+        result.push_back({variableKeyStringSetting.get(),
+                          valueStringSetting.get()});
+    }
+
+    return result;
+}
+
+// The parsed (but unresolved) rules are shared by all File Explorer UI
+// threads, so that the theme and the settings are only parsed once per process
+// and not again for each new window thread. Only the XAML-dependent work is
+// done per thread.
+std::mutex g_parsedElementsCustomizationRulesMutex;
+std::shared_ptr<const std::vector<ElementCustomizationRules>>
+    g_parsedElementsCustomizationRules;
+std::shared_ptr<const std::vector<ResourceVariableSetting>>
+    g_parsedResourceVariables;
+
+void ParseStylesFromSettings() {
+    auto rules = std::make_shared<const std::vector<ElementCustomizationRules>>(
+        ProcessAllStylesFromSettings());
+    auto resourceVariables =
+        std::make_shared<const std::vector<ResourceVariableSetting>>(
+            LoadResourceVariablesFromSettings());
+
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    g_parsedElementsCustomizationRules = std::move(rules);
+    g_parsedResourceVariables = std::move(resourceVariables);
+}
+
+void FreeParsedStyles() {
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    g_parsedElementsCustomizationRules = nullptr;
+    g_parsedResourceVariables = nullptr;
+}
+
+std::shared_ptr<const std::vector<ElementCustomizationRules>>
+GetParsedStyles() {
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    if (!g_parsedElementsCustomizationRules) {
+        g_parsedElementsCustomizationRules =
+            std::make_shared<const std::vector<ElementCustomizationRules>>(
+                ProcessAllStylesFromSettings());
     }
 
-    Wh_Log(L"Processing resource variable %s", variableKeyStringSetting.get());
+    return g_parsedElementsCustomizationRules;
+}
+
+std::shared_ptr<const std::vector<ResourceVariableSetting>>
+GetParsedResourceVariables() {
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    if (!g_parsedResourceVariables) {
+        g_parsedResourceVariables =
+            std::make_shared<const std::vector<ResourceVariableSetting>>(
+                LoadResourceVariablesFromSettings());
+    }
+
+    return g_parsedResourceVariables;
+}
+
+void LoadStylesForCurrentThread() {
+    // Copy the rules, as the resolved XAML values are bound to the thread.
+    g_elementsCustomizationRules = *GetParsedStyles();
+}
+
+void ProcessSingleResourceVariable(
+    const ResourceVariableSetting& resourceVariable) {
+    Wh_Log(L"Processing resource variable %s",
+           resourceVariable.variableKey.c_str());
 
-    std::wstring_view variableKey = variableKeyStringSetting.get();
+    std::wstring_view variableKey = resourceVariable.variableKey;
 
     auto resources = Application::Current().Resources();
 
@@ -2737,24 +2837,19 @@ bool ProcessSingleResourceVariableFromSettings(int index) {
     auto resourceTypeName =
         winrt::Windows::UI::Xaml::Interop::TypeName{resourceClassName};
 
-    string_setting_unique_ptr valueStringSetting(
-        Wh_GetStringSetting(L"resourceVariables[%d].value", index));
-
-    std::wstring_view value = valueStringSetting.get();
+    std::wstring_view value = resourceVariable.value;
 
     resources.Insert(winrt::box_value(variableKey),
                      Markup::XamlBindingHelper::ConvertValue(
                          resourceTypeName, winrt::box_value(value)));
-
-    return true;
 }
 
 void ProcessResourceVariablesFromSettings() {
-    for (int i = 0;; i++) {
+    auto resourceVariables = GetParsedResourceVariables();
+
+    for (const auto& resourceVariable : *resourceVariables) {
         try {
-            if (!ProcessSingleResourceVariableFromSettings(i)) {
-                break;
-            }
+            ProcessSingleResourceVariable(resourceVariable);
         } catch (winrt::hresult_error const& ex) {
             Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
         } catch (std::exception const& ex) {
@@ -2778,6 +2873,7 @@ void UninitializeForCurrentThread() {
     g_elementsCustomizationState.clear();
 
     g_elementsCustomizationRules.clear();
+    g_xamlStyleCache.clear();
 
     g_initializedForThread = false;
 }
@@ -2796,7 +2892,7 @@ void InitializeForCurrentThread() {
         return;
     }
 
-    ProcessAllStylesFromSettings();
+    LoadStylesForCurrentThread();
     ProcessResourceVariablesFromSettings();
 
     g_initializedForThread = true;
@@ -3237,6 +3333,8 @@ BOOL Wh_ModInit() {
 void Wh_ModAfterInit() {
     Wh_Log(L">");
 
+    ParseStylesFromSettings();
+
     auto hTargetWnds = GetTargetWnds();
     for (auto hTargetWnd : hTargetWnds) {
         Wh_Log(L"Initializing for %08X", (DWORD)(ULONG_PTR)hTargetWnd);
@@ -3263,6 +3361,8 @@ void Wh_ModUninit() {
         RunFromWindowThread(
             hTargetWnd, [](PVOID) { UninitializeForCurrentThread(); }, nullptr);
     }
+
+    FreeParsedStyles();
 }
 
 void Wh_ModSettingsChanged() {
@@ -3270,6 +3370,8 @@ void Wh_ModSettingsChanged() {
 
     UninitializeSettingsAndTap();
 
+    ParseStylesFromSettings();
+
     auto hTargetWnds = GetTargetWnds();
     for (auto hTargetWnd : hTargetWnds) {
         Wh_Log(L"Reinitializing for %08X", (DWORD)(ULONG_PTR)hTargetWnd);
@@ -2,7 +2,7 @@
 // @id              windows-11-notification-center-styler
 // @name            Windows 11 Notification Center Styler
 // @description     Customize the Notification Center and Action Center with themes contributed by others or create your own
-// @version         1.3.2
+// @version         1.3.4
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -1055,6 +1055,8 @@ HRESULT InjectWindhawkTAP() noexcept
 // clang-format on
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <functional>
 #include <list>
 #include <optional>
 #include <sstream>
@@ -1150,6 +1152,28 @@ struct ElementCustomizationRules {
 thread_local std::vector<ElementCustomizationRules>
     g_elementsCustomizationRules;
 
+struct StringViewHash {
+    using is_transparent = void;
+    size_t operator()(std::wstring_view s) const noexcept {
+        return std::hash<std::wstring_view>{}(s);
+    }
+};
+
+// Element type -> element name -> indices in g_elementsCustomizationRules. An
+// empty name is used for rules that don't match by name. Used to only test
+// rules that can possibly match a newly added element, since the whole tree is
+// added every time a flyout is opened.
+using ElementCustomizationRulesIndexForType =
+    std::unordered_map<std::wstring,
+                       std::vector<size_t>,
+                       StringViewHash,
+                       std::equal_to<>>;
+thread_local std::unordered_map<std::wstring,
+                                ElementCustomizationRulesIndexForType,
+                                StringViewHash,
+                                std::equal_to<>>
+    g_elementsCustomizationRulesIndex;
+
 struct ElementPropertyCustomizationState {
     std::optional<winrt::Windows::Foundation::IInspectable> originalValue;
     std::optional<PropertyOverrideValue> customValue;
@@ -2082,6 +2106,11 @@ std::optional<PropertyOverrideValue> ParseNonXamlPropertyOverrideValue(
     };
 }
 
+// Parsed styles by their full XAML source. Identical setters for the same
+// type are only parsed once per settings load, as XamlReader::Load is
+// relatively expensive.
+thread_local std::unordered_map<std::wstring, Style> g_xamlStyleCache;
+
 Style GetStyleFromXamlSetters(const std::wstring_view type,
                               const std::wstring_view xamlStyleSetters) {
     std::wstring xaml =
@@ -2117,6 +2146,12 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         L"    </Style>\n"
         L"</ResourceDictionary>";
 
+    if (auto it = g_xamlStyleCache.find(xaml); it != g_xamlStyleCache.end()) {
+        Wh_Log(L"Using cached style for %.*s", static_cast<int>(type.length()),
+               type.data());
+        return it->second;
+    }
+
     Wh_Log(L"======================================== XAML:");
     std::wstringstream ss(xaml);
     std::wstring line;
@@ -2129,7 +2164,9 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         Markup::XamlReader::Load(xaml).as<ResourceDictionary>();
 
     auto [styleKey, styleInspectable] = resourceDictionary.First().Current();
-    return styleInspectable.as<Style>();
+    auto style = styleInspectable.as<Style>();
+    g_xamlStyleCache.try_emplace(std::move(xaml), style);
+    return style;
 }
 
 Style GetStyleFromXamlSettersWithFallbackType(
@@ -2388,15 +2425,75 @@ bool TestElementMatcher(FrameworkElement element,
     return true;
 }
 
+// Returns the indices of the rules which can match the element according to
+// their type and name, in descending order (the order in which rules are
+// applied). The element name is only queried if a rule for its type needs it.
+std::vector<size_t> GetCandidateElementCustomizationRules(
+    FrameworkElement element,
+    PCWSTR fallbackClassName) {
+    std::vector<size_t> candidates;
+
+    std::optional<winrt::hstring> name;
+
+    auto addCandidatesForType = [&](std::wstring_view type) {
+        auto typeIt = g_elementsCustomizationRulesIndex.find(type);
+        if (typeIt == g_elementsCustomizationRulesIndex.end()) {
+            return;
+        }
+
+        const auto& indexForType = typeIt->second;
+
+        size_t unnamedCount = 0;
+        if (auto it = indexForType.find(std::wstring_view{});
+            it != indexForType.end()) {
+            candidates.insert(candidates.end(), it->second.begin(),
+                              it->second.end());
+            unnamedCount = 1;
+        }
+
+        if (indexForType.size() > unnamedCount) {
+            if (!name) {
+                name = element.Name();
+            }
+
+            if (!name->empty()) {
+                if (auto it = indexForType.find(std::wstring_view{*name});
+                    it != indexForType.end()) {
+                    candidates.insert(candidates.end(), it->second.begin(),
+                                      it->second.end());
+                }
+            }
+        }
+    };
+
+    auto className = winrt::get_class_name(element);
+    addCandidatesForType(className);
+    if (fallbackClassName && className != fallbackClassName) {
+        addCandidatesForType(fallbackClassName);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), std::greater<>{});
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+
+    return candidates;
+}
+
 std::unordered_map<VisualStateGroup, PropertyOverrides>
 FindElementPropertyOverrides(FrameworkElement element,
                              PCWSTR fallbackClassName) {
     std::unordered_map<VisualStateGroup, PropertyOverrides> overrides;
+
+    auto candidates =
+        GetCandidateElementCustomizationRules(element, fallbackClassName);
+    if (candidates.empty()) {
+        return overrides;
+    }
+
     std::unordered_set<DependencyProperty> propertiesAdded;
 
-    for (auto it = g_elementsCustomizationRules.rbegin();
-         it != g_elementsCustomizationRules.rend(); ++it) {
-        auto& override = *it;
+    for (size_t index : candidates) {
+        auto& override = g_elementsCustomizationRules[index];
 
         VisualStateGroup visualStateGroup = nullptr;
 
@@ -2961,6 +3058,10 @@ void AddElementCustomizationRules(std::wstring_view target,
         first = false;
     }
 
+    const auto& elementMatcher = elementCustomizationRules.elementMatcher;
+    g_elementsCustomizationRulesIndex[elementMatcher.type][elementMatcher.name]
+        .push_back(g_elementsCustomizationRules.size());
+
     g_elementsCustomizationRules.push_back(
         std::move(elementCustomizationRules));
 }
@@ -3124,6 +3225,8 @@ void UninitializeForCurrentThread() {
     g_elementsCustomizationState.clear();
 
     g_elementsCustomizationRules.clear();
+    g_elementsCustomizationRulesIndex.clear();
+    g_xamlStyleCache.clear();
 
     g_initializedForThread = false;
 }
@@ -2,7 +2,7 @@
 // @id              windows-11-start-menu-styler
 // @name            Windows 11 Start Menu Styler
 // @description     Customize the start menu with themes contributed by others or create your own
-// @version         1.3.1
+// @version         1.3.6
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -2742,6 +2742,12 @@ void ApplyCustomizations(InstanceHandle handle,
                          winrt::Windows::UI::Xaml::FrameworkElement element,
                          PCWSTR fallbackClassName);
 void CleanupCustomizations(InstanceHandle handle);
+void PruneElementsNotReportedSinceAdvise();
+
+// Set once AdviseVisualTreeChange returns, by which time all existing elements
+// were reported. Elements which weren't reported were removed while the watcher
+// wasn't advised, and are pruned on the next visual tree change.
+std::atomic<bool> g_pruneElementsPending;
 
 HMODULE GetCurrentModuleHandle() {
     HMODULE module;
@@ -2830,6 +2836,8 @@ VisualTreeWatcher::VisualTreeWatcher(winrt::com_ptr<IUnknown> site) :
             watcher->Release();
             if (FAILED(hr)) {
                 Wh_Log(L"Error %08X", hr);
+            } else {
+                g_pruneElementsPending = true;
             }
             return 0;
         },
@@ -2858,6 +2866,11 @@ HRESULT VisualTreeWatcher::OnVisualTreeChange(ParentChildRelation, VisualElement
         return S_OK;
     }
 
+    if (g_pruneElementsPending.exchange(false))
+    {
+        PruneElementsNotReportedSinceAdvise();
+    }
+
     Wh_Log(L"========================================");
 
     switch (mutationType)
@@ -3201,10 +3214,24 @@ struct ElementCustomizationRules {
     ElementMatcher elementMatcher;
     std::vector<ElementMatcher> parentElementMatchers;
     PropertyOverridesMaybeUnresolved propertyOverrides;
+    // The target and styles the rules were created from, used to find the
+    // rules that were changed when settings are reloaded.
+    std::wstring source;
+    // The settings generation in which the rules were added.
+    uint32_t generation = 0;
 };
 
 std::vector<ElementCustomizationRules> g_elementsCustomizationRules;
 
+// Incremented each time the settings are (re)loaded.
+uint32_t g_rulesGeneration;
+
+// The rules generation in which each element in the visual tree was last
+// evaluated. When the TAP is re-injected after a settings change, all existing
+// elements are reported again, and only rules which were added since can
+// change the result for elements which weren't affected by removed rules.
+std::unordered_map<InstanceHandle, uint32_t> g_elementsEvaluatedGeneration;
+
 struct ElementPropertyCustomizationState {
     std::optional<winrt::Windows::Foundation::IInspectable> originalValue;
     std::optional<PropertyOverrideValue> customValue;
@@ -3220,6 +3247,9 @@ struct ElementCustomizationStateForVisualStateGroup {
 struct ElementCustomizationState {
     winrt::weak_ref<FrameworkElement> element;
 
+    // Indices in g_elementsCustomizationRules of the rules that matched.
+    std::vector<size_t> ruleIndices;
+
     // Use list to avoid reallocations on insertion, as pointers to items are
     // captured in callbacks and stored.
     std::list<std::pair<std::optional<winrt::weak_ref<VisualStateGroup>>,
@@ -3233,6 +3263,10 @@ std::unordered_map<InstanceHandle, ElementCustomizationState>
 std::wstring g_webContentCss;
 std::wstring g_webContentJs;
 
+// Built once from the above on first use, since it's executed on every
+// navigation of every WebView.
+std::wstring g_webViewJsCodeForApply;
+
 struct WebViewCustomizationState {
     winrt::weak_ref<FrameworkElement> element;
     bool isWebView2 = false;
@@ -4173,6 +4207,11 @@ std::optional<PropertyOverrideValue> ParseNonXamlPropertyOverrideValue(
     };
 }
 
+// Parsed styles by their full XAML source. Identical setters for the same
+// type are only parsed once per settings load, as XamlReader::Load is
+// relatively expensive.
+std::unordered_map<std::wstring, Style> g_xamlStyleCache;
+
 Style GetStyleFromXamlSetters(const std::wstring_view type,
                               const std::wstring_view xamlStyleSetters) {
     std::wstring xaml =
@@ -4208,6 +4247,12 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         L"    </Style>\n"
         L"</ResourceDictionary>";
 
+    if (auto it = g_xamlStyleCache.find(xaml); it != g_xamlStyleCache.end()) {
+        Wh_Log(L"Using cached style for %.*s", static_cast<int>(type.length()),
+               type.data());
+        return it->second;
+    }
+
     Wh_Log(L"======================================== XAML:");
     std::wstringstream ss(xaml);
     std::wstring line;
@@ -4220,7 +4265,9 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         Markup::XamlReader::Load(xaml).as<ResourceDictionary>();
 
     auto [styleKey, styleInspectable] = resourceDictionary.First().Current();
-    return styleInspectable.as<Style>();
+    auto style = styleInspectable.as<Style>();
+    g_xamlStyleCache.try_emplace(std::move(xaml), style);
+    return style;
 }
 
 Style GetStyleFromXamlSettersWithFallbackType(
@@ -4375,6 +4422,56 @@ const PropertyValues& GetResolvedPropertyValues(
     return std::get<PropertyValues>(*propertyValuesMaybeUnresolved);
 }
 
+// Resolves the styles of the rules ahead of time, so that the XAML isn't
+// parsed while the start menu opens and its elements are reported one by one.
+// Only rules with an explicit type can be resolved without an element. If
+// resolving fails, the rule is left unresolved, to be resolved when an element
+// matches, with the element's class as the fallback type.
+void PreResolveElementsCustomizationRules() {
+    auto preResolveMatcher = [](ElementMatcher& matcher) {
+        const auto* unresolved =
+            std::get_if<PropertyValuesUnresolved>(&matcher.propertyValues);
+        if (matcher.type.empty() || !unresolved || unresolved->empty()) {
+            return;
+        }
+
+        PropertyValuesMaybeUnresolved propertyValues = *unresolved;
+        if (!GetResolvedPropertyValues(matcher.type, matcher.type,
+                                       &propertyValues)
+                 .empty()) {
+            matcher.propertyValues = std::move(propertyValues);
+        }
+    };
+
+    size_t resolvedCount = 0;
+
+    for (auto& rule : g_elementsCustomizationRules) {
+        preResolveMatcher(rule.elementMatcher);
+        for (auto& matcher : rule.parentElementMatchers) {
+            preResolveMatcher(matcher);
+        }
+
+        const auto* unresolved =
+            std::get_if<PropertyOverridesUnresolved>(&rule.propertyOverrides);
+        if (rule.elementMatcher.type.empty() || !unresolved ||
+            unresolved->empty()) {
+            continue;
+        }
+
+        PropertyOverridesMaybeUnresolved propertyOverrides = *unresolved;
+        if (!GetResolvedPropertyOverrides(rule.elementMatcher.type,
+                                          rule.elementMatcher.type,
+                                          &propertyOverrides)
+                 .empty()) {
+            rule.propertyOverrides = std::move(propertyOverrides);
+            resolvedCount++;
+        }
+    }
+
+    Wh_Log(L"Resolved %zu of %zu rules ahead of time", resolvedCount,
+           g_elementsCustomizationRules.size());
+}
+
 // https://stackoverflow.com/a/12835139
 VisualStateGroup GetVisualStateGroup(FrameworkElement element,
                                      std::wstring_view visualStateGroupName) {
@@ -4479,47 +4576,74 @@ bool TestElementMatcher(FrameworkElement element,
     return true;
 }
 
-std::unordered_map<VisualStateGroup, PropertyOverrides>
-FindElementPropertyOverrides(FrameworkElement element,
-                             PCWSTR fallbackClassName) {
-    std::unordered_map<VisualStateGroup, PropertyOverrides> overrides;
-    std::unordered_set<DependencyProperty> propertiesAdded;
+bool TestElementCustomizationRules(FrameworkElement element,
+                                   ElementCustomizationRules& override,
+                                   VisualStateGroup* visualStateGroup,
+                                   PCWSTR fallbackClassName) {
+    if (!TestElementMatcher(element, override.elementMatcher, visualStateGroup,
+                            fallbackClassName)) {
+        return false;
+    }
 
-    for (auto it = g_elementsCustomizationRules.rbegin();
-         it != g_elementsCustomizationRules.rend(); ++it) {
-        auto& override = *it;
+    auto parentElementIter = element;
 
-        VisualStateGroup visualStateGroup = nullptr;
+    for (auto& matcher : override.parentElementMatchers) {
+        // Using parentElementIter.Parent() was sometimes returning null.
+        parentElementIter =
+            Media::VisualTreeHelper::GetParent(parentElementIter)
+                .try_as<FrameworkElement>();
+        if (!parentElementIter) {
+            return false;
+        }
 
-        if (!TestElementMatcher(element, override.elementMatcher,
-                                &visualStateGroup, fallbackClassName)) {
-            continue;
+        if (!TestElementMatcher(parentElementIter, matcher, visualStateGroup,
+                                nullptr)) {
+            return false;
         }
+    }
 
-        auto parentElementIter = element;
-        bool parentElementMatchFailed = false;
+    return true;
+}
 
-        for (auto& matcher : override.parentElementMatchers) {
-            // Using parentElementIter.Parent() was sometimes returning null.
-            parentElementIter =
-                Media::VisualTreeHelper::GetParent(parentElementIter)
-                    .try_as<FrameworkElement>();
-            if (!parentElementIter) {
-                parentElementMatchFailed = true;
-                break;
-            }
+// Returns whether any of the rules added after the given generation match the
+// element.
+bool TestElementCustomizationRulesSinceGeneration(FrameworkElement element,
+                                                  PCWSTR fallbackClassName,
+                                                  uint32_t generation) {
+    for (auto& override : g_elementsCustomizationRules) {
+        if (override.generation <= generation) {
+            continue;
+        }
 
-            if (!TestElementMatcher(parentElementIter, matcher,
-                                    &visualStateGroup, nullptr)) {
-                parentElementMatchFailed = true;
-                break;
-            }
+        if (TestElementCustomizationRules(element, override, nullptr,
+                                          fallbackClassName)) {
+            return true;
         }
+    }
+
+    return false;
+}
+
+std::unordered_map<VisualStateGroup, PropertyOverrides>
+FindElementPropertyOverrides(FrameworkElement element,
+                             PCWSTR fallbackClassName,
+                             std::vector<size_t>* matchedRuleIndices) {
+    std::unordered_map<VisualStateGroup, PropertyOverrides> overrides;
+    std::unordered_set<DependencyProperty> propertiesAdded;
 
-        if (parentElementMatchFailed) {
+    for (size_t i = g_elementsCustomizationRules.size(); i-- > 0;) {
+        auto& override = g_elementsCustomizationRules[i];
+
+        VisualStateGroup visualStateGroup = nullptr;
+
+        if (!TestElementCustomizationRules(element, override,
+                                           &visualStateGroup,
+                                           fallbackClassName)) {
             continue;
         }
 
+        matchedRuleIndices->push_back(i);
+
         auto& overridesForVisualStateGroup = overrides[visualStateGroup];
         for (const auto& [property, valuesPerVisualState] :
              GetResolvedPropertyOverrides(
@@ -4798,7 +4922,10 @@ std::wstring EscapeJsTemplateString(std::wstring_view str) {
     return buffer;
 }
 
-std::wstring CreateWebViewJsCodeForApply() {
+// Creates the style element, or updates its content in place if it already
+// exists. The custom JS can be appended, it runs in the same scope and can use
+// `styleElementId` and `styleContent`.
+std::wstring CreateWebViewJsCodeForStyle(std::wstring_view customJs = {}) {
     std::wstring jsCode =
         LR"(
         (() => {
@@ -4811,7 +4938,12 @@ std::wstring CreateWebViewJsCodeForApply() {
     jsCode +=
         LR"(
         `;
-        if (!document.getElementById(styleElementId)) {
+        const existingStyle = document.getElementById(styleElementId);
+        if (existingStyle) {
+            if (existingStyle.textContent !== styleContent) {
+                existingStyle.textContent = styleContent;
+            }
+        } else {
             const style = document.createElement("style");
             style.id = styleElementId;
             style.textContent = styleContent;
@@ -4819,22 +4951,37 @@ std::wstring CreateWebViewJsCodeForApply() {
         }
     )";
 
-    jsCode += g_webContentJs;
+    jsCode += customJs;
 
     jsCode +=
         LR"(
         })();
     )";
 
+    return jsCode;
+}
+
+void LogWebViewJsCode(std::wstring_view jsCode) {
     Wh_Log(L"======================================== JS:");
-    std::wstringstream ss(jsCode);
+    std::wstringstream ss{std::wstring{jsCode}};
     std::wstring line;
     while (std::getline(ss, line, L'\n')) {
         Wh_Log(L"%s", line.c_str());
     }
     Wh_Log(L"========================================");
+}
 
-    return jsCode;
+const std::wstring& GetWebViewJsCodeForApply() {
+    if (!g_webViewJsCodeForApply.empty()) {
+        return g_webViewJsCodeForApply;
+    }
+
+    std::wstring jsCode = CreateWebViewJsCodeForStyle(g_webContentJs);
+
+    LogWebViewJsCode(jsCode);
+
+    g_webViewJsCodeForApply = std::move(jsCode);
+    return g_webViewJsCodeForApply;
 }
 
 bool ApplyWebViewStyleCustomizations(Controls::WebView webViewElement) {
@@ -4860,7 +5007,7 @@ bool ApplyWebViewStyleCustomizations(Controls::WebView webViewElement) {
         return false;
     }
 
-    std::wstring jsCode = CreateWebViewJsCodeForApply();
+    const std::wstring& jsCode = GetWebViewJsCodeForApply();
 
     webViewElement.InvokeScriptAsync(
         L"eval", winrt::single_threaded_vector<winrt::hstring>(
@@ -4889,7 +5036,7 @@ bool ApplyWebView2StyleCustomizations(
         return false;
     }
 
-    std::wstring jsCode = CreateWebViewJsCodeForApply();
+    const std::wstring& jsCode = GetWebViewJsCodeForApply();
 
     void* operationPtr;
     auto jsCodeHstring = winrt::hstring(jsCode.c_str(), jsCode.size());
@@ -5048,6 +5195,40 @@ void ClearWebViewCustomizations(
     }
 }
 
+// Updates the style of an already customized WebView in place, used when only
+// the styles change.
+void UpdateWebViewStyleCustomizations(
+    const WebViewCustomizationState& webViewCustomizationState,
+    const std::wstring& jsCode) {
+    auto element = webViewCustomizationState.element.get();
+    if (!element) {
+        return;
+    }
+
+    auto jsCodeHstring = winrt::hstring(jsCode.c_str(), jsCode.size());
+
+    if (!webViewCustomizationState.isWebView2) {
+        auto webViewElement = element.as<Controls::WebView>();
+
+        webViewElement.InvokeScriptAsync(
+            L"eval",
+            winrt::single_threaded_vector<winrt::hstring>({jsCodeHstring}));
+    } else {
+        winrt::com_ptr<WebView2Standalone_IWebView2> webViewElement;
+        winrt::check_hresult(
+            ((IUnknown*)winrt::get_abi(element))
+                ->QueryInterface(IID_WebView2Standalone_IWebView2,
+                                 webViewElement.put_void()));
+
+        void* operationPtr;
+        winrt::check_hresult(webViewElement->ExecuteScriptAsync(
+            *(void**)(&jsCodeHstring), &operationPtr));
+        auto operation =
+            winrt::Windows::Foundation::IAsyncOperation<winrt::hstring>{
+                operationPtr, winrt::take_ownership_from_abi};
+    }
+}
+
 void ApplyCustomizations(InstanceHandle handle,
                          FrameworkElement element,
                          PCWSTR fallbackClassName) {
@@ -5059,8 +5240,37 @@ void ApplyCustomizations(InstanceHandle handle,
         }
     }
 
-    auto overrides = FindElementPropertyOverrides(element, fallbackClassName);
+    auto [evaluatedGenerationIt, firstEvaluation] =
+        g_elementsEvaluatedGeneration.try_emplace(handle, g_rulesGeneration);
+    if (!firstEvaluation) {
+        uint32_t evaluatedGeneration = evaluatedGenerationIt->second;
+        evaluatedGenerationIt->second = g_rulesGeneration;
+
+        // The element was already evaluated with an older set of rules which
+        // is still valid for it, only re-evaluate it if one of the new rules
+        // matches.
+        if (evaluatedGeneration < g_rulesGeneration &&
+            !TestElementCustomizationRulesSinceGeneration(
+                element, fallbackClassName, evaluatedGeneration)) {
+            return;
+        }
+    }
+
+    std::vector<size_t> matchedRuleIndices;
+    auto overrides = FindElementPropertyOverrides(element, fallbackClassName,
+                                                  &matchedRuleIndices);
     if (overrides.empty()) {
+        if (auto it = g_elementsCustomizationState.find(handle);
+            it != g_elementsCustomizationState.end()) {
+            for (const auto& [visualStateGroupOptionalWeakPtrIter, stateIter] :
+                 it->second.perVisualStateGroup) {
+                RestoreCustomizationsForVisualStateGroup(
+                    element, visualStateGroupOptionalWeakPtrIter, stateIter);
+            }
+
+            g_elementsCustomizationState.erase(it);
+        }
+
         return;
     }
 
@@ -5075,6 +5285,7 @@ void ApplyCustomizations(InstanceHandle handle,
     }
 
     elementCustomizationState.element = element;
+    elementCustomizationState.ruleIndices = std::move(matchedRuleIndices);
     elementCustomizationState.perVisualStateGroup.clear();
 
     for (auto& [visualStateGroup, overridesForVisualStateGroup] : overrides) {
@@ -5095,7 +5306,32 @@ void ApplyCustomizations(InstanceHandle handle,
     }
 }
 
+void PruneElementsNotReportedSinceAdvise() {
+    // All existing elements are reported again when the watcher is advised,
+    // which updates their evaluated generation to the current one.
+    std::vector<InstanceHandle> removedHandles;
+    for (const auto& [handle, evaluatedGeneration] :
+         g_elementsEvaluatedGeneration) {
+        if (evaluatedGeneration != g_rulesGeneration) {
+            removedHandles.push_back(handle);
+        }
+    }
+
+    if (removedHandles.empty()) {
+        return;
+    }
+
+    Wh_Log(L"Pruning %zu elements removed while not watching",
+           removedHandles.size());
+
+    for (auto handle : removedHandles) {
+        CleanupCustomizations(handle);
+    }
+}
+
 void CleanupCustomizations(InstanceHandle handle) {
+    g_elementsEvaluatedGeneration.erase(handle);
+
     if (auto it = g_elementsCustomizationState.find(handle);
         it != g_elementsCustomizationState.end()) {
         auto& elementCustomizationState = it->second;
@@ -5360,6 +5596,14 @@ void AddElementCustomizationRules(std::wstring_view target,
                                   std::vector<std::wstring> styles) {
     ElementCustomizationRules elementCustomizationRules;
 
+    elementCustomizationRules.source = target;
+    for (const auto& style : styles) {
+        elementCustomizationRules.source += L'\n';
+        elementCustomizationRules.source += style;
+    }
+
+    elementCustomizationRules.generation = g_rulesGeneration;
+
     auto targetParts = SplitStringView(target, L" > ");
 
     bool first = true;
@@ -5492,6 +5736,7 @@ void ProcessWebStylesFromSettings(
         webContentCss += L"}\n";
     }
 
+    g_webViewJsCodeForApply.clear();
     g_webContentCss = std::move(webContentCss);
     g_webContentJs =
         string_setting_unique_ptr(Wh_GetStringSetting(L"webContentCustomJs"))
@@ -5589,18 +5834,52 @@ void ProcessAllStylesFromSettings() {
     }
 }
 
-bool ProcessSingleResourceVariableFromSettings(int index) {
-    string_setting_unique_ptr variableKeyStringSetting(
-        Wh_GetStringSetting(L"resourceVariables[%d].variableKey", index));
-    if (!*variableKeyStringSetting.get()) {
-        return false;
+using ResourceVariables = std::vector<std::pair<std::wstring, std::wstring>>;
+
+ResourceVariables g_resourceVariables;
+
+// The resource variables which are currently applied, with the original values
+// of the resources. Writing a resource is not free, so on settings changes
+// only the variables whose values changed are written, and the resources of
+// removed variables are restored.
+struct AppliedResourceVariable {
+    std::wstring value;
+    winrt::Windows::Foundation::IInspectable originalValue;
+};
+
+std::unordered_map<std::wstring, AppliedResourceVariable>
+    g_appliedResourceVariables;
+
+ResourceVariables LoadResourceVariablesFromSettings() {
+    ResourceVariables result;
+
+    for (int i = 0;; i++) {
+        string_setting_unique_ptr variableKeyStringSetting(
+            Wh_GetStringSetting(L"resourceVariables[%d].variableKey", i));
+        if (!*variableKeyStringSetting.get()) {
+            break;
+        }
+
+        string_setting_unique_ptr valueStringSetting(
+            Wh_GetStringSetting(L"resourceVariables[%d].value", i));
+
+        result.push_back(
+            {variableKeyStringSetting.get(), valueStringSetting.get()});
     }
 
-    Wh_Log(L"Processing resource variable %s", variableKeyStringSetting.get());
+    return result;
+}
 
-    std::wstring_view variableKey = variableKeyStringSetting.get();
+void ProcessSingleResourceVariable(ResourceDictionary resources,
+                                   const std::wstring& variableKey,
+                                   const std::wstring& value) {
+    auto appliedIt = g_appliedResourceVariables.find(variableKey);
+    if (appliedIt != g_appliedResourceVariables.end() &&
+        appliedIt->second.value == value) {
+        return;
+    }
 
-    auto resources = Application::Current().Resources();
+    Wh_Log(L"Processing resource variable %s", variableKey.c_str());
 
     auto resource = resources.Lookup(winrt::box_value(variableKey));
 
@@ -5616,24 +5895,68 @@ bool ProcessSingleResourceVariableFromSettings(int index) {
 
     auto resourceTypeName = Interop::TypeName{resourceClassName};
 
-    string_setting_unique_ptr valueStringSetting(
-        Wh_GetStringSetting(L"resourceVariables[%d].value", index));
-
-    std::wstring_view value = valueStringSetting.get();
-
     resources.Insert(winrt::box_value(variableKey),
                      Markup::XamlBindingHelper::ConvertValue(
                          resourceTypeName, winrt::box_value(value)));
 
-    return true;
+    if (appliedIt != g_appliedResourceVariables.end()) {
+        appliedIt->second.value = value;
+    } else {
+        g_appliedResourceVariables.try_emplace(
+            variableKey, AppliedResourceVariable{value, resource});
+    }
+}
+
+// Restores the resources of the applied variables which aren't in `keep`.
+void RestoreResourceVariables(const ResourceVariables& keep) {
+    if (g_appliedResourceVariables.empty()) {
+        return;
+    }
+
+    ResourceDictionary resources = nullptr;
+    try {
+        resources = Application::Current().Resources();
+    } catch (winrt::hresult_error const& ex) {
+        Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
+        g_appliedResourceVariables.clear();
+        return;
+    }
+
+    for (auto it = g_appliedResourceVariables.begin();
+         it != g_appliedResourceVariables.end();) {
+        const auto& [variableKey, appliedResourceVariable] = *it;
+
+        bool kept = std::any_of(keep.begin(), keep.end(),
+                                [&variableKey](const auto& item) {
+                                    return item.first == variableKey;
+                                });
+        if (kept) {
+            ++it;
+            continue;
+        }
+
+        Wh_Log(L"Restoring resource variable %s", variableKey.c_str());
+
+        try {
+            resources.Insert(winrt::box_value(variableKey),
+                             appliedResourceVariable.originalValue);
+        } catch (winrt::hresult_error const& ex) {
+            Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
+        }
+
+        it = g_appliedResourceVariables.erase(it);
+    }
 }
 
 void ProcessResourceVariablesFromSettings() {
-    for (int i = 0;; i++) {
+    g_resourceVariables = LoadResourceVariablesFromSettings();
+
+    RestoreResourceVariables(g_resourceVariables);
+
+    for (const auto& [variableKey, value] : g_resourceVariables) {
         try {
-            if (!ProcessSingleResourceVariableFromSettings(i)) {
-                break;
-            }
+            ProcessSingleResourceVariable(Application::Current().Resources(),
+                                          variableKey, value);
         } catch (winrt::hresult_error const& ex) {
             Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
         } catch (std::exception const& ex) {
@@ -5642,6 +5965,19 @@ void ProcessResourceVariablesFromSettings() {
     }
 }
 
+void ClearWebViewsCustomizationState() {
+    for (const auto& [handle, webViewCustomizationState] :
+         g_webViewsCustomizationState) {
+        try {
+            ClearWebViewCustomizations(webViewCustomizationState);
+        } catch (winrt::hresult_error const& ex) {
+            Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
+        }
+    }
+
+    g_webViewsCustomizationState.clear();
+}
+
 void UninitializeSettingsAndTap() {
     if (g_delayedAllAppsRootVisibilitySet) {
         g_delayedAllAppsRootVisibilitySet.Cancel();
@@ -5660,19 +5996,12 @@ void UninitializeSettingsAndTap() {
     }
 
     g_elementsCustomizationState.clear();
+    g_elementsEvaluatedGeneration.clear();
 
     g_elementsCustomizationRules.clear();
+    g_xamlStyleCache.clear();
 
-    for (const auto& [handle, webViewCustomizationState] :
-         g_webViewsCustomizationState) {
-        try {
-            ClearWebViewCustomizations(webViewCustomizationState);
-        } catch (winrt::hresult_error const& ex) {
-            Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
-        }
-    }
-
-    g_webViewsCustomizationState.clear();
+    ClearWebViewsCustomizationState();
 
     g_targetThreadId = 0;
 }
@@ -5684,8 +6013,154 @@ void InitializeSettingsAndTap() {
         return;
     }
 
+    g_rulesGeneration++;
+
     ProcessAllStylesFromSettings();
     ProcessResourceVariablesFromSettings();
+    PreResolveElementsCustomizationRules();
+
+    HRESULT hr = InjectWindhawkTAP();
+    if (FAILED(hr)) {
+        Wh_Log(L"Error %08X", hr);
+    }
+}
+
+// Reloads the settings, keeping customizations which aren't affected by the
+// changes in place. Must be called after the TAP was uninitialized, all
+// elements will be re-evaluated as they're reported again by the TAP.
+void ReinitializeSettingsAndTap() {
+    if (g_targetThreadId != GetCurrentThreadId() ||
+        LoadResourceVariablesFromSettings() != g_resourceVariables) {
+        // Resource variables can affect any of the parsed values.
+        UninitializeSettingsAndTap();
+        InitializeSettingsAndTap();
+        return;
+    }
+
+    auto oldRules = std::move(g_elementsCustomizationRules);
+    g_elementsCustomizationRules.clear();
+
+    auto oldWebContentCss = std::move(g_webContentCss);
+    auto oldWebContentJs = std::move(g_webContentJs);
+    g_webContentCss.clear();
+    g_webContentJs.clear();
+    g_webViewJsCodeForApply.clear();
+
+    g_rulesGeneration++;
+
+    ProcessAllStylesFromSettings();
+
+    // Match unchanged rules by their source, and keep the old rules objects
+    // which may already have their values resolved.
+    std::unordered_multimap<std::wstring_view, size_t> oldRulesBySource;
+    for (size_t i = 0; i < oldRules.size(); i++) {
+        oldRulesBySource.insert({oldRules[i].source, i});
+    }
+
+    constexpr size_t kRemovedRule = static_cast<size_t>(-1);
+    std::vector<size_t> oldToNewRuleIndex(oldRules.size(), kRemovedRule);
+
+    for (size_t i = 0; i < g_elementsCustomizationRules.size(); i++) {
+        auto it = oldRulesBySource.find(g_elementsCustomizationRules[i].source);
+        if (it == oldRulesBySource.end()) {
+            continue;
+        }
+
+        size_t oldIndex = it->second;
+        oldRulesBySource.erase(it);
+
+        oldToNewRuleIndex[oldIndex] = i;
+    }
+
+    // Reordered rules change precedence between them, reapply everything in
+    // this case.
+    size_t lastNewIndex = 0;
+    bool reordered = false;
+    size_t keptRules = 0;
+    for (size_t newIndex : oldToNewRuleIndex) {
+        if (newIndex == kRemovedRule) {
+            continue;
+        }
+
+        if (keptRules > 0 && newIndex < lastNewIndex) {
+            reordered = true;
+            break;
+        }
+
+        lastNewIndex = newIndex;
+        keptRules++;
+    }
+
+    if (reordered) {
+        Wh_Log(L"Rules were reordered, reapplying all styles");
+        UninitializeSettingsAndTap();
+        InitializeSettingsAndTap();
+        return;
+    }
+
+    for (size_t oldIndex = 0; oldIndex < oldRules.size(); oldIndex++) {
+        size_t newIndex = oldToNewRuleIndex[oldIndex];
+        if (newIndex != kRemovedRule) {
+            g_elementsCustomizationRules[newIndex] =
+                std::move(oldRules[oldIndex]);
+        }
+    }
+
+    Wh_Log(L"Rules: %zu kept, %zu removed, %zu added", keptRules,
+           oldRules.size() - keptRules,
+           g_elementsCustomizationRules.size() - keptRules);
+
+    // Restore elements which were customized by removed rules, they will be
+    // fully re-evaluated.
+    for (auto it = g_elementsCustomizationState.begin();
+         it != g_elementsCustomizationState.end();) {
+        auto& [handle, elementCustomizationState] = *it;
+
+        bool affected = false;
+        for (auto& ruleIndex : elementCustomizationState.ruleIndices) {
+            ruleIndex = oldToNewRuleIndex[ruleIndex];
+            if (ruleIndex == kRemovedRule) {
+                affected = true;
+            }
+        }
+
+        if (!affected) {
+            ++it;
+            continue;
+        }
+
+        auto element = elementCustomizationState.element.get();
+
+        for (const auto& [visualStateGroupOptionalWeakPtrIter, stateIter] :
+             elementCustomizationState.perVisualStateGroup) {
+            RestoreCustomizationsForVisualStateGroup(
+                element, visualStateGroupOptionalWeakPtrIter, stateIter);
+        }
+
+        g_elementsEvaluatedGeneration.erase(handle);
+        it = g_elementsCustomizationState.erase(it);
+    }
+
+    if (g_webContentJs != oldWebContentJs) {
+        // Custom JS can't be undone, reload the WebViews' customizations.
+        ClearWebViewsCustomizationState();
+    } else if (g_webContentCss != oldWebContentCss) {
+        std::wstring jsCode = CreateWebViewJsCodeForStyle();
+        LogWebViewJsCode(jsCode);
+
+        for (const auto& [handle, webViewCustomizationState] :
+             g_webViewsCustomizationState) {
+            try {
+                UpdateWebViewStyleCustomizations(webViewCustomizationState,
+                                                 jsCode);
+            } catch (winrt::hresult_error const& ex) {
+                Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
+            }
+        }
+    }
+
+    // Only the added rules are still unresolved at this point.
+    PreResolveElementsCustomizationRules();
 
     HRESULT hr = InjectWindhawkTAP();
     if (FAILED(hr)) {
@@ -6168,7 +6643,12 @@ void Wh_ModUninit() {
     if (hCoreWnd) {
         Wh_Log(L"Uninitializing - Found core window");
         RunFromWindowThread(
-            hCoreWnd, [](PVOID) { UninitializeSettingsAndTap(); }, nullptr);
+            hCoreWnd,
+            [](PVOID) {
+                UninitializeSettingsAndTap();
+                RestoreResourceVariables({});
+            },
+            nullptr);
     }
 }
 
@@ -6193,10 +6673,7 @@ void Wh_ModSettingsChanged() {
         Wh_Log(L"Reinitializing - Found core window");
         RunFromWindowThread(
             hCoreWnd,
-            [](PVOID) {
-                UninitializeSettingsAndTap();
-                InitializeSettingsAndTap();
-            },
+            [](PVOID) { ReinitializeSettingsAndTap(); },
             nullptr);
     }
 }
@@ -2,7 +2,7 @@
 // @id              windows-11-taskbar-styler
 // @name            Windows 11 Taskbar Styler
 // @description     Customize the taskbar with themes contributed by others or create your own
-// @version         1.5.1
+// @version         1.5.10
 // @author          m417z
 // @github          https://github.com/m417z
 // @twitter         https://twitter.com/m417z
@@ -2578,6 +2578,7 @@ void ApplyCustomizations(InstanceHandle handle,
                          winrt::Windows::UI::Xaml::FrameworkElement element,
                          PCWSTR fallbackClassName);
 void CleanupCustomizations(InstanceHandle handle);
+bool HasCustomizationRulesForCurrentThread();
 
 HMODULE GetCurrentModuleHandle() {
     HMODULE module;
@@ -2712,6 +2713,12 @@ HRESULT VisualTreeWatcher::OnVisualTreeChange(ParentChildRelation, VisualElement
 
     Wh_Log(L"Element type: %s", element.Type);
 
+    if (mutationType == Add && !HasCustomizationRulesForCurrentThread())
+    {
+        // No rule can match, skip resolving the element.
+        return S_OK;
+    }
+
     if (mutationType == Add)
     {
         const auto inspectable = FromHandle(element.Handle);
@@ -2943,7 +2950,13 @@ HRESULT InjectWindhawkTAP() noexcept
 // clang-format on
 ////////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <array>
+#include <functional>
 #include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <string>
@@ -3035,15 +3048,78 @@ struct ElementCustomizationRules {
 thread_local std::vector<ElementCustomizationRules>
     g_elementsCustomizationRules;
 
+struct StringViewHash {
+    using is_transparent = void;
+    size_t operator()(std::wstring_view s) const noexcept {
+        return std::hash<std::wstring_view>{}(s);
+    }
+};
+
+// Element type -> element name -> indices in g_elementsCustomizationRules. An
+// empty name is used for rules that don't match by name. Used to only test
+// rules that can possibly match a newly added element.
+using ElementCustomizationRulesIndexForType =
+    std::unordered_map<std::wstring,
+                       std::vector<size_t>,
+                       StringViewHash,
+                       std::equal_to<>>;
+thread_local std::unordered_map<std::wstring,
+                                ElementCustomizationRulesIndexForType,
+                                StringViewHash,
+                                std::equal_to<>>
+    g_elementsCustomizationRulesIndex;
+
+bool HasCustomizationRulesForCurrentThread() {
+    return !g_elementsCustomizationRulesIndex.empty();
+}
+
 struct ElementPropertyCustomizationState {
     std::optional<winrt::Windows::Foundation::IInspectable> originalValue;
     std::optional<PropertyOverrideValue> customValue;
     int64_t propertyChangedToken = 0;
 };
 
+// Tracks the number of bytes currently allocated through it, used for the
+// per-element customization state.
+class CountingMemoryResource : public std::pmr::memory_resource {
+   public:
+    explicit CountingMemoryResource(std::pmr::memory_resource* upstream)
+        : m_upstream(upstream) {}
+
+    size_t BytesInUse() const { return m_bytesInUse; }
+
+   private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        void* p = m_upstream->allocate(bytes, alignment);
+        m_bytesInUse += bytes;
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        m_upstream->deallocate(p, bytes, alignment);
+        m_bytesInUse -= bytes;
+    }
+
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::pmr::memory_resource* m_upstream;
+    size_t m_bytesInUse = 0;
+};
+
+// The per-element state nodes are allocated from a per-thread pool to avoid
+// fragmenting the process heap with many small, short-lived allocations.
+thread_local std::pmr::unsynchronized_pool_resource
+    g_elementsCustomizationStatePool;
+thread_local CountingMemoryResource g_elementsCustomizationStateMemory{
+    &g_elementsCustomizationStatePool};
+
 struct ElementCustomizationStateForVisualStateGroup {
-    std::unordered_map<DependencyProperty, ElementPropertyCustomizationState>
-        propertyCustomizationStates;
+    std::pmr::unordered_map<DependencyProperty,
+                            ElementPropertyCustomizationState>
+        propertyCustomizationStates{&g_elementsCustomizationStateMemory};
     winrt::event_token visualStateGroupCurrentStateChangedToken;
 };
 
@@ -3052,13 +3128,203 @@ struct ElementCustomizationState {
 
     // Use list to avoid reallocations on insertion, as pointers to items are
     // captured in callbacks and stored.
-    std::list<std::pair<std::optional<winrt::weak_ref<VisualStateGroup>>,
-                        ElementCustomizationStateForVisualStateGroup>>
-        perVisualStateGroup;
+    std::pmr::list<std::pair<std::optional<winrt::weak_ref<VisualStateGroup>>,
+                             ElementCustomizationStateForVisualStateGroup>>
+        perVisualStateGroup{&g_elementsCustomizationStateMemory};
+};
+
+// An open addressing hash table with linear probing, keyed by the element
+// instance handle. Values may be moved when the table grows, which is fine
+// since the list nodes that callbacks point to stay in place.
+class ElementCustomizationStateTable {
+   public:
+    ElementCustomizationState* find(InstanceHandle handle) {
+        Slot* slot = FindSlot(handle);
+        return slot ? &slot->value : nullptr;
+    }
+
+    ElementCustomizationState& operator[](InstanceHandle handle) {
+        if (auto* value = find(handle)) {
+            return *value;
+        }
+
+        if ((m_size + m_deleted + 1) * 4 > m_slots.size() * 3) {
+            Rehash();
+        }
+
+        size_t mask = m_slots.size() - 1;
+        size_t i = Hash(handle) & mask;
+        while (m_slots[i].state == SlotState::kOccupied) {
+            i = (i + 1) & mask;
+        }
+
+        auto& slot = m_slots[i];
+        if (slot.state == SlotState::kDeleted) {
+            m_deleted--;
+        }
+
+        slot.handle = handle;
+        slot.state = SlotState::kOccupied;
+        m_size++;
+        return slot.value;
+    }
+
+    void erase(InstanceHandle handle) {
+        Slot* slot = FindSlot(handle);
+        if (!slot) {
+            return;
+        }
+
+        slot->value = {};
+        slot->state = SlotState::kDeleted;
+        m_size--;
+        m_deleted++;
+    }
+
+    template <typename F>
+    void ForEach(F&& f) {
+        for (auto& slot : m_slots) {
+            if (slot.state == SlotState::kOccupied) {
+                f(slot.handle, slot.value);
+            }
+        }
+    }
+
+    void clear() {
+        m_slots.clear();
+        m_slots.shrink_to_fit();
+        m_size = 0;
+        m_deleted = 0;
+    }
+
+    size_t size() const { return m_size; }
+
+    size_t TableBytes() const { return m_slots.capacity() * sizeof(Slot); }
+
+   private:
+    enum class SlotState : uint8_t {
+        kEmpty,
+        kOccupied,
+        kDeleted,
+    };
+
+    struct Slot {
+        InstanceHandle handle = 0;
+        SlotState state = SlotState::kEmpty;
+        ElementCustomizationState value;
+    };
+
+    static size_t Hash(InstanceHandle handle) {
+        // Fibonacci hashing, handles are pointer-like and poorly distributed
+        // in the low bits.
+        return static_cast<size_t>((static_cast<uint64_t>(handle) *
+                                    0x9E3779B97F4A7C15ull) >>
+                                   32);
+    }
+
+    Slot* FindSlot(InstanceHandle handle) {
+        if (m_slots.empty()) {
+            return nullptr;
+        }
+
+        size_t mask = m_slots.size() - 1;
+        for (size_t i = Hash(handle) & mask;; i = (i + 1) & mask) {
+            auto& slot = m_slots[i];
+            if (slot.state == SlotState::kEmpty) {
+                return nullptr;
+            }
+
+            if (slot.state == SlotState::kOccupied && slot.handle == handle) {
+                return &slot;
+            }
+        }
+    }
+
+    void Rehash() {
+        size_t newCapacity = m_slots.empty() ? 64 : m_slots.size();
+        // Only grow if the table is actually full, otherwise rehashing just
+        // gets rid of the deleted slots.
+        while ((m_size + 1) * 2 > newCapacity) {
+            newCapacity *= 2;
+        }
+
+        auto oldSlots = std::move(m_slots);
+        m_slots = std::vector<Slot>(newCapacity);
+        m_deleted = 0;
+
+        size_t mask = newCapacity - 1;
+        for (auto& oldSlot : oldSlots) {
+            if (oldSlot.state != SlotState::kOccupied) {
+                continue;
+            }
+
+            size_t i = Hash(oldSlot.handle) & mask;
+            while (m_slots[i].state != SlotState::kEmpty) {
+                i = (i + 1) & mask;
+            }
+
+            m_slots[i].handle = oldSlot.handle;
+            m_slots[i].state = SlotState::kOccupied;
+            m_slots[i].value = std::move(oldSlot.value);
+        }
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_size = 0;
+    size_t m_deleted = 0;
+};
+
+thread_local ElementCustomizationStateTable g_elementsCustomizationState;
+
+// Logged when the state of a thread is freed, i.e. on unload and when the
+// settings change, rather than for every styled element.
+void LogElementsCustomizationStateStats() {
+    Wh_Log(L"Customization state: %zu elements, %zu table bytes, %zu node "
+           L"bytes",
+           g_elementsCustomizationState.size(),
+           g_elementsCustomizationState.TableBytes(),
+           g_elementsCustomizationStateMemory.BytesInUse());
+}
+
+// Time spent styling each added element, including matching it against the
+// rules. Percentiles over the last samples are logged periodically, so the
+// engine's cost can be compared between versions and themes on a real session.
+class ApplyCustomizationsLatencyStats {
+   public:
+    void AddSample(LONGLONG ticks) {
+        m_samples[m_count % m_samples.size()] = ticks;
+        m_count++;
+
+        if (m_count % m_samples.size() == 0) {
+            Log();
+        }
+    }
+
+   private:
+    void Log() {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+
+        auto sorted = m_samples;
+        std::sort(sorted.begin(), sorted.end());
+
+        auto percentileUs = [&](size_t percentile) {
+            size_t index = (sorted.size() - 1) * percentile / 100;
+            return static_cast<double>(sorted[index]) * 1000000.0 /
+                   frequency.QuadPart;
+        };
+
+        Wh_Log(L"Styling latency over %zu elements (%zu total): p50=%.1fus "
+               L"p90=%.1fus p99=%.1fus max=%.1fus",
+               sorted.size(), m_count, percentileUs(50), percentileUs(90),
+               percentileUs(99), percentileUs(100));
+    }
+
+    std::array<LONGLONG, 256> m_samples{};
+    size_t m_count = 0;
 };
 
-thread_local std::unordered_map<InstanceHandle, ElementCustomizationState>
-    g_elementsCustomizationState;
+thread_local ApplyCustomizationsLatencyStats g_applyCustomizationsLatencyStats;
 
 thread_local bool g_elementPropertyModifying;
 
@@ -4089,6 +4355,11 @@ std::optional<PropertyOverrideValue> ParseNonXamlPropertyOverrideValue(
     };
 }
 
+// Parsed styles by their full XAML source. Identical setters for the same
+// type are only parsed once per settings load, as XamlReader::Load is
+// relatively expensive.
+thread_local std::unordered_map<std::wstring, Style> g_xamlStyleCache;
+
 Style GetStyleFromXamlSetters(const std::wstring_view type,
                               const std::wstring_view xamlStyleSetters) {
     std::wstring xaml =
@@ -4124,6 +4395,12 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         L"    </Style>\n"
         L"</ResourceDictionary>";
 
+    if (auto it = g_xamlStyleCache.find(xaml); it != g_xamlStyleCache.end()) {
+        Wh_Log(L"Using cached style for %.*s", static_cast<int>(type.length()),
+               type.data());
+        return it->second;
+    }
+
     Wh_Log(L"======================================== XAML:");
     std::wstringstream ss(xaml);
     std::wstring line;
@@ -4136,7 +4413,9 @@ Style GetStyleFromXamlSetters(const std::wstring_view type,
         Markup::XamlReader::Load(xaml).as<ResourceDictionary>();
 
     auto [styleKey, styleInspectable] = resourceDictionary.First().Current();
-    return styleInspectable.as<Style>();
+    auto style = styleInspectable.as<Style>();
+    g_xamlStyleCache.try_emplace(std::move(xaml), style);
+    return style;
 }
 
 Style GetStyleFromXamlSettersWithFallbackType(
@@ -4420,15 +4699,60 @@ bool TestElementMatcher(FrameworkElement element,
     return true;
 }
 
+// Returns the indices of the rules which can match the element according to
+// their type and name, in descending order (the order in which rules are
+// applied).
+std::vector<size_t> GetCandidateElementCustomizationRules(
+    std::wstring_view className,
+    std::wstring_view name,
+    PCWSTR fallbackClassName) {
+    std::vector<size_t> candidates;
+
+    auto addCandidatesForType = [&](std::wstring_view type) {
+        auto typeIt = g_elementsCustomizationRulesIndex.find(type);
+        if (typeIt == g_elementsCustomizationRulesIndex.end()) {
+            return;
+        }
+
+        const auto& indexForType = typeIt->second;
+
+        if (auto it = indexForType.find(std::wstring_view{});
+            it != indexForType.end()) {
+            candidates.insert(candidates.end(), it->second.begin(),
+                              it->second.end());
+        }
+
+        if (!name.empty()) {
+            if (auto it = indexForType.find(name); it != indexForType.end()) {
+                candidates.insert(candidates.end(), it->second.begin(),
+                                  it->second.end());
+            }
+        }
+    };
+
+    addCandidatesForType(className);
+    if (fallbackClassName && className != fallbackClassName) {
+        addCandidatesForType(fallbackClassName);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), std::greater<>{});
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+
+    return candidates;
+}
+
 std::unordered_map<VisualStateGroup, PropertyOverrides>
 FindElementPropertyOverrides(FrameworkElement element,
                              PCWSTR fallbackClassName) {
     std::unordered_map<VisualStateGroup, PropertyOverrides> overrides;
     std::unordered_set<DependencyProperty> propertiesAdded;
 
-    for (auto it = g_elementsCustomizationRules.rbegin();
-         it != g_elementsCustomizationRules.rend(); ++it) {
-        auto& override = *it;
+    auto candidates = GetCandidateElementCustomizationRules(
+        winrt::get_class_name(element), element.Name(), fallbackClassName);
+
+    for (size_t index : candidates) {
+        auto& override = g_elementsCustomizationRules[index];
 
         VisualStateGroup visualStateGroup = nullptr;
 
@@ -4488,42 +4812,122 @@ FindElementPropertyOverrides(FrameworkElement element,
     return overrides;
 }
 
+// The overrides of a single visual state group, with the visual state names
+// interned to indices into a flat per-property value array, so that a visual
+// state change doesn't need string lookups or allocations. Index 0 is the
+// default value, for an empty visual state name.
+struct VisualStateGroupPropertyOverrides {
+    std::vector<std::wstring> visualStateNames;
+    std::vector<std::pair<DependencyProperty,
+                          std::vector<std::optional<PropertyOverrideValue>>>>
+        properties;
+};
+
+std::shared_ptr<const VisualStateGroupPropertyOverrides>
+CompileVisualStateGroupPropertyOverrides(
+    const PropertyOverrides& propertyOverrides) {
+    auto compiled = std::make_shared<VisualStateGroupPropertyOverrides>();
+    auto& visualStateNames = compiled->visualStateNames;
+
+    visualStateNames.push_back(L"");
+    for (const auto& [property, valuesPerVisualState] : propertyOverrides) {
+        for (const auto& [visualState, value] : valuesPerVisualState) {
+            if (std::find(visualStateNames.begin(), visualStateNames.end(),
+                          visualState) == visualStateNames.end()) {
+                visualStateNames.push_back(visualState);
+            }
+        }
+    }
+
+    compiled->properties.reserve(propertyOverrides.size());
+    for (const auto& [property, valuesPerVisualState] : propertyOverrides) {
+        auto& values = compiled->properties
+                           .emplace_back(property, visualStateNames.size())
+                           .second;
+        for (const auto& [visualState, value] : valuesPerVisualState) {
+            size_t index = std::find(visualStateNames.begin(),
+                                     visualStateNames.end(), visualState) -
+                           visualStateNames.begin();
+            values[index] = value;
+        }
+    }
+
+    return compiled;
+}
+
+// Returns -1 if no override uses the given visual state. There are only a
+// handful of states per group, so a linear scan is the fastest lookup.
+int FindVisualStateIndex(const VisualStateGroupPropertyOverrides& overrides,
+                         std::wstring_view visualStateName) {
+    const auto& names = overrides.visualStateNames;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (names[i] == visualStateName) {
+            return static_cast<int>(i);
+        }
+    }
+
+    return -1;
+}
+
+const PropertyOverrideValue* GetVisualStateValue(
+    const std::vector<std::optional<PropertyOverrideValue>>& values,
+    int visualStateIndex) {
+    if (visualStateIndex < 0 || !values[visualStateIndex]) {
+        return nullptr;
+    }
+
+    return &*values[visualStateIndex];
+}
+
 void ApplyCustomizationsForVisualStateGroup(
     FrameworkElement element,
     VisualStateGroup visualStateGroup,
-    PropertyOverrides propertyOverrides,
+    const PropertyOverrides& propertyOverrides,
     ElementCustomizationStateForVisualStateGroup*
         elementCustomizationStateForVisualStateGroup) {
     auto elementDo = element.as<DependencyObject>();
 
+    auto compiledOverrides =
+        CompileVisualStateGroupPropertyOverrides(propertyOverrides);
+
     VisualState currentVisualState(
         visualStateGroup ? visualStateGroup.CurrentState() : nullptr);
 
-    std::wstring currentVisualStateName(
-        currentVisualState ? currentVisualState.Name() : L"");
+    int currentVisualStateIndex =
+        currentVisualState
+            ? FindVisualStateIndex(*compiledOverrides,
+                                   currentVisualState.Name())
+            : 0;
 
-    for (const auto& [property, valuesPerVisualState] : propertyOverrides) {
+    // Parallel to compiledOverrides->properties. The map nodes are stable, so
+    // the state change handler can use the pointers directly.
+    std::vector<ElementPropertyCustomizationState*> propertyCustomizationStates;
+    propertyCustomizationStates.reserve(compiledOverrides->properties.size());
+
+    for (const auto& [property, values] : compiledOverrides->properties) {
         const auto [propertyCustomizationStatesIt, inserted] =
             elementCustomizationStateForVisualStateGroup
                 ->propertyCustomizationStates.insert({property, {}});
-        if (!inserted) {
-            continue;
-        }
 
         auto& propertyCustomizationState =
             propertyCustomizationStatesIt->second;
+        propertyCustomizationStates.push_back(&propertyCustomizationState);
 
-        auto it = valuesPerVisualState.find(currentVisualStateName);
-        if (it == valuesPerVisualState.end() &&
-            !currentVisualStateName.empty()) {
-            it = valuesPerVisualState.find(L"");
+        if (!inserted) {
+            continue;
         }
 
-        if (it != valuesPerVisualState.end()) {
+        const PropertyOverrideValue* value =
+            GetVisualStateValue(values, currentVisualStateIndex);
+        if (!value) {
+            value = GetVisualStateValue(values, 0);
+        }
+
+        if (value) {
             propertyCustomizationState.originalValue =
                 ReadLocalValueWithWorkaround(element, property);
-            propertyCustomizationState.customValue = it->second;
-            SetOrClearValue(element, property, it->second,
+            propertyCustomizationState.customValue = *value;
+            SetOrClearValue(element, property, *value,
                             /*initialApply=*/true);
         }
 
@@ -4571,8 +4975,9 @@ void ApplyCustomizationsForVisualStateGroup(
         elementCustomizationStateForVisualStateGroup
             ->visualStateGroupCurrentStateChangedToken =
             visualStateGroup.CurrentStateChanged(
-                [elementWeakRef, propertyOverrides,
-                 elementCustomizationStateForVisualStateGroup](
+                [elementWeakRef, compiledOverrides,
+                 propertyCustomizationStates =
+                     std::move(propertyCustomizationStates)](
                     winrt::Windows::Foundation::IInspectable const& sender,
                     VisualStateChangedEventArgs const& e) {
                     auto element = elementWeakRef.get();
@@ -4583,43 +4988,45 @@ void ApplyCustomizationsForVisualStateGroup(
                     Wh_Log(L"Re-applying all styles for %s",
                            winrt::get_class_name(element).c_str());
 
-                    g_elementPropertyModifying = true;
+                    auto newState = e.NewState();
+                    int newStateIndex =
+                        newState ? FindVisualStateIndex(*compiledOverrides,
+                                                        newState.Name())
+                                 : 0;
 
-                    auto& propertyCustomizationStates =
-                        elementCustomizationStateForVisualStateGroup
-                            ->propertyCustomizationStates;
+                    auto oldState = e.OldState();
+                    int oldStateIndex =
+                        oldState ? FindVisualStateIndex(*compiledOverrides,
+                                                        oldState.Name())
+                                 : 0;
 
-                    for (const auto& [property, valuesPerVisualState] :
-                         propertyOverrides) {
+                    g_elementPropertyModifying = true;
+
+                    const auto& properties = compiledOverrides->properties;
+                    for (size_t i = 0; i < properties.size(); i++) {
+                        const auto& [property, values] = properties[i];
                         auto& propertyCustomizationState =
-                            propertyCustomizationStates.at(property);
-
-                        auto newState = e.NewState();
-                        auto newStateName =
-                            std::wstring{newState ? newState.Name() : L""};
-                        auto it = valuesPerVisualState.find(newStateName);
-                        if (it == valuesPerVisualState.end()) {
-                            it = valuesPerVisualState.find(L"");
-                            if (it != valuesPerVisualState.end()) {
-                                auto oldState = e.OldState();
-                                auto oldStateName = std::wstring{
-                                    oldState ? oldState.Name() : L""};
-                                if (!valuesPerVisualState.contains(
-                                        oldStateName)) {
-                                    continue;
-                                }
+                            *propertyCustomizationStates[i];
+
+                        const PropertyOverrideValue* value =
+                            GetVisualStateValue(values, newStateIndex);
+                        if (!value) {
+                            value = GetVisualStateValue(values, 0);
+                            if (value &&
+                                !GetVisualStateValue(values, oldStateIndex)) {
+                                continue;
                             }
                         }
 
-                        if (it != valuesPerVisualState.end()) {
+                        if (value) {
                             if (!propertyCustomizationState.originalValue) {
                                 propertyCustomizationState.originalValue =
                                     ReadLocalValueWithWorkaround(element,
                                                                  property);
                             }
 
-                            propertyCustomizationState.customValue = it->second;
-                            SetOrClearValue(element, property, it->second);
+                            propertyCustomizationState.customValue = *value;
+                            SetOrClearValue(element, property, *value);
                         } else {
                             if (propertyCustomizationState.originalValue) {
                                 SetOrClearValue(
@@ -4668,9 +5075,9 @@ void RestoreCustomizationsForVisualStateGroup(
     }
 }
 
-void ApplyCustomizations(InstanceHandle handle,
-                         FrameworkElement element,
-                         PCWSTR fallbackClassName) {
+void ApplyCustomizationsImpl(InstanceHandle handle,
+                             FrameworkElement element,
+                             PCWSTR fallbackClassName) {
     auto overrides = FindElementPropertyOverrides(element, fallbackClassName);
     if (overrides.empty()) {
         return;
@@ -4702,30 +5109,51 @@ void ApplyCustomizations(InstanceHandle handle,
             &elementCustomizationState.perVisualStateGroup.back().second;
 
         ApplyCustomizationsForVisualStateGroup(
-            element, visualStateGroup, std::move(overridesForVisualStateGroup),
+            element, visualStateGroup, overridesForVisualStateGroup,
             elementCustomizationStateForVisualStateGroup);
     }
 }
 
-void CleanupCustomizations(InstanceHandle handle) {
-    if (auto it = g_elementsCustomizationState.find(handle);
-        it != g_elementsCustomizationState.end()) {
-        auto& elementCustomizationState = it->second;
+void ApplyCustomizations(InstanceHandle handle,
+                         FrameworkElement element,
+                         PCWSTR fallbackClassName) {
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    ApplyCustomizationsImpl(handle, element, fallbackClassName);
 
-        auto element = elementCustomizationState.element.get();
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    g_applyCustomizationsLatencyStats.AddSample(end.QuadPart - start.QuadPart);
+}
+
+void CleanupCustomizations(InstanceHandle handle) {
+    if (auto* elementCustomizationState =
+            g_elementsCustomizationState.find(handle)) {
+        auto element = elementCustomizationState->element.get();
 
         for (const auto& [visualStateGroupOptionalWeakPtrIter, stateIter] :
-             elementCustomizationState.perVisualStateGroup) {
+             elementCustomizationState->perVisualStateGroup) {
             RestoreCustomizationsForVisualStateGroup(
                 element, visualStateGroupOptionalWeakPtrIter, stateIter);
         }
 
-        g_elementsCustomizationState.erase(it);
+        g_elementsCustomizationState.erase(handle);
     }
 }
 
 using StyleConstant = std::pair<std::wstring, std::wstring>;
-using StyleConstants = std::vector<StyleConstant>;
+
+struct StyleConstants {
+    // Name -> value.
+    std::unordered_map<std::wstring,
+                       std::wstring,
+                       StringViewHash,
+                       std::equal_to<>>
+        values;
+    // The distinct name lengths, longest first, to replace long names first.
+    std::vector<size_t> nameLengths;
+};
 
 std::optional<StyleConstant> ParseStyleConstant(std::wstring_view constant) {
     // Skip if commented.
@@ -4750,9 +5178,15 @@ StyleConstants LoadStyleConstants(
     const std::vector<PCWSTR>& themeStyleConstants) {
     StyleConstants result;
 
+    // Later definitions override earlier ones with the same name.
+    auto addConstant = [&result](StyleConstant constant) {
+        result.values.insert_or_assign(std::move(constant.first),
+                                       std::move(constant.second));
+    };
+
     for (const auto themeStyleConstant : themeStyleConstants) {
         if (auto parsed = ParseStyleConstant(themeStyleConstant)) {
-            result.push_back(std::move(*parsed));
+            addConstant(std::move(*parsed));
         }
     }
 
@@ -4764,18 +5198,19 @@ StyleConstants LoadStyleConstants(
         }
 
         if (auto parsed = ParseStyleConstant(constantSetting.get())) {
-            result.push_back(std::move(*parsed));
+            addConstant(std::move(*parsed));
         }
     }
 
-    // Reverse the order to allow overriding definitions with the same name.
-    std::reverse(result.begin(), result.end());
+    for (const auto& [name, value] : result.values) {
+        result.nameLengths.push_back(name.size());
+    }
 
-    // Sort by name length to replace long names first.
-    std::stable_sort(result.begin(), result.end(),
-                     [](const StyleConstant& a, const StyleConstant& b) {
-                         return a.first.size() > b.first.size();
-                     });
+    std::sort(result.nameLengths.begin(), result.nameLengths.end(),
+              std::greater<>());
+    result.nameLengths.erase(
+        std::unique(result.nameLengths.begin(), result.nameLengths.end()),
+        result.nameLengths.end());
 
     return result;
 }
@@ -4783,6 +5218,7 @@ StyleConstants LoadStyleConstants(
 std::wstring ApplyStyleConstants(std::wstring_view style,
                                  const StyleConstants& styleConstants) {
     std::wstring result;
+    result.reserve(style.size());
 
     size_t lastPos = 0;
     size_t findPos;
@@ -4790,17 +5226,28 @@ std::wstring ApplyStyleConstants(std::wstring_view style,
     while ((findPos = style.find('$', lastPos)) != style.npos) {
         result.append(style, lastPos, findPos - lastPos);
 
-        const StyleConstant* constant = nullptr;
-        for (const auto& s : styleConstants) {
-            if (s.first == style.substr(findPos + 1, s.first.size())) {
-                constant = &s;
+        auto rest = style.substr(findPos + 1);
+
+        // Look up the longest name which matches, one lookup per distinct
+        // name length.
+        const std::wstring* constantValue = nullptr;
+        size_t constantNameLength = 0;
+        for (size_t nameLength : styleConstants.nameLengths) {
+            if (nameLength > rest.size()) {
+                continue;
+            }
+
+            auto it = styleConstants.values.find(rest.substr(0, nameLength));
+            if (it != styleConstants.values.end()) {
+                constantValue = &it->second;
+                constantNameLength = nameLength;
                 break;
             }
         }
 
-        if (constant) {
-            result += constant->second;
-            lastPos = findPos + 1 + constant->first.size();
+        if (constantValue) {
+            result += *constantValue;
+            lastPos = findPos + 1 + constantNameLength;
         } else {
             result += '$';
             lastPos = findPos + 1;
@@ -4958,8 +5405,10 @@ std::wstring AdjustTypeName(std::wstring_view type) {
     return std::wstring{type};
 }
 
-void AddElementCustomizationRules(std::wstring_view target,
-                                  std::vector<std::wstring> styles) {
+void AddElementCustomizationRules(
+    std::vector<ElementCustomizationRules>* rules,
+    std::wstring_view target,
+    std::vector<std::wstring> styles) {
     ElementCustomizationRules elementCustomizationRules;
 
     auto targetParts = SplitStringView(target, L" > ");
@@ -4997,11 +5446,11 @@ void AddElementCustomizationRules(std::wstring_view target,
         first = false;
     }
 
-    g_elementsCustomizationRules.push_back(
-        std::move(elementCustomizationRules));
+    rules->push_back(std::move(elementCustomizationRules));
 }
 
 bool ProcessSingleTargetStylesFromSettings(
+    std::vector<ElementCustomizationRules>* rules,
     int index,
     const StyleConstants& styleConstants) {
     string_setting_unique_ptr targetStringSetting(
@@ -5036,7 +5485,7 @@ bool ProcessSingleTargetStylesFromSettings(
     }
 
     if (styles.size() > 0) {
-        AddElementCustomizationRules(targetStringSetting.get(),
+        AddElementCustomizationRules(rules, targetStringSetting.get(),
                                      std::move(styles));
     }
 
@@ -5102,7 +5551,9 @@ std::optional<bool> IsOsFeatureEnabled(UINT32 featureId) {
     return std::nullopt;
 }
 
-void ProcessAllStylesFromSettings() {
+std::vector<ElementCustomizationRules> ProcessAllStylesFromSettings() {
+    std::vector<ElementCustomizationRules> rules;
+
     PCWSTR themeName = Wh_GetStringSetting(L"theme");
     const Theme* theme = nullptr;
     if (wcscmp(themeName, L"TranslucentTaskbar") == 0) {
@@ -5169,7 +5620,7 @@ void ProcessAllStylesFromSettings() {
                     styles.push_back(ApplyStyleConstants(s, styleConstants));
                 }
 
-                AddElementCustomizationRules(themeTargetStyle.target,
+                AddElementCustomizationRules(&rules, themeTargetStyle.target,
                                              std::move(styles));
             } catch (winrt::hresult_error const& ex) {
                 Wh_Log(L"Error %08X", ex.code());
@@ -5181,7 +5632,8 @@ void ProcessAllStylesFromSettings() {
 
     for (int i = 0;; i++) {
         try {
-            if (!ProcessSingleTargetStylesFromSettings(i, styleConstants)) {
+            if (!ProcessSingleTargetStylesFromSettings(&rules, i,
+                                                       styleConstants)) {
                 break;
             }
         } catch (winrt::hresult_error const& ex) {
@@ -5190,18 +5642,107 @@ void ProcessAllStylesFromSettings() {
             Wh_Log(L"Error: %S", ex.what());
         }
     }
+
+    return rules;
 }
 
-bool ProcessSingleResourceVariableFromSettings(int index) {
-    string_setting_unique_ptr variableKeyStringSetting(
-        Wh_GetStringSetting(L"resourceVariables[%d].variableKey", index));
-    if (!*variableKeyStringSetting.get()) {
-        return false;
+struct ResourceVariableSetting {
+    std::wstring variableKey;
+    std::wstring value;
+};
+
+std::vector<ResourceVariableSetting> LoadResourceVariablesFromSettings() {
+    std::vector<ResourceVariableSetting> result;
+
+    for (int i = 0;; i++) {
+        string_setting_unique_ptr variableKeyStringSetting(
+            Wh_GetStringSetting(L"resourceVariables[%d].variableKey", i));
+        if (!*variableKeyStringSetting.get()) {
+            break;
+        }
+
+        string_setting_unique_ptr valueStringSetting(
+            Wh_GetStringSetting(L"resourceVariables[%d].value", i));
+
+        result.push_back({variableKeyStringSetting.get(),
+                          valueStringSetting.get()});
+    }
+
+    return result;
+}
+
+// The parsed (but unresolved) rules are shared by all UI threads. Parsing is
+// done once, preferably from a non-UI thread before the UI threads are
+// initialized, so that only the XAML-dependent work is done on the UI thread.
+// The resource variables are read along with them, so that the settings are
+// only read once and not again by each UI thread.
+std::mutex g_parsedElementsCustomizationRulesMutex;
+std::shared_ptr<const std::vector<ElementCustomizationRules>>
+    g_parsedElementsCustomizationRules;
+std::shared_ptr<const std::vector<ResourceVariableSetting>>
+    g_parsedResourceVariables;
+
+void ParseStylesFromSettings() {
+    auto rules = std::make_shared<const std::vector<ElementCustomizationRules>>(
+        ProcessAllStylesFromSettings());
+    auto resourceVariables =
+        std::make_shared<const std::vector<ResourceVariableSetting>>(
+            LoadResourceVariablesFromSettings());
+
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    g_parsedElementsCustomizationRules = std::move(rules);
+    g_parsedResourceVariables = std::move(resourceVariables);
+}
+
+void FreeParsedStyles() {
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    g_parsedElementsCustomizationRules = nullptr;
+    g_parsedResourceVariables = nullptr;
+}
+
+std::shared_ptr<const std::vector<ElementCustomizationRules>>
+GetParsedStyles() {
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    if (!g_parsedElementsCustomizationRules) {
+        g_parsedElementsCustomizationRules =
+            std::make_shared<const std::vector<ElementCustomizationRules>>(
+                ProcessAllStylesFromSettings());
+    }
+
+    return g_parsedElementsCustomizationRules;
+}
+
+std::shared_ptr<const std::vector<ResourceVariableSetting>>
+GetParsedResourceVariables() {
+    std::lock_guard<std::mutex> guard(g_parsedElementsCustomizationRulesMutex);
+    if (!g_parsedResourceVariables) {
+        g_parsedResourceVariables =
+            std::make_shared<const std::vector<ResourceVariableSetting>>(
+                LoadResourceVariablesFromSettings());
     }
 
-    Wh_Log(L"Processing resource variable %s", variableKeyStringSetting.get());
+    return g_parsedResourceVariables;
+}
+
+void LoadStylesForCurrentThread() {
+    // Copy the rules, as the resolved XAML values are bound to the thread.
+    g_elementsCustomizationRules = *GetParsedStyles();
+
+    for (size_t i = 0; i < g_elementsCustomizationRules.size(); i++) {
+        const auto& elementMatcher =
+            g_elementsCustomizationRules[i].elementMatcher;
+        g_elementsCustomizationRulesIndex[elementMatcher.type]
+                                         [elementMatcher.name]
+                                             .push_back(i);
+    }
+}
+
+void ProcessSingleResourceVariable(
+    const ResourceVariableSetting& resourceVariable) {
+    Wh_Log(L"Processing resource variable %s",
+           resourceVariable.variableKey.c_str());
 
-    std::wstring_view variableKey = variableKeyStringSetting.get();
+    std::wstring_view variableKey = resourceVariable.variableKey;
 
     auto resources = Application::Current().Resources();
 
@@ -5219,24 +5760,19 @@ bool ProcessSingleResourceVariableFromSettings(int index) {
 
     auto resourceTypeName = Interop::TypeName{resourceClassName};
 
-    string_setting_unique_ptr valueStringSetting(
-        Wh_GetStringSetting(L"resourceVariables[%d].value", index));
-
-    std::wstring_view value = valueStringSetting.get();
+    std::wstring_view value = resourceVariable.value;
 
     resources.Insert(winrt::box_value(variableKey),
                      Markup::XamlBindingHelper::ConvertValue(
                          resourceTypeName, winrt::box_value(value)));
-
-    return true;
 }
 
 void ProcessResourceVariablesFromSettings() {
-    for (int i = 0;; i++) {
+    auto resourceVariables = GetParsedResourceVariables();
+
+    for (const auto& resourceVariable : *resourceVariables) {
         try {
-            if (!ProcessSingleResourceVariableFromSettings(i)) {
-                break;
-            }
+            ProcessSingleResourceVariable(resourceVariable);
         } catch (winrt::hresult_error const& ex) {
             Wh_Log(L"Error %08X: %s", ex.code(), ex.message().c_str());
         } catch (std::exception const& ex) {
@@ -5252,20 +5788,26 @@ void UninitializeForCurrentThread() {
 
     g_delayedBackgroundFillSet.clear();
 
-    for (const auto& [handle, elementCustomizationState] :
-         g_elementsCustomizationState) {
-        auto element = elementCustomizationState.element.get();
+    LogElementsCustomizationStateStats();
 
-        for (const auto& [visualStateGroupOptionalWeakPtrIter, stateIter] :
-             elementCustomizationState.perVisualStateGroup) {
-            RestoreCustomizationsForVisualStateGroup(
-                element, visualStateGroupOptionalWeakPtrIter, stateIter);
-        }
-    }
+    g_elementsCustomizationState.ForEach(
+        [](InstanceHandle,
+           const ElementCustomizationState& elementCustomizationState) {
+            auto element = elementCustomizationState.element.get();
+
+            for (const auto& [visualStateGroupOptionalWeakPtrIter, stateIter] :
+                 elementCustomizationState.perVisualStateGroup) {
+                RestoreCustomizationsForVisualStateGroup(
+                    element, visualStateGroupOptionalWeakPtrIter, stateIter);
+            }
+        });
 
     g_elementsCustomizationState.clear();
+    g_elementsCustomizationStatePool.release();
 
     g_elementsCustomizationRules.clear();
+    g_xamlStyleCache.clear();
+    g_elementsCustomizationRulesIndex.clear();
 
     g_initializedForThread = false;
 }
@@ -5284,13 +5826,21 @@ void InitializeForCurrentThread() {
         return;
     }
 
-    ProcessAllStylesFromSettings();
+    LoadStylesForCurrentThread();
     ProcessResourceVariablesFromSettings();
 
     g_initializedForThread = true;
 }
 
 void InitializeSettingsAndTap() {
+    // Without styles the visual tree watcher has nothing to apply, and would
+    // only add the diagnostics callback overhead for every element. This is
+    // called again after the settings change.
+    if (GetParsedStyles()->empty()) {
+        Wh_Log(L"No styles, not injecting TAP");
+        return;
+    }
+
     if (g_initialized.exchange(true)) {
         return;
     }
@@ -5713,6 +6263,8 @@ BOOL Wh_ModInit() {
 void Wh_ModAfterInit() {
     Wh_Log(L">");
 
+    ParseStylesFromSettings();
+
     bool initialize = false;
 
     HWND hTaskbarUiWnd = GetTaskbarUiWnd();
@@ -5757,6 +6309,8 @@ void Wh_ModUninit() {
             hXamlHostWnd, [](PVOID) { UninitializeForCurrentThread(); },
             nullptr);
     }
+
+    FreeParsedStyles();
 }
 
 void Wh_ModSettingsChanged() {
@@ -5764,6 +6318,8 @@ void Wh_ModSettingsChanged() {
 
     UninitializeSettingsAndTap();
 
+    ParseStylesFromSettings();
+
     bool initialize = false;
 
     HWND hTaskbarUiWnd = GetTaskbarUiWnd();
@@ -1,9 +1,15 @@
 import argparse
 import ctypes
+import hashlib
+import os
 import re
+import shutil
 import subprocess
 import sys
 import tempfile
+import threading
+import uuid
+from concurrent.futures import ThreadPoolExecutor
 from dataclasses import dataclass
 from enum import Enum
 from pathlib import Path
@@ -311,6 +317,48 @@ class ModInfo:
     architectures: set[Architecture]
 
 
+@dataclass
+class BuildOptions:
+    cache_dir: Optional[Path] = None
+    pch_dir: Optional[Path] = None
+
+
+@dataclass
+class CompileJob:
+    mod_file: Path
+    compiler_path: Path
+    compiler_target: str
+    # The mod code after applying the compatibility patches, or None if there
+    # are no patches and the mod file is compiled as is.
+    patched_mod_code: Optional[str]
+    # Arguments except for the source file and the output path.
+    compiler_args: list
+    # Arguments which only affect linking, excluded when building a
+    # precompiled header.
+    link_args: list
+    # For logging, already included in compiler_args.
+    extra_args: list
+    compatibility_compiler_flags: list
+    compatibility_patches: Optional[list]
+    output_path: Path
+    windhawk_version: tuple[int, int, int, int]
+
+    def cache_key(self) -> str:
+        h = hashlib.sha256()
+        h.update(repr(self.windhawk_version).encode())
+        h.update(b'\0')
+        h.update(str(self.compiler_path).encode())
+        h.update(b'\0')
+        for arg in self.compiler_args:
+            h.update(str(arg).encode())
+            h.update(b'\0')
+        if self.patched_mod_code is not None:
+            h.update(self.patched_mod_code.encode('utf-8'))
+        else:
+            h.update(self.mod_file.read_bytes())
+        return h.hexdigest()
+
+
 def get_engine_path(windhawk_dir: Path) -> Optional[str]:
     config = (windhawk_dir / 'windhawk.ini').read_text(encoding='utf-16')
     p = r'^\s*EnginePath\s*=\s*(.*?)\s*$'
@@ -537,11 +585,9 @@ def get_mod_info(path: Path) -> ModInfo:
     return ModInfo(id, version, compiler_options, architectures)
 
 
-def compile_mod(
+def get_compile_jobs(
     mod_file: Path, windhawk_dir: Path, output_paths: dict[Architecture, Path]
-):
-    print(f'Checking {mod_file}')
-
+) -> List[CompileJob]:
     windhawk_version = get_file_version(windhawk_dir / 'windhawk.exe')
 
     compiler_path = windhawk_dir / 'Compiler' / 'bin'
@@ -573,9 +619,20 @@ def compile_mod(
         )
     mod_compatibility = mod_compatibility[0] if len(mod_compatibility) == 1 else {}
 
-    succeeded = True
+    compatibility_compiler_flags = mod_compatibility.get('compiler_flags', [])
 
-    for arch in mod_info.architectures:
+    patched_mod_code = None
+    compatibility_patches = mod_compatibility.get('patches')
+    if compatibility_patches:
+        patched_mod_code = mod_file.read_text(encoding='utf-8')
+        for search, replace in compatibility_patches:
+            patched_mod_code = re.sub(
+                search, replace, patched_mod_code, flags=re.MULTILINE
+            )
+
+    jobs = []
+
+    for arch in sorted(mod_info.architectures, key=lambda x: x.value):
         if arch == Architecture.ARM64 and windhawk_version < str_to_file_version(
             '1.6.0.0'
         ):
@@ -610,25 +667,12 @@ def compile_mod(
         if windhawk_version < str_to_file_version('1.5.0.0'):
             version_definitions = []
 
-        mod_file_for_compilation = mod_file
-        mod_file_temp = None
-
-        compatibility_compiler_flags = mod_compatibility.get('compiler_flags', [])
-        if compatibility_compiler_flags:
-            print(f'Using compatibility compiler flags: {compatibility_compiler_flags}')
-
-        compatibility_patches = mod_compatibility.get('patches')
-        if compatibility_patches:
-            print(f'Using compatibility patches: {compatibility_patches}')
-            mod_code = mod_file.read_text(encoding='utf-8')
-            for search, replace in compatibility_patches:
-                mod_code = re.sub(search, replace, mod_code, flags=re.MULTILINE)
-
-            with tempfile.NamedTemporaryFile(delete=False, suffix='.wh.cpp') as tmp:
-                mod_file_temp = Path(tmp.name)
-
-            mod_file_temp.write_text(mod_code, encoding='utf-8')
-            mod_file_for_compilation = mod_file_temp
+        link_args = [
+            '-shared',
+            engine_lib_path,
+            '-Wl,--export-all-symbols',
+            *[x for x in extra_args if x.startswith(('-l', '-Wl,'))],
+        ]
 
         compiler_args = [
             f'-std=c++{cpp_version}',
@@ -642,31 +686,329 @@ def compile_mod(
             f'-DWH_MOD_ID=L"{mod_info.id}"',
             f'-DWH_MOD_VERSION=L"{mod_info.version}"',
             engine_lib_path,
-            mod_file_for_compilation,
             '-include',
             'windhawk_api.h',
             '-target',
             compiler_target,
             '-Wl,--export-all-symbols',
-            '-o',
-            output_paths[arch],
             *extra_args,
             *compatibility_compiler_flags,
         ]
 
-        print(f'Running compiler, target: {compiler_target}, extra args: {extra_args}')
-        result = subprocess.call([compiler_path, *compiler_args])
+        jobs.append(
+            CompileJob(
+                mod_file=mod_file,
+                compiler_path=compiler_path,
+                compiler_target=compiler_target,
+                patched_mod_code=patched_mod_code,
+                compiler_args=compiler_args,
+                link_args=link_args,
+                extra_args=extra_args,
+                compatibility_compiler_flags=compatibility_compiler_flags,
+                compatibility_patches=compatibility_patches,
+                output_path=output_paths[arch],
+                windhawk_version=windhawk_version,
+            )
+        )
+
+    return jobs
+
+
+# Returns the preprocessor lines at the top of the mod code, which usually
+# include the same system and WinRT headers in many mods. Only plain
+# `#include <...>`, `#define` and `#undef` lines are taken, so that compiling
+# them into a precompiled header and then compiling the mod as usual, in
+# which they're mostly no-ops due to include guards, doesn't change the
+# meaning of the code.
+def get_leading_preprocessor_lines(mod_code: str) -> List[str]:
+    lines = []
+    inside_block_comment = False
+
+    for line in mod_code.splitlines():
+        line = line.strip()
+
+        if inside_block_comment:
+            if '*/' in line:
+                inside_block_comment = False
+            continue
+
+        if line == '' or line.startswith('//'):
+            continue
+
+        if line.startswith('/*'):
+            if '*/' not in line:
+                inside_block_comment = True
+            continue
+
+        if re.fullmatch(r'#\s*include\s*<[^>]+>\s*(//.*)?', line):
+            lines.append(re.sub(r'\s*//.*', '', line))
+            continue
+
+        if re.fullmatch(r'#\s*(define|undef)\s+\w+(\s.*)?', line) and not line.endswith(
+            '\\'
+        ):
+            lines.append(line)
+            continue
+
+        break
+
+    return lines
+
+
+def get_pch_args(job: CompileJob) -> list:
+    # The mod id and version are left out, they're different for each mod.
+    # They're fine to define only on the command line when the precompiled
+    # header is used.
+    pch_args = []
+    args = iter(job.compiler_args)
+    for arg in args:
+        if arg in job.link_args:
+            continue
+
+        if isinstance(arg, str) and arg.startswith(('-DWH_MOD_ID=', '-DWH_MOD_VERSION=')):
+            continue
+
+        if arg == '-include':
+            include = next(args)
+            if include != 'windhawk_api.h':
+                pch_args += [arg, include]
+            continue
+
+        pch_args.append(arg)
+
+    return pch_args
+
+
+g_pch_locks_lock = threading.Lock()
+g_pch_locks: dict[str, threading.Lock] = {}
+g_pch_results: dict[str, Optional[Path]] = {}
+
+
+# Builds the precompiled header for the job if it wasn't built yet, and returns
+# its path, or None if it can't be built. Mods with the same headers and flags
+# share the precompiled header.
+def get_pch(job: CompileJob, pch_dir: Path, log) -> Optional[Path]:
+    mod_code = job.patched_mod_code
+    if mod_code is None:
+        mod_code = job.mod_file.read_text(encoding='utf-8')
+
+    header_code = '\n'.join(
+        ['#include <windhawk_api.h>', *get_leading_preprocessor_lines(mod_code)]
+    ) + '\n'
+
+    pch_args = get_pch_args(job)
+
+    h = hashlib.sha256()
+    h.update(repr(job.windhawk_version).encode())
+    h.update(b'\0')
+    h.update(str(job.compiler_path).encode())
+    h.update(b'\0')
+    for arg in pch_args:
+        h.update(str(arg).encode())
+        h.update(b'\0')
+    h.update(header_code.encode('utf-8'))
+    key = h.hexdigest()
+
+    with g_pch_locks_lock:
+        lock = g_pch_locks.setdefault(key, threading.Lock())
+
+    with lock:
+        if key in g_pch_results:
+            return g_pch_results[key]
+
+        header_path = pch_dir / f'{key}.h'
+        pch_path = pch_dir / f'{key}.h.pch'
+
+        if not pch_path.exists():
+            header_path.write_text(header_code, encoding='utf-8')
+
+            pch_temp = pch_path.with_name(f'{pch_path.name}.{uuid.uuid4().hex}.tmp')
+
+            log(f'Building precompiled header, target: {job.compiler_target}')
+            process = subprocess.run(
+                [
+                    job.compiler_path,
+                    *pch_args,
+                    '-x',
+                    'c++-header',
+                    header_path,
+                    '-o',
+                    pch_temp,
+                ],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT,
+                text=True,
+                errors='replace',
+            )
+
+            if process.returncode != 0:
+                log(process.stdout.rstrip('\n'))
+                log('Failed to build precompiled header, compiling without it')
+                pch_temp.unlink(missing_ok=True)
+                g_pch_results[key] = None
+                return None
+
+            os.replace(pch_temp, pch_path)
+
+        g_pch_results[key] = pch_path
+        return pch_path
+
+
+def run_compile_job(
+    job: CompileJob, options: BuildOptions, capture_output: bool
+) -> tuple[bool, str]:
+    log_lines = []
+
+    def log(message: str):
+        if capture_output:
+            log_lines.append(message)
+        else:
+            print(message)
+
+    # Build into a unique file next to the output and move it into place when
+    # done, so that parallel jobs with the same output path don't clash.
+    output_temp = job.output_path.with_name(
+        f'{job.output_path.name}.{uuid.uuid4().hex}.tmp'
+    )
+
+    cache_path = None
+    if options.cache_dir is not None:
+        cache_path = options.cache_dir / f'{job.cache_key()}.dll'
+        if cache_path.exists():
+            log(f'Using cached output, target: {job.compiler_target}')
+            shutil.copyfile(cache_path, output_temp)
+            os.replace(output_temp, job.output_path)
+            return True, '\n'.join(log_lines)
+
+    if job.compatibility_compiler_flags:
+        log(f'Using compatibility compiler flags: {job.compatibility_compiler_flags}')
+
+    mod_file_for_compilation = job.mod_file
+    mod_file_temp = None
+
+    if job.patched_mod_code is not None:
+        log(f'Using compatibility patches: {job.compatibility_patches}')
+        with tempfile.NamedTemporaryFile(delete=False, suffix='.wh.cpp') as tmp:
+            mod_file_temp = Path(tmp.name)
+
+        mod_file_temp.write_text(job.patched_mod_code, encoding='utf-8')
+        mod_file_for_compilation = mod_file_temp
+
+    compiler_args = job.compiler_args
+
+    # The precompiled header is built and used with clang's flags, older
+    # Windhawk versions come with gcc.
+    use_pch = options.pch_dir is not None
+    if use_pch and job.compiler_path.name.lower() != 'clang++.exe':
+        log('Precompiled headers require clang, compiling without them')
+        use_pch = False
+
+    if use_pch:
+        pch_path = get_pch(job, options.pch_dir, log)
+        if pch_path is not None:
+            # The precompiled header includes windhawk_api.h.
+            compiler_args = []
+            args = iter(job.compiler_args)
+            for arg in args:
+                if arg == '-include':
+                    include = next(args)
+                    if include == 'windhawk_api.h':
+                        compiler_args += ['-include-pch', pch_path]
+                    else:
+                        compiler_args += [arg, include]
+                    continue
+
+                compiler_args.append(arg)
+
+    compiler_args = [
+        *compiler_args,
+        mod_file_for_compilation,
+        '-o',
+        output_temp,
+    ]
+
+    log(f'Running compiler, target: {job.compiler_target}, extra args: {job.extra_args}')
+    if capture_output:
+        process = subprocess.run(
+            [job.compiler_path, *compiler_args],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+            text=True,
+            errors='replace',
+        )
+        if process.stdout:
+            log(process.stdout.rstrip('\n'))
+        result = process.returncode
+    else:
+        result = subprocess.call([job.compiler_path, *compiler_args])
+
+    if mod_file_temp:
+        mod_file_temp.unlink()
+
+    if result != 0:
+        log(f'Failed to compile {job.mod_file}, target: {job.compiler_target}')
+        output_temp.unlink(missing_ok=True)
+        return False, '\n'.join(log_lines)
+
+    if cache_path is not None:
+        cache_temp = cache_path.with_name(f'{cache_path.name}.{uuid.uuid4().hex}.tmp')
+        shutil.copyfile(output_temp, cache_temp)
+        os.replace(cache_temp, cache_path)
+
+    os.replace(output_temp, job.output_path)
 
-        if mod_file_temp:
-            mod_file_temp.unlink()
+    return True, '\n'.join(log_lines)
 
-        if result != 0:
-            print(f'Failed to compile {mod_file}')
+
+def compile_mod(
+    mod_file: Path,
+    windhawk_dir: Path,
+    output_paths: dict[Architecture, Path],
+    options: BuildOptions = BuildOptions(),
+):
+    print(f'Checking {mod_file}')
+
+    succeeded = True
+
+    for job in get_compile_jobs(mod_file, windhawk_dir, output_paths):
+        job_succeeded, _ = run_compile_job(job, options, capture_output=False)
+        if not job_succeeded:
             succeeded = False
 
     return succeeded
 
 
+def compile_mods_parallel(
+    mod_files: List[Path],
+    windhawk_dir: Path,
+    output_paths: dict[Architecture, Path],
+    options: BuildOptions,
+    jobs_count: int,
+) -> List[Path]:
+    jobs = []
+    for mod_file in mod_files:
+        jobs += get_compile_jobs(mod_file, windhawk_dir, output_paths)
+
+    failed = []
+
+    with ThreadPoolExecutor(max_workers=jobs_count) as executor:
+        futures = [
+            executor.submit(run_compile_job, job, options, True) for job in jobs
+        ]
+
+        # Print the output of each job as a whole, in the submission order.
+        for job, future in zip(jobs, futures):
+            job_succeeded, output = future.result()
+            print(f'Checking {job.mod_file}')
+            if output:
+                print(output)
+
+            if not job_succeeded and job.mod_file not in failed:
+                failed.append(job.mod_file)
+
+    return failed
+
+
 def main():
     parser = argparse.ArgumentParser()
 
@@ -680,6 +1022,29 @@ def main():
     parser.add_argument('-o64', '--output-64', type=Path, required=True)
     parser.add_argument('-oarm64', '--output-arm64', type=Path, required=True)
 
+    parser.add_argument(
+        '-j',
+        '--jobs',
+        type=int,
+        default=1,
+        help='number of compilations to run in parallel, 0 for one per CPU',
+    )
+    parser.add_argument(
+        '-c',
+        '--cache-dir',
+        type=Path,
+        help='directory for caching compiled mods, which are skipped on rebuild'
+        ' if the source, the compiler flags and the patches are unchanged',
+    )
+    parser.add_argument(
+        '-p',
+        '--pch-dir',
+        type=Path,
+        help='directory for precompiled headers, which are built from the'
+        ' headers included at the top of the mods and shared between mods,'
+        ' ignored if the compiler is not clang',
+    )
+
     args = parser.parse_args()
 
     windhawk_dir: Path = args.windhawk_dir
@@ -694,11 +1059,25 @@ def main():
         Architecture.ARM64: args.output_arm64,
     }
 
+    options = BuildOptions(cache_dir=args.cache_dir, pch_dir=args.pch_dir)
+    for dir in [options.cache_dir, options.pch_dir]:
+        if dir is not None:
+            dir.mkdir(parents=True, exist_ok=True)
+
+    jobs_count: int = args.jobs
+    if jobs_count == 0:
+        jobs_count = os.cpu_count() or 1
+
     failed = []
 
-    for mod_file in mod_files:
-        if not compile_mod(mod_file, windhawk_dir, output_paths):
-            failed.append(mod_file)
+    if jobs_count > 1:
+        failed = compile_mods_parallel(
+            mod_files, windhawk_dir, output_paths, options, jobs_count
+        )
+    else:
+        for mod_file in mod_files:
+            if not compile_mod(mod_file, windhawk_dir, output_paths, options):
+                failed.append(mod_file)
 
     if failed:
         print('=' * 80)